@@ -121,6 +121,40 @@ extern "C" {
 			      uint8_t iv[16],
 			      const uint8_t *input, uint8_t *output);
 
+	/**
+	 * \brief          AES-CTR buffer encryption/decryption
+	 *
+	 * \param ctx           AES context (encryption key schedule)
+	 * \param length        length of the input data
+	 * \param nc_off        offset in the current stream_block (for
+	 *                      resuming within a block, updated after use)
+	 * \param nonce_counter 128-bit nonce and counter (updated after use)
+	 * \param stream_block  saved stream block for resuming (updated)
+	 * \param input         buffer holding the input data
+	 * \param output        buffer holding the output data
+	 *
+	 * \note           The counter is incremented as a 128-bit big-endian
+	 *                 integer; both directions use the same operation.
+	 */
+	void aes_crypt_ctr(aes_context * ctx,
+			   size_t length,
+			   size_t *nc_off,
+			   uint8_t nonce_counter[16],
+			   uint8_t stream_block[16],
+			   const uint8_t *input, uint8_t *output);
+
+	/**
+	 * \brief          AES-CTR keystream generation
+	 *
+	 * \param ctx           AES context (encryption key schedule)
+	 * \param nblocks       number of 16-byte keystream blocks
+	 * \param nonce_counter 128-bit nonce and counter (updated after use)
+	 * \param output        buffer receiving nblocks * 16 bytes
+	 */
+	void aes_ctr_keystream(aes_context * ctx,
+			       size_t nblocks,
+			       uint8_t nonce_counter[16], uint8_t *output);
+
 #if defined(TROPICSSL_SELF_TEST)
 	/**
 	 * \brief          Checkup routine
@@ -0,0 +1,125 @@
+/**
+ * \file aesce.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_AESCE_H
+#define TROPICSSL_AESCE_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_AESCE)
+#include "tropicssl/aes.h"
+
+#if defined(__GNUC__) && defined(__aarch64__) && \
+    !defined(TROPICSSL_HAVE_ARMV8)
+#define TROPICSSL_HAVE_ARMV8
+#endif
+
+#if defined(TROPICSSL_HAVE_ARMV8)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          ARMv8 Cryptography Extensions detection routine
+	 *
+	 * \return         1 if the CPU has the AES instructions, 0 otherwise
+	 */
+	int aesce_supports(void);
+
+	/**
+	 * \brief          AES key schedule (encryption) using the ARMv8
+	 *                 Cryptography Extensions
+	 *
+	 * \param rk       destination round keys (4 * (nr + 1) words)
+	 * \param key      encryption key
+	 * \param keysize  must be 128, 192 or 256
+	 */
+	void aesce_setkey_enc(uint32_t *rk, const uint8_t *key,
+			      unsigned int keysize);
+
+	/**
+	 * \brief          Compute the decryption round keys from the
+	 *                 encryption round keys
+	 *
+	 * \param invkey   destination round keys
+	 * \param fwdkey   encryption round keys
+	 * \param nr       number of rounds
+	 */
+	void aesce_inverse_key(uint32_t *invkey, const uint32_t *fwdkey,
+			       unsigned int nr);
+
+	/**
+	 * \brief          AES-ECB block encryption/decryption
+	 *
+	 * \param ctx      AES context
+	 * \param mode     AES_ENCRYPT or AES_DECRYPT
+	 * \param input    16-byte input block
+	 * \param output   16-byte output block
+	 */
+	void aesce_crypt_ecb(aes_context * ctx, int mode,
+			     const uint8_t input[16], uint8_t output[16]);
+
+	/**
+	 * \brief          AES-CBC buffer encryption/decryption
+	 *
+	 * \param ctx      AES context
+	 * \param mode     AES_ENCRYPT or AES_DECRYPT
+	 * \param length   length of the input data
+	 * \param iv       initialization vector (updated after use)
+	 * \param input    buffer holding the input data
+	 * \param output   buffer holding the output data
+	 */
+	void aesce_crypt_cbc(aes_context * ctx, int mode, size_t length,
+			     uint8_t iv[16],
+			     const uint8_t *input, uint8_t *output);
+
+	/**
+	 * \brief          AES-CTR over whole blocks
+	 *
+	 * \param ctx           AES context (encryption key schedule)
+	 * \param nblocks       number of 16-byte blocks to process
+	 * \param nonce_counter 128-bit nonce and counter (updated after use)
+	 * \param input         input data, or NULL to output the keystream
+	 * \param output        buffer holding nblocks * 16 output bytes
+	 */
+	void aesce_crypt_ctr(aes_context * ctx, size_t nblocks,
+			     uint8_t nonce_counter[16],
+			     const uint8_t *input, uint8_t *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_HAVE_ARMV8 */
+#endif              /* TROPICSSL_AESCE */
+#endif				/* aesce.h */
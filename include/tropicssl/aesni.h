@@ -0,0 +1,215 @@
+/**
+ * \file aesni.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_AESNI_H
+#define TROPICSSL_AESNI_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_AESNI)
+#include "tropicssl/aes.h"
+#if defined(TROPICSSL_SHA1)
+#include "tropicssl/sha1.h"
+#endif
+#if defined(TROPICSSL_CAMELLIA)
+#include "tropicssl/camellia.h"
+#endif
+
+#if defined(__GNUC__) && \
+    ( defined(__amd64__) || defined(__x86_64__) ) && \
+    !defined(TROPICSSL_HAVE_X86_64)
+#define TROPICSSL_HAVE_X86_64
+#endif
+
+/*
+ * CPUID leaf 1, ECX feature bits
+ */
+#define TROPICSSL_AESNI_AES             0x02000000u
+#define TROPICSSL_AESNI_CLMUL           0x00000002u
+#define TROPICSSL_AESNI_SSSE3           0x00000200u
+
+#if defined(TROPICSSL_HAVE_X86_64)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          AES-NI features detection routine
+	 *
+	 * \param what     the feature to check (TROPICSSL_AESNI_AES,
+	 *                 TROPICSSL_AESNI_CLMUL or TROPICSSL_AESNI_SSSE3)
+	 *
+	 * \return         1 if the CPU supports the feature, 0 otherwise
+	 */
+	int aesni_supports(unsigned int what);
+
+	/**
+	 * \brief          AES key schedule (encryption) using AES-NI
+	 *
+	 * \param rk       destination round keys (4 * (nr + 1) words)
+	 * \param key      encryption key
+	 * \param keysize  must be 128, 192 or 256
+	 */
+	void aesni_setkey_enc(uint32_t *rk, const uint8_t *key,
+			      unsigned int keysize);
+
+	/**
+	 * \brief          Compute the decryption round keys from the
+	 *                 encryption round keys, using AES-NI
+	 *
+	 * \param invkey   destination round keys
+	 * \param fwdkey   encryption round keys
+	 * \param nr       number of rounds
+	 */
+	void aesni_inverse_key(uint32_t *invkey, const uint32_t *fwdkey,
+			       unsigned int nr);
+
+	/**
+	 * \brief          AES-ECB block encryption/decryption using AES-NI
+	 *
+	 * \param ctx      AES context
+	 * \param mode     AES_ENCRYPT or AES_DECRYPT
+	 * \param input    16-byte input block
+	 * \param output   16-byte output block
+	 */
+	void aesni_crypt_ecb(aes_context * ctx, int mode,
+			     const uint8_t input[16], uint8_t output[16]);
+
+	/**
+	 * \brief          AES-CBC buffer encryption/decryption using AES-NI
+	 *
+	 * \param ctx      AES context
+	 * \param mode     AES_ENCRYPT or AES_DECRYPT
+	 * \param length   length of the input data
+	 * \param iv       initialization vector (updated after use)
+	 * \param input    buffer holding the input data
+	 * \param output   buffer holding the output data
+	 */
+	void aesni_crypt_cbc(aes_context * ctx, int mode, size_t length,
+			     uint8_t iv[16],
+			     const uint8_t *input, uint8_t *output);
+
+	/**
+	 * \brief          AES-CTR over whole blocks using AES-NI
+	 *
+	 * \param ctx           AES context (encryption key schedule)
+	 * \param nblocks       number of 16-byte blocks to process
+	 * \param nonce_counter 128-bit nonce and counter (updated after use)
+	 * \param input         input data, or NULL to output the keystream
+	 * \param output        buffer holding nblocks * 16 output bytes
+	 */
+	void aesni_crypt_ctr(aes_context * ctx, size_t nblocks,
+			     uint8_t nonce_counter[16],
+			     const uint8_t *input, uint8_t *output);
+
+#if defined(TROPICSSL_SHA1)
+	/**
+	 * \brief          Stitched SHA-1 update and AES-CBC encryption
+	 *
+	 * \param ctx      AES context (encryption key schedule)
+	 * \param iv       initialization vector (updated after use)
+	 * \param sha1     SHA-1 context, with no partial block buffered
+	 * \param hash_in  nblocks * 64 bytes to hash
+	 * \param aes_buf  nblocks * 64 bytes to encrypt in place
+	 * \param nblocks  number of 64-byte iterations
+	 *
+	 * \note           Each hash block is read before the AES blocks of
+	 *                 the same iteration are written, so hash_in may
+	 *                 run ahead of aes_buf within the same buffer.
+	 */
+	void aesni_cbc_sha1_enc(aes_context * ctx, uint8_t iv[16],
+				sha1_context * sha1,
+				const uint8_t *hash_in, uint8_t *aes_buf,
+				size_t nblocks);
+
+	/**
+	 * \brief          Stitched SHA-1 update and AES-CBC decryption
+	 *
+	 * \param ctx      AES context (decryption key schedule)
+	 * \param iv       initialization vector (updated after use)
+	 * \param sha1     SHA-1 context, with no partial block buffered
+	 * \param hash_in  nblocks * 64 bytes to hash
+	 * \param aes_buf  nblocks * 64 bytes to decrypt in place
+	 * \param nblocks  number of 64-byte iterations
+	 *
+	 * \note           hash_in must not overlap the part of aes_buf
+	 *                 still to be decrypted.
+	 */
+	void aesni_cbc_sha1_dec(aes_context * ctx, uint8_t iv[16],
+				sha1_context * sha1,
+				const uint8_t *hash_in, uint8_t *aes_buf,
+				size_t nblocks);
+#endif
+
+#if defined(TROPICSSL_CAMELLIA)
+	/**
+	 * \brief          Camellia-CBC decryption of sixteen blocks at a
+	 *                 time, with the AES-NI S-box (needs SSSE3 too)
+	 *
+	 * \param ctx      Camellia context (decryption key schedule)
+	 * \param length   length of the input data, a multiple of 256
+	 * \param iv       initialization vector (updated after use)
+	 * \param input    buffer holding the input data
+	 * \param output   buffer holding the output data
+	 */
+	void aesni_camellia_cbc_dec(camellia_context * ctx, size_t length,
+				    uint8_t iv[16],
+				    const uint8_t *input, uint8_t *output);
+#endif
+
+	/**
+	 * \brief          Precompute the GHASH key powers for PCLMULQDQ
+	 *
+	 * \param hp       receives H^1..H^4 in the internal layout
+	 * \param h        hash subkey H = E(K, 0^128)
+	 */
+	void aesni_gcm_powers(uint8_t hp[64], const uint8_t h[16]);
+
+	/**
+	 * \brief          GHASH update using PCLMULQDQ
+	 *
+	 * \param y        GHASH accumulator (updated)
+	 * \param hp       key powers from aesni_gcm_powers()
+	 * \param data     input blocks
+	 * \param nblocks  number of 16-byte blocks
+	 */
+	void aesni_ghash(uint8_t y[16], const uint8_t hp[64],
+			 const uint8_t *data, size_t nblocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_HAVE_X86_64 */
+#endif              /* TROPICSSL_AESNI */
+#endif				/* aesni.h */
@@ -51,6 +51,30 @@
  */
 #define TROPICSSL_MPI_MAX_LIMBS                             10000
 
+/*
+ * Number of bases mpi_exp_mod_batch() works on side by side
+ */
+#define MPI_BATCH_LANES                                     8
+
+/*
+ * Largest modulus mpi_exp_mod_fixed() keeps its table on the stack for
+ */
+#define MPI_EXP_STACK_BITS                                  2048
+
+/*
+ * Default and largest number of teeth of an mpi_comb
+ */
+#define MPI_COMB_TEETH                                      5
+#define MPI_COMB_MAX_TEETH                                  10
+
+/*
+ * Most threads mpi_gen_prime_mt() starts
+ */
+#define MPI_GEN_PRIME_MAX_THREADS                           64
+
+#define MPI_SCRATCH_MIN_LIMBS                               8
+#define MPI_SCRATCH_CLASSES                                 12
+
 /*
  * Define the base integer type, architecture-wise
  */
@@ -88,8 +112,45 @@ typedef struct {
 	int s;			/*!<  integer sign      */
 	size_t n;		/*!<  total # of limbs  */
 	t_uint *p;		/*!<  pointer to limbs  */
+	int t;			/*!<  temporary: limbs may come from
+				      the thread's workspace        */
 } mpi;
 
+/**
+ * \brief          Montgomery constants of a modulus
+ */
+typedef struct {
+	size_t n;		/*!<  # of limbs of N   */
+	size_t nbits;		/*!<  size(N) in bits   */
+	size_t wsize;		/*!<  window size       */
+	t_uint mm;		/*!<  -N^-1 mod 2^biL   */
+	mpi RR;			/*!<  R^2 mod N         */
+	mpi RRR;		/*!<  R^3 mod N         */
+	mpi RI;			/*!<  R'^2 mod N, R' = 2^(52k), if the
+				      IFMA kernel is to be used     */
+} mpi_mont;
+
+/**
+ * \brief          Fixed-base comb of a base G under a modulus N: entry j
+ *                 of T is the product of G^(2^(i * d)) over the bits i
+ *                 set in j, times R mod N (Lim-Lee, HAC 14.113)
+ */
+typedef struct {
+	size_t n;		/*!<  # of limbs of N   */
+	size_t teeth;		/*!<  bits per column   */
+	size_t d;		/*!<  tooth spacing     */
+	t_uint *T;		/*!<  2^teeth entries   */
+} mpi_comb;
+
+typedef struct {
+	t_uint *buf;		/*!<  storage           */
+	size_t len;		/*!<  # of limbs of buf */
+	size_t used;		/*!<  # of limbs carved */
+	size_t spills;		/*!<  # of heap fallbacks */
+	t_uint *free[MPI_SCRATCH_CLASSES];	/*!<  released blocks,
+						      by size class  */
+} mpi_scratch;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -99,11 +160,51 @@ extern "C" {
 	 */
 	void mpi_init(mpi * X, ...);
 
+	/**
+	 * \brief          Initialize one or more temporaries: like
+	 *                 mpi_init(), but their limbs come from the
+	 *                 calling thread's workspace when it has one
+	 *
+	 * \note           A temporary must be freed by the thread that
+	 *                 grew it, while the same workspace is set, and
+	 *                 must not be swapped into a longer lived mpi.
+	 */
+	void mpi_init_tmp(mpi * X, ...);
+
 	/**
 	 * \brief          Unallocate one or more mpi
 	 */
 	void mpi_free(mpi * X, ...);
 
+	/**
+	 * \brief          Initialize a workspace for temporaries
+	 *
+	 * \param S        workspace to be initialized
+	 * \param buf      storage, eg. a static or stack array
+	 * \param len      number of limbs of buf
+	 *
+	 * \note           Blocks are carved from buf by size class
+	 *                 (powers of two times MPI_SCRATCH_MIN_LIMBS, plus
+	 *                 a header limb) and recycled on release, so
+	 *                 once a loop of RSA or DH operations has run
+	 *                 once, the next ones do no heap allocation.
+	 *                 About 4096 limbs cover RSA-2048 and 2048-bit
+	 *                 DH; S->spills counts what did not fit and went
+	 *                 to the heap instead.
+	 */
+	void mpi_scratch_init(mpi_scratch * S, t_uint * buf, size_t len);
+
+	/**
+	 * \brief          Make the calling thread take its temporaries
+	 *                 from a workspace
+	 *
+	 * \param S        workspace, or NULL to go back to the heap
+	 *
+	 * \note           The workspace is not locked: give each thread
+	 *                 its own.
+	 */
+	void mpi_set_scratch(mpi_scratch * S);
+
 	/**
 	 * \brief          Enlarge to the specified number of limbs
 	 *
@@ -391,17 +492,158 @@ extern "C" {
 	int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR);
 
 	/**
-	 * \brief          Fill an MPI X with size bytes of random
+	 * \brief          Batch exponentiation: X[i] = A[i]^E mod N
+	 *                 for 0 <= i < count, under one exponent
+	 *
+	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if N is negative or even
+	 *
+	 * \note           The bases are processed MPI_BATCH_LANES at a time,
+	 *                 limb-interleaved, so that every Montgomery step runs
+	 *                 across all lanes at once. The exponent is scanned in
+	 *                 fixed windows, the same sequence for every base.
+	 *                 _RR is as for mpi_exp_mod().
+	 */
+	int mpi_exp_mod_batch(mpi * X, const mpi * A, int count, const mpi * E,
+			      const mpi * N, mpi * _RR);
+
+	/**
+	 * \brief          Precompute the Montgomery constants of N
+	 *
+	 * \param M        constants to fill in, zeroed or previously set up
+	 * \param N        odd, positive modulus
+	 *
+	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if N is not positive or even
+	 */
+	int mpi_mont_init(mpi_mont * M, const mpi * N);
+
+	/**
+	 * \brief          Set up the Montgomery constants of N from the RR
+	 *                 and RRR of an earlier mpi_mont_init(), eg. as
+	 *                 saved in a key snapshot
+	 *
+	 * \param M        constants to fill in, zeroed or previously set up
+	 * \param N        odd, positive modulus
+	 * \param RR       R^2 mod N
+	 * \param RRR      R^3 mod N
+	 * \param RI       R'^2 mod N for the IFMA kernel, or NULL or 0 to
+	 *                 have it computed when this CPU needs it
+	 *
+	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if N is not positive or even,
+	 *                 or RR or RRR is not reduced mod N
+	 *
+	 * \note           R depends on the limb size (biL): the values must
+	 *                 come from a build with the same limbs.
+	 */
+	int mpi_mont_import(mpi_mont * M, const mpi * N, const mpi * RR,
+			    const mpi * RRR, const mpi * RI);
+
+	/**
+	 * \brief          Unallocate the Montgomery constants
+	 */
+	void mpi_mont_free(mpi_mont * M);
+
+	/**
+	 * \brief          Fixed-window exponentiation: X = A^E mod N
+	 *
+	 * \param M        constants of N, from mpi_mont_init()
+	 *
+	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if M is unset or A < 0
+	 *
+	 * \note           The sequence of operations and memory accesses
+	 *                 depends only on the sizes of N and E, not on the
+	 *                 bits of A or E. Moduli up to MPI_EXP_STACK_BITS
+	 *                 need no allocation, bases up to the size of N^2
+	 *                 no division. M is only read, so several threads
+	 *                 may share it.
+	 */
+	int mpi_exp_mod_fixed(mpi * X, const mpi * A, const mpi * E,
+			      const mpi * N, const mpi_mont * M);
+
+	/**
+	 * \brief          Montgomery multiplication: X = A * B * R^-1 mod N,
+	 *                 R being 2^(biL * M->n)
+	 *
+	 * \param M        constants of N, from mpi_mont_init()
+	 *
+	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if M is unset or
+	 *                 A or B is not in [0, N)
+	 *
+	 * \note           Values kept multiplied by R (A * R is
+	 *                 mpi_mont_mul(A, M->RR)) can then be multiplied
+	 *                 with no division at all.
+	 */
+	int mpi_mont_mul(mpi * X, const mpi * A, const mpi * B,
+			 const mpi * N, const mpi_mont * M);
+
+	/**
+	 * \brief          Precompute the comb of a fixed base G, for
+	 *                 exponents of up to ebits bits
+	 *
+	 * \param C        comb to fill in, zeroed or previously set up
+	 * \param G        base, 0 <= G
+	 * \param ebits    max. size of the exponents in bits
+	 * \param teeth    bits per column, 1 to MPI_COMB_MAX_TEETH, or 0
+	 *                 for MPI_COMB_TEETH; the table takes 2^teeth
+	 *                 times the size of N
+	 * \param M        constants of N, from mpi_mont_init()
+	 *
+	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if M is unset or
+	 *                 G or teeth is out of range
+	 */
+	int mpi_comb_init(mpi_comb * C, const mpi * G, size_t ebits,
+			  size_t teeth, const mpi * N, const mpi_mont * M);
+
+	/**
+	 * \brief          Unallocate a comb
+	 */
+	void mpi_comb_free(mpi_comb * C);
+
+	/**
+	 * \brief          Fixed-base exponentiation: X = G^E mod N, with
+	 *                 the comb C of G
+	 *
+	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if C does not match M,
+	 *                 or E is negative or longer than C allows
+	 *
+	 * \note           It takes d squarings and d multiplications for
+	 *                 d = ebits / teeth, against about ebits squarings
+	 *                 for mpi_exp_mod(). As in mpi_exp_mod_fixed(), every
+	 *                 entry of the table is read on every step, and C
+	 *                 may be shared by several threads.
+	 */
+	int mpi_exp_mod_comb(mpi * X, const mpi * E, const mpi * N,
+			     const mpi_mont * M, const mpi_comb * C);
+
+	/**
+	 * \brief          Fill an MPI X with size limbs of random, taken
+	 *                 from f_rng in a single request
 	 *
 	 * \param X        Destination MPI
-	 * \param size     Size in bytes
+	 * \param size     Size in limbs
 	 * \param f_rng    RNG function
 	 * \param p_rng    RNG parameter
 	 *
 	 * \return         TROPICSSL_ERR_MPI_OKAY if successful,
-	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed
+	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
+	 *                 or the error returned by f_rng
 	 */
-	int mpi_fill_random(mpi * X, size_t size, int (*f_rng)(void *), void *p_rng);
+	int mpi_fill_random(mpi * X, size_t size,
+			    int (*f_rng) (void *, uint8_t *, size_t),
+			    void *p_rng);
 
 	/**
 	 * \brief          Greatest common divisor: G = gcd(A, B)
@@ -428,7 +670,9 @@ extern "C" {
 	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
 	 *                 TROPICSSL_ERR_MPI_NOT_ACCEPTABLE if X is not prime
 	 */
-	int mpi_is_prime(mpi * X, int (*f_rng) (void *), void *p_rng);
+	int mpi_is_prime(mpi * X,
+			 int (*f_rng) (void *, uint8_t *, size_t),
+			 void *p_rng);
 
 	/**
 	 * \brief          Prime number generation
@@ -442,9 +686,38 @@ extern "C" {
 	 * \return         TROPICSSL_ERR_MPI_OKAY if successful (probably prime),
 	 *                 TROPICSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed,
 	 *                 TROPICSSL_ERR_MPI_BAD_INPUT_DATA if nbits is < 3
+	 *
+	 * \note           Candidates are sieved by the odd primes below
+	 *                 2^14 a window at a time before Miller-Rabin.
 	 */
 	int mpi_gen_prime(mpi * X, size_t nbits, int dh_flag,
-			  int (*f_rng) (void *), void *p_rng);
+			  int (*f_rng) (void *, uint8_t *, size_t),
+			  void *p_rng);
+
+	/**
+	 * \brief          Prime number generation on several threads
+	 *
+	 * \param X        destination mpi
+	 * \param nbits    required size of X in bits
+	 * \param dh_flag  if 1, then (X-1)/2 will be prime too
+	 * \param threads  number of searches to run at once, at most
+	 *                 MPI_GEN_PRIME_MAX_THREADS
+	 * \param f_rng    RNG function
+	 * \param p_rng    RNG parameter
+	 *
+	 * \return         as for mpi_gen_prime()
+	 *
+	 * \note           Each thread searches from a random start of
+	 *                 its own, and the first prime found is kept.
+	 *                 f_rng is shared between them, behind a lock,
+	 *                 so it need not be thread-safe; it must not be
+	 *                 used elsewhere meanwhile. Without
+	 *                 TROPICSSL_GENPRIME_MT (or on Win32), this is
+	 *                 mpi_gen_prime().
+	 */
+	int mpi_gen_prime_mt(mpi * X, size_t nbits, int dh_flag, int threads,
+			     int (*f_rng) (void *, uint8_t *, size_t),
+			     void *p_rng);
 
 #if defined(TROPICSSL_SELF_TEST)
 	/**
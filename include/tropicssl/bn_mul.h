@@ -729,4 +729,17 @@
 #endif /* C (generic)  */
 #endif /* C (longlong) */
 
+/*
+ * Operand sizes, in limbs, from which Karatsuba beats schoolbook
+ * multiplication and squaring; the schoolbook squaring being the
+ * cheaper of the two, it holds out longer
+ */
+#if !defined(MPI_KARATSUBA_CUTOFF)
+#define MPI_KARATSUBA_CUTOFF        32
+#endif
+
+#if !defined(MPI_KARATSUBA_SQR_CUTOFF)
+#define MPI_KARATSUBA_SQR_CUTOFF    96
+#endif
+
 #endif /* bn_mul.h */
@@ -0,0 +1,171 @@
+/**
+ * \file bn_x86.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_BN_X86_H
+#define TROPICSSL_BN_X86_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_BN_X86)
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#if defined(__GNUC__) && \
+    ( defined(__amd64__) || defined(__x86_64__) ) && \
+    !defined(TROPICSSL_HAVE_X86_64)
+#define TROPICSSL_HAVE_X86_64
+#endif
+
+/*
+ * Feature sets, as reported by bn_x86_supports()
+ */
+#define TROPICSSL_BN_X86_ADX            0x01u	/* BMI2 MULX, ADCX/ADOX  */
+#define TROPICSSL_BN_X86_IFMA           0x02u	/* AVX-512F, AVX-512IFMA */
+
+/*
+ * Largest moduli the Montgomery kernels below take, in 32-bit limbs
+ */
+#define BN_X86_MAX_LIMBS                256
+#define BN_X86_IFMA_MAX_BITS            2048
+
+/*
+ * Below this, the conversions to and from radix 2^52 cost more
+ * than the IFMA kernel saves over the ADX one
+ */
+#define BN_X86_IFMA_MIN_BITS            768
+
+/*
+ * Operand size, in limbs, from which Karatsuba beats the ADX
+ * schoolbook multiplication
+ */
+#if !defined(BN_X86_KARATSUBA_CUTOFF)
+#define BN_X86_KARATSUBA_CUTOFF         192
+#endif
+
+#if defined(TROPICSSL_HAVE_X86_64)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Bignum instruction set detection routine
+	 *
+	 * \param what     TROPICSSL_BN_X86_ADX or TROPICSSL_BN_X86_IFMA
+	 *
+	 * \return         1 if the CPU (and OS) support the feature, 0 otherwise
+	 */
+	int bn_x86_supports(unsigned int what);
+
+	/**
+	 * \brief          Multiplication using MULX/ADCX/ADOX:
+	 *                 d[0 .. an + bn - 1] = a * b
+	 *
+	 * \param d        destination, an + bn limbs, not a nor b
+	 * \param a        an limbs
+	 * \param an       number of limbs of a, even
+	 * \param b        bn limbs
+	 * \param bn       number of limbs of b, even
+	 *
+	 * \note           Limbs are 32 bits and little-endian; the kernels
+	 *                 work on pairs of them as 64-bit words.
+	 */
+	void bn_x86_mul_adx(uint32_t *d, const uint32_t *a, size_t an,
+			    const uint32_t *b, size_t bn);
+
+	/**
+	 * \brief          Montgomery multiplication using MULX/ADCX/ADOX:
+	 *                 d = a * b * 2^(-32n) mod N
+	 *
+	 * \param d        destination, n limbs, may be a or b
+	 * \param a        n limbs, a < N
+	 * \param b        n limbs, b < N
+	 * \param N        odd modulus, n limbs
+	 * \param n        number of limbs, even, at most BN_X86_MAX_LIMBS
+	 *
+	 * \note           The final subtraction is done by mask.
+	 */
+	void bn_x86_montmul_adx(uint32_t *d, const uint32_t *a,
+				const uint32_t *b, const uint32_t *N,
+				size_t n);
+
+	/**
+	 * \brief          Montgomery squaring using MULX/ADCX/ADOX:
+	 *                 d = a^2 * 2^(-32n) mod N
+	 *
+	 * \param d        destination, n limbs, may be a
+	 * \param a        n limbs, a < N
+	 * \param N        odd modulus, n limbs
+	 * \param n        number of limbs, even, at most BN_X86_MAX_LIMBS
+	 */
+	void bn_x86_montsqr_adx(uint32_t *d, const uint32_t *a,
+				const uint32_t *N, size_t n);
+
+	/**
+	 * \brief          Number of 52-bit digits for a modulus of nbits,
+	 *                 such that 2^(52 * digits) > 4N
+	 */
+	size_t bn_x86_ifma_digits(size_t nbits);
+
+	/**
+	 * \brief          Fixed-window exponentiation using AVX-512 IFMA:
+	 *                 X = A^E mod N
+	 *
+	 * \param X        destination, n + 1 limbs, X < 2N
+	 * \param A        n limbs, A < N
+	 * \param E        exponent limbs
+	 * \param en       number of limbs of E
+	 * \param ebits    number of exponent bits to go through
+	 * \param N        odd modulus, n limbs, at most BN_X86_IFMA_MAX_BITS
+	 * \param RR       2^(104 * bn_x86_ifma_digits(nbits)) mod N, n limbs
+	 * \param n        number of limbs
+	 * \param nbits    size(N) in bits
+	 * \param wsize    window size, 1 to 5
+	 *
+	 * \note           Everything is done in radix 2^52, with a Montgomery
+	 *                 constant of its own, so the conversions happen only
+	 *                 once per exponentiation. Every window multiplies by
+	 *                 a table entry, and every entry is read each time.
+	 */
+	void bn_x86_exp_mod_ifma(uint32_t *X, const uint32_t *A,
+				 const uint32_t *E, size_t en, size_t ebits,
+				 const uint32_t *N, const uint32_t *RR,
+				 size_t n, size_t nbits, size_t wsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_HAVE_X86_64 */
+#endif              /* TROPICSSL_BN_X86 */
+#endif				/* bn_x86.h */
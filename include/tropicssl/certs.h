@@ -49,6 +49,7 @@ extern "C" {
 	extern const char test_srv_key[];
 	extern const char test_cli_crt[];
 	extern const char test_cli_key[];
+	extern const char test_ca_crl[];
 
 #ifdef __cplusplus
 }
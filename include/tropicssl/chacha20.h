@@ -0,0 +1,110 @@
+/**
+ * \file chacha20.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_CHACHA20_H
+#define TROPICSSL_CHACHA20_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_CHACHA20)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && \
+    ( defined(__amd64__) || defined(__x86_64__) ) && \
+    !defined(TROPICSSL_HAVE_X86_64)
+#define TROPICSSL_HAVE_X86_64
+#endif
+
+/**
+ * \brief          ChaCha20 context structure
+ */
+typedef struct {
+	uint32_t state[16];	/*!<  constants, key, counter, nonce */
+	uint8_t keystream[64];	/*!<  current keystream block        */
+	size_t left;		/*!<  unused bytes of keystream      */
+	int simd;		/*!<  vector code to use (0: none)   */
+} chacha20_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          ChaCha20 key schedule
+	 *
+	 * \param ctx      ChaCha20 context to be initialized
+	 * \param key      the 256-bit key
+	 */
+	void chacha20_setkey(chacha20_context * ctx, const uint8_t key[32]);
+
+	/**
+	 * \brief          Start a ChaCha20 keystream (RFC 7539)
+	 *
+	 * \param ctx      ChaCha20 context
+	 * \param nonce    the 96-bit nonce
+	 * \param counter  initial block counter
+	 */
+	void chacha20_starts(chacha20_context * ctx, const uint8_t nonce[12],
+			     uint32_t counter);
+
+	/**
+	 * \brief          ChaCha20 encryption/decryption
+	 *
+	 * \param ctx      ChaCha20 context
+	 * \param length   length of the input data
+	 * \param input    buffer holding the input data
+	 * \param output   buffer holding the output data
+	 *
+	 * \note           output may be equal to input. Whole blocks go
+	 *                 through the SSE2, AVX2 or NEON code when the
+	 *                 CPU has it.
+	 */
+	void chacha20_update(chacha20_context * ctx, size_t length,
+			     const uint8_t *input, uint8_t *output);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int chacha20_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_CHACHA20 */
+#endif				/* chacha20.h */
@@ -0,0 +1,126 @@
+/**
+ * \file chachapoly.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_CHACHAPOLY_H
+#define TROPICSSL_CHACHAPOLY_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_CHACHAPOLY)
+#include "tropicssl/chacha20.h"
+
+#define CHACHAPOLY_ENCRYPT     1
+#define CHACHAPOLY_DECRYPT     0
+
+/**
+ * \brief          ChaCha20-Poly1305 context structure
+ */
+typedef struct {
+	chacha20_context chacha;	/*!<  ChaCha20 keyed context */
+} chachapoly_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          ChaCha20-Poly1305 key setup
+	 *
+	 * \param ctx      context to be initialized
+	 * \param key      the 256-bit key
+	 */
+	void chachapoly_setkey(chachapoly_context * ctx,
+			       const uint8_t key[32]);
+
+	/**
+	 * \brief          ChaCha20-Poly1305 buffer encryption/decryption
+	 *                 with tag (RFC 7539 AEAD construction)
+	 *
+	 * \param ctx      ChaCha20-Poly1305 context
+	 * \param mode     CHACHAPOLY_ENCRYPT or CHACHAPOLY_DECRYPT
+	 * \param length   length of the input data
+	 * \param nonce    the 96-bit nonce
+	 * \param add      additional data
+	 * \param add_len  length of the additional data
+	 * \param input    buffer holding the input data
+	 * \param output   buffer holding the output data
+	 * \param tag      buffer receiving the 16-byte tag
+	 *
+	 * \note           On decryption the computed tag is returned and
+	 *                 must be compared by the caller;
+	 *                 chachapoly_auth_decrypt() does this in constant
+	 *                 time. output may be equal to input.
+	 */
+	void chachapoly_crypt_and_tag(chachapoly_context * ctx, int mode,
+				      size_t length, const uint8_t nonce[12],
+				      const uint8_t *add, size_t add_len,
+				      const uint8_t *input, uint8_t *output,
+				      uint8_t tag[16]);
+
+	/**
+	 * \brief          ChaCha20-Poly1305 buffer authenticated
+	 *                 decryption
+	 *
+	 * \param ctx      ChaCha20-Poly1305 context
+	 * \param length   length of the input data
+	 * \param nonce    the 96-bit nonce
+	 * \param add      additional data
+	 * \param add_len  length of the additional data
+	 * \param tag      expected 16-byte tag
+	 * \param input    buffer holding the ciphertext
+	 * \param output   buffer holding the plaintext
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_CHACHAPOLY_AUTH_FAILED if the tag
+	 *                 does not match (output is left untouched)
+	 */
+	int chachapoly_auth_decrypt(chachapoly_context * ctx, size_t length,
+				    const uint8_t nonce[12],
+				    const uint8_t *add, size_t add_len,
+				    const uint8_t tag[16],
+				    const uint8_t *input, uint8_t *output);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int chachapoly_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_CHACHAPOLY */
+#endif				/* chachapoly.h */
@@ -78,6 +78,14 @@
  */
 #define TROPICSSL_DEBUG_MSG
 
+/*
+ * Uncomment to compile the static tracepoints listed in
+ * include/tropicssl/trace.h as USDT probes, for bpftrace or perf on
+ * live processes. Requires <sys/sdt.h> (systemtap-sdt-dev).
+ *
+#define TROPICSSL_USDT
+ */
+
 /*
  * Enable the checkup functions (*_self_test).
  */
@@ -88,11 +96,24 @@
  */
 #define TROPICSSL_GENPRIME
 
+/*
+ * Enable mpi_gen_prime_mt() and rsa_gen_key_mt(), which search for
+ * primes on several POSIX threads at once.
+ */
+#define TROPICSSL_GENPRIME_MT
+
 /*
  * Uncomment to enable FileSystem operation.
  */
 #define TROPICSSL_FS_IO
 
+/*
+ * Enable x509parse_crtpath(), which maps PEM bundles or whole
+ * directories of certificates and parses them on several POSIX
+ * threads at once. Requires TROPICSSL_FS_IO.
+ */
+#define TROPICSSL_X509_CRTPATH
+
 /*
  * Uncomment this macro to store the AES tables in ROM.
  *
@@ -110,6 +131,24 @@
  */
 #define TROPICSSL_AES
 
+/*
+ * Module:  library/aesni.c
+ * Caller:  library/aes.c
+ *
+ * This module adds AES-NI support on x86-64; it is selected at run
+ * time by aes_setkey_enc() and aes_setkey_dec() when CPUID reports it.
+ */
+#define TROPICSSL_AESNI
+
+/*
+ * Module:  library/aesce.c
+ * Caller:  library/aes.c
+ *
+ * This module adds support for the ARMv8 Cryptography Extensions;
+ * it is selected at run time when the CPU reports them.
+ */
+#define TROPICSSL_AESCE
+
 /*
  * Module:  library/arc4.c
  * Caller:  library/ssl_tls.c
@@ -139,11 +178,33 @@
  */
 #define TROPICSSL_BIGNUM
 
+/*
+ * Module:  library/bn_x86.c
+ * Caller:  library/bignum.c
+ *
+ * This module adds MULX/ADCX/ADOX and AVX-512 IFMA bignum kernels
+ * for x86-64; each is selected at run time when the CPU reports it.
+ */
+#define TROPICSSL_BN_X86
+
+/*
+ * Module:  library/bignum.c
+ * Caller:  library/bignum.c
+ *
+ * This option adds Montgomery multiplication and squaring kernels
+ * unrolled for 1024, 2048, 3072 and 4096-bit moduli, used when the
+ * x86-64 kernels are not; each size adds a few KB of code.
+ */
+#define TROPICSSL_BN_FIXED
+
 /*
  * Module:  library/camellia.c
  * Caller:
  *
  * This module enabled the following cipher suites:
+ *
+ * With TROPICSSL_AESNI, CBC decryption runs sixteen blocks at a time
+ * on the AES-NI S-box.
  */
 #define TROPICSSL_CAMELLIA
 
@@ -155,6 +216,15 @@
  */
 #define TROPICSSL_CERTS
 
+/*
+ * Module:  library/ctr_drbg.c
+ * Caller:
+ *
+ * This module provides the AES-256 CTR_DRBG random generator, seeded
+ * from an entropy source such as HAVEGE. Requires TROPICSSL_AES.
+ */
+#define TROPICSSL_CTR_DRBG_C
+
 /*
  * Module:  library/debug.c
  * Caller:  library/ssl_cli.c
@@ -172,6 +242,9 @@
  * This module enables the following ciphersuites:
  *      SSL_RSA_DES_168_SHA
  *      SSL_EDH_RSA_DES_168_SHA
+ *
+ * 3DES-CBC decryption of 64 blocks or more is bitsliced (GCC on
+ * x86-64 or NEON targets).
  */
 #define TROPICSSL_DES
 
@@ -186,6 +259,76 @@
  */
 #define TROPICSSL_DHM
 
+/*
+ * Module:  library/ecp.c
+ * Caller:  library/ssl_cli.c
+ *          library/ssl_srv.c
+ *
+ * This module provides the P-256 curve and ECDH, and enables the
+ * following ciphersuites (TLS 1.0 and up):
+ *      TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA
+ *      TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA
+ *      TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA
+ */
+#define TROPICSSL_ECP
+
+/*
+ * Module:  library/gcm.c
+ * Caller:  library/ssl_tls.c
+ *
+ * Requires: TROPICSSL_AES
+ *
+ * This module enables the following ciphersuites (TLS 1.2 only):
+ *      TLS_RSA_WITH_AES_128_GCM_SHA256
+ *      TLS_RSA_WITH_AES_256_GCM_SHA384
+ *      TLS_DHE_RSA_WITH_AES_128_GCM_SHA256
+ *      TLS_DHE_RSA_WITH_AES_256_GCM_SHA384
+ */
+#define TROPICSSL_GCM
+
+/*
+ * Module:  library/chacha20.c
+ * Caller:  library/chachapoly.c
+ *
+ * This module adds the ChaCha20 stream cipher, four blocks at a time
+ * in SSE2 or NEON and eight in AVX2 when the CPU reports it.
+ */
+#define TROPICSSL_CHACHA20
+
+/*
+ * Module:  library/poly1305.c
+ * Caller:  library/chachapoly.c
+ *
+ * This module adds the Poly1305 one-time authenticator, two blocks
+ * at a time in SSE2 or NEON.
+ */
+#define TROPICSSL_POLY1305
+
+/*
+ * Module:  library/chachapoly.c
+ * Caller:  library/ssl_tls.c
+ *
+ * Requires: TROPICSSL_CHACHA20, TROPICSSL_POLY1305
+ *
+ * This module enables the following ciphersuites (TLS 1.2 only):
+ *      TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+ *      TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+ *
+ * These are fast and constant-time without AES hardware; see
+ * ssl_set_prioritize_chacha().
+ */
+#define TROPICSSL_CHACHAPOLY
+
+/*
+ * Module:  library/entropy.c
+ * Caller:
+ *
+ * This module provides a locked entropy pool fed by RDSEED/RDRAND
+ * and getrandom(), with HAVEGE as a fallback, per-thread CTR_DRBGs
+ * seeded from it and a background reseeder. Requires TROPICSSL_SHA2.
+ */
+#define TROPICSSL_ENTROPY
+
 /*
  * Module:  library/havege.c
  * Caller:
@@ -203,6 +346,18 @@
  */
 #define TROPICSSL_MD5
 
+/*
+ * Module:  library/memory.c
+ * Caller:  library/bignum.c
+ *          library/ssl_tls.c
+ *          library/x509parse.c
+ *
+ * This module routes the library's allocations through a per-thread
+ * hook, and provides an arena allocator for it; without it, they go
+ * straight to malloc() and free().
+ */
+#define TROPICSSL_MEMORY
+
 /*
  * Module:  library/net.c
  * Caller:
@@ -235,20 +390,135 @@
 
 /*
  * Module:  library/sha2.c
- * Caller:
+ * Caller:  library/ssl_tls.c
  *
  * This module adds support for SHA-224 and SHA-256.
+ * It is required for TLSv1.2 (PRF and SHA256 ciphersuites).
  */
 #define TROPICSSL_SHA2
 
+/*
+ * Module:  library/shani.c
+ * Caller:  library/sha1.c
+ *          library/sha2.c
+ *
+ * This module adds SHA-1 and SHA-256 through the x86-64 SHA
+ * extensions, with an SSSE3/AVX2 SHA-256 message schedule for older
+ * CPUs; it is selected at run time when CPUID reports them.
+ */
+#define TROPICSSL_SHANI
+
+/*
+ * Module:  library/shace.c
+ * Caller:  library/sha1.c
+ *          library/sha2.c
+ *
+ * This module adds SHA-1 and SHA-256 through the ARMv8 SHA1 and
+ * SHA256 instructions; it is selected at run time when the CPU
+ * reports them.
+ */
+#define TROPICSSL_SHACE
+
+/*
+ * Module:  library/hashmb.c
+ * Caller:  programs/hash/sha2sum.c
+ *
+ * This module hashes batches of independent messages with MD5, SHA-1
+ * or SHA-256, eight at a time in AVX2 lanes when the CPU has them.
+ */
+#define TROPICSSL_HASHMB
+
+/*
+ * Module:  library/treehash.c
+ * Caller:  programs/hash/md5sum.c
+ *          programs/hash/sha1sum.c
+ *          programs/hash/sha2sum.c
+ *
+ * This module adds a chunked tree digest of MD5, SHA-1 or SHA-256,
+ * computed on several POSIX threads over a mapped file.
+ */
+#define TROPICSSL_TREEHASH
+
 /*
  * Module:  library/sha4.c
- * Caller:
+ * Caller:  library/ssl_tls.c
  *
  * This module adds support for SHA-384 and SHA-512.
+ * It is required for TLSv1.2 (SHA384 ciphersuites).
  */
 #define TROPICSSL_SHA4
 
+/*
+ * Module:  library/ssl_cache.c
+ * Caller:
+ *
+ * This module provides a thread-safe session cache for
+ * ssl_set_scb(), keyed by session id on servers and by server name
+ * and port on clients; it uses POSIX threads (or Win32 critical
+ * sections) for its locks.
+ */
+#define TROPICSSL_SSL_CACHE_C
+
+/*
+ * Module:  library/ssl_ticket.c
+ * Caller:
+ *
+ * This module provides RFC 5077 session ticket keys for
+ * ssl_set_ticket_cb(), so that servers resume sessions without
+ * keeping them. Requires TROPICSSL_AES and TROPICSSL_SHA2.
+ */
+#define TROPICSSL_SSL_TICKET_C
+
+/*
+ * Module:  library/ssl_sni.c
+ * Caller:
+ *
+ * This module maps server_name host names (exact or "*.domain")
+ * to certificates for ssl_set_sni(), so that a server can host
+ * several names on one port.
+ */
+#define TROPICSSL_SSL_SNI_C
+
+/*
+ * Module:  library/ssl_admit.c
+ * Caller:  programs/ssl/ssl_server2.c
+ *
+ * This module provides a token bucket for ssl_set_admission(), so
+ * that under load full handshakes wait or are refused while
+ * resumptions and established connections go on; it uses POSIX
+ * threads (or Win32 critical sections) for its lock.
+ */
+#define TROPICSSL_SSL_ADMIT_C
+
+/*
+ * Module:  library/ssl_shm_cache.c
+ * Caller:  programs/ssl/ssl_server2.c
+ *
+ * This module keeps server session ids in a shared mapping, so that
+ * forked workers (or separate processes on one host) resume each
+ * other's sessions. It requires POSIX mmap and the GCC atomic builtins.
+ */
+#define TROPICSSL_SSL_SHM_CACHE_C
+
+/*
+ * Module:  library/mem_bio.c
+ * Caller:  programs/test/ssl_bench.c
+ *
+ * This module provides ring buffers for ssl_set_bio(), to connect
+ * two contexts in memory or run TLS over a userspace transport.
+ */
+#define TROPICSSL_MEM_BIO_C
+
+/*
+ * Module:  library/ssl_engine.c
+ * Caller:  programs/ssl/ssl_server2.c
+ *
+ * This module drives many non-blocking SSL/TLS connections from one
+ * thread, with epoll (Linux) or kqueue (BSD, Mac OS X). Requires
+ * TROPICSSL_NET.
+ */
+#define TROPICSSL_SSL_ENGINE_C
+
 /*
  * Module:  library/ssl_cli.c
  * Caller:
@@ -274,14 +544,45 @@
  */
 #define TROPICSSL_SSL_TLS_C
 
+/*
+ * Let ssl_set_ktls() hand the record layer of TLS 1.2 AES-GCM
+ * connections to the kernel once the handshake is over (Linux
+ * kernel TLS; elsewhere, or without the tls module, records stay
+ * in userspace). Requires TROPICSSL_NET and TROPICSSL_GCM.
+ */
+#define TROPICSSL_SSL_KTLS
+
+/*
+ * Let ssl_set_compression() negotiate DEFLATE record compression
+ * (RFC 3749) through zlib; programs then link with -lz. Off by
+ * default: it only belongs on links where both ends and all the
+ * traffic are trusted (see CRIME).
+ *
+#define TROPICSSL_ZLIB_SUPPORT
+ */
+
 /*
  * Module:  library/timing.c
  * Caller:  library/havege.c
+ *          library/ssl_cli.c
+ *          library/ssl_srv.c
+ *          library/ssl_tls.c
  *
- * This module is used by the HAVEGE random number generator.
+ * This module is used by the HAVEGE random number generator,
+ * by the SSL/TLS counters below and to restart dynamic record
+ * sizing after an idle period.
  */
 #define TROPICSSL_TIMING
 
+/*
+ * Keep per-context SSL/TLS counters: records and bytes, time spent
+ * in each handshake state and in public key operations, session
+ * resumption and buffer use (see ssl_get_stats() and
+ * ssl_set_stats_sink()). Requires TROPICSSL_TIMING; the sinks use
+ * POSIX threads (or Win32 critical sections) for their lock.
+ */
+#define TROPICSSL_SSL_STATS
+
 /*
  * Module:  library/x509parse.c
  * Caller:  library/ssl_cli.c
@@ -292,6 +593,53 @@
  */
 #define TROPICSSL_X509_PARSE
 
+/*
+ * Module:  library/x509parse.c
+ * Caller:
+ *
+ * This lets x509_set_verify_cache() skip the signature checks of
+ * a chain the same CA chain verified before. Requires
+ * TROPICSSL_SHA2; it uses POSIX threads (or Win32 critical sections)
+ * for its lock.
+ */
+#define TROPICSSL_X509_VERIFY_CACHE
+
+/*
+ * Module:  library/x509parse.c
+ * Caller:  library/ssl_tls.c
+ *
+ * This module keeps parsed peer certificate chains for
+ * ssl_set_crt_cache(), shared by reference between connections.
+ * Requires TROPICSSL_SHA2; it uses POSIX threads (or Win32 critical
+ * sections) for its lock.
+ */
+#define TROPICSSL_X509_CRT_CACHE
+
+/*
+ * Module:  library/x509parse.c
+ * Caller:
+ *
+ * This module parses certificate revocation lists into a hashed
+ * index of revoked serial numbers; x509_set_crl() has
+ * x509parse_verify() check it, and x509_crl_store_swap() replaces
+ * it while handshakes go on. It uses POSIX threads (or Win32
+ * critical sections) for its lock.
+ */
+#define TROPICSSL_X509_CRL
+
+/*
+ * Module:  library/x509snap.c
+ * Caller:
+ *
+ * This module saves parsed certificate chains and private keys,
+ * with their CRT and Montgomery constants, in one binary file
+ * indexed by name, and maps it back: loading a key then needs no
+ * PEM, DES or ASN.1 decoding and no modular arithmetic. Requires
+ * TROPICSSL_X509_PARSE and TROPICSSL_SHA2; files need
+ * TROPICSSL_FS_IO and mmap().
+ */
+#define TROPICSSL_X509_SNAP_C
+
 /*
  * Module:  library/x509_write.c
  * Caller:
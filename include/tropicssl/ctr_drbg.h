@@ -0,0 +1,160 @@
+/**
+ * \file ctr_drbg.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_CTR_DRBG_H
+#define TROPICSSL_CTR_DRBG_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+#include "tropicssl/aes.h"
+
+#define CTR_DRBG_BLOCKSIZE              16	/* AES block            */
+#define CTR_DRBG_KEYSIZE                32	/* AES-256 key          */
+#define CTR_DRBG_SEEDLEN                48	/* key and counter      */
+
+/*
+ * Entropy gathered on a reseed, and on instantiation (where half as
+ * much again is taken as the nonce)
+ */
+#define CTR_DRBG_ENTROPY_LEN            32
+#define CTR_DRBG_NONCE_LEN              16
+
+#define CTR_DRBG_RESEED_INTERVAL        10000	/* requests per seed    */
+#define CTR_DRBG_MAX_INPUT              256	/* additional input     */
+#define CTR_DRBG_MAX_REQUEST            65536	/* bytes between updates */
+
+/**
+ * \brief          CTR_DRBG context (NIST SP 800-90A, AES-256 with a
+ *                 derivation function)
+ *
+ * \note           A context is not locked: give each thread its own,
+ *                 seeded from the shared entropy source.
+ */
+typedef struct {
+	uint8_t counter[16];		/*!<  V + 1                    */
+	int reseed_counter;		/*!<  requests since the seed  */
+	int reseed_interval;		/*!<  requests per seed        */
+	aes_context aes;		/*!<  current key              */
+
+	int (*f_entropy) (void *, uint8_t *, size_t);
+	void *p_entropy;		/*!<  entropy source context   */
+} ctr_drbg_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Seed a CTR_DRBG context
+	 *
+	 * \param ctx       CTR_DRBG context to be initialized
+	 * \param f_entropy entropy source, such as havege_random
+	 * \param p_entropy entropy source parameter
+	 * \param custom    personalization string (may be NULL), so that
+	 *                  instances seeded alike still differ
+	 * \param len       length of the personalization string
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED
+	 */
+	int ctr_drbg_init(ctr_drbg_context * ctx,
+			  int (*f_entropy) (void *, uint8_t *, size_t),
+			  void *p_entropy,
+			  const uint8_t *custom, size_t len);
+
+	/**
+	 * \brief          Reseed from the entropy source; done by the
+	 *                 generator itself every reseed_interval requests
+	 *
+	 * \param ctx      CTR_DRBG context
+	 * \param additional additional data to mix in (may be NULL)
+	 * \param len      length of the additional data
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED
+	 */
+	int ctr_drbg_reseed(ctr_drbg_context * ctx,
+			    const uint8_t *additional, size_t len);
+
+	/**
+	 * \brief          Generate random bytes, mixing in additional data
+	 *
+	 * \param p_rng    CTR_DRBG context
+	 * \param output   buffer to fill
+	 * \param output_len number of bytes wanted (any length)
+	 * \param additional additional data (may be NULL)
+	 * \param add_len  length of the additional data
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED
+	 *                 or TROPICSSL_ERR_CTR_DRBG_INPUT_TOO_BIG
+	 */
+	int ctr_drbg_random_with_add(void *p_rng,
+				     uint8_t *output, size_t output_len,
+				     const uint8_t *additional,
+				     size_t add_len);
+
+	/**
+	 * \brief          Generate random bytes: the f_rng function for
+	 *                 ssl_set_rng(), rsa_init() and the like
+	 *
+	 * \param p_rng    CTR_DRBG context
+	 * \param output   buffer to fill
+	 * \param output_len number of bytes wanted (any length)
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED
+	 */
+	int ctr_drbg_random(void *p_rng, uint8_t *output, size_t output_len);
+
+	/**
+	 * \brief          Wipe a CTR_DRBG context
+	 *
+	 * \param ctx      CTR_DRBG context to be cleared
+	 */
+	void ctr_drbg_free(ctr_drbg_context * ctx);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ctr_drbg_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif				/* TROPICSSL_CTR_DRBG_C */
+#endif				/* ctr_drbg.h */
@@ -40,6 +40,14 @@
 #if defined(TROPICSSL_DHM)
 #include "tropicssl/bignum.h"
 
+#include <time.h>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 typedef struct {
 	size_t len;		/*!<  size(P) in chars  */
 	mpi P;			/*!<  prime modulus     */
@@ -51,6 +59,30 @@ typedef struct {
 	mpi RP;			/*!<  cached R^2 mod P  */
 } dhm_context;
 
+/**
+ * \brief          Ephemeral DH state shared by the contexts of a
+ *                 server: P and G with their Montgomery constants and
+ *                 the comb of G, plus the key pair being reused, if any
+ */
+typedef struct {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	int x_size;		/*!<  private value bits */
+	mpi P;			/*!<  prime modulus      */
+	mpi G;			/*!<  generator          */
+	mpi_mont M;		/*!<  constants of P     */
+	mpi_comb C;		/*!<  comb of G under P  */
+	mpi X;			/*!<  reused secret      */
+	mpi GX;			/*!<  reused G^X mod P   */
+	time_t born;		/*!<  when X was made    */
+	int uses;		/*!<  handshakes using X */
+	int max_uses;		/*!<  reuse limits, see  */
+	int max_age;		/*!<  dhm_shared_reuse() */
+} dhm_shared;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -59,7 +91,8 @@ extern "C" {
 	 * \brief          Parse the ServerKeyExchange parameters
 	 *
 	 * \param ctx      DHM context
-	 * \param p        &(start of input buffer)
+	 * \param p        &(start of input buffer), left on what
+	 *                 follows P, G and Ys (the signature)
 	 * \param end      end of buffer
 	 *
 	 * \return         0 if successful, or an TROPICSSL_ERR_DHM_XXX error code
@@ -85,7 +118,8 @@ extern "C" {
 	 */
 	int dhm_make_params(dhm_context * ctx, int x_size,
 			    uint8_t *output, size_t *olen,
-			    int (*f_rng) (void *), void *p_rng);
+			    int (*f_rng) (void *, uint8_t *, size_t),
+			    void *p_rng);
 
 	/**
 	 * \brief          Import the peer's public value G^Y
@@ -112,7 +146,8 @@ extern "C" {
 	 */
 	int dhm_make_public(dhm_context * ctx, int s_size,
 			    uint8_t *output, size_t olen,
-			    int (*f_rng) (void *), void *p_rng);
+			    int (*f_rng) (void *, uint8_t *, size_t),
+			    void *p_rng);
 
 	/**
 	 * \brief          Derive and export the shared secret (G^Y)^X mod P
@@ -131,6 +166,67 @@ extern "C" {
 	 */
 	void dhm_free(dhm_context * ctx);
 
+	/**
+	 * \brief          Set up the state shared by a server's contexts:
+	 *                 precompute the comb of G under P
+	 *
+	 * \param S        shared state to be initialized
+	 * \param P        prime modulus
+	 * \param G        generator
+	 * \param x_size   private value size in bits
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_BAD_ARG if G or
+	 *                 x_size is out of range, or an TROPICSSL_ERR_MPI_XXX
+	 *                 error code; S needs no dhm_shared_free()
+	 *                 after an error
+	 *
+	 * \note           Each key pair is fresh until dhm_shared_reuse()
+	 *                 says otherwise.
+	 */
+	int dhm_shared_init(dhm_shared * S, const mpi * P, const mpi * G,
+			    int x_size);
+
+	/**
+	 * \brief          Reuse each ephemeral key pair for a while
+	 *
+	 * \param S        shared state
+	 * \param max_uses number of handshakes a key pair serves, 0 for
+	 *                 no limit
+	 * \param max_age  number of seconds it is kept, 0 for no limit
+	 *
+	 * \note           With both at 0 (the default) or max_uses at 1,
+	 *                 every handshake gets a new key pair. Anyone who
+	 *                 gets hold of a reused X can read every session
+	 *                 that used it, so keep the limits small.
+	 */
+	void dhm_shared_reuse(dhm_shared * S, int max_uses, int max_age);
+
+	/**
+	 * \brief          Same as dhm_make_params(), taking P, G, the size
+	 *                 of X and possibly X itself from the shared state
+	 *
+	 * \param ctx      DHM context, to be used with dhm_read_public()
+	 *                 and dhm_calc_secret() afterwards
+	 * \param S        shared state, from dhm_shared_init()
+	 * \param output   destination buffer
+	 * \param olen     number of chars written
+	 * \param f_rng    RNG function
+	 * \param p_rng    RNG parameter
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_DHM_XXX error code
+	 *
+	 * \note           S may be used by several threads at once.
+	 */
+	int dhm_make_params_shared(dhm_context * ctx, dhm_shared * S,
+				   uint8_t *output, size_t *olen,
+				   int (*f_rng) (void *, uint8_t *, size_t),
+				   void *p_rng);
+
+	/**
+	 * \brief          Free the shared state
+	 */
+	void dhm_shared_free(dhm_shared * S);
+
 #if defined(TROPICSSL_SELF_TEST)
 	/**
 	 * \brief          Checkup routine
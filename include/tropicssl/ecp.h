@@ -0,0 +1,195 @@
+/**
+ * \file ecp.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_ECP_H
+#define TROPICSSL_ECP_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_ECP)
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "tropicssl/err.h"
+
+#define ECP_P256_LEN            32	/*!< size of the field and scalars */
+#define ECP_P256_POINT_LEN      65	/*!< uncompressed: 04 | X | Y      */
+
+/*
+ * TLS identifiers (RFC 4492)
+ */
+#define ECP_TLS_NAMED_CURVE      3	/*!< ECCurveType named_curve       */
+#define ECP_TLS_SECP256R1       23	/*!< NamedCurve secp256r1          */
+#define ECP_TLS_UNCOMPRESSED     0	/*!< ECPointFormat uncompressed    */
+
+typedef struct {
+	uint8_t d[ECP_P256_LEN];	/*!<  secret scalar        */
+	uint8_t Q[ECP_P256_POINT_LEN];	/*!<  self = d.G           */
+	uint8_t Qp[ECP_P256_POINT_LEN];	/*!<  peer public point    */
+	uint8_t K[ECP_P256_LEN];	/*!<  key = x(d.Qp)        */
+} ecdh_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Generate a P-256 key pair
+	 *
+	 * \param d        secret scalar, in [1, n-1] (big-endian)
+	 * \param Q        public point d.G, uncompressed
+	 * \param f_rng    RNG function
+	 * \param p_rng    RNG parameter
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_ECP_INVALID_KEY
+	 *                 if the RNG kept returning values out of range,
+	 *                 or the error returned by f_rng
+	 */
+	int ecp_p256_gen_key(uint8_t d[ECP_P256_LEN],
+			     uint8_t Q[ECP_P256_POINT_LEN],
+			     int (*f_rng) (void *, uint8_t *, size_t),
+			     void *p_rng);
+
+	/**
+	 * \brief          Check that an uncompressed point is on P-256
+	 *
+	 * \param P        point to check
+	 *
+	 * \return         0 if valid, or TROPICSSL_ERR_ECP_INVALID_KEY
+	 */
+	int ecp_p256_check_public(const uint8_t P[ECP_P256_POINT_LEN]);
+
+	/**
+	 * \brief          Multiply a point by a scalar, R = d.P
+	 *
+	 * \param R        destination point, uncompressed
+	 * \param d        scalar in [1, n-1] (big-endian)
+	 * \param P        point, uncompressed; it is checked first
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_ECP_BAD_INPUT_DATA
+	 *                 if d is out of range, or
+	 *                 TROPICSSL_ERR_ECP_INVALID_KEY if P is not valid
+	 *
+	 * \note           The time taken depends neither on d nor on P.
+	 */
+	int ecp_p256_mul(uint8_t R[ECP_P256_POINT_LEN],
+			 const uint8_t d[ECP_P256_LEN],
+			 const uint8_t P[ECP_P256_POINT_LEN]);
+
+	/**
+	 * \brief          Setup and write the ServerKeyExchange parameters
+	 *                 (ECParameters and ECPoint)
+	 *
+	 * \param ctx      ECDH context
+	 * \param output   destination buffer, at least 69 bytes
+	 * \param olen     number of chars written
+	 * \param f_rng    RNG function
+	 * \param p_rng    RNG parameter
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_ECP_XXX error code
+	 */
+	int ecdh_make_params(ecdh_context * ctx, uint8_t *output, size_t *olen,
+			     int (*f_rng) (void *, uint8_t *, size_t),
+			     void *p_rng);
+
+	/**
+	 * \brief          Parse the ServerKeyExchange parameters
+	 *
+	 * \param ctx      ECDH context
+	 * \param p        &(start of input buffer), moved past the point
+	 * \param end      end of buffer
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_ECP_XXX error code
+	 */
+	int ecdh_read_params(ecdh_context * ctx,
+			     uint8_t **p, const uint8_t *end);
+
+	/**
+	 * \brief          Create own key pair and export the ClientKeyExchange
+	 *                 ECPoint (with its length byte)
+	 *
+	 * \param ctx      ECDH context
+	 * \param output   destination buffer, at least 66 bytes
+	 * \param olen     number of chars written
+	 * \param f_rng    RNG function
+	 * \param p_rng    RNG parameter
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_ECP_XXX error code
+	 */
+	int ecdh_make_public(ecdh_context * ctx, uint8_t *output, size_t *olen,
+			     int (*f_rng) (void *, uint8_t *, size_t),
+			     void *p_rng);
+
+	/**
+	 * \brief          Import the peer's ClientKeyExchange ECPoint
+	 *
+	 * \param ctx      ECDH context
+	 * \param input    input buffer, starting with the length byte
+	 * \param ilen     size of buffer
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_ECP_XXX error code
+	 */
+	int ecdh_read_public(ecdh_context * ctx,
+			     const uint8_t *input, size_t ilen);
+
+	/**
+	 * \brief          Derive and export the shared secret x(d.Qp)
+	 *
+	 * \param ctx      ECDH context
+	 * \param output   destination buffer
+	 * \param olen     size of buffer on entry, number of chars written
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_ECP_XXX error code
+	 */
+	int ecdh_calc_secret(ecdh_context * ctx,
+			     uint8_t *output, size_t *olen);
+
+	/*
+	 * \brief          Wipe an ECDH context
+	 */
+	void ecdh_free(ecdh_context * ctx);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ecp_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_ECP */
+#endif
@@ -0,0 +1,192 @@
+/**
+ * \file entropy.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_ENTROPY_H
+#define TROPICSSL_ENTROPY_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_ENTROPY)
+#include <stddef.h>
+#include <inttypes.h>
+
+#if defined(TROPICSSL_HAVEGE)
+#include "tropicssl/havege.h"
+#endif
+#if defined(TROPICSSL_CTR_DRBG_C)
+#include "tropicssl/ctr_drbg.h"
+#endif
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define ENTROPY_BLOCK_LEN               32	/* SHA-256 output       */
+#define ENTROPY_RESERVE_LEN             1024	/* gathered ahead       */
+#define ENTROPY_RESEED_MS               60000	/* reseeder period      */
+
+/*
+ * Sources, in the order they are drawn from
+ */
+#define ENTROPY_SRC_RDSEED              0x01	/* x86 RDSEED           */
+#define ENTROPY_SRC_RDRAND              0x02	/* x86 RDRAND           */
+#define ENTROPY_SRC_GETRANDOM           0x04	/* Linux getrandom()    */
+#define ENTROPY_SRC_HAVEGE              0x08	/* fallback             */
+
+/**
+ * \brief          Entropy pool: shared by every thread, under its lock
+ */
+typedef struct {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t wake;		/*!<  stops the reseeder       */
+	pthread_key_t key;		/*!<  per-thread DRBGs         */
+	pthread_t reseeder;		/*!<  background thread        */
+#endif
+	int sources;			/*!<  ENTROPY_SRC_* in use     */
+	uint8_t pool[ENTROPY_BLOCK_LEN];	/*!<  running hash     */
+	uint8_t reserve[ENTROPY_RESERVE_LEN];	/*!<  gathered ahead   */
+	size_t reserve_len;		/*!<  bytes left in reserve    */
+	volatile unsigned int generation;	/*!<  reseeder rounds  */
+	unsigned int forks;		/*!<  fork count of the reserve */
+	int interval_ms;		/*!<  0 if no reseeder         */
+	int stop;			/*!<  reseeder asked to stop   */
+#if defined(TROPICSSL_HAVEGE)
+	havege_state *hs;		/*!<  set up on first use      */
+#endif
+#if defined(TROPICSSL_CTR_DRBG_C) && defined(WIN32)
+	ctr_drbg_context drbg;		/*!<  one DRBG for all threads */
+	int drbg_ready;
+#endif
+} entropy_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Set up an entropy pool and seed it
+	 *
+	 * \param ctx      pool to be initialized
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_ENTROPY_SOURCE_FAILED
+	 *
+	 * \note           RDSEED, RDRAND and getrandom() are used when
+	 *                 the CPU and the kernel have them. HAVEGE is
+	 *                 only set up, with its timing walk, if none of
+	 *                 them delivers.
+	 */
+	int entropy_init(entropy_context * ctx);
+
+	/**
+	 * \brief          Get seed material: the f_entropy function for
+	 *                 ctr_drbg_init()
+	 *
+	 * \param p_entropy entropy pool
+	 * \param output   buffer to fill
+	 * \param len      number of bytes wanted
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_ENTROPY_SOURCE_FAILED
+	 *
+	 * \note           Served from the reserve the reseeder keeps
+	 *                 filled, if any, so that the caller does not
+	 *                 wait on the sources. A forked child drops the
+	 *                 reserve it inherited instead of sharing it.
+	 */
+	int entropy_func(void *p_entropy, uint8_t *output, size_t len);
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+	/**
+	 * \brief          Generate random bytes from the calling thread's
+	 *                 own CTR_DRBG, set up on first use and seeded
+	 *                 from the pool: the f_rng function for
+	 *                 ssl_set_rng(), rsa_init() and the like
+	 *
+	 * \param p_entropy entropy pool
+	 * \param output   buffer to fill
+	 * \param len      number of bytes wanted
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_ENTROPY_SOURCE_FAILED
+	 *
+	 * \note           Each DRBG reseeds, from the reserve, on its
+	 *                 first request after a reseeder round, and from
+	 *                 the sources on its first one in a forked child
+	 *                 (see pthread_atfork()). It is freed when its
+	 *                 thread exits. On WIN32, one
+	 *                 DRBG is shared under the pool's lock.
+	 */
+	int entropy_random(void *p_entropy, uint8_t *output, size_t len);
+#endif
+
+	/**
+	 * \brief          Start a thread that refills the reserve every
+	 *                 interval_ms milliseconds
+	 *
+	 * \param ctx      entropy pool
+	 * \param interval_ms period, or 0 for ENTROPY_RESEED_MS
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_ENTROPY_THREAD_FAILED
+	 */
+	int entropy_start_reseeder(entropy_context * ctx, int interval_ms);
+
+	/**
+	 * \brief          Stop the reseeder and wipe the pool
+	 *
+	 * \param ctx      entropy pool
+	 *
+	 * \note           Other threads must be done with entropy_random()
+	 *                 by then; the calling thread's DRBG is freed here.
+	 */
+	void entropy_free(entropy_context * ctx);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int entropy_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif				/* TROPICSSL_ENTROPY */
+#endif				/* entropy.h */
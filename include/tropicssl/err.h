@@ -49,6 +49,10 @@
 #define TROPICSSL_ERR_NET_SEND_FAILED                       -0x0F70
 #define TROPICSSL_ERR_NET_CONN_RESET                        -0x0F80
 #define TROPICSSL_ERR_NET_TRY_AGAIN                         -0x0F90
+#define TROPICSSL_ERR_NET_WANT_READ                         -0x0FA0
+#define TROPICSSL_ERR_NET_WANT_WRITE                        -0x0FB0
+#define TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE               -0x0FC0
+#define TROPICSSL_ERR_NET_CONNECT_TIMEOUT                   -0x0FD0
 
 #define TROPICSSL_ERR_MPI_INVALID_CHARACTER                 -0x0006
 #define TROPICSSL_ERR_MPI_BUFFER_TOO_SMALL                  -0x0008
@@ -60,12 +64,26 @@
 #define TROPICSSL_ERR_BASE64_BUFFER_TOO_SMALL               -0x0010
 #define TROPICSSL_ERR_BASE64_INVALID_CHARACTER              -0x0012
 
+#define TROPICSSL_ERR_GCM_AUTH_FAILED                       -0x0014
+#define TROPICSSL_ERR_GCM_BAD_INPUT                         -0x0016
+
+#define TROPICSSL_ERR_CHACHAPOLY_AUTH_FAILED                -0x0054
+
+#define TROPICSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED        -0x0034
+#define TROPICSSL_ERR_CTR_DRBG_INPUT_TOO_BIG                -0x0038
+
+#define TROPICSSL_ERR_ENTROPY_SOURCE_FAILED                 -0x003C
+#define TROPICSSL_ERR_ENTROPY_THREAD_FAILED                 -0x003E
+
 #define TROPICSSL_ERR_DHM_READ_PARAMS_FAILED                -0x0490
 #define TROPICSSL_ERR_DHM_MAKE_PARAMS_FAILED                -0x04A0
 #define TROPICSSL_ERR_DHM_READ_PUBLIC_FAILED                -0x04B0
 #define TROPICSSL_ERR_DHM_MAKE_PUBLIC_FAILED                -0x04C0
 #define TROPICSSL_ERR_DHM_CALC_SECRET_FAILED                -0x04D0
 
+#define TROPICSSL_ERR_ECP_BAD_INPUT_DATA                    -0x04E0
+#define TROPICSSL_ERR_ECP_INVALID_KEY                       -0x04F0
+
 #define TROPICSSL_ERR_RSA_INVALID_PADDING                   -0x0410
 #define TROPICSSL_ERR_RSA_KEY_GEN_FAILED                    -0x0420
 #define TROPICSSL_ERR_RSA_KEY_CHECK_FAILED                  -0x0430
@@ -74,7 +92,11 @@
 #define TROPICSSL_ERR_RSA_VERIFY_FAILED                     -0x0460
 #define TROPICSSL_ERR_RSA_OUTPUT_TO_LARGE                   -0x0470
 
+#define TROPICSSL_ERR_SSL_ASYNC_IN_PROGRESS                 -0x0800
+#define TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED                -0x0880
+#define TROPICSSL_ERR_SSL_HANDSHAKE_REFUSED                 -0x0900
 #define TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE               -0x1000
+#define TROPICSSL_ERR_SSL_BAD_INPUT_DATA                    -0x1800
 #define TROPICSSL_ERR_SSL_INVALID_MAC                       -0x2000
 #define TROPICSSL_ERR_SSL_INVALID_RECORD                    -0x2800
 #define TROPICSSL_ERR_SSL_INVALID_MODULUS_SIZE              -0x3000
@@ -100,6 +122,9 @@
 #define TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE_VERIFY         -0xD000
 #define TROPICSSL_ERR_SSL_BAD_HS_CHANGE_CIPHER_SPEC         -0xD800
 #define TROPICSSL_ERR_SSL_BAD_HS_FINISHED                   -0xE000
+#define TROPICSSL_ERR_SSL_BAD_HS_NEW_SESSION_TICKET         -0xE800
+#define TROPICSSL_ERR_SSL_MALLOC_FAILED                     -0xF000
+#define TROPICSSL_ERR_SSL_COMPRESSION_FAILED                -0xF800
 
 #define TROPICSSL_ERR_ASN1_OUT_OF_DATA                      -0x0014
 #define TROPICSSL_ERR_ASN1_UNEXPECTED_TAG                   -0x0016
@@ -132,5 +157,10 @@
 #define TROPICSSL_ERR_X509_KEY_PASSWORD_MISMATCH            -0x02E0
 #define TROPICSSL_ERR_X509_POINT_ERROR                      -0x0300
 #define TROPICSSL_ERR_X509_VALUE_TO_LENGTH                  -0x0320
+#define TROPICSSL_ERR_X509_CRL_INVALID_PEM                  -0x0340
+#define TROPICSSL_ERR_X509_CRL_INVALID_FORMAT               -0x0360
+#define TROPICSSL_ERR_X509_CRL_VERIFY_FAILED                -0x0380
+#define TROPICSSL_ERR_X509_SNAP_INVALID                     -0x03A0
+#define TROPICSSL_ERR_X509_SNAP_NOT_FOUND                   -0x03C0
 
 #endif /* TROPICSSL_ERR_H */
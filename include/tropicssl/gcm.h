@@ -0,0 +1,185 @@
+/**
+ * \file gcm.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_GCM_H
+#define TROPICSSL_GCM_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_GCM)
+#include "tropicssl/aes.h"
+
+#define GCM_ENCRYPT     1
+#define GCM_DECRYPT     0
+
+/**
+ * \brief          GCM context structure
+ */
+typedef struct {
+	aes_context aes;	/*!<  AES context (encryption)   */
+	uint64_t HL[16];	/*!<  precalculated HTable       */
+	uint64_t HH[16];	/*!<  precalculated HTable       */
+	uint8_t HP[64];		/*!<  H^1..H^4 for PCLMULQDQ     */
+	uint64_t len;		/*!<  total length encrypted     */
+	uint64_t add_len;	/*!<  total length of add. data  */
+	uint8_t base_ectr[16];	/*!<  first counter-mode block   */
+	uint8_t y[16];		/*!<  counter block              */
+	uint8_t buf[16];	/*!<  GHASH accumulator          */
+	int mode;		/*!<  GCM_ENCRYPT or GCM_DECRYPT */
+	int clmul;		/*!<  use the PCLMULQDQ tables   */
+} gcm_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          GCM initialization (AES key schedule and
+	 *                 GHASH tables)
+	 *
+	 * \param ctx      GCM context to be initialized
+	 * \param key      encryption key
+	 * \param keysize  must be 128, 192 or 256
+	 */
+	void gcm_init(gcm_context * ctx, const uint8_t *key,
+		      unsigned int keysize);
+
+	/**
+	 * \brief          Start a GCM message
+	 *
+	 * \param ctx      GCM context
+	 * \param mode     GCM_ENCRYPT or GCM_DECRYPT
+	 * \param iv       initialization vector
+	 * \param iv_len   length of the IV (12 bytes is the fast path)
+	 * \param add      additional data
+	 * \param add_len  length of the additional data
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_GCM_BAD_INPUT
+	 */
+	int gcm_starts(gcm_context * ctx, int mode,
+		       const uint8_t *iv, size_t iv_len,
+		       const uint8_t *add, size_t add_len);
+
+	/**
+	 * \brief          Encrypt or decrypt part of a GCM message
+	 *
+	 * \param ctx      GCM context
+	 * \param length   length of the data; must be a multiple of 16
+	 *                 except for the last call before gcm_finish()
+	 * \param input    buffer holding the input data
+	 * \param output   buffer holding the output data
+	 *
+	 * \note           output may be equal to input, or may precede
+	 *                 it in the same buffer (as with a forward memmove).
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_GCM_BAD_INPUT
+	 */
+	int gcm_update(gcm_context * ctx, size_t length,
+		       const uint8_t *input, uint8_t *output);
+
+	/**
+	 * \brief          Finish a GCM message and compute the tag
+	 *
+	 * \param ctx      GCM context
+	 * \param tag      buffer receiving the tag
+	 * \param tag_len  length of the tag (4 to 16 bytes)
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_GCM_BAD_INPUT
+	 */
+	int gcm_finish(gcm_context * ctx, uint8_t *tag, size_t tag_len);
+
+	/**
+	 * \brief          GCM buffer encryption/decryption with tag
+	 *
+	 * \param ctx      GCM context
+	 * \param mode     GCM_ENCRYPT or GCM_DECRYPT
+	 * \param length   length of the input data
+	 * \param iv       initialization vector
+	 * \param iv_len   length of the IV
+	 * \param add      additional data
+	 * \param add_len  length of the additional data
+	 * \param input    buffer holding the input data
+	 * \param output   buffer holding the output data
+	 * \param tag_len  length of the tag to generate
+	 * \param tag      buffer receiving the tag
+	 *
+	 * \note           On decryption the computed tag is returned and
+	 *                 must be compared by the caller; gcm_auth_decrypt()
+	 *                 does this in constant time.
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_GCM_BAD_INPUT
+	 */
+	int gcm_crypt_and_tag(gcm_context * ctx, int mode, size_t length,
+			      const uint8_t *iv, size_t iv_len,
+			      const uint8_t *add, size_t add_len,
+			      const uint8_t *input, uint8_t *output,
+			      size_t tag_len, uint8_t *tag);
+
+	/**
+	 * \brief          GCM buffer authenticated decryption
+	 *
+	 * \param ctx      GCM context
+	 * \param length   length of the input data
+	 * \param iv       initialization vector
+	 * \param iv_len   length of the IV
+	 * \param add      additional data
+	 * \param add_len  length of the additional data
+	 * \param tag      expected tag
+	 * \param tag_len  length of the tag
+	 * \param input    buffer holding the ciphertext
+	 * \param output   buffer holding the plaintext
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_GCM_AUTH_FAILED
+	 *                 if the tag does not match (output is wiped),
+	 *                 or TROPICSSL_ERR_GCM_BAD_INPUT
+	 */
+	int gcm_auth_decrypt(gcm_context * ctx, size_t length,
+			     const uint8_t *iv, size_t iv_len,
+			     const uint8_t *add, size_t add_len,
+			     const uint8_t *tag, size_t tag_len,
+			     const uint8_t *input, uint8_t *output);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int gcm_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_GCM */
+#endif				/* gcm.h */
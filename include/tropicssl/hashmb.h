@@ -0,0 +1,126 @@
+/**
+ * \file hashmb.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_HASHMB_H
+#define TROPICSSL_HASHMB_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_HASHMB)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && \
+    ( defined(__amd64__) || defined(__x86_64__) ) && \
+    !defined(TROPICSSL_HAVE_X86_64)
+#define TROPICSSL_HAVE_X86_64
+#endif
+
+/*
+ * Number of messages hashed side by side in one pass
+ */
+#define HASHMB_LANES                    8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Multi-buffer hashing detection routine
+	 *
+	 * \return         1 if the messages are really hashed in
+	 *                 parallel (AVX2), 0 if the functions below fall
+	 *                 back to one message at a time
+	 */
+	int hashmb_supports(void);
+
+	/**
+	 * \brief          Output = MD5( input[i] ) for each of n messages
+	 *
+	 * \param n        number of messages
+	 * \param input    the n buffers holding the messages
+	 * \param ilen     the n message lengths
+	 * \param output   the n buffers receiving a 16-byte digest each
+	 *
+	 * \note           Messages of any mix of lengths are accepted;
+	 *                 throughput is best when they have similar sizes.
+	 */
+	void hashmb_md5(size_t n, const uint8_t * const input[],
+			const size_t ilen[], uint8_t * const output[]);
+
+	/**
+	 * \brief          Output = SHA-1( input[i] ) for each of n messages
+	 *
+	 * \param n        number of messages
+	 * \param input    the n buffers holding the messages
+	 * \param ilen     the n message lengths
+	 * \param output   the n buffers receiving a 20-byte digest each
+	 *
+	 * \note           On CPUs with the SHA extensions the messages are
+	 *                 hashed one at a time through them, which is
+	 *                 faster than the AVX2 lanes.
+	 */
+	void hashmb_sha1(size_t n, const uint8_t * const input[],
+			 const size_t ilen[], uint8_t * const output[]);
+
+	/**
+	 * \brief          Output = SHA-256( input[i] ) for each of n
+	 *                 messages
+	 *
+	 * \param n        number of messages
+	 * \param input    the n buffers holding the messages
+	 * \param ilen     the n message lengths
+	 * \param output   the n buffers receiving a 32-byte (or 28-byte
+	 *                 for SHA-224) digest each
+	 * \param is224    0 = use SHA256, 1 = use SHA224
+	 *
+	 * \note           As for hashmb_sha1(), the SHA extensions are
+	 *                 preferred over the AVX2 lanes when present.
+	 */
+	void hashmb_sha2(size_t n, const uint8_t * const input[],
+			 const size_t ilen[], uint8_t * const output[],
+			 int is224);
+
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int hashmb_self_test(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_HASHMB */
+#endif				/* hashmb.h */
@@ -38,6 +38,8 @@
 #include "tropicssl/config.h"
 
 #if defined(TROPICSSL_HAVEGE)
+#include <string.h>
+#include <inttypes.h>
 
 #define COLLECT_SIZE 1024
 
@@ -70,6 +72,18 @@ extern "C" {
 	 */
 	int havege_rand(void *p_rng);
 
+	/**
+	 * \brief          HAVEGE bulk function, with the f_rng signature;
+	 *                 best used to seed a DRBG (see ctr_drbg_init)
+	 *
+	 * \param p_rng    points to an HAVEGE state
+	 * \param output   buffer to fill
+	 * \param len      number of bytes wanted
+	 *
+	 * \return         0
+	 */
+	int havege_random(void *p_rng, uint8_t *output, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -48,8 +48,8 @@ typedef struct {
 	uint32_t state[4];	/*!< intermediate digest state  */
 	uint8_t buffer[64];	/*!< data block being processed */
 
-	uint8_t ipad[64];	/*!< HMAC: inner padding        */
-	uint8_t opad[64];	/*!< HMAC: outer padding        */
+	uint32_t istate[4];	/*!< HMAC: inner key state      */
+	uint32_t ostate[4];	/*!< HMAC: outer key state      */
 } md5_context;
 
 #ifdef __cplusplus
@@ -128,6 +128,18 @@ extern "C" {
 	 */
 	void md5_hmac_finish(md5_context * ctx, uint8_t output[16]);
 
+	/**
+	 * \brief          MD5 HMAC context reset
+	 *
+	 * \param ctx      HMAC context set up by md5_hmac_starts()
+	 *
+	 * \note           The padded key blocks are hashed once by
+	 *                 md5_hmac_starts(); resetting restores that
+	 *                 state, so further messages under the same key
+	 *                 cost no extra compression.
+	 */
+	void md5_hmac_reset(md5_context * ctx);
+
 	/**
 	 * \brief          Output = HMAC-MD5( hmac key, input buffer )
 	 *
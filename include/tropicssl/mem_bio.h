@@ -0,0 +1,221 @@
+/**
+ * \file mem_bio.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_MEM_BIO_H
+#define TROPICSSL_MEM_BIO_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_MEM_BIO_C)
+#include "tropicssl/ssl.h"
+
+/**
+ * \brief          One direction of an in-memory transport: a ring
+ *                 buffer with one writer and one reader, and no lock
+ */
+typedef struct {
+	uint8_t *buf;		/*!<  storage                 */
+	size_t size;		/*!<  capacity                */
+	size_t head;		/*!<  offset of the next read */
+	size_t len;		/*!<  bytes waiting           */
+	int eof;		/*!<  closed by the writer    */
+} mem_bio;
+
+/**
+ * \brief          Both directions between a client and a server
+ */
+typedef struct {
+	mem_bio c2s;		/*!<  client to server        */
+	mem_bio s2c;		/*!<  server to client        */
+} mem_bio_pair;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Initialize an empty ring
+	 *
+	 * \param b        ring to be initialized
+	 * \param size     capacity in bytes; a few SSL_BUFFER_LEN hold
+	 *                 any handshake flight
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 */
+	int mem_bio_init(mem_bio * b, size_t size);
+
+	/**
+	 * \brief          Drop the data waiting and reopen the ring
+	 */
+	void mem_bio_reset(mem_bio * b);
+
+	/**
+	 * \brief          Close the writing end: once the reader has
+	 *                 drained the ring, it gets
+	 *                 TROPICSSL_ERR_NET_CONN_RESET, as from a socket
+	 */
+	void mem_bio_close(mem_bio * b);
+
+	/**
+	 * \brief          Return the number of bytes waiting to be read
+	 */
+	size_t mem_bio_pending(const mem_bio * b);
+
+	/**
+	 * \brief          Return the number of bytes that can be written
+	 */
+	size_t mem_bio_space(const mem_bio * b);
+
+	/**
+	 * \brief          Read callback for ssl_set_bio()
+	 *
+	 * \param ctx      ring to read from
+	 * \param buf      destination
+	 * \param len      at most that many bytes are read
+	 *
+	 * \return         the number of bytes read, TROPICSSL_ERR_NET_TRY_AGAIN
+	 *                 if the ring is empty, or
+	 *                 TROPICSSL_ERR_NET_CONN_RESET once it is closed
+	 */
+	int mem_bio_recv(void *ctx, uint8_t *buf, size_t len);
+
+	/**
+	 * \brief          Write callback for ssl_set_bio()
+	 *
+	 * \param ctx      ring to write to
+	 * \param buf      data
+	 * \param len      at most that many bytes are written
+	 *
+	 * \return         the number of bytes written, TROPICSSL_ERR_NET_TRY_AGAIN
+	 *                 if the ring is full, or
+	 *                 TROPICSSL_ERR_NET_CONN_RESET if it is closed
+	 */
+	int mem_bio_send(void *ctx, uint8_t *buf, size_t len);
+
+	/**
+	 * \brief          Vectored write callback for ssl_set_sendv()
+	 *
+	 * \return         as mem_bio_send(), for the concatenation of
+	 *                 the buffers
+	 */
+	int mem_bio_sendv(void *ctx, const net_iovec * iov, int iovcnt);
+
+	/**
+	 * \brief          Zero-copy read: point at the longest contiguous
+	 *                 run of waiting bytes
+	 *
+	 * \param b        ring
+	 * \param p        set to the first waiting byte
+	 *
+	 * \return         length of the run (0 if the ring is empty); it
+	 *                 stays valid until mem_bio_consume()
+	 */
+	size_t mem_bio_peek(const mem_bio * b, const uint8_t ** p);
+
+	/**
+	 * \brief          Drop n bytes (at most mem_bio_pending()) from
+	 *                 the front of the ring
+	 */
+	void mem_bio_consume(mem_bio * b, size_t n);
+
+	/**
+	 * \brief          Zero-copy write: point at the longest contiguous
+	 *                 run of free space, eg. to receive a packet into
+	 *
+	 * \param b        ring
+	 * \param p        set to the first free byte
+	 *
+	 * \return         length of the run (0 if the ring is full)
+	 */
+	size_t mem_bio_reserve(mem_bio * b, uint8_t ** p);
+
+	/**
+	 * \brief          Append n bytes (at most the reserved run) that
+	 *                 were written in place after mem_bio_reserve()
+	 */
+	void mem_bio_commit(mem_bio * b, size_t n);
+
+	/**
+	 * \brief          Free the ring's storage
+	 */
+	void mem_bio_free(mem_bio * b);
+
+	/**
+	 * \brief          Initialize both rings of a pair
+	 *
+	 * \param pair     pair to be initialized
+	 * \param size     capacity of each direction
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 */
+	int mem_bio_pair_init(mem_bio_pair * pair, size_t size);
+
+	/**
+	 * \brief          Connect a client and a server context through
+	 *                 the pair (ssl_set_bio and ssl_set_sendv on both)
+	 *
+	 * \param pair     empty pair, see mem_bio_pair_reset()
+	 * \param cli      client context
+	 * \param srv      server context
+	 *
+	 * \note           Neither end ever blocks: step each one's
+	 *                 ssl_handshake() or ssl_read() while the other
+	 *                 returns TROPICSSL_ERR_NET_WANT_READ.
+	 */
+	void mem_bio_pair_set(mem_bio_pair * pair,
+			      ssl_context * cli, ssl_context * srv);
+
+	/**
+	 * \brief          Empty and reopen both rings of a pair
+	 */
+	void mem_bio_pair_reset(mem_bio_pair * pair);
+
+	/**
+	 * \brief          Free both rings of a pair
+	 */
+	void mem_bio_pair_free(mem_bio_pair * pair);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int mem_bio_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_MEM_BIO_C */
+#endif				/* mem_bio.h */
@@ -0,0 +1,159 @@
+/**
+ * \file memory.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_MEMORY_H
+#define TROPICSSL_MEMORY_H
+
+#include "tropicssl/config.h"
+
+#include <stdlib.h>
+
+#if defined(TROPICSSL_MEMORY)
+
+/*
+ * Default size of the chunks an arena carves its blocks from
+ */
+#define MEMORY_ARENA_CHUNK          16384
+
+typedef struct _memory_chunk memory_chunk;
+
+/**
+ * \brief          Arena context structure
+ */
+typedef struct {
+	memory_chunk *chunks;	/*!<  chunks in use, newest first */
+	memory_chunk *spare;	/*!<  chunks kept by the reset    */
+	size_t chunk_len;	/*!<  size of a regular chunk     */
+	size_t left;		/*!<  bytes left in chunks[0]     */
+} memory_arena;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Allocate len bytes with the calling thread's
+	 *                 allocator (malloc() unless set otherwise)
+	 *
+	 * \param len      number of bytes
+	 *
+	 * \return         the block, or NULL if allocation failed
+	 */
+	void *memory_alloc(size_t len);
+
+	/**
+	 * \brief          Free a block from memory_alloc(), through the
+	 *                 allocator it came from
+	 *
+	 * \param ptr      the block, or NULL
+	 */
+	void memory_free(void *ptr);
+
+	/**
+	 * \brief          Set the calling thread's allocator
+	 *
+	 * \param f_alloc  allocation function, or NULL for malloc()
+	 * \param f_free   matching release function
+	 * \param p_alloc  context for both functions
+	 *
+	 * \note           Every block remembers its allocator, so a block
+	 *                 may be freed after the thread switched to
+	 *                 another one, or by another thread.
+	 */
+	void memory_set_alloc(void *(*f_alloc) (void *, size_t),
+			      void (*f_free) (void *, void *), void *p_alloc);
+
+	/**
+	 * \brief          Get the calling thread's allocator, eg. to put
+	 *                 it back after a stretch of heap allocations
+	 */
+	void memory_get_alloc(void *(**f_alloc) (void *, size_t),
+			      void (**f_free) (void *, void *), void **p_alloc);
+
+	/**
+	 * \brief          Initialize an arena
+	 *
+	 * \param arena    arena to be initialized
+	 * \param chunk_len size of the chunks allocated from the heap,
+	 *                 or 0 for MEMORY_ARENA_CHUNK
+	 */
+	void memory_arena_init(memory_arena * arena, size_t chunk_len);
+
+	/**
+	 * \brief          Make the calling thread allocate from an arena
+	 *
+	 * \param arena    arena, or NULL to go back to malloc()
+	 *
+	 * \note           Freeing an arena block is a no-op: the memory
+	 *                 comes back all at once with memory_arena_reset().
+	 *                 Anything still holding arena blocks (eg. a peer
+	 *                 certificate or record buffers handed to a pool)
+	 *                 must be freed, or at least no longer used,
+	 *                 before that.
+	 */
+	void memory_set_arena(memory_arena * arena);
+
+	/**
+	 * \brief          Release every block allocated from an arena;
+	 *                 the first chunk is kept for reuse
+	 *
+	 * \param arena    arena
+	 */
+	void memory_arena_reset(memory_arena * arena);
+
+	/**
+	 * \brief          Return all chunks of an arena to the heap
+	 *
+	 * \param arena    arena
+	 */
+	void memory_arena_free(memory_arena * arena);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int memory_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+#define memory_alloc    malloc
+#define memory_free     free
+
+#endif				/* TROPICSSL_MEMORY */
+#endif				/* memory.h */
@@ -41,6 +41,49 @@
 #include <string.h>
 #include <inttypes.h>
 
+/*
+ * Directions for net_set_ktls()
+ */
+#define NET_KTLS_TX             1
+#define NET_KTLS_RX             2
+
+/*
+ * Options of net_connect_start() and net_connect_addrs()
+ */
+#define NET_CONNECT_NODELAY     1	/* TCP_NODELAY                  */
+#define NET_CONNECT_FASTOPEN    2	/* TCP Fast Open, where present */
+
+/*
+ * Addresses kept by net_resolve()
+ */
+#define NET_ADDRS_MAX           8
+
+/*
+ * Happy eyeballs (RFC 8305): head start of each address over the next
+ */
+#define NET_CONNECT_DELAY       250
+
+/**
+ * \brief          Resolved addresses of a host, in the order they
+ *                 are to be tried
+ */
+typedef struct {
+	int count;
+	struct {
+		int family;	/*!< AF_INET or AF_INET6 */
+		int len;	/*!< length of sa used   */
+		uint32_t sa[8];	/*!< struct sockaddr_*   */
+	} addr[NET_ADDRS_MAX];
+} net_addrs;
+
+/**
+ * \brief          Scatter/gather element, see net_sendv()
+ */
+typedef struct {
+	const uint8_t *base;	/*!< start of the data  */
+	size_t len;		/*!< length of the data */
+} net_iovec;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -52,9 +95,94 @@ extern "C" {
 	 *                      TROPICSSL_ERR_NET_SOCKET_FAILED,
 	 *                      TROPICSSL_ERR_NET_UNKNOWN_HOST,
 	 *                      TROPICSSL_ERR_NET_CONNECT_FAILED
+	 *
+	 * \note           IPv4 or IPv6, whichever answers first; see
+	 *                 net_connect_addrs().
 	 */
 	int net_connect(int *fd, const char *host, int port);
 
+	/**
+	 * \brief          Initiate a TCP connection with host:port, giving
+	 *                 up after timeout milliseconds (0: no limit)
+	 *
+	 * \return         0 if successful, or one of:
+	 *                      TROPICSSL_ERR_NET_SOCKET_FAILED,
+	 *                      TROPICSSL_ERR_NET_UNKNOWN_HOST,
+	 *                      TROPICSSL_ERR_NET_CONNECT_FAILED,
+	 *                      TROPICSSL_ERR_NET_CONNECT_TIMEOUT
+	 *
+	 * \note           Same as net_resolve() then net_connect_addrs().
+	 *                 net_connect() is this with no time limit.
+	 */
+	int net_connect_timeout(int *fd, const char *host, int port,
+				int timeout);
+
+	/**
+	 * \brief          Look up the IPv4 and IPv6 addresses of host:port
+	 *                 (getaddrinfo()), alternating families from the
+	 *                 one preferred by the system
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_NET_UNKNOWN_HOST
+	 *                 or TROPICSSL_ERR_NET_SOCKET_FAILED
+	 *
+	 * \note           This is the only step that may wait on DNS: a
+	 *                 client that opens many connections to a server
+	 *                 resolves it once and reuses the result.
+	 */
+	int net_resolve(net_addrs * addrs, const char *host, int port);
+
+	/**
+	 * \brief          Connect to one of the addresses, or the first to
+	 *                 answer (happy eyeballs): each gets
+	 *                 NET_CONNECT_DELAY ms before the next is tried
+	 *                 alongside it
+	 *
+	 * \param fd       set to the connected socket, which is blocking
+	 * \param addrs    addresses from net_resolve()
+	 * \param flags    NET_CONNECT_NODELAY, NET_CONNECT_FASTOPEN or 0
+	 * \param timeout  limit in milliseconds, 0 for none
+	 * \param index    if not NULL, set to the index of the address
+	 *                 connected to
+	 *
+	 * \return         0 if successful, or one of:
+	 *                      TROPICSSL_ERR_NET_SOCKET_FAILED,
+	 *                      TROPICSSL_ERR_NET_CONNECT_FAILED,
+	 *                      TROPICSSL_ERR_NET_CONNECT_TIMEOUT
+	 */
+	int net_connect_addrs(int *fd, const net_addrs * addrs, int flags,
+			      int timeout, int *index);
+
+	/**
+	 * \brief          Start a connection to address 'index' of addrs
+	 *                 without waiting for it
+	 *
+	 * \param fd       set to the new socket, which is non-blocking
+	 * \param flags    NET_CONNECT_NODELAY, NET_CONNECT_FASTOPEN or 0
+	 *
+	 * \return         0 if already connected,
+	 *                 TROPICSSL_ERR_NET_WANT_WRITE if under way (wait
+	 *                 for fd to be writable, then net_connect_finish()),
+	 *                 or TROPICSSL_ERR_NET_SOCKET_FAILED or
+	 *                 TROPICSSL_ERR_NET_CONNECT_FAILED; fd is then
+	 *                 closed
+	 *
+	 * \note           With NET_CONNECT_FASTOPEN the SYN waits for the
+	 *                 first write (Linux 4.11 and later), so the
+	 *                 connection always seems to be made at once.
+	 */
+	int net_connect_start(int *fd, const net_addrs * addrs, int index,
+			      int flags);
+
+	/**
+	 * \brief          Check how a connection from net_connect_start()
+	 *                 went
+	 *
+	 * \return         0 once it is made, TROPICSSL_ERR_NET_WANT_WRITE
+	 *                 while under way, or TROPICSSL_ERR_NET_CONNECT_FAILED
+	 *                 (the caller then closes fd)
+	 */
+	int net_connect_finish(int fd);
+
 	/**
 	 * \brief          Create a listening socket on bind_ip:port.
 	 *                 If bind_ip == NULL, all interfaces are binded.
@@ -66,6 +194,25 @@ extern "C" {
 	 */
 	int net_bind(int *fd, const char *bind_ip, int port);
 
+	/**
+	 * \brief          Create a listening socket on bind_ip:port that
+	 *                 other sockets may bind too (SO_REUSEPORT); the
+	 *                 kernel then spreads new connections over them.
+	 *                 One per thread lets each accept on its own,
+	 *                 with no lock and no thundering herd.
+	 *
+	 * \return         0 if successful, or one of:
+	 *                      TROPICSSL_ERR_NET_SOCKET_FAILED,
+	 *                      TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE,
+	 *                      TROPICSSL_ERR_NET_BIND_FAILED,
+	 *                      TROPICSSL_ERR_NET_LISTEN_FAILED
+	 *
+	 * \note           The backlog is SOMAXCONN rather than 10.
+	 *                 Where SO_REUSEPORT is missing, several threads
+	 *                 may instead share one net_bind() socket.
+	 */
+	int net_bind_reuseport(int *fd, const char *bind_ip, int port);
+
 	/**
 	 * \brief          Accept a connection from a remote client
 	 *
@@ -89,6 +236,41 @@ extern "C" {
 	 */
 	int net_set_nonblock(int fd);
 
+	/**
+	 * \brief          Turn Nagle's algorithm off (on != 0) or back on
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE
+	 *
+	 * \note           A handshake flight is several small writes:
+	 *                 with Nagle and delayed ACKs they may wait
+	 *                 40 ms or more for each other.
+	 */
+	int net_set_nodelay(int fd, int on);
+
+	/**
+	 * \brief          Let a listening socket accept data in the SYN
+	 *                 of known clients (TCP Fast Open), with up to
+	 *                 qlen such connections pending
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE
+	 */
+	int net_set_fastopen(int fd, int qlen);
+
+	/**
+	 * \brief          Set the kernel send and receive buffer sizes;
+	 *                 0 leaves one as it is
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE
+	 *
+	 * \note           The receive buffer sets the window scale, so
+	 *                 it only fully applies before connect(), or on
+	 *                 the listening socket for accepted ones.
+	 */
+	int net_set_bufsize(int fd, int sndbuf, int rcvbuf);
+
 	/**
 	 * \brief          Portable usleep helper
 	 *
@@ -117,6 +299,77 @@ extern "C" {
 	 */
 	int net_send(void *ctx, uint8_t *buf, size_t len);
 
+	/**
+	 * \brief          Write the 'iovcnt' buffers of 'iov' in order,
+	 *                 with one system call where the platform has
+	 *                 writev().
+	 *
+	 * \return         This function returns the number of bytes sent,
+	 *                 or a negative error code; TROPICSSL_ERR_NET_TRY_AGAIN
+	 *                 indicates write() is blocking.
+	 *
+	 * \note           Partial writes may stop anywhere, including in
+	 *                 the middle of an element.
+	 */
+	int net_sendv(void *ctx, const net_iovec * iov, int iovcnt);
+
+	/**
+	 * \brief          Send 'len' bytes of file 'fd' from 'offset' on
+	 *                 socket 'sock', within the kernel (sendfile())
+	 *
+	 * \return         This function returns the number of bytes sent,
+	 *                 or a negative error code; TROPICSSL_ERR_NET_TRY_AGAIN
+	 *                 indicates the write is blocking, and
+	 *                 TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE that the
+	 *                 system has no sendfile() (only Linux's is used).
+	 */
+	int net_sendfile(int sock, int fd, uint64_t offset, size_t len);
+
+	/**
+	 * \brief          Have the kernel protect the records of one
+	 *                 direction of a TLS 1.2 AES-GCM connection
+	 *                 (Linux kernel TLS)
+	 *
+	 * \param fd       connected TCP socket
+	 * \param dir      NET_KTLS_TX or NET_KTLS_RX
+	 * \param key      AES key
+	 * \param keylen   16 or 32 bytes
+	 * \param salt     implicit part of the nonce
+	 * \param seq      sequence number of the next record, which is
+	 *                 also its explicit nonce
+	 *
+	 * \return         0 if successful, or
+	 *                 TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE if the
+	 *                 system (or its kernel) cannot do it
+	 *
+	 * \note           From then on, that direction of fd carries
+	 *                 plaintext: write() or read() application data,
+	 *                 and other records through net_send_record()
+	 *                 and net_recv_record().
+	 */
+	int net_set_ktls(int fd, int dir, const uint8_t *key, size_t keylen,
+			 const uint8_t salt[4], const uint8_t seq[8]);
+
+	/**
+	 * \brief          Send 'len' bytes as a record of the given type
+	 *                 on a socket with kernel TLS output
+	 *
+	 * \return         the number of bytes sent, or a negative error
+	 *                 code as for net_send()
+	 */
+	int net_send_record(int fd, int type, const uint8_t *buf, size_t len);
+
+	/**
+	 * \brief          Read at most 'len' bytes of a single record on a
+	 *                 socket with kernel TLS input
+	 *
+	 * \param type     set to the record's content type
+	 *
+	 * \return         the number of bytes received, or a negative
+	 *                 error code as for net_recv()
+	 */
+	int net_recv_record(int fd, int *type, uint8_t *buf, size_t len);
+
 	/**
 	 * \brief          Gracefully shutdown the connection
 	 */
@@ -152,7 +152,8 @@ inline int RSA_private_decrypt(int size, uint8_t *input,
 inline int RSA_public_encrypt(int size, uint8_t *input,
 			      uint8_t *output, RSA * key, int ignore)
 {
-	if (!rsa_pkcs1_encrypt(key, RSA_PUBLIC, size, input, output))
+	if (!rsa_pkcs1_encrypt(key, key->f_rng, key->p_rng, RSA_PUBLIC,
+			       size, input, output))
 		return RSA_size(key);
 	else
 		return -1;
@@ -161,7 +162,8 @@ inline int RSA_public_encrypt(int size, uint8_t *input,
 inline int RSA_private_encrypt(int size, uint8_t *input,
 			       uint8_t *output, RSA * key, int ignore)
 {
-	if (!rsa_pkcs1_encrypt(key, RSA_PRIVATE, size, input, output))
+	if (!rsa_pkcs1_encrypt(key, key->f_rng, key->p_rng, RSA_PRIVATE,
+			       size, input, output))
 		return RSA_size(key);
 	else
 		return -1;
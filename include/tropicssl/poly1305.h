@@ -0,0 +1,117 @@
+/**
+ * \file poly1305.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_POLY1305_H
+#define TROPICSSL_POLY1305_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_POLY1305)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && \
+    ( defined(__amd64__) || defined(__x86_64__) ) && \
+    !defined(TROPICSSL_HAVE_X86_64)
+#define TROPICSSL_HAVE_X86_64
+#endif
+
+/**
+ * \brief          Poly1305 context structure
+ */
+typedef struct {
+	uint32_t r[5];		/*!<  clamped key r, 26-bit limbs    */
+	uint32_t r2[5];		/*!<  r^2, for two blocks at a time  */
+	uint32_t h[5];		/*!<  accumulator                    */
+	uint32_t pad[4];	/*!<  key s                          */
+	uint8_t buf[16];	/*!<  pending partial block          */
+	size_t left;		/*!<  bytes in buf                   */
+	int simd;		/*!<  use the SSE2 or NEON code      */
+} poly1305_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Poly1305 key setup
+	 *
+	 * \param ctx      Poly1305 context to be initialized
+	 * \param key      the 256-bit one-time key (r, s)
+	 */
+	void poly1305_starts(poly1305_context * ctx, const uint8_t key[32]);
+
+	/**
+	 * \brief          Poly1305 process buffer
+	 *
+	 * \param ctx      Poly1305 context
+	 * \param input    buffer holding the data
+	 * \param ilen     length of the input data
+	 */
+	void poly1305_update(poly1305_context * ctx,
+			     const uint8_t *input, size_t ilen);
+
+	/**
+	 * \brief          Poly1305 final tag
+	 *
+	 * \param ctx      Poly1305 context
+	 * \param mac      16-byte tag
+	 */
+	void poly1305_finish(poly1305_context * ctx, uint8_t mac[16]);
+
+	/**
+	 * \brief          Output = Poly1305(key, input buffer)
+	 *
+	 * \param key      the 256-bit one-time key
+	 * \param input    buffer holding the data
+	 * \param ilen     length of the input data
+	 * \param mac      16-byte tag
+	 */
+	void poly1305_mac(const uint8_t key[32], const uint8_t *input,
+			  size_t ilen, uint8_t mac[16]);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int poly1305_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_POLY1305 */
+#endif				/* poly1305.h */
@@ -76,6 +76,16 @@
     "\x30\x21\x30\x09\x06\x05\x2B\x0E\x03"  \
     "\x02\x1A\x05\x00\x04\x14"
 
+#define ASN1_HASH_SHA256                    \
+    "\x30\x31\x30\x0D\x06\x09\x60\x86\x48"  \
+    "\x01\x65\x03\x04\x02\x01\x05\x00\x04"  \
+    "\x20"
+
+#define ASN1_HASH_SHA384                    \
+    "\x30\x41\x30\x0D\x06\x09\x60\x86\x48"  \
+    "\x01\x65\x03\x04\x02\x02\x05\x00\x04"  \
+    "\x30"
+
 /**
  * \brief          RSA context structure
  */
@@ -97,9 +107,16 @@ typedef struct {
 	mpi RP;			/*!<  cached R^2 mod P  */
 	mpi RQ;			/*!<  cached R^2 mod Q  */
 
+	mpi_mont MP;		/*!<  Montgomery consts of P */
+	mpi_mont MQ;		/*!<  Montgomery consts of Q */
+	mpi_mont MN;		/*!<  Montgomery consts of N */
+
+	mpi Vi;			/*!<  blinding value * R mod N    */
+	mpi Vf;			/*!<  un-blinding value * R mod N */
+
 	int padding;		/*!<  1.5 or OAEP/PSS   */
 	int hash_id;		/*!<  hash identifier   */
-	int (*f_rng) (void *);	/*!<  RNG function      */
+	int (*f_rng) (void *, uint8_t *, size_t);	/*!<  RNG function      */
 	void *p_rng;		/*!<  RNG parameter     */
 } rsa_context;
 
@@ -124,7 +141,8 @@ extern "C" {
 	 */
 	void rsa_init(rsa_context * ctx,
 		      int padding,
-		      int hash_id, int (*f_rng) (void *), void *p_rng);
+		      int hash_id, int (*f_rng) (void *, uint8_t *, size_t),
+		      void *p_rng);
 
 	/**
 	 * \brief          Generate an RSA keypair
@@ -140,6 +158,20 @@ extern "C" {
 	 */
 	int rsa_gen_key(rsa_context * ctx, int nbits, int exponent);
 
+	/**
+	 * \brief          Generate an RSA keypair, each prime being searched
+	 *                 for on several threads (see mpi_gen_prime_mt())
+	 *
+	 * \param ctx      RSA context that will hold the key
+	 * \param nbits    size of the public key in bits
+	 * \param exponent public exponent (e.g., 65537)
+	 * \param threads  number of threads, eg. the number of cores
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_RSA_XXX error code
+	 */
+	int rsa_gen_key_mt(rsa_context * ctx, int nbits, int exponent,
+			   int threads);
+
 	/**
 	 * \brief          Check a public RSA key
 	 *
@@ -176,6 +208,21 @@ extern "C" {
 	int rsa_public(rsa_context * ctx,
 		       const uint8_t *input, uint8_t *output);
 
+	/**
+	 * \brief          Precompute what the private key operations need
+	 *
+	 * \param ctx      RSA context
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_RSA_XXX error code
+	 *
+	 * \note           rsa_gen_key() and x509parse_key() do this already;
+	 *                 it is needed only when the key is filled in by hand,
+	 *                 and should be done before the context is shared
+	 *                 between threads (rsa_private() would otherwise do
+	 *                 it on first use).
+	 */
+	int rsa_precompute(rsa_context * ctx);
+
 	/**
 	 * \brief          Do an RSA private key operation
 	 *
@@ -187,14 +234,44 @@ extern "C" {
 	 *
 	 * \note           The input and output buffers must be large
 	 *                 enough (eg. 128 bytes if RSA-1024 is used).
+	 *
+	 * \note           If ctx->f_rng is set, the input is blinded: the
+	 *                 first call picks a random Vf and Vi = Vf^-E,
+	 *                 each later one squares both (in Montgomery form,
+	 *                 so with no division). The pair lives in ctx, so
+	 *                 a context must not be used by two threads at
+	 *                 once.
 	 */
 	int rsa_private(rsa_context * ctx,
 			const uint8_t *input, uint8_t *output);
 
+	/**
+	 * \brief          Do a batch of RSA private key operations
+	 *
+	 * \param ctx      RSA context
+	 * \param count    number of operations
+	 * \param input    count input buffers
+	 * \param output   count output buffers
+	 *
+	 * \return         0 if successful, or an TROPICSSL_ERR_RSA_XXX error code
+	 *
+	 * \note           The operations run MPI_BATCH_LANES at a time in
+	 *                 lockstep (see mpi_exp_mod_batch()), which suits a
+	 *                 server that collects the key exchanges of several
+	 *                 pending handshakes before decrypting them.
+	 *                 One out of range input fails the whole call.
+	 *                 Each input gets a blinding pair of its own, as
+	 *                 for rsa_private().
+	 */
+	int rsa_private_batch(rsa_context * ctx, int count,
+			      const uint8_t * const *input, uint8_t **output);
+
 	/**
 	 * \brief          Add the message padding, then do an RSA operation
 	 *
 	 * \param ctx      RSA context
+	 * \param f_rng    RNG function, for the padding
+	 * \param p_rng    RNG parameter
 	 * \param mode     RSA_PUBLIC or RSA_PRIVATE
 	 * \param ilen     contains the the plaintext length
 	 * \param input    buffer holding the data to be encrypted
@@ -206,7 +283,8 @@ extern "C" {
 	 *                 of ctx->N (eg. 128 bytes if RSA-1024 is used).
 	 */
 	int rsa_pkcs1_encrypt(rsa_context * ctx,
-			      int mode, size_t ilen,
+			      int (*f_rng) (void *, uint8_t *, size_t),
+			      void *p_rng, int mode, size_t ilen,
 			      const uint8_t *input, uint8_t *output);
 
 	/**
@@ -230,6 +308,27 @@ extern "C" {
 			      const uint8_t *input,
 			      uint8_t *output, size_t output_max_len);
 
+	/**
+	 * \brief          Do a batch of private RSA operations, then
+	 *                 remove the message padding from each
+	 *
+	 * \param ctx      RSA context
+	 * \param count    number of ciphertexts
+	 * \param input    count buffers holding the encrypted data
+	 * \param output   count buffers that will hold the plaintexts
+	 * \param olen     will contain the count plaintext lengths
+	 * \param output_max_len	maximum length of each output buffer
+	 * \param status   will contain the count results, 0 or an
+	 *                 TROPICSSL_ERR_RSA_XXX error code
+	 *
+	 * \return         0 if the batch ran, or an TROPICSSL_ERR_RSA_XXX
+	 *                 error code if it could not (eg. out of memory)
+	 */
+	int rsa_pkcs1_decrypt_batch(rsa_context * ctx, int count,
+				    const uint8_t * const *input,
+				    uint8_t **output, size_t *olen,
+				    size_t output_max_len, int *status);
+
 	/**
 	 * \brief          Do a private RSA to sign a message digest
 	 *
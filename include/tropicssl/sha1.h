@@ -49,8 +49,8 @@ typedef struct {
 	uint32_t state[5];	/*!< intermediate digest state  */
 	uint8_t buffer[64];	/*!< data block being processed */
 
-	uint8_t ipad[64];	/*!< HMAC: inner padding        */
-	uint8_t opad[64];	/*!< HMAC: outer padding        */
+	uint32_t istate[5];	/*!< HMAC: inner key state      */
+	uint32_t ostate[5];	/*!< HMAC: outer key state      */
 } sha1_context;
 
 #ifdef __cplusplus
@@ -131,6 +131,18 @@ extern "C" {
 	 */
 	void sha1_hmac_finish(sha1_context * ctx, uint8_t output[20]);
 
+	/**
+	 * \brief          SHA-1 HMAC context reset
+	 *
+	 * \param ctx      HMAC context set up by sha1_hmac_starts()
+	 *
+	 * \note           The padded key blocks are hashed once by
+	 *                 sha1_hmac_starts(); resetting restores that
+	 *                 state, so further messages under the same key
+	 *                 cost no extra compression.
+	 */
+	void sha1_hmac_reset(sha1_context * ctx);
+
 	/**
 	 * \brief          Output = HMAC-SHA-1( hmac key, input buffer )
 	 *
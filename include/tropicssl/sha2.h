@@ -49,8 +49,8 @@ typedef struct {
 	uint32_t state[8];	/*!< intermediate digest state  */
 	uint8_t buffer[64];	/*!< data block being processed */
 
-	uint8_t ipad[64];	/*!< HMAC: inner padding        */
-	uint8_t opad[64];	/*!< HMAC: outer padding        */
+	uint32_t istate[8];	/*!< HMAC: inner key state      */
+	uint32_t ostate[8];	/*!< HMAC: outer key state      */
 	int is224;		/*!< 0 => SHA-256, else SHA-224 */
 } sha2_context;
 
@@ -137,6 +137,18 @@ extern "C" {
 	 */
 	void sha2_hmac_finish(sha2_context * ctx, uint8_t output[32]);
 
+	/**
+	 * \brief          SHA-256 HMAC context reset
+	 *
+	 * \param ctx      HMAC context set up by sha2_hmac_starts()
+	 *
+	 * \note           The padded key blocks are hashed once by
+	 *                 sha2_hmac_starts(); resetting restores that
+	 *                 state, so further messages under the same key
+	 *                 cost no extra compression.
+	 */
+	void sha2_hmac_reset(sha2_context * ctx);
+
 	/**
 	 * \brief          Output = HMAC-SHA-256( hmac key, input buffer )
 	 *
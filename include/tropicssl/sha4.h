@@ -56,8 +56,8 @@ typedef struct {
 	uint64_t state[8];	/*!< intermediate digest state  */
 	uint8_t buffer[128];	/*!< data block being processed */
 
-	uint8_t ipad[128];	/*!< HMAC: inner padding        */
-	uint8_t opad[128];	/*!< HMAC: outer padding        */
+	uint64_t istate[8];	/*!< HMAC: inner key state      */
+	uint64_t ostate[8];	/*!< HMAC: outer key state      */
 	int is384;		/*!< 0 => SHA-512, else SHA-384 */
 } sha4_context;
 
@@ -144,6 +144,18 @@ extern "C" {
 	 */
 	void sha4_hmac_finish(sha4_context * ctx, uint8_t output[64]);
 
+	/**
+	 * \brief          SHA-512 HMAC context reset
+	 *
+	 * \param ctx      HMAC context set up by sha4_hmac_starts()
+	 *
+	 * \note           The padded key blocks are hashed once by
+	 *                 sha4_hmac_starts(); resetting restores that
+	 *                 state, so further messages under the same key
+	 *                 cost no extra compression.
+	 */
+	void sha4_hmac_reset(sha4_context * ctx);
+
 	/**
 	 * \brief          Output = HMAC-SHA-512( hmac key, input buffer )
 	 *
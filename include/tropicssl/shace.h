@@ -0,0 +1,97 @@
+/**
+ * \file shace.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_SHACE_H
+#define TROPICSSL_SHACE_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SHACE)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__aarch64__) && \
+    !defined(TROPICSSL_HAVE_ARMV8)
+#define TROPICSSL_HAVE_ARMV8
+#endif
+
+/*
+ * Features reported by shace_supports()
+ */
+#define TROPICSSL_SHACE_SHA1            0x01u
+#define TROPICSSL_SHACE_SHA256          0x02u
+
+#if defined(TROPICSSL_HAVE_ARMV8)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          ARMv8 SHA instructions detection routine
+	 *
+	 * \param what     TROPICSSL_SHACE_SHA1 or TROPICSSL_SHACE_SHA256
+	 *
+	 * \return         1 if the CPU has the instructions, 0 otherwise
+	 */
+	int shace_supports(unsigned int what);
+
+	/**
+	 * \brief          SHA-1 compression of whole blocks using the
+	 *                 ARMv8 SHA1 instructions
+	 *
+	 * \param state    SHA-1 intermediate digest (updated)
+	 * \param data     nblocks * 64 bytes of message
+	 * \param nblocks  number of blocks to process
+	 */
+	void shace_sha1_process(uint32_t state[5], const uint8_t *data,
+				size_t nblocks);
+
+	/**
+	 * \brief          SHA-256 compression of whole blocks using the
+	 *                 ARMv8 SHA256 instructions
+	 *
+	 * \param state    SHA-256 intermediate digest (updated)
+	 * \param data     nblocks * 64 bytes of message
+	 * \param nblocks  number of blocks to process
+	 */
+	void shace_sha256_process(uint32_t state[8], const uint8_t *data,
+				  size_t nblocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_HAVE_ARMV8 */
+#endif              /* TROPICSSL_SHACE */
+#endif				/* shace.h */
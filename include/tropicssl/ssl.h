@@ -40,10 +40,22 @@
 
 #include "tropicssl/net.h"
 #include "tropicssl/dhm.h"
+#include "tropicssl/ecp.h"
 #include "tropicssl/rsa.h"
 #include "tropicssl/md5.h"
 #include "tropicssl/sha1.h"
+#include "tropicssl/sha2.h"
+#include "tropicssl/sha4.h"
 #include "tropicssl/x509.h"
+#include "tropicssl/timing.h"
+
+#if defined(TROPICSSL_SSL_STATS)
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
 
 /*
  * Various constants
@@ -52,10 +64,12 @@
 #define SSL_MINOR_VERSION_0             0	/*!< SSL v3.0 */
 #define SSL_MINOR_VERSION_1             1	/*!< TLS v1.0 */
 #define SSL_MINOR_VERSION_2             2	/*!< TLS v1.1 */
+#define SSL_MINOR_VERSION_3             3	/*!< TLS v1.2 */
 
 #define SSL_IS_CLIENT                   0
 #define SSL_IS_SERVER                   1
 #define SSL_COMPRESS_NULL               0
+#define SSL_COMPRESS_DEFLATE            1
 
 #define SSL_VERIFY_NONE                 0
 #define SSL_VERIFY_OPTIONAL             1
@@ -65,9 +79,68 @@
 
 /*
  * Allow an extra 512 bytes for the record header
- * and encryption overhead (counter + MAC + padding).
+ * and encryption overhead (counter + MAC + padding),
+ * plus the 1024 bytes compression may add (RFC 5246 6.2.2).
+ */
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+#define SSL_COMPRESSION_ADD          1024
+#else
+#define SSL_COMPRESSION_ADD             0
+#endif
+#define SSL_BUFFER_OVERHEAD (512 + SSL_COMPRESSION_ADD)
+#define SSL_BUFFER_LEN (SSL_MAX_CONTENT_LEN + SSL_BUFFER_OVERHEAD)
+
+/*
+ * Smallest plaintext length accepted by ssl_set_buffer_len()
+ */
+#define SSL_MIN_CONTENT_LEN           512
+
+/*
+ * Largest handshake message gathered from several records, by
+ * default (see ssl_set_handshake_max_len())
+ */
+#define SSL_MAX_HANDSHAKE_LEN       65536
+
+/*
+ * Dynamic record sizing defaults (see ssl_set_record_sizing()): the
+ * opening records fit one 1448-byte TCP segment with the header, IV,
+ * MAC and padding of any cipher suite
+ */
+#define SSL_DRS_SMALL_LEN            1360
+#define SSL_DRS_RAMP_LEN            32768
+#define SSL_DRS_IDLE_MS              1000
+
+/*
+ * DEFLATE compressor bounds (see ssl_set_compression()): it takes
+ * (1 << (WINDOW_BITS + 2)) + (1 << (MEM_LEVEL + 9)) bytes, 32 KB
+ * with these; the decompressor takes the 32 KB window any peer
+ * may use, plus about 7 KB.
+ */
+#define SSL_DEFLATE_WINDOW_BITS        12
+#define SSL_DEFLATE_MEM_LEVEL           5
+
+/*
+ * RFC 6066 max_fragment_length codes: 2^(8+code) bytes
+ */
+#define SSL_MAX_FRAG_LEN_NONE           0
+#define SSL_MAX_FRAG_LEN_512            1
+#define SSL_MAX_FRAG_LEN_1024           2
+#define SSL_MAX_FRAG_LEN_2048           3
+#define SSL_MAX_FRAG_LEN_4096           4
+
+/*
+ * The output ring queues records back to back for ssl_writev() and
+ * corked contexts; it has room for this many full-sized records,
+ * and many more small ones.
+ */
+#define SSL_OUT_RING_RECORDS            4
+
+/*
+ * Connection state exported by ssl_context_save(): the format
+ * version, then at most this many bytes (RC4 adds its permutations)
  */
-#define SSL_BUFFER_LEN (SSL_MAX_CONTENT_LEN + 512)
+#define SSL_CONTEXT_SAVE_VERSION        1
+#define SSL_CONTEXT_SAVE_MAX_LEN      725
 
 /*
  * Supported ciphersuites
@@ -84,6 +157,38 @@
 #define TLS_RSA_WITH_CAMELLIA_256_CBC_SHA           0x84
 #define TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA       0x88
 
+/*
+ * RFC 5246 HMAC-SHA256 ciphersuites, TLS 1.2 only
+ */
+#define TLS_RSA_WITH_AES_128_CBC_SHA256             0x3C
+#define TLS_RSA_WITH_AES_256_CBC_SHA256             0x3D
+#define TLS_DHE_RSA_WITH_AES_128_CBC_SHA256         0x67
+#define TLS_DHE_RSA_WITH_AES_256_CBC_SHA256         0x6B
+
+/*
+ * RFC 5288 AEAD ciphersuites, TLS 1.2 only
+ */
+#define TLS_RSA_WITH_AES_128_GCM_SHA256             0x9C
+#define TLS_RSA_WITH_AES_256_GCM_SHA384             0x9D
+#define TLS_DHE_RSA_WITH_AES_128_GCM_SHA256         0x9E
+#define TLS_DHE_RSA_WITH_AES_256_GCM_SHA384         0x9F
+
+/*
+ * RFC 4492 ephemeral ECDH ciphersuites (P-256, RSA signed)
+ */
+#define TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA         0xC012
+#define TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA          0xC013
+#define TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA          0xC014
+#define TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256       0xC027
+#define TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256       0xC02F
+#define TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384       0xC030
+
+/*
+ * RFC 7905 ChaCha20-Poly1305 ciphersuites, TLS 1.2 only
+ */
+#define TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 0xCCA8
+#define TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256   0xCCAA
+
 /*
  * Message, alert and handshake types
  */
@@ -100,6 +205,7 @@
 #define SSL_HS_HELLO_REQUEST            0
 #define SSL_HS_CLIENT_HELLO             1
 #define SSL_HS_SERVER_HELLO             2
+#define SSL_HS_NEW_SESSION_TICKET       4
 #define SSL_HS_CERTIFICATE             11
 #define SSL_HS_SERVER_KEY_EXCHANGE     12
 #define SSL_HS_CERTIFICATE_REQUEST     13
@@ -113,6 +219,37 @@
  */
 #define TLS_EXT_SERVERNAME              0
 #define TLS_EXT_SERVERNAME_HOSTNAME     0
+#define TLS_EXT_MAX_FRAGMENT_LENGTH     1
+#define TLS_EXT_SUPPORTED_ELLIPTIC_CURVES 10
+#define TLS_EXT_EC_POINT_FORMATS       11
+#define TLS_EXT_SIG_ALG                13
+#define TLS_EXT_SESSION_TICKET         35
+
+/*
+ * TLS 1.2 SignatureAndHashAlgorithm values (RFC 5246 7.4.1.4.1)
+ */
+#define SSL_HASH_SHA1                   2
+#define SSL_HASH_SHA256                 4
+#define SSL_HASH_SHA384                 5
+#define SSL_SIG_RSA                     1
+
+/*
+ * Longest input to a raw PKCS#1 v1.5 signature: the DigestInfo of
+ * a SHA-384 hash (the MD5 + SHA-1 pair of older versions is 36 bytes)
+ */
+#define SSL_SIG_INPUT_MAX              67
+
+/*
+ * Private key operations handed to ssl_set_async_key() callbacks
+ */
+#define SSL_ASYNC_SIGN                  1	/*!< PKCS#1 v1.5, raw input  */
+#define SSL_ASYNC_DECRYPT               2	/*!< PKCS#1 v1.5 decryption   */
+
+/*
+ * Directions handed to the kernel, see ssl_get_ktls()
+ */
+#define SSL_KTLS_TX                     1
+#define SSL_KTLS_RX                     2
 
 /*
  * SSL state machine
@@ -130,6 +267,7 @@ typedef enum {
 	SSL_CERTIFICATE_VERIFY,
 	SSL_CLIENT_CHANGE_CIPHER_SPEC,
 	SSL_CLIENT_FINISHED,
+	SSL_SERVER_NEW_SESSION_TICKET,
 	SSL_SERVER_CHANGE_CIPHER_SPEC,
 	SSL_SERVER_FINISHED,
 	SSL_FLUSH_BUFFERS,
@@ -138,6 +276,113 @@ typedef enum {
 
 typedef struct _ssl_session ssl_session;
 typedef struct _ssl_context ssl_context;
+typedef struct _ssl_cipher_info ssl_cipher_info;
+
+/*
+ * Idle record buffers, shared by any number of contexts
+ */
+typedef struct {
+	size_t len;		/*!< size of each buffer              */
+	int max;		/*!< max. number of buffers kept      */
+	int count;		/*!< number of buffers kept           */
+	uint8_t *head;		/*!< list of idle buffers             */
+} ssl_buffer_pool;
+
+/*
+ * Handshake transcript: kept as raw bytes until the negotiated
+ * version says which digests the Finished and CertificateVerify
+ * messages need, then hashed as it comes with those only
+ */
+#define SSL_TRANSCRIPT_MD5              1
+#define SSL_TRANSCRIPT_SHA1             2
+#define SSL_TRANSCRIPT_SHA256           4
+#define SSL_TRANSCRIPT_SHA384           8
+
+typedef struct {
+	int digests;		/*!< running digests, 0 until selected */
+	uint8_t *buf;		/*!< transcript so far, until then    */
+	size_t len;		/*!< bytes in buf                     */
+	size_t size;		/*!< size of buf                      */
+	md5_context md5;	/*!< running MD5 of the transcript    */
+	sha1_context sha1;	/*!< running SHA-1 of the transcript  */
+	sha2_context sha2;	/*!< running SHA-256 (TLS 1.2)        */
+	sha4_context sha4;	/*!< running SHA-384 (TLS 1.2)        */
+} ssl_transcript;
+
+#if defined(TROPICSSL_SSL_STATS)
+/*
+ * Performance counters of one context, or the sum of many
+ */
+typedef struct {
+	uint64_t records_in;	/*!< records received                 */
+	uint64_t records_out;	/*!< records sent                     */
+	uint64_t bytes_in;	/*!< record bytes received, headers in */
+	uint64_t bytes_out;	/*!< record bytes sent, headers in    */
+
+	uint64_t handshakes;	/*!< handshakes completed             */
+	uint64_t resume_hits;	/*!< offered sessions resumed         */
+	uint64_t resume_misses;	/*!< offered sessions not resumed     */
+
+	uint64_t rsa_ops;	/*!< RSA operations (not async ones)  */
+	uint64_t rsa_usec;	/*!< time spent in them               */
+	uint64_t dh_ops;	/*!< DH key operations                */
+	uint64_t dh_usec;	/*!< time spent in them               */
+	uint64_t ecdh_ops;	/*!< ECDH key operations              */
+	uint64_t ecdh_usec;	/*!< time spent in them               */
+
+	uint64_t state_usec[SSL_HANDSHAKE_OVER];	/*!< per state  */
+
+	uint64_t in_hwm;	/*!< most input bytes held at once    */
+	uint64_t out_hwm;	/*!< most output bytes held at once   */
+} ssl_stats;
+
+/*
+ * Counters of finished contexts, shared by any number of threads
+ */
+typedef struct {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	ssl_stats total;	/*!< sum of the merged counters       */
+	uint64_t contexts;	/*!< number of contexts merged        */
+} ssl_stats_sink;
+#endif
+
+/*
+ * State only the handshake needs: allocated by ssl_init() and
+ * released as soon as the handshake is over
+ */
+typedef struct {
+	dhm_context dhm_ctx;	/*!<  DHM key exchange        */
+#if defined(TROPICSSL_ECP)
+	ecdh_context ecdh_ctx;	/*!<  ECDHE key exchange      */
+#endif
+	ssl_transcript transcript;	/*!<  handshake messages      */
+
+	int deflate_offered;	/*!<  (server) client has it  */
+	size_t pmslen;		/*!<  premaster length        */
+	uint8_t randbytes[64];	/*!<  random bytes            */
+	uint8_t premaster[256];	/*!<  premaster secret        */
+
+	int gather;		/*!<  SSL_GATHER_* state      */
+	int stream;		/*!<  Certificate parsed as it comes */
+	uint8_t *msg;		/*!<  message being gathered  */
+	size_t msg_size;	/*!<  size of that buffer     */
+	size_t msg_fill;	/*!<  bytes held in it        */
+	size_t msg_len;		/*!<  message length, 0 until its header is in */
+	size_t msg_done;	/*!<  bytes parsed on the fly */
+	size_t msg_rest;	/*!<  record bytes after it   */
+} ssl_handshake_params;
+
+/*
+ * A handshake message larger than its record is gathered in
+ * ssl_handshake_params; once whole, in_msg points to it
+ */
+#define SSL_GATHER_NONE                 0
+#define SSL_GATHER_MORE                 1
+#define SSL_GATHER_DONE                 2
 
 /*
  * This structure is used for session resuming.
@@ -145,10 +390,15 @@ typedef struct _ssl_context ssl_context;
 struct _ssl_session {
 	time_t start;		/*!< starting time      */
 	int cipher;		/*!< chosen cipher      */
+	int compression;	/*!< chosen compression */
 	size_t length;		/*!< session id length  */
 	uint8_t id[32];	/*!< session identifier */
 	uint8_t master[48];	/*!< the master secret  */
 	ssl_session *next;	/*!< next session entry */
+
+	uint8_t *ticket;	/*!< (client) RFC 5077 ticket */
+	size_t ticket_len;	/*!< ticket length            */
+	uint32_t ticket_lifetime;	/*!< lifetime hint, seconds   */
 };
 
 struct _ssl_context {
@@ -158,7 +408,7 @@ struct _ssl_context {
 	int state;		/*!< SSL handshake: current state     */
 
 	int major_ver;		/*!< equal to  SSL_MAJOR_VERSION_3    */
-	int minor_ver;		/*!< either 0 (SSL3) or 1 (TLS1.0)    */
+	int minor_ver;		/*!< 0 (SSL3) up to 3 (TLS1.2)        */
 
 	int max_major_ver;	/*!< max. major version from client   */
 	int max_minor_ver;	/*!< max. minor version from client   */
@@ -166,10 +416,11 @@ struct _ssl_context {
 	/*
 	 * Callbacks (RNG, debug, I/O)
 	 */
-	int (*f_rng) (void *);
+	int (*f_rng) (void *, uint8_t *, size_t);
 	void (*f_dbg) (void *, int, const char *);
 	int (*f_recv) (void *, uint8_t *, size_t);
 	int (*f_send) (void *, uint8_t *, size_t);
+	int (*f_sendv) (void *, const net_iovec *, int);
 
 	void *p_rng;		/*!< context for the RNG function     */
 	void *p_dbg;		/*!< context for the debug function   */
@@ -184,6 +435,22 @@ struct _ssl_context {
 	ssl_session *session;	/*!<  current session data    */
 	int (*s_get) (ssl_context *);	/*!<  (server) get callback   */
 	int (*s_set) (ssl_context *);	/*!<  (server) set callback   */
+	void *p_scb;		/*!<  context for s_get/s_set */
+	int scb_port;		/*!<  (client) server port    */
+	int (*f_admit) (void *, ssl_context *, int);
+	void *p_admit;		/*!<  (server) admission ctx. */
+	unsigned long admit_since;	/*!<  deferred since (ms)     */
+
+	int (*f_ticket_write) (void *, ssl_context *, uint8_t *, size_t *,
+			       uint32_t *);
+	int (*f_ticket_parse) (void *, ssl_context *, ssl_session *,
+			       const uint8_t *, size_t);
+	void *p_ticket;		/*!<  (server) ticket context */
+	int use_tickets;	/*!<  (client) send tickets   */
+	int new_ticket;		/*!<  NewSessionTicket agreed */
+	int ticket_cipher;	/*!<  cipher in valid ticket  */
+	int false_start;	/*!<  (client) False Start on */
+	int false_started;	/*!<  server Finished pending */
 
 	/*
 	 * Record layer (incoming data)
@@ -196,10 +463,18 @@ struct _ssl_context {
 	int in_msgtype;			/*!< record header: message type      */
 	size_t in_msglen;		/*!< record header: message length    */
 	size_t in_left;			/*!< amount of data read so far       */
+	size_t in_ahead;		/*!< bytes read past the record       */
+	size_t in_ahead_off;		/*!< where they start (from in_hdr)   */
+	size_t in_ahead_len;		/*!< read-ahead room in the buffer    */
 
 	size_t in_hslen;		/*!< current handshake message length */
+	size_t hs_max_len;		/*!< largest one gathered from records */
 	int nb_zero;			/*!< # of 0-length encrypted messages */
 
+	size_t in_content_len;		/*!< max. incoming plaintext length   */
+	size_t in_buf_len;		/*!< size of the in_ctr buffer        */
+	uint8_t in_seq[8];	/*!< in_ctr while the buffer is idle  */
+
 	/*
 	 * Record layer (outgoing data)
 	 */
@@ -211,13 +486,46 @@ struct _ssl_context {
 	size_t out_msglen;		/*!< record header: message length    */
 	size_t out_left;		/*!< amount of data not yet written   */
 
+	uint8_t *out_ring;	/*!< queued records (writev, cork)    */
+	size_t out_ring_len;		/*!< size of the out_ring buffer      */
+	size_t out_ring_used;		/*!< bytes of queued records          */
+	size_t out_ring_sent;		/*!< queued bytes already written     */
+	size_t out_ring_data;		/*!< writev/sendfile bytes queued     */
+	int out_cork;			/*!< queue application records        */
+
+	size_t out_content_len;		/*!< max. outgoing plaintext length   */
+	size_t drs_small_len;		/*!< opening record length, 0 = off   */
+	size_t drs_ramp_len;		/*!< bytes sent in opening records    */
+	int drs_idle_ms;		/*!< idle time that restarts the ramp */
+	size_t drs_sent;		/*!< bytes sent since the ramp began  */
+#if defined(TROPICSSL_TIMING)
+	struct hr_time drs_timer;	/*!< started by the last write        */
+#endif
+	size_t out_buf_len;		/*!< size of the out_ctr buffer       */
+	uint8_t out_seq[8];	/*!< out_ctr while the buffer is idle */
+
+	ssl_buffer_pool *pool;	/*!< where idle buffers are released  */
+
 	/*
 	 * PKI layer
 	 */
 	rsa_context *rsa_key;	/*!<  own RSA private key     */
 	x509_cert *own_cert;	/*!<  own X.509 certificate   */
+
+	int (*f_async_start) (void *, ssl_context *, int,
+			      const uint8_t *, size_t);
+	int (*f_async_resume) (void *, ssl_context *, uint8_t *, size_t *,
+			       size_t);
+	void *p_async;		/*!<  context for the above   */
+	int async_op;		/*!<  private op. in progress */
+	size_t async_off;	/*!<  where its result goes   */
+
 	x509_cert *ca_chain;	/*!<  own trusted CA chain    */
 	x509_cert *peer_cert;	/*!<  peer X.509 cert chain   */
+#if defined(TROPICSSL_X509_CRT_CACHE)
+	x509_crt_cache *crt_cache;	/*!<  shared peer chains      */
+	x509_crt_cache *peer_cache;	/*!<  holder of peer_cert     */
+#endif
 	const char *peer_cn;	/*!<  expected peer CN        */
 
 	int endpoint;		/*!<  0: client, 1: server    */
@@ -228,35 +536,79 @@ struct _ssl_context {
 	/*
 	 * Crypto layer
 	 */
-	dhm_context dhm_ctx;	/*!<  DHM key exchange        */
-	md5_context fin_md5;	/*!<  Finished MD5 checksum   */
-	sha1_context fin_sha1;	/*!<  Finished SHA-1 checksum */
+	ssl_handshake_params *handshake;	/*!<  NULL once it is over */
+	dhm_shared *dhm_sh;	/*!<  (server) shared DH state */
+#if defined(TROPICSSL_ECP)
+	int ec_ok;		/*!<  (server) peer has P-256 */
+	int ec_fmt;		/*!<  (server) echo formats   */
+#endif
 
-	int do_crypt;		/*!<  en(de)cryption flag     */
+	int in_crypt;		/*!<  decryption flag         */
+	int out_crypt;		/*!<  encryption flag         */
 	int *ciphers;		/*!<  allowed ciphersuites    */
-	size_t pmslen;		/*!<  premaster length        */
+	int chacha_prio;	/*!<  ChaCha20-Poly1305 first  */
+	int compress_level;	/*!<  DEFLATE level, 0: off   */
+	void *deflate_ctx;	/*!<  zlib streams, once the  */
+	void *inflate_ctx;	/*!<  records are compressed  */
+	uint8_t *compress_buf;	/*!<  (de)compression output  */
 	unsigned int keylen;		/*!<  symmetric key length    */
 	size_t minlen;		/*!<  min. ciphertext length  */
 	size_t ivlen;		/*!<  IV length               */
 	size_t maclen;		/*!<  MAC length              */
 
-	uint8_t randbytes[64];	/*!<  random bytes            */
-	uint8_t premaster[256];	/*!<  premaster secret        */
-
 	uint8_t iv_enc[16];	/*!<  IV (encryption)         */
 	uint8_t iv_dec[16];	/*!<  IV (decryption)         */
 
 	uint8_t mac_enc[32];	/*!<  MAC (encryption)        */
 	uint8_t mac_dec[32];	/*!<  MAC (decryption)        */
+	uint8_t *key_rand;	/*!<  hello randoms, kept only
+					      for ssl_context_save()  */
+
+	const ssl_cipher_info *cipher_info;	/*!<  negotiated suite  */
+	int (*f_encrypt) (ssl_context *);	/*!<  record protection */
+	int (*f_decrypt) (ssl_context *);	/*!<  and its removal   */
+	void (*f_mac) (const uint8_t *, void *, const uint8_t *, int,
+		       uint8_t *, size_t);	/*!<  record MAC        */
+
+	void *hmac_enc;		/*!<  HMAC key state (enc.)   */
+	void *hmac_dec;		/*!<  HMAC key state (dec.)   */
 
-	uint32_t ctx_enc[128];	/*!<  encryption context      */
-	uint32_t ctx_dec[128];	/*!<  decryption context      */
+	void *ctx_enc;		/*!<  encryption context      */
+	void *ctx_dec;		/*!<  decryption context      */
+	size_t ctx_len;		/*!<  one block for all four  */
 
 	/*
 	 * TLS extensions
 	 */
 	uint8_t *hostname;
 	size_t hostname_len;
+	int (*f_sni) (void *, ssl_context *, const uint8_t *, size_t);
+	void *p_sni;		/*!<  (server) SNI context    */
+	int sni_ack;		/*!<  server_name was used    */
+	int mfl_code;		/*!<  max_fragment_length wanted */
+	int mfl_nego;		/*!<  max_fragment_length agreed */
+	int sig_hash;		/*!<  (server) TLS 1.2 hash to sign */
+
+#if defined(TROPICSSL_SSL_KTLS)
+	/*
+	 * Kernel TLS
+	 */
+	int ktls_fd;		/*!<  socket to offload, or -1 */
+	int ktls;		/*!<  SSL_KTLS_TX, SSL_KTLS_RX  */
+	uint8_t ktls_key_enc[32];	/*!<  GCM keys, until offloaded */
+	uint8_t ktls_key_dec[32];
+#endif
+
+#if defined(TROPICSSL_SSL_STATS)
+	/*
+	 * Performance counters
+	 */
+	ssl_stats stats;		/*!<  counters so far         */
+	ssl_stats_sink *stats_sink;	/*!<  where ssl_free() adds them */
+	int stats_state;		/*!<  state being timed       */
+	struct hr_time stats_state_timer;	/*!<  handshake step */
+	struct hr_time stats_op_timer;	/*!<  public key operation    */
+#endif
 };
 
 #ifdef __cplusplus
@@ -305,10 +657,13 @@ extern "C" {
 	 * \brief          Set the random number generator callback
 	 *
 	 * \param ssl      SSL context
-	 * \param f_rng    RNG function
+	 * \param f_rng    RNG function: fills its buffer with random
+	 *                 bytes and returns 0, such as ctr_drbg_random
 	 * \param p_rng    RNG parameter
 	 */
-	void ssl_set_rng(ssl_context * ssl, int (*f_rng) (void *), void *p_rng);
+	void ssl_set_rng(ssl_context * ssl,
+			 int (*f_rng) (void *, uint8_t *, size_t),
+			 void *p_rng);
 
 	/**
 	 * \brief          Set the debug callback
@@ -328,6 +683,12 @@ extern "C" {
 	 * \param p_recv   read parameter
 	 * \param f_send   write callback
 	 * \param p_send   write parameter
+	 *
+	 * \note           A callback that would block returns
+	 *                 TROPICSSL_ERR_NET_TRY_AGAIN; the SSL calls then
+	 *                 return TROPICSSL_ERR_NET_WANT_READ or
+	 *                 TROPICSSL_ERR_NET_WANT_WRITE, after which callback
+	 *                 they were stuck.
 	 */
 	void ssl_set_bio(ssl_context * ssl,
 			 int (*f_recv) (void *, uint8_t *, size_t),
@@ -335,16 +696,151 @@ extern "C" {
 						      size_t), void *p_send);
 
 	/**
-	 * \brief          Set the session callbacks (server-side only)
+	 * \brief          Set the optional vectored write callback, used
+	 *                 with p_send to flush several records at once
+	 *
+	 * \param ssl      SSL context
+	 * \param f_sendv  vectored write callback (eg. net_sendv), or
+	 *                 NULL to send one buffer at a time with f_send
+	 */
+	void ssl_set_sendv(ssl_context * ssl,
+			   int (*f_sendv) (void *, const net_iovec *, int));
+
+#if defined(TROPICSSL_SSL_KTLS)
+	/**
+	 * \brief          Hand the record layer to the kernel once the
+	 *                 handshake is over (Linux kernel TLS)
+	 *
+	 * \param ssl      SSL context
+	 * \param fd       the connected TCP socket under the BIO
+	 *
+	 * \note           Only TLS 1.2 AES-GCM suites with full-sized
+	 *                 records qualify, and only if the kernel has the
+	 *                 tls module; otherwise, or for a direction with
+	 *                 data still buffered, records stay in userspace.
+	 *                 See ssl_get_ktls().
+	 *
+	 * \note           Offloaded directions use fd directly, not the
+	 *                 BIO: ssl_read() and ssl_write() become a recv()
+	 *                 and a send(), and ssl_sendfile() the kernel's
+	 *                 sendfile(). Renegotiation is then refused.
+	 */
+	void ssl_set_ktls(ssl_context * ssl, int fd);
+
+	/**
+	 * \brief          Return the directions the kernel protects
+	 *
+	 * \param ssl      SSL context
+	 *
+	 * \return         0, or SSL_KTLS_TX and / or SSL_KTLS_RX
+	 */
+	int ssl_get_ktls(const ssl_context * ssl);
+#endif
+
+	/**
+	 * \brief          Set the session callbacks
 	 *
 	 * \param ssl      SSL context
-	 * \param s_get    session get callback
-	 * \param s_set    session set callback
+	 * \param s_get    session get callback: on a server, fetch the
+	 *                 master secret of the session the client offers;
+	 *                 on a client (with resume = 0), fill in a session
+	 *                 to offer and set resume
+	 * \param s_set    session set callback, called when the keys are
+	 *                 known (server) or the handshake is over (client)
 	 */
 	void ssl_set_scb(ssl_context * ssl,
 			 int (*s_get) (ssl_context *),
 			 int (*s_set) (ssl_context *));
 
+	/**
+	 * \brief          Set the admission callback (server-side only),
+	 *                 eg. ssl_admit_check
+	 *
+	 * \param ssl      SSL context
+	 * \param f_admit  called after the ClientHello, with 1 if the
+	 *                 session is resumed and 0 for a full handshake;
+	 *                 0 lets the handshake go on,
+	 *                 TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED holds it
+	 *                 back, anything else ends it
+	 * \param p_admit  context for the callback
+	 *
+	 * \note           A deferred handshake returns
+	 *                 TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED; call it
+	 *                 again later (ssl_engine does after a few ms),
+	 *                 which asks f_admit again. Nothing is sent until
+	 *                 it is admitted.
+	 */
+	void ssl_set_admission(ssl_context * ssl,
+			       int (*f_admit) (void *, ssl_context *, int),
+			       void *p_admit);
+
+	/**
+	 * \brief          Enable the RFC 5077 SessionTicket extension
+	 *                 (client-side only)
+	 *
+	 * \param ssl      SSL context
+	 * \param use_tickets 1 to ask for a ticket and offer the one kept
+	 *                 in the session (see ssl_set_session), 0 not to
+	 *
+	 * \note           The ticket is allocated in the session; release
+	 *                 it with ssl_session_free().
+	 */
+	void ssl_set_session_tickets(ssl_context * ssl, int use_tickets);
+
+	/**
+	 * \brief          Enable TLS False Start (client-side only)
+	 *
+	 * \param ssl      SSL context
+	 * \param enabled  1 to let ssl_handshake() return as soon as the
+	 *                 client's Finished is sent, on full handshakes
+	 *                 with a DHE or ECDHE key exchange and an AEAD
+	 *                 (GCM or ChaCha20-Poly1305) suite; 0 (default)
+	 *                 to wait for the server's Finished
+	 *
+	 * \note           Application data written then goes out one
+	 *                 round trip earlier. The server's Finished is
+	 *                 checked by the first ssl_read(), which fails if
+	 *                 it is wrong; until then the server has not been
+	 *                 proven to hold the keys, so enable this only with
+	 *                 a verified certificate (SSL_VERIFY_REQUIRED).
+	 */
+	void ssl_set_false_start(ssl_context * ssl, int enabled);
+
+	/**
+	 * \brief          Set the server_name callback (server-side only),
+	 *                 eg. ssl_sni_get
+	 *
+	 * \param ssl      SSL context
+	 * \param f_sni    called with the host name the client asked for,
+	 *                 before the cipher is chosen; it may pick the
+	 *                 certificate with ssl_set_own_cert(), and returns
+	 *                 0 to go on or non-zero to abort the handshake
+	 * \param p_sni    context for the callback
+	 */
+	void ssl_set_sni(ssl_context * ssl,
+			 int (*f_sni) (void *, ssl_context *,
+				       const uint8_t *, size_t),
+			 void *p_sni);
+
+	/**
+	 * \brief          Set the session ticket callbacks (server-side
+	 *                 only), eg. ssl_ticket_write/ssl_ticket_parse
+	 *
+	 * \param ssl      SSL context
+	 * \param f_ticket_write  seal ssl->session into a ticket of at most
+	 *                 *len bytes, updating *len and the lifetime hint
+	 * \param f_ticket_parse  unseal a ticket into a session; 0 if valid
+	 * \param p_ticket context for both callbacks
+	 */
+	void ssl_set_ticket_cb(ssl_context * ssl,
+			       int (*f_ticket_write) (void *, ssl_context *,
+						      uint8_t *, size_t *,
+						      uint32_t *),
+			       int (*f_ticket_parse) (void *, ssl_context *,
+						      ssl_session *,
+						      const uint8_t *, size_t),
+			       void *p_ticket);
+
 	/**
 	 * \brief          Set the session resuming flag, timeout and data
 	 *
@@ -361,9 +857,28 @@ extern "C" {
 	 *
 	 * \param ssl      SSL context
 	 * \param ciphers  0-terminated list of allowed ciphers
+	 *
+	 * \note           The list is only read, so one can serve every
+	 *                 context in every thread.
 	 */
 	void ssl_set_ciphers(ssl_context * ssl, int *ciphers);
 
+	/**
+	 * \brief          Put ChaCha20-Poly1305 ahead of the AES suites
+	 *                 for peers that are better off with it
+	 *
+	 * \param ssl      SSL context
+	 * \param enabled  1 to enable, 0 to follow the cipher list as is
+	 *                 (default)
+	 *
+	 * \note           A client offers the ChaCha20-Poly1305 suites of
+	 *                 its list first when the CPU has no AES
+	 *                 instructions. A server picks them first (in its
+	 *                 own order) when the client lists one of them
+	 *                 first, which is how such clients ask for it.
+	 */
+	void ssl_set_prioritize_chacha(ssl_context * ssl, int enabled);
+
 	/**
 	 * \brief          Set the data required to verify peer certificate
 	 *
@@ -371,21 +886,118 @@ extern "C" {
 	 * \param ca_chain trusted CA chain
 	 * \param peer_cn  expected peer CommonName (or NULL)
 	 *
+	 * \note           The chain is only read (any verification cache
+	 *                 on it is locked), so threads may share it.
+	 *
+	 * \note           The first call for a chain also encodes the DN
+	 *                 list of the CertificateRequest, kept on the chain
+	 *                 for every context using it.
+	 *
 	 * \note           TODO: add two more parameters: depth and crl
 	 */
 	void ssl_set_ca_chain(ssl_context * ssl, x509_cert * ca_chain,
 			      const char *peer_cn);
 
+	/**
+	 * \brief          Offer (client) or accept (server) DEFLATE
+	 *                 compression of the records
+	 *
+	 * \param ssl      SSL context
+	 * \param level    zlib level, 1 (fastest) to 9 (smallest), or
+	 *                 0 to turn it off (the default)
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 *                 or TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE without
+	 *                 TROPICSSL_ZLIB_SUPPORT
+	 *
+	 * \note           Compressing secrets along with data an attacker
+	 *                 chooses leaks them through the record lengths
+	 *                 (CRIME): only use it where both ends and all
+	 *                 the traffic are trusted.
+	 *
+	 * \note           Each direction is one stream flushed at every
+	 *                 record; the state is allocated when the first
+	 *                 compressed record goes out or comes in, and is
+	 *                 bounded by SSL_DEFLATE_WINDOW_BITS and
+	 *                 SSL_DEFLATE_MEM_LEVEL. Compressed connections
+	 *                 keep their records in userspace (see
+	 *                 ssl_set_ktls()).
+	 */
+	int ssl_set_compression(ssl_context * ssl, int level);
+
+#if defined(TROPICSSL_X509_CRT_CACHE)
+	/**
+	 * \brief          Take the peer's chain from a certificate cache,
+	 *                 so that chains seen before are not parsed again
+	 *
+	 * \param ssl      SSL context
+	 * \param cache    certificate cache, shared by any number of
+	 *                 contexts and threads; it must outlive them
+	 *
+	 * \note           peer_cert then points to an immutable chain,
+	 *                 released by ssl_free().
+	 */
+	void ssl_set_crt_cache(ssl_context * ssl, x509_crt_cache * cache);
+#endif
+
 	/**
 	 * \brief          Set own certificate and private key
 	 *
 	 * \param ssl      SSL context
 	 * \param own_cert own public certificate
 	 * \param rsa_key  own private RSA key
+	 *
+	 * \note           If rsa_key has no RNG of its own (as when it
+	 *                 comes from x509parse_key()), each private key
+	 *                 operation of the handshake lends it the one from
+	 *                 ssl_set_rng(), for blinding, and takes it back
+	 *                 after: the key keeps no pointer to the context.
+	 *
+	 * \note           Threads may share own_cert, but not rsa_key:
+	 *                 it keeps the blinding values, and the RNG is
+	 *                 not locked either. Give each thread a key (and
+	 *                 an RNG) of its own, as ssl_server2 does.
+	 *
+	 * \note           The first call for a chain also encodes its
+	 *                 Certificate message, kept on the chain: the
+	 *                 handshake then copies it out whole. Parsing more
+	 *                 certificates into the chain drops it.
 	 */
 	void ssl_set_own_cert(ssl_context * ssl, x509_cert * own_cert,
 			      rsa_context * rsa_key);
 
+	/**
+	 * \brief          Hand the private key operations to someone else,
+	 *                 eg. a worker thread or an accelerator
+	 *                 (server-side only)
+	 *
+	 * \param ssl      SSL context
+	 * \param f_start  start operation SSL_ASYNC_SIGN or SSL_ASYNC_DECRYPT
+	 *                 on the given input; 0 once started, or
+	 *                 TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE to have it
+	 *                 done inline with the key given to ssl_set_own_cert
+	 * \param f_resume fetch the result (at most the given size) and
+	 *                 its length; 0 when done,
+	 *                 TROPICSSL_ERR_SSL_ASYNC_IN_PROGRESS if not yet
+	 * \param p_async  context for both callbacks
+	 *
+	 * \note           The handshake then returns
+	 *                 TROPICSSL_ERR_SSL_ASYNC_IN_PROGRESS until the
+	 *                 operation is over; call it again when notified.
+	 *                 f_resume is first tried right after f_start.
+	 *
+	 * \note           Only the modulus length of the key given to
+	 *                 ssl_set_own_cert() is used for offloaded
+	 *                 operations. A failed decryption is treated like
+	 *                 bad padding, a failed signature aborts.
+	 */
+	void ssl_set_async_key(ssl_context * ssl,
+			       int (*f_start) (void *, ssl_context *, int,
+					       const uint8_t *, size_t),
+			       int (*f_resume) (void *, ssl_context *,
+						uint8_t *, size_t *, size_t),
+			       void *p_async);
+
 	/**
 	 * \brief          Set the Diffie-Hellman public P and G values,
 	 *                 read as hexadecimal strings (server-side only)
@@ -394,10 +1006,22 @@ extern "C" {
 	 * \param dhm_P    Diffie-Hellman-Merkle modulus
 	 * \param dhm_G    Diffie-Hellman-Merkle generator
 	 *
-	 * \return         0 if successful
+	 * \return         0 if successful, or TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 *                 once the handshake is over
 	 */
 	int ssl_set_dh_param(ssl_context * ssl, const char *dhm_P, const char *dhm_G);
 
+	/**
+	 * \brief          Take the DH parameters from a state shared by all
+	 *                 of the server's contexts, with G's comb already
+	 *                 computed and, if so set up, key pairs reused
+	 *                 (see dhm_shared_init() and dhm_shared_reuse())
+	 *
+	 * \param ssl      SSL context
+	 * \param S        shared DH state, instead of ssl_set_dh_param()
+	 */
+	void ssl_set_dh_shared(ssl_context * ssl, dhm_shared * S);
+
 	/**
 	 * \brief          Set hostname for ServerName TLS Extension
 	 *
@@ -409,6 +1033,152 @@ extern "C" {
 	 */
 	int ssl_set_hostname(ssl_context * ssl, const char *hostname);
 
+	/**
+	 * \brief          Request the max_fragment_length TLS Extension
+	 *                 (client-side only)
+	 *
+	 * \param ssl      SSL context
+	 * \param mfl_code SSL_MAX_FRAG_LEN_512 .. SSL_MAX_FRAG_LEN_4096,
+	 *                 or SSL_MAX_FRAG_LEN_NONE
+	 *
+	 * \note           Once agreed, the limit applies to the application
+	 *                 data records of both directions and the record
+	 *                 buffers shrink to match; the handshake itself
+	 *                 still uses full-sized records.
+	 */
+	void ssl_set_max_frag_len(ssl_context * ssl, int mfl_code);
+
+	/**
+	 * \brief          Set the maximum plaintext length of the records
+	 *                 this context receives and sends
+	 *
+	 * \param ssl      SSL context
+	 * \param in_len   largest incoming record, at least
+	 *                 SSL_MIN_CONTENT_LEN, at most SSL_MAX_CONTENT_LEN
+	 * \param out_len  largest outgoing record, same bounds
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 *                 or TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 *
+	 * \note           The buffers are reallocated as soon as they hold
+	 *                 no pending data. A peer sending larger records
+	 *                 than in_len is rejected, so only lower it below
+	 *                 SSL_MAX_CONTENT_LEN when the peer is known to
+	 *                 fragment accordingly.
+	 */
+	int ssl_set_buffer_len(ssl_context * ssl, size_t in_len, size_t out_len);
+
+	/**
+	 * \brief          Set the largest handshake message this context
+	 *                 gathers from several records
+	 *
+	 * \param ssl      SSL context
+	 * \param len      message length, header included (by default
+	 *                 SSL_MAX_HANDSHAKE_LEN), or 0 to require every
+	 *                 handshake message to fit in one record
+	 *
+	 * \note           The message is gathered in a buffer of its own,
+	 *                 released once it has been handled, so in_len of
+	 *                 ssl_set_buffer_len() need not grow with the peer's
+	 *                 certificate chain. A Certificate message is even
+	 *                 parsed one certificate at a time as its records
+	 *                 come in, and only the largest certificate is held
+	 *                 at once (unless ssl_set_crt_cache() is used).
+	 */
+	void ssl_set_handshake_max_len(ssl_context * ssl, size_t len);
+
+	/**
+	 * \brief          Set the dynamic record sizing policy
+	 *
+	 * \param ssl      SSL context
+	 * \param small_len plaintext length of the opening application
+	 *                 data records, eg. SSL_DRS_SMALL_LEN, or 0 to
+	 *                 always fill records (the default)
+	 * \param ramp_len  bytes sent in such records before they grow
+	 *                 to the full outgoing length, eg. SSL_DRS_RAMP_LEN
+	 * \param idle_ms  a write coming this long after the previous
+	 *                 one starts over with small records, eg.
+	 *                 SSL_DRS_IDLE_MS, or 0 to never start over
+	 *
+	 * \note           A record the size of one TCP segment can be
+	 *                 decrypted as soon as it arrives, while a full
+	 *                 16 KB record waits for a dozen segments while
+	 *                 the congestion window is still small. Once
+	 *                 ramp_len bytes are out, full records cut the
+	 *                 per-record overhead again. ssl_write_reserve()
+	 *                 lends the current record length. The idle
+	 *                 restart needs TROPICSSL_TIMING; kernel TLS
+	 *                 sizes its records itself.
+	 */
+	void ssl_set_record_sizing(ssl_context * ssl, size_t small_len,
+				   size_t ramp_len, int idle_ms);
+
+	/**
+	 * \brief          Read ahead: receive as much as the input buffer
+	 *                 holds, rather than one record header and then
+	 *                 its body, so that several queued records come
+	 *                 in with one f_recv call
+	 *
+	 * \param ssl      SSL context
+	 * \param len      bytes the input buffer gets beyond one record,
+	 *                 eg. 2 * SSL_BUFFER_LEN, or 0 to turn it off
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 *                 if input is pending, or TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 *
+	 * \note           Records may then wait in the buffer after the
+	 *                 socket is drained: before waiting for it to be
+	 *                 readable, check ssl_check_pending().
+	 *
+	 * \note           The server reads the ClientHello exactly, and a
+	 *                 context with records waiting keeps its input
+	 *                 in userspace (see ssl_set_ktls()).
+	 */
+	int ssl_set_read_ahead(ssl_context * ssl, size_t len);
+
+	/**
+	 * \brief          Tell whether input is waiting in the context:
+	 *                 decrypted data, or records read ahead
+	 *
+	 * \param ssl      SSL context
+	 *
+	 * \return         1 if ssl_read() may return data without the
+	 *                 socket being readable, 0 otherwise
+	 */
+	int ssl_check_pending(const ssl_context * ssl);
+
+	/**
+	 * \brief          Initialize a pool of idle record buffers
+	 *
+	 * \param pool     buffer pool
+	 * \param len      plaintext length the buffers are sized for
+	 * \param max      max. number of idle buffers the pool keeps
+	 */
+	void ssl_pool_init(ssl_buffer_pool * pool, size_t len, int max);
+
+	/**
+	 * \brief          Free all buffers held by a pool
+	 *
+	 * \param pool     buffer pool
+	 */
+	void ssl_pool_free(ssl_buffer_pool * pool);
+
+	/**
+	 * \brief          Release the record buffers to a pool whenever
+	 *                 they hold no pending data
+	 *
+	 * \param ssl      SSL context
+	 * \param pool     buffer pool, or NULL to keep the buffers attached
+	 *
+	 * \note           After the handshake, an idle connection then holds
+	 *                 no record buffer; ssl_read(), ssl_write() and the
+	 *                 like take one back from the pool (or malloc) when
+	 *                 called. The pool must outlive the context and is
+	 *                 not thread-safe: share it between the contexts of
+	 *                 one thread only.
+	 */
+	void ssl_set_buffer_pool(ssl_context * ssl, ssl_buffer_pool * pool);
+
 	/**
 	 * \brief          Return the number of data bytes available to read
 	 *
@@ -440,13 +1210,30 @@ extern "C" {
 	 */
 	const char *ssl_get_cipher(const ssl_context * ssl);
 
+	/**
+	 * \brief          Return the name of a ciphersuite
+	 *
+	 * \param cipher   ciphersuite, eg. TLS_RSA_WITH_AES_128_CBC_SHA
+	 *
+	 * \return         a string containing the cipher name, or
+	 *                 "unknown" if it is not compiled in
+	 */
+	const char *ssl_get_cipher_name(int cipher);
+
 	/**
 	 * \brief          Perform the SSL handshake
 	 *
 	 * \param ssl      SSL context
 	 *
-	 * \return         0 if successful, TROPICSSL_ERR_NET_TRY_AGAIN,
+	 * \return         0 if successful, TROPICSSL_ERR_NET_WANT_READ or
+	 *                 TROPICSSL_ERR_NET_WANT_WRITE (non-blocking I/O),
 	 *                 or a specific SSL error code.
+	 *
+	 * \note           After WANT_READ (WANT_WRITE), call it again once
+	 *                 the transport is readable (writable). Each step
+	 *                 runs once: a message is built, hashed and, for
+	 *                 key exchanges, computed before it is queued, and
+	 *                 only its sending is retried.
 	 */
 	int ssl_handshake(ssl_context * ssl);
 
@@ -458,7 +1245,9 @@ extern "C" {
 	 * \param len      how many bytes must be read
 	 *
 	 * \return         This function returns the number of bytes read,
-	 *                 or a negative error code.
+	 *                 or a negative error code; TROPICSSL_ERR_NET_WANT_READ
+	 *                 (or _WRITE, while still in the handshake) means
+	 *                 it must be called again later.
 	 */
 	int ssl_read(ssl_context * ssl, uint8_t *buf, size_t len);
 
@@ -472,30 +1261,384 @@ extern "C" {
 	 * \return         This function returns the number of bytes written,
 	 *                 or a negative error code.
 	 *
-	 * \note           When this function returns TROPICSSL_ERR_NET_TRY_AGAIN,
+	 * \note           When this function returns TROPICSSL_ERR_NET_WANT_WRITE,
 	 *                 it must be called later with the *same* arguments,
 	 *                 until it returns a positive value.
 	 */
 	int ssl_write(ssl_context * ssl, const uint8_t *buf, size_t len);
 
+	/**
+	 * \brief          Write the concatenation of 'iovcnt' buffers,
+	 *                 packed into as few records as possible
+	 *
+	 * \param ssl      SSL context
+	 * \param iov      buffers holding the data
+	 * \param iovcnt   number of buffers
+	 *
+	 * \return         This function returns the number of bytes written,
+	 *                 or a negative error code.
+	 *
+	 * \note           At most SSL_OUT_RING_RECORDS full records are
+	 *                 written per call; a smaller return value means
+	 *                 the rest must be passed again.
+	 *
+	 * \note           When this function returns TROPICSSL_ERR_NET_WANT_WRITE,
+	 *                 it must be called later with the *same* arguments,
+	 *                 until it returns a positive value.
+	 */
+	int ssl_writev(ssl_context * ssl, const net_iovec * iov, int iovcnt);
+
+	/**
+	 * \brief          Write 'len' bytes of a file, from 'offset',
+	 *                 without a copy through a caller buffer
+	 *
+	 * \param ssl      SSL context
+	 * \param fd       file descriptor, opened for reading
+	 * \param offset   where to start in the file
+	 * \param len      how many bytes to send
+	 *
+	 * \return         This function returns the number of bytes written
+	 *                 (0 past the end of the file), or a negative
+	 *                 error code; TROPICSSL_ERR_FILE_IO_ERROR if the
+	 *                 file cannot be read.
+	 *
+	 * \note           Each record is read straight into the output
+	 *                 ring and encrypted there; with kernel TLS (see
+	 *                 ssl_set_ktls()) this is the kernel's sendfile().
+	 *                 Like ssl_writev(), a call may write less than
+	 *                 'len': pass the rest again, from offset + the
+	 *                 return value.
+	 *
+	 * \note           When this function returns TROPICSSL_ERR_NET_WANT_WRITE,
+	 *                 it must be called later with the *same* arguments,
+	 *                 until it returns a positive value.
+	 */
+	int ssl_sendfile(ssl_context * ssl, int fd, uint64_t offset,
+			 size_t len);
+
+	/**
+	 * \brief          Zero-copy read: point to the pending application
+	 *                 data inside the record buffer
+	 *
+	 * \param ssl      SSL context
+	 * \param buf      set to the start of the decrypted data
+	 * \param len      set to the number of bytes available
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_NET_WANT_READ,
+	 *                 TROPICSSL_ERR_NET_WANT_WRITE, or a specific SSL
+	 *                 error code.
+	 *
+	 * \note           The view stays valid until the next call that
+	 *                 reads from ssl; hand the consumed bytes back with
+	 *                 ssl_read_release(). Calling ssl_read_view() again
+	 *                 before releasing everything returns the rest of
+	 *                 the same record.
+	 */
+	int ssl_read_view(ssl_context * ssl, const uint8_t **buf, size_t *len);
+
+	/**
+	 * \brief          Release data obtained with ssl_read_view()
+	 *
+	 * \param ssl      SSL context
+	 * \param len      number of bytes consumed from the view
+	 */
+	void ssl_read_release(ssl_context * ssl, size_t len);
+
+	/**
+	 * \brief          Zero-copy write: lend the plaintext area of the
+	 *                 next output record
+	 *
+	 * \param ssl      SSL context
+	 * \param buf      set to the area to fill with application data
+	 * \param len      set to its size (the max. outgoing plaintext
+	 *                 length, SSL_MAX_CONTENT_LEN by default)
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_NET_WANT_READ,
+	 *                 TROPICSSL_ERR_NET_WANT_WRITE, or a specific SSL
+	 *                 error code.
+	 *
+	 * \note           The area stays lent until ssl_write_commit();
+	 *                 no other call may write to ssl in between.
+	 */
+	int ssl_write_reserve(ssl_context * ssl, uint8_t **buf, size_t *len);
+
+	/**
+	 * \brief          Encrypt and send the first 'len' bytes of the
+	 *                 area lent by ssl_write_reserve()
+	 *
+	 * \param ssl      SSL context
+	 * \param len      how many bytes were placed in the area
+	 *
+	 * \return         This function returns 'len', or a negative
+	 *                 error code.
+	 *
+	 * \note           When this function returns TROPICSSL_ERR_NET_WANT_WRITE,
+	 *                 the record is queued; it must be called again
+	 *                 with the *same* length until it returns a
+	 *                 positive value.
+	 */
+	int ssl_write_commit(ssl_context * ssl, size_t len);
+
+	/**
+	 * \brief          Enable or disable output corking
+	 *
+	 * \param ssl      SSL context
+	 * \param cork     1 to queue application data records in the
+	 *                 output ring, 0 to send each one right away
+	 *
+	 * \note           While corked, ssl_write() and ssl_write_commit()
+	 *                 encrypt into consecutive ring slots; the queue
+	 *                 goes out in one batch when the ring fills or on
+	 *                 ssl_flush(). Call ssl_flush() before waiting for
+	 *                 the peer's answer, and after uncorking.
+	 */
+	void ssl_set_cork(ssl_context * ssl, int cork);
+
+	/**
+	 * \brief          Send all queued output
+	 *
+	 * \param ssl      SSL context
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_NET_WANT_WRITE,
+	 *                 or a negative error code.
+	 */
+	int ssl_flush(ssl_context * ssl);
+
 	/**
 	 * \brief          Notify the peer that the connection is being closed
 	 */
 	int ssl_close_notify(ssl_context * ssl);
 
+	/**
+	 * \brief          Let ssl_context_save() export this connection
+	 *                 once its handshake is over
+	 *
+	 * \param ssl      SSL context, before its handshake (or load)
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 *
+	 * \note           The keys are derived again from the hello randoms
+	 *                 on load; these go with the handshake state, so
+	 *                 only the contexts asking for it keep a copy.
+	 */
+	int ssl_set_saveable(ssl_context * ssl);
+
+	/**
+	 * \brief          Export an established connection, so that
+	 *                 another context (in another process, given
+	 *                 the socket) can carry on with it
+	 *
+	 * \param ssl      SSL context, with its handshake over
+	 * \param buf      buffer receiving the state
+	 * \param len      size of buf, SSL_CONTEXT_SAVE_MAX_LEN is enough
+	 * \param olen     set to the number of bytes written
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 *                 if the handshake is not over, data is pending
+	 *                 in either direction, buf is too small or the
+	 *                 context was not made saveable by
+	 *                 ssl_set_saveable(), or
+	 *                 TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE for a
+	 *                 compressed or kernel TLS connection
+	 *
+	 * \note           The state is the version, ciphersuite, session,
+	 *                 hello randoms, sequence numbers and the IV and
+	 *                 stream cipher state, in a fixed layout: the
+	 *                 keys are derived again on load, so it does not
+	 *                 depend on how this build lays out its contexts.
+	 *                 It holds the master secret; keep it as secret.
+	 *
+	 * \note           Flush the output first; the context must not
+	 *                 be used for records afterwards, or the loaded
+	 *                 one would reuse their sequence numbers.
+	 */
+	int ssl_context_save(ssl_context * ssl, uint8_t *buf, size_t len,
+			     size_t *olen);
+
+	/**
+	 * \brief          Carry on with a connection ssl_context_save()
+	 *                 exported
+	 *
+	 * \param ssl      SSL context fresh from ssl_init(), with its
+	 *                 RNG, I/O and session set as for a handshake
+	 *                 (and any ssl_set_ktls() or buffer lengths)
+	 * \param buf      the exported state
+	 * \param len      its length
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 *                 if the state is malformed, of another format
+	 *                 version or has a ciphersuite its protocol
+	 *                 version does not allow,
+	 *                 TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE
+	 *                 if its ciphersuite is not built in
+	 *
+	 * \note           The peer's certificate is not part of the state:
+	 *                 it was verified by the context that exported it.
+	 */
+	int ssl_context_load(ssl_context * ssl, const uint8_t *buf, size_t len);
+
 	/**
 	 * \brief          Free an SSL context
 	 */
 	void ssl_free(ssl_context * ssl);
 
+	/**
+	 * \brief          Free the data held by a session (its ticket)
+	 */
+	void ssl_session_free(ssl_session * session);
+
+#if defined(TROPICSSL_SSL_STATS)
+	/**
+	 * \brief          Copy the counters of a context
+	 *
+	 * \param ssl      SSL context
+	 * \param stats    where the counters go
+	 *
+	 * \note           Resume hits and misses only count handshakes
+	 *                 where the client offered a session ID; times
+	 *                 are in microseconds, and leave out the time
+	 *                 spent waiting for the peer in non-blocking mode.
+	 */
+	void ssl_get_stats(const ssl_context * ssl, ssl_stats * stats);
+
+	/**
+	 * \brief          Initialize a statistics sink
+	 *
+	 * \param sink     sink to initialize
+	 *
+	 * \return         0 if successful, or 1 if the lock could not be
+	 *                 created
+	 */
+	int ssl_stats_sink_init(ssl_stats_sink * sink);
+
+	/**
+	 * \brief          Have the counters of a context added to a sink
+	 *                 when it is freed
+	 *
+	 * \param ssl      SSL context
+	 * \param sink     sink, shared by any number of contexts and
+	 *                 threads; it must outlive them
+	 */
+	void ssl_set_stats_sink(ssl_context * ssl, ssl_stats_sink * sink);
+
+	/**
+	 * \brief          Add the counters of a context to its sink now,
+	 *                 and clear them
+	 *
+	 * \param ssl      SSL context
+	 *
+	 * \note           Useful for long-lived connections; ssl_free()
+	 *                 merges whatever is left.
+	 */
+	void ssl_stats_merge(ssl_context * ssl);
+
+	/**
+	 * \brief          Copy the totals of a sink
+	 *
+	 * \param sink     statistics sink
+	 * \param stats    where the totals go
+	 *
+	 * \return         the number of contexts merged so far
+	 */
+	uint64_t ssl_stats_sink_get(ssl_stats_sink * sink, ssl_stats * stats);
+
+	/**
+	 * \brief          Free the lock of a statistics sink
+	 */
+	void ssl_stats_sink_free(ssl_stats_sink * sink);
+
+	/**
+	 * \brief          Write counters as text, one "name value" per line
+	 *
+	 * \param stats    counters to write
+	 * \param buf      output buffer
+	 * \param len      size of buf
+	 *
+	 * \return         the length written (without the terminating
+	 *                 zero), or TROPICSSL_ERR_SSL_BAD_INPUT_DATA if
+	 *                 buf is too small
+	 */
+	int ssl_stats_write(const ssl_stats * stats, char *buf, size_t len);
+
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_stats_self_test(int verbose);
+#endif
+
+	/**
+	 * \brief          Checkup routine: handshake messages gathered
+	 *                 from several records
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_gather_self_test(int verbose);
+
 	/*
 	 * Internal functions (do not call directly)
 	 */
+#if defined(TROPICSSL_SSL_STATS)
+#define SSL_STATS_INC(ssl, n)   ((ssl)->stats.n++)
+#define SSL_STATS_ADD(ssl, n, v) ((ssl)->stats.n += (v))
+#define SSL_STATS_MAX(ssl, n, v)                                \
+	do { if ((ssl)->stats.n < (v)) (ssl)->stats.n = (v); } while (0)
+#define SSL_STATS_OP_START(ssl)                                 \
+	((void)get_timer_us(&(ssl)->stats_op_timer, 1))
+#define SSL_STATS_OP_END(ssl, op)                               \
+	do { (ssl)->stats.op##_ops++;                           \
+	     (ssl)->stats.op##_usec +=                          \
+	         get_timer_us(&(ssl)->stats_op_timer, 0); } while (0)
+#define SSL_STATS_STATE_START(ssl)                              \
+	do { (ssl)->stats_state = (ssl)->state;                 \
+	     get_timer_us(&(ssl)->stats_state_timer, 1); } while (0)
+#define SSL_STATS_STATE_END(ssl)                                \
+	((ssl)->stats.state_usec[(ssl)->stats_state] +=         \
+	     get_timer_us(&(ssl)->stats_state_timer, 0))
+#else
+#define SSL_STATS_INC(ssl, n)           do { } while (0)
+#define SSL_STATS_ADD(ssl, n, v)        do { } while (0)
+#define SSL_STATS_MAX(ssl, n, v)        do { } while (0)
+#define SSL_STATS_OP_START(ssl)         do { } while (0)
+#define SSL_STATS_OP_END(ssl, op)       do { } while (0)
+#define SSL_STATS_STATE_START(ssl)      do { } while (0)
+#define SSL_STATS_STATE_END(ssl)        do { } while (0)
+#endif
+
 	int ssl_handshake_client(ssl_context * ssl);
 	int ssl_handshake_server(ssl_context * ssl);
 
+	int ssl_cipher_min_minor_ver(int cipher);
+	int ssl_cipher_is_dhe(int cipher);
+	int ssl_cipher_is_ecdhe(int cipher);
+	int ssl_cipher_is_chachapoly(int cipher);
+	int ssl_cipher_is_aead(int cipher);
+	int ssl_cipher_prf_hash(int cipher);
+	size_t ssl_encode_dn_list(const x509_cert * ca_chain, uint8_t *buf);
 	int ssl_derive_keys(ssl_context * ssl);
-	void ssl_calc_verify(ssl_context * ssl, uint8_t hash[36]);
+	int ssl_rsa_sign(ssl_context * ssl, unsigned int hashlen,
+			 const uint8_t *hash, uint8_t *sig);
+	int ssl_rsa_decrypt(ssl_context * ssl, size_t *olen,
+			    const uint8_t *input, uint8_t *output,
+			    size_t output_max_len);
+	int ssl_session_get(ssl_context * ssl);
+	void ssl_session_set(ssl_context * ssl);
+	size_t ssl_calc_verify(ssl_context * ssl,
+			       uint8_t hash[SSL_SIG_INPUT_MAX]);
+	size_t ssl_calc_params_hash(ssl_context * ssl, int sig_hash,
+				    const uint8_t *params, size_t len,
+				    uint8_t hash[SSL_SIG_INPUT_MAX]);
+
+	int ssl_transcript_update(ssl_transcript * t, const uint8_t *buf,
+				  size_t len);
+	void ssl_transcript_select(ssl_transcript * t, int digests);
+	void ssl_transcript_md5(ssl_transcript * t, md5_context * md5);
+	void ssl_transcript_sha1(ssl_transcript * t, sha1_context * sha1);
+	void ssl_transcript_sha2(ssl_transcript * t, sha2_context * sha2);
+	void ssl_transcript_sha4(ssl_transcript * t, sha4_context * sha4);
+	int ssl_transcript_digests(int minor_ver, int cipher);
+	void ssl_transcript_free(ssl_transcript * t);
 
 	int ssl_read_record(ssl_context * ssl);
 	int ssl_fetch_input(ssl_context * ssl, size_t nb_want);
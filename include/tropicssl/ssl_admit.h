@@ -0,0 +1,143 @@
+/**
+ * \file ssl_admit.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_SSL_ADMIT_H
+#define TROPICSSL_SSL_ADMIT_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_ADMIT_C)
+#include "tropicssl/ssl.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/**
+ * \brief          Admission control context: a token bucket that
+ *                 full handshakes draw from, resumptions do not
+ */
+typedef struct {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	int rate;		/*!<  full handshakes per second */
+	int burst;		/*!<  bucket size                */
+	int max_wait;		/*!<  ms deferred before refused */
+	uint64_t tokens;	/*!<  in 1/1000 handshakes       */
+	unsigned long last;	/*!<  last refill (ms)           */
+
+	uint64_t full;		/*!<  full handshakes admitted   */
+	uint64_t resumed;	/*!<  resumptions admitted       */
+	uint64_t deferred;	/*!<  full handshakes held back  */
+	uint64_t refused;	/*!<  full handshakes refused    */
+} ssl_admit_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Initialize an admission context
+	 *
+	 * \param admit    context to be initialized
+	 * \param rate     full handshakes admitted per second, on average
+	 * \param burst    full handshakes admitted at once after a lull
+	 * \param max_wait how long (ms) a full handshake may be held back
+	 *                 waiting for a token before it is refused; 0 to
+	 *                 refuse at once
+	 *
+	 * \note           The rate is the CPU budget for full handshakes:
+	 *                 eg. 80% of what one core does (see benchmark),
+	 *                 times the cores. Resumptions and established
+	 *                 connections keep the rest.
+	 */
+	void ssl_admit_init(ssl_admit_context * admit, int rate, int burst,
+			    int max_wait);
+
+	/**
+	 * \brief          Change the rate and burst, eg. from a monitor of
+	 *                 CPU load; the tokens already in the bucket stay
+	 *                 (up to the new burst)
+	 */
+	void ssl_admit_set_rate(ssl_admit_context * admit, int rate,
+				int burst);
+
+	/**
+	 * \brief          Use an admission context for a (server) context
+	 *
+	 * \param ssl      SSL context
+	 * \param admit    admission context, shared by any number of
+	 *                 contexts and threads
+	 */
+	void ssl_set_admission_control(ssl_context * ssl,
+				       ssl_admit_context * admit);
+
+	/**
+	 * \brief          Admission callback (see ssl_set_admission)
+	 *
+	 * \param p_admit  admission context
+	 * \param ssl      SSL context
+	 * \param resume   1 for a resumption, which is always admitted
+	 *
+	 * \return         0 if admitted,
+	 *                 TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED while the
+	 *                 bucket is empty, or
+	 *                 TROPICSSL_ERR_SSL_HANDSHAKE_REFUSED once it has
+	 *                 waited max_wait
+	 */
+	int ssl_admit_check(void *p_admit, ssl_context * ssl, int resume);
+
+	/**
+	 * \brief          Free an admission context
+	 */
+	void ssl_admit_free(ssl_admit_context * admit);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_admit_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_SSL_ADMIT_C */
+#endif				/* ssl_admit.h */
@@ -0,0 +1,166 @@
+/**
+ * \file ssl_cache.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_SSL_CACHE_H
+#define TROPICSSL_SSL_CACHE_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_CACHE_C)
+#include "tropicssl/ssl.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+ * Number of independently locked parts of the cache
+ */
+#define SSL_CACHE_SHARDS                16
+
+typedef struct _ssl_cache_entry ssl_cache_entry;
+
+/**
+ * \brief          Cache shard: a hash table of sessions and their
+ *                 least recently used order
+ */
+typedef struct {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	ssl_cache_entry **table;	/*!<  hash buckets             */
+	size_t mask;			/*!<  number of buckets - 1    */
+	ssl_cache_entry *lru_first;	/*!<  most recently used       */
+	ssl_cache_entry *lru_last;	/*!<  next one to be evicted   */
+	size_t count;			/*!<  sessions stored          */
+	size_t max;			/*!<  max. sessions stored     */
+} ssl_cache_shard;
+
+/**
+ * \brief          Session cache context structure
+ */
+typedef struct {
+	ssl_cache_shard shard[SSL_CACHE_SHARDS];
+} ssl_cache_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Initialize a session cache
+	 *
+	 * \param cache    cache to be initialized
+	 * \param max      max. number of sessions kept; the least
+	 *                 recently used ones are evicted beyond that
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 */
+	int ssl_cache_init(ssl_cache_context * cache, size_t max);
+
+	/**
+	 * \brief          Use a session cache for a (server) context
+	 *
+	 * \param ssl      SSL context
+	 * \param cache    session cache, shared by any number of contexts
+	 *                 and threads
+	 *
+	 * \note           Sessions older than the timeout given to
+	 *                 ssl_set_session() are neither resumed nor kept.
+	 */
+	void ssl_set_session_cache(ssl_context * ssl, ssl_cache_context * cache);
+
+	/**
+	 * \brief          Use a session cache for a client context: the
+	 *                 session of the server at hostname:port is
+	 *                 offered again on the next connection to it
+	 *
+	 * \param ssl      SSL context, with ssl_set_hostname() and
+	 *                 ssl_set_session() already called
+	 * \param cache    session cache, shared by any number of contexts
+	 *                 and threads (but not with servers)
+	 * \param port     server port, the other half of the cache key
+	 *
+	 * \note           The cache is only consulted when ssl_set_session()
+	 *                 was given resume = 0, and fills in that session;
+	 *                 it is updated once the handshake is over.
+	 */
+	void ssl_set_client_session_cache(ssl_context * ssl,
+					  ssl_cache_context * cache, int port);
+
+	/**
+	 * \brief          Session get callback (see ssl_set_scb)
+	 *
+	 * \param ssl      SSL context, with p_scb pointing to the cache
+	 *
+	 * \return         0 if the session was found, 1 otherwise
+	 *
+	 * \note           On a client, the session found replaces the
+	 *                 contents of ssl->session, and resume is set.
+	 */
+	int ssl_cache_get(ssl_context * ssl);
+
+	/**
+	 * \brief          Session set callback (see ssl_set_scb)
+	 *
+	 * \param ssl      SSL context, with p_scb pointing to the cache
+	 *
+	 * \return         0 if successful, 1 if memory allocation failed
+	 */
+	int ssl_cache_set(ssl_context * ssl);
+
+	/**
+	 * \brief          Free all sessions and the cache itself
+	 *
+	 * \param cache    session cache
+	 */
+	void ssl_cache_free(ssl_cache_context * cache);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_cache_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_SSL_CACHE_C */
+#endif				/* ssl_cache.h */
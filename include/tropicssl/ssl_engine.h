@@ -0,0 +1,256 @@
+/**
+ * \file ssl_engine.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_SSL_ENGINE_H
+#define TROPICSSL_SSL_ENGINE_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_ENGINE_C)
+#include "tropicssl/ssl.h"
+
+/*
+ * Most events handled per wait, and connections accepted per
+ * wake-up of the listening socket
+ */
+#define SSL_ENGINE_EVENTS               64
+#define SSL_ENGINE_ACCEPT_BATCH         16
+
+/*
+ * Interval (ms) at which handshakes held back by the admission
+ * callback (see ssl_set_admission) are tried again
+ */
+#define SSL_ENGINE_DEFER_MS             10
+
+/*
+ * Readiness a connection waits for
+ */
+#define SSL_ENGINE_READ                 1
+#define SSL_ENGINE_WRITE                2
+
+typedef struct _ssl_engine ssl_engine;
+typedef struct _ssl_conn ssl_conn;
+
+/**
+ * \brief          Application callbacks, all given the engine's p_h
+ */
+typedef struct {
+	/*
+	 * Configure c->ssl for a new connection: endpoint, RNG, keys,
+	 * ciphers, session cache... The engine has already set the
+	 * I/O callbacks and c->session. Required; non-zero refuses it.
+	 */
+	int (*f_setup) (void *, ssl_conn *);
+
+	/*
+	 * Handshake completed (optional)
+	 */
+	void (*f_open) (void *, ssl_conn *);
+
+	/*
+	 * Application data arrived; the buffer is only valid during the
+	 * call. Required; negative closes the connection.
+	 */
+	int (*f_read) (void *, ssl_conn *, const uint8_t *, size_t);
+
+	/*
+	 * The record held back by ssl_engine_write() went out, more can
+	 * be written (optional); negative closes the connection.
+	 */
+	int (*f_write) (void *, ssl_conn *);
+
+	/*
+	 * Connection gone, with 0 for ssl_engine_close() or the error
+	 * that ended it (optional). Release c->user here.
+	 */
+	void (*f_close) (void *, ssl_conn *, int);
+} ssl_engine_handlers;
+
+/**
+ * \brief          One non-blocking connection driven by an engine
+ */
+struct _ssl_conn {
+	int fd;			/*!<  connected socket        */
+	ssl_context ssl;	/*!<  its SSL/TLS context     */
+	ssl_session session;	/*!<  its session data        */
+	ssl_engine *engine;	/*!<  engine driving it       */
+	void *user;		/*!<  for the application     */
+
+	int open;		/*!<  handshake completed     */
+	int closing;		/*!<  gone, freed after run   */
+	int shutdown;		/*!<  close once pending sent */
+	int events;		/*!<  readiness registered    */
+	size_t pending;		/*!<  length of a held record */
+	int deferred;		/*!<  handshake held back     */
+
+	ssl_conn *prev;		/*!<  previous connection     */
+	ssl_conn *next;		/*!<  next connection         */
+	ssl_conn *defer_next;	/*!<  next one held back      */
+};
+
+/**
+ * \brief          Event loop over many connections, for one thread
+ */
+struct _ssl_engine {
+	int poll_fd;		/*!<  epoll or kqueue handle  */
+	int listen_fd;		/*!<  listening socket, or -1 */
+	int accepting;		/*!<  listen_fd is registered */
+	int stop;		/*!<  set by ssl_engine_stop() */
+
+	size_t conns;		/*!<  live connections        */
+	size_t max_conns;	/*!<  accept() stops there    */
+	uint64_t accepted;	/*!<  connections accepted    */
+
+	ssl_engine_handlers h;	/*!<  application callbacks   */
+	void *p_h;		/*!<  context for them        */
+
+	ssl_conn *live;		/*!<  live connections        */
+	ssl_conn *dead;		/*!<  closed during this run  */
+	ssl_conn *deferred;	/*!<  handshakes held back    */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Initialize an engine
+	 *
+	 * \param e        engine to initialize
+	 * \param listen_fd socket from net_bind() to accept clients on,
+	 *                 or -1 to only drive ssl_engine_add() sockets;
+	 *                 it is made non-blocking
+	 * \param max_conns live connections beyond which the engine stops
+	 *                 accepting, until some close
+	 * \param h        application callbacks (copied)
+	 * \param p_h      context for the callbacks
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_NET_SOCKET_FAILED,
+	 *                 or TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE on systems
+	 *                 with neither epoll nor kqueue
+	 *
+	 * \note           An engine and its connections belong to one
+	 *                 thread. Several threads may each run an engine
+	 *                 on the same listening socket, or on their own.
+	 */
+	int ssl_engine_init(ssl_engine * e, int listen_fd, size_t max_conns,
+			    const ssl_engine_handlers * h, void *p_h);
+
+	/**
+	 * \brief          Drive an already connected socket
+	 *
+	 * \param e        engine
+	 * \param fd       socket, made non-blocking; closed by the engine
+	 *                 from then on, even if this fails
+	 * \param conn     set to the new connection (or NULL)
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_SSL_MALLOC_FAILED,
+	 *                 TROPICSSL_ERR_NET_SOCKET_FAILED, or what the
+	 *                 f_setup callback returned
+	 */
+	int ssl_engine_add(ssl_engine * e, int fd, ssl_conn ** conn);
+
+	/**
+	 * \brief          Wait for events once, and handle them
+	 *
+	 * \param e        engine
+	 * \param timeout  max. wait in milliseconds, -1 for no limit
+	 *
+	 * \return         the number of events handled (0 on timeout),
+	 *                 or TROPICSSL_ERR_NET_SOCKET_FAILED
+	 *
+	 * \note           While handshakes are deferred, the wait is at
+	 *                 most SSL_ENGINE_DEFER_MS; they are tried again
+	 *                 after the events.
+	 */
+	int ssl_engine_run(ssl_engine * e, int timeout);
+
+	/**
+	 * \brief          Handle events until ssl_engine_stop()
+	 *
+	 * \return         0, or TROPICSSL_ERR_NET_SOCKET_FAILED
+	 */
+	int ssl_engine_loop(ssl_engine * e);
+
+	/**
+	 * \brief          Make ssl_engine_loop() return after the current
+	 *                 events (from a callback, or a signal handler)
+	 */
+	void ssl_engine_stop(ssl_engine * e);
+
+	/**
+	 * \brief          Send application data on a connection
+	 *
+	 * \param c        connection
+	 * \param buf      data
+	 * \param len      its length
+	 *
+	 * \return         the number of bytes taken (at most one record),
+	 *                 TROPICSSL_ERR_NET_WANT_WRITE if the handshake is
+	 *                 not over or the previous record is still held
+	 *                 back, or another negative error code
+	 *
+	 * \note           Bytes taken are owned by the engine: when the
+	 *                 socket is full, their record is held back and
+	 *                 sent when it drains, then f_write is called.
+	 */
+	int ssl_engine_write(ssl_conn * c, const uint8_t *buf, size_t len);
+
+	/**
+	 * \brief          Send close_notify (as far as the socket takes
+	 *                 it) and close a connection; it is freed when
+	 *                 the current ssl_engine_run() returns
+	 *
+	 * \note           A record held back by ssl_engine_write() is
+	 *                 sent first: the connection closes when it is out.
+	 */
+	void ssl_engine_close(ssl_conn * c);
+
+	/**
+	 * \brief          Close all connections and free the engine; the
+	 *                 listening socket is left open
+	 */
+	void ssl_engine_free(ssl_engine * e);
+
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_engine_self_test(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_SSL_ENGINE_C */
+#endif				/* ssl_engine.h */
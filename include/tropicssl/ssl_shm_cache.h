@@ -0,0 +1,142 @@
+/**
+ * \file ssl_shm_cache.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_SSL_SHM_CACHE_H
+#define TROPICSSL_SSL_SHM_CACHE_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_SHM_CACHE_C)
+#include "tropicssl/ssl.h"
+
+/*
+ * Slots a session id may go to: a set of this many, picked by hash
+ */
+#define SSL_SHM_CACHE_WAYS              4
+
+/**
+ * \brief          Session cache in shared memory: fixed slots seen by
+ *                 every process that maps the segment
+ */
+typedef struct {
+	uint8_t *map;		/*!<  mapped segment          */
+	size_t map_len;		/*!<  its size                */
+	uint32_t sets;		/*!<  number of sets (2^n)    */
+} ssl_shm_cache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Create or map a shared session cache
+	 *
+	 * \param cache    cache to be set up
+	 * \param path     file to share it through (created with mode
+	 *                 0600 if missing, eg. under /dev/shm), or NULL
+	 *                 for an anonymous segment that the processes
+	 *                 forked afterwards share
+	 * \param max      number of sessions, rounded up to a power of
+	 *                 two sets of SSL_SHM_CACHE_WAYS slots
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_FILE_IO_ERROR,
+	 *                 TROPICSSL_ERR_SSL_MALLOC_FAILED,
+	 *                 TROPICSSL_ERR_SSL_BAD_INPUT_DATA if the file
+	 *                 holds a cache of another size or layout, or
+	 *                 TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE
+	 *
+	 * \note           The segment holds master secrets: whoever can
+	 *                 read the file can decrypt resumed sessions.
+	 */
+	int ssl_shm_cache_init(ssl_shm_cache * cache, const char *path,
+			       size_t max);
+
+	/**
+	 * \brief          Use a shared session cache for a server context
+	 *
+	 * \param ssl      SSL context
+	 * \param cache    shared cache; any number of contexts, threads
+	 *                 and processes may use it at once
+	 *
+	 * \note           Sessions older than the timeout given to
+	 *                 ssl_set_session() are not resumed, and are the
+	 *                 first to be replaced.
+	 */
+	void ssl_set_shm_session_cache(ssl_context * ssl,
+				       ssl_shm_cache * cache);
+
+	/**
+	 * \brief          Session get callback (see ssl_set_scb),
+	 *                 server-side only
+	 *
+	 * \param ssl      SSL context, with p_scb pointing to the cache
+	 *
+	 * \return         0 if the session was found, 1 otherwise
+	 *
+	 * \note           Reads take no lock: a slot being written at
+	 *                 the same time is a miss.
+	 */
+	int ssl_shm_cache_get(ssl_context * ssl);
+
+	/**
+	 * \brief          Session set callback (see ssl_set_scb),
+	 *                 server-side only
+	 *
+	 * \param ssl      SSL context, with p_scb pointing to the cache
+	 *
+	 * \return         0 if stored, 1 if not (another writer had the
+	 *                 slot, or there was nothing to store)
+	 */
+	int ssl_shm_cache_set(ssl_context * ssl);
+
+	/**
+	 * \brief          Unmap the cache; the file, if any, stays
+	 *
+	 * \param cache    shared cache
+	 */
+	void ssl_shm_cache_free(ssl_shm_cache * cache);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_shm_cache_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_SSL_SHM_CACHE_C */
+#endif				/* ssl_shm_cache.h */
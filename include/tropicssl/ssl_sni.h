@@ -0,0 +1,147 @@
+/**
+ * \file ssl_sni.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_SSL_SNI_H
+#define TROPICSSL_SSL_SNI_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_SNI_C)
+#include "tropicssl/ssl.h"
+
+/*
+ * Longest host name (RFC 1035)
+ */
+#define SSL_SNI_MAX_NAME               255
+
+typedef struct _ssl_sni_entry ssl_sni_entry;
+
+/**
+ * \brief          Host name to certificate map, looked up once per
+ *                 handshake by the server_name callback; it hands its
+ *                 private keys to the contexts using it, so it belongs
+ *                 to one thread
+ */
+typedef struct {
+	ssl_sni_entry **table;		/*!<  hash buckets             */
+	size_t mask;			/*!<  number of buckets - 1    */
+	size_t count;			/*!<  names stored             */
+} ssl_sni_map;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Initialize a host name map
+	 *
+	 * \param map      map to be initialized
+	 * \param max      expected number of names
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 */
+	int ssl_sni_init(ssl_sni_map * map, size_t max);
+
+	/**
+	 * \brief          Serve a certificate and key for a host name
+	 *
+	 * \param map      host name map
+	 * \param name     host name, or "*.domain" for any single label
+	 *                 in front of domain; matched without case
+	 * \param own_cert certificate chain for that name
+	 * \param rsa_key  its private key
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 *                 if the name is empty or too long, or
+	 *                 TROPICSSL_ERR_SSL_MALLOC_FAILED
+	 *
+	 * \note           A name added twice takes the latest pair. Add
+	 *                 every name before the map is used: lookups
+	 *                 take no lock.
+	 *
+	 * \note           As with ssl_set_own_cert(), threads may share
+	 *                 own_cert but not rsa_key: with several threads,
+	 *                 build a map per thread, each with keys (and an
+	 *                 RNG) of its own.
+	 */
+	int ssl_sni_add(ssl_sni_map * map, const char *name,
+			x509_cert * own_cert, rsa_context * rsa_key);
+
+	/**
+	 * \brief          Use a host name map for a (server) context
+	 *
+	 * \param ssl      SSL context
+	 * \param map      host name map, shared by any number of contexts
+	 *                 of the thread that owns its keys
+	 *
+	 * \note           Names that are not in the map keep the
+	 *                 certificate from ssl_set_own_cert().
+	 *
+	 * \note           The contexts of other threads must not use this
+	 *                 map: every private key operation updates the
+	 *                 key's blinding values, and a key without an RNG
+	 *                 of its own borrows the context's meanwhile.
+	 */
+	void ssl_set_sni_map(ssl_context * ssl, ssl_sni_map * map);
+
+	/**
+	 * \brief          server_name callback (see ssl_set_sni): picks
+	 *                 the certificate of the exact name, or else of
+	 *                 its wildcard
+	 *
+	 * \param p_sni    host name map
+	 *
+	 * \return         0
+	 */
+	int ssl_sni_get(void *p_sni, ssl_context * ssl,
+			const uint8_t *name, size_t len);
+
+	/**
+	 * \brief          Free the map (not the certificates and keys)
+	 */
+	void ssl_sni_free(ssl_sni_map * map);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_sni_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_SSL_SNI_C */
+#endif				/* ssl_sni.h */
@@ -0,0 +1,194 @@
+/**
+ * \file ssl_ticket.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_SSL_TICKET_H
+#define TROPICSSL_SSL_TICKET_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_TICKET_C)
+#include "tropicssl/ssl.h"
+#include "tropicssl/aes.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+ * Key material: name (16) | AES-256 key (32) | HMAC-SHA-256 key (32)
+ */
+#define SSL_TICKET_KEY_LEN              80
+
+/*
+ * Ticket: name (16) | IV (16) | encrypted state (80) | MAC (32)
+ */
+#define SSL_TICKET_LEN                  144
+
+/**
+ * \brief          Ticket key, looked up by its name
+ */
+typedef struct {
+	int active;			/*!<  1 once the key is set    */
+	uint8_t name[16];		/*!<  sent in the clear        */
+	aes_context enc;		/*!<  AES-256 encryption key   */
+	aes_context dec;		/*!<  AES-256 decryption key   */
+	uint8_t mac[32];		/*!<  HMAC-SHA-256 key         */
+} ssl_ticket_key;
+
+/**
+ * \brief          Ticket context: tickets are sealed with the current
+ *                 key, and still accepted under the previous one
+ */
+typedef struct {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	ssl_ticket_key keys[2];		/*!<  current and previous key */
+	int current;			/*!<  index of the current key */
+	uint32_t lifetime;		/*!<  ticket lifetime, seconds */
+} ssl_ticket_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Initialize a ticket context with a random key
+	 *
+	 * \param ctx      ticket context to be initialized
+	 * \param f_rng    RNG function
+	 * \param p_rng    RNG parameter
+	 * \param lifetime tickets older than this (in seconds) are refused;
+	 *                 also sent to clients as the lifetime hint
+	 *
+	 * \return         0 if successful, or the error returned by f_rng
+	 */
+	int ssl_ticket_init(ssl_ticket_context * ctx,
+			    int (*f_rng) (void *, uint8_t *, size_t),
+			    void *p_rng, uint32_t lifetime);
+
+	/**
+	 * \brief          Replace the current key with a random one; the
+	 *                 old current key becomes the previous one
+	 *
+	 * \param ctx      ticket context
+	 * \param f_rng    RNG function
+	 * \param p_rng    RNG parameter
+	 *
+	 * \return         0 if successful, or the error returned by f_rng
+	 *                 (and the keys are left as they were)
+	 *
+	 * \note           Call it at least once per lifetime, so that no
+	 *                 key seals tickets for longer than that.
+	 */
+	int ssl_ticket_rotate(ssl_ticket_context * ctx,
+			      int (*f_rng) (void *, uint8_t *, size_t),
+			      void *p_rng);
+
+	/**
+	 * \brief          Like ssl_ticket_rotate(), with a given key, so
+	 *                 that all servers of a fleet share their keys
+	 *
+	 * \param ctx      ticket context
+	 * \param key      name, AES key and HMAC key (see above)
+	 */
+	void ssl_ticket_set_key(ssl_ticket_context * ctx,
+				const uint8_t key[SSL_TICKET_KEY_LEN]);
+
+	/**
+	 * \brief          Use a ticket context for a (server) context
+	 *
+	 * \param ssl      SSL context
+	 * \param ctx      ticket context, shared by any number of contexts
+	 *                 and threads
+	 */
+	void ssl_set_session_ticket_keys(ssl_context * ssl,
+					 ssl_ticket_context * ctx);
+
+	/**
+	 * \brief          Ticket write callback (see ssl_set_ticket_cb)
+	 *
+	 * \param p_ticket ticket context
+	 * \param ssl      SSL context, whose session is sealed
+	 * \param ticket   output buffer
+	 * \param len      size of the buffer, updated with the ticket length
+	 * \param lifetime set to the lifetime hint
+	 *
+	 * \return         0 if successful, or TROPICSSL_ERR_SSL_BAD_INPUT_DATA
+	 */
+	int ssl_ticket_write(void *p_ticket, ssl_context * ssl,
+			     uint8_t *ticket, size_t *len,
+			     uint32_t *lifetime);
+
+	/**
+	 * \brief          Ticket parse callback (see ssl_set_ticket_cb)
+	 *
+	 * \param p_ticket ticket context
+	 * \param ssl      SSL context
+	 * \param session  set to the session sealed in the ticket
+	 * \param ticket   ticket sent by the client
+	 * \param len      ticket length
+	 *
+	 * \return         0 if the ticket is genuine, current and matches
+	 *                 the protocol version, or
+	 *                 TROPICSSL_ERR_SSL_NO_SESSION_FOUND
+	 */
+	int ssl_ticket_parse(void *p_ticket, ssl_context * ssl,
+			     ssl_session * session,
+			     const uint8_t *ticket, size_t len);
+
+	/**
+	 * \brief          Wipe the keys and free the ticket context
+	 *
+	 * \param ctx      ticket context
+	 */
+	void ssl_ticket_free(ssl_ticket_context * ctx);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int ssl_ticket_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_SSL_TICKET_C */
+#endif				/* ssl_ticket.h */
@@ -66,6 +66,17 @@ extern "C" {
 	 */
 	unsigned long get_timer(struct hr_time *val, int reset);
 
+	/**
+	 * \brief          Return the elapsed time in microseconds
+	 *
+	 * \param val      points to a timer structure
+	 * \param reset    if set to 1, the timer is restarted
+	 *
+	 * \note           Same timer as get_timer(); the two may be used
+	 *                 on one structure.
+	 */
+	unsigned long get_timer_us(struct hr_time *val, int reset);
+
 	/**
 	 * \brief          Setup an alarm clock
 	 *
@@ -0,0 +1,94 @@
+/**
+ * \file trace.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_TRACE_H
+#define TROPICSSL_TRACE_H
+
+#include "tropicssl/config.h"
+
+/*
+ * Static tracepoints of provider "tropicssl", for eg.
+ *
+ *   bpftrace -e 'usdt:./libtropicssl.so:tropicssl:rsa_private_start
+ *                { @t[arg0] = nsecs; }'
+ *
+ * handshake_state_start    ssl, endpoint, state
+ * handshake_state_done     ssl, endpoint, ret
+ * handshake_done           ssl, endpoint, ret (on each return, so
+ *                          also for WANT_READ / WANT_WRITE)
+ * handshake_admit          ssl, resume, ret (server, see
+ *                          ssl_set_admission())
+ * record_encrypt_start     ssl, msgtype, len
+ * record_encrypt_done      ssl, len, ret
+ * record_decrypt_start     ssl, msgtype, len
+ * record_decrypt_done      ssl, len, ret
+ * rsa_public_start         ctx, bits
+ * rsa_public_done          ctx, ret
+ * rsa_private_start        ctx, bits
+ * rsa_private_done         ctx, ret
+ * rsa_private_batch_start  ctx, bits, count
+ * rsa_private_batch_done   ctx, ret
+ * dhm_make_params_start    ctx, bits
+ * dhm_make_params_done     ctx, ret, fresh (0 if a shared key was reused)
+ * dhm_make_public_start    ctx, bits
+ * dhm_make_public_done     ctx, ret
+ * dhm_calc_secret_start    ctx, bits
+ * dhm_calc_secret_done     ctx, ret
+ * ecdh_make_params_start   ctx
+ * ecdh_make_params_done    ctx, ret
+ * ecdh_make_public_start   ctx
+ * ecdh_make_public_done    ctx, ret
+ * ecdh_calc_secret_start   ctx
+ * ecdh_calc_secret_done    ctx, ret
+ * cache_get_start          ssl
+ * cache_get_done           ssl, ret (0 on a hit)
+ * cache_set_done           ssl, ret
+ *
+ * Without TROPICSSL_USDT they compile to nothing; with it, each is a
+ * single nop plus an ELF note until a tracer attaches.
+ */
+#if defined(TROPICSSL_USDT)
+#include <sys/sdt.h>
+
+#define TROPICSSL_TRACE1(name, a)                               \
+	DTRACE_PROBE1(tropicssl, name, a)
+#define TROPICSSL_TRACE2(name, a, b)                            \
+	DTRACE_PROBE2(tropicssl, name, a, b)
+#define TROPICSSL_TRACE3(name, a, b, c)                         \
+	DTRACE_PROBE3(tropicssl, name, a, b, c)
+#else
+#define TROPICSSL_TRACE1(name, a)               do { } while (0)
+#define TROPICSSL_TRACE2(name, a, b)            do { } while (0)
+#define TROPICSSL_TRACE3(name, a, b, c)         do { } while (0)
+#endif
+
+#endif				/* trace.h */
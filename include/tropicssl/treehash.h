@@ -0,0 +1,117 @@
+/**
+ * \file treehash.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_TREEHASH_H
+#define TROPICSSL_TREEHASH_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_TREEHASH)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TREEHASH_MD5                    0
+#define TREEHASH_SHA1                   1
+#define TREEHASH_SHA224                 2
+#define TREEHASH_SHA256                 3
+
+/*
+ * Leaf size; part of the digest definition, so not a tuning knob
+ */
+#define TREEHASH_CHUNK_SIZE             (1024 * 1024)
+
+#define TREEHASH_MAX_THREADS            64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Tree digest of a buffer: the input is cut into
+	 *                 TREEHASH_CHUNK_SIZE chunks (the last one may be
+	 *                 shorter), each leaf is H( 0x00 || chunk ) and
+	 *                 the output is H( 0x01 || leaf_0 || leaf_1 ... )
+	 *
+	 * \param type     TREEHASH_MD5, TREEHASH_SHA1, TREEHASH_SHA224 or
+	 *                 TREEHASH_SHA256
+	 * \param input    buffer holding the data
+	 * \param ilen     length of the input data
+	 * \param threads  number of hashing threads, 1 for the caller's
+	 *                 alone
+	 * \param output   digest (16, 20, 28 or 32 bytes)
+	 *
+	 * \return         0 if successful, 1 if the type is unknown or
+	 *                 memory ran out
+	 *
+	 * \note           The result depends only on the data, not on the
+	 *                 number of threads; it differs from the classic
+	 *                 digest of the same data.
+	 */
+	int treehash(int type, const uint8_t *input, size_t ilen,
+		     int threads, uint8_t *output);
+
+#if defined(TROPICSSL_FS_IO)
+	/**
+	 * \brief          Tree digest of a file, see treehash()
+	 *
+	 * \param type     TREEHASH_MD5, TREEHASH_SHA1, TREEHASH_SHA224 or
+	 *                 TREEHASH_SHA256
+	 * \param path     input file name
+	 * \param threads  number of hashing threads, or 0 for one per
+	 *                 online CPU
+	 * \param output   digest (16, 20, 28 or 32 bytes)
+	 *
+	 * \return         0 if successful, 1 if fopen failed,
+	 *                 or 2 if fread failed
+	 *
+	 * \note           The file is mapped rather than read; each thread
+	 *                 asks the kernel to read its next chunk ahead and
+	 *                 drops the pages of the chunks it has hashed.
+	 */
+	int treehash_file(int type, const char *path, int threads,
+			  uint8_t *output);
+#endif
+
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int treehash_self_test(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif              /* TROPICSSL_TREEHASH */
+#endif				/* treehash.h */
@@ -40,6 +40,16 @@
 #if defined(TROPICSSL_X509_PARSE)
 #include "tropicssl/rsa.h"
 
+#if defined(TROPICSSL_X509_VERIFY_CACHE) || \
+    defined(TROPICSSL_X509_CRT_CACHE) || defined(TROPICSSL_X509_CRL)
+#include <time.h>
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
 #define BADCERT_EXPIRED                 1
 #define BADCERT_REVOKED                 2
 #define BADCERT_CN_MISMATCH             4
@@ -61,6 +71,7 @@
 #define ASN1_T61_STRING              0x14
 #define ASN1_IA5_STRING              0x16
 #define ASN1_UTC_TIME                0x17
+#define ASN1_GENERALIZED_TIME        0x18
 #define ASN1_UNIVERSAL_STRING        0x1C
 #define ASN1_BMP_STRING              0x1E
 #define ASN1_PRIMITIVE               0x00
@@ -138,13 +149,129 @@ typedef struct _x509_cert {
 
 	int ca_istrue;
 	int max_pathlen;
+	int lazy;			/*!<  issuer, subject not decoded */
 
 	x509_buf sig_oid2;
 	x509_buf sig;
 
+	struct _x509_index *index;	/*!<  on the head of a CA chain */
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	struct _x509_vcache *vcache;	/*!<  on the head of a CA chain */
+#endif
+#if defined(TROPICSSL_X509_CRL)
+	struct _x509_crl_store *crl;	/*!<  on the head of a CA chain */
+#endif
+	uint8_t *crt_msg;		/*!<  on the head of an own chain */
+	uint8_t *dn_list;		/*!<  on the head of a CA chain */
+
 	struct _x509_cert *next;
 } x509_cert;
 
+/**
+ * \brief          Subject index of a CA chain: open addressing over
+ *                 a hash of subject_raw
+ */
+typedef struct _x509_index {
+	unsigned long *hash;		/*!<  subject hash of each slot */
+	x509_cert **slot;		/*!<  NULL if the slot is empty */
+	size_t mask;			/*!<  number of slots - 1       */
+} x509_index;
+
+/*
+ * Entries per set of the verification and certificate caches
+ */
+#define X509_VCACHE_WAYS                 4
+
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+/**
+ * \brief          Verified chain: SHA-256 of the presented certificates
+ */
+typedef struct {
+	uint8_t digest[32];
+	time_t expires;			/*!<  0 if the slot is empty    */
+} x509_vcache_entry;
+
+/**
+ * \brief          Verification cache, attached to a trusted CA chain
+ */
+typedef struct _x509_vcache {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	x509_vcache_entry *table;	/*!<  X509_VCACHE_WAYS per set  */
+	size_t mask;			/*!<  number of sets - 1        */
+	int timeout;			/*!<  lifetime of an entry (s)  */
+	unsigned long hits;		/*!<  signature checks skipped  */
+	unsigned long misses;		/*!<  chains fully verified     */
+} x509_vcache;
+#endif
+
+#if defined(TROPICSSL_X509_CRT_CACHE)
+typedef struct _x509_shared x509_shared;
+
+/**
+ * \brief          Parsed certificate chains, shared by reference
+ */
+typedef struct {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	x509_shared **table;		/*!<  X509_VCACHE_WAYS per set  */
+	size_t mask;			/*!<  number of sets - 1        */
+	unsigned long tick;		/*!<  lookups so far            */
+	unsigned long hits;		/*!<  chains not parsed again   */
+	unsigned long misses;		/*!<  chains parsed             */
+} x509_crt_cache;
+#endif
+
+#if defined(TROPICSSL_X509_CRL)
+/**
+ * \brief          Certificate revocation list, chained like x509_cert
+ */
+typedef struct _x509_crl {
+	x509_buf raw;
+	x509_buf tbs;
+
+	int version;
+	x509_buf sig_oid1;
+	int sig_alg;			/*!<  RSA_MD5 .. RSA_SHA256     */
+
+	x509_buf issuer_raw;
+
+	x509_time this_update;
+	x509_time next_update;		/*!<  all zero if absent        */
+
+	x509_buf entries;		/*!<  revokedCertificates       */
+	size_t count;			/*!<  number of entries         */
+
+	x509_buf sig_oid2;
+	x509_buf sig;
+
+	struct _x509_crl *next;
+} x509_crl;
+
+typedef struct _x509_revoked x509_revoked;
+
+/**
+ * \brief          Current revocation lists of a CA chain, replaced as
+ *                 a whole by x509_crl_store_swap()
+ */
+typedef struct _x509_crl_store {
+#if defined(WIN32)
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	x509_revoked *cur;		/*!<  NULL if nothing is revoked */
+	unsigned long checks;		/*!<  certificates looked up    */
+	unsigned long revoked;		/*!<  found revoked             */
+} x509_crl_store;
+#endif
+
 /*
  * Structures for writing X.509 certificates
  */
@@ -188,6 +315,35 @@ extern "C" {
 	 */
 	int x509parse_crt(x509_cert * crt, const uint8_t *buf, size_t buflen);
 
+	/**
+	 * \brief          Index a trusted CA chain by subject, so that
+	 *                 x509parse_verify() finds issuers in constant time
+	 *
+	 * \param chain    points to the start of the chain
+	 *
+	 * \return         0 if successful, or 1 if memory allocation failed
+	 *                 (the chain is then searched linearly)
+	 *
+	 * \note           x509parse_crt() drops the index of the chain it
+	 *                 adds to: index it once every certificate is in.
+	 *                 An indexed chain is only read by
+	 *                 x509parse_verify(), so any number of contexts and
+	 *                 threads can share it through ssl_set_ca_chain().
+	 */
+	int x509parse_index(x509_cert * chain);
+
+	/**
+	 * \brief          Same as x509parse_crt(), but leave the issuer
+	 *                 and subject lists empty: the names are checked
+	 *                 and kept raw, for x509parse_dn() to decode
+	 *                 when needed
+	 *
+	 * \note           x509parse_verify() and x509parse_cert_info()
+	 *                 read such certificates from their raw names.
+	 */
+	int x509parse_crt_lazy(x509_cert * crt, const uint8_t *buf,
+			       size_t buflen);
+
 #if defined(TROPICSSL_FS_IO)
 	/**
 	 * \brief          Load one or more certificates and add them
@@ -201,6 +357,27 @@ extern "C" {
 	int x509parse_crtfile(x509_cert * crt, const char *path);
 #endif
 
+#if defined(TROPICSSL_FS_IO) && defined(TROPICSSL_X509_CRTPATH)
+	/**
+	 * \brief          Load every certificate of a bundle, or of all the
+	 *                 files of a directory (in name order), and add
+	 *                 them to the chained list
+	 *
+	 * \param chain    points to the start of the chain
+	 * \param path     PEM or DER file, or directory of such files
+	 * \param threads  number of parsing threads, 1 for the caller's
+	 *                 alone
+	 *
+	 * \return         0 if successful, or a specific X509 error code;
+	 *                 the chain then holds the certificates before
+	 *                 the first bad one, as with x509parse_crtfile()
+	 *
+	 * \note           Files are mapped rather than read, and text
+	 *                 around the PEM blocks is ignored.
+	 */
+	int x509parse_crtpath(x509_cert * chain, const char *path, int threads);
+#endif
+
 	/**
 	 * \brief          Parse a private RSA key
 	 *
@@ -229,6 +406,22 @@ extern "C" {
 	int x509parse_keyfile(rsa_context * rsa, const char *path, const char *password);
 #endif
 
+	/**
+	 * \brief          Decode a raw DN, eg. the subject_raw of a
+	 *                 certificate from x509parse_crt_lazy()
+	 *
+	 * \param raw      DER Name
+	 * \param dn       list to fill, freed with x509_name_free()
+	 *
+	 * \return         0 if successful, or a specific X509 error code
+	 */
+	int x509parse_dn(const x509_buf * raw, x509_name * dn);
+
+	/**
+	 * \brief          Free the list from x509parse_dn()
+	 */
+	void x509_name_free(x509_name * dn);
+
 	/**
 	 * \brief          Store the certificate DN in printable form into buf;
 	 *                 no more than (end - buf) characters will be written.
@@ -264,16 +457,193 @@ extern "C" {
 	 *                      BADCERT_CN_MISMATCH --
 	 *                      BADCERT_NOT_TRUSTED
 	 *
-	 * \note           TODO: add two arguments, depth and crl
+	 * \note           Revocation is checked against the CRL store
+	 *                 attached with x509_set_crl(), if any.
 	 */
 	int x509parse_verify(x509_cert * crt,
 			     x509_cert * trust_ca, const char *cn, int *flags);
 
 	/**
 	 * \brief          Unallocate all certificate data
+	 *
+	 * \note           If crt carries a verification cache, the cache
+	 *                 is flushed (but not freed).
 	 */
 	void x509_free(x509_cert * crt);
 
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	/**
+	 * \brief          Initialize a verification cache
+	 *
+	 * \param cache    cache to be initialized
+	 * \param max      approx. number of verified chains kept
+	 * \param timeout  seconds a verified chain is trusted without
+	 *                 checking its signatures again
+	 *
+	 * \return         0 if successful, or 1 if memory allocation failed
+	 */
+	int x509_vcache_init(x509_vcache * cache, size_t max, int timeout);
+
+	/**
+	 * \brief          Remember the chains this CA chain verified
+	 *
+	 * \param trust_ca head of the trusted CA chain, as passed to
+	 *                 x509parse_verify() or ssl_set_ca_chain()
+	 * \param cache    verification cache, or NULL to stop caching;
+	 *                 it may be shared by threads but belongs to
+	 *                 this single CA chain
+	 *
+	 * \note           Only successful verifications are kept, and
+	 *                 expiry and the CN are still checked on a hit:
+	 *                 the flags are those of a full verification.
+	 *                 Flush the cache if the CA chain loses a
+	 *                 certificate.
+	 */
+	void x509_set_verify_cache(x509_cert * trust_ca, x509_vcache * cache);
+
+	/**
+	 * \brief          Forget every verified chain
+	 */
+	void x509_vcache_flush(x509_vcache * cache);
+
+	/**
+	 * \brief          Free the cache entries and the lock
+	 */
+	void x509_vcache_free(x509_vcache * cache);
+#endif
+
+#if defined(TROPICSSL_X509_CRL)
+	/**
+	 * \brief          Parse one or more CRLs and add them to the
+	 *                 chained list
+	 *
+	 * \param chain    points to the start of the list
+	 * \param buf      PEM ("X509 CRL" blocks) or DER data; it need
+	 *                 not be NUL-terminated
+	 * \param buflen   size of the buffer
+	 *
+	 * \return         0 if successful, or a specific X509 error code
+	 */
+	int x509parse_crl(x509_crl * chain, const uint8_t *buf, size_t buflen);
+
+#if defined(TROPICSSL_FS_IO)
+	/**
+	 * \brief          Load one or more CRLs and add them to the
+	 *                 chained list
+	 *
+	 * \param chain    points to the start of the list
+	 * \param path     filename to read the CRLs from
+	 *
+	 * \return         0 if successful, or a specific X509 error code
+	 *
+	 * \note           With TROPICSSL_X509_CRTPATH the file is mapped
+	 *                 rather than read.
+	 */
+	int x509parse_crlfile(x509_crl * chain, const char *path);
+#endif
+
+	/**
+	 * \brief          Unallocate all CRL data
+	 */
+	void x509_crl_free(x509_crl * crl);
+
+	/**
+	 * \brief          Initialize a CRL store, with nothing revoked
+	 *
+	 * \return         0
+	 */
+	int x509_crl_store_init(x509_crl_store * store);
+
+	/**
+	 * \brief          Replace the revocation lists of a store
+	 *
+	 * \param store    CRL store
+	 * \param crl      CRLs from x509parse_crl(); the store takes
+	 *                 them over and leaves the list empty. An empty
+	 *                 list clears the store.
+	 * \param ca       certificates of the CRL issuers, eg. the
+	 *                 trusted CA chain and any intermediate CAs
+	 *
+	 * \return         0 if successful, 1 if memory allocation failed,
+	 *                 or TROPICSSL_ERR_X509_CRL_VERIFY_FAILED if a CRL
+	 *                 is not signed by one of ca (the store and crl
+	 *                 are then left unchanged)
+	 *
+	 * \note           Serials are indexed by issuer and number, so
+	 *                 that a lookup takes constant time. Verifications
+	 *                 in progress finish with the lists they started
+	 *                 with; the old lists are freed after the last.
+	 *                 nextUpdate is not enforced: swap in fresh lists.
+	 */
+	int x509_crl_store_swap(x509_crl_store * store, x509_crl * crl,
+				x509_cert * ca);
+
+	/**
+	 * \brief          Have x509parse_verify() reject the certificates
+	 *                 a store lists as revoked
+	 *
+	 * \param trust_ca head of the trusted CA chain, as passed to
+	 *                 x509parse_verify() or ssl_set_ca_chain()
+	 * \param store    CRL store, or NULL to stop checking
+	 *
+	 * \note           Every certificate of the presented chain is
+	 *                 looked up, also on verification cache hits, and
+	 *                 BADCERT_REVOKED set if one is listed.
+	 */
+	void x509_set_crl(x509_cert * trust_ca, x509_crl_store * store);
+
+	/**
+	 * \brief          Free the current lists and the lock
+	 */
+	void x509_crl_store_free(x509_crl_store * store);
+#endif
+
+#if defined(TROPICSSL_X509_CRT_CACHE)
+	/**
+	 * \brief          Initialize a certificate cache
+	 *
+	 * \param cache    cache to be initialized
+	 * \param max      approx. number of parsed chains kept
+	 *
+	 * \return         0 if successful, or 1 if memory allocation failed
+	 */
+	int x509_crt_cache_init(x509_crt_cache * cache, size_t max);
+
+	/**
+	 * \brief          Get the parsed chain of a TLS certificate_list,
+	 *                 parsing it only if the cache does not hold it
+	 *
+	 * \param cache    certificate cache
+	 * \param crt      set to the chain, to be released with
+	 *                 x509_crt_release()
+	 * \param buf      DER certificates, each preceded by its length
+	 *                 on 3 bytes
+	 * \param buflen   size of the buffer
+	 *
+	 * \return         0 if successful, or a specific X509 error code
+	 *
+	 * \note           Chains are keyed by SHA-256 of buf. They are
+	 *                 immutable: read them from any thread, but never
+	 *                 parse into, index or free them.
+	 */
+	int x509parse_crt_shared(x509_crt_cache * cache, x509_cert ** crt,
+				 const uint8_t *buf, size_t buflen);
+
+	/**
+	 * \brief          Drop a reference from x509parse_crt_shared();
+	 *                 the chain is freed with its last reference
+	 */
+	void x509_crt_release(x509_crt_cache * cache, x509_cert * crt);
+
+	/**
+	 * \brief          Drop the cache's own references and free it
+	 *
+	 * \note           Every chain from x509parse_crt_shared() must
+	 *                 have been released before.
+	 */
+	void x509_crt_cache_free(x509_crt_cache * cache);
+#endif
+
 #if defined(TROPICSSL_SELF_TEST)
 	/**
 	 * \brief          Checkup routine
@@ -0,0 +1,206 @@
+/**
+ * \file x509snap.h
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TROPICSSL_X509SNAP_H
+#define TROPICSSL_X509SNAP_H
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_X509_SNAP_C)
+#include "tropicssl/x509.h"
+
+#define X509_SNAP_VERSION               1
+#define X509_SNAP_HEADER_LEN           32
+#define X509_SNAP_INDEX_LEN            32	/* per entry */
+
+/**
+ * \brief          One named certificate chain and private key, given
+ *                 to x509_snap_write()
+ */
+typedef struct {
+	const char *name;		/*!<  eg. the host name          */
+	const x509_cert *crt;		/*!<  chain, own certificate first */
+	const rsa_context *rsa;		/*!<  its key, or NULL           */
+} x509_snap_entry;
+
+/**
+ * \brief          Snapshot file mapped for x509_snap_find() and
+ *                 x509_snap_load()
+ */
+typedef struct {
+	const uint8_t *p;		/*!<  whole file                 */
+	size_t len;			/*!<  its size                   */
+	size_t count;			/*!<  number of entries          */
+	int limb_bits;			/*!<  biL of the writer          */
+	int mapped;			/*!<  p is to be unmapped        */
+} x509_snap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \brief          Serialize certificate chains and keys, sorted by
+	 *                 name; keys keep their CRT and Montgomery
+	 *                 constants, so loading needs neither PEM, DES
+	 *                 nor ASN.1 decoding of the key, nor any modular
+	 *                 reduction
+	 *
+	 * \param buf      output buffer, or NULL to only get the size
+	 * \param buflen   size of buf
+	 * \param olen     size of the snapshot
+	 * \param entries  entries to store; the names must be distinct
+	 * \param count    number of entries
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_MPI_BUFFER_TOO_SMALL
+	 *                 if buf is too short (*olen is then the size
+	 *                 needed), TROPICSSL_ERR_X509_SNAP_INVALID for a
+	 *                 duplicate name, or an MPI error code
+	 *
+	 * \note           The snapshot holds the private keys in clear:
+	 *                 protect it as the key files themselves.
+	 */
+	int x509_snap_build(uint8_t *buf, size_t buflen, size_t *olen,
+			    const x509_snap_entry * entries, size_t count);
+
+#if defined(TROPICSSL_FS_IO)
+	/**
+	 * \brief          Write a snapshot file with x509_snap_build()
+	 *
+	 * \param path     file to create (mode 0600)
+	 * \param entries  entries to store
+	 * \param count    number of entries
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_FILE_IO_ERROR, or
+	 *                 an error of x509_snap_build()
+	 */
+	int x509_snap_write(const char *path,
+			    const x509_snap_entry * entries, size_t count);
+
+	/**
+	 * \brief          Map a snapshot file
+	 *
+	 * \param snap     snapshot to set up
+	 * \param path     file written by x509_snap_write()
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_FILE_IO_ERROR, or
+	 *                 TROPICSSL_ERR_X509_SNAP_INVALID if the header or
+	 *                 the index is bad
+	 *
+	 * \note           The entries are only checked when loaded.
+	 */
+	int x509_snap_open(x509_snap * snap, const char *path);
+#endif
+
+	/**
+	 * \brief          Use a snapshot from memory
+	 *
+	 * \param snap     snapshot to set up
+	 * \param buf      snapshot, as from x509_snap_build(); it must
+	 *                 stay valid until x509_snap_close()
+	 * \param buflen   its size
+	 *
+	 * \return         as x509_snap_open()
+	 */
+	int x509_snap_attach(x509_snap * snap, const uint8_t *buf,
+			     size_t buflen);
+
+	/**
+	 * \brief          Look an entry up by name (binary search)
+	 *
+	 * \param snap     snapshot
+	 * \param name     name given to x509_snap_build()
+	 *
+	 * \return         the entry's number, or
+	 *                 TROPICSSL_ERR_X509_SNAP_NOT_FOUND
+	 */
+	int x509_snap_find(const x509_snap * snap, const char *name);
+
+	/**
+	 * \brief          Load the certificate chain and key of an entry
+	 *
+	 * \param snap     snapshot
+	 * \param idx      entry number, from x509_snap_find()
+	 * \param crt      chain to add the certificates to
+	 * \param rsa      RSA context to set up, or NULL to skip the key
+	 *
+	 * \return         0 if successful, TROPICSSL_ERR_X509_SNAP_NOT_FOUND
+	 *                 if idx is out of range or the entry has no key
+	 *                 while rsa is given, TROPICSSL_ERR_X509_SNAP_INVALID
+	 *                 if its digest does not match, or an X509 or MPI
+	 *                 error code
+	 *
+	 * \note           The certificates are parsed as by
+	 *                 x509parse_crt_lazy(). The key is not checked
+	 *                 again with rsa_check_privkey(): x509_snap_build()
+	 *                 only stores keys that passed it, and the entry's
+	 *                 SHA-256 digest catches a damaged file.
+	 *                 The Montgomery constants are only taken from a
+	 *                 writer with the same limb size, and computed
+	 *                 otherwise.
+	 */
+	int x509_snap_load(const x509_snap * snap, int idx,
+			   x509_cert * crt, rsa_context * rsa);
+
+	/**
+	 * \brief          Name of an entry, not NUL-terminated
+	 *
+	 * \param snap     snapshot
+	 * \param idx      entry number, below snap->count
+	 * \param len      set to the length of the name
+	 *
+	 * \return         the name, or NULL if idx is out of range
+	 */
+	const char *x509_snap_name(const x509_snap * snap, int idx,
+				   size_t *len);
+
+	/**
+	 * \brief          Unmap or forget a snapshot; what was loaded from
+	 *                 it stays valid
+	 */
+	void x509_snap_close(x509_snap * snap);
+
+#if defined(TROPICSSL_SELF_TEST)
+	/**
+	 * \brief          Checkup routine
+	 *
+	 * \return         0 if successful, or 1 if the test failed
+	 */
+	int x509_snap_self_test(int verbose);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif				/* TROPICSSL_X509_SNAP_C */
+#endif				/* x509snap.h */
@@ -46,6 +46,22 @@
 #include "tropicssl/err.h"
 #include "tropicssl/aes.h"
 
+#if defined(TROPICSSL_AESNI)
+#include "tropicssl/aesni.h"
+#endif
+
+#if defined(TROPICSSL_AESCE)
+#include "tropicssl/aesce.h"
+#endif
+
+#if !defined(TROPICSSL_AES_ROM_TABLES)
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
 /*
  * 32-bit integer manipulation macros (little endian)
  */
@@ -371,8 +387,6 @@ static uint32_t RCON[10];
 #define XTIME(x) ( ( x << 1 ) ^ ( ( x & 0x80 ) ? 0x1B : 0x00 ) )
 #define MUL(x,y) ( ( x && y ) ? pow[(log[x]+log[y]) % 255] : 0 )
 
-static int aes_init_done = 0;
-
 static void aes_gen_tables(void)
 {
 	uint32_t i, x, y, z;
@@ -448,6 +462,27 @@ static void aes_gen_tables(void)
 	}
 }
 
+/*
+ * The tables are built once, by whichever thread sets a key first;
+ * the others wait for it rather than read them half-written
+ */
+#if defined(WIN32)
+static INIT_ONCE aes_init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK aes_init_tables(PINIT_ONCE once, PVOID p, PVOID * ctx)
+{
+	aes_gen_tables();
+	return (TRUE);
+}
+
+#define AES_INIT_TABLES()                                       \
+    InitOnceExecuteOnce(&aes_init_once, aes_init_tables, NULL, NULL)
+#else
+static pthread_once_t aes_init_once = PTHREAD_ONCE_INIT;
+
+#define AES_INIT_TABLES()   pthread_once(&aes_init_once, aes_gen_tables)
+#endif
+
 #endif
 
 /*
@@ -459,10 +494,7 @@ void aes_setkey_enc(aes_context * ctx, const uint8_t *key, unsigned int keysize)
 	uint32_t *RK;
 
 #if !defined(TROPICSSL_AES_ROM_TABLES)
-	if (aes_init_done == 0) {
-		aes_gen_tables();
-		aes_init_done = 1;
-	}
+	AES_INIT_TABLES();
 #endif
 
 	switch (keysize) {
@@ -481,6 +513,20 @@ void aes_setkey_enc(aes_context * ctx, const uint8_t *key, unsigned int keysize)
 
 	ctx->rk = RK = ctx->buf;
 
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (aesni_supports(TROPICSSL_AESNI_AES)) {
+		aesni_setkey_enc(RK, key, keysize);
+		return;
+	}
+#endif
+
+#if defined(TROPICSSL_AESCE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (aesce_supports()) {
+		aesce_setkey_enc(RK, key, keysize);
+		return;
+	}
+#endif
+
 	for (i = 0; i < (keysize >> 5); i++) {
 		GET_UINT32_LE(RK[i], key, i << 2);
 	}
@@ -580,6 +626,23 @@ void aes_setkey_dec(aes_context * ctx, const uint8_t *key, unsigned int keysize)
 #endif
 
 	aes_setkey_enc(&cty, key, keysize);
+
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (aesni_supports(TROPICSSL_AESNI_AES)) {
+		aesni_inverse_key(RK, cty.rk, ctx->nr);
+		memset(&cty, 0, sizeof(aes_context));
+		return;
+	}
+#endif
+
+#if defined(TROPICSSL_AESCE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (aesce_supports()) {
+		aesce_inverse_key(RK, cty.rk, ctx->nr);
+		memset(&cty, 0, sizeof(aes_context));
+		return;
+	}
+#endif
+
 	SK = cty.rk + cty.nr * 4;
 
 	*RK++ = *SK++;
@@ -659,6 +722,20 @@ void aes_crypt_ecb(aes_context * ctx,
 	uint32_t i;
 	uint32_t *RK, X0, X1, X2, X3, Y0, Y1, Y2, Y3;
 
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (aesni_supports(TROPICSSL_AESNI_AES)) {
+		aesni_crypt_ecb(ctx, mode, input, output);
+		return;
+	}
+#endif
+
+#if defined(TROPICSSL_AESCE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (aesce_supports()) {
+		aesce_crypt_ecb(ctx, mode, input, output);
+		return;
+	}
+#endif
+
 	RK = ctx->rk;
 
 	GET_UINT32_LE(X0, input, 0);
@@ -752,6 +829,20 @@ void aes_crypt_cbc(aes_context * ctx,
 	uint32_t i;
 	uint8_t temp[16];
 
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (aesni_supports(TROPICSSL_AESNI_AES)) {
+		aesni_crypt_cbc(ctx, mode, length, iv, input, output);
+		return;
+	}
+#endif
+
+#if defined(TROPICSSL_AESCE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (aesce_supports()) {
+		aesce_crypt_cbc(ctx, mode, length, iv, input, output);
+		return;
+	}
+#endif
+
 	if (mode == AES_DECRYPT) {
 		while (length > 0) {
 			memcpy(temp, input, 16);
@@ -819,6 +910,110 @@ void aes_crypt_cfb128(aes_context * ctx,
 	*iv_off = n;
 }
 
+/*
+ * Increment the 128-bit big-endian counter
+ */
+static void aes_ctr_inc(uint8_t nonce_counter[16])
+{
+	int i;
+
+	for (i = 16; i > 0; i--)
+		if (++nonce_counter[i - 1] != 0)
+			break;
+}
+
+/*
+ * AES-CTR over whole blocks; input == NULL yields the raw keystream
+ */
+static void aes_ctr_blocks(aes_context * ctx,
+			   size_t nblocks,
+			   uint8_t nonce_counter[16],
+			   const uint8_t *input, uint8_t *output)
+{
+	int i;
+	uint8_t tmp[16];
+
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (aesni_supports(TROPICSSL_AESNI_AES)) {
+		aesni_crypt_ctr(ctx, nblocks, nonce_counter, input, output);
+		return;
+	}
+#endif
+
+#if defined(TROPICSSL_AESCE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (aesce_supports()) {
+		aesce_crypt_ctr(ctx, nblocks, nonce_counter, input, output);
+		return;
+	}
+#endif
+
+	while (nblocks > 0) {
+		aes_crypt_ecb(ctx, AES_ENCRYPT, nonce_counter, tmp);
+		aes_ctr_inc(nonce_counter);
+
+		if (input != NULL) {
+			for (i = 0; i < 16; i++)
+				output[i] = (uint8_t)(input[i] ^ tmp[i]);
+			input += 16;
+		} else
+			memcpy(output, tmp, 16);
+
+		output += 16;
+		nblocks--;
+	}
+}
+
+/*
+ * AES-CTR buffer encryption/decryption
+ */
+void aes_crypt_ctr(aes_context * ctx,
+		   size_t length,
+		   size_t *nc_off,
+		   uint8_t nonce_counter[16],
+		   uint8_t stream_block[16],
+		   const uint8_t *input, uint8_t *output)
+{
+	size_t n = *nc_off;
+
+	/*
+	 * Finish the stream block left over from the previous call
+	 */
+	while (n != 0 && length > 0) {
+		*output++ = (uint8_t)(*input++ ^ stream_block[n]);
+		n = (n + 1) & 0x0F;
+		length--;
+	}
+
+	if (length >= 16) {
+		aes_ctr_blocks(ctx, length >> 4, nonce_counter, input, output);
+		input += length & ~(size_t)0x0F;
+		output += length & ~(size_t)0x0F;
+		length &= 0x0F;
+	}
+
+	if (length > 0) {
+		aes_crypt_ecb(ctx, AES_ENCRYPT, nonce_counter, stream_block);
+		aes_ctr_inc(nonce_counter);
+
+		while (length-- > 0) {
+			*output++ = (uint8_t)(*input++ ^ stream_block[n]);
+			n++;
+		}
+	}
+
+	*nc_off = n;
+}
+
+/*
+ * AES-CTR keystream generation
+ */
+void aes_ctr_keystream(aes_context * ctx,
+		       size_t nblocks,
+		       uint8_t nonce_counter[16], uint8_t *output)
+{
+	aes_ctr_blocks(ctx, nblocks, nonce_counter, NULL, output);
+}
+
 #if defined(TROPICSSL_SELF_TEST)
 
 #include <stdio.h>
@@ -1128,6 +1323,218 @@ static int aes_test_mode_cfb128(int verbose)
 
 }
 
+/*
+ * AES-CTR test vectors from:
+ *
+ * http://www.faqs.org/rfcs/rfc3686.html
+ */
+static const uint8_t aes_test_ctr_key[3][16] = {
+	{
+	 0xAE, 0x68, 0x52, 0xF8, 0x12, 0x10, 0x67, 0xCC,
+	 0x4B, 0xF7, 0xA5, 0x76, 0x55, 0x77, 0xF3, 0x9E},
+	{
+	 0x7E, 0x24, 0x06, 0x78, 0x17, 0xFA, 0xE0, 0xD7,
+	 0x43, 0xD6, 0xCE, 0x1F, 0x32, 0x53, 0x91, 0x63},
+	{
+	 0x76, 0x91, 0xBE, 0x03, 0x5E, 0x50, 0x20, 0xA8,
+	 0xAC, 0x6E, 0x61, 0x85, 0x29, 0xF9, 0xA0, 0xDC}
+};
+
+static const uint8_t aes_test_ctr_nonce_counter[3][16] = {
+	{
+	 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00,
+	 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01},
+	{
+	 0x00, 0x6C, 0xB6, 0xDB, 0xC0, 0x54, 0x3B, 0x59,
+	 0xDA, 0x48, 0xD9, 0x0B, 0x00, 0x00, 0x00, 0x01},
+	{
+	 0x00, 0xE0, 0x01, 0x7B, 0x27, 0x77, 0x7F, 0x3F,
+	 0x4A, 0x17, 0x86, 0xF0, 0x00, 0x00, 0x00, 0x01}
+};
+
+static const uint8_t aes_test_ctr_pt[3][48] = {
+	{
+	 0x53, 0x69, 0x6E, 0x67, 0x6C, 0x65, 0x20, 0x62,
+	 0x6C, 0x6F, 0x63, 0x6B, 0x20, 0x6D, 0x73, 0x67},
+	{
+	 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F},
+	{
+	 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+	 0x20, 0x21, 0x22, 0x23}
+};
+
+static const uint8_t aes_test_ctr_ct[3][48] = {
+	{
+	 0xE4, 0x09, 0x5D, 0x4F, 0xB7, 0xA7, 0xB3, 0x79,
+	 0x2D, 0x61, 0x75, 0xA3, 0x26, 0x13, 0x11, 0xB8},
+	{
+	 0x51, 0x04, 0xA1, 0x06, 0x16, 0x8A, 0x72, 0xD9,
+	 0x79, 0x0D, 0x41, 0xEE, 0x8E, 0xDA, 0xD3, 0x88,
+	 0xEB, 0x2E, 0x1E, 0xFC, 0x46, 0xDA, 0x57, 0xC8,
+	 0xFC, 0xE6, 0x30, 0xDF, 0x91, 0x41, 0xBE, 0x28},
+	{
+	 0xC1, 0xCF, 0x48, 0xA8, 0x9F, 0x2F, 0xFD, 0xD9,
+	 0xCF, 0x46, 0x52, 0xE9, 0xEF, 0xDB, 0x72, 0xD7,
+	 0x45, 0x40, 0xA4, 0x2B, 0xDE, 0x6D, 0x78, 0x36,
+	 0xD5, 0x9A, 0x5C, 0xEA, 0xAE, 0xF3, 0x10, 0x53,
+	 0x25, 0xB2, 0x07, 0x2F}
+};
+
+static const size_t aes_test_ctr_len[3] = { 16, 32, 36 };
+
+static int aes_test_mode_ctr(int verbose)
+{
+	uint32_t i, u, v;
+	size_t offset;
+	uint8_t nonce_counter[16];
+	uint8_t stream_block[16];
+	uint8_t buf[48];
+	aes_context ctx;
+
+	/*
+	 * CTR mode
+	 */
+	for (i = 0; i < 6; i++) {
+		u = i >> 1;
+		v = i & 1;
+
+		if (verbose != 0)
+			printf("  AES-CTR-128 (%s): ",
+			       (v == AES_DECRYPT) ? "dec" : "enc");
+
+		memcpy(nonce_counter, aes_test_ctr_nonce_counter[u], 16);
+
+		offset = 0;
+		aes_setkey_enc(&ctx, aes_test_ctr_key[u], 128);
+
+		if (v == AES_DECRYPT) {
+			size_t len = aes_test_ctr_len[u];
+
+			/*
+			 * Feed the data in two uneven pieces so that the
+			 * stream block resume path is checked as well
+			 */
+			memcpy(buf, aes_test_ctr_ct[u], len);
+			aes_crypt_ctr(&ctx, 7, &offset, nonce_counter,
+				      stream_block, buf, buf);
+			aes_crypt_ctr(&ctx, len - 7, &offset, nonce_counter,
+				      stream_block, buf + 7, buf + 7);
+
+			if (memcmp(buf, aes_test_ctr_pt[u], len) != 0) {
+				if (verbose != 0)
+					printf("failed\n");
+
+				return (1);
+			}
+		} else {
+			size_t len = aes_test_ctr_len[u];
+
+			memcpy(buf, aes_test_ctr_pt[u], len);
+			aes_crypt_ctr(&ctx, len, &offset, nonce_counter,
+				      stream_block, buf, buf);
+
+			if (memcmp(buf, aes_test_ctr_ct[u], len) != 0) {
+				if (verbose != 0)
+					printf("failed\n");
+
+				return (1);
+			}
+		}
+
+		if (verbose != 0)
+			printf("passed\n");
+	}
+
+	if (verbose != 0)
+		printf("\n");
+
+	return (0);
+}
+
+/*
+ * Multi-block CBC decryption must match block-at-a-time decryption,
+ * and bulk CTR must match the single block path
+ */
+static int aes_test_mode_bulk(int verbose)
+{
+	uint32_t i;
+	size_t offset;
+	uint8_t key[32];
+	uint8_t iv1[16], iv2[16];
+	uint8_t src[272];
+	uint8_t buf1[272], buf2[272];
+	uint8_t stream_block[16];
+	aes_context ctx;
+
+	if (verbose != 0)
+		printf("  AES-CBC/CTR bulk   : ");
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = (uint8_t)(i * 7 + 1);
+
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = (uint8_t)(i * 13 + 5);
+
+	aes_setkey_dec(&ctx, key, 256);
+
+	memset(iv1, 0xA5, sizeof(iv1));
+	memset(iv2, 0xA5, sizeof(iv2));
+
+	aes_crypt_cbc(&ctx, AES_DECRYPT, sizeof(src), iv1, src, buf1);
+
+	for (i = 0; i < sizeof(src); i += 16)
+		aes_crypt_cbc(&ctx, AES_DECRYPT, 16, iv2, src + i, buf2 + i);
+
+	if (memcmp(buf1, buf2, sizeof(buf1)) != 0 ||
+	    memcmp(iv1, iv2, sizeof(iv1)) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	aes_setkey_enc(&ctx, key, 256);
+
+	/*
+	 * Start close to a 64-bit carry to exercise counter propagation
+	 */
+	memset(iv1, 0, sizeof(iv1));
+	memset(iv1 + 8, 0xFF, 8);
+	iv1[15] = 0xFB;
+	memcpy(iv2, iv1, sizeof(iv2));
+
+	offset = 0;
+	aes_crypt_ctr(&ctx, sizeof(src), &offset, iv1, stream_block,
+		      src, buf1);
+
+	for (i = 0; i < sizeof(src); i += 16) {
+		aes_crypt_ecb(&ctx, AES_ENCRYPT, iv2, buf2 + i);
+		aes_ctr_inc(iv2);
+	}
+
+	for (i = 0; i < sizeof(src); i++)
+		buf2[i] ^= src[i];
+
+	if (memcmp(buf1, buf2, sizeof(buf1)) != 0 ||
+	    memcmp(iv1, iv2, sizeof(iv1)) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+}
+
 /*
  * Checkup routine
  */
@@ -1147,6 +1554,14 @@ int aes_self_test(int verbose)
 	if (ret != 0)
 		return (ret);
 
+	ret = aes_test_mode_ctr(verbose);
+	if (ret != 0)
+		return (ret);
+
+	ret = aes_test_mode_bulk(verbose);
+	if (ret != 0)
+		return (ret);
+
 	return (0);
 }
 
@@ -0,0 +1,339 @@
+/*
+ *  ARMv8 Cryptography Extensions support functions
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_AESCE)
+
+#include "tropicssl/aesce.h"
+
+#if defined(TROPICSSL_HAVE_ARMV8)
+
+/*
+ * Enable the crypto instructions for this file only; the code
+ * below is only reached after aesce_supports() said so.
+ */
+#if !defined(__ARM_FEATURE_CRYPTO) && !defined(__ARM_FEATURE_AES)
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("aes"))), apply_to = function)
+#define AESCE_POP_TARGET
+#else
+#pragma GCC push_options
+#pragma GCC target ("+crypto")
+#define AESCE_POP_TARGET
+#endif
+#endif
+
+#include <arm_neon.h>
+
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/*
+ * ARMv8 Cryptography Extensions detection routine
+ */
+int aesce_supports(void)
+{
+#if defined(__linux__)
+	static int done = 0;
+	static int aes = 0;
+
+	if (done == 0) {
+		aes = (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+		done = 1;
+	}
+
+	return (aes);
+#elif defined(__APPLE__)
+	/* every 64-bit Apple core has the crypto extensions */
+	return (1);
+#else
+	return (0);
+#endif
+}
+
+static const uint32_t aesce_rcon[10] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36
+};
+
+/*
+ * SubWord() through AESE with an all-zero round key: with the word
+ * replicated in every column, ShiftRows leaves the state unchanged.
+ */
+static uint32_t aesce_sub_word(uint32_t x)
+{
+	uint8x16_t t;
+
+	t = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(x)), vdupq_n_u8(0));
+
+	return (vgetq_lane_u32(vreinterpretq_u32_u8(t), 0));
+}
+
+/*
+ * AES key schedule (encryption)
+ */
+void aesce_setkey_enc(uint32_t *rk, const uint8_t *key, unsigned int keysize)
+{
+	unsigned int i, nk, total;
+	uint32_t t;
+
+	nk = keysize >> 5;
+	total = 4 * (nk + 7);
+
+	for (i = 0; i < nk; i++) {
+		rk[i] = ((uint32_t)key[4 * i]) |
+		    ((uint32_t)key[4 * i + 1] << 8) |
+		    ((uint32_t)key[4 * i + 2] << 16) |
+		    ((uint32_t)key[4 * i + 3] << 24);
+	}
+
+	for (; i < total; i++) {
+		t = rk[i - 1];
+
+		if (i % nk == 0) {
+			t = aesce_sub_word(t);
+			t = ((t >> 8) | (t << 24)) ^ aesce_rcon[i / nk - 1];
+		} else if (nk > 6 && i % nk == 4)
+			t = aesce_sub_word(t);
+
+		rk[i] = rk[i - nk] ^ t;
+	}
+}
+
+/*
+ * AES key schedule (decryption), "equivalent inverse cipher" form
+ */
+void aesce_inverse_key(uint32_t *invkey, const uint32_t *fwdkey,
+		       unsigned int nr)
+{
+	unsigned int i;
+
+	vst1q_u32(invkey, vld1q_u32(fwdkey + 4 * nr));
+
+	for (i = 1; i < nr; i++)
+		vst1q_u8((uint8_t *)(invkey + 4 * i),
+			 vaesimcq_u8(vld1q_u8((const uint8_t *)
+					      (fwdkey + 4 * (nr - i)))));
+
+	vst1q_u32(invkey + 4 * nr, vld1q_u32(fwdkey));
+}
+
+#define AESCE_RK(i) vld1q_u8((const uint8_t *)(ctx->rk + 4 * (i)))
+
+/*
+ * AES-ECB block encryption/decryption
+ */
+void aesce_crypt_ecb(aes_context * ctx, int mode,
+		     const uint8_t input[16], uint8_t output[16])
+{
+	unsigned int i;
+	uint8x16_t b = vld1q_u8(input);
+
+	if (mode == AES_DECRYPT) {
+		for (i = 0; i < ctx->nr - 1; i++)
+			b = vaesimcq_u8(vaesdq_u8(b, AESCE_RK(i)));
+
+		b = vaesdq_u8(b, AESCE_RK(i));
+	} else {
+		for (i = 0; i < ctx->nr - 1; i++)
+			b = vaesmcq_u8(vaeseq_u8(b, AESCE_RK(i)));
+
+		b = vaeseq_u8(b, AESCE_RK(i));
+	}
+
+	vst1q_u8(output, veorq_u8(b, AESCE_RK(ctx->nr)));
+}
+
+/*
+ * AES-CBC buffer encryption/decryption
+ */
+void aesce_crypt_cbc(aes_context * ctx, int mode, size_t length,
+		     uint8_t iv[16], const uint8_t *input, uint8_t *output)
+{
+	unsigned int i, nr = ctx->nr;
+	uint8x16_t k[15];
+	uint8x16_t b, c, v;
+
+	for (i = 0; i <= nr; i++)
+		k[i] = AESCE_RK(i);
+
+	v = vld1q_u8(iv);
+
+	if (mode == AES_DECRYPT) {
+		/*
+		 * Four independent blocks per round keep the AESD/AESIMC
+		 * pipeline busy.
+		 */
+		while (length >= 64) {
+			uint8x16_t c0, c1, c2, c3, b0, b1, b2, b3;
+
+			b0 = c0 = vld1q_u8(input);
+			b1 = c1 = vld1q_u8(input + 16);
+			b2 = c2 = vld1q_u8(input + 32);
+			b3 = c3 = vld1q_u8(input + 48);
+
+			for (i = 0; i < nr - 1; i++) {
+				b0 = vaesimcq_u8(vaesdq_u8(b0, k[i]));
+				b1 = vaesimcq_u8(vaesdq_u8(b1, k[i]));
+				b2 = vaesimcq_u8(vaesdq_u8(b2, k[i]));
+				b3 = vaesimcq_u8(vaesdq_u8(b3, k[i]));
+			}
+
+			b0 = veorq_u8(vaesdq_u8(b0, k[i]), k[nr]);
+			b1 = veorq_u8(vaesdq_u8(b1, k[i]), k[nr]);
+			b2 = veorq_u8(vaesdq_u8(b2, k[i]), k[nr]);
+			b3 = veorq_u8(vaesdq_u8(b3, k[i]), k[nr]);
+
+			vst1q_u8(output, veorq_u8(b0, v));
+			vst1q_u8(output + 16, veorq_u8(b1, c0));
+			vst1q_u8(output + 32, veorq_u8(b2, c1));
+			vst1q_u8(output + 48, veorq_u8(b3, c2));
+			v = c3;
+
+			input += 64;
+			output += 64;
+			length -= 64;
+		}
+
+		while (length > 0) {
+			c = b = vld1q_u8(input);
+
+			for (i = 0; i < nr - 1; i++)
+				b = vaesimcq_u8(vaesdq_u8(b, k[i]));
+
+			b = veorq_u8(vaesdq_u8(b, k[i]), k[nr]);
+			vst1q_u8(output, veorq_u8(b, v));
+			v = c;
+
+			input += 16;
+			output += 16;
+			length -= 16;
+		}
+	} else {
+		while (length > 0) {
+			b = veorq_u8(vld1q_u8(input), v);
+
+			for (i = 0; i < nr - 1; i++)
+				b = vaesmcq_u8(vaeseq_u8(b, k[i]));
+
+			v = veorq_u8(vaeseq_u8(b, k[i]), k[nr]);
+			vst1q_u8(output, v);
+
+			input += 16;
+			output += 16;
+			length -= 16;
+		}
+	}
+
+	vst1q_u8(iv, v);
+}
+
+/*
+ * Load the big-endian 128-bit counter as a vector
+ */
+static uint8x16_t aesce_ctr_block(uint64_t hi, uint64_t lo)
+{
+	uint64x2_t t = vcombine_u64(vcreate_u64(hi), vcreate_u64(lo));
+
+	return (vrev64q_u8(vreinterpretq_u8_u64(t)));
+}
+
+/*
+ * AES-CTR keystream over whole blocks, four counter blocks at a time
+ */
+void aesce_crypt_ctr(aes_context * ctx, size_t nblocks,
+		     uint8_t nonce_counter[16],
+		     const uint8_t *input, uint8_t *output)
+{
+	unsigned int i, j, nr = ctx->nr;
+	uint64_t hi, lo;
+	uint8x16_t k[15];
+	uint8x16_t b[4];
+
+	for (i = 0; i <= nr; i++)
+		k[i] = AESCE_RK(i);
+
+	hi = lo = 0;
+	for (i = 0; i < 8; i++) {
+		hi = (hi << 8) | nonce_counter[i];
+		lo = (lo << 8) | nonce_counter[i + 8];
+	}
+
+	while (nblocks > 0) {
+		size_t n = (nblocks < 4) ? nblocks : 4;
+
+		for (j = 0; j < n; j++) {
+			b[j] = aesce_ctr_block(hi, lo);
+			if (++lo == 0)
+				++hi;
+		}
+
+		for (i = 0; i < nr - 1; i++)
+			for (j = 0; j < n; j++)
+				b[j] = vaesmcq_u8(vaeseq_u8(b[j], k[i]));
+
+		for (j = 0; j < n; j++) {
+			b[j] = veorq_u8(vaeseq_u8(b[j], k[i]), k[nr]);
+
+			if (input != NULL) {
+				b[j] = veorq_u8(b[j], vld1q_u8(input));
+				input += 16;
+			}
+
+			vst1q_u8(output, b[j]);
+			output += 16;
+		}
+
+		nblocks -= n;
+	}
+
+	for (i = 8; i > 0; i--) {
+		nonce_counter[i - 1] = (uint8_t)hi;
+		nonce_counter[i + 7] = (uint8_t)lo;
+		hi >>= 8;
+		lo >>= 8;
+	}
+}
+
+#if defined(AESCE_POP_TARGET)
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+
+#endif
+#endif
@@ -0,0 +1,1004 @@
+/*
+ *  AES-NI support functions
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  The AES-NI instruction set was introduced by Intel in 2008.
+ *
+ *  http://software.intel.com/en-us/articles/intel-advanced-encryption-standard-aes-instructions-set/
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_AESNI)
+
+#include "tropicssl/aesni.h"
+
+#if defined(TROPICSSL_HAVE_X86_64)
+
+#include <cpuid.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+/*
+ * The AES-NI code paths are compiled for the instructions they use,
+ * so that the rest of the library does not need -maes; they are only
+ * ever reached after aesni_supports() said so.
+ */
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+
+#define AESNI_LOAD(p)       _mm_loadu_si128((const __m128i *)(p))
+#define AESNI_STORE(p,x)    _mm_storeu_si128((__m128i *)(p), (x))
+
+/*
+ * One round applied to the eight blocks b0..b7
+ */
+#define AESNI_ROUND8(f,k)           \
+{                                   \
+    b0 = f(b0, k);                  \
+    b1 = f(b1, k);                  \
+    b2 = f(b2, k);                  \
+    b3 = f(b3, k);                  \
+    b4 = f(b4, k);                  \
+    b5 = f(b5, k);                  \
+    b6 = f(b6, k);                  \
+    b7 = f(b7, k);                  \
+}
+
+/*
+ * AES-NI support detection routine
+ */
+int aesni_supports(unsigned int what)
+{
+	static int done = 0;
+	static unsigned int c = 0;
+
+	if (done == 0) {
+		unsigned int a, b, d;
+
+		if (__get_cpuid(1, &a, &b, &c, &d) == 0)
+			c = 0;
+
+		done = 1;
+	}
+
+	return ((c & what) != 0);
+}
+
+static const uint32_t aesni_rcon[10] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36
+};
+
+/*
+ * SubWord() and SubWord( RotWord() ) of a single key schedule word,
+ * taken from AESKEYGENASSIST so that no lookup table is involved.
+ */
+AESNI_TARGET static uint32_t aesni_sub_word(uint32_t x, int rotate)
+{
+	__m128i t;
+
+	t = _mm_aeskeygenassist_si128(_mm_set_epi32(0, 0, (int)x, 0), 0);
+
+	if (rotate != 0)
+		t = _mm_srli_si128(t, 4);
+
+	return ((uint32_t)_mm_cvtsi128_si32(t));
+}
+
+/*
+ * AES key schedule (encryption)
+ */
+void aesni_setkey_enc(uint32_t *rk, const uint8_t *key, unsigned int keysize)
+{
+	unsigned int i, nk, total;
+	uint32_t t;
+
+	nk = keysize >> 5;
+	total = 4 * (nk + 7);
+
+	for (i = 0; i < nk; i++) {
+		rk[i] = ((uint32_t)key[4 * i]) |
+		    ((uint32_t)key[4 * i + 1] << 8) |
+		    ((uint32_t)key[4 * i + 2] << 16) |
+		    ((uint32_t)key[4 * i + 3] << 24);
+	}
+
+	for (; i < total; i++) {
+		t = rk[i - 1];
+
+		if (i % nk == 0)
+			t = aesni_sub_word(t, 1) ^ aesni_rcon[i / nk - 1];
+		else if (nk > 6 && i % nk == 4)
+			t = aesni_sub_word(t, 0);
+
+		rk[i] = rk[i - nk] ^ t;
+	}
+}
+
+/*
+ * AES key schedule (decryption), "equivalent inverse cipher" form
+ */
+AESNI_TARGET void aesni_inverse_key(uint32_t *invkey, const uint32_t *fwdkey,
+				    unsigned int nr)
+{
+	unsigned int i;
+
+	AESNI_STORE(invkey, AESNI_LOAD(fwdkey + 4 * nr));
+
+	for (i = 1; i < nr; i++)
+		AESNI_STORE(invkey + 4 * i,
+			    _mm_aesimc_si128(AESNI_LOAD(fwdkey + 4 * (nr - i))));
+
+	AESNI_STORE(invkey + 4 * nr, AESNI_LOAD(fwdkey));
+}
+
+/*
+ * AES-ECB block encryption/decryption
+ */
+AESNI_TARGET void aesni_crypt_ecb(aes_context * ctx, int mode,
+				  const uint8_t input[16], uint8_t output[16])
+{
+	unsigned int i;
+	const uint32_t *rk = ctx->rk;
+	__m128i b;
+
+	b = _mm_xor_si128(AESNI_LOAD(input), AESNI_LOAD(rk));
+
+	if (mode == AES_DECRYPT) {
+		for (i = 1; i < ctx->nr; i++)
+			b = _mm_aesdec_si128(b, AESNI_LOAD(rk + 4 * i));
+
+		b = _mm_aesdeclast_si128(b, AESNI_LOAD(rk + 4 * i));
+	} else {
+		for (i = 1; i < ctx->nr; i++)
+			b = _mm_aesenc_si128(b, AESNI_LOAD(rk + 4 * i));
+
+		b = _mm_aesenclast_si128(b, AESNI_LOAD(rk + 4 * i));
+	}
+
+	AESNI_STORE(output, b);
+}
+
+/*
+ * AES-CBC buffer encryption/decryption
+ */
+AESNI_TARGET void aesni_crypt_cbc(aes_context * ctx, int mode, size_t length,
+				  uint8_t iv[16],
+				  const uint8_t *input, uint8_t *output)
+{
+	unsigned int i, nr = ctx->nr;
+	__m128i k[15];
+	__m128i b, c, v;
+
+	for (i = 0; i <= nr; i++)
+		k[i] = AESNI_LOAD(ctx->rk + 4 * i);
+
+	v = AESNI_LOAD(iv);
+
+	if (mode == AES_DECRYPT) {
+		/*
+		 * CBC decryption has no dependency between blocks: run eight
+		 * of them through each round so that the AESDEC latency is
+		 * hidden behind the others.
+		 */
+		while (length >= 128) {
+			__m128i c0, c1, c2, c3, c4, c5, c6, c7;
+			__m128i b0, b1, b2, b3, b4, b5, b6, b7;
+
+			c0 = AESNI_LOAD(input);
+			c1 = AESNI_LOAD(input + 16);
+			c2 = AESNI_LOAD(input + 32);
+			c3 = AESNI_LOAD(input + 48);
+			c4 = AESNI_LOAD(input + 64);
+			c5 = AESNI_LOAD(input + 80);
+			c6 = AESNI_LOAD(input + 96);
+			c7 = AESNI_LOAD(input + 112);
+
+			b0 = _mm_xor_si128(c0, k[0]);
+			b1 = _mm_xor_si128(c1, k[0]);
+			b2 = _mm_xor_si128(c2, k[0]);
+			b3 = _mm_xor_si128(c3, k[0]);
+			b4 = _mm_xor_si128(c4, k[0]);
+			b5 = _mm_xor_si128(c5, k[0]);
+			b6 = _mm_xor_si128(c6, k[0]);
+			b7 = _mm_xor_si128(c7, k[0]);
+
+			for (i = 1; i < nr; i++)
+				AESNI_ROUND8(_mm_aesdec_si128, k[i]);
+
+			AESNI_ROUND8(_mm_aesdeclast_si128, k[nr]);
+
+			AESNI_STORE(output, _mm_xor_si128(b0, v));
+			AESNI_STORE(output + 16, _mm_xor_si128(b1, c0));
+			AESNI_STORE(output + 32, _mm_xor_si128(b2, c1));
+			AESNI_STORE(output + 48, _mm_xor_si128(b3, c2));
+			AESNI_STORE(output + 64, _mm_xor_si128(b4, c3));
+			AESNI_STORE(output + 80, _mm_xor_si128(b5, c4));
+			AESNI_STORE(output + 96, _mm_xor_si128(b6, c5));
+			AESNI_STORE(output + 112, _mm_xor_si128(b7, c6));
+			v = c7;
+
+			input += 128;
+			output += 128;
+			length -= 128;
+		}
+
+		while (length > 0) {
+			c = AESNI_LOAD(input);
+			b = _mm_xor_si128(c, k[0]);
+
+			for (i = 1; i < nr; i++)
+				b = _mm_aesdec_si128(b, k[i]);
+
+			b = _mm_aesdeclast_si128(b, k[nr]);
+			AESNI_STORE(output, _mm_xor_si128(b, v));
+			v = c;
+
+			input += 16;
+			output += 16;
+			length -= 16;
+		}
+	} else {
+		while (length > 0) {
+			b = _mm_xor_si128(AESNI_LOAD(input), v);
+			b = _mm_xor_si128(b, k[0]);
+
+			for (i = 1; i < nr; i++)
+				b = _mm_aesenc_si128(b, k[i]);
+
+			v = _mm_aesenclast_si128(b, k[nr]);
+			AESNI_STORE(output, v);
+
+			input += 16;
+			output += 16;
+			length -= 16;
+		}
+	}
+
+	AESNI_STORE(iv, v);
+}
+
+/*
+ * Big-endian 128-bit counter, kept as two native halves
+ */
+#define AESNI_CTR_BLOCK(hi,lo)                              \
+    _mm_set_epi64x((long long)__builtin_bswap64(lo),        \
+                   (long long)__builtin_bswap64(hi))
+
+#define AESNI_CTR_INC(hi,lo)    { if (++(lo) == 0) ++(hi); }
+
+/*
+ * AES-CTR keystream over whole blocks, eight counter blocks at a time
+ */
+AESNI_TARGET void aesni_crypt_ctr(aes_context * ctx, size_t nblocks,
+				  uint8_t nonce_counter[16],
+				  const uint8_t *input, uint8_t *output)
+{
+	unsigned int i, nr = ctx->nr;
+	uint64_t hi, lo;
+	__m128i k[15];
+	__m128i b0, b1, b2, b3, b4, b5, b6, b7;
+
+	for (i = 0; i <= nr; i++)
+		k[i] = AESNI_LOAD(ctx->rk + 4 * i);
+
+	hi = lo = 0;
+	for (i = 0; i < 8; i++) {
+		hi = (hi << 8) | nonce_counter[i];
+		lo = (lo << 8) | nonce_counter[i + 8];
+	}
+
+	while (nblocks >= 8) {
+		b0 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+		b1 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+		b2 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+		b3 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+		b4 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+		b5 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+		b6 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+		b7 = AESNI_CTR_BLOCK(hi, lo);
+		AESNI_CTR_INC(hi, lo);
+
+		AESNI_ROUND8(_mm_xor_si128, k[0]);
+
+		for (i = 1; i < nr; i++)
+			AESNI_ROUND8(_mm_aesenc_si128, k[i]);
+
+		AESNI_ROUND8(_mm_aesenclast_si128, k[nr]);
+
+		if (input != NULL) {
+			b0 = _mm_xor_si128(b0, AESNI_LOAD(input));
+			b1 = _mm_xor_si128(b1, AESNI_LOAD(input + 16));
+			b2 = _mm_xor_si128(b2, AESNI_LOAD(input + 32));
+			b3 = _mm_xor_si128(b3, AESNI_LOAD(input + 48));
+			b4 = _mm_xor_si128(b4, AESNI_LOAD(input + 64));
+			b5 = _mm_xor_si128(b5, AESNI_LOAD(input + 80));
+			b6 = _mm_xor_si128(b6, AESNI_LOAD(input + 96));
+			b7 = _mm_xor_si128(b7, AESNI_LOAD(input + 112));
+			input += 128;
+		}
+
+		AESNI_STORE(output, b0);
+		AESNI_STORE(output + 16, b1);
+		AESNI_STORE(output + 32, b2);
+		AESNI_STORE(output + 48, b3);
+		AESNI_STORE(output + 64, b4);
+		AESNI_STORE(output + 80, b5);
+		AESNI_STORE(output + 96, b6);
+		AESNI_STORE(output + 112, b7);
+
+		output += 128;
+		nblocks -= 8;
+	}
+
+	while (nblocks > 0) {
+		b0 = _mm_xor_si128(AESNI_CTR_BLOCK(hi, lo), k[0]);
+		AESNI_CTR_INC(hi, lo);
+
+		for (i = 1; i < nr; i++)
+			b0 = _mm_aesenc_si128(b0, k[i]);
+
+		b0 = _mm_aesenclast_si128(b0, k[nr]);
+
+		if (input != NULL) {
+			b0 = _mm_xor_si128(b0, AESNI_LOAD(input));
+			input += 16;
+		}
+
+		AESNI_STORE(output, b0);
+		output += 16;
+		nblocks--;
+	}
+
+	for (i = 8; i > 0; i--) {
+		nonce_counter[i - 1] = (uint8_t)hi;
+		nonce_counter[i + 7] = (uint8_t)lo;
+		hi >>= 8;
+		lo >>= 8;
+	}
+}
+
+#if defined(TROPICSSL_SHA1)
+/*
+ * Stitched HMAC-SHA1 + AES-CBC, after Gopal et al., "Fast Cryptographic
+ * Computation on Intel Architecture Processors via Function Stitching".
+ *
+ * CBC encryption is latency bound on the AESENC chain while SHA-1 is
+ * bound on the integer ALUs; issuing both from one loop lets them run
+ * in each other's shadow. Each iteration hashes one 64-byte block and
+ * runs four AES blocks, interleaving five SHA-1 rounds with a few AES
+ * rounds.
+ */
+#define SHA1_S(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define SHA1_W(t)                                                       \
+    (W[(t) & 15] = SHA1_S(W[((t) - 3) & 15] ^ W[((t) - 8) & 15] ^      \
+                          W[((t) - 14) & 15] ^ W[(t) & 15], 1))
+
+#define SHA1_X(t) ((t) < 16 ? W[(t) & 15] : SHA1_W(t))
+
+#define SHA1_F1(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA1_F2(x,y,z) ((x) ^ (y) ^ (z))
+#define SHA1_F3(x,y,z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+#define SHA1_P(a,b,c,d,e,x,F,K)                                         \
+    {                                                                   \
+        e += SHA1_S(a, 5) + F(b, c, d) + K + (x);                       \
+        b = SHA1_S(b, 30);                                              \
+    }
+
+#define SHA1_R5(t,F,K)                                                  \
+    SHA1_P(A, B, C, D, E, SHA1_X(t), F, K);                             \
+    SHA1_P(E, A, B, C, D, SHA1_X((t) + 1), F, K);                       \
+    SHA1_P(D, E, A, B, C, SHA1_X((t) + 2), F, K);                       \
+    SHA1_P(C, D, E, A, B, SHA1_X((t) + 3), F, K);                       \
+    SHA1_P(B, C, D, E, A, SHA1_X((t) + 4), F, K)
+
+#define AESNI_STITCH_ROUNDS(f, n)                                       \
+    for (s = 0; s < (n) && j < nr; s++, j++)                            \
+        b = f(b, k[j])
+
+/*
+ * Twenty SHA-1 rounds around one AES block
+ */
+#define AESNI_SHA1_QUARTER(q, F, K, f)                                  \
+    {                                                                   \
+        j = 1;                                                          \
+        SHA1_R5(20 * (q), F, K);                                        \
+        AESNI_STITCH_ROUNDS(f, 3);                                      \
+        SHA1_R5(20 * (q) + 5, F, K);                                    \
+        AESNI_STITCH_ROUNDS(f, 3);                                      \
+        SHA1_R5(20 * (q) + 10, F, K);                                   \
+        AESNI_STITCH_ROUNDS(f, 3);                                      \
+        SHA1_R5(20 * (q) + 15, F, K);                                   \
+        AESNI_STITCH_ROUNDS(f, nr);                                     \
+    }
+
+#define AESNI_SHA1_ENC_QUARTER(q, F, K)                                 \
+    {                                                                   \
+        b = _mm_xor_si128(_mm_xor_si128(AESNI_LOAD(aes_buf + 16 * (q)), \
+                                        v), k[0]);                      \
+        AESNI_SHA1_QUARTER(q, F, K, _mm_aesenc_si128);                  \
+        v = _mm_aesenclast_si128(b, k[nr]);                             \
+        AESNI_STORE(aes_buf + 16 * (q), v);                             \
+    }
+
+#define AESNI_SHA1_DEC_QUARTER(q, F, K)                                 \
+    {                                                                   \
+        c = AESNI_LOAD(aes_buf + 16 * (q));                             \
+        b = _mm_xor_si128(c, k[0]);                                     \
+        AESNI_SHA1_QUARTER(q, F, K, _mm_aesdec_si128);                  \
+        b = _mm_aesdeclast_si128(b, k[nr]);                             \
+        AESNI_STORE(aes_buf + 16 * (q), _mm_xor_si128(b, v));           \
+        v = c;                                                          \
+    }
+
+static void aesni_sha1_load(uint32_t W[16], const uint8_t *data)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		W[i] = ((uint32_t) data[4 * i] << 24) |
+		    ((uint32_t) data[4 * i + 1] << 16) |
+		    ((uint32_t) data[4 * i + 2] << 8) |
+		    ((uint32_t) data[4 * i + 3]);
+}
+
+static void aesni_sha1_count(sha1_context * sha1)
+{
+	sha1->total[0] += 64;
+	if (sha1->total[0] < 64)
+		sha1->total[1]++;
+}
+
+/*
+ * Stitched SHA-1 update and in-place AES-CBC encryption
+ */
+AESNI_TARGET void aesni_cbc_sha1_enc(aes_context * ctx, uint8_t iv[16],
+				     sha1_context * sha1,
+				     const uint8_t *hash_in, uint8_t *aes_buf,
+				     size_t nblocks)
+{
+	unsigned int j, s, nr = ctx->nr;
+	uint32_t W[16], A, B, C, D, E;
+	__m128i k[15];
+	__m128i b, v;
+
+	for (j = 0; j <= nr; j++)
+		k[j] = AESNI_LOAD(ctx->rk + 4 * j);
+
+	v = AESNI_LOAD(iv);
+
+	while (nblocks > 0) {
+		/*
+		 * The hash input may overlap the blocks encrypted below
+		 */
+		aesni_sha1_load(W, hash_in);
+
+		A = sha1->state[0];
+		B = sha1->state[1];
+		C = sha1->state[2];
+		D = sha1->state[3];
+		E = sha1->state[4];
+
+		AESNI_SHA1_ENC_QUARTER(0, SHA1_F1, 0x5A827999);
+		AESNI_SHA1_ENC_QUARTER(1, SHA1_F2, 0x6ED9EBA1);
+		AESNI_SHA1_ENC_QUARTER(2, SHA1_F3, 0x8F1BBCDC);
+		AESNI_SHA1_ENC_QUARTER(3, SHA1_F2, 0xCA62C1D6);
+
+		sha1->state[0] += A;
+		sha1->state[1] += B;
+		sha1->state[2] += C;
+		sha1->state[3] += D;
+		sha1->state[4] += E;
+		aesni_sha1_count(sha1);
+
+		hash_in += 64;
+		aes_buf += 64;
+		nblocks--;
+	}
+
+	AESNI_STORE(iv, v);
+	memset(W, 0, sizeof(W));
+}
+
+/*
+ * Stitched SHA-1 update and in-place AES-CBC decryption
+ */
+AESNI_TARGET void aesni_cbc_sha1_dec(aes_context * ctx, uint8_t iv[16],
+				     sha1_context * sha1,
+				     const uint8_t *hash_in, uint8_t *aes_buf,
+				     size_t nblocks)
+{
+	unsigned int j, s, nr = ctx->nr;
+	uint32_t W[16], A, B, C, D, E;
+	__m128i k[15];
+	__m128i b, c, v;
+
+	for (j = 0; j <= nr; j++)
+		k[j] = AESNI_LOAD(ctx->rk + 4 * j);
+
+	v = AESNI_LOAD(iv);
+
+	while (nblocks > 0) {
+		aesni_sha1_load(W, hash_in);
+
+		A = sha1->state[0];
+		B = sha1->state[1];
+		C = sha1->state[2];
+		D = sha1->state[3];
+		E = sha1->state[4];
+
+		AESNI_SHA1_DEC_QUARTER(0, SHA1_F1, 0x5A827999);
+		AESNI_SHA1_DEC_QUARTER(1, SHA1_F2, 0x6ED9EBA1);
+		AESNI_SHA1_DEC_QUARTER(2, SHA1_F3, 0x8F1BBCDC);
+		AESNI_SHA1_DEC_QUARTER(3, SHA1_F2, 0xCA62C1D6);
+
+		sha1->state[0] += A;
+		sha1->state[1] += B;
+		sha1->state[2] += C;
+		sha1->state[3] += D;
+		sha1->state[4] += E;
+		aesni_sha1_count(sha1);
+
+		hash_in += 64;
+		aes_buf += 64;
+		nblocks--;
+	}
+
+	AESNI_STORE(iv, v);
+	memset(W, 0, sizeof(W));
+}
+#endif
+
+#if defined(TROPICSSL_CAMELLIA)
+/*
+ * Camellia, sixteen blocks at a time
+ *
+ * The blocks are byte-sliced: x[j] holds byte j of all sixteen blocks,
+ * so each S-box is applied to one register. The Camellia s1 is affine
+ * equivalent to inversion in GF(2^8), as is the AES S-box, which gives
+ * s1(x) = post(SubBytes(pre(x))) for two affine maps pre and post; each
+ * is two 4-bit PSHUFB lookups. AESENCLAST with a zero round key does
+ * the SubBytes, and its ShiftRows, which here moves bytes between
+ * blocks, is undone by one more PSHUFB. s2 and s3 rotate the output of
+ * s1, and s4 its input; the rotations are folded into the tables.
+ */
+#define AESNI_CAMELLIA_TARGET __attribute__((target("aes,ssse3,sse2")))
+
+static const uint8_t aesni_camellia_tables[11][16] = {
+	/* pre, s1 to s3: low and high nibble */
+	{0x08, 0x09, 0x11, 0x10, 0xB9, 0xB8, 0xA0, 0xA1,
+	 0xA3, 0xA2, 0xBA, 0xBB, 0x12, 0x13, 0x0B, 0x0A},
+	{0x00, 0xA7, 0x93, 0x34, 0x61, 0xC6, 0xF2, 0x55,
+	 0xD9, 0x7E, 0x4A, 0xED, 0xB8, 0x1F, 0x2B, 0x8C},
+	/* pre, s4 */
+	{0x08, 0x11, 0xB9, 0xA0, 0xA3, 0xBA, 0x12, 0x0B,
+	 0xAF, 0xB6, 0x1E, 0x07, 0x04, 0x1D, 0xB5, 0xAC},
+	{0x00, 0x93, 0x61, 0xF2, 0xD9, 0x4A, 0xB8, 0x2B,
+	 0x01, 0x92, 0x60, 0xF3, 0xD8, 0x4B, 0xB9, 0x2A},
+	/* post, s1 and s4 */
+	{0x11, 0x82, 0x84, 0x17, 0x3E, 0xAD, 0xAB, 0x38,
+	 0x71, 0xE2, 0xE4, 0x77, 0x5E, 0xCD, 0xCB, 0x58},
+	{0x00, 0xB8, 0xD9, 0x61, 0xA0, 0x18, 0x79, 0xC1,
+	 0xA8, 0x10, 0x71, 0xC9, 0x08, 0xB0, 0xD1, 0x69},
+	/* post, s2 */
+	{0x22, 0x05, 0x09, 0x2E, 0x7C, 0x5B, 0x57, 0x70,
+	 0xE2, 0xC5, 0xC9, 0xEE, 0xBC, 0x9B, 0x97, 0xB0},
+	{0x00, 0x71, 0xB3, 0xC2, 0x41, 0x30, 0xF2, 0x83,
+	 0x51, 0x20, 0xE2, 0x93, 0x10, 0x61, 0xA3, 0xD2},
+	/* post, s3 */
+	{0x88, 0x41, 0x42, 0x8B, 0x1F, 0xD6, 0xD5, 0x1C,
+	 0xB8, 0x71, 0x72, 0xBB, 0x2F, 0xE6, 0xE5, 0x2C},
+	{0x00, 0x5C, 0xEC, 0xB0, 0x50, 0x0C, 0xBC, 0xE0,
+	 0x54, 0x08, 0xB8, 0xE4, 0x04, 0x58, 0xE8, 0xB4},
+	/* inverse ShiftRows */
+	{0x00, 0x0D, 0x0A, 0x07, 0x04, 0x01, 0x0E, 0x0B,
+	 0x08, 0x05, 0x02, 0x0F, 0x0C, 0x09, 0x06, 0x03}
+};
+
+#define CAM_PRE1        0
+#define CAM_PRE4        2
+#define CAM_POST1       4
+#define CAM_POST2       6
+#define CAM_POST3       8
+#define CAM_INVSR       10
+
+AESNI_CAMELLIA_TARGET
+static inline __m128i aesni_camellia_lut(__m128i x, const __m128i *t)
+{
+	__m128i m = _mm_set1_epi8(0x0F);
+
+	return (_mm_xor_si128(_mm_shuffle_epi8(t[0], _mm_and_si128(x, m)),
+			      _mm_shuffle_epi8(t[1], _mm_and_si128(
+					_mm_srli_epi16(x, 4), m))));
+}
+
+AESNI_CAMELLIA_TARGET
+static inline __m128i aesni_camellia_sbox(__m128i x, const __m128i *t,
+					  int pre, int post)
+{
+	x = aesni_camellia_lut(x, t + pre);
+	x = _mm_aesenclast_si128(x, _mm_setzero_si128());
+	x = _mm_shuffle_epi8(x, t[CAM_INVSR]);
+
+	return (aesni_camellia_lut(x, t + post));
+}
+
+/*
+ * z ^= F(x, k) on byte-sliced halves, as camellia_feistel()
+ */
+AESNI_CAMELLIA_TARGET
+static inline void aesni_camellia_f(const __m128i x[8], const __m128i k[8],
+				    __m128i z[8], const __m128i *t)
+{
+	__m128i y0, y1, y2, y3, y4, y5, y6, y7;
+
+	y0 = aesni_camellia_sbox(_mm_xor_si128(x[0], k[0]), t,
+				 CAM_PRE1, CAM_POST1);
+	y1 = aesni_camellia_sbox(_mm_xor_si128(x[1], k[1]), t,
+				 CAM_PRE1, CAM_POST2);
+	y2 = aesni_camellia_sbox(_mm_xor_si128(x[2], k[2]), t,
+				 CAM_PRE1, CAM_POST3);
+	y3 = aesni_camellia_sbox(_mm_xor_si128(x[3], k[3]), t,
+				 CAM_PRE4, CAM_POST1);
+	y4 = aesni_camellia_sbox(_mm_xor_si128(x[4], k[4]), t,
+				 CAM_PRE1, CAM_POST2);
+	y5 = aesni_camellia_sbox(_mm_xor_si128(x[5], k[5]), t,
+				 CAM_PRE1, CAM_POST3);
+	y6 = aesni_camellia_sbox(_mm_xor_si128(x[6], k[6]), t,
+				 CAM_PRE4, CAM_POST1);
+	y7 = aesni_camellia_sbox(_mm_xor_si128(x[7], k[7]), t,
+				 CAM_PRE1, CAM_POST1);
+
+	/* P-function */
+	y0 = _mm_xor_si128(y0, y5);
+	y1 = _mm_xor_si128(y1, y6);
+	y2 = _mm_xor_si128(y2, y7);
+	y3 = _mm_xor_si128(y3, y4);
+	y4 = _mm_xor_si128(y4, y2);
+	y5 = _mm_xor_si128(y5, y3);
+	y6 = _mm_xor_si128(y6, y0);
+	y7 = _mm_xor_si128(y7, y1);
+	y0 = _mm_xor_si128(y0, y7);
+	y1 = _mm_xor_si128(y1, y4);
+	y2 = _mm_xor_si128(y2, y5);
+	y3 = _mm_xor_si128(y3, y6);
+	y4 = _mm_xor_si128(y4, y3);
+	y5 = _mm_xor_si128(y5, y0);
+	y6 = _mm_xor_si128(y6, y1);
+	y7 = _mm_xor_si128(y7, y2);
+
+	z[0] = _mm_xor_si128(z[0], y4);
+	z[1] = _mm_xor_si128(z[1], y5);
+	z[2] = _mm_xor_si128(z[2], y6);
+	z[3] = _mm_xor_si128(z[3], y7);
+	z[4] = _mm_xor_si128(z[4], y0);
+	z[5] = _mm_xor_si128(z[5], y1);
+	z[6] = _mm_xor_si128(z[6], y2);
+	z[7] = _mm_xor_si128(z[7], y3);
+}
+
+/*
+ * Byte-sliced 32-bit l = rotl(l & kl, 1) ^ r, as in FL / FLInv
+ */
+AESNI_CAMELLIA_TARGET
+static inline void aesni_camellia_fl_rot(const __m128i a[4],
+					 const __m128i k[4], __m128i r[4])
+{
+	int i;
+	__m128i t[4], one = _mm_set1_epi8(0x01);
+
+	for (i = 0; i < 4; i++)
+		t[i] = _mm_and_si128(a[i], k[i]);
+
+	for (i = 0; i < 4; i++)
+		r[i] = _mm_xor_si128(r[i], _mm_or_si128(
+			_mm_add_epi8(t[i], t[i]),
+			_mm_and_si128(_mm_srli_epi16(t[(i + 1) & 3], 7), one)));
+}
+
+AESNI_CAMELLIA_TARGET
+static inline void aesni_camellia_fl_or(const __m128i a[4],
+					const __m128i k[4], __m128i r[4])
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		r[i] = _mm_xor_si128(r[i], _mm_or_si128(a[i], k[i]));
+}
+
+/*
+ * 16x16 byte transpose: byte j of x[i] <-> byte i of x[j]
+ */
+AESNI_CAMELLIA_TARGET static inline void aesni_transpose16(__m128i x[16])
+{
+	int i, r;
+	__m128i t[16];
+
+	for (r = 0; r < 4; r++) {
+		for (i = 0; i < 8; i++) {
+			t[2 * i] = _mm_unpacklo_epi8(x[i], x[i + 8]);
+			t[2 * i + 1] = _mm_unpackhi_epi8(x[i], x[i + 8]);
+		}
+
+		for (i = 0; i < 16; i++)
+			x[i] = t[i];
+	}
+}
+
+/*
+ * Camellia-ECB on sixteen blocks, as camellia_crypt_ecb()
+ */
+AESNI_CAMELLIA_TARGET
+static void aesni_camellia_ecb16(const __m128i *k, int nr, const __m128i *t,
+				 __m128i s[16])
+{
+	int i;
+
+	aesni_transpose16(s);
+
+	for (i = 0; i < 16; i++)
+		s[i] = _mm_xor_si128(s[i], *k++);
+
+	while (nr) {
+		--nr;
+
+		for (i = 0; i < 3; i++) {
+			aesni_camellia_f(s, k, s + 8, t);
+			aesni_camellia_f(s + 8, k + 8, s, t);
+			k += 16;
+		}
+
+		if (nr) {
+			aesni_camellia_fl_rot(s, k, s + 4);
+			aesni_camellia_fl_or(s + 4, k + 4, s);
+			aesni_camellia_fl_or(s + 12, k + 12, s + 8);
+			aesni_camellia_fl_rot(s + 8, k + 8, s + 12);
+			k += 16;
+		}
+	}
+
+	for (i = 0; i < 8; i++) {
+		s[i + 8] = _mm_xor_si128(s[i + 8], k[i]);
+		s[i] = _mm_xor_si128(s[i], k[i + 8]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		__m128i u = s[i];
+
+		s[i] = s[i + 8];
+		s[i + 8] = u;
+	}
+
+	aesni_transpose16(s);
+}
+
+/*
+ * Camellia-CBC decryption of groups of sixteen blocks
+ */
+AESNI_CAMELLIA_TARGET void aesni_camellia_cbc_dec(camellia_context * ctx,
+						  size_t length,
+						  uint8_t iv[16],
+						  const uint8_t *input,
+						  uint8_t *output)
+{
+	int i, j, nk = 16 * ctx->nr + 4;
+	__m128i t[11], k[68 * 4], s[16], v;
+
+	for (i = 0; i < 11; i++)
+		t[i] = AESNI_LOAD(aesni_camellia_tables[i]);
+
+	for (i = 0; i < nk; i++)
+		for (j = 0; j < 4; j++)
+			k[4 * i + j] = _mm_set1_epi8((char)
+				(ctx->rk[i] >> (24 - 8 * j)));
+
+	while (length >= 256) {
+		for (i = 0; i < 16; i++)
+			s[i] = AESNI_LOAD(input + 16 * i);
+
+		aesni_camellia_ecb16(k, ctx->nr, t, s);
+
+		/*
+		 * From the last block down, so that output may be input
+		 */
+		v = AESNI_LOAD(input + 240);
+
+		for (i = 15; i > 0; i--)
+			AESNI_STORE(output + 16 * i, _mm_xor_si128(s[i],
+					AESNI_LOAD(input + 16 * i - 16)));
+
+		AESNI_STORE(output, _mm_xor_si128(s[0], AESNI_LOAD(iv)));
+		AESNI_STORE(iv, v);
+
+		input += 256;
+		output += 256;
+		length -= 256;
+	}
+}
+#endif
+
+
+/*
+ * GHASH with PCLMULQDQ, following the Intel white paper "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing
+ * the GCM Mode". Operands are kept byte-reflected so that the GCM
+ * bit order maps onto the instruction; four blocks are multiplied by
+ * H^4..H^1 and reduced once.
+ */
+#define AESNI_CLMUL_TARGET __attribute__((target("pclmul,ssse3,sse2")))
+
+#define AESNI_BSWAP(x)                                                  \
+    _mm_shuffle_epi8((x), _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,          \
+                                       8, 9, 10, 11, 12, 13, 14, 15))
+
+/*
+ * Accumulate the unreduced 256-bit product a * b into lo/mid/hi
+ */
+#define AESNI_CLMUL_ACC(a, b)                                           \
+    do {                                                                \
+        lo = _mm_xor_si128(lo, _mm_clmulepi64_si128((a), (b), 0x00));   \
+        hi = _mm_xor_si128(hi, _mm_clmulepi64_si128((a), (b), 0x11));   \
+        mid = _mm_xor_si128(mid, _mm_clmulepi64_si128((a), (b), 0x01)); \
+        mid = _mm_xor_si128(mid, _mm_clmulepi64_si128((a), (b), 0x10)); \
+    } while (0)
+
+/*
+ * Shift the 256-bit product left by one bit and reduce it modulo
+ * x^128 + x^7 + x^2 + x + 1
+ */
+AESNI_CLMUL_TARGET static __m128i aesni_gf_reduce(__m128i lo, __m128i mid,
+						  __m128i hi)
+{
+	__m128i t1, t2, t3;
+
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	t1 = _mm_srli_epi32(lo, 31);
+	t2 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+
+	t3 = _mm_srli_si128(t1, 12);
+	t2 = _mm_slli_si128(t2, 4);
+	t1 = _mm_slli_si128(t1, 4);
+	lo = _mm_or_si128(lo, t1);
+	hi = _mm_or_si128(hi, t2);
+	hi = _mm_or_si128(hi, t3);
+
+	t1 = _mm_slli_epi32(lo, 31);
+	t2 = _mm_slli_epi32(lo, 30);
+	t3 = _mm_slli_epi32(lo, 25);
+	t1 = _mm_xor_si128(t1, t2);
+	t1 = _mm_xor_si128(t1, t3);
+	t2 = _mm_srli_si128(t1, 4);
+	t1 = _mm_slli_si128(t1, 12);
+	lo = _mm_xor_si128(lo, t1);
+
+	t3 = _mm_srli_epi32(lo, 1);
+	t1 = _mm_srli_epi32(lo, 2);
+	t3 = _mm_xor_si128(t3, t1);
+	t1 = _mm_srli_epi32(lo, 7);
+	t3 = _mm_xor_si128(t3, t1);
+	t3 = _mm_xor_si128(t3, t2);
+	lo = _mm_xor_si128(lo, t3);
+
+	return (_mm_xor_si128(hi, lo));
+}
+
+AESNI_CLMUL_TARGET static __m128i aesni_gf_mul(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i mid = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+
+	AESNI_CLMUL_ACC(a, b);
+
+	return (aesni_gf_reduce(lo, mid, hi));
+}
+
+/*
+ * Precompute H^1..H^4 (byte-reflected)
+ */
+AESNI_CLMUL_TARGET void aesni_gcm_powers(uint8_t hp[64], const uint8_t h[16])
+{
+	__m128i h1, h2, h3, h4;
+
+	h1 = AESNI_BSWAP(AESNI_LOAD(h));
+	h2 = aesni_gf_mul(h1, h1);
+	h3 = aesni_gf_mul(h2, h1);
+	h4 = aesni_gf_mul(h3, h1);
+
+	AESNI_STORE(hp, h1);
+	AESNI_STORE(hp + 16, h2);
+	AESNI_STORE(hp + 32, h3);
+	AESNI_STORE(hp + 48, h4);
+}
+
+/*
+ * GHASH update: y = (y ^ X1) * H, ... over nblocks of data
+ */
+AESNI_CLMUL_TARGET void aesni_ghash(uint8_t y[16], const uint8_t hp[64],
+				    const uint8_t *data, size_t nblocks)
+{
+	__m128i lo, mid, hi, x0, x1, x2, x3;
+	__m128i h1, h2, h3, h4, acc;
+
+	h1 = AESNI_LOAD(hp);
+	h2 = AESNI_LOAD(hp + 16);
+	h3 = AESNI_LOAD(hp + 32);
+	h4 = AESNI_LOAD(hp + 48);
+
+	acc = AESNI_BSWAP(AESNI_LOAD(y));
+
+	while (nblocks >= 4) {
+		x0 = _mm_xor_si128(AESNI_BSWAP(AESNI_LOAD(data)), acc);
+		x1 = AESNI_BSWAP(AESNI_LOAD(data + 16));
+		x2 = AESNI_BSWAP(AESNI_LOAD(data + 32));
+		x3 = AESNI_BSWAP(AESNI_LOAD(data + 48));
+
+		lo = mid = hi = _mm_setzero_si128();
+
+		AESNI_CLMUL_ACC(x0, h4);
+		AESNI_CLMUL_ACC(x1, h3);
+		AESNI_CLMUL_ACC(x2, h2);
+		AESNI_CLMUL_ACC(x3, h1);
+
+		acc = aesni_gf_reduce(lo, mid, hi);
+
+		data += 64;
+		nblocks -= 4;
+	}
+
+	while (nblocks > 0) {
+		x0 = _mm_xor_si128(AESNI_BSWAP(AESNI_LOAD(data)), acc);
+		acc = aesni_gf_mul(x0, h1);
+
+		data += 16;
+		nblocks--;
+	}
+
+	AESNI_STORE(y, AESNI_BSWAP(acc));
+}
+
+#endif
+#endif
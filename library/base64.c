@@ -42,6 +42,17 @@
 
 #include <inttypes.h>
 
+#if defined(TROPICSSL_AESNI)
+#include "tropicssl/aesni.h"
+#endif
+
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+#include <tmmintrin.h>
+
+#define BASE64_SSSE3
+#define BASE64_SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+
 static const uint8_t base64_enc_map[64] = {
 	'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J',
 	'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T',
@@ -132,6 +143,77 @@ int base64_encode(uint8_t *dst, size_t *dlen, const uint8_t *src, size_t slen)
 	return (0);
 }
 
+#if defined(BASE64_SSSE3)
+/*
+ * Sixteen characters at a time, after W. Mula: the low and high
+ * nibbles of each character pick two bit masks that only overlap
+ * outside the alphabet ('=' included), and the high nibble (shifted
+ * by one for '/') picks what to add to get the 6-bit value.
+ */
+BASE64_SSSE3_TARGET static int base64_ssse3_values(const uint8_t *src,
+						   __m128i * v)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11,
+					     0x11, 0x11, 0x11, 0x11,
+					     0x11, 0x11, 0x13, 0x1A,
+					     0x1B, 0x1B, 0x1B, 0x1A);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02,
+					     0x04, 0x08, 0x04, 0x08,
+					     0x10, 0x10, 0x10, 0x10,
+					     0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65,
+					       -71, -71, 0, 0, 0, 0,
+					       0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2F);
+	__m128i in, hi, lo;
+
+	in = _mm_loadu_si128((const __m128i *)src);
+
+	hi = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+	lo = _mm_and_si128(in, mask_2f);
+
+	lo = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+			   _mm_shuffle_epi8(lut_hi, hi));
+
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(lo, _mm_setzero_si128())) !=
+	    0xFFFF)
+		return (1);
+
+	hi = _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi);
+	*v = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, hi));
+
+	return (0);
+}
+
+BASE64_SSSE3_TARGET static int base64_ssse3_check(const uint8_t *src)
+{
+	__m128i v;
+
+	return (base64_ssse3_values(src, &v));
+}
+
+/*
+ * Decode sixteen characters into twelve bytes; writes sixteen
+ */
+BASE64_SSSE3_TARGET static int base64_ssse3_decode(uint8_t *dst,
+						   const uint8_t *src)
+{
+	__m128i v;
+
+	if (base64_ssse3_values(src, &v) != 0)
+		return (1);
+
+	v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+	v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+	v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+					      8, 14, 13, 12, -1, -1, -1, -1));
+
+	_mm_storeu_si128((__m128i *)dst, v);
+
+	return (0);
+}
+#endif
+
 /*
  * Decode a base64-formatted buffer
  */
@@ -140,8 +222,28 @@ int base64_decode(uint8_t *dst, size_t *dlen, const uint8_t *src, size_t slen)
 	size_t i, n;
 	uint32_t j, x;
 	uint8_t *p;
+#if defined(BASE64_SSSE3)
+	uint8_t *end;
+	int simd = aesni_supports(TROPICSSL_AESNI_SSSE3);
+#endif
 
 	for (i = n = 0, j = 0; i < slen; i++) {
+#if defined(BASE64_SSSE3)
+		/*
+		 * Whole runs of the alphabet, up to the next line break
+		 * or padding
+		 */
+		if (simd != 0 && j == 0) {
+			while (slen - i >= 16 && base64_ssse3_check(src + i) == 0) {
+				i += 16;
+				n += 16;
+			}
+
+			if (i == slen)
+				break;
+		}
+#endif
+
 		if ((slen - i) >= 2 && src[i] == '\r' && src[i + 1] == '\n')
 			continue;
 
@@ -170,7 +272,25 @@ int base64_decode(uint8_t *dst, size_t *dlen, const uint8_t *src, size_t slen)
 		return (TROPICSSL_ERR_BASE64_BUFFER_TOO_SMALL);
 	}
 
+#if defined(BASE64_SSSE3)
+	end = dst + *dlen;
+#endif
+
 	for (j = 3, x = 0, n = 0, p = dst; i > 0; i--, src++) {
+#if defined(BASE64_SSSE3)
+		if (simd != 0 && n == 0) {
+			while (i >= 16 && end - p >= 16 &&
+			       base64_ssse3_decode(p, src) == 0) {
+				p += 12;
+				src += 16;
+				i -= 16;
+			}
+
+			if (i == 0)
+				break;
+		}
+#endif
+
 		if (*src == '\r' || *src == '\n')
 			continue;
 
@@ -217,9 +337,11 @@ static const uint8_t base64_test_enc[88] =
  */
 int base64_self_test(int verbose)
 {
-	size_t len;
+	size_t len, i, j, n;
 	const uint8_t *src;
 	uint8_t buffer[128];
+	uint8_t bulk[1000], buffer2[1002];
+	uint8_t enc[1400], lines[1400];
 
 	if (verbose != 0)
 		printf("  Base64 encoding test: ");
@@ -249,6 +371,48 @@ int base64_self_test(int verbose)
 		return (1);
 	}
 
+	if (verbose != 0)
+		printf("passed\n  Base64 bulk test: ");
+
+	/*
+	 * PEM-like lines, so that both the 16-character runs and the
+	 * line breaks and padding between them get decoded
+	 */
+	for (i = 0; i < sizeof(bulk); i++)
+		bulk[i] = (uint8_t)(i * 7 + (i >> 5));
+
+	for (n = sizeof(bulk) - 2; n <= sizeof(bulk); n++) {
+		len = sizeof(enc);
+		if (base64_encode(enc, &len, bulk, n) != 0)
+			return (1);
+
+		for (i = j = 0; i < len; i++) {
+			if (i > 0 && i % 64 == 0)
+				lines[j++] = '\n';
+			lines[j++] = enc[i];
+		}
+
+		len = sizeof(buffer2);
+		if (base64_decode(buffer2, &len, lines, j) != 0 ||
+		    len != n || memcmp(buffer2, bulk, n) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+	}
+
+	lines[40] = '*';
+	len = sizeof(buffer2);
+
+	if (base64_decode(buffer2, &len, lines, j) !=
+	    TROPICSSL_ERR_BASE64_INVALID_CHARACTER) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
 	if (verbose != 0)
 		printf("passed\n\n");
 
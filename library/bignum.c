@@ -48,21 +48,116 @@
 #include "tropicssl/err.h"
 #include "tropicssl/bignum.h"
 #include "tropicssl/bn_mul.h"
+#include "tropicssl/memory.h"
+
+#if defined(TROPICSSL_BN_X86)
+#include "tropicssl/bn_x86.h"
+#endif
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
 
+#if defined(TROPICSSL_GENPRIME_MT) && !defined(WIN32)
+#include <pthread.h>
+#endif
+
 #define ciL	   ((int) sizeof(t_uint))	/* chars in limb  */
 #define biL	   (ciL << 3)	/* bits  in limb  */
 #define biH	   (ciL << 2)	/* half limb size */
 
+#if !defined(TROPICSSL_HAVE_ASM) && \
+    (defined(TROPICSSL_HAVE_INT8) || defined(TROPICSSL_HAVE_INT16) || \
+     defined(TROPICSSL_HAVE_INT64))
+#define MPI_SQR_UDBL
+#endif
+
+/*
+ * The fixed-width kernels want 32-bit limbs and C double-width
+ * arithmetic, like MPI_SQR_UDBL
+ */
+#if defined(TROPICSSL_BN_FIXED) && defined(MPI_SQR_UDBL) && \
+    !defined(TROPICSSL_HAVE_INT8) && !defined(TROPICSSL_HAVE_INT16)
+#define MPI_FIXED
+#endif
+
+/*
+ * The x86-64 kernels take 32-bit limbs, in even numbers
+ */
+#if defined(TROPICSSL_BN_X86) && defined(TROPICSSL_HAVE_X86_64) && \
+    !defined(TROPICSSL_HAVE_INT8) && !defined(TROPICSSL_HAVE_INT16)
+#define MPI_X86
+#define MPI_X86_MUL(n)	(((n) & 1) == 0 && \
+			 bn_x86_supports(TROPICSSL_BN_X86_ADX))
+#define MPI_X86_ADX(n)	(MPI_X86_MUL(n) && (n) <= BN_X86_MAX_LIMBS)
+#endif
+
 /*
  * Convert between bits/chars and number of limbs
  */
 #define BITS_TO_LIMBS(i)  (((i) + biL - 1) / biL)
 #define CHARS_TO_LIMBS(i) (((i) + ciL - 1) / ciL)
 
+#if defined(_MSC_VER)
+#define MPI_THREAD __declspec(thread)
+#elif defined(__GNUC__)
+#define MPI_THREAD __thread
+#else
+#define MPI_THREAD		/* one workspace for the whole process */
+#endif
+
+static MPI_THREAD mpi_scratch *mpi_ws;
+
+/*
+ * Limbs for X: temporaries take a block of the smallest size class
+ * that fits from the thread's workspace, whose header limb holds
+ * the class; anything else, or what the workspace cannot give,
+ * comes from the heap
+ */
+static t_uint *mpi_alloc_limbs(size_t nblimbs, int tmp)
+{
+	size_t c, len;
+	t_uint *p;
+	mpi_scratch *S = mpi_ws;
+
+	if (tmp == 0 || S == NULL)
+		return ((t_uint *) memory_alloc(nblimbs * ciL));
+
+	for (c = 0, len = MPI_SCRATCH_MIN_LIMBS; len < nblimbs; c++)
+		len <<= 1;
+
+	if (c < MPI_SCRATCH_CLASSES) {
+		if ((p = S->free[c]) != NULL) {
+			memcpy(&S->free[c], p, sizeof(t_uint *));
+			return (p);
+		}
+
+		if (S->len - S->used >= len + 1) {
+			p = S->buf + S->used + 1;
+			p[-1] = (t_uint) c;
+			S->used += len + 1;
+			return (p);
+		}
+	}
+
+	S->spills++;
+
+	return ((t_uint *) memory_alloc(nblimbs * ciL));
+}
+
+static void mpi_free_limbs(t_uint * p)
+{
+	size_t c;
+	mpi_scratch *S = mpi_ws;
+
+	if (S != NULL && p > S->buf && p < S->buf + S->len) {
+		c = (size_t) p[-1];
+		memcpy(p, &S->free[c], sizeof(t_uint *));
+		S->free[c] = p;
+	} else
+		memory_free(p);
+}
+
 /*
  * Initialize one or more mpi
  */
@@ -76,6 +171,28 @@ void mpi_init(mpi * X, ...)
 		X->s = 1;
 		X->n = 0;
 		X->p = NULL;
+		X->t = 0;
+
+		X = va_arg(args, mpi *);
+	}
+
+	va_end(args);
+}
+
+/*
+ * Initialize one or more temporaries
+ */
+void mpi_init_tmp(mpi * X, ...)
+{
+	va_list args;
+
+	va_start(args, X);
+
+	while (X != NULL) {
+		X->s = 1;
+		X->n = 0;
+		X->p = NULL;
+		X->t = 1;
 
 		X = va_arg(args, mpi *);
 	}
@@ -95,7 +212,7 @@ void mpi_free(mpi * X, ...)
 	while (X != NULL) {
 		if (X->p != NULL) {
 			memset(X->p, 0, X->n * ciL);
-			free(X->p);
+			mpi_free_limbs(X->p);
 		}
 
 		X->s = 1;
@@ -119,7 +236,7 @@ int mpi_grow(mpi * X, size_t nblimbs)
 		return (TROPICSSL_ERR_MPI_MALLOC_FAILED);
 
 	if (X->n < nblimbs) {
-		if ((p = (t_uint *) malloc(nblimbs * ciL)) == NULL)
+		if ((p = mpi_alloc_limbs(nblimbs, X->t)) == NULL)
 			return (TROPICSSL_ERR_MPI_MALLOC_FAILED);
 
 		memset(p, 0, nblimbs * ciL);
@@ -127,7 +244,7 @@ int mpi_grow(mpi * X, size_t nblimbs)
 		if (X->p != NULL) {
 			memcpy(p, X->p, X->n * ciL);
 			memset(X->p, 0, X->n * ciL);
-			free(X->p);
+			mpi_free_limbs(X->p);
 		}
 
 		X->n = nblimbs;
@@ -137,6 +254,22 @@ int mpi_grow(mpi * X, size_t nblimbs)
 	return (TROPICSSL_ERR_OKAY);
 }
 
+/*
+ * Workspace for temporaries
+ */
+void mpi_scratch_init(mpi_scratch * S, t_uint * buf, size_t len)
+{
+	memset(S, 0, sizeof(mpi_scratch));
+
+	S->buf = buf;
+	S->len = len;
+}
+
+void mpi_set_scratch(mpi_scratch * S)
+{
+	mpi_ws = S;
+}
+
 /*
  * Copy the contents of Y into X
  */
@@ -782,7 +915,7 @@ int mpi_sub_abs(mpi * X, const mpi * A, const mpi * B)
 	if (mpi_cmp_abs(A, B) < 0)
 		return (TROPICSSL_ERR_MPI_NEGATIVE_VALUE);
 
-	mpi_init(&TB, NULL);
+	mpi_init_tmp(&TB, NULL);
 
 	if (X == B) {
 		MPI_CHK(mpi_copy(&TB, B));
@@ -933,16 +1066,244 @@ static void mpi_mul_hlp(size_t i, t_uint * s, t_uint * d, t_uint b)
 	} while (c != 0);
 }
 
+/*
+ * d[0 .. n - 1] = a + b, returns the carry
+ */
+static t_uint mpi_add_raw(t_uint * d, const t_uint * a, const t_uint * b,
+			  size_t n)
+{
+	size_t i;
+	t_uint c, z;
+
+	for (i = c = 0; i < n; i++) {
+		z = a[i] + c;
+		c = (z < c);
+		d[i] = z + b[i];
+		c += (d[i] < z);
+	}
+
+	return (c);
+}
+
+/*
+ * d[0 .. n - 1] = a - b, returns the borrow
+ */
+static t_uint mpi_sub_raw(t_uint * d, const t_uint * a, const t_uint * b,
+			  size_t n)
+{
+	size_t i;
+	t_uint c, z;
+
+	for (i = c = 0; i < n; i++) {
+		z = a[i] - c;
+		c = (z > a[i]);
+		d[i] = z - b[i];
+		c += (d[i] > z);
+	}
+
+	return (c);
+}
+
+/*
+ * d[0 .. n - 1] += c, over all n limbs whatever the carries
+ */
+static void mpi_inc_raw(t_uint * d, t_uint c, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		d[i] += c;
+		c = (d[i] < c);
+	}
+}
+
+/*
+ * Schoolbook squaring: d[0 .. 2n - 1] = s^2, d zeroed beforehand.
+ * Each cross product is done once and doubled, which leaves
+ * n(n + 1)/2 limb products instead of n^2.
+ */
+static void mpi_sqr_hlp(size_t n, const t_uint * s, t_uint * d)
+{
+	size_t i;
+#if defined(MPI_SQR_UDBL)
+	size_t j;
+	t_udbl r;
+	t_uint c, h, x0, x1;
+
+	/*
+	 * Without the MULADDC assembly, plain double-width arithmetic
+	 * lets the compiler keep everything in registers
+	 */
+	for (i = 0; i + 1 < n; i++) {
+		for (j = i + 1, c = 0; j < n; j++) {
+			r = (t_udbl) s[i] * s[j] + d[i + j] + c;
+			d[i + j] = (t_uint) r;
+			c = (t_uint) (r >> biL);
+		}
+
+		d[i + n] = c;
+	}
+
+	/*
+	 * Double, and add the squares on the diagonal, in one pass
+	 */
+	for (i = c = h = 0; i < n; i++) {
+		x0 = d[2 * i];
+		x1 = d[2 * i + 1];
+
+		r = (t_udbl) s[i] * s[i] + ((x0 << 1) | h) + c;
+		d[2 * i] = (t_uint) r;
+		h = x1 >> (biL - 1);
+
+		r = (r >> biL) + (t_uint) ((x1 << 1) | (x0 >> (biL - 1)));
+		d[2 * i + 1] = (t_uint) r;
+		c = (t_uint) (r >> biL);
+	}
+#else
+	t_uint c, z;
+
+	for (i = 0; i + 1 < n; i++)
+		mpi_mul_hlp(n - i - 1, (t_uint *) s + i + 1, d + 2 * i + 1, s[i]);
+
+	for (i = c = 0; i < 2 * n; i++) {
+		z = d[i];
+		d[i] = (z << 1) | c;
+		c = z >> (biL - 1);
+	}
+
+	for (i = 0; i < n; i++)
+		mpi_mul_hlp(1, (t_uint *) s + i, d + 2 * i, s[i]);
+#endif
+}
+
+/*
+ * Scratch space, in limbs, for mpi_ksqr() and mpi_kmul() on n limbs
+ */
+#define KARATSUBA_SCRATCH(n)	(6 * (n))
+
+/*
+ * Karatsuba squaring: d[0 .. 2n - 1] = a^2, with w holding
+ * KARATSUBA_SCRATCH(n) limbs. With a = a1 * B + a0,
+ *
+ *   a^2 = a1^2 * B^2 + (a0^2 + a1^2 - (a0 - a1)^2) * B + a0^2
+ *
+ * and |a0 - a1| is taken by mask, so that as for the schoolbook
+ * case nothing depends on the value of a.
+ */
+static void mpi_ksqr(t_uint * d, const t_uint * a, size_t n, t_uint * w)
+{
+	size_t i, h;
+	t_uint c, m, *v, *s, *t;
+
+	if (n < MPI_KARATSUBA_SQR_CUTOFF || (n & 1) != 0) {
+		memset(d, 0, 2 * n * ciL);
+		mpi_sqr_hlp(n, a, d);
+		return;
+	}
+
+	h = n / 2;
+	v = w;
+	s = v + h;
+	t = s + n;
+
+	mpi_ksqr(d, a, h, t);
+	mpi_ksqr(d + n, a + h, h, t);
+
+	/*
+	 * v = |a0 - a1|, s = v^2
+	 */
+	m = (t_uint) 0 - mpi_sub_raw(v, a, a + h, h);
+
+	for (i = 0, c = m & 1; i < h; i++) {
+		v[i] = (v[i] ^ m) + c;
+		c = (v[i] < c);
+	}
+
+	mpi_ksqr(s, v, h, t);
+
+	/*
+	 * d += (a0^2 + a1^2 - s) * B
+	 */
+	c = mpi_add_raw(t, d, d + n, n);
+	c -= mpi_sub_raw(t, t, s, n);
+	c += mpi_add_raw(d + h, d + h, t, n);
+
+	mpi_inc_raw(d + h + n, c, h);
+}
+
+/*
+ * Karatsuba multiplication: d[0 .. 2n - 1] = a * b, with w holding
+ * KARATSUBA_SCRATCH(n) limbs. Unlike the squaring, the middle term
+ * can have either sign here.
+ */
+static void mpi_kmul(t_uint * d, const t_uint * a, const t_uint * b,
+		     size_t n, t_uint * w)
+{
+	size_t i, h;
+	t_uint c, sa, sb, *va, *vb, *s, *t;
+
+#if defined(MPI_X86)
+	if (n < BN_X86_KARATSUBA_CUTOFF && MPI_X86_MUL(n)) {
+		bn_x86_mul_adx(d, a, n, b, n);
+		return;
+	}
+#endif
+
+	if (n < MPI_KARATSUBA_CUTOFF || (n & 1) != 0) {
+		memset(d, 0, 2 * n * ciL);
+
+		for (i = 0; i < n; i++)
+			mpi_mul_hlp(n, (t_uint *) b, d + i, a[i]);
+		return;
+	}
+
+	h = n / 2;
+	va = w;
+	vb = va + h;
+	s = vb + h;
+	t = s + n;
+
+	mpi_kmul(d, a, b, h, t);
+	mpi_kmul(d + n, a + h, b + h, h, t);
+
+	if ((sa = mpi_sub_raw(va, a, a + h, h)) != 0)
+		mpi_sub_raw(va, a + h, a, h);
+
+	if ((sb = mpi_sub_raw(vb, b, b + h, h)) != 0)
+		mpi_sub_raw(vb, b + h, b, h);
+
+	mpi_kmul(s, va, vb, h, t + n);
+
+	/*
+	 * d += (a0 * b0 + a1 * b1 - (a0 - a1) * (b0 - b1)) * B
+	 */
+	c = mpi_add_raw(t, d, d + n, n);
+
+	if (sa == sb)
+		c -= mpi_sub_raw(t, t, s, n);
+	else
+		c += mpi_add_raw(t, t, s, n);
+
+	c += mpi_add_raw(d + h, d + h, t, n);
+
+	mpi_inc_raw(d + h + n, c, h);
+}
+
 /*
  * Baseline multiplication: X = A * B  (HAC 14.12)
  */
 int mpi_mul_mpi(mpi * X, const mpi * A, const mpi * B)
 {
 	int ret;
-	size_t i, j;
+	size_t i, j, cutoff = MPI_KARATSUBA_CUTOFF;
 	mpi TA, TB;
 
-	mpi_init(&TA, &TB, NULL);
+	mpi_init_tmp(&TA, &TB, NULL);
+
+#if defined(MPI_X86)
+	if (bn_x86_supports(TROPICSSL_BN_X86_ADX))
+		cutoff = BN_X86_KARATSUBA_CUTOFF;
+#endif
 
 	if (X == A) {
 		MPI_CHK(mpi_copy(&TA, A));
@@ -961,6 +1322,59 @@ int mpi_mul_mpi(mpi * X, const mpi * A, const mpi * B)
 		if (B->p[j - 1] != 0)
 			break;
 
+	/*
+	 * Karatsuba for large operands of about the same size,
+	 * both zero-padded to m limbs
+	 */
+	if (i >= cutoff && j >= cutoff && i < 2 * j && j < 2 * i) {
+		size_t m = (i > j) ? i : j, size;
+		t_uint *w;
+
+		m = (m + 1) & ~(size_t) 1;
+
+		MPI_CHK(mpi_grow(X, 2 * m));
+		MPI_CHK(mpi_lset(X, 0));
+
+		size = (4 * m + KARATSUBA_SCRATCH(m)) * ciL;
+
+		if ((w = mpi_alloc_limbs(size / ciL, 1)) == NULL) {
+			ret = TROPICSSL_ERR_MPI_MALLOC_FAILED;
+			goto cleanup;
+		}
+
+		memset(w, 0, 2 * m * ciL);
+		memcpy(w, A->p, i * ciL);
+		memcpy(w + m, B->p, j * ciL);
+
+		mpi_kmul(w + 2 * m, w, w + m, m, w + 4 * m);
+		memcpy(X->p, w + 2 * m, 2 * m * ciL);
+
+		memset(w, 0, size);
+		mpi_free_limbs(w);
+
+		X->s = A->s * B->s;
+		goto cleanup;
+	}
+
+#if defined(MPI_X86)
+	/*
+	 * Odd sizes take one of the zero limbs above them, if any
+	 */
+	if (i + (i & 1) <= A->n && j + (j & 1) <= B->n &&
+	    MPI_X86_MUL(i + (i & 1)) && MPI_X86_MUL(j + (j & 1))) {
+		i += i & 1;
+		j += j & 1;
+
+		MPI_CHK(mpi_grow(X, i + j));
+		MPI_CHK(mpi_lset(X, 0));
+
+		bn_x86_mul_adx(X->p, A->p, i, B->p, j);
+
+		X->s = A->s * B->s;
+		goto cleanup;
+	}
+#endif
+
 	MPI_CHK(mpi_grow(X, i + j));
 	MPI_CHK(mpi_lset(X, 0));
 
@@ -1004,7 +1418,7 @@ int mpi_div_mpi(mpi * Q, mpi * R, const mpi * A, const mpi * B)
 	if (mpi_cmp_int(B, 0) == 0)
 		return (TROPICSSL_ERR_MPI_DIVISION_BY_ZERO);
 
-	mpi_init(&X, &Y, &Z, &T1, &T2, NULL);
+	mpi_init_tmp(&X, &Y, &Z, &T1, &T2, NULL);
 
 	if (mpi_cmp_abs(A, B) < 0) {
 		if (Q != NULL)
@@ -1260,6 +1674,164 @@ static void mpi_montg_init(t_uint * mm, const mpi * N)
 	*mm = ~x + 1;
 }
 
+/*
+ * Final step of the Montgomery product: D = d mod N for d < 2N of
+ * n + 1 limbs, T[0 .. n - 1] being scratch space. d - N is kept if
+ * d[n] is set or if there was no borrow, the choice being made by
+ * mask rather than by branch.
+ */
+static void mpi_mont_sub(t_uint * D, const t_uint * d, const t_uint * N,
+			 size_t n, t_uint * T)
+{
+	size_t i;
+	t_uint m;
+
+	m = mpi_sub_raw(T, d, N, n);
+	m = (t_uint) 0 - ((d[n] | (m ^ 1)) & 1);
+
+	for (i = 0; i < n; i++)
+		D[i] = (T[i] & m) | (d[i] & ~m);
+}
+
+#if defined(MPI_FIXED)
+/*
+ * Fixed-width Montgomery kernels: the limb loop of each row is
+ * unrolled for a given modulus size, so only the row loop is left
+ */
+#define MPI_U4(M, j)	M(j) M(j + 1) M(j + 2) M(j + 3)
+#define MPI_U16(M, j)	MPI_U4(M, j) MPI_U4(M, j + 4) \
+			MPI_U4(M, j + 8) MPI_U4(M, j + 12)
+#define MPI_U32(M, j)	MPI_U16(M, j) MPI_U16(M, j + 16)
+
+#define MPI_ROW_1024(M)	MPI_U32(M, 0)
+#define MPI_ROW_2048(M)	MPI_U32(M, 0) MPI_U32(M, 32)
+#define MPI_ROW_3072(M)	MPI_U32(M, 0) MPI_U32(M, 32) MPI_U32(M, 64)
+#define MPI_ROW_4096(M)	MPI_U32(M, 0) MPI_U32(M, 32) MPI_U32(M, 64) \
+			MPI_U32(M, 96)
+
+/*
+ * Limb j of T = (T + u0*B + u1*N) / 2^biL, with one carry for
+ * each product; limb 0 of the sum is 0 by the choice of u1
+ */
+#define MPI_FIXED_MUL(j)					\
+	r = (t_udbl) u0 * B[j] + T[j] + c0;			\
+	c0 = (t_uint) (r >> biL);				\
+	r = (t_udbl) u1 * N[j] + (t_uint) r + c1;		\
+	c1 = (t_uint) (r >> biL);				\
+	if ((j) > 0)						\
+		T[(j) - 1] = (t_uint) r;
+
+/*
+ * Limb j of T[i ..] += u*N
+ */
+#define MPI_FIXED_RED(j)					\
+	r = (t_udbl) u * N[j] + T[i + (j)] + c;			\
+	T[i + (j)] = (t_uint) r;				\
+	c = (t_uint) (r >> biL);
+
+/*
+ * D = A * B * R^-1 mod N and D = A^2 * R^-1 mod N on bits / biL
+ * limbs, with the same arguments as mpi_montmul_ct() and
+ * mpi_montsqr_ct()
+ */
+#define MPI_FIXED_KERNELS(bits)						\
+static void mpi_montmul_##bits(t_uint * D, const t_uint * A,		\
+			       const t_uint * B, const t_uint * N,	\
+			       t_uint mm, t_uint * T)			\
+{									\
+	size_t i, n = bits / biL;					\
+	t_udbl r;							\
+	t_uint u0, u1, c0, c1;						\
+									\
+	memset(T, 0, (n + 1) * ciL);					\
+									\
+	for (i = 0; i < n; i++) {					\
+		u0 = A[i];						\
+		u1 = (T[0] + u0 * B[0]) * mm;				\
+		c0 = c1 = 0;						\
+									\
+		MPI_ROW_##bits(MPI_FIXED_MUL)				\
+									\
+		r = (t_udbl) T[n] + c0 + c1;				\
+		T[n - 1] = (t_uint) r;					\
+		T[n] = (t_uint) (r >> biL);				\
+	}								\
+									\
+	mpi_mont_sub(D, T, N, n, T + n + 1);				\
+}									\
+									\
+static void mpi_montsqr_##bits(t_uint * D, const t_uint * A,		\
+			       const t_uint * N, t_uint mm,		\
+			       t_uint * T)				\
+{									\
+	size_t i, n = bits / biL;					\
+	t_udbl r;							\
+	t_uint u, c, cc;						\
+									\
+	memset(T, 0, (2 * n + 2) * ciL);				\
+	mpi_sqr_hlp(n, A, T);						\
+									\
+	for (i = cc = 0; i < n; i++) {					\
+		u = T[i] * mm;						\
+		c = 0;							\
+									\
+		MPI_ROW_##bits(MPI_FIXED_RED)				\
+									\
+		r = (t_udbl) T[i + n] + c + cc;				\
+		T[i + n] = (t_uint) r;					\
+		cc = (t_uint) (r >> biL);				\
+	}								\
+									\
+	T[2 * n] = cc;							\
+									\
+	mpi_mont_sub(D, T + n, N, n, T);				\
+}
+
+MPI_FIXED_KERNELS(1024)
+MPI_FIXED_KERNELS(2048)
+MPI_FIXED_KERNELS(3072)
+MPI_FIXED_KERNELS(4096)
+
+/*
+ * Run the kernel for n limbs, if there is one: B == NULL squares A
+ */
+static int mpi_mont_fixed(t_uint * D, const t_uint * A, const t_uint * B,
+			  const t_uint * N, size_t n, t_uint mm, t_uint * T)
+{
+	switch (n) {
+	case 1024 / biL:
+		if (B == NULL)
+			mpi_montsqr_1024(D, A, N, mm, T);
+		else
+			mpi_montmul_1024(D, A, B, N, mm, T);
+		return (1);
+
+	case 2048 / biL:
+		if (B == NULL)
+			mpi_montsqr_2048(D, A, N, mm, T);
+		else
+			mpi_montmul_2048(D, A, B, N, mm, T);
+		return (1);
+
+	case 3072 / biL:
+		if (B == NULL)
+			mpi_montsqr_3072(D, A, N, mm, T);
+		else
+			mpi_montmul_3072(D, A, B, N, mm, T);
+		return (1);
+
+	case 4096 / biL:
+		if (B == NULL)
+			mpi_montsqr_4096(D, A, N, mm, T);
+		else
+			mpi_montmul_4096(D, A, B, N, mm, T);
+		return (1);
+	}
+
+	return (0);
+}
+#endif
+
 /*
  * Montgomery multiplication: A = A * B * R^-1 mod N  (HAC 14.36)
  */
@@ -1268,10 +1840,25 @@ static void mpi_montmul(mpi * A, const mpi * B, const mpi * N, t_uint mm, const
 	size_t i, n, m;
 	t_uint u0, u1, *d;
 
+	n = N->n;
+
+#if defined(MPI_X86)
+	if (B->n >= n && MPI_X86_ADX(n)) {
+		bn_x86_montmul_adx(A->p, A->p, B->p, N->p, n);
+		A->p[n] = 0;
+		return;
+	}
+#endif
+#if defined(MPI_FIXED)
+	if (B->n >= n && mpi_mont_fixed(A->p, A->p, B->p, N->p, n, mm, T->p)) {
+		A->p[n] = 0;
+		return;
+	}
+#endif
+
 	memset(T->p, 0, T->n * ciL);
 
 	d = T->p;
-	n = N->n;
 	m = (B->n < n) ? B->n : n;
 
 	for (i = 0; i < n; i++) {
@@ -1298,21 +1885,139 @@ static void mpi_montmul(mpi * A, const mpi * B, const mpi * N, t_uint mm, const
 }
 
 /*
- * Montgomery reduction: A = A * R^-1 mod N
+ * Montgomery multiplication on bare limbs: D = A * B * R^-1 mod N,
+ * with A < R, B < N, all of them n limbs. T is 2n + 2 limbs of
+ * scratch space and D may be A or B. Unlike mpi_montmul(), the
+ * final subtraction is picked by a mask, so nothing depends on
+ * the values involved.
  */
-static void mpi_montred(mpi * A, const mpi * N, t_uint mm, const mpi * T)
+static void mpi_montmul_ct(t_uint * D, const t_uint * A, const t_uint * B,
+			   const t_uint * N, size_t n, t_uint mm, t_uint * T)
 {
-	t_uint z = 1;
-	mpi U;
+	size_t i;
+	t_uint u0, u1, *d;
 
-	U.n = U.s = z;
-	U.p = &z;
+#if defined(MPI_X86)
+	if (MPI_X86_ADX(n)) {
+		bn_x86_montmul_adx(D, A, B, N, n);
+		return;
+	}
+#endif
+#if defined(MPI_FIXED)
+	if (mpi_mont_fixed(D, A, B, N, n, mm, T))
+		return;
+#endif
 
-	mpi_montmul(A, &U, N, mm, T);
-}
+	memset(T, 0, (2 * n + 2) * ciL);
 
-/*
- * Sliding-window exponentiation: X = A^E mod N	 (HAC 14.85)
+	d = T;
+
+	for (i = 0; i < n; i++) {
+		/*
+		 * T = (T + u0*B + u1*N) / 2^biL
+		 */
+		u0 = A[i];
+		u1 = (d[0] + u0 * B[0]) * mm;
+
+		mpi_mul_hlp(n, (t_uint *) B, d, u0);
+		mpi_mul_hlp(n, (t_uint *) N, d, u1);
+
+		*d++ = u0;
+		d[n + 1] = 0;
+	}
+
+	mpi_mont_sub(D, d, N, n, T);
+}
+
+/*
+ * Montgomery squaring on bare limbs: D = A^2 * R^-1 mod N, with
+ * A < N, and T and D as for mpi_montmul_ct(). W, if not NULL, is
+ * KARATSUBA_SCRATCH(n) limbs for mpi_ksqr() to use.
+ */
+static void mpi_montsqr_ct(t_uint * D, const t_uint * A, const t_uint * N,
+			   size_t n, t_uint mm, t_uint * T, t_uint * W)
+{
+	size_t i;
+
+#if defined(MPI_X86)
+	if (MPI_X86_ADX(n)) {
+		bn_x86_montsqr_adx(D, A, N, n);
+		return;
+	}
+#endif
+#if defined(MPI_FIXED)
+	if (mpi_mont_fixed(D, A, NULL, N, n, mm, T))
+		return;
+#endif
+
+	if (W != NULL)
+		mpi_ksqr(T, A, n, W);
+	else {
+		memset(T, 0, 2 * n * ciL);
+		mpi_sqr_hlp(n, A, T);
+	}
+
+	T[2 * n] = T[2 * n + 1] = 0;
+
+	/*
+	 * T = (T + u*N) / 2^(n*biL), one limb of u at a time
+	 */
+#if defined(MPI_SQR_UDBL)
+	{
+		size_t j;
+		t_udbl r;
+		t_uint u, c, cc;
+
+		for (i = cc = 0; i < n; i++) {
+			u = T[i] * mm;
+
+			for (j = c = 0; j < n; j++) {
+				r = (t_udbl) u * N[j] + T[i + j] + c;
+				T[i + j] = (t_uint) r;
+				c = (t_uint) (r >> biL);
+			}
+
+			r = (t_udbl) T[i + n] + c + cc;
+			T[i + n] = (t_uint) r;
+			cc = (t_uint) (r >> biL);
+		}
+
+		T[2 * n] = cc;
+	}
+#else
+	for (i = 0; i < n; i++)
+		mpi_mul_hlp(n, (t_uint *) N, T + i, T[i] * mm);
+#endif
+
+	mpi_mont_sub(D, T + n, N, n, T);
+}
+
+/*
+ * Montgomery squaring: A = A^2 * R^-1 mod N, for the same A, N and
+ * T as mpi_montmul() and K as mpi_montsqr_ct()'s W (p may be NULL)
+ */
+static void mpi_montsqr(mpi * A, const mpi * N, t_uint mm, const mpi * T,
+			const mpi * K)
+{
+	mpi_montsqr_ct(A->p, A->p, N->p, N->n, mm, T->p, K->p);
+}
+
+/*
+ * Montgomery reduction: A = A * R^-1 mod N
+ */
+static void mpi_montred(mpi * A, const mpi * N, t_uint mm, const mpi * T)
+{
+	t_uint z = 1;
+	mpi U;
+
+	U.n = U.s = z;
+	U.p = &z;
+
+	mpi_montmul(A, &U, N, mm, T);
+}
+
+/*
+ * Sliding-window exponentiation: X = A^E mod N	 (HAC 14.85)
  */
 int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 {
@@ -1320,7 +2025,7 @@ int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 	size_t i, j, wsize, wbits;
 	size_t bufsize, nblimbs, nbits;
 	t_uint ei, mm, state;
-	mpi RR, T, W[64];
+	mpi RR, T, K, W[64];
 
 	if (mpi_cmp_int(N, 0) < 0 || (N->p[0] & 1) == 0)
 		return (TROPICSSL_ERR_BAD_ARG);
@@ -1329,9 +2034,13 @@ int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 	 * Init temps and window size
 	 */
 	mpi_montg_init(&mm, N);
-	mpi_init(&RR, &T, NULL);
+	mpi_init(&RR, NULL);
+	mpi_init_tmp(&T, &K, NULL);
 	memset(W, 0, sizeof(W));
 
+	for (i = 0; i < 64; i++)
+		W[i].t = 1;
+
 	i = mpi_msb(E);
 
 	wsize = (i > 671) ? 6 : (i > 239) ? 5 : (i > 79) ? 4 : (i > 23) ? 3 : 1;
@@ -1341,6 +2050,9 @@ int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 	MPI_CHK(mpi_grow(&W[1], j));
 	MPI_CHK(mpi_grow(&T, j * 2));
 
+	if (N->n >= MPI_KARATSUBA_SQR_CUTOFF)
+		MPI_CHK(mpi_grow(&K, KARATSUBA_SCRATCH(N->n)));
+
 	/*
 	 * If 1st call, pre-compute R^2 mod N
 	 */
@@ -1380,7 +2092,7 @@ int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 		MPI_CHK(mpi_copy(&W[j], &W[1]));
 
 		for (i = 0; i < wsize - 1; i++)
-			mpi_montmul(&W[j], &W[j], N, mm, &T);
+			mpi_montsqr(&W[j], N, mm, &T, &K);
 
 		/*
 		 * W[i] = W[i - 1] * W[1]
@@ -1421,7 +2133,7 @@ int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 			/*
 			 * out of window, square X
 			 */
-			mpi_montmul(X, X, N, mm, &T);
+			mpi_montsqr(X, N, mm, &T, &K);
 			continue;
 		}
 
@@ -1438,7 +2150,7 @@ int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 			 * X = X^wsize R^-1 mod N
 			 */
 			for (i = 0; i < wsize; i++)
-				mpi_montmul(X, X, N, mm, &T);
+				mpi_montsqr(X, N, mm, &T, &K);
 
 			/*
 			 * X = X * W[wbits] R^-1 mod N
@@ -1455,7 +2167,7 @@ int mpi_exp_mod(mpi * X, const mpi * A, const mpi * E, const mpi * N, mpi * _RR)
 	 * process the remaining bits
 	 */
 	for (i = 0; i < nbits; i++) {
-		mpi_montmul(X, X, N, mm, &T);
+		mpi_montsqr(X, N, mm, &T, &K);
 
 		wbits <<= 1;
 
@@ -1473,7 +2185,7 @@ cleanup:
 	for (i = (1 << (wsize - 1)); i < (1 << wsize); i++)
 		mpi_free(&W[i], NULL);
 
-	mpi_free(&W[1], &T, NULL);
+	mpi_free(&W[1], &T, &K, NULL);
 	if (_RR == NULL)
 		mpi_free(&RR, NULL);
 
@@ -1481,227 +2193,1174 @@ cleanup:
 }
 
 /*
- * Greatest common divisor: G = gcd(A, B)  (HAC 14.54)
+ * Exponent bits [i, i + w)
  */
-int mpi_gcd(mpi * G, const mpi * A, const mpi * B)
+static size_t mpi_get_bits(const mpi * E, size_t i, size_t w)
 {
-	int ret;
-	size_t lz, lzt;
-	mpi TG, TA, TB;
-
-	mpi_init(&TG, &TA, &TB, NULL);
-
-	MPI_CHK(mpi_copy(&TA, A));
-	MPI_CHK(mpi_copy(&TB, B));
+	size_t j, r = 0;
 
-	lz = mpi_lsb(&TA);
-	lzt = mpi_lsb(&TB);
+	for (j = w; j > 0; j--) {
+		r <<= 1;
 
-	if (lzt < lz)
-		lz = lzt;
+		if ((i + j - 1) / biL < E->n)
+			r |= (E->p[(i + j - 1) / biL] >> ((i + j - 1) % biL)) & 1;
+	}
 
-	MPI_CHK(mpi_shift_r(&TA, lz));
-	MPI_CHK(mpi_shift_r(&TB, lz));
+	return (r);
+}
 
-	TA.s = TB.s = 1;
+/*
+ * Sizes and -N^-1 of a modulus, common to both ways of getting
+ * its Montgomery constants
+ */
+static int mpi_mont_setup(mpi_mont * M, const mpi * N)
+{
+	size_t n;
 
-	while (mpi_cmp_int(&TA, 0) != 0) {
-		MPI_CHK(mpi_shift_r(&TA, mpi_lsb(&TA)));
-		MPI_CHK(mpi_shift_r(&TB, mpi_lsb(&TB)));
+	if (mpi_cmp_int(N, 0) <= 0 || (N->p[0] & 1) == 0)
+		return (TROPICSSL_ERR_BAD_ARG);
 
-		if (mpi_cmp_mpi(&TA, &TB) >= 0) {
-			MPI_CHK(mpi_sub_abs(&TA, &TA, &TB));
-			MPI_CHK(mpi_shift_r(&TA, 1));
-		} else {
-			MPI_CHK(mpi_sub_abs(&TB, &TB, &TA));
-			MPI_CHK(mpi_shift_r(&TB, 1));
-		}
-	}
+	mpi_mont_free(M);
 
-	MPI_CHK(mpi_shift_l(&TB, lz));
-	MPI_CHK(mpi_copy(G, &TB));
+	/*
+	 * Leading zero limbs of N would only slow things down
+	 */
+	n = mpi_size(N);
+	n = (n + ciL - 1) / ciL;
 
-cleanup:
+	M->n = n;
+	M->nbits = mpi_msb(N);
+	M->wsize = (M->nbits > 239) ? 5 : (M->nbits > 79) ? 4 :
+	    (M->nbits > 23) ? 3 : 1;
 
-	mpi_free(&TB, &TA, &TG, NULL);
+	mpi_montg_init(&M->mm, N);
 
-	return (ret);
+	return (0);
 }
 
-int mpi_fill_random(mpi * X, size_t size, int (*f_rng)(void *), void *p_rng)
+#if defined(MPI_X86)
+/*
+ * Whether the IFMA kernel is to be used for N
+ */
+static int mpi_mont_ifma(const mpi_mont * M)
 {
-    int ret;
-    size_t k;
-    uint8_t *p;
-
-    MPI_CHK(mpi_grow(X, size));
-    MPI_CHK(mpi_lset(X, 0));
-
-    p = (uint8_t *) X->p;
-    for (k = 0; k < X->n * ciL; k++)
-        *p++ = (uint8_t) f_rng(p_rng);
-
-cleanup:
-    return (ret);
+	return (M->nbits >= BN_X86_IFMA_MIN_BITS &&
+		M->nbits <= BN_X86_IFMA_MAX_BITS &&
+		bn_x86_supports(TROPICSSL_BN_X86_IFMA));
 }
 
-#if defined(TROPICSSL_GENPRIME)
-
 /*
- * Modular inverse: X = A^-1 mod N	(HAC 14.61 / 14.64)
+ * RI = R'^2 mod N, in the IFMA kernel's own radix
  */
-int mpi_inv_mod(mpi * X, const mpi * A, const mpi * N)
+static int mpi_mont_ifma_init(mpi_mont * M, const mpi * N)
 {
 	int ret;
-	mpi G, TA, TU, U1, U2, TB, TV, V1, V2;
-
-	if (mpi_cmp_int(N, 0) <= 0)
-		return (TROPICSSL_ERR_BAD_ARG);
 
-	mpi_init(&TA, &TU, &U1, &U2, &G, &TB, &TV, &V1, &V2, NULL);
+	MPI_CHK(mpi_lset(&M->RI, 1));
+	MPI_CHK(mpi_shift_l(&M->RI, 104 * bn_x86_ifma_digits(M->nbits)));
+	MPI_CHK(mpi_mod_mpi(&M->RI, &M->RI, N));
+	MPI_CHK(mpi_grow(&M->RI, M->n));
 
-	MPI_CHK(mpi_gcd(&G, A, N));
+cleanup:
 
-	if (mpi_cmp_int(&G, 1) != 0) {
-		ret = TROPICSSL_ERR_MPI_NOT_ACCEPTABLE;
-		goto cleanup;
-	}
+	return (ret);
+}
+#endif
 
-	MPI_CHK(mpi_mod_mpi(&TA, A, N));
-	MPI_CHK(mpi_copy(&TU, &TA));
-	MPI_CHK(mpi_copy(&TB, N));
-	MPI_CHK(mpi_copy(&TV, N));
+/*
+ * Precompute the Montgomery constants of a modulus
+ */
+int mpi_mont_init(mpi_mont * M, const mpi * N)
+{
+	int ret;
+	size_t n;
 
-	MPI_CHK(mpi_lset(&U1, 1));
-	MPI_CHK(mpi_lset(&U2, 0));
-	MPI_CHK(mpi_lset(&V1, 0));
-	MPI_CHK(mpi_lset(&V2, 1));
+	if ((ret = mpi_mont_setup(M, N)) != 0)
+		return (ret);
 
-	do {
-		while ((TU.p[0] & 1) == 0) {
-			MPI_CHK(mpi_shift_r(&TU, 1));
+	n = M->n;
 
-			if ((U1.p[0] & 1) != 0 || (U2.p[0] & 1) != 0) {
-				MPI_CHK(mpi_add_mpi(&U1, &U1, &TB));
-				MPI_CHK(mpi_sub_mpi(&U2, &U2, &TA));
-			}
+	/*
+	 * RR = R^2 mod N, RRR = R^3 mod N
+	 */
+	MPI_CHK(mpi_lset(&M->RR, 1));
+	MPI_CHK(mpi_shift_l(&M->RR, n * 2 * biL));
+	MPI_CHK(mpi_mod_mpi(&M->RR, &M->RR, N));
+	MPI_CHK(mpi_grow(&M->RR, n));
+
+	MPI_CHK(mpi_copy(&M->RRR, &M->RR));
+	MPI_CHK(mpi_shift_l(&M->RRR, n * biL));
+	MPI_CHK(mpi_mod_mpi(&M->RRR, &M->RRR, N));
+	MPI_CHK(mpi_grow(&M->RRR, n));
+
+#if defined(MPI_X86)
+	if (mpi_mont_ifma(M))
+		MPI_CHK(mpi_mont_ifma_init(M, N));
+#endif
 
-			MPI_CHK(mpi_shift_r(&U1, 1));
-			MPI_CHK(mpi_shift_r(&U2, 1));
-		}
+cleanup:
 
-		while ((TV.p[0] & 1) == 0) {
-			MPI_CHK(mpi_shift_r(&TV, 1));
+	if (ret != 0)
+		mpi_mont_free(M);
 
-			if ((V1.p[0] & 1) != 0 || (V2.p[0] & 1) != 0) {
-				MPI_CHK(mpi_add_mpi(&V1, &V1, &TB));
-				MPI_CHK(mpi_sub_mpi(&V2, &V2, &TA));
-			}
+	return (ret);
+}
 
-			MPI_CHK(mpi_shift_r(&V1, 1));
-			MPI_CHK(mpi_shift_r(&V2, 1));
-		}
+/*
+ * Take the Montgomery constants of a modulus from an earlier
+ * mpi_mont_init(): only the cheap parts are computed again
+ */
+int mpi_mont_import(mpi_mont * M, const mpi * N, const mpi * RR,
+		    const mpi * RRR, const mpi * RI)
+{
+	int ret;
 
-		if (mpi_cmp_mpi(&TU, &TV) >= 0) {
-			MPI_CHK(mpi_sub_mpi(&TU, &TU, &TV));
-			MPI_CHK(mpi_sub_mpi(&U1, &U1, &V1));
-			MPI_CHK(mpi_sub_mpi(&U2, &U2, &V2));
-		} else {
-			MPI_CHK(mpi_sub_mpi(&TV, &TV, &TU));
-			MPI_CHK(mpi_sub_mpi(&V1, &V1, &U1));
-			MPI_CHK(mpi_sub_mpi(&V2, &V2, &U2));
-		}
-	} while (mpi_cmp_int(&TU, 0) != 0);
+	if ((ret = mpi_mont_setup(M, N)) != 0)
+		return (ret);
 
-	while (mpi_cmp_int(&V1, 0) < 0)
-		MPI_CHK(mpi_add_mpi(&V1, &V1, N));
+	if (RR->s < 0 || RRR->s < 0 ||
+	    mpi_cmp_mpi(RR, N) >= 0 || mpi_cmp_mpi(RRR, N) >= 0) {
+		ret = TROPICSSL_ERR_BAD_ARG;
+		goto cleanup;
+	}
 
-	while (mpi_cmp_mpi(&V1, N) >= 0)
-		MPI_CHK(mpi_sub_mpi(&V1, &V1, N));
+	MPI_CHK(mpi_copy(&M->RR, RR));
+	MPI_CHK(mpi_grow(&M->RR, M->n));
+	MPI_CHK(mpi_copy(&M->RRR, RRR));
+	MPI_CHK(mpi_grow(&M->RRR, M->n));
 
-	MPI_CHK(mpi_copy(X, &V1));
+#if defined(MPI_X86)
+	/*
+	 * RI only depends on the size of N, not on the limbs: it is
+	 * taken when given, and computed if this CPU wants it
+	 */
+	if (mpi_mont_ifma(M)) {
+		if (RI != NULL && mpi_cmp_int(RI, 0) > 0 &&
+		    mpi_cmp_mpi(RI, N) < 0) {
+			MPI_CHK(mpi_copy(&M->RI, RI));
+			MPI_CHK(mpi_grow(&M->RI, M->n));
+		} else
+			MPI_CHK(mpi_mont_ifma_init(M, N));
+	}
+#else
+	((void)RI);
+#endif
 
 cleanup:
 
-	mpi_free(&V2, &V1, &TV, &TB, &G, &U2, &U1, &TU, &TA, NULL);
+	if (ret != 0)
+		mpi_mont_free(M);
 
 	return (ret);
 }
 
-static const int small_prime[] = {
-	3, 5, 7, 11, 13, 17, 19, 23,
-	29, 31, 37, 41, 43, 47, 53, 59,
-	61, 67, 71, 73, 79, 83, 89, 97,
-	101, 103, 107, 109, 113, 127, 131, 137,
-	139, 149, 151, 157, 163, 167, 173, 179,
-	181, 191, 193, 197, 199, 211, 223, 227,
-	229, 233, 239, 241, 251, 257, 263, 269,
-	271, 277, 281, 283, 293, 307, 311, 313,
-	317, 331, 337, 347, 349, 353, 359, 367,
-	373, 379, 383, 389, 397, 401, 409, 419,
-	421, 431, 433, 439, 443, 449, 457, 461,
-	463, 467, 479, 487, 491, 499, 503, 509,
-	521, 523, 541, 547, 557, 563, 569, 571,
-	577, 587, 593, 599, 601, 607, 613, 617,
-	619, 631, 641, 643, 647, 653, 659, 661,
-	673, 677, 683, 691, 701, 709, 719, 727,
-	733, 739, 743, 751, 757, 761, 769, 773,
-	787, 797, 809, 811, 821, 823, 827, 829,
-	839, 853, 857, 859, 863, 877, 881, 883,
-	887, 907, 911, 919, 929, 937, 941, 947,
-	953, 967, 971, 977, 983, 991, 997, -103
-};
-
 /*
- * Miller-Rabin primality test	(HAC 4.24)
+ * Unallocate the Montgomery constants
  */
-int mpi_is_prime(mpi * X, int (*f_rng) (void *), void *p_rng)
+void mpi_mont_free(mpi_mont * M)
 {
-	int ret, xs;
-	size_t i, j, n, s;
-	mpi W, R, T, A, RR;
-
-	if (mpi_cmp_int(X, 0) == 0 || mpi_cmp_int(X, 1) == 0) {
-		return (TROPICSSL_ERR_MPI_NOT_ACCEPTABLE);
-	}
+	mpi_free(&M->RR, &M->RRR, &M->RI, NULL);
+	memset(M, 0, sizeof(mpi_mont));
+}
 
-	if (mpi_cmp_int(X, 2) == 0) {
-		return (TROPICSSL_ERR_OKAY);
-	}
+/*
+ * Fixed-window exponentiation: X = A^E mod N, with the
+ * precomputed constants M of N
+ */
+int mpi_exp_mod_fixed(mpi * X, const mpi * A, const mpi * E,
+		      const mpi * N, const mpi_mont * M)
+{
+	int ret = 0;
+	size_t i, j, k, n, w, wsize, size;
+	size_t ebits;
+	t_uint m, *buf, *W, *Y, *V, *T, *K;
+	t_uint local[((1 << 5) + 4) * (MPI_EXP_STACK_BITS / biL) + 2 +
+		     KARATSUBA_SCRATCH(MPI_EXP_STACK_BITS / biL)];
+	mpi U;
 
-	mpi_init(&W, &R, &T, &A, &RR, NULL);
+	if (M->n == 0 || mpi_cmp_int(A, 0) < 0)
+		return (TROPICSSL_ERR_BAD_ARG);
 
-	xs = X->s;
-	X->s = 1;
+	n = M->n;
+	wsize = M->wsize;
 
 	/*
-	 * test trivial factors first
+	 * W[0 .. 2^wsize - 1], Y, V, T (2n + 2) and K for the squarings
 	 */
-	if ((X->p[0] & 1) == 0)
-		return (TROPICSSL_ERR_MPI_NOT_ACCEPTABLE);
+	size = ((1 << wsize) + 4) * n + 2 + KARATSUBA_SCRATCH(n);
 
-	for (i = 0; small_prime[i] > 0; i++) {
-		t_uint r;
+	if (size <= sizeof(local) / ciL)
+		buf = local;
+	else if ((buf = mpi_alloc_limbs(size, 1)) == NULL)
+		return (TROPICSSL_ERR_MPI_MALLOC_FAILED);
 
-		if (mpi_cmp_int(X, small_prime[i]) <= 0)
-			return (TROPICSSL_ERR_OKAY);
+	W = buf;
+	Y = W + ((size_t) 1 << wsize) * n;
+	V = Y + n;
+	T = V + n;
+	K = T + 2 * n + 2;
 
-		MPI_CHK(mpi_mod_int(&r, X, small_prime[i]));
+	mpi_init_tmp(&U, NULL);
 
-		if (r == 0)
-			return (TROPICSSL_ERR_MPI_NOT_ACCEPTABLE);
+	/*
+	 * Bases up to 2n limbs (which is all of them for RSA-CRT)
+	 * are brought in as Ah * R^3 + Al * R^2, with no division;
+	 * larger ones are reduced first
+	 */
+	if (mpi_size(A) > 2 * n * ciL) {
+		MPI_CHK(mpi_mod_mpi(&U, A, N));
+		A = &U;
 	}
 
+	memset(Y, 0, 2 * n * ciL);
+
+	for (i = 0; i < 2 * n && i < A->n; i++)
+		Y[i] = A->p[i];
+
+	mpi_montmul_ct(W + n, Y, M->RR.p, N->p, n, M->mm, T);
+	mpi_montmul_ct(V, Y + n, M->RRR.p, N->p, n, M->mm, T);
+
 	/*
-	 * W = |X| - 1
-	 * R = W >> lsb(W)
+	 * The carry goes just past W[1], in space not yet in use
 	 */
-	MPI_CHK(mpi_sub_int(&W, X, 1));
-	s = mpi_lsb(&W);
-	MPI_CHK(mpi_copy(&R, &W));
-	MPI_CHK(mpi_shift_r(&R, s));
+	W[2 * n] = mpi_add_raw(W + n, W + n, V, n);
+	mpi_mont_sub(W + n, W + n, N->p, n, V);
 
-	i = mpi_msb(X);
+	ebits = mpi_msb(E);
+	if (ebits < M->nbits)
+		ebits = M->nbits;
+
+#if defined(MPI_X86)
+	/*
+	 * The IFMA kernel does the rest in its own radix, from
+	 * A mod N = W[1] * R^-1
+	 */
+	if (M->RI.p != NULL) {
+		memset(V, 0, n * ciL);
+		V[0] = 1;
+
+		mpi_montmul_ct(Y, W + n, V, N->p, n, M->mm, T);
+		bn_x86_exp_mod_ifma(T, Y, E->p, E->n, ebits, N->p,
+				    M->RI.p, n, M->nbits, wsize);
+		mpi_mont_sub(Y, T, N->p, n, V);
+
+		MPI_CHK(mpi_grow(X, n));
+		MPI_CHK(mpi_lset(X, 0));
+		memcpy(X->p, Y, n * ciL);
+		goto cleanup;
+	}
+#endif
+
+	/*
+	 * W[0] = R mod N, W[i] = W[i - 1] * W[1]
+	 */
+	memset(V, 0, n * ciL);
+	V[0] = 1;
+
+	mpi_montmul_ct(W, V, M->RR.p, N->p, n, M->mm, T);
+
+	for (i = 2; i < ((size_t) 1 << wsize); i++)
+		mpi_montmul_ct(W + i * n, W + (i - 1) * n, W + n,
+			       N->p, n, M->mm, T);
+
+	/*
+	 * Y = A^E R mod N, wsize bits at a time over as many bits as
+	 * N has, however short E is; every table entry is read
+	 * on every step so that the access pattern says nothing either
+	 */
+	memcpy(Y, W, n * ciL);
+
+	for (i = (ebits + wsize - 1) / wsize * wsize; i > 0; i -= wsize) {
+		for (j = 0; j < wsize; j++)
+			mpi_montsqr_ct(Y, Y, N->p, n, M->mm, T, K);
+
+		w = mpi_get_bits(E, i - wsize, wsize);
+
+		memset(V, 0, n * ciL);
+
+		for (k = 0; k < ((size_t) 1 << wsize); k++) {
+			m = (t_uint) 0 - (t_uint) (k == w);
+
+			for (j = 0; j < n; j++)
+				V[j] |= W[k * n + j] & m;
+		}
+
+		mpi_montmul_ct(Y, Y, V, N->p, n, M->mm, T);
+	}
+
+	/*
+	 * X = Y * R^-1 mod N
+	 */
+	memset(V, 0, n * ciL);
+	V[0] = 1;
+
+	mpi_montmul_ct(Y, Y, V, N->p, n, M->mm, T);
+
+	MPI_CHK(mpi_grow(X, n));
+	MPI_CHK(mpi_lset(X, 0));
+	memcpy(X->p, Y, n * ciL);
+
+cleanup:
+
+	memset(buf, 0, size * ciL);
+
+	if (buf != local)
+		mpi_free_limbs(buf);
+
+	mpi_free(&U, NULL);
+
+	return (ret);
+}
+
+/*
+ * Montgomery multiplication: X = A * B * R^-1 mod N
+ */
+int mpi_mont_mul(mpi * X, const mpi * A, const mpi * B,
+		 const mpi * N, const mpi_mont * M)
+{
+	int ret = 0;
+	size_t n, size;
+	t_uint *buf, local[4 * (2 * MPI_EXP_STACK_BITS / biL) + 2];
+
+	if (M->n == 0 || A->s < 0 || B->s < 0 ||
+	    mpi_cmp_abs(A, N) >= 0 || mpi_cmp_abs(B, N) >= 0)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	n = M->n;
+
+	/*
+	 * A and B on n limbs, then T (2n + 2)
+	 */
+	size = 4 * n + 2;
+
+	if (size <= sizeof(local) / ciL)
+		buf = local;
+	else if ((buf = mpi_alloc_limbs(size, 1)) == NULL)
+		return (TROPICSSL_ERR_MPI_MALLOC_FAILED);
+
+	memset(buf, 0, 2 * n * ciL);
+	memcpy(buf, A->p, ((A->n < n) ? A->n : n) * ciL);
+	memcpy(buf + n, B->p, ((B->n < n) ? B->n : n) * ciL);
+
+	mpi_montmul_ct(buf, buf, buf + n, N->p, n, M->mm, buf + 2 * n);
+
+	MPI_CHK(mpi_grow(X, n));
+	MPI_CHK(mpi_lset(X, 0));
+	memcpy(X->p, buf, n * ciL);
+
+cleanup:
+
+	memset(buf, 0, size * ciL);
+
+	if (buf != local)
+		mpi_free_limbs(buf);
+
+	return (ret);
+}
+
+/*
+ * Precompute the comb of a fixed base
+ */
+int mpi_comb_init(mpi_comb * C, const mpi * G, size_t ebits,
+		  size_t teeth, const mpi * N, const mpi_mont * M)
+{
+	int ret = 0;
+	size_t i, j, n;
+	t_uint *S, *T, *B;
+	mpi U;
+
+	if (teeth == 0)
+		teeth = MPI_COMB_TEETH;
+
+	if (M->n == 0 || G->s < 0 || ebits == 0 ||
+	    teeth > MPI_COMB_MAX_TEETH)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	mpi_comb_free(C);
+	mpi_init(&U, NULL);
+
+	n = M->n;
+
+	C->n = n;
+	C->teeth = teeth;
+	C->d = (ebits + teeth - 1) / teeth;
+
+	/*
+	 * The table, then G^(2^(i * d)) R for each tooth, B and T
+	 */
+	C->T = (t_uint *) memory_alloc(((1 << teeth) * n) * ciL);
+	S = (t_uint *) memory_alloc(((teeth + 4) * n + 2) * ciL);
+
+	if (C->T == NULL || S == NULL) {
+		ret = TROPICSSL_ERR_MPI_MALLOC_FAILED;
+		goto cleanup;
+	}
+
+	B = S + teeth * n;
+	T = B + n;
+
+	MPI_CHK(mpi_mod_mpi(&U, G, N));
+	memset(B, 0, n * ciL);
+	memcpy(B, U.p, ((U.n < n) ? U.n : n) * ciL);
+
+	mpi_montmul_ct(S, B, M->RR.p, N->p, n, M->mm, T);
+
+	for (i = 1; i < teeth; i++) {
+		memcpy(S + i * n, S + (i - 1) * n, n * ciL);
+
+		for (j = 0; j < C->d; j++)
+			mpi_montsqr_ct(S + i * n, S + i * n, N->p, n,
+				       M->mm, T, NULL);
+	}
+
+	/*
+	 * T[0] = R mod N, T[j] = T[j - top bit] * S[top bit]
+	 */
+	memset(B, 0, n * ciL);
+	B[0] = 1;
+
+	mpi_montmul_ct(C->T, B, M->RR.p, N->p, n, M->mm, T);
+
+	for (i = 0; i < teeth; i++)
+		for (j = 0; j < ((size_t) 1 << i); j++)
+			mpi_montmul_ct(C->T + (j + ((size_t) 1 << i)) * n,
+				       C->T + j * n, S + i * n,
+				       N->p, n, M->mm, T);
+
+cleanup:
+
+	if (S != NULL) {
+		memset(S, 0, ((teeth + 4) * n + 2) * ciL);
+		memory_free(S);
+	}
+
+	if (ret != 0)
+		mpi_comb_free(C);
+
+	mpi_free(&U, NULL);
+
+	return (ret);
+}
+
+/*
+ * Unallocate a comb
+ */
+void mpi_comb_free(mpi_comb * C)
+{
+	if (C->T != NULL) {
+		memset(C->T, 0, ((1 << C->teeth) * C->n) * ciL);
+		memory_free(C->T);
+	}
+
+	memset(C, 0, sizeof(mpi_comb));
+}
+
+/*
+ * V = entry w of the comb, reading all of them; four limbs at a
+ * time, as this is a good part of the work
+ */
+static void mpi_comb_select(t_uint * V, const mpi_comb * C, size_t w)
+{
+	size_t j, k, n = C->n;
+	t_uint m;
+	const t_uint *T;
+
+	memset(V, 0, n * ciL);
+
+	for (k = 0, T = C->T; k < ((size_t) 1 << C->teeth); k++, T += n) {
+		m = (t_uint) 0 - (t_uint) (k == w);
+
+		for (j = 0; j + 4 <= n; j += 4) {
+			V[j] |= T[j] & m;
+			V[j + 1] |= T[j + 1] & m;
+			V[j + 2] |= T[j + 2] & m;
+			V[j + 3] |= T[j + 3] & m;
+		}
+
+		for (; j < n; j++)
+			V[j] |= T[j] & m;
+	}
+}
+
+/*
+ * Fixed-base comb exponentiation: X = G^E mod N
+ */
+int mpi_exp_mod_comb(mpi * X, const mpi * E, const mpi * N,
+		     const mpi_mont * M, const mpi_comb * C)
+{
+	int ret = 0;
+	size_t i, j, n, b, w, size;
+	t_uint *buf, *Y, *V, *T, *K;
+	t_uint local[4 * (MPI_EXP_STACK_BITS / biL) + 2 +
+		     KARATSUBA_SCRATCH(MPI_EXP_STACK_BITS / biL)];
+
+	if (M->n == 0 || C->n != M->n || E->s < 0 ||
+	    mpi_msb(E) > C->teeth * C->d)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	n = M->n;
+
+	/*
+	 * Y, V, T (2n + 2) and K for the squarings
+	 */
+	size = 4 * n + 2 + KARATSUBA_SCRATCH(n);
+
+	if (size <= sizeof(local) / ciL)
+		buf = local;
+	else if ((buf = mpi_alloc_limbs(size, 1)) == NULL)
+		return (TROPICSSL_ERR_MPI_MALLOC_FAILED);
+
+	Y = buf;
+	V = Y + n;
+	T = V + n;
+	K = T + 2 * n + 2;
+
+	/*
+	 * Column i of E is the bits i, i + d, i + 2d, ..., one per
+	 * tooth: square, then multiply by the entry that column picks
+	 */
+	memcpy(Y, C->T, n * ciL);
+
+	for (i = C->d; i > 0; i--) {
+		mpi_montsqr_ct(Y, Y, N->p, n, M->mm, T, K);
+
+		for (j = w = 0; j < C->teeth; j++) {
+			b = j * C->d + i - 1;
+
+			if (b / biL < E->n)
+				w |= ((E->p[b / biL] >> (b % biL)) & 1) << j;
+		}
+
+		mpi_comb_select(V, C, w);
+
+		mpi_montmul_ct(Y, Y, V, N->p, n, M->mm, T);
+	}
+
+	/*
+	 * X = Y * R^-1 mod N
+	 */
+	memset(V, 0, n * ciL);
+	V[0] = 1;
+
+	mpi_montmul_ct(Y, Y, V, N->p, n, M->mm, T);
+
+	MPI_CHK(mpi_grow(X, n));
+	MPI_CHK(mpi_lset(X, 0));
+	memcpy(X->p, Y, n * ciL);
+
+cleanup:
+
+	memset(buf, 0, size * ciL);
+
+	if (buf != local)
+		mpi_free_limbs(buf);
+
+	return (ret);
+}
+
+#if defined(TROPICSSL_HAVE_INT8) || defined(TROPICSSL_HAVE_INT16) || \
+    defined(TROPICSSL_HAVE_INT64)
+
+#define LANES MPI_BATCH_LANES
+
+/*
+ * D = T mod N, for T < 2N of n + 1 lanes: N is subtracted where
+ * T >= N, ie. where there is a top limb or no borrow, choosing by
+ * mask rather than branching
+ */
+static void mpi_mont_sub_lanes(t_uint * D, const t_uint * T, const mpi * N)
+{
+	size_t j, k, n = N->n;
+	t_udbl s;
+	t_uint c[LANES], m[LANES];
+	const t_uint *t;
+
+	for (k = 0; k < LANES; k++)
+		c[k] = 0;
+
+	for (j = 0; j < n; j++) {
+		t = T + j * LANES;
+
+		for (k = 0; k < LANES; k++) {
+			s = (t_udbl) t[k] - N->p[j] - c[k];
+			c[k] = (s >> biL) & 1;
+		}
+	}
+
+	t = T + n * LANES;
+
+	for (k = 0; k < LANES; k++) {
+		m[k] = (t_uint) 0 - (t[k] | (c[k] ^ 1));
+		c[k] = 0;
+	}
+
+	for (j = 0; j < n; j++) {
+		t = T + j * LANES;
+
+		for (k = 0; k < LANES; k++) {
+			s = (t_udbl) t[k] - N->p[j] - c[k];
+			c[k] = (s >> biL) & 1;
+			D[j * LANES + k] = ((t_uint) s & m[k]) | (t[k] & ~m[k]);
+		}
+	}
+}
+
+/*
+ * Lane-interleaved Montgomery multiplication: limb j of lane k is
+ * at [j * LANES + k]. Every lane shares N and goes through the same
+ * steps, so the innermost loops run across the lanes, free of any
+ * dependency between them.
+ *
+ * D = A * B * R^-1 mod N, T being (n + 2) lanes of scratch space;
+ * D may be A or B.
+ */
+static void mpi_montmul_lanes(t_uint * D, const t_uint * A,
+			      const t_uint * B, const mpi * N, t_uint mm,
+			      t_uint * T)
+{
+	size_t i, j, k, n = N->n;
+	t_udbl s, c[LANES];
+	t_uint u[LANES], *t;
+	const t_uint *a, *b;
+
+	memset(T, 0, (n + 2) * LANES * ciL);
+
+	for (i = 0; i < n; i++) {
+		/*
+		 * T = T + A[i] * B
+		 */
+		a = A + i * LANES;
+
+		for (k = 0; k < LANES; k++)
+			c[k] = 0;
+
+		for (j = 0; j < n; j++) {
+			t = T + j * LANES;
+			b = B + j * LANES;
+
+			for (k = 0; k < LANES; k++) {
+				s = (t_udbl) t[k] + (t_udbl) a[k] * b[k] + c[k];
+				t[k] = (t_uint) s;
+				c[k] = s >> biL;
+			}
+		}
+
+		t = T + n * LANES;
+
+		for (k = 0; k < LANES; k++) {
+			s = (t_udbl) t[k] + c[k];
+			t[k] = (t_uint) s;
+			t[k + LANES] = (t_uint) (s >> biL);
+		}
+
+		/*
+		 * T = (T + u * N) / 2^biL, with u = T[0] * mm
+		 */
+		for (k = 0; k < LANES; k++) {
+			u[k] = T[k] * mm;
+			s = (t_udbl) T[k] + (t_udbl) u[k] * N->p[0];
+			c[k] = s >> biL;
+		}
+
+		for (j = 1; j < n; j++) {
+			t = T + j * LANES;
+
+			for (k = 0; k < LANES; k++) {
+				s = (t_udbl) t[k] + (t_udbl) u[k] * N->p[j] + c[k];
+				t[k - LANES] = (t_uint) s;
+				c[k] = s >> biL;
+			}
+		}
+
+		t = T + n * LANES;
+
+		for (k = 0; k < LANES; k++) {
+			s = (t_udbl) t[k] + c[k];
+			t[k - LANES] = (t_uint) s;
+			t[k] = t[k + LANES] + (t_uint) (s >> biL);
+			t[k + LANES] = 0;
+		}
+	}
+
+	mpi_mont_sub_lanes(D, T, N);
+}
+
+/*
+ * Lane-interleaved Montgomery squaring: D = A^2 * R^-1 mod N, as
+ * mpi_sqr_hlp() and the reduction of mpi_montsqr_ct() side by side.
+ * T is 2n + 2 lanes of scratch space here.
+ */
+static void mpi_montsqr_lanes(t_uint * D, const t_uint * A, const mpi * N,
+			      t_uint mm, t_uint * T)
+{
+	size_t i, j, k, n = N->n;
+	t_udbl r;
+	t_uint c[LANES], h[LANES], u[LANES], x0, x1, *t;
+
+	memset(T, 0, (2 * n + 2) * LANES * ciL);
+
+	for (i = 0; i + 1 < n; i++) {
+		for (k = 0; k < LANES; k++)
+			c[k] = 0;
+
+		for (j = i + 1; j < n; j++) {
+			t = T + (i + j) * LANES;
+
+			for (k = 0; k < LANES; k++) {
+				r = (t_udbl) A[i * LANES + k] * A[j * LANES + k] +
+				    t[k] + c[k];
+				t[k] = (t_uint) r;
+				c[k] = (t_uint) (r >> biL);
+			}
+		}
+
+		t = T + (i + n) * LANES;
+
+		for (k = 0; k < LANES; k++)
+			t[k] = c[k];
+	}
+
+	for (k = 0; k < LANES; k++)
+		c[k] = h[k] = 0;
+
+	for (i = 0; i < n; i++) {
+		t = T + 2 * i * LANES;
+
+		for (k = 0; k < LANES; k++) {
+			x0 = t[k];
+			x1 = t[k + LANES];
+
+			r = (t_udbl) A[i * LANES + k] * A[i * LANES + k] +
+			    ((x0 << 1) | h[k]) + c[k];
+			t[k] = (t_uint) r;
+			h[k] = x1 >> (biL - 1);
+
+			r = (r >> biL) + (t_uint) ((x1 << 1) | (x0 >> (biL - 1)));
+			t[k + LANES] = (t_uint) r;
+			c[k] = (t_uint) (r >> biL);
+		}
+	}
+
+	/*
+	 * h now collects the carries out of the top of each row
+	 */
+	for (k = 0; k < LANES; k++)
+		h[k] = 0;
+
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < LANES; k++) {
+			u[k] = T[i * LANES + k] * mm;
+			c[k] = 0;
+		}
+
+		for (j = 0; j < n; j++) {
+			t = T + (i + j) * LANES;
+
+			for (k = 0; k < LANES; k++) {
+				r = (t_udbl) u[k] * N->p[j] + t[k] + c[k];
+				t[k] = (t_uint) r;
+				c[k] = (t_uint) (r >> biL);
+			}
+		}
+
+		t = T + (i + n) * LANES;
+
+		for (k = 0; k < LANES; k++) {
+			r = (t_udbl) t[k] + c[k] + h[k];
+			t[k] = (t_uint) r;
+			h[k] = (t_uint) (r >> biL);
+		}
+	}
+
+	t = T + 2 * n * LANES;
+
+	for (k = 0; k < LANES; k++)
+		t[k] = h[k];
+
+	mpi_mont_sub_lanes(D, T + n * LANES, N);
+}
+
+/*
+ * Fixed-window exponentiation of up to LANES bases at once
+ */
+int mpi_exp_mod_batch(mpi * X, const mpi * A, int count, const mpi * E,
+		      const mpi * N, mpi * _RR)
+{
+	int ret, g, lanes;
+	size_t i, j, k, n, w, wsize, nbits, size;
+	t_uint mm, *buf, *W, *Y, *R2, *T;
+	mpi RR, U;
+
+	if (mpi_cmp_int(N, 0) < 0 || (N->p[0] & 1) == 0)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	if (count <= 0)
+		return (0);
+
+#if defined(MPI_X86)
+	/*
+	 * The x86-64 kernels on one base at a time outrun the portable
+	 * code on all the lanes, so the bases go through them instead
+	 */
+	if (MPI_X86_ADX((mpi_size(N) + ciL - 1) / ciL)) {
+		mpi_mont M;
+
+		memset(&M, 0, sizeof(mpi_mont));
+		ret = mpi_mont_init(&M, N);
+
+		for (g = 0; g < count && ret == 0; g++)
+			ret = mpi_exp_mod_fixed(&X[g], &A[g], E, N, &M);
+
+		mpi_mont_free(&M);
+		return (ret);
+	}
+#endif
+
+	mpi_montg_init(&mm, N);
+	mpi_init(&RR, &U, NULL);
+
+	n = N->n;
+	nbits = mpi_msb(E);
+	wsize = (nbits > 239) ? 5 : (nbits > 79) ? 4 : (nbits > 23) ? 3 : 1;
+
+	/*
+	 * W[0 .. 2^wsize - 1], Y, R2 and T, all of them LANES wide
+	 */
+	size = ((1 << wsize) + 2) * n + (2 * n + 2);
+	buf = (t_uint *) memory_alloc(size * LANES * ciL);
+
+	if (buf == NULL)
+		return (TROPICSSL_ERR_MPI_MALLOC_FAILED);
+
+	memset(buf, 0, size * LANES * ciL);
+
+	W = buf;
+	Y = W + ((size_t) 1 << wsize) * n * LANES;
+	R2 = Y + n * LANES;
+	T = R2 + n * LANES;
+
+	if (_RR == NULL || _RR->p == NULL) {
+		MPI_CHK(mpi_lset(&RR, 1));
+		MPI_CHK(mpi_shift_l(&RR, N->n * 2 * biL));
+		MPI_CHK(mpi_mod_mpi(&RR, &RR, N));
+
+		if (_RR != NULL)
+			memcpy(_RR, &RR, sizeof(mpi));
+	} else
+		memcpy(&RR, _RR, sizeof(mpi));
+
+	for (j = 0; j < n && j < RR.n; j++)
+		for (k = 0; k < LANES; k++)
+			R2[j * LANES + k] = RR.p[j];
+
+	for (g = 0; g < count; g += LANES) {
+		lanes = (count - g < LANES) ? count - g : LANES;
+
+		/*
+		 * W[1] = A * R mod N; unused lanes repeat the last base
+		 */
+		memset(W + n * LANES, 0, n * LANES * ciL);
+
+		for (k = 0; k < LANES; k++) {
+			const mpi *src = &A[g + ((int)k < lanes ? (int)k : lanes - 1)];
+
+			if (mpi_cmp_mpi(src, N) >= 0) {
+				MPI_CHK(mpi_mod_mpi(&U, src, N));
+				src = &U;
+			}
+
+			for (j = 0; j < n && j < src->n; j++)
+				W[(n + j) * LANES + k] = src->p[j];
+		}
+
+		mpi_montmul_lanes(W + n * LANES, W + n * LANES, R2, N, mm, T);
+
+		/*
+		 * W[0] = R mod N, W[i] = W[i - 1] * W[1]
+		 */
+		memset(W, 0, n * LANES * ciL);
+
+		for (k = 0; k < LANES; k++)
+			W[k] = 1;
+
+		mpi_montmul_lanes(W, W, R2, N, mm, T);
+
+		for (i = 2; i < ((size_t) 1 << wsize); i++)
+			mpi_montmul_lanes(W + i * n * LANES,
+					  W + (i - 1) * n * LANES,
+					  W + n * LANES, N, mm, T);
+
+		/*
+		 * Y = A^E R mod N, wsize bits at a time from the top
+		 */
+		memcpy(Y, W, n * LANES * ciL);
+
+		for (i = (nbits + wsize - 1) / wsize * wsize; i > 0; i -= wsize) {
+			for (j = 0; j < wsize; j++)
+				mpi_montsqr_lanes(Y, Y, N, mm, T);
+
+			w = mpi_get_bits(E, i - wsize, wsize);
+
+			mpi_montmul_lanes(Y, Y, W + w * n * LANES, N, mm, T);
+		}
+
+		/*
+		 * X = Y * 1 * R^-1 mod N
+		 */
+		for (k = 0; k < LANES; k++)
+			W[k] = 1;
+
+		memset(W + LANES, 0, (n - 1) * LANES * ciL);
+
+		mpi_montmul_lanes(Y, Y, W, N, mm, T);
+
+		for (k = 0; k < (size_t) lanes; k++) {
+			MPI_CHK(mpi_grow(&X[g + k], n));
+			MPI_CHK(mpi_lset(&X[g + k], 0));
+
+			for (j = 0; j < n; j++)
+				X[g + k].p[j] = Y[j * LANES + k];
+		}
+	}
+
+cleanup:
+
+	memset(buf, 0, size * LANES * ciL);
+	memory_free(buf);
+
+	mpi_free(&U, NULL);
+	if (_RR == NULL)
+		mpi_free(&RR, NULL);
+
+	return (ret);
+}
+
+#undef LANES
+
+#else
+
+/*
+ * Without a double-width type, the bases simply go one at a time
+ */
+int mpi_exp_mod_batch(mpi * X, const mpi * A, int count, const mpi * E,
+		      const mpi * N, mpi * _RR)
+{
+	int ret = 0, i;
+
+	for (i = 0; i < count && ret == 0; i++)
+		ret = mpi_exp_mod(&X[i], &A[i], E, N, _RR);
+
+	return (ret);
+}
+
+#endif
+
+/*
+ * Greatest common divisor: G = gcd(A, B)  (HAC 14.54)
+ */
+int mpi_gcd(mpi * G, const mpi * A, const mpi * B)
+{
+	int ret;
+	size_t lz, lzt;
+	mpi TG, TA, TB;
+
+	mpi_init_tmp(&TG, &TA, &TB, NULL);
+
+	MPI_CHK(mpi_copy(&TA, A));
+	MPI_CHK(mpi_copy(&TB, B));
+
+	lz = mpi_lsb(&TA);
+	lzt = mpi_lsb(&TB);
+
+	if (lzt < lz)
+		lz = lzt;
+
+	MPI_CHK(mpi_shift_r(&TA, lz));
+	MPI_CHK(mpi_shift_r(&TB, lz));
+
+	TA.s = TB.s = 1;
+
+	while (mpi_cmp_int(&TA, 0) != 0) {
+		MPI_CHK(mpi_shift_r(&TA, mpi_lsb(&TA)));
+		MPI_CHK(mpi_shift_r(&TB, mpi_lsb(&TB)));
+
+		if (mpi_cmp_mpi(&TA, &TB) >= 0) {
+			MPI_CHK(mpi_sub_abs(&TA, &TA, &TB));
+			MPI_CHK(mpi_shift_r(&TA, 1));
+		} else {
+			MPI_CHK(mpi_sub_abs(&TB, &TB, &TA));
+			MPI_CHK(mpi_shift_r(&TB, 1));
+		}
+	}
+
+	MPI_CHK(mpi_shift_l(&TB, lz));
+	MPI_CHK(mpi_copy(G, &TB));
+
+cleanup:
+
+	mpi_free(&TB, &TA, &TG, NULL);
+
+	return (ret);
+}
+
+int mpi_fill_random(mpi * X, size_t size,
+		    int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+    int ret;
+
+    MPI_CHK(mpi_grow(X, size));
+    MPI_CHK(mpi_lset(X, 0));
+
+    /*
+     * All limbs in one request: the byte order does not matter
+     */
+    MPI_CHK(f_rng(p_rng, (uint8_t *) X->p, X->n * ciL));
+
+cleanup:
+    return (ret);
+}
+
+/*
+ * Modular inverse: X = A^-1 mod N	(HAC 14.61 / 14.64)
+ */
+int mpi_inv_mod(mpi * X, const mpi * A, const mpi * N)
+{
+	int ret;
+	mpi G, TA, TU, U1, U2, TB, TV, V1, V2;
+
+	if (mpi_cmp_int(N, 0) <= 0)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	mpi_init_tmp(&TA, &TU, &U1, &U2, &G, &TB, &TV, &V1, &V2, NULL);
+
+	MPI_CHK(mpi_gcd(&G, A, N));
+
+	if (mpi_cmp_int(&G, 1) != 0) {
+		ret = TROPICSSL_ERR_MPI_NOT_ACCEPTABLE;
+		goto cleanup;
+	}
+
+	MPI_CHK(mpi_mod_mpi(&TA, A, N));
+	MPI_CHK(mpi_copy(&TU, &TA));
+	MPI_CHK(mpi_copy(&TB, N));
+	MPI_CHK(mpi_copy(&TV, N));
+
+	MPI_CHK(mpi_lset(&U1, 1));
+	MPI_CHK(mpi_lset(&U2, 0));
+	MPI_CHK(mpi_lset(&V1, 0));
+	MPI_CHK(mpi_lset(&V2, 1));
+
+	do {
+		while ((TU.p[0] & 1) == 0) {
+			MPI_CHK(mpi_shift_r(&TU, 1));
+
+			if ((U1.p[0] & 1) != 0 || (U2.p[0] & 1) != 0) {
+				MPI_CHK(mpi_add_mpi(&U1, &U1, &TB));
+				MPI_CHK(mpi_sub_mpi(&U2, &U2, &TA));
+			}
+
+			MPI_CHK(mpi_shift_r(&U1, 1));
+			MPI_CHK(mpi_shift_r(&U2, 1));
+		}
+
+		while ((TV.p[0] & 1) == 0) {
+			MPI_CHK(mpi_shift_r(&TV, 1));
+
+			if ((V1.p[0] & 1) != 0 || (V2.p[0] & 1) != 0) {
+				MPI_CHK(mpi_add_mpi(&V1, &V1, &TB));
+				MPI_CHK(mpi_sub_mpi(&V2, &V2, &TA));
+			}
+
+			MPI_CHK(mpi_shift_r(&V1, 1));
+			MPI_CHK(mpi_shift_r(&V2, 1));
+		}
+
+		if (mpi_cmp_mpi(&TU, &TV) >= 0) {
+			MPI_CHK(mpi_sub_mpi(&TU, &TU, &TV));
+			MPI_CHK(mpi_sub_mpi(&U1, &U1, &V1));
+			MPI_CHK(mpi_sub_mpi(&U2, &U2, &V2));
+		} else {
+			MPI_CHK(mpi_sub_mpi(&TV, &TV, &TU));
+			MPI_CHK(mpi_sub_mpi(&V1, &V1, &U1));
+			MPI_CHK(mpi_sub_mpi(&V2, &V2, &U2));
+		}
+	} while (mpi_cmp_int(&TU, 0) != 0);
+
+	while (mpi_cmp_int(&V1, 0) < 0)
+		MPI_CHK(mpi_add_mpi(&V1, &V1, N));
+
+	while (mpi_cmp_mpi(&V1, N) >= 0)
+		MPI_CHK(mpi_sub_mpi(&V1, &V1, N));
+
+	MPI_CHK(mpi_copy(X, &V1));
+
+cleanup:
+
+	mpi_free(&V2, &V1, &TV, &TB, &G, &U2, &U1, &TU, &TA, NULL);
+
+	return (ret);
+}
+
+#if defined(TROPICSSL_GENPRIME)
+
+/*
+ * mpi_gen_prime() crosses out the multiples of the MPI_SIEVE_PRIMES
+ * odd primes below MPI_SIEVE_LIMIT from windows of MPI_SIEVE_WINDOW
+ * candidates, for primes of more than MPI_SIEVE_MIN_BITS
+ */
+#define MPI_SIEVE_LIMIT		16384
+#define MPI_SIEVE_PRIMES	1899
+#define MPI_SIEVE_WINDOW	4096
+#define MPI_SIEVE_MIN_BITS	16
+
+static const int small_prime[] = {
+	3, 5, 7, 11, 13, 17, 19, 23,
+	29, 31, 37, 41, 43, 47, 53, 59,
+	61, 67, 71, 73, 79, 83, 89, 97,
+	101, 103, 107, 109, 113, 127, 131, 137,
+	139, 149, 151, 157, 163, 167, 173, 179,
+	181, 191, 193, 197, 199, 211, 223, 227,
+	229, 233, 239, 241, 251, 257, 263, 269,
+	271, 277, 281, 283, 293, 307, 311, 313,
+	317, 331, 337, 347, 349, 353, 359, 367,
+	373, 379, 383, 389, 397, 401, 409, 419,
+	421, 431, 433, 439, 443, 449, 457, 461,
+	463, 467, 479, 487, 491, 499, 503, 509,
+	521, 523, 541, 547, 557, 563, 569, 571,
+	577, 587, 593, 599, 601, 607, 613, 617,
+	619, 631, 641, 643, 647, 653, 659, 661,
+	673, 677, 683, 691, 701, 709, 719, 727,
+	733, 739, 743, 751, 757, 761, 769, 773,
+	787, 797, 809, 811, 821, 823, 827, 829,
+	839, 853, 857, 859, 863, 877, 881, 883,
+	887, 907, 911, 919, 929, 937, 941, 947,
+	953, 967, 971, 977, 983, 991, 997, -103
+};
+
+/*
+ * Miller-Rabin rounds (HAC 4.24), for an odd X > 3 that trial
+ * division has already been through
+ */
+static int mpi_miller_rabin(mpi * X,
+			    int (*f_rng) (void *, uint8_t *, size_t),
+			    void *p_rng)
+{
+	int ret = 0;
+	size_t i, j, n, s;
+	mpi W, R, T, A, RR;
+
+	mpi_init(&W, &R, &T, &A, &RR, NULL);
+
+	/*
+	 * W = |X| - 1
+	 * R = W >> lsb(W)
+	 */
+	MPI_CHK(mpi_sub_int(&W, X, 1));
+	s = mpi_lsb(&W);
+	MPI_CHK(mpi_copy(&R, &W));
+	MPI_CHK(mpi_shift_r(&R, s));
+
+	i = mpi_msb(X);
 	/*
 	 * HAC, table 4.4
 	 */
@@ -1713,7 +3372,7 @@ int mpi_is_prime(mpi * X, int (*f_rng) (void *), void *p_rng)
 		/*
 		 * pick a random A, 1 < A < |X| - 1
 		 */
-		mpi_fill_random(&A, X->n, f_rng, p_rng);
+		MPI_CHK(mpi_fill_random(&A, X->n, f_rng, p_rng));
 
 		if (mpi_cmp_mpi(&A, &W) >= 0) {
 		    j = mpi_msb(&A) - mpi_msb(&W);
@@ -1727,62 +3386,151 @@ int mpi_is_prime(mpi * X, int (*f_rng) (void *), void *p_rng)
 		 */
 		MPI_CHK(mpi_exp_mod(&A, &A, &R, X, &RR));
 
-		if (mpi_cmp_mpi(&A, &W) == 0 || mpi_cmp_int(&A, 1) == 0)
-			continue;
+		if (mpi_cmp_mpi(&A, &W) == 0 || mpi_cmp_int(&A, 1) == 0)
+			continue;
+
+		j = 1;
+		while (j < s && mpi_cmp_mpi(&A, &W) != 0) {
+			/*
+			 * A = A * A mod |X|
+			 */
+			MPI_CHK(mpi_mul_mpi(&T, &A, &A));
+			MPI_CHK(mpi_mod_mpi(&A, &T, X));
+
+			if (mpi_cmp_int(&A, 1) == 0)
+				break;
+
+			j++;
+		}
+
+		/*
+		 * not prime if A != |X| - 1 or A == 1
+		 */
+		if (mpi_cmp_mpi(&A, &W) != 0 || mpi_cmp_int(&A, 1) == 0) {
+			ret = TROPICSSL_ERR_MPI_NOT_ACCEPTABLE;
+			break;
+		}
+	}
+
+cleanup:
+
+	mpi_free(&RR, &A, &T, &R, &W, NULL);
+
+	return (ret);
+}
+
+/*
+ * Miller-Rabin primality test, after trial division
+ */
+int mpi_is_prime(mpi * X, int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	int ret, xs;
+	size_t i;
+
+	if (mpi_cmp_int(X, 0) == 0 || mpi_cmp_int(X, 1) == 0) {
+		return (TROPICSSL_ERR_MPI_NOT_ACCEPTABLE);
+	}
+
+	if (mpi_cmp_int(X, 2) == 0) {
+		return (TROPICSSL_ERR_OKAY);
+	}
+
+	xs = X->s;
+	X->s = 1;
 
-		j = 1;
-		while (j < s && mpi_cmp_mpi(&A, &W) != 0) {
-			/*
-			 * A = A * A mod |X|
-			 */
-			MPI_CHK(mpi_mul_mpi(&T, &A, &A));
-			MPI_CHK(mpi_mod_mpi(&A, &T, X));
+	/*
+	 * test trivial factors first
+	 */
+	if ((X->p[0] & 1) == 0) {
+		ret = TROPICSSL_ERR_MPI_NOT_ACCEPTABLE;
+		goto cleanup;
+	}
 
-			if (mpi_cmp_int(&A, 1) == 0)
-				break;
+	for (i = 0; small_prime[i] > 0; i++) {
+		t_uint r;
 
-			j++;
+		if (mpi_cmp_int(X, small_prime[i]) <= 0) {
+			ret = TROPICSSL_ERR_OKAY;
+			goto cleanup;
 		}
 
-		/*
-		 * not prime if A != |X| - 1 or A == 1
-		 */
-		if (mpi_cmp_mpi(&A, &W) != 0 || mpi_cmp_int(&A, 1) == 0) {
+		MPI_CHK(mpi_mod_int(&r, X, small_prime[i]));
+
+		if (r == 0) {
 			ret = TROPICSSL_ERR_MPI_NOT_ACCEPTABLE;
-			break;
+			goto cleanup;
 		}
 	}
 
+	ret = mpi_miller_rabin(X, f_rng, p_rng);
+
 cleanup:
 
 	X->s = xs;
 
-	mpi_free(&RR, &A, &T, &R, &W, NULL);
-
 	return (ret);
 }
 
 /*
- * Prime number generation
+ * Odd primes below MPI_SIEVE_LIMIT, by the sieve of Eratosthenes
  */
-int mpi_gen_prime(mpi * X, size_t nbits, int dh_flag,
-		  int (*f_rng) (void *), void *p_rng)
+static size_t mpi_sieve_primes(uint16_t *prime)
+{
+	size_t i, j, n = 0;
+	uint8_t comp[MPI_SIEVE_LIMIT / 2];
+
+	memset(comp, 0, sizeof(comp));
+
+	/*
+	 * comp[i] stands for 2i + 1
+	 */
+	for (i = 1; i < MPI_SIEVE_LIMIT / 2; i++) {
+		if (comp[i] != 0)
+			continue;
+
+		prime[n++] = (uint16_t) (2 * i + 1);
+
+		for (j = 2 * i * (i + 1); j < MPI_SIEVE_LIMIT / 2; j += 2 * i + 1)
+			comp[j] = 1;
+	}
+
+	return (n);
+}
+
+/*
+ * Search for a prime from a random start, MPI_SIEVE_WINDOW candidates
+ * at a time: the residues of the window's start modulo the sieve
+ * primes are kept up to date by addition, and the multiples of each
+ * prime crossed out of the window, so that only the survivors go
+ * through Miller-Rabin. With dh_flag, candidates step by 4 so that
+ * (X - 1) / 2 stays odd, and X = 1 mod p is crossed out as well,
+ * that being where p divides (X - 1) / 2. The search gives up with
+ * TROPICSSL_ERR_MPI_NOT_ACCEPTABLE once f_stop(p_rng), if given, says so.
+ */
+static int mpi_gen_prime_hlp(mpi * X, size_t nbits, int dh_flag,
+			     int (*f_rng) (void *, uint8_t *, size_t),
+			     void *p_rng,
+			     int (*f_stop) (void *))
 {
 	int ret;
-	size_t k, n;
-	mpi Y;
+	size_t i, j, k, n, np;
+	t_uint r;
+	unsigned long p, inv, step, adv;
+	uint16_t prime[MPI_SIEVE_PRIMES], rem[MPI_SIEVE_PRIMES];
+	uint8_t sieve[MPI_SIEVE_WINDOW];
+	mpi C, Y;
 
 	if (nbits < 3)
 		return (TROPICSSL_ERR_BAD_ARG);
 
-	mpi_init(&Y, NULL);
+	mpi_init(&C, &Y, NULL);
 
 	n = BITS_TO_LIMBS(nbits);
 
 	MPI_CHK(mpi_grow(X, n));
 	MPI_CHK(mpi_lset(X, 0));
 
-	mpi_fill_random(X, n, f_rng, p_rng);
+	MPI_CHK(mpi_fill_random(X, n, f_rng, p_rng));
 
 	k = mpi_msb(X);
 	if (k < nbits)
@@ -1792,42 +3540,264 @@ int mpi_gen_prime(mpi * X, size_t nbits, int dh_flag,
 
 	X->p[0] |= 3;
 
-	if (dh_flag == 0) {
-		while ((ret = mpi_is_prime(X, f_rng, p_rng)) != 0) {
-			if (ret != TROPICSSL_ERR_MPI_NOT_ACCEPTABLE)
-				goto cleanup;
+	/*
+	 * Below this, candidates could be sieve primes themselves
+	 */
+	if (nbits <= MPI_SIEVE_MIN_BITS) {
+		if (dh_flag == 0) {
+			while ((ret = mpi_is_prime(X, f_rng, p_rng)) != 0) {
+				if (ret != TROPICSSL_ERR_MPI_NOT_ACCEPTABLE)
+					goto cleanup;
 
-			MPI_CHK(mpi_add_int(X, X, 2));
-		}
-	} else {
-		MPI_CHK(mpi_sub_int(&Y, X, 1));
-		MPI_CHK(mpi_shift_r(&Y, 1));
+				MPI_CHK(mpi_add_int(X, X, 2));
+			}
+		} else {
+			MPI_CHK(mpi_sub_int(&Y, X, 1));
+			MPI_CHK(mpi_shift_r(&Y, 1));
 
-		while (1) {
-			if ((ret = mpi_is_prime(X, f_rng, p_rng)) == 0) {
-				if ((ret = mpi_is_prime(&Y, f_rng, p_rng)) == 0)
-					break;
+			while (1) {
+				if ((ret = mpi_is_prime(X, f_rng, p_rng)) == 0) {
+					if ((ret = mpi_is_prime(&Y, f_rng, p_rng)) == 0)
+						break;
+
+					if (ret != TROPICSSL_ERR_MPI_NOT_ACCEPTABLE)
+						goto cleanup;
+				}
 
 				if (ret != TROPICSSL_ERR_MPI_NOT_ACCEPTABLE)
 					goto cleanup;
+
+				MPI_CHK(mpi_add_int(&Y, X, 1));
+				MPI_CHK(mpi_add_int(X, X, 2));
+				MPI_CHK(mpi_shift_r(&Y, 1));
 			}
+		}
 
-			if (ret != TROPICSSL_ERR_MPI_NOT_ACCEPTABLE)
+		goto cleanup;
+	}
+
+	np = mpi_sieve_primes(prime);
+	step = (dh_flag != 0) ? 4 : 2;
+
+	for (i = 0; i < np; i++) {
+		MPI_CHK(mpi_mod_int(&r, X, prime[i]));
+		rem[i] = (uint16_t) r;
+	}
+
+	while (1) {
+		memset(sieve, 0, sizeof(sieve));
+
+		for (i = 0; i < np; i++) {
+			/*
+			 * X + step * j = 0 mod p for j = -rem / step mod p
+			 */
+			p = prime[i];
+			inv = (p + 1) / 2;
+			if (step == 4)
+				inv = inv * inv % p;
+
+			for (j = (p - rem[i]) * inv % p; j < MPI_SIEVE_WINDOW; j += p)
+				sieve[j] = 1;
+
+			if (dh_flag != 0)
+				for (j = (p + 1 - rem[i]) * inv % p;
+				     j < MPI_SIEVE_WINDOW; j += p)
+					sieve[j] = 1;
+		}
+
+		for (j = 0; j < MPI_SIEVE_WINDOW; j++) {
+			if (f_stop != NULL && f_stop(p_rng) != 0) {
+				ret = TROPICSSL_ERR_MPI_NOT_ACCEPTABLE;
 				goto cleanup;
+			}
 
-			MPI_CHK(mpi_add_int(&Y, X, 1));
-			MPI_CHK(mpi_add_int(X, X, 2));
-			MPI_CHK(mpi_shift_r(&Y, 1));
+			if (sieve[j] != 0)
+				continue;
+
+			MPI_CHK(mpi_add_int(&C, X, (t_sint) (step * j)));
+
+			ret = mpi_miller_rabin(&C, f_rng, p_rng);
+
+			if (ret == 0 && dh_flag != 0) {
+				MPI_CHK(mpi_copy(&Y, &C));
+				MPI_CHK(mpi_shift_r(&Y, 1));
+				ret = mpi_miller_rabin(&Y, f_rng, p_rng);
+			}
+
+			if (ret == 0) {
+				MPI_CHK(mpi_copy(X, &C));
+				goto cleanup;
+			}
+
+			if (ret != TROPICSSL_ERR_MPI_NOT_ACCEPTABLE)
+				goto cleanup;
 		}
+
+		/*
+		 * On to the next window
+		 */
+		adv = step * MPI_SIEVE_WINDOW;
+		MPI_CHK(mpi_add_int(X, X, (t_sint) adv));
+
+		for (i = 0; i < np; i++)
+			rem[i] = (uint16_t) ((rem[i] + adv % prime[i]) % prime[i]);
 	}
 
 cleanup:
 
-	mpi_free(&Y, NULL);
+	mpi_free(&Y, &C, NULL);
+
+	return (ret);
+}
+
+/*
+ * Prime number generation
+ */
+int mpi_gen_prime(mpi * X, size_t nbits, int dh_flag,
+		  int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	return (mpi_gen_prime_hlp(X, nbits, dh_flag, f_rng, p_rng, NULL));
+}
+
+#if defined(TROPICSSL_GENPRIME_MT) && !defined(WIN32)
+
+/*
+ * State shared by the threads of mpi_gen_prime_mt()
+ */
+typedef struct {
+	pthread_mutex_t lock;	/* for the RNG and what follows */
+	int (*f_rng) (void *, uint8_t *, size_t);
+	void *p_rng;
+	size_t nbits;
+	int dh_flag;
+	int done;		/* a prime was found, or an error */
+	int ret;
+	mpi P;
+} mpi_prime_search;
+
+/*
+ * The caller's RNG, one request at a time
+ */
+static int mpi_prime_rng(void *arg, uint8_t *output, size_t len)
+{
+	int r;
+	mpi_prime_search *s = (mpi_prime_search *) arg;
+
+	pthread_mutex_lock(&s->lock);
+	r = s->f_rng(s->p_rng, output, len);
+	pthread_mutex_unlock(&s->lock);
+
+	return (r);
+}
+
+/*
+ * Whether another thread is done already
+ */
+static int mpi_prime_stop(void *arg)
+{
+	int done;
+	mpi_prime_search *s = (mpi_prime_search *) arg;
+
+	pthread_mutex_lock(&s->lock);
+	done = s->done;
+	pthread_mutex_unlock(&s->lock);
+
+	return (done);
+}
+
+/*
+ * One search, from a start of its own; the first to succeed
+ * (or fail) stops the others
+ */
+static void *mpi_prime_thread(void *arg)
+{
+	int ret;
+	mpi P;
+	mpi_prime_search *s = (mpi_prime_search *) arg;
+
+	mpi_init(&P, NULL);
+
+	ret = mpi_gen_prime_hlp(&P, s->nbits, s->dh_flag,
+				mpi_prime_rng, s, mpi_prime_stop);
+
+	pthread_mutex_lock(&s->lock);
+
+	if (s->done == 0) {
+		if (ret == 0)
+			mpi_swap(&s->P, &P);
+
+		s->ret = ret;
+		s->done = 1;
+	}
+
+	pthread_mutex_unlock(&s->lock);
+
+	mpi_free(&P, NULL);
+
+	return (NULL);
+}
+
+/*
+ * Prime number generation on several threads
+ */
+int mpi_gen_prime_mt(mpi * X, size_t nbits, int dh_flag, int threads,
+		     int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	int ret, i, n;
+	pthread_t tid[MPI_GEN_PRIME_MAX_THREADS];
+	mpi_prime_search s;
+
+	if (threads > MPI_GEN_PRIME_MAX_THREADS)
+		threads = MPI_GEN_PRIME_MAX_THREADS;
+
+	if (threads <= 1 || nbits <= MPI_SIEVE_MIN_BITS)
+		return (mpi_gen_prime(X, nbits, dh_flag, f_rng, p_rng));
+
+	memset(&s, 0, sizeof(s));
+	pthread_mutex_init(&s.lock, NULL);
+	mpi_init(&s.P, NULL);
+
+	s.f_rng = f_rng;
+	s.p_rng = p_rng;
+	s.nbits = nbits;
+	s.dh_flag = dh_flag;
+
+	for (n = 0; n < threads; n++)
+		if (pthread_create(&tid[n], NULL, mpi_prime_thread, &s) != 0)
+			break;
+
+	for (i = 0; i < n; i++)
+		pthread_join(tid[i], NULL);
+
+	pthread_mutex_destroy(&s.lock);
+
+	/*
+	 * Not a single thread: do it here
+	 */
+	if (n == 0)
+		ret = mpi_gen_prime(X, nbits, dh_flag, f_rng, p_rng);
+	else if ((ret = s.ret) == 0)
+		ret = mpi_copy(X, &s.P);
+
+	mpi_free(&s.P, NULL);
 
 	return (ret);
 }
 
+#else
+
+/*
+ * Without threads, the search simply runs here
+ */
+int mpi_gen_prime_mt(mpi * X, size_t nbits, int dh_flag, int threads,
+		     int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	(void) threads;
+	return (mpi_gen_prime(X, nbits, dh_flag, f_rng, p_rng));
+}
+
+#endif
+
 #endif
 
 #if defined(TROPICSSL_SELF_TEST)
@@ -1840,15 +3810,100 @@ static const int gcd_pairs[GCD_PAIR_COUNT][3] = {
 	{768454923, 542167814, 1}
 };
 
+#if defined(TROPICSSL_GENPRIME) || defined(MPI_FIXED)
+static int mpi_self_test_rng(void *p_rng, uint8_t *output, size_t len)
+{
+	(void) p_rng;
+
+	while (len-- > 0)
+		*output++ = (uint8_t)rand();
+
+	return (0);
+}
+#endif
+
+#if defined(MPI_FIXED)
+/*
+ * Check each fixed-width kernel against D * R = A * B mod N, on
+ * random operands
+ */
+static int mpi_self_test_fixed(void)
+{
+	int ret, k;
+	size_t n;
+	mpi A, B, N, X, Y;
+	t_uint mm, D[4096 / biL], T[2 * (4096 / biL) + 2];
+
+	mpi_init(&A, &B, &N, &X, &Y, NULL);
+
+	for (k = 1; k <= 4; k++) {
+		n = k * 1024 / biL;
+
+		MPI_CHK(mpi_fill_random(&N, n, mpi_self_test_rng, NULL));
+		N.p[0] |= 1;
+		N.p[n - 1] |= (t_uint) 1 << (biL - 1);
+		mpi_montg_init(&mm, &N);
+
+		MPI_CHK(mpi_fill_random(&A, n, mpi_self_test_rng, NULL));
+		MPI_CHK(mpi_fill_random(&B, n, mpi_self_test_rng, NULL));
+		MPI_CHK(mpi_mod_mpi(&A, &A, &N));
+		MPI_CHK(mpi_mod_mpi(&B, &B, &N));
+		MPI_CHK(mpi_grow(&A, n));
+		MPI_CHK(mpi_grow(&B, n));
+
+		/*
+		 * Product, then square
+		 */
+		MPI_CHK(mpi_mul_mpi(&Y, &A, &B));
+		mpi_mont_fixed(D, A.p, B.p, N.p, n, mm, T);
+
+		for (;;) {
+			MPI_CHK(mpi_mod_mpi(&Y, &Y, &N));
+
+			MPI_CHK(mpi_grow(&X, n));
+			MPI_CHK(mpi_lset(&X, 0));
+			memcpy(X.p, D, n * ciL);
+			MPI_CHK(mpi_shift_l(&X, n * biL));
+			MPI_CHK(mpi_mod_mpi(&X, &X, &N));
+
+			if (mpi_cmp_mpi(&X, &Y) != 0) {
+				ret = 1;
+				goto cleanup;
+			}
+
+			if (B.p == NULL)
+				break;
+
+			mpi_free(&B, NULL);
+			MPI_CHK(mpi_mul_mpi(&Y, &A, &A));
+			mpi_mont_fixed(D, A.p, NULL, N.p, n, mm, T);
+		}
+	}
+
+cleanup:
+
+	mpi_free(&Y, &X, &N, &B, &A, NULL);
+
+	return (ret);
+}
+#endif
+
 /*
  * Checkup routine
  */
 int mpi_self_test(int verbose)
 {
 	int ret, i;
+	size_t used = 0;
 	mpi A, E, N, X, Y, U, V;
+	mpi_mont M;
+	mpi_comb C;
+	mpi_scratch S;
+	t_uint wsbuf[512];
 
 	mpi_init(&A, &E, &N, &X, &Y, &U, &V, NULL);
+	memset(&M, 0, sizeof(mpi_mont));
+	memset(&C, 0, sizeof(mpi_comb));
 
 	MPI_CHK(mpi_read_string(&A, 16,
 				"EFE021C2645FD1DC586E69184AF4A31E"
@@ -1975,11 +4030,102 @@ int mpi_self_test(int verbose)
 	if (verbose != 0)
 		printf("passed\n");
 
+#if defined(TROPICSSL_GENPRIME)
+	if (verbose != 0)
+		printf("  MPI test #6 (gen_prime): ");
+
+	MPI_CHK(mpi_gen_prime(&X, 256, 0, mpi_self_test_rng, NULL));
+	MPI_CHK(mpi_gen_prime_mt(&Y, 160, 1, 2, mpi_self_test_rng, NULL));
+	MPI_CHK(mpi_copy(&A, &Y));
+	MPI_CHK(mpi_shift_r(&A, 1));
+
+	if (mpi_msb(&X) != 256 || mpi_msb(&Y) != 160 ||
+	    mpi_is_prime(&X, mpi_self_test_rng, NULL) != 0 ||
+	    mpi_is_prime(&Y, mpi_self_test_rng, NULL) != 0 ||
+	    mpi_is_prime(&A, mpi_self_test_rng, NULL) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+#endif
+
+	if (verbose != 0)
+		printf("  MPI test #7 (exp_mod_comb): ");
+
+	MPI_CHK(mpi_lset(&A, 2));
+	MPI_CHK(mpi_mont_init(&M, &N));
+
+	for (i = 1; i <= MPI_COMB_MAX_TEETH; i += 3) {
+		MPI_CHK(mpi_comb_init(&C, &A, mpi_msb(&E), i, &N, &M));
+		MPI_CHK(mpi_exp_mod_comb(&X, &E, &N, &M, &C));
+		MPI_CHK(mpi_exp_mod(&Y, &A, &E, &N, NULL));
+
+		if (mpi_cmp_mpi(&X, &Y) != 0) {
+			if (verbose != 0)
+				printf("failed at %d\n", i);
+
+			return (1);
+		}
+	}
+
+	if (verbose != 0)
+		printf("passed\n  MPI test #8 (workspace): ");
+
+	/*
+	 * Once warmed up, temporaries only recycle workspace blocks
+	 */
+	mpi_scratch_init(&S, wsbuf, sizeof(wsbuf) / ciL);
+	mpi_set_scratch(&S);
+
+	for (i = 0; i < 3; i++) {
+		if (i == 1)
+			used = S.used;
+
+		MPI_CHK(mpi_exp_mod(&X, &A, &E, &N, NULL));
+		MPI_CHK(mpi_mul_mpi(&U, &X, &E));
+		MPI_CHK(mpi_mod_mpi(&V, &U, &N));
+	}
+
+	mpi_set_scratch(NULL);
+
+	if (mpi_cmp_mpi(&X, &Y) != 0 || S.used != used || S.spills != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+
+#if defined(MPI_FIXED)
+	if (verbose != 0)
+		printf("  MPI test #9 (fixed kernels): ");
+
+	if (mpi_self_test_fixed() != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+#endif
+
 cleanup:
 
+	mpi_set_scratch(NULL);
+
 	if (ret != 0 && verbose != 0)
 		printf("Unexpected error, return code = %08X\n", ret);
 
+	mpi_comb_free(&C);
+	mpi_mont_free(&M);
 	mpi_free(&V, &U, &Y, &X, &N, &E, &A, NULL);
 
 	if (verbose != 0)
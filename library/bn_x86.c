@@ -0,0 +1,512 @@
+/*
+ *  x86-64 bignum kernels: MULX/ADCX/ADOX and AVX-512 IFMA
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  MULX and ADCX/ADOX came with Broadwell; the two carry flags let a
+ *  row of multiply-accumulates run without the extra adc chain. IFMA
+ *  (vpmadd52luq/vpmadd52huq) multiplies eight 52-bit digits at once;
+ *  the Montgomery multiplication in that radix follows:
+ *
+ *  S. Gueron, V. Krasnov, "Accelerating Big Integer Arithmetic Using
+ *  Intel IFMA Extensions", ARITH 2016
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_BN_X86)
+
+#include "tropicssl/bn_x86.h"
+
+#if defined(TROPICSSL_HAVE_X86_64)
+
+#include <cpuid.h>
+#include <string.h>
+#include <immintrin.h>
+
+/*
+ * As for AES-NI, each kernel is compiled for what it uses, and only
+ * reached after bn_x86_supports() said so.
+ */
+#define BN_ADX_TARGET   __attribute__((target("bmi2,adx")))
+#define BN_IFMA_TARGET  __attribute__((target("avx512f,avx512ifma")))
+
+#define BN_X86_MAX_WORDS        (BN_X86_MAX_LIMBS / 2)
+
+/*
+ * Bignum instruction set detection routine
+ */
+int bn_x86_supports(unsigned int what)
+{
+	static int done = 0;
+	static unsigned int flags = 0;
+
+	if (done == 0) {
+		unsigned int a, b, c, d, xlo, xhi;
+
+		if (__get_cpuid_count(7, 0, &a, &b, &c, &d) != 0) {
+			if ((b & (1u << 8)) != 0 && (b & (1u << 19)) != 0)
+				flags |= TROPICSSL_BN_X86_ADX;
+
+			/*
+			 * AVX-512 also needs the OS to save the opmask and
+			 * ZMM state (XCR0 bits 1, 2, 5, 6 and 7)
+			 */
+			if ((b & (1u << 16)) != 0 && (b & (1u << 21)) != 0 &&
+			    __get_cpuid(1, &a, &b, &c, &d) != 0 &&
+			    (c & (1u << 27)) != 0) {
+				__asm__("xgetbv" : "=a"(xlo), "=d"(xhi) : "c"(0));
+
+				if ((xlo & 0xE6) == 0xE6)
+					flags |= TROPICSSL_BN_X86_IFMA;
+			}
+		}
+
+		done = 1;
+	}
+
+	return ((flags & what) != 0);
+}
+
+/*
+ * 64-bit word i of an array of 32-bit limbs
+ */
+static inline uint64_t ld64(const uint32_t *p, size_t i)
+{
+	uint64_t w;
+
+	memcpy(&w, p + 2 * i, sizeof(w));
+	return (w);
+}
+
+static inline void st64(uint32_t *p, size_t i, uint64_t w)
+{
+	memcpy(p + 2 * i, &w, sizeof(w));
+}
+
+/*
+ * -N^-1 mod 2^64, by Newton iteration from the 3 bits of n0^-1 mod 8
+ * that n0 itself provides
+ */
+static uint64_t bn_x86_montg_init(uint64_t n0)
+{
+	uint64_t x = n0;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		x *= 2 - n0 * x;
+
+	return (~x + 1);
+}
+
+/*
+ * out[0 .. len - 1] = in[0 .. len - 1] + x * b[0 .. len - 1], returning
+ * the carry word; len > 0. The low halves of the products go through
+ * the CF chain (adcx) and the high halves through the OF chain (adox),
+ * and the loop itself touches neither flag (lea, jrcxz). out may be in
+ * or one word below it.
+ */
+BN_ADX_TARGET
+static uint64_t adx_row(uint64_t *out, const uint64_t *in,
+			const uint64_t *b, size_t len, uint64_t x)
+{
+	uint64_t c, lo, hi;
+
+	__asm__ volatile("xor   %k[c], %k[c]            \n\t"
+			 "1:                            \n\t"
+			 "mulx  (%[b]), %[lo], %[hi]    \n\t"
+			 "adcx  (%[in]), %[lo]          \n\t"
+			 "adox  %[c], %[lo]             \n\t"
+			 "mov   %[lo], (%[out])         \n\t"
+			 "mov   %[hi], %[c]             \n\t"
+			 "lea   8(%[b]), %[b]           \n\t"
+			 "lea   8(%[in]), %[in]         \n\t"
+			 "lea   8(%[out]), %[out]       \n\t"
+			 "lea   -1(%[len]), %[len]      \n\t"
+			 "jrcxz 2f                      \n\t"
+			 "jmp   1b                      \n\t"
+			 "2:                            \n\t"
+			 "mov   $0, %k[lo]              \n\t"
+			 "adcx  %[lo], %[c]             \n\t"
+			 "adox  %[lo], %[c]             \n\t"
+			 : [c] "=&r"(c), [lo] "=&r"(lo), [hi] "=&r"(hi),
+			   [b] "+r"(b), [in] "+r"(in), [out] "+r"(out),
+			   [len] "+c"(len)
+			 : "d"(x)
+			 : "cc", "memory");
+
+	return (c);
+}
+
+/*
+ * d[0 .. len - 1] = t mod N, for t < 2N of len + 1 words:
+ * t - N is kept if t[len] is set or if there was no borrow
+ */
+static void adx_final_sub(uint32_t *d, const uint64_t *t,
+			  const uint32_t *N, size_t len)
+{
+	size_t i;
+	uint64_t r[BN_X86_MAX_WORDS], br, m;
+	unsigned __int128 z;
+
+	for (i = br = 0; i < len; i++) {
+		z = (unsigned __int128) t[i] - ld64(N, i) - br;
+		r[i] = (uint64_t) z;
+		br = (uint64_t) (z >> 64) & 1;
+	}
+
+	m = (uint64_t) 0 - ((t[len] | (br ^ 1)) & 1);
+
+	for (i = 0; i < len; i++)
+		st64(d, i, (r[i] & m) | (t[i] & ~m));
+}
+
+/*
+ * Multiplication using MULX/ADCX/ADOX
+ */
+BN_ADX_TARGET
+void bn_x86_mul_adx(uint32_t *d, const uint32_t *a, size_t an,
+		    const uint32_t *b, size_t bn)
+{
+	size_t i;
+	uint64_t c;
+
+	memset(d, 0, (an + bn) * sizeof(uint32_t));
+
+	for (i = 0; bn > 0 && i < an / 2; i++) {
+		c = adx_row((uint64_t *) d + i, (uint64_t *) d + i,
+			    (const uint64_t *) b, bn / 2, ld64(a, i));
+		st64(d, i + bn / 2, c);
+	}
+}
+
+/*
+ * Montgomery multiplication using MULX/ADCX/ADOX (CIOS); the second
+ * row of each step writes one word down, which does the division by
+ * 2^64 as it goes
+ */
+BN_ADX_TARGET
+void bn_x86_montmul_adx(uint32_t *d, const uint32_t *a, const uint32_t *b,
+			const uint32_t *N, size_t n)
+{
+	size_t i, len = n / 2;
+	uint64_t t[BN_X86_MAX_WORDS + 3], *w = t + 1;
+	uint64_t mm, c, z;
+
+	mm = bn_x86_montg_init(ld64(N, 0));
+	memset(t, 0, (len + 3) * sizeof(uint64_t));
+
+	for (i = 0; i < len; i++) {
+		c = adx_row(w, w, (const uint64_t *) b, len, ld64(a, i));
+		z = w[len] + c;
+		w[len + 1] += (z < c);
+		w[len] = z;
+
+		c = adx_row(w - 1, w, (const uint64_t *) N, len, w[0] * mm);
+		z = w[len] + c;
+		w[len - 1] = z;
+		w[len] = w[len + 1] + (z < c);
+		w[len + 1] = 0;
+	}
+
+	adx_final_sub(d, w, N, len);
+}
+
+/*
+ * Montgomery squaring using MULX/ADCX/ADOX: the cross products once,
+ * doubled along with the squares, then the reduction
+ */
+BN_ADX_TARGET
+void bn_x86_montsqr_adx(uint32_t *d, const uint32_t *a, const uint32_t *N,
+			size_t n)
+{
+	size_t i, len = n / 2;
+	uint64_t t[2 * BN_X86_MAX_WORDS + 2];
+	uint64_t mm, c, h, x0, x1, ai;
+	unsigned __int128 r;
+
+	mm = bn_x86_montg_init(ld64(N, 0));
+	memset(t, 0, (2 * len + 2) * sizeof(uint64_t));
+
+	for (i = 0; i + 1 < len; i++)
+		t[i + len] = adx_row(t + 2 * i + 1, t + 2 * i + 1,
+				     (const uint64_t *) a + i + 1,
+				     len - i - 1, ld64(a, i));
+
+	for (i = c = h = 0; i < len; i++) {
+		ai = ld64(a, i);
+		x0 = t[2 * i];
+		x1 = t[2 * i + 1];
+
+		r = (unsigned __int128) ai * ai + ((x0 << 1) | h) + c;
+		t[2 * i] = (uint64_t) r;
+		h = x1 >> 63;
+
+		r = (r >> 64) + ((x1 << 1) | (x0 >> 63));
+		t[2 * i + 1] = (uint64_t) r;
+		c = (uint64_t) (r >> 64);
+	}
+
+	for (i = h = 0; i < len; i++) {
+		c = adx_row(t + i, t + i, (const uint64_t *) N, len,
+			    t[i] * mm);
+
+		r = (unsigned __int128) t[i + len] + c + h;
+		t[i + len] = (uint64_t) r;
+		h = (uint64_t) (r >> 64);
+	}
+
+	t[2 * len] = h;
+
+	adx_final_sub(d, t + len, N, len);
+}
+
+#define M52                     0xFFFFFFFFFFFFFull
+#define IFMA_MAX_DIGITS         40	/* for BN_X86_IFMA_MAX_BITS */
+#define IFMA_ALIGN              __attribute__((aligned(64)))
+
+/*
+ * Number of 52-bit digits needed for a modulus of nbits
+ */
+size_t bn_x86_ifma_digits(size_t nbits)
+{
+	return ((nbits + 2 + 51) / 52);
+}
+
+/*
+ * 52-bit digits d[0 .. nd - 1] from the n limbs of x
+ */
+static void ifma_from_limbs(uint64_t *d, size_t nd, const uint32_t *x,
+			    size_t n)
+{
+	size_t i, j, k;
+	unsigned __int128 v;
+
+	for (i = 0; i < nd; i++) {
+		j = (52 * i) / 32;
+
+		for (k = 3, v = 0; k > 0; k--) {
+			v <<= 32;
+			if (j + k - 1 < n)
+				v |= x[j + k - 1];
+		}
+
+		d[i] = (uint64_t) (v >> ((52 * i) % 32)) & M52;
+	}
+}
+
+/*
+ * n limbs of x from the (normalized) digits d[0 .. nd - 1]
+ */
+static void ifma_to_limbs(uint32_t *x, size_t n, const uint64_t *d,
+			  size_t nd)
+{
+	size_t i, j, s;
+	uint64_t v;
+
+	for (i = 0; i < n; i++) {
+		j = (32 * i) / 52;
+		s = (32 * i) % 52;
+
+		v = (j < nd) ? d[j] >> s : 0;
+		if (j + 1 < nd)
+			v |= d[j + 1] << (52 - s);
+
+		x[i] = (uint32_t) v;
+	}
+}
+
+/*
+ * Almost Montgomery multiplication in radix 2^52: r = a * b / 2^(52k)
+ * mod m, for a, b < 2m, giving r < 2m. k digits in nv vectors of 8.
+ *
+ * Each step adds the low halves of a * b[i] and m * u, drops the
+ * (now zero) bottom digit by shifting every lane down by one, and then
+ * adds the high halves, which thereby land one digit up as they should.
+ * Lanes are left to grow past 52 bits; 4k * 2^52 still fits in 64.
+ */
+BN_IFMA_TARGET
+static void ifma_amm(uint64_t *r, const uint64_t *a, const uint64_t *b,
+		     const uint64_t *m, uint64_t k0, size_t k, size_t nv)
+{
+	size_t i, v;
+	uint64_t t0, u, c;
+	__m512i acc[IFMA_MAX_DIGITS / 8], va[IFMA_MAX_DIGITS / 8];
+	__m512i vm[IFMA_MAX_DIGITS / 8], bi, ui, zero;
+
+	zero = _mm512_setzero_si512();
+
+	for (v = 0; v < nv; v++) {
+		acc[v] = zero;
+		va[v] = _mm512_load_si512((const void *)(a + 8 * v));
+		vm[v] = _mm512_load_si512((const void *)(m + 8 * v));
+	}
+
+	for (i = 0; i < k; i++) {
+		bi = _mm512_set1_epi64((long long)b[i]);
+
+		for (v = 0; v < nv; v++)
+			acc[v] = _mm512_madd52lo_epu64(acc[v], va[v], bi);
+
+		t0 = (uint64_t) _mm_cvtsi128_si64(_mm512_castsi512_si128(acc[0]));
+		u = (t0 * k0) & M52;
+		c = (t0 + ((m[0] * u) & M52)) >> 52;
+		ui = _mm512_set1_epi64((long long)u);
+
+		for (v = 0; v < nv; v++)
+			acc[v] = _mm512_madd52lo_epu64(acc[v], vm[v], ui);
+
+		for (v = 0; v + 1 < nv; v++)
+			acc[v] = _mm512_alignr_epi64(acc[v + 1], acc[v], 1);
+		acc[nv - 1] = _mm512_alignr_epi64(zero, acc[nv - 1], 1);
+
+		acc[0] = _mm512_mask_add_epi64(acc[0], 1, acc[0],
+					       _mm512_set1_epi64((long long)c));
+
+		for (v = 0; v < nv; v++) {
+			acc[v] = _mm512_madd52hi_epu64(acc[v], va[v], bi);
+			acc[v] = _mm512_madd52hi_epu64(acc[v], vm[v], ui);
+		}
+	}
+
+	for (v = 0; v < nv; v++)
+		_mm512_store_si512((void *)(r + 8 * v), acc[v]);
+
+	for (i = c = 0; i < k; i++) {
+		t0 = r[i] + c;
+		r[i] = t0 & M52;
+		c = t0 >> 52;
+	}
+}
+
+/*
+ * Exponent bits [i, i + w) of the en limbs of E
+ */
+static size_t ifma_get_bits(const uint32_t *E, size_t en, size_t i, size_t w)
+{
+	size_t j, r = 0;
+
+	for (j = w; j > 0; j--) {
+		r <<= 1;
+
+		if ((i + j - 1) / 32 < en)
+			r |= (E[(i + j - 1) / 32] >> ((i + j - 1) % 32)) & 1;
+	}
+
+	return (r);
+}
+
+/*
+ * Fixed-window exponentiation using AVX-512 IFMA
+ */
+BN_IFMA_TARGET
+void bn_x86_exp_mod_ifma(uint32_t *X, const uint32_t *A,
+			 const uint32_t *E, size_t en, size_t ebits,
+			 const uint32_t *N, const uint32_t *RR,
+			 size_t n, size_t nbits, size_t wsize)
+{
+	size_t i, j, e, w, k, nv;
+	uint64_t k0;
+	uint64_t W[32][IFMA_MAX_DIGITS] IFMA_ALIGN;
+	uint64_t Y[IFMA_MAX_DIGITS] IFMA_ALIGN;
+	uint64_t S[IFMA_MAX_DIGITS] IFMA_ALIGN;
+	uint64_t M[IFMA_MAX_DIGITS] IFMA_ALIGN;
+	uint64_t Z[IFMA_MAX_DIGITS] IFMA_ALIGN;
+	__m512i sel[IFMA_MAX_DIGITS / 8];
+	__mmask8 hit;
+
+	k = bn_x86_ifma_digits(nbits);
+	nv = (k + 7) / 8;
+
+	memset(W, 0, sizeof(W));
+	memset(Y, 0, sizeof(Y));
+	memset(S, 0, sizeof(S));
+
+	ifma_from_limbs(M, nv * 8, N, n);
+	ifma_from_limbs(Z, nv * 8, RR, n);
+	ifma_from_limbs(S, nv * 8, A, n);
+
+	k0 = bn_x86_montg_init(M[0] | (M[1] << 52)) & M52;
+
+	/*
+	 * W[1] = A * R', W[0] = R', W[i] = W[i - 1] * W[1], all mod N
+	 */
+	ifma_amm(W[1], S, Z, M, k0, k, nv);
+
+	memset(Y, 0, sizeof(Y));
+	Y[0] = 1;
+	ifma_amm(W[0], Y, Z, M, k0, k, nv);
+
+	for (i = 2; i < ((size_t) 1 << wsize); i++)
+		ifma_amm(W[i], W[i - 1], W[1], M, k0, k, nv);
+
+	memcpy(Y, W[0], sizeof(Y));
+
+	for (i = (ebits + wsize - 1) / wsize * wsize; i > 0; i -= wsize) {
+		for (j = 0; j < wsize; j++)
+			ifma_amm(Y, Y, Y, M, k0, k, nv);
+
+		w = ifma_get_bits(E, en, i - wsize, wsize);
+
+		for (j = 0; j < nv; j++)
+			sel[j] = _mm512_setzero_si512();
+
+		for (e = 0; e < ((size_t) 1 << wsize); e++) {
+			hit = _mm512_cmpeq_epi64_mask(_mm512_set1_epi64((long long)e),
+						      _mm512_set1_epi64((long long)w));
+
+			for (j = 0; j < nv; j++)
+				sel[j] = _mm512_mask_mov_epi64(sel[j], hit,
+				    _mm512_load_si512((const void *)(W[e] + 8 * j)));
+		}
+
+		for (j = 0; j < nv; j++)
+			_mm512_store_si512((void *)(S + 8 * j), sel[j]);
+
+		ifma_amm(Y, Y, S, M, k0, k, nv);
+	}
+
+	/*
+	 * X = Y / R' mod N, still below 2N
+	 */
+	memset(S, 0, sizeof(S));
+	S[0] = 1;
+	ifma_amm(Y, Y, S, M, k0, k, nv);
+
+	ifma_to_limbs(X, n + 1, Y, nv * 8);
+
+	memset(W, 0, sizeof(W));
+	memset(Y, 0, sizeof(Y));
+	memset(S, 0, sizeof(S));
+}
+
+#endif              /* TROPICSSL_HAVE_X86_64 */
+#endif              /* TROPICSSL_BN_X86 */
@@ -44,6 +44,10 @@
 #include "tropicssl/err.h"
 #include "tropicssl/camellia.h"
 
+#if defined(TROPICSSL_AESNI)
+#include "tropicssl/aesni.h"
+#endif
+
 /*
  * 32-bit integer manipulation macros (big endian)
  */
@@ -575,6 +579,19 @@ void camellia_crypt_cbc(camellia_context * ctx,
 	uint8_t temp[16];
 
 	if (mode == CAMELLIA_DECRYPT) {
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+		if (length >= 256 && aesni_supports(TROPICSSL_AESNI_AES) &&
+		    aesni_supports(TROPICSSL_AESNI_SSSE3)) {
+			size_t n = length & ~(size_t)255;
+
+			aesni_camellia_cbc_dec(ctx, n, iv, input, output);
+
+			input += n;
+			output += n;
+			length -= n;
+		}
+#endif
+
 		while (length > 0) {
 			memcpy(temp, input, 16);
 			camellia_crypt_ecb(ctx, mode, input, output);
@@ -812,6 +829,7 @@ int camellia_self_test(int verbose)
 	uint8_t src[16];
 	uint8_t dst[16];
 	uint8_t iv[16];
+	uint8_t big[37 * 16];
 	camellia_context ctx;
 
 	memset(key, 0, 32);
@@ -901,6 +919,43 @@ int camellia_self_test(int verbose)
 			printf("passed\n");
 	}
 
+	/*
+	 * CBC mode, long message: encrypted one block at a time,
+	 * decrypted in a single call (the AES-NI path where present)
+	 */
+	for (u = 0; u < 3; u++) {
+		if (verbose != 0)
+			printf("  CAMELLIA-CBC-%3d (bulk): ", 128 + u * 64);
+
+		for (i = 0; i < (int)sizeof(big); i++)
+			big[i] = (uint8_t)(i * 7 + (i >> 8));
+
+		memcpy(key, camellia_test_cbc_key[u], 16 + 8 * u);
+		camellia_setkey_enc(&ctx, key, 128 + u * 64);
+		memcpy(iv, camellia_test_cbc_iv, 16);
+
+		for (i = 0; i < (int)sizeof(big); i += 16)
+			camellia_crypt_cbc(&ctx, CAMELLIA_ENCRYPT, 16, iv,
+					   big + i, big + i);
+
+		camellia_setkey_dec(&ctx, key, 128 + u * 64);
+		memcpy(iv, camellia_test_cbc_iv, 16);
+		camellia_crypt_cbc(&ctx, CAMELLIA_DECRYPT, sizeof(big), iv,
+				   big, big);
+
+		for (i = 0; i < (int)sizeof(big); i++) {
+			if (big[i] != (uint8_t)(i * 7 + (i >> 8))) {
+				if (verbose != 0)
+					printf("failed\n");
+
+				return (1);
+			}
+		}
+
+		if (verbose != 0)
+			printf("passed\n");
+	}
+
 	if (verbose != 0)
 		printf("\n");
 
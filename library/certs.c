@@ -201,4 +201,23 @@ const char test_cli_key[] =
         "swiP8rLb269fx7Q2y0VZltiDOROOqgqwDAhGNsgfoNrUoPyt8ao9Bg==\r\n"
         "-----END RSA PRIVATE KEY-----\r\n";
 
+/*
+ * Revokes serials 01, 0A and 1234 of test_ca_crt
+ */
+const char test_ca_crl[] =
+        "-----BEGIN X509 CRL-----\r\n"
+        "MIICMzCCARsCAQEwDQYJKoZIhvcNAQELBQAwgZcxCzAJBgNVBAYTAlZOMQ4wDAYD\r\n"
+        "VQQIDAVIYW5vaTEOMAwGA1UEBwwFSGFub2kxEzARBgNVBAoMCkNhbmggQ2EgUm8x\r\n"
+        "ETAPBgNVBAsMCEVtYmVkZGVkMRYwFAYDVQQDDA1WdSBUaGFuaCBDb25nMSgwJgYJ\r\n"
+        "KoZIhvcNAQkBFhl2dXRoYW5oY29uZy5pY3RAZ21haWwuY29tFw0yNjEwMTQwODQ5\r\n"
+        "NTJaGA8yMTI2MDkyMDA4NDk1MlowPTASAgEBFw0xNTA5MDEwMDAwMDBaMBICAQoX\r\n"
+        "DTE1MDkwMTAwMDAwMFowEwICEjQXDTE1MDkwMTAwMDAwMFqgDjAMMAoGA1UdFAQD\r\n"
+        "AgEBMA0GCSqGSIb3DQEBCwUAA4IBAQBin39zH5+Z2pR8lVJX/HZsN3TrHwsYfp8m\r\n"
+        "cFR3MCAd1PMJgm3A1Nj3kjHYXe5tD9y6md998po+W2Zh/0BjL2I65FndCN+3SvNO\r\n"
+        "CNHdS2PVdhCYGat7NgWuKPeIHEe2qXADCM9xtYepC72f3jhOGqIaCERFtuwDpVo7\r\n"
+        "onj24CowYDabCbV7FwwncA7fPpKql1p7GzuLIOWMclzqrM+kMjH9OZo4ovSXCdDl\r\n"
+        "voSSuCnhoZ+CCru6+RkkJ4lcV8pTjZLbNN9wGamkZiuTcJ7h4z6d7HypFUTeCHR5\r\n"
+        "XLjXBW0rBSvcUOibn52jiEEuGB/G6JD0sorkVpBpcEq0VGyNTfNJ\r\n"
+        "-----END X509 CRL-----\r\n";
+
 #endif
@@ -0,0 +1,600 @@
+/*
+ *  ChaCha20 stream cipher
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ChaCha20 was designed by D. J. Bernstein; the TLS variant with a
+ *  96-bit nonce and 32-bit block counter is specified in RFC 7539.
+ *
+ *  http://cr.yp.to/chacha/chacha-20080128.pdf
+ *  http://tools.ietf.org/html/rfc7539
+ *
+ *  The vector code runs four (SSE2, NEON) or eight (AVX2) blocks side
+ *  by side, one state word of every block per register, and
+ *  transposes the result back into keystream order.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_CHACHA20)
+
+#include "tropicssl/chacha20.h"
+
+#include <string.h>
+
+#if defined(TROPICSSL_HAVE_X86_64)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TROPICSSL_CHACHA20_NEON
+#include <arm_neon.h>
+#endif
+
+#define CHACHA20_SIMD_4WAY      1	/* SSE2 or NEON */
+#define CHACHA20_SIMD_8WAY      2	/* AVX2 */
+
+/*
+ * 32-bit integer manipulation macros (little endian)
+ */
+#ifndef GET_UINT32_LE
+#define GET_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ]       )             \
+        | ( (uint32_t) (b)[(i) + 1] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 2] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 3] << 24 );            \
+}
+#endif
+
+#ifndef PUT_UINT32_LE
+#define PUT_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (uint8_t) ( (n)       );             \
+    (b)[(i) + 1] = (uint8_t) ( (n) >>  8 );             \
+    (b)[(i) + 2] = (uint8_t) ( (n) >> 16 );             \
+    (b)[(i) + 3] = (uint8_t) ( (n) >> 24 );             \
+}
+#endif
+
+#define ROTL32(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QR(a,b,c,d)                                     \
+{                                                       \
+    a += b; d ^= a; d = ROTL32(d, 16);                  \
+    c += d; b ^= c; b = ROTL32(b, 12);                  \
+    a += b; d ^= a; d = ROTL32(d,  8);                  \
+    c += d; b ^= c; b = ROTL32(b,  7);                  \
+}
+
+/*
+ * One 64-byte keystream block; the counter is advanced
+ */
+static void chacha20_block(uint32_t state[16], uint8_t out[64])
+{
+	int i;
+	uint32_t x[16];
+
+	memcpy(x, state, sizeof(x));
+
+	for (i = 0; i < 10; i++) {
+		QR(x[0], x[4], x[8], x[12]);
+		QR(x[1], x[5], x[9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[8], x[13]);
+		QR(x[3], x[4], x[9], x[14]);
+	}
+
+	for (i = 0; i < 16; i++) {
+		x[i] += state[i];
+		PUT_UINT32_LE(x[i], out, i * 4);
+	}
+
+	state[12]++;
+}
+
+/*
+ * The vector rounds: V_ADD, V_XOR and V_ROTL(x, n) on whole registers,
+ * with the same column / diagonal pattern as the scalar code
+ */
+#define V_QR(a,b,c,d)                                   \
+{                                                       \
+    a = V_ADD(a, b); d = V_XOR(d, a); d = V_ROTL16(d);  \
+    c = V_ADD(c, d); b = V_XOR(b, c); b = V_ROTL(b, 12);\
+    a = V_ADD(a, b); d = V_XOR(d, a); d = V_ROTL8(d);   \
+    c = V_ADD(c, d); b = V_XOR(b, c); b = V_ROTL(b, 7); \
+}
+
+#define V_DOUBLE_ROUND(x)                               \
+{                                                       \
+    V_QR(x[0], x[4], x[8], x[12]);                      \
+    V_QR(x[1], x[5], x[9], x[13]);                      \
+    V_QR(x[2], x[6], x[10], x[14]);                     \
+    V_QR(x[3], x[7], x[11], x[15]);                     \
+    V_QR(x[0], x[5], x[10], x[15]);                     \
+    V_QR(x[1], x[6], x[11], x[12]);                     \
+    V_QR(x[2], x[7], x[8], x[13]);                      \
+    V_QR(x[3], x[4], x[9], x[14]);                      \
+}
+
+#if defined(TROPICSSL_HAVE_X86_64)
+/*
+ * AVX2 detection: CPUID leaf 7 and the OS saving the YMM registers
+ */
+static int chacha20_has_avx2(void)
+{
+	static int done = 0;
+	static int avx2 = 0;
+
+	if (done == 0) {
+		unsigned int a, b, c, d, xcr0;
+
+		if (__get_cpuid(1, &a, &b, &c, &d) != 0 &&
+		    (c & 0x18000000u) == 0x18000000u) {
+			__asm__ volatile ("xgetbv" : "=a" (xcr0),
+					  "=d" (d) : "c" (0));
+
+			if ((xcr0 & 6) == 6 && __get_cpuid_max(0, NULL) >= 7) {
+				__cpuid_count(7, 0, a, b, c, d);
+				avx2 = (b & 0x00000020u) != 0;
+			}
+		}
+
+		done = 1;
+	}
+
+	return (avx2);
+}
+
+#define V_ADD(a,b)      _mm_add_epi32(a, b)
+#define V_XOR(a,b)      _mm_xor_si128(a, b)
+#define V_ROTL(x,n)     _mm_or_si128(_mm_slli_epi32(x, n),      \
+                                     _mm_srli_epi32(x, 32 - (n)))
+#define V_ROTL16(x)     _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1)
+#define V_ROTL8(x)      V_ROTL(x, 8)
+
+/*
+ * Output block j, 16 bytes at offset g * 16, comes from lane j of
+ * state words 4g .. 4g + 3
+ */
+#define SSE2_STORE(in,out,off,v)                                        \
+    _mm_storeu_si128((__m128i *)((out) + (off)),                        \
+        _mm_xor_si128(v, _mm_loadu_si128((const __m128i *)((in) + (off)))))
+
+/*
+ * Four blocks at a time in SSE2 (part of the x86-64 baseline)
+ */
+static void chacha20_blocks_sse2(uint32_t state[16], const uint8_t *input,
+				 uint8_t *output, size_t nblocks)
+{
+	int i;
+	__m128i x[16], s[16], t0, t1, t2, t3;
+
+	for (i = 0; i < 16; i++)
+		s[i] = _mm_set1_epi32((int)state[i]);
+
+	s[12] = _mm_add_epi32(s[12], _mm_set_epi32(3, 2, 1, 0));
+
+	for (; nblocks >= 4; nblocks -= 4) {
+		memcpy(x, s, sizeof(x));
+
+		for (i = 0; i < 10; i++)
+			V_DOUBLE_ROUND(x);
+
+		for (i = 0; i < 4; i++) {
+			t0 = _mm_add_epi32(x[4 * i], s[4 * i]);
+			t1 = _mm_add_epi32(x[4 * i + 1], s[4 * i + 1]);
+			t2 = _mm_add_epi32(x[4 * i + 2], s[4 * i + 2]);
+			t3 = _mm_add_epi32(x[4 * i + 3], s[4 * i + 3]);
+
+			x[0] = _mm_unpacklo_epi32(t0, t1);
+			x[1] = _mm_unpacklo_epi32(t2, t3);
+			x[2] = _mm_unpackhi_epi32(t0, t1);
+			x[3] = _mm_unpackhi_epi32(t2, t3);
+
+			SSE2_STORE(input, output, i * 16,
+				   _mm_unpacklo_epi64(x[0], x[1]));
+			SSE2_STORE(input, output, 64 + i * 16,
+				   _mm_unpackhi_epi64(x[0], x[1]));
+			SSE2_STORE(input, output, 128 + i * 16,
+				   _mm_unpacklo_epi64(x[2], x[3]));
+			SSE2_STORE(input, output, 192 + i * 16,
+				   _mm_unpackhi_epi64(x[2], x[3]));
+		}
+
+		s[12] = _mm_add_epi32(s[12], _mm_set1_epi32(4));
+		state[12] += 4;
+		input += 256;
+		output += 256;
+	}
+}
+
+#undef V_ADD
+#undef V_XOR
+#undef V_ROTL
+#undef V_ROTL16
+#undef V_ROTL8
+
+#define CHACHA20_AVX2 __attribute__((target("avx2")))
+
+#define V_ADD(a,b)      _mm256_add_epi32(a, b)
+#define V_XOR(a,b)      _mm256_xor_si256(a, b)
+#define V_ROTL(x,n)     _mm256_or_si256(_mm256_slli_epi32(x, n),        \
+                                        _mm256_srli_epi32(x, 32 - (n)))
+#define V_ROTL16(x)     _mm256_shuffle_epi8(x, rot16)
+#define V_ROTL8(x)      _mm256_shuffle_epi8(x, rot8)
+
+/*
+ * Eight blocks at a time in AVX2: the unpacks work within each
+ * 128-bit lane, so the low lane holds block j and the high lane
+ * block j + 4
+ */
+CHACHA20_AVX2 static void chacha20_blocks_avx2(uint32_t state[16],
+					       const uint8_t *input,
+					       uint8_t *output, size_t nblocks)
+{
+	int i, j;
+	__m256i x[16], s[16], t[4], u[4];
+	const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5,
+					       10, 11, 8, 9, 14, 15, 12, 13,
+					       2, 3, 0, 1, 6, 7, 4, 5,
+					       10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6,
+					      11, 8, 9, 10, 15, 12, 13, 14,
+					      3, 0, 1, 2, 7, 4, 5, 6,
+					      11, 8, 9, 10, 15, 12, 13, 14);
+
+	for (i = 0; i < 16; i++)
+		s[i] = _mm256_set1_epi32((int)state[i]);
+
+	s[12] = _mm256_add_epi32(s[12],
+				 _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+	for (; nblocks >= 8; nblocks -= 8) {
+		memcpy(x, s, sizeof(x));
+
+		for (i = 0; i < 10; i++)
+			V_DOUBLE_ROUND(x);
+
+		for (i = 0; i < 4; i++) {
+			for (j = 0; j < 4; j++)
+				t[j] = _mm256_add_epi32(x[4 * i + j],
+							s[4 * i + j]);
+
+			u[0] = _mm256_unpacklo_epi32(t[0], t[1]);
+			u[1] = _mm256_unpacklo_epi32(t[2], t[3]);
+			u[2] = _mm256_unpackhi_epi32(t[0], t[1]);
+			u[3] = _mm256_unpackhi_epi32(t[2], t[3]);
+
+			t[0] = _mm256_unpacklo_epi64(u[0], u[1]);
+			t[1] = _mm256_unpackhi_epi64(u[0], u[1]);
+			t[2] = _mm256_unpacklo_epi64(u[2], u[3]);
+			t[3] = _mm256_unpackhi_epi64(u[2], u[3]);
+
+			for (j = 0; j < 4; j++) {
+				SSE2_STORE(input, output, j * 64 + i * 16,
+					   _mm256_castsi256_si128(t[j]));
+				SSE2_STORE(input, output, 256 + j * 64 + i * 16,
+					   _mm256_extracti128_si256(t[j], 1));
+			}
+		}
+
+		s[12] = _mm256_add_epi32(s[12], _mm256_set1_epi32(8));
+		state[12] += 8;
+		input += 512;
+		output += 512;
+	}
+}
+
+#undef V_ADD
+#undef V_XOR
+#undef V_ROTL
+#undef V_ROTL16
+#undef V_ROTL8
+#endif /* TROPICSSL_HAVE_X86_64 */
+
+#if defined(TROPICSSL_CHACHA20_NEON)
+#define V_ADD(a,b)      vaddq_u32(a, b)
+#define V_XOR(a,b)      veorq_u32(a, b)
+#define V_ROTL(x,n)     vsriq_n_u32(vshlq_n_u32(x, n), x, 32 - (n))
+#define V_ROTL16(x)     vreinterpretq_u32_u16(                          \
+                            vrev32q_u16(vreinterpretq_u16_u32(x)))
+#define V_ROTL8(x)      V_ROTL(x, 8)
+
+#define NEON_STORE(in,out,off,v)                                        \
+    vst1q_u8((out) + (off), veorq_u8(vreinterpretq_u8_u32(v),           \
+                                     vld1q_u8((in) + (off))))
+
+/*
+ * Four blocks at a time in NEON (part of the AArch64 baseline)
+ */
+static void chacha20_blocks_neon(uint32_t state[16], const uint8_t *input,
+				 uint8_t *output, size_t nblocks)
+{
+	int i;
+	uint32x4_t x[16], s[16], t0, t1, t2, t3;
+	uint32x4x2_t ab, cd;
+	static const uint32_t lanes[4] = { 0, 1, 2, 3 };
+
+	for (i = 0; i < 16; i++)
+		s[i] = vdupq_n_u32(state[i]);
+
+	s[12] = vaddq_u32(s[12], vld1q_u32(lanes));
+
+	for (; nblocks >= 4; nblocks -= 4) {
+		memcpy(x, s, sizeof(x));
+
+		for (i = 0; i < 10; i++)
+			V_DOUBLE_ROUND(x);
+
+		for (i = 0; i < 4; i++) {
+			t0 = vaddq_u32(x[4 * i], s[4 * i]);
+			t1 = vaddq_u32(x[4 * i + 1], s[4 * i + 1]);
+			t2 = vaddq_u32(x[4 * i + 2], s[4 * i + 2]);
+			t3 = vaddq_u32(x[4 * i + 3], s[4 * i + 3]);
+
+			ab = vtrnq_u32(t0, t1);
+			cd = vtrnq_u32(t2, t3);
+
+			NEON_STORE(input, output, i * 16,
+				   vcombine_u32(vget_low_u32(ab.val[0]),
+						vget_low_u32(cd.val[0])));
+			NEON_STORE(input, output, 64 + i * 16,
+				   vcombine_u32(vget_low_u32(ab.val[1]),
+						vget_low_u32(cd.val[1])));
+			NEON_STORE(input, output, 128 + i * 16,
+				   vcombine_u32(vget_high_u32(ab.val[0]),
+						vget_high_u32(cd.val[0])));
+			NEON_STORE(input, output, 192 + i * 16,
+				   vcombine_u32(vget_high_u32(ab.val[1]),
+						vget_high_u32(cd.val[1])));
+		}
+
+		s[12] = vaddq_u32(s[12], vdupq_n_u32(4));
+		state[12] += 4;
+		input += 256;
+		output += 256;
+	}
+}
+
+#undef V_ADD
+#undef V_XOR
+#undef V_ROTL
+#undef V_ROTL16
+#undef V_ROTL8
+#endif /* TROPICSSL_CHACHA20_NEON */
+
+/*
+ * ChaCha20 key schedule
+ */
+void chacha20_setkey(chacha20_context * ctx, const uint8_t key[32])
+{
+	int i;
+
+	/* "expand 32-byte k" */
+	ctx->state[0] = 0x61707865;
+	ctx->state[1] = 0x3320646E;
+	ctx->state[2] = 0x79622D32;
+	ctx->state[3] = 0x6B206574;
+
+	for (i = 0; i < 8; i++)
+		GET_UINT32_LE(ctx->state[4 + i], key, i * 4);
+
+	memset(ctx->state + 12, 0, 16);
+	ctx->left = 0;
+	ctx->simd = 0;
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	ctx->simd = chacha20_has_avx2() ? CHACHA20_SIMD_8WAY :
+	    CHACHA20_SIMD_4WAY;
+#elif defined(TROPICSSL_CHACHA20_NEON)
+	ctx->simd = CHACHA20_SIMD_4WAY;
+#endif
+}
+
+/*
+ * Start a keystream at the given nonce and block counter
+ */
+void chacha20_starts(chacha20_context * ctx, const uint8_t nonce[12],
+		     uint32_t counter)
+{
+	ctx->state[12] = counter;
+	GET_UINT32_LE(ctx->state[13], nonce, 0);
+	GET_UINT32_LE(ctx->state[14], nonce, 4);
+	GET_UINT32_LE(ctx->state[15], nonce, 8);
+	ctx->left = 0;
+}
+
+/*
+ * ChaCha20 encryption/decryption
+ */
+void chacha20_update(chacha20_context * ctx, size_t length,
+		     const uint8_t *input, uint8_t *output)
+{
+	size_t i, n;
+
+	while (length > 0 && ctx->left > 0) {
+		*output++ = *input++ ^ ctx->keystream[64 - ctx->left];
+		ctx->left--;
+		length--;
+	}
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	if (ctx->simd == CHACHA20_SIMD_8WAY && length >= 512) {
+		n = length & ~(size_t) 511;
+		chacha20_blocks_avx2(ctx->state, input, output, n / 64);
+		input += n;
+		output += n;
+		length -= n;
+	}
+
+	if (ctx->simd != 0 && length >= 256) {
+		n = length & ~(size_t) 255;
+		chacha20_blocks_sse2(ctx->state, input, output, n / 64);
+		input += n;
+		output += n;
+		length -= n;
+	}
+#elif defined(TROPICSSL_CHACHA20_NEON)
+	if (ctx->simd != 0 && length >= 256) {
+		n = length & ~(size_t) 255;
+		chacha20_blocks_neon(ctx->state, input, output, n / 64);
+		input += n;
+		output += n;
+		length -= n;
+	}
+#endif
+
+	while (length > 0) {
+		chacha20_block(ctx->state, ctx->keystream);
+
+		n = (length < 64) ? length : 64;
+		for (i = 0; i < n; i++)
+			output[i] = input[i] ^ ctx->keystream[i];
+
+		ctx->left = 64 - n;
+		input += n;
+		output += n;
+		length -= n;
+	}
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * RFC 7539 section 2.4.2
+ */
+static const uint8_t chacha20_test_nonce[12] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4A,
+	0x00, 0x00, 0x00, 0x00
+};
+
+static const char chacha20_test_pt[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only "
+    "one tip for the future, sunscreen would be it.";
+
+static const uint8_t chacha20_test_ct[114] = {
+	0x6E, 0x2E, 0x35, 0x9A, 0x25, 0x68, 0xF9, 0x80,
+	0x41, 0xBA, 0x07, 0x28, 0xDD, 0x0D, 0x69, 0x81,
+	0xE9, 0x7E, 0x7A, 0xEC, 0x1D, 0x43, 0x60, 0xC2,
+	0x0A, 0x27, 0xAF, 0xCC, 0xFD, 0x9F, 0xAE, 0x0B,
+	0xF9, 0x1B, 0x65, 0xC5, 0x52, 0x47, 0x33, 0xAB,
+	0x8F, 0x59, 0x3D, 0xAB, 0xCD, 0x62, 0xB3, 0x57,
+	0x16, 0x39, 0xD6, 0x24, 0xE6, 0x51, 0x52, 0xAB,
+	0x8F, 0x53, 0x0C, 0x35, 0x9F, 0x08, 0x61, 0xD8,
+	0x07, 0xCA, 0x0D, 0xBF, 0x50, 0x0D, 0x6A, 0x61,
+	0x56, 0xA3, 0x8E, 0x08, 0x8A, 0x22, 0xB6, 0x5E,
+	0x52, 0xBC, 0x51, 0x4D, 0x16, 0xCC, 0xF8, 0x06,
+	0x81, 0x8C, 0xE9, 0x1A, 0xB7, 0x79, 0x37, 0x36,
+	0x5A, 0xF9, 0x0B, 0xBF, 0x74, 0xA3, 0x5B, 0xE6,
+	0xB4, 0x0B, 0x8E, 0xED, 0xF2, 0x78, 0x5E, 0x42,
+	0x87, 0x4D
+};
+
+/*
+ * Checkup routine
+ */
+int chacha20_self_test(int verbose)
+{
+	int simd;
+	size_t i;
+	uint8_t key[32];
+	uint8_t buf1[1100], buf2[1100];
+	chacha20_context ctx;
+
+	if (verbose != 0)
+		printf("  ChaCha20 test #1: ");
+
+	for (i = 0; i < 32; i++)
+		key[i] = (uint8_t)i;
+
+	chacha20_setkey(&ctx, key);
+	chacha20_starts(&ctx, chacha20_test_nonce, 1);
+	chacha20_update(&ctx, 114, (const uint8_t *)chacha20_test_pt, buf1);
+
+	if (memcmp(buf1, chacha20_test_ct, 114) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n  ChaCha20 test #2: ");
+
+	/*
+	 * Each vector code path over a long message, in place, must
+	 * match the portable code run in uneven pieces
+	 */
+	simd = ctx.simd;
+
+	for (i = 0; i < sizeof(buf2); i++)
+		buf2[i] = (uint8_t)(i * 7 + 1);
+
+	ctx.simd = 0;
+	chacha20_starts(&ctx, chacha20_test_nonce, 0xFFFFFFF0);
+	chacha20_update(&ctx, 3, buf2, buf2);
+	chacha20_update(&ctx, 125, buf2 + 3, buf2 + 3);
+	chacha20_update(&ctx, sizeof(buf2) - 128, buf2 + 128, buf2 + 128);
+
+	for (; simd > 0; simd--) {
+		for (i = 0; i < sizeof(buf1); i++)
+			buf1[i] = (uint8_t)(i * 7 + 1);
+
+		ctx.simd = simd;
+		chacha20_starts(&ctx, chacha20_test_nonce, 0xFFFFFFF0);
+		chacha20_update(&ctx, sizeof(buf1), buf1, buf1);
+
+		if (memcmp(buf1, buf2, sizeof(buf1)) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+	}
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+}
+
+#endif
+
+#endif
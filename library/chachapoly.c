@@ -0,0 +1,262 @@
+/*
+ *  ChaCha20-Poly1305 authenticated encryption
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  The AEAD construction is specified in RFC 7539, section 2.8:
+ *
+ *  http://tools.ietf.org/html/rfc7539
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_CHACHAPOLY)
+
+#include "tropicssl/err.h"
+#include "tropicssl/chachapoly.h"
+#include "tropicssl/poly1305.h"
+
+#include <string.h>
+
+/*
+ * ChaCha20-Poly1305 key setup
+ */
+void chachapoly_setkey(chachapoly_context * ctx, const uint8_t key[32])
+{
+	chacha20_setkey(&ctx->chacha, key);
+}
+
+/*
+ * The one-time Poly1305 key is the first half of keystream block 0;
+ * the data is encrypted from block 1 on
+ */
+static void chachapoly_starts(chachapoly_context * ctx,
+			      const uint8_t nonce[12], poly1305_context * mac,
+			      const uint8_t *add, size_t add_len)
+{
+	uint8_t otk[64];
+	static const uint8_t zeroes[16] = { 0 };
+
+	memset(otk, 0, sizeof(otk));
+	chacha20_starts(&ctx->chacha, nonce, 0);
+	chacha20_update(&ctx->chacha, sizeof(otk), otk, otk);
+
+	poly1305_starts(mac, otk);
+	memset(otk, 0, sizeof(otk));
+
+	poly1305_update(mac, add, add_len);
+	poly1305_update(mac, zeroes, (16 - add_len % 16) % 16);
+}
+
+/*
+ * The MAC of ciphertext || pad || le64(add_len) || le64(length)
+ */
+static void chachapoly_finish(poly1305_context * mac, const uint8_t *ct,
+			      size_t length, size_t add_len, uint8_t tag[16])
+{
+	int i;
+	uint8_t lens[16];
+	static const uint8_t zeroes[16] = { 0 };
+
+	poly1305_update(mac, ct, length);
+	poly1305_update(mac, zeroes, (16 - length % 16) % 16);
+
+	for (i = 0; i < 8; i++) {
+		lens[i] = (uint8_t)((uint64_t) add_len >> (i * 8));
+		lens[8 + i] = (uint8_t)((uint64_t) length >> (i * 8));
+	}
+
+	poly1305_update(mac, lens, 16);
+	poly1305_finish(mac, tag);
+}
+
+/*
+ * ChaCha20-Poly1305 buffer encryption/decryption with tag
+ */
+void chachapoly_crypt_and_tag(chachapoly_context * ctx, int mode,
+			      size_t length, const uint8_t nonce[12],
+			      const uint8_t *add, size_t add_len,
+			      const uint8_t *input, uint8_t *output,
+			      uint8_t tag[16])
+{
+	poly1305_context mac;
+
+	chachapoly_starts(ctx, nonce, &mac, add, add_len);
+
+	/*
+	 * The tag covers the ciphertext, so decryption runs the MAC
+	 * before the input may be overwritten
+	 */
+	if (mode == CHACHAPOLY_DECRYPT) {
+		chachapoly_finish(&mac, input, length, add_len, tag);
+		chacha20_update(&ctx->chacha, length, input, output);
+	} else {
+		chacha20_update(&ctx->chacha, length, input, output);
+		chachapoly_finish(&mac, output, length, add_len, tag);
+	}
+}
+
+/*
+ * ChaCha20-Poly1305 buffer authenticated decryption
+ */
+int chachapoly_auth_decrypt(chachapoly_context * ctx, size_t length,
+			    const uint8_t nonce[12],
+			    const uint8_t *add, size_t add_len,
+			    const uint8_t tag[16],
+			    const uint8_t *input, uint8_t *output)
+{
+	int i;
+	uint8_t check[16];
+	uint8_t diff;
+	poly1305_context mac;
+
+	chachapoly_starts(ctx, nonce, &mac, add, add_len);
+	chachapoly_finish(&mac, input, length, add_len, check);
+
+	for (diff = 0, i = 0; i < 16; i++)
+		diff |= tag[i] ^ check[i];
+
+	if (diff != 0)
+		return (TROPICSSL_ERR_CHACHAPOLY_AUTH_FAILED);
+
+	chacha20_update(&ctx->chacha, length, input, output);
+
+	return (0);
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * RFC 7539 section 2.8.2
+ */
+static const uint8_t chachapoly_test_nonce[12] = {
+	0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43,
+	0x44, 0x45, 0x46, 0x47
+};
+
+static const uint8_t chachapoly_test_add[12] = {
+	0x50, 0x51, 0x52, 0x53, 0xC0, 0xC1, 0xC2, 0xC3,
+	0xC4, 0xC5, 0xC6, 0xC7
+};
+
+static const char chachapoly_test_pt[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only "
+    "one tip for the future, sunscreen would be it.";
+
+static const uint8_t chachapoly_test_ct[114] = {
+	0xD3, 0x1A, 0x8D, 0x34, 0x64, 0x8E, 0x60, 0xDB,
+	0x7B, 0x86, 0xAF, 0xBC, 0x53, 0xEF, 0x7E, 0xC2,
+	0xA4, 0xAD, 0xED, 0x51, 0x29, 0x6E, 0x08, 0xFE,
+	0xA9, 0xE2, 0xB5, 0xA7, 0x36, 0xEE, 0x62, 0xD6,
+	0x3D, 0xBE, 0xA4, 0x5E, 0x8C, 0xA9, 0x67, 0x12,
+	0x82, 0xFA, 0xFB, 0x69, 0xDA, 0x92, 0x72, 0x8B,
+	0x1A, 0x71, 0xDE, 0x0A, 0x9E, 0x06, 0x0B, 0x29,
+	0x05, 0xD6, 0xA5, 0xB6, 0x7E, 0xCD, 0x3B, 0x36,
+	0x92, 0xDD, 0xBD, 0x7F, 0x2D, 0x77, 0x8B, 0x8C,
+	0x98, 0x03, 0xAE, 0xE3, 0x28, 0x09, 0x1B, 0x58,
+	0xFA, 0xB3, 0x24, 0xE4, 0xFA, 0xD6, 0x75, 0x94,
+	0x55, 0x85, 0x80, 0x8B, 0x48, 0x31, 0xD7, 0xBC,
+	0x3F, 0xF4, 0xDE, 0xF0, 0x8E, 0x4B, 0x7A, 0x9D,
+	0xE5, 0x76, 0xD2, 0x65, 0x86, 0xCE, 0xC6, 0x4B,
+	0x61, 0x16
+};
+
+static const uint8_t chachapoly_test_tag[16] = {
+	0x1A, 0xE1, 0x0B, 0x59, 0x4F, 0x09, 0xE2, 0x6A,
+	0x7E, 0x90, 0x2E, 0xCB, 0xD0, 0x60, 0x06, 0x91
+};
+
+/*
+ * Checkup routine
+ */
+int chachapoly_self_test(int verbose)
+{
+	int i;
+	uint8_t key[32];
+	uint8_t buf[114];
+	uint8_t tag[16];
+	chachapoly_context ctx;
+
+	if (verbose != 0)
+		printf("  ChaCha20-Poly1305 test #1: ");
+
+	for (i = 0; i < 32; i++)
+		key[i] = (uint8_t)(0x80 + i);
+
+	chachapoly_setkey(&ctx, key);
+	chachapoly_crypt_and_tag(&ctx, CHACHAPOLY_ENCRYPT, 114,
+				 chachapoly_test_nonce, chachapoly_test_add, 12,
+				 (const uint8_t *)chachapoly_test_pt, buf, tag);
+
+	if (memcmp(buf, chachapoly_test_ct, 114) != 0 ||
+	    memcmp(tag, chachapoly_test_tag, 16) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	/*
+	 * In place, then with a corrupted tag
+	 */
+	if (chachapoly_auth_decrypt(&ctx, 114, chachapoly_test_nonce,
+				    chachapoly_test_add, 12, tag,
+				    buf, buf) != 0 ||
+	    memcmp(buf, chachapoly_test_pt, 114) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	tag[0] ^= 1;
+
+	if (chachapoly_auth_decrypt(&ctx, 114, chachapoly_test_nonce,
+				    chachapoly_test_add, 12, tag,
+				    chachapoly_test_ct, buf) !=
+	    TROPICSSL_ERR_CHACHAPOLY_AUTH_FAILED) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+}
+
+#endif
+
+#endif
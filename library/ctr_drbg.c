@@ -0,0 +1,397 @@
+/*
+ *  CTR_DRBG deterministic random bit generator
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  The generator is NIST SP 800-90A CTR_DRBG with AES-256 and the
+ *  block cipher derivation function:
+ *
+ *    http://csrc.nist.gov/publications/nistpubs/800-90A/SP800-90A.pdf
+ *
+ *  Each request is served from the keystream in one piece, so callers
+ *  ask for everything they need at once rather than byte by byte.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/ctr_drbg.h"
+
+#include <string.h>
+
+/*
+ * Seed material: entropy, nonce and personalization string
+ */
+#define CTR_DRBG_MAX_SEED_INPUT						\
+	(CTR_DRBG_ENTROPY_LEN + CTR_DRBG_NONCE_LEN + CTR_DRBG_MAX_INPUT)
+
+static void ctr_drbg_inc(uint8_t counter[16])
+{
+	int i;
+
+	for (i = 16; i > 0; i--)
+		if (++counter[i - 1] != 0)
+			break;
+}
+
+/*
+ * Block_Cipher_df (10.4.2): SEEDLEN bytes out of a || b
+ */
+static void ctr_drbg_df(uint8_t output[CTR_DRBG_SEEDLEN],
+			const uint8_t *a, size_t alen,
+			const uint8_t *b, size_t blen)
+{
+	uint8_t buf[8 + CTR_DRBG_MAX_SEED_INPUT + 16];
+	uint8_t tmp[CTR_DRBG_SEEDLEN];
+	uint8_t key[CTR_DRBG_KEYSIZE];
+	uint8_t chain[16];
+	uint8_t *x;
+	size_t i, j, n, len = alen + blen;
+	aes_context aes;
+
+	/*
+	 * S = L || N || input || 0x80, zero padded to whole blocks
+	 */
+	memset(buf, 0, sizeof(buf));
+	buf[0] = (uint8_t)(len >> 24);
+	buf[1] = (uint8_t)(len >> 16);
+	buf[2] = (uint8_t)(len >> 8);
+	buf[3] = (uint8_t)(len);
+	buf[7] = CTR_DRBG_SEEDLEN;
+	memcpy(buf + 8, a, alen);
+	if (blen > 0)
+		memcpy(buf + 8 + alen, b, blen);
+	buf[8 + len] = 0x80;
+	n = (8 + len + 1 + 15) & ~(size_t)15;
+
+	for (i = 0; i < CTR_DRBG_KEYSIZE; i++)
+		key[i] = (uint8_t)i;
+
+	aes_setkey_enc(&aes, key, CTR_DRBG_KEYSIZE * 8);
+
+	/*
+	 * BCC of (i || 0^96) || S, for each block of the temporary key
+	 */
+	for (j = 0; j < CTR_DRBG_SEEDLEN; j += 16) {
+		memset(chain, 0, 16);
+		chain[3] = (uint8_t)(j / 16);
+		aes_crypt_ecb(&aes, AES_ENCRYPT, chain, chain);
+
+		for (x = buf; x < buf + n; x += 16) {
+			for (i = 0; i < 16; i++)
+				chain[i] ^= x[i];
+
+			aes_crypt_ecb(&aes, AES_ENCRYPT, chain, chain);
+		}
+
+		memcpy(tmp + j, chain, 16);
+	}
+
+	aes_setkey_enc(&aes, tmp, CTR_DRBG_KEYSIZE * 8);
+
+	x = tmp + CTR_DRBG_KEYSIZE;
+	for (j = 0; j < CTR_DRBG_SEEDLEN; j += 16) {
+		aes_crypt_ecb(&aes, AES_ENCRYPT, x, output + j);
+		x = output + j;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	memset(tmp, 0, sizeof(tmp));
+	memset(&aes, 0, sizeof(aes_context));
+}
+
+/*
+ * CTR_DRBG_Update (10.2.1.2): the counter is kept at V + 1, which is
+ * the first block aes_ctr_keystream() encrypts
+ */
+static void ctr_drbg_update(ctr_drbg_context * ctx,
+			    const uint8_t data[CTR_DRBG_SEEDLEN])
+{
+	int i;
+	uint8_t tmp[CTR_DRBG_SEEDLEN];
+
+	aes_ctr_keystream(&ctx->aes, CTR_DRBG_SEEDLEN / 16, ctx->counter, tmp);
+
+	if (data != NULL)
+		for (i = 0; i < CTR_DRBG_SEEDLEN; i++)
+			tmp[i] ^= data[i];
+
+	aes_setkey_enc(&ctx->aes, tmp, CTR_DRBG_KEYSIZE * 8);
+
+	memcpy(ctx->counter, tmp + CTR_DRBG_KEYSIZE, 16);
+	ctr_drbg_inc(ctx->counter);
+
+	memset(tmp, 0, sizeof(tmp));
+}
+
+/*
+ * Fresh entropy (and the nonce, if asked for) mixed with the
+ * caller's data
+ */
+static int ctr_drbg_seed(ctr_drbg_context * ctx, size_t entropy_len,
+			 const uint8_t *additional, size_t len)
+{
+	uint8_t entropy[CTR_DRBG_ENTROPY_LEN + CTR_DRBG_NONCE_LEN];
+	uint8_t seed[CTR_DRBG_SEEDLEN];
+
+	if (len > CTR_DRBG_MAX_INPUT)
+		return (TROPICSSL_ERR_CTR_DRBG_INPUT_TOO_BIG);
+
+	if (ctx->f_entropy(ctx->p_entropy, entropy, entropy_len) != 0)
+		return (TROPICSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED);
+
+	ctr_drbg_df(seed, entropy, entropy_len, additional, len);
+	ctr_drbg_update(ctx, seed);
+	ctx->reseed_counter = 1;
+
+	memset(entropy, 0, sizeof(entropy));
+	memset(seed, 0, sizeof(seed));
+
+	return (0);
+}
+
+/*
+ * CTR_DRBG instantiation
+ */
+int ctr_drbg_init(ctr_drbg_context * ctx,
+		  int (*f_entropy) (void *, uint8_t *, size_t),
+		  void *p_entropy, const uint8_t *custom, size_t len)
+{
+	uint8_t key[CTR_DRBG_KEYSIZE];
+
+	memset(ctx, 0, sizeof(ctr_drbg_context));
+	memset(key, 0, sizeof(key));
+
+	ctx->f_entropy = f_entropy;
+	ctx->p_entropy = p_entropy;
+	ctx->reseed_interval = CTR_DRBG_RESEED_INTERVAL;
+
+	aes_setkey_enc(&ctx->aes, key, CTR_DRBG_KEYSIZE * 8);
+	ctr_drbg_inc(ctx->counter);
+
+	return (ctr_drbg_seed(ctx, CTR_DRBG_ENTROPY_LEN + CTR_DRBG_NONCE_LEN,
+			      custom, len));
+}
+
+/*
+ * CTR_DRBG reseeding
+ */
+int ctr_drbg_reseed(ctr_drbg_context * ctx,
+		    const uint8_t *additional, size_t len)
+{
+	return (ctr_drbg_seed(ctx, CTR_DRBG_ENTROPY_LEN, additional, len));
+}
+
+/*
+ * CTR_DRBG generation (10.2.1.5.2), of at most CTR_DRBG_MAX_REQUEST
+ */
+static int ctr_drbg_generate(ctr_drbg_context * ctx,
+			     uint8_t *output, size_t output_len,
+			     const uint8_t *additional, size_t add_len)
+{
+	int ret;
+	uint8_t add[CTR_DRBG_SEEDLEN];
+	uint8_t tmp[16];
+	size_t n;
+
+	if (add_len > CTR_DRBG_MAX_INPUT)
+		return (TROPICSSL_ERR_CTR_DRBG_INPUT_TOO_BIG);
+
+	if (ctx->reseed_counter > ctx->reseed_interval) {
+		if ((ret = ctr_drbg_reseed(ctx, additional, add_len)) != 0)
+			return (ret);
+
+		add_len = 0;
+	}
+
+	memset(add, 0, sizeof(add));
+
+	if (add_len > 0) {
+		ctr_drbg_df(add, additional, add_len, NULL, 0);
+		ctr_drbg_update(ctx, add);
+	}
+
+	/*
+	 * Whole blocks go straight into the output
+	 */
+	n = output_len / 16;
+	aes_ctr_keystream(&ctx->aes, n, ctx->counter, output);
+
+	if ((output_len & 15) != 0) {
+		aes_ctr_keystream(&ctx->aes, 1, ctx->counter, tmp);
+		memcpy(output + n * 16, tmp, output_len & 15);
+		memset(tmp, 0, sizeof(tmp));
+	}
+
+	ctr_drbg_update(ctx, add);
+	ctx->reseed_counter++;
+
+	memset(add, 0, sizeof(add));
+
+	return (0);
+}
+
+int ctr_drbg_random_with_add(void *p_rng,
+			     uint8_t *output, size_t output_len,
+			     const uint8_t *additional, size_t add_len)
+{
+	int ret;
+	size_t n;
+	ctr_drbg_context *ctx = (ctr_drbg_context *) p_rng;
+
+	/*
+	 * Longer requests are served in several generations; the
+	 * additional data goes into the first one
+	 */
+	do {
+		n = output_len;
+		if (n > CTR_DRBG_MAX_REQUEST)
+			n = CTR_DRBG_MAX_REQUEST;
+
+		ret = ctr_drbg_generate(ctx, output, n, additional, add_len);
+		if (ret != 0)
+			return (ret);
+
+		output += n;
+		output_len -= n;
+		add_len = 0;
+	} while (output_len > 0);
+
+	return (0);
+}
+
+int ctr_drbg_random(void *p_rng, uint8_t *output, size_t output_len)
+{
+	return (ctr_drbg_random_with_add(p_rng, output, output_len, NULL, 0));
+}
+
+void ctr_drbg_free(ctr_drbg_context * ctx)
+{
+	memset(ctx, 0, sizeof(ctr_drbg_context));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * Test vectors cross-checked with an independent CTR_DRBG
+ * (AES-256, derivation function, no prediction resistance)
+ */
+static const uint8_t ctr_drbg_test_out[2][64] = {
+	{
+	 0x3A, 0x54, 0x63, 0x55, 0x56, 0x96, 0x6E, 0x16,
+	 0xF7, 0x63, 0xF5, 0x19, 0xC1, 0x27, 0x08, 0x6B,
+	 0xC4, 0x46, 0x85, 0xBC, 0x6A, 0xD8, 0xCF, 0x15,
+	 0xC1, 0xDC, 0x68, 0x85, 0x9B, 0x62, 0xB1, 0xEB,
+	 0x4F, 0xE5, 0x48, 0x60, 0xD7, 0x88, 0xC0, 0xDE,
+	 0x20, 0x84, 0x20, 0x30, 0x90, 0x05, 0xD4, 0x49,
+	 0xD6, 0x17, 0xCC, 0xB2, 0xCB, 0xFA, 0x92, 0xA8,
+	 0x78, 0x87, 0x2D, 0xE7, 0x1B, 0x14, 0xDD, 0xB9},
+	{
+	 0x25, 0x31, 0xD6, 0xC0, 0x94, 0xB7, 0x32, 0xDB,
+	 0x85, 0xEE, 0x8D, 0x35, 0xC3, 0x2A, 0x35, 0x3B,
+	 0x3E, 0xAB, 0x9B, 0xE8, 0xDB, 0x85, 0x10, 0x5E,
+	 0xED, 0x1C, 0xD0, 0xFB, 0x54, 0x44, 0xED, 0xDD,
+	 0xA3, 0xD6, 0xA2, 0x63, 0x40, 0xE6, 0x8D, 0xC2,
+	 0x80, 0x7C, 0x56, 0xA5, 0x06, 0xBA, 0xCB, 0x20,
+	 0x5C, 0x25, 0xF7, 0xFD, 0x85, 0xA1, 0x2F, 0x04,
+	 0x50, 0x76, 0xD6, 0xED, 0x3E, 0xF1, 0x80, 0xF3}
+};
+
+/*
+ * Entropy 0x01, 0x08, 0x0F... for the seed and nonce, then
+ * 0x05, 0x12, 0x1F... for the reseed
+ */
+static int ctr_drbg_test_entropy(void *p, uint8_t *output, size_t len)
+{
+	size_t i;
+	int *calls = (int *)p;
+
+	for (i = 0; i < len; i++)
+		output[i] = (*calls == 0) ? (uint8_t)(i * 7 + 1) :
+		    (uint8_t)(i * 13 + 5);
+
+	(*calls)++;
+
+	return (0);
+}
+
+/*
+ * Checkup routine
+ */
+int ctr_drbg_self_test(int verbose)
+{
+	int i, calls = 0;
+	uint8_t add[3][16], buf[64];
+	ctr_drbg_context ctx;
+
+	if (verbose != 0)
+		printf("  CTR_DRBG test: ");
+
+	for (i = 0; i < 16; i++) {
+		add[0][i] = (uint8_t)(0x10 + i);
+		add[1][i] = (uint8_t)(0x40 + i);
+		add[2][i] = (uint8_t)(0x80 + i);
+	}
+
+	if (ctr_drbg_init(&ctx, ctr_drbg_test_entropy, &calls,
+			  (const uint8_t *)"tropicssl drbg ", 16) != 0 ||
+	    ctr_drbg_random_with_add(&ctx, buf, 64, add[0], 16) != 0 ||
+	    memcmp(buf, ctr_drbg_test_out[0], 64) != 0)
+		goto fail;
+
+	if (ctr_drbg_reseed(&ctx, add[1], 16) != 0 ||
+	    ctr_drbg_random_with_add(&ctx, buf, 64, add[2], 16) != 0 ||
+	    memcmp(buf, ctr_drbg_test_out[1], 64) != 0)
+		goto fail;
+
+	ctr_drbg_free(&ctx);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	ctr_drbg_free(&ctx);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
@@ -46,6 +46,22 @@
 #include "tropicssl/err.h"
 #include "tropicssl/des.h"
 
+#if defined(__GNUC__) && \
+    ( defined(__amd64__) || defined(__x86_64__) || \
+      ( defined(__aarch64__) && defined(__ARM_NEON) ) )
+#define TROPICSSL_DES_BITSLICE
+#endif
+
+#if defined(TROPICSSL_DES_BITSLICE) && \
+    ( defined(__amd64__) || defined(__x86_64__) ) && \
+    !defined(TROPICSSL_HAVE_X86_64)
+#define TROPICSSL_HAVE_X86_64
+#endif
+
+#if defined(TROPICSSL_HAVE_X86_64)
+#include <cpuid.h>
+#endif
+
 /*
  * 32-bit integer manipulation macros (big endian)
  */
@@ -585,6 +601,464 @@ void des3_crypt_ecb(des3_context * ctx,
 	PUT_UINT32_BE(X, output, 4);
 }
 
+#if defined(TROPICSSL_DES_BITSLICE)
+/*
+ * Bitsliced Triple-DES, used for bulk CBC decryption
+ *
+ * 256 blocks are processed side by side: plane i holds bit i of the X
+ * (or Y) word of every block, one block per bit lane, so each DES
+ * S-box becomes a fixed sequence of AND / OR / NOT over whole planes
+ * and no table is ever indexed with secret data. The frame is the one
+ * of the table code above: the output bits of every S-box land in the
+ * positions of the SB1 .. SB8 entries, so DES_IP / DES_FP and the
+ * subkeys of des3_context are used unmodified.
+ *
+ * Each S-box function below is the SBn table written as a sum of
+ * products: the minterms of three of its input bits select the rows,
+ * and the other three bits the column within the row.
+ */
+typedef uint64_t des_bs_t __attribute__ ((vector_size(32)));
+
+#define DES_BS_INLINE   inline __attribute__ ((always_inline))
+
+#define DES_BS_BLOCKS   256	/* blocks per batch              */
+#define DES_BS_MIN      64	/* below this, use the tables    */
+
+static DES_BS_INLINE void des_bs_s1(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[3], l1 = t[5], l2 = t[1];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[0], g1 = t[2], g2 = t[4];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[2] ^= (h0 & (m3 | m5 | m6)) | (h1 & (m2 | m4 | m7)) |
+	    (h2 & (q0 | m1 | m7)) | (h3 & (l0 | m0)) | (h4 & (n2 | q1)) |
+	    (h5 & (q2 | q1)) | (h6 & (q2 | m3 | m5)) |
+	    (h7 & (m1 | m2 | m4 | m7));
+	y[10] ^= (h0 & (q1 | m0 | m7)) | (h1 & (q1 | m2 | m4)) |
+	    (h2 & (q3 | m1 | m2)) | (h3 & (m0 | m6 | m7)) |
+	    (h4 & (q0 | q3 | m2)) | (h5 & (q0 | m3 | m6)) |
+	    (h6 & (m0 | m5 | m6)) | (h7 & (q2 | m1 | m3 | m4));
+	y[16] ^= (h0 & ~(m1 | m6)) | (h1 & (q2 | m1 | m3 | m4)) |
+	    (h2 & (m0 | m2)) | (h3 & (q0 | m1 | m7)) | (h4 & (q2 | m1)) |
+	    (h5 & (m2 | m4 | m5)) | (h6 & (q0 | m3 | m5 | m6)) |
+	    (h7 & (q3 | m0 | m6));
+	y[24] ^= (h0 & (m0 | m3 | m5)) | (h1 & (q2 | m1 | m4 | m7)) |
+	    (h2 & ~(m3 | m4)) | (h3 & (m1 | m2)) | (h4 & (l2 | q2)) |
+	    (h5 & (m0 | m1 | m3 | m6)) | (h6 & (m2 | m4)) | (h7 & (l2 | q0));
+}
+
+static DES_BS_INLINE void des_bs_s2(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[1], l1 = t[3], l2 = t[0];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[2], g1 = t[4], g2 = t[5];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[5] ^= (h0 & (q2 | m0 | m5)) | (h1 & (l0 | m4)) |
+	    (h2 & (q2 | m1 | m4)) | (h3 & (m1 | m2 | m7)) |
+	    (h4 & (q3 | m1 | m4)) | (h5 & (q2 | m0)) | (h6 & (m0 | m5 | m7)) |
+	    (h7 & (n1 | m3 | m6));
+	y[15] ^= (h0 & (n1 | m3 | m6)) | (h1 & (m2 | m5)) |
+	    (h2 & (m0 | m1 | m7)) | (h3 & (q2 | m1 | m4 | m7)) |
+	    (h4 & (m4 | m6 | m7)) | (h5 & (n2 | q1)) | (h6 & (q0 | q3 | m2)) |
+	    (h7 & (q3 | m4));
+	y[20] ^= (h0 & (m0 | m3 | m5 | m6)) | (h1 & (m0 | m1 | m6 | m7)) |
+	    (h2 & (q0 | m2 | m7)) | (h3 & (q1 | m3 | m6)) |
+	    (h4 & (q1 | m2 | m4 | m7)) | (h5 & (m1 | m2 | m4)) |
+	    (h6 & (m1 | m2 | m4)) | (h7 & (q3 | m0 | m5 | m6));
+	y[31] ^= (h0 & (n0 | l1)) | (h1 & (q1 | m2 | m7)) | (h2 & (m1 | m6)) |
+	    (h3 & (m0 | m3 | m5 | m6)) | (h4 & (q2 | m1 | m7)) |
+	    (h5 & (q0 | m1 | m7)) | (h6 & (m3 | m4 | m5)) |
+	    (h7 & (q2 | m1 | m3 | m4));
+}
+
+static DES_BS_INLINE void des_bs_s3(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[0], l1 = t[1], l2 = t[2];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[3], g1 = t[4], g2 = t[5];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[3] ^= (h0 & (m0 | m3 | m6)) | (h1 & (n1 | m2 | m7)) |
+	    (h2 & (m1 | m6 | m7)) | (h3 & (q0 | m3 | m5)) | (h4 & (m2 | m3)) |
+	    (h5 & (m1 | m2 | m4 | m7)) | (h6 & (q0 | q3 | m5)) |
+	    (h7 & (q2 | q1 | m4));
+	y[9] ^= (h0 & (q0 | m1 | m6 | m7)) | (h1 & (m4 | m7)) |
+	    (h2 & (q3 | m2 | m4)) | (h3 & (q1 | m0 | m3 | m6)) |
+	    (h4 & (m0 | m3 | m5 | m6)) | (h5 & (m0 | m2 | m3 | m5)) |
+	    (h6 & (m0 | m3 | m5 | m6)) | (h7 & (m1 | m2 | m4 | m7));
+	y[17] ^= (h0 & (m1 | m3 | m6)) | (h1 & (q0 | m3 | m5 | m6)) |
+	    (h2 & (l2 | q2)) | (h3 & (q1 | m2)) | (h4 & (q0 | m2 | m5)) |
+	    (h5 & (m1 | m2 | m7)) | (h6 & (q1 | m3 | m6)) |
+	    (h7 & (q0 | q3 | m6));
+	y[27] ^= (h0 & (q3 | m1 | m4)) | (h1 & (q2 | m1 | m4)) |
+	    (h2 & (q2 | m0 | m5)) | (h3 & (q3 | m0 | m5)) |
+	    (h4 & (q1 | m0 | m6)) | (h5 & (q3 | m2 | m4)) |
+	    (h6 & (q3 | m0 | m2)) | (h7 & (m0 | m1 | m3 | m6));
+}
+
+static DES_BS_INLINE void des_bs_s4(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[1], l1 = t[2], l2 = t[0];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[3], g1 = t[4], g2 = t[5];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[0] ^= (h0 & ~(m2 | m5)) | (h1 & (m2 | m5 | m7)) |
+	    (h2 & (m0 | m3 | m5)) | (h3 & (q0 | q3)) | (h4 & (m2 | m4 | m5)) |
+	    (h5 & (q2 | q1 | m3)) | (h6 & (n0 | m1 | m7)) | (h7 & (m0 | m5));
+	y[7] ^= (h0 & (q2 | q1 | m4)) | (h1 & (m2 | m3 | m5)) |
+	    (h2 & (m2 | m7)) | (h3 & (l0 | m0 | m6)) | (h4 & (m0 | m2 | m5)) |
+	    (h5 & ~(m2 | m5)) | (h6 & (q0 | q3)) | (h7 & (m2 | m4 | m7));
+	y[13] ^= (h0 & (q0 | m1 | m2 | m7)) | (h1 & (q1 | m4)) |
+	    (h2 & (q3 | m4 | m5)) | (h3 & (q2 | m1 | m3)) | (h4 & (q1 | m7)) |
+	    (h5 & (q2 | m0 | m3)) | (h6 & (m0 | m3 | m5 | m6)) |
+	    (h7 & (q0 | q3 | m5));
+	y[23] ^= (h0 & (q2 | m0 | m3)) | (h1 & (l0 | m4)) | (h2 & (q1 | m6)) |
+	    (h3 & (m0 | m3 | m5 | m6)) | (h4 & (n1 | m7)) |
+	    (h5 & (m1 | m2 | m4)) | (h6 & (q3 | m0 | m2)) |
+	    (h7 & (q1 | m6 | m7));
+}
+
+static DES_BS_INLINE void des_bs_s5(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[0], l1 = t[1], l2 = t[2];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[3], g1 = t[4], g2 = t[5];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[8] ^= (h0 & (q1 | m0 | m3)) | (h1 & (n0 | m3)) | (h2 & l2) |
+	    (h3 & (m1 | m4 | m7)) | (h4 & (q2 | m1 | m7)) |
+	    (h5 & (q0 | m3 | m5)) | (h6 & (m0 | m1 | m3)) |
+	    (h7 & (q2 | m0 | m1 | m7));
+	y[19] ^= (h0 & (m1 | m2 | m4 | m7)) | (h1 & (q1 | m0 | m3 | m6)) |
+	    (h2 & (q2 | q1)) | (h3 & (q0 | m7)) | (h4 & (m0 | m5 | m7)) |
+	    (h5 & (q3 | m2 | m4)) | (h6 & (q0 | m1 | m3 | m6)) |
+	    (h7 & (m0 | m3 | m5 | m6));
+	y[25] ^= (h0 & (q3 | m1 | m2)) | (h1 & (m2 | m4 | m5)) |
+	    (h2 & (m0 | m5 | m6 | m7)) | (h3 & (q0 | m3 | m5 | m6)) |
+	    (h4 & (q1 | m3 | m6)) | (h5 & (l1 | m0)) | (h6 & (q0 | q3 | m2)) |
+	    (h7 & (m1 | m6));
+	y[30] ^= (h0 & (m3 | m6)) | (h1 & (q0 | q3 | m5)) |
+	    (h2 & (q2 | q1 | m4)) | (h3 & (m0 | m1 | m3 | m6)) |
+	    (h4 & (m1 | m4 | m6 | m7)) | (h5 & (m1 | m2 | m4 | m7)) |
+	    (h6 & (l1 | m0)) | (h7 & (m2 | m5 | m7));
+}
+
+static DES_BS_INLINE void des_bs_s6(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[0], l1 = t[4], l2 = t[3];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[1], g1 = t[2], g2 = t[5];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[4] ^= (h0 & (m0 | m3 | m5 | m6)) | (h1 & (q2 | q1)) |
+	    (h2 & (m1 | m3 | m4 | m6)) | (h3 & (m0 | m2 | m3 | m5)) |
+	    (h4 & (m1 | m2 | m7)) | (h5 & (m0 | m3 | m5 | m6)) |
+	    (h6 & (q0 | m2 | m5)) | (h7 & (q3 | m0 | m1 | m6));
+	y[14] ^= (h0 & (m4 | m5)) | (h1 & (l1 | n2)) | (h2 & (l1 | m5)) |
+	    (h3 & (m0 | m5 | m6)) | (h4 & (q2 | m0 | m3 | m5)) |
+	    (h5 & (q1 | m6)) | (h6 & (m0 | m3 | m5 | m6)) | (h7 & (q0 | q3));
+	y[22] ^= (h0 & (q1 | m3 | m6)) | (h1 & (m1 | m4 | m6 | m7)) |
+	    (h2 & (q0 | m2 | m7)) | (h3 & (m0 | m1 | m3 | m6)) |
+	    (h4 & (q3 | m2 | m4)) | (h5 & (m0 | m1 | m3)) |
+	    (h6 & (q1 | m0 | m6)) | (h7 & (q2 | m3 | m4 | m5));
+	y[29] ^= (h0 & (q0 | m1 | m6)) | (h1 & (q1 | m2 | m7)) |
+	    (h2 & (m0 | m3 | m5)) | (h3 & (q0 | q3 | m6)) |
+	    (h4 & (m0 | m3 | m5)) | (h5 & (q0 | m3 | m6)) | (h6 & (l2 | q0)) |
+	    (h7 & (q1 | m2 | m7));
+}
+
+static DES_BS_INLINE void des_bs_s7(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[0], l1 = t[1], l2 = t[2];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[3], g1 = t[4], g2 = t[5];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[1] ^= (h0 & (q2 | q1)) | (h1 & (q0 | q3 | m6)) |
+	    (h2 & (m1 | m2 | m4 | m7)) | (h3 & (m2 | m3 | m5)) |
+	    (h4 & (l2 | q3)) | (h5 & (m0 | m5 | m6)) |
+	    (h6 & (q2 | m0 | m1 | m7)) | (h7 & (m1 | m4 | m7));
+	y[11] ^= (h0 & (l2 | q2)) | (h1 & (m0 | m7)) |
+	    (h2 & (m0 | m1 | m3 | m6)) | (h3 & (q3 | m1 | m2 | m4)) |
+	    (h4 & (m1 | m3 | m4)) | (h5 & (l2 | q2)) | (h6 & (q0 | m2 | m7)) |
+	    (h7 & (q1 | m3 | m6));
+	y[21] ^= (h0 & (m0 | m1 | m6 | m7)) | (h1 & (m0 | m1 | m6)) |
+	    (h2 & (q2 | q1 | m7)) | (h3 & (q0 | q3)) | (h4 & (q2 | q1)) |
+	    (h5 & (q0 | q3 | m6)) | (h6 & (q3 | m2 | m4)) |
+	    (h7 & (m1 | m2 | m7));
+	y[26] ^= (h0 & (q1 | m2 | m7)) | (h1 & (m0 | m3 | m5 | m6)) |
+	    (h2 & (q0 | m3 | m5 | m6)) | (h3 & (m0 | m3 | m6)) |
+	    (h4 & (q0 | m3 | m5 | m6)) | (h5 & (m1 | m2 | m4 | m7)) |
+	    (h6 & (q3 | m1 | m2)) | (h7 & (m2 | m4 | m5));
+}
+
+static DES_BS_INLINE void des_bs_s8(const des_bs_t t[6], des_bs_t y[32])
+{
+	des_bs_t l0 = t[1], l1 = t[5], l2 = t[0];
+	des_bs_t n0 = ~l0, n1 = ~l1, n2 = ~l2;
+	des_bs_t q0 = n0 & n1, q1 = l0 & n1, q2 = n0 & l1, q3 = l0 & l1;
+	des_bs_t m0 = q0 & n2, m1 = q1 & n2, m2 = q2 & n2, m3 = q3 & n2;
+	des_bs_t m4 = q0 & l2, m5 = q1 & l2, m6 = q2 & l2, m7 = q3 & l2;
+	des_bs_t g0 = t[2], g1 = t[3], g2 = t[4];
+	des_bs_t f0 = ~g0, f1 = ~g1, f2 = ~g2;
+	des_bs_t e0 = f0 & f1, e1 = g0 & f1, e2 = f0 & g1, e3 = g0 & g1;
+	des_bs_t h0 = e0 & f2, h1 = e1 & f2, h2 = e2 & f2, h3 = e3 & f2;
+	des_bs_t h4 = e0 & g2, h5 = e1 & g2, h6 = e2 & g2, h7 = e3 & g2;
+
+	y[6] ^= (h0 & (m0 | m2 | m5)) | (h1 & (q2 | m1 | m4 | m7)) |
+	    (h2 & (m0 | m1 | m3 | m6)) | (h3 & (m2 | m4 | m5 | m7)) |
+	    (h4 & (l2 | q3)) | (h5 & (m1 | m3 | m4)) |
+	    (h6 & (m0 | m2 | m5 | m7)) | (h7 & (q2 | m0 | m1));
+	y[12] ^= (h0 & ~(m1 | m6)) | (h1 & (q3 | m4)) | (h2 & (q1 | m2)) |
+	    (h3 & (q0 | m1 | m7)) | (h4 & (q1 | m6)) |
+	    (h5 & (m0 | m3 | m5 | m6)) | (h6 & (l1 | m0)) |
+	    (h7 & (m1 | m2 | m4 | m7));
+	y[18] ^= (h0 & (q2 | q1 | m3)) | (h1 & (m6 | m7)) | (h2 & (n1 | m7)) |
+	    (h3 & (q0 | m2 | m3)) | (h4 & (m0 | m3 | m6)) | (h5 & (n1 | m2)) |
+	    (h6 & (q2 | m3 | m5)) | (h7 & (q1 | m6 | m7));
+	y[28] ^= (h0 & (m0 | m3 | m5)) | (h1 & (q0 | m5 | m6)) |
+	    (h2 & (q3 | m1 | m2 | m4)) | (h3 & (q2 | m0 | m7)) |
+	    (h4 & (q0 | m1 | m6 | m7)) | (h5 & (q2 | q1 | m3)) |
+	    (h6 & (m2 | m5)) | (h7 & (q0 | q3));
+}
+
+/*
+ * One DES round on planes: b ^= f(a, k0, k1), as DES_ROUND(a, b)
+ */
+#define DES_BS_KEY(k,n)	((uint64_t) 0 - (((k) >> (n)) & 1))
+
+#define DES_BS_INPUT(a,k,s,r)						\
+	do {								\
+		for (j = 0; j < 6; j++)					\
+			t[j] = a[((s) + j + (r)) & 31]			\
+				^ DES_BS_KEY(k, (s) + j);		\
+	} while (0)
+
+static DES_BS_INLINE void des_bs_round(const des_bs_t a[32], des_bs_t b[32],
+				       uint32_t k0, uint32_t k1)
+{
+	int j;
+	des_bs_t t[6];
+
+	DES_BS_INPUT(a, k0, 0, 0);
+	des_bs_s8(t, b);
+	DES_BS_INPUT(a, k0, 8, 0);
+	des_bs_s6(t, b);
+	DES_BS_INPUT(a, k0, 16, 0);
+	des_bs_s4(t, b);
+	DES_BS_INPUT(a, k0, 24, 0);
+	des_bs_s2(t, b);
+
+	DES_BS_INPUT(a, k1, 0, 4);
+	des_bs_s7(t, b);
+	DES_BS_INPUT(a, k1, 8, 4);
+	des_bs_s5(t, b);
+	DES_BS_INPUT(a, k1, 16, 4);
+	des_bs_s3(t, b);
+	DES_BS_INPUT(a, k1, 24, 4);
+	des_bs_s1(t, b);
+}
+
+/*
+ * 64x64 bit matrix transpose: bit j of w[i] <-> bit i of w[j]
+ */
+static void des_bs_transpose(uint64_t w[64])
+{
+	int i, s;
+	uint64_t m, t;
+
+	for (s = 32, m = 0x00000000FFFFFFFFULL; s > 0; s >>= 1, m ^= m << s) {
+		for (i = 0; i < 64; i = ((i | s) + 1) & ~s) {
+			t = ((w[i] >> s) ^ w[i + s]) & m;
+			w[i] ^= t << s;
+			w[i + s] ^= t;
+		}
+	}
+}
+
+/*
+ * 3DES-ECB on DES_BS_BLOCKS blocks, in place
+ */
+static DES_BS_INLINE void des3_bs_ecb(const uint32_t *SK, uint8_t *buf)
+{
+	int i, j;
+	uint32_t X, Y, T;
+	uint64_t w[4][64];
+	des_bs_t x[32], y[32];
+
+	for (i = 0; i < DES_BS_BLOCKS; i++) {
+		GET_UINT32_BE(X, buf, i * 8);
+		GET_UINT32_BE(Y, buf, i * 8 + 4);
+		DES_IP(X, Y);
+		w[i >> 6][i & 63] = ((uint64_t) X << 32) | Y;
+	}
+
+	for (j = 0; j < 4; j++)
+		des_bs_transpose(w[j]);
+
+	for (i = 0; i < 32; i++) {
+		for (j = 0; j < 4; j++) {
+			x[i][j] = w[j][32 + i];
+			y[i][j] = w[j][i];
+		}
+	}
+
+	for (i = 0; i < 8; i++, SK += 4) {
+		des_bs_round(y, x, SK[0], SK[1]);
+		des_bs_round(x, y, SK[2], SK[3]);
+	}
+
+	for (i = 0; i < 8; i++, SK += 4) {
+		des_bs_round(x, y, SK[0], SK[1]);
+		des_bs_round(y, x, SK[2], SK[3]);
+	}
+
+	for (i = 0; i < 8; i++, SK += 4) {
+		des_bs_round(y, x, SK[0], SK[1]);
+		des_bs_round(x, y, SK[2], SK[3]);
+	}
+
+	for (i = 0; i < 32; i++) {
+		for (j = 0; j < 4; j++) {
+			w[j][32 + i] = x[i][j];
+			w[j][i] = y[i][j];
+		}
+	}
+
+	for (j = 0; j < 4; j++)
+		des_bs_transpose(w[j]);
+
+	for (i = 0; i < DES_BS_BLOCKS; i++) {
+		X = (uint32_t) (w[i >> 6][i & 63] >> 32);
+		Y = (uint32_t) w[i >> 6][i & 63];
+		DES_FP(Y, X);
+		PUT_UINT32_BE(Y, buf, i * 8);
+		PUT_UINT32_BE(X, buf, i * 8 + 4);
+	}
+}
+
+static void des3_bs_ecb_generic(const uint32_t *SK, uint8_t *buf)
+{
+	des3_bs_ecb(SK, buf);
+}
+
+#if defined(TROPICSSL_HAVE_X86_64)
+__attribute__ ((target("avx2")))
+static void des3_bs_ecb_avx2(const uint32_t *SK, uint8_t *buf)
+{
+	des3_bs_ecb(SK, buf);
+}
+
+/*
+ * AVX2 detection: CPUID leaf 7 and the OS saving the YMM registers
+ */
+static int des_has_avx2(void)
+{
+	static int done = 0;
+	static int avx2 = 0;
+
+	if (done == 0) {
+		unsigned int a, b, c, d, xcr0;
+
+		if (__get_cpuid(1, &a, &b, &c, &d) != 0 &&
+		    (c & 0x18000000u) == 0x18000000u) {
+			__asm__ volatile ("xgetbv" : "=a" (xcr0),
+					  "=d" (d) : "c" (0));
+
+			if ((xcr0 & 6) == 6 && __get_cpuid_max(0, NULL) >= 7) {
+				__cpuid_count(7, 0, a, b, c, d);
+				avx2 = (b & 0x00000020u) != 0;
+			}
+		}
+
+		done = 1;
+	}
+
+	return (avx2);
+}
+#endif
+
+/*
+ * 3DES-CBC decryption of up to DES_BS_BLOCKS blocks; input and
+ * output may be the same buffer
+ */
+static void des3_bs_cbc_dec(des3_context * ctx, size_t nblocks,
+			    uint8_t iv[8], const uint8_t *input,
+			    uint8_t *output)
+{
+	size_t i, j;
+	uint8_t buf[DES_BS_BLOCKS * 8];
+	uint8_t temp[8];
+
+	memcpy(buf, input, nblocks * 8);
+	memset(buf + nblocks * 8, 0, (DES_BS_BLOCKS - nblocks) * 8);
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	if (des_has_avx2())
+		des3_bs_ecb_avx2(ctx->sk, buf);
+	else
+#endif
+		des3_bs_ecb_generic(ctx->sk, buf);
+
+	memcpy(temp, input + (nblocks - 1) * 8, 8);
+
+	for (i = nblocks - 1; i > 0; i--)
+		for (j = 0; j < 8; j++)
+			output[i * 8 + j] = (uint8_t)(buf[i * 8 + j] ^
+						      input[i * 8 + j - 8]);
+
+	for (j = 0; j < 8; j++)
+		output[j] = (uint8_t)(buf[j] ^ iv[j]);
+
+	memcpy(iv, temp, 8);
+}
+#endif				/* TROPICSSL_DES_BITSLICE */
+
 /*
  * 3DES-CBC buffer encryption/decryption
  */
@@ -611,6 +1085,21 @@ void des3_crypt_cbc(des3_context * ctx,
 			length -= 8;
 		}
 	} else {		/* DES_DECRYPT */
+#if defined(TROPICSSL_DES_BITSLICE)
+		while (length >= DES_BS_MIN * 8) {
+			size_t n = length / 8;
+
+			if (n > DES_BS_BLOCKS)
+				n = DES_BS_BLOCKS;
+
+			des3_bs_cbc_dec(ctx, n, iv, input, output);
+
+			input += n * 8;
+			output += n * 8;
+			length -= n * 8;
+		}
+#endif
+
 		while (length > 0) {
 			memcpy(temp, input, 8);
 			des3_crypt_ecb(ctx, input, output);
@@ -686,6 +1175,7 @@ int des_self_test(int verbose)
 	uint8_t buf[8];
 	uint8_t prv[8];
 	uint8_t iv[8];
+	uint8_t big[300 * 8];
 
 	memset(key, 0, 24);
 
@@ -849,8 +1339,37 @@ int des_self_test(int verbose)
 			printf("passed\n");
 	}
 
+	/*
+	 * CBC mode, long message: encrypted one block at a time,
+	 * decrypted in a single call (the bitsliced path where present)
+	 */
 	if (verbose != 0)
-		printf("\n");
+		printf("  DES3-CBC-168 (bulk): ");
+
+	for (j = 0; j < sizeof(big); j++)
+		big[j] = (uint8_t)(j * 7 + (j >> 8));
+
+	des3_set3key_enc(&ctx3, (uint8_t *)des3_test_keys);
+	memcpy(iv, des3_test_iv, 8);
+
+	for (j = 0; j < sizeof(big); j += 8)
+		des3_crypt_cbc(&ctx3, DES_ENCRYPT, 8, iv, big + j, big + j);
+
+	des3_set3key_dec(&ctx3, (uint8_t *)des3_test_keys);
+	memcpy(iv, des3_test_iv, 8);
+	des3_crypt_cbc(&ctx3, DES_DECRYPT, sizeof(big), iv, big, big);
+
+	for (j = 0; j < sizeof(big); j++) {
+		if (big[j] != (uint8_t)(j * 7 + (j >> 8))) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+	}
+
+	if (verbose != 0)
+		printf("passed\n\n");
 
 	return (0);
 }
@@ -44,6 +44,7 @@
 
 #include "tropicssl/err.h"
 #include "tropicssl/dhm.h"
+#include "tropicssl/trace.h"
 
 #include <string.h>
 
@@ -76,7 +77,7 @@ static int dhm_read_bignum(mpi * X, uint8_t **p, const uint8_t *end)
  */
 int dhm_read_params(dhm_context * ctx, uint8_t **p, const uint8_t *end)
 {
-	int ret, n;
+	int ret;
 
 	memset(ctx, 0, sizeof(dhm_context));
 
@@ -87,49 +88,40 @@ int dhm_read_params(dhm_context * ctx, uint8_t **p, const uint8_t *end)
 
 	ctx->len = mpi_size(&ctx->P);
 
-	if (end - *p < 2)
-		return (TROPICSSL_ERR_BAD_ARG);
-
-	n = ((*p)[0] << 8) | (*p)[1];
-	(*p) += 2;
-
-	if (end != *p + n)
-		return (TROPICSSL_ERR_BAD_ARG);
-
 	return (0);
 }
 
 /*
- * Setup and write the ServerKeyExchange parameters
+ * Random private value of x_size bits, less than P
  */
-int dhm_make_params(dhm_context * ctx, int x_size,
-		    uint8_t *output, size_t *olen,
-		    int (*f_rng) (void *), void *p_rng)
+static int dhm_gen_x(mpi * X, int x_size, const mpi * P,
+		     int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
 {
-	int i, ret, n;
-	size_t n1, n2, n3;
-	uint8_t *p;
+	int ret, n;
 
-	/*
-	 * generate X and calculate GX = G^X mod P
-	 */
 	n = x_size / sizeof(t_uint);
-	MPI_CHK(mpi_grow(&ctx->X, n));
-	MPI_CHK(mpi_lset(&ctx->X, 0));
+	MPI_CHK(mpi_grow(X, n));
+	MPI_CHK(mpi_lset(X, 0));
 
-	n = x_size >> 3;
-	p = (uint8_t *)ctx->X.p;
-	for (i = 0; i < n; i++)
-		*p++ = (uint8_t)f_rng(p_rng);
+	MPI_CHK(f_rng(p_rng, (uint8_t *)X->p, x_size >> 3));
 
-	while (mpi_cmp_mpi(&ctx->X, &ctx->P) >= 0)
-		mpi_shift_r(&ctx->X, 1);
+	while (mpi_cmp_mpi(X, P) >= 0)
+		mpi_shift_r(X, 1);
 
-	MPI_CHK(mpi_exp_mod(&ctx->GX, &ctx->G, &ctx->X, &ctx->P, &ctx->RP));
+cleanup:
+
+	return (ret);
+}
+
+/*
+ * Export P, G and GX
+ */
+static int dhm_write_params(dhm_context * ctx, uint8_t *output, size_t *olen)
+{
+	int ret;
+	size_t n1, n2, n3;
+	uint8_t *p;
 
-	/*
-	 * export P, G, GX
-	 */
 #define DHM_MPI_EXPORT(X,n)						\
 	MPI_CHK( mpi_write_binary( X, p + 2, n ) ); \
 	*p++ = (uint8_t)( n >> 8 );			\
@@ -150,6 +142,31 @@ int dhm_make_params(dhm_context * ctx, int x_size,
 
 cleanup:
 
+	return (ret);
+}
+
+/*
+ * Setup and write the ServerKeyExchange parameters
+ */
+int dhm_make_params(dhm_context * ctx, int x_size,
+		    uint8_t *output, size_t *olen,
+		    int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	int ret;
+
+	TROPICSSL_TRACE2(dhm_make_params_start, ctx, mpi_msb(&ctx->P));
+
+	/*
+	 * generate X and calculate GX = G^X mod P
+	 */
+	MPI_CHK(dhm_gen_x(&ctx->X, x_size, &ctx->P, f_rng, p_rng));
+	MPI_CHK(mpi_exp_mod(&ctx->GX, &ctx->G, &ctx->X, &ctx->P, &ctx->RP));
+	MPI_CHK(dhm_write_params(ctx, output, olen));
+
+cleanup:
+
+	TROPICSSL_TRACE3(dhm_make_params_done, ctx, ret, 1);
+
 	if (ret != 0)
 		return (ret | TROPICSSL_ERR_DHM_MAKE_PARAMS_FAILED);
 
@@ -177,35 +194,27 @@ int dhm_read_public(dhm_context * ctx, const uint8_t *input, size_t ilen)
  */
 int dhm_make_public(dhm_context * ctx, int x_size,
 		    uint8_t *output, size_t olen,
-		    int (*f_rng) (void *), void *p_rng)
+		    int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
 {
-	int ret, i, n;
-	uint8_t *p;
+	int ret;
 
 	if (ctx == NULL || olen < 1 || olen > ctx->len)
 		return (TROPICSSL_ERR_BAD_ARG);
 
+	TROPICSSL_TRACE2(dhm_make_public_start, ctx, mpi_msb(&ctx->P));
+
 	/*
 	 * generate X and calculate GX = G^X mod P
 	 */
-	n = x_size / sizeof(t_uint);
-	MPI_CHK(mpi_grow(&ctx->X, n));
-	MPI_CHK(mpi_lset(&ctx->X, 0));
-
-	n = x_size >> 3;
-	p = (uint8_t *)ctx->X.p;
-	for (i = 0; i < n; i++)
-		*p++ = (uint8_t)f_rng(p_rng);
-
-	while (mpi_cmp_mpi(&ctx->X, &ctx->P) >= 0)
-		mpi_shift_r(&ctx->X, 1);
-
+	MPI_CHK(dhm_gen_x(&ctx->X, x_size, &ctx->P, f_rng, p_rng));
 	MPI_CHK(mpi_exp_mod(&ctx->GX, &ctx->G, &ctx->X, &ctx->P, &ctx->RP));
 
 	MPI_CHK(mpi_write_binary(&ctx->GX, output, olen));
 
 cleanup:
 
+	TROPICSSL_TRACE2(dhm_make_public_done, ctx, ret);
+
 	if (ret != 0)
 		return (TROPICSSL_ERR_DHM_MAKE_PUBLIC_FAILED | ret);
 
@@ -222,6 +231,8 @@ int dhm_calc_secret(dhm_context * ctx, uint8_t *output, size_t *olen)
 	if (ctx == NULL || *olen < ctx->len)
 		return (TROPICSSL_ERR_BAD_ARG);
 
+	TROPICSSL_TRACE2(dhm_calc_secret_start, ctx, mpi_msb(&ctx->P));
+
 	MPI_CHK(mpi_exp_mod(&ctx->K, &ctx->GY, &ctx->X, &ctx->P, &ctx->RP));
 
 	*olen = mpi_size(&ctx->K);
@@ -230,6 +241,8 @@ int dhm_calc_secret(dhm_context * ctx, uint8_t *output, size_t *olen)
 
 cleanup:
 
+	TROPICSSL_TRACE2(dhm_calc_secret_done, ctx, ret);
+
 	if (ret != 0)
 		return (TROPICSSL_ERR_DHM_CALC_SECRET_FAILED | ret);
 
@@ -245,6 +258,154 @@ void dhm_free(dhm_context * ctx)
 		 &ctx->GX, &ctx->X, &ctx->G, &ctx->P, NULL);
 }
 
+#if defined(WIN32)
+#define DHM_SHARED_LOCK(s)      EnterCriticalSection(&(s)->lock)
+#define DHM_SHARED_UNLOCK(s)    LeaveCriticalSection(&(s)->lock)
+#else
+#define DHM_SHARED_LOCK(s)      pthread_mutex_lock(&(s)->lock)
+#define DHM_SHARED_UNLOCK(s)    pthread_mutex_unlock(&(s)->lock)
+#endif
+
+/*
+ * Set up the state shared by a server's contexts
+ */
+int dhm_shared_init(dhm_shared * S, const mpi * P, const mpi * G,
+		    int x_size)
+{
+	int ret;
+
+	if (x_size < 8 || mpi_cmp_int(G, 2) < 0 || mpi_cmp_mpi(G, P) >= 0)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	memset(S, 0, sizeof(dhm_shared));
+
+#if defined(WIN32)
+	InitializeCriticalSection(&S->lock);
+#else
+	pthread_mutex_init(&S->lock, NULL);
+#endif
+
+	S->x_size = x_size;
+
+	MPI_CHK(mpi_copy(&S->P, P));
+	MPI_CHK(mpi_copy(&S->G, G));
+	MPI_CHK(mpi_mont_init(&S->M, &S->P));
+	MPI_CHK(mpi_comb_init(&S->C, &S->G, x_size, 0, &S->P, &S->M));
+
+cleanup:
+
+	if (ret != 0)
+		dhm_shared_free(S);
+
+	return (ret);
+}
+
+/*
+ * Reuse each ephemeral key pair for a while
+ */
+void dhm_shared_reuse(dhm_shared * S, int max_uses, int max_age)
+{
+	DHM_SHARED_LOCK(S);
+
+	S->max_uses = max_uses;
+	S->max_age = max_age;
+	S->uses = 0;
+
+	DHM_SHARED_UNLOCK(S);
+}
+
+/*
+ * Setup and write the ServerKeyExchange parameters, reusing the
+ * current key pair of S when its limits allow
+ */
+int dhm_make_params_shared(dhm_context * ctx, dhm_shared * S,
+			   uint8_t *output, size_t *olen,
+			   int (*f_rng) (void *, uint8_t *, size_t),
+			   void *p_rng)
+{
+	int ret = 0, reuse, fresh = 1;
+	time_t now = 0;
+
+	TROPICSSL_TRACE2(dhm_make_params_start, ctx, mpi_msb(&S->P));
+
+	MPI_CHK(mpi_copy(&ctx->P, &S->P));
+	MPI_CHK(mpi_copy(&ctx->G, &S->G));
+
+	DHM_SHARED_LOCK(S);
+
+	reuse = S->max_uses != 1 && (S->max_uses != 0 || S->max_age != 0);
+
+	if (reuse) {
+		if (S->max_age != 0)
+			now = time(NULL);
+
+		if (S->uses > 0 &&
+		    (S->max_uses == 0 || S->uses < S->max_uses) &&
+		    (S->max_age == 0 || now - S->born < S->max_age)) {
+			if ((ret = mpi_copy(&ctx->X, &S->X)) == 0 &&
+			    (ret = mpi_copy(&ctx->GX, &S->GX)) == 0) {
+				S->uses++;
+				fresh = 0;
+			}
+		}
+	}
+
+	DHM_SHARED_UNLOCK(S);
+
+	MPI_CHK(ret);
+
+	if (fresh) {
+		/*
+		 * The comb is only read, so this needs no lock
+		 */
+		MPI_CHK(dhm_gen_x(&ctx->X, S->x_size, &S->P, f_rng, p_rng));
+		MPI_CHK(mpi_exp_mod_comb(&ctx->GX, &ctx->X, &S->P,
+					 &S->M, &S->C));
+
+		if (reuse) {
+			DHM_SHARED_LOCK(S);
+
+			if ((ret = mpi_copy(&S->X, &ctx->X)) == 0 &&
+			    (ret = mpi_copy(&S->GX, &ctx->GX)) == 0) {
+				S->born = now;
+				S->uses = 1;
+			} else
+				S->uses = 0;
+
+			DHM_SHARED_UNLOCK(S);
+
+			MPI_CHK(ret);
+		}
+	}
+
+	MPI_CHK(dhm_write_params(ctx, output, olen));
+
+cleanup:
+
+	TROPICSSL_TRACE3(dhm_make_params_done, ctx, ret, fresh);
+
+	if (ret != 0)
+		return (ret | TROPICSSL_ERR_DHM_MAKE_PARAMS_FAILED);
+
+	return (0);
+}
+
+/*
+ * Free the shared state
+ */
+void dhm_shared_free(dhm_shared * S)
+{
+	mpi_comb_free(&S->C);
+	mpi_mont_free(&S->M);
+	mpi_free(&S->GX, &S->X, &S->G, &S->P, NULL);
+
+#if defined(WIN32)
+	DeleteCriticalSection(&S->lock);
+#else
+	pthread_mutex_destroy(&S->lock);
+#endif
+}
+
 #if defined(TROPICSSL_SELF_TEST)
 
 /*
@@ -0,0 +1,1177 @@
+/*
+ *  Elliptic curve P-256 and ECDH
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  The curve and its TLS encoding:
+ *
+ *  SEC 2: Recommended Elliptic Curve Domain Parameters, secp256r1
+ *  RFC 4492, Elliptic Curve Cryptography (ECC) Cipher Suites for TLS
+ *
+ *  Field elements are kept fully reduced and in Montgomery form,
+ *  times R = 2^256 mod p. Points use the complete projective formulas
+ *  for a = -3 of
+ *
+ *  J. Renes, C. Costello, L. Batina, "Complete addition formulas for
+ *  prime order elliptic curves", EUROCRYPT 2016
+ *
+ *  so that doubling, the point at infinity and P + P need no special
+ *  case: every scalar multiplication runs the same operations and
+ *  table lookups, whatever the scalar.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_ECP)
+
+#include "tropicssl/ecp.h"
+#include "tropicssl/trace.h"
+
+#include <string.h>
+
+/*
+ * Limbs: 64-bit where the compiler has a 128-bit product, 32-bit
+ * otherwise. Constants are written as pairs of 32-bit words.
+ */
+#if defined(__SIZEOF_INT128__)
+typedef uint64_t ecp_limb;
+typedef unsigned __int128 ecp_dlimb;
+#define ECP_W(lo, hi)   (((uint64_t) (hi) << 32) | (lo))
+#else
+typedef uint32_t ecp_limb;
+typedef uint64_t ecp_dlimb;
+#define ECP_W(lo, hi)   (lo), (hi)
+#endif
+
+#define ECP_LIMBS       (ECP_P256_LEN / sizeof(ecp_limb))
+#define ECP_LIMB_BITS   (8 * sizeof(ecp_limb))
+
+typedef ecp_limb ecp_fe[ECP_LIMBS];
+
+typedef struct {
+	ecp_fe X, Y, Z;
+} ecp_point;
+
+/*
+ * p, and the order n (both as is)
+ */
+static const ecp_fe P256_P = {
+	ECP_W(0xFFFFFFFF, 0xFFFFFFFF), ECP_W(0xFFFFFFFF, 0x00000000),
+	ECP_W(0x00000000, 0x00000000), ECP_W(0x00000001, 0xFFFFFFFF)
+};
+
+static const ecp_fe P256_N = {
+	ECP_W(0xFC632551, 0xF3B9CAC2), ECP_W(0xA7179E84, 0xBCE6FAAD),
+	ECP_W(0xFFFFFFFF, 0xFFFFFFFF), ECP_W(0x00000000, 0xFFFFFFFF)
+};
+
+/*
+ * Montgomery forms (times R = 2^256 mod p) of b and 1; R^2 mod p
+ */
+static const ecp_fe P256_B = {
+	ECP_W(0x29C4BDDF, 0xD89CDF62), ECP_W(0x78843090, 0xACF005CD),
+	ECP_W(0xF7212ED6, 0xE5A220AB), ECP_W(0x04874834, 0xDC30061D)
+};
+
+static const ecp_fe P256_ONE = {
+	ECP_W(0x00000001, 0x00000000), ECP_W(0x00000000, 0xFFFFFFFF),
+	ECP_W(0xFFFFFFFF, 0xFFFFFFFF), ECP_W(0xFFFFFFFE, 0x00000000)
+};
+
+static const ecp_fe P256_RR = {
+	ECP_W(0x00000003, 0x00000000), ECP_W(0xFFFFFFFF, 0xFFFFFFFB),
+	ECP_W(0xFFFFFFFE, 0xFFFFFFFF), ECP_W(0xFFFFFFFD, 0x00000004)
+};
+
+/*
+ * Fixed-base comb: entry i - 1 is the affine point
+ *
+ *     sum over the bits j of i of 2^(52 j).G,     1 <= i <= 31
+ *
+ * in Montgomery form, so that the 5 bits k[c], k[52 + c], ...,
+ * k[208 + c] of a scalar select one entry for each of the 52
+ * columns c.
+ */
+#define ECP_COMB_TEETH   5
+#define ECP_COMB_COLS   52
+
+static const ecp_fe ecp_p256_comb[31][2] = {
+	{{ECP_W(0x18A9143C, 0x79E730D4), ECP_W(0x5FEDB601, 0x75BA95FC),
+	  ECP_W(0x77622510, 0x79FB732B), ECP_W(0xA53755C6, 0x18905F76)},
+	 {ECP_W(0xCE95560A, 0xDDF25357), ECP_W(0xBA19E45C, 0x8B4AB8E4),
+	  ECP_W(0xDD21F325, 0xD2E88688), ECP_W(0x25885D85, 0x8571FF18)}},
+	{{ECP_W(0xCECA9754, 0x83F49167), ECP_W(0x4B7939A0, 0x426D2CF6),
+	  ECP_W(0x723FD0BF, 0x2555E355), ECP_W(0xC4F144E2, 0xA96E6D06)},
+	 {ECP_W(0x87880E61, 0x4768A8DD), ECP_W(0xE508E4D5, 0x15543815),
+	  ECP_W(0xB1B65E15, 0x09D7E772), ECP_W(0xAC302FA0, 0x63439DD6)}},
+	{{ECP_W(0xA0BE5D0E, 0xF2675562), ECP_W(0x4D1BB068, 0x4B524D25),
+	  ECP_W(0xA9B75B8C, 0xBC2C5FF2), ECP_W(0xD9A6F548, 0x4F326643)},
+	 {ECP_W(0x1258835E, 0x50DD6844), ECP_W(0x676090E0, 0x7D21BEEE),
+	  ECP_W(0xF4A17B42, 0xB0B62C65), ECP_W(0xB3CEC3B0, 0x60DFAE28)}},
+	{{ECP_W(0xCF7D62D2, 0x20D3C982), ECP_W(0x23BA8150, 0x1F36E29D),
+	  ECP_W(0x92763F9E, 0x48AE0BF0), ECP_W(0x1D3A7007, 0x7A527E6B)},
+	 {ECP_W(0x581A85E3, 0xB4A89097), ECP_W(0xDC158BE5, 0x1F1A520F),
+	  ECP_W(0x167D726E, 0xF98DB37D), ECP_W(0x1113E862, 0x8802786E)}},
+	{{ECP_W(0xB113F918, 0x531E7B64), ECP_W(0x920A681D, 0x26B5D70A),
+	  ECP_W(0x24C37044, 0x04E52F8F), ECP_W(0xBB7C375B, 0xBC7C9542)},
+	 {ECP_W(0xF2E26375, 0xB63A044B), ECP_W(0xE922A3D0, 0xD842A342),
+	  ECP_W(0xA9292D57, 0x9EED2ECA), ECP_W(0x49AC7832, 0xFE27D2C2)}},
+	{{ECP_W(0xF24AAB7E, 0xEDBD7944), ECP_W(0xCD1A1921, 0x56E51D9E),
+	  ECP_W(0x962DAE55, 0x11C63188), ECP_W(0x326ACD14, 0x37090565)},
+	 {ECP_W(0xD71ED134, 0xC436E587), ECP_W(0xAD89B461, 0x3D96AC3A),
+	  ECP_W(0xDCB718BB, 0xCDF570BC), ECP_W(0xDCFABDE2, 0xAAA490E9)}},
+	{{ECP_W(0x0B639942, 0xB0AB5401), ECP_W(0x19379664, 0xA6E12F57),
+	  ECP_W(0x1D040ABC, 0xC535F8B4), ECP_W(0xA75EEF24, 0xEF255C54)},
+	 {ECP_W(0xAECEB0EA, 0xB236F734), ECP_W(0x9D879E2F, 0x38FCC8C1),
+	  ECP_W(0x180CACAB, 0x674D8FDC), ECP_W(0xF624DF06, 0x0A18BAD4)}},
+	{{ECP_W(0xCA8D9D1A, 0x488F1185), ECP_W(0xD987DED2, 0xADF2C77D),
+	  ECP_W(0x60C46124, 0x5F3039F0), ECP_W(0x71E095F4, 0xE5D70B75)},
+	 {ECP_W(0x6260E70F, 0x82D58650), ECP_W(0xF750D105, 0x39D75EA7),
+	  ECP_W(0x75BAC364, 0x8CF3D0B1), ECP_W(0x21D01329, 0xF3A7564D)}},
+	{{ECP_W(0x60530D0A, 0x83FC8091), ECP_W(0x7BC23DC8, 0x58C24F52),
+	  ECP_W(0xA653AF5A, 0xECDE2F1F), ECP_W(0xB10E511E, 0xB2E2A374)},
+	 {ECP_W(0x9BEBE1E4, 0xF0C54B32), ECP_W(0xADE42270, 0x239C25DF),
+	  ECP_W(0x9F22B433, 0xD866F55E), ECP_W(0xED17EFD3, 0x1E513CA2)}},
+	{{ECP_W(0x5BC98E0D, 0x66313DC8), ECP_W(0x9A256888, 0xB13FE4E6),
+	  ECP_W(0xECD6E280, 0x74816589), ECP_W(0x5BA88474, 0xDEE13CDE)},
+	 {ECP_W(0xC53BC78D, 0xAE4E1872), ECP_W(0x2F08A464, 0x9B79904A),
+	  ECP_W(0x9DA51935, 0xEF6E5CE2), ECP_W(0x083C47EA, 0x9E58DF82)}},
+	{{ECP_W(0xF5A32632, 0x4E066713), ECP_W(0x4B36F498, 0x431F75D4),
+	  ECP_W(0x70BD5F07, 0x40AE279F), ECP_W(0x239EC23D, 0x252CDB93)},
+	 {ECP_W(0x7312A246, 0xC18DDDF8), ECP_W(0x23A9E561, 0x5B77673C),
+	  ECP_W(0x1715FEDE, 0x020F09C3), ECP_W(0xA580CFC5, 0xABEF6451)}},
+	{{ECP_W(0xF2A0D962, 0x3C8BC3BF), ECP_W(0x3405A8AA, 0x59F856EE),
+	  ECP_W(0xB3DC5948, 0x2FB6590C), ECP_W(0xED85740E, 0xC8AA740C)},
+	 {ECP_W(0xE9AAFE19, 0xF8081CFB), ECP_W(0x2534800D, 0xF7D2E1F3),
+	  ECP_W(0x8D78D247, 0x355148C2), ECP_W(0xD1557399, 0xAF0DC5A4)}},
+	{{ECP_W(0xC7F68782, 0x34DFBFC4), ECP_W(0x08AC2685, 0x2C6A80D6),
+	  ECP_W(0x08D0255B, 0x5479E1BC), ECP_W(0x9110C616, 0x42EB9DE0)},
+	 {ECP_W(0x10B4ACBA, 0x97991DD8), ECP_W(0x94D997C7, 0xF36ACC8F),
+	  ECP_W(0x69DDC036, 0xD05AD78B), ECP_W(0xE68B4243, 0x1AC7E528)}},
+	{{ECP_W(0xE82C8E2A, 0xDD9F8A00), ECP_W(0x21F80126, 0x104B85C6),
+	  ECP_W(0x5B17A522, 0x1997228D), ECP_W(0x923D0BD0, 0x706E5EC3)},
+	 {ECP_W(0x1DC33622, 0x00C6AF27), ECP_W(0x271F09E1, 0xB3BC76C8),
+	  ECP_W(0xE36E325A, 0xEC1B7C0B), ECP_W(0x68F12BFE, 0x128200E2)}},
+	{{ECP_W(0xA8636D07, 0x8E86CB3D), ECP_W(0x2BE46DA2, 0xC79C42AC),
+	  ECP_W(0xAA01E0E1, 0xED70E08A), ECP_W(0xE3B69272, 0x773579FC)},
+	 {ECP_W(0x4D8464C3, 0xBC0FE555), ECP_W(0xCF54E071, 0x9E87A057),
+	  ECP_W(0x3913B1D3, 0xDA655B0A), ECP_W(0x9A55DBA4, 0x052774D4)}},
+	{{ECP_W(0xADF7CCCF, 0x75D9BC15), ECP_W(0xDFA1E1B0, 0x81A3E5D6),
+	  ECP_W(0x249BC17E, 0x8C39E444), ECP_W(0x8EA7FD43, 0xF37DCCB2)},
+	 {ECP_W(0x907FBA12, 0xDA654873), ECP_W(0x4A372904, 0x35DAA6DA),
+	  ECP_W(0x6283A6C5, 0x0564CFC6), ECP_W(0x4A9395BF, 0xD09FA4F6)}},
+	{{ECP_W(0xE37542CA, 0xB1F5C026), ECP_W(0x72E01034, 0x0B860CF3),
+	  ECP_W(0x025289F2, 0x3A7C10E4), ECP_W(0x92901032, 0xD2197D5F)},
+	 {ECP_W(0x267CA2F6, 0xFA06F835), ECP_W(0xBF6E43AA, 0x8FCB9A29),
+	  ECP_W(0x7ED9F8E7, 0x465F6C11), ECP_W(0xE6077AAF, 0x8A50A5B3)}},
+	{{ECP_W(0xD2B59E85, 0xAD76C703), ECP_W(0x9204C53F, 0x0A230645),
+	  ECP_W(0x4A9F1335, 0x9BBC0BC4), ECP_W(0xD0A967E9, 0x71603515)},
+	 {ECP_W(0xA0205375, 0x8B6D6D6E), ECP_W(0x51AD76DE, 0x63104183),
+	  ECP_W(0xAABBD0AC, 0x5ABFBC21), ECP_W(0xC71F3060, 0x61FB45C3)}},
+	{{ECP_W(0x1D323961, 0x579345DF), ECP_W(0x94CD3BC4, 0x45B79EAD),
+	  ECP_W(0x423668D2, 0x50B664BE), ECP_W(0x42BC26EA, 0x19DD5B75)},
+	 {ECP_W(0x3677AE8F, 0xC7C1FBAA), ECP_W(0x5D033158, 0x7B2E711A),
+	  ECP_W(0x8942AC93, 0x8AECB50A), ECP_W(0x8A16718C, 0xE255438B)}},
+	{{ECP_W(0x33396533, 0x80253642), ECP_W(0x2C5AD150, 0x82CB33A7),
+	  ECP_W(0x070CA168, 0x7C147998), ECP_W(0x6AAC6636, 0x07791253)},
+	 {ECP_W(0x7C78BE24, 0x160003AE), ECP_W(0xA30EEABF, 0xBBA9FE68),
+	  ECP_W(0x3073F0ED, 0x16C31C40), ECP_W(0x789CAECA, 0xD329CD28)}},
+	{{ECP_W(0x7972BCDF, 0x840DBCBF), ECP_W(0xBD11900C, 0xB5C8444F),
+	  ECP_W(0x16520CEE, 0x78B2B290), ECP_W(0xBE88D914, 0xE19F13A3)},
+	 {ECP_W(0x49D3C0DF, 0x052DDC89), ECP_W(0xE0B4224B, 0xC9FC183C),
+	  ECP_W(0xCF31E0BB, 0x2C8DD074), ECP_W(0xA26B1441, 0x872C7B95)}},
+	{{ECP_W(0x74C8A327, 0xED93585D), ECP_W(0x06BE87CA, 0xF2FB7D08),
+	  ECP_W(0x84E36244, 0x707D83CA), ECP_W(0x3EFA6833, 0x037F499D)},
+	 {ECP_W(0x99BF5DDE, 0xF3218D42), ECP_W(0x69FF7CE3, 0xBE0A81C0),
+	  ECP_W(0x9EB7D4C0, 0x068FBBEA), ECP_W(0xE6938C78, 0xF4EF6609)}},
+	{{ECP_W(0xCB22715E, 0x202E5C5A), ECP_W(0x288F8243, 0x88E93D23),
+	  ECP_W(0xDC7EACE6, 0xDF1D1F52), ECP_W(0x373183F8, 0xC6B38B3B)},
+	 {ECP_W(0x3EAC9C4B, 0x77798B7F), ECP_W(0x6BFA9835, 0xA9D37DFF),
+	  ECP_W(0xFAAC41C9, 0xAFF4A447), ECP_W(0x0FCB6036, 0xF14FD13C)}},
+	{{ECP_W(0x49CCC093, 0xEF5EE27D), ECP_W(0x40D359A3, 0x7FF3263D),
+	  ECP_W(0xC6D6C0EA, 0x885D1942), ECP_W(0x28C97FEE, 0x925ABBA3)},
+	 {ECP_W(0x5D95F52D, 0xD7383480), ECP_W(0x4EB691DB, 0x6979981C),
+	  ECP_W(0x553A29C6, 0x6544E8AE), ECP_W(0x5043559F, 0x28324EF8)}},
+	{{ECP_W(0x300C0E39, 0xD6C8E4B7), ECP_W(0x3E37F58A, 0x37AD4A1A),
+	  ECP_W(0xE5E8CDFB, 0x763330F5), ECP_W(0x870EA133, 0x62BF8C2C)},
+	 {ECP_W(0x763CCAC9, 0x03FBC63A), ECP_W(0xFB1886C0, 0xC889D8A5),
+	  ECP_W(0xBE49D9FE, 0xF0486DE5), ECP_W(0x62C23338, 0xAF9A8778)}},
+	{{ECP_W(0x76AA81B3, 0x8A43A2A1), ECP_W(0x8A0CC3D2, 0x89602129),
+	  ECP_W(0x821F6640, 0x49D311E8), ECP_W(0x5C734AE4, 0x8035608F)},
+	 {ECP_W(0x349ADC3B, 0xA7BE0561), ECP_W(0x96A337B5, 0x328525B2),
+	  ECP_W(0x6BCCF78A, 0x575413C3), ECP_W(0x4854960F, 0x6C7292EC)}},
+	{{ECP_W(0x3C2943FF, 0x121E6A71), ECP_W(0x6374C47E, 0x0468565C),
+	  ECP_W(0x2826F138, 0xD66FE993), ECP_W(0x7748E3AC, 0x4E2CFAF1)},
+	 {ECP_W(0x4708A6C8, 0xE9BAAA2C), ECP_W(0x66FFB5B4, 0xA3845C8C),
+	  ECP_W(0xB77C8FAC, 0xAD3E293E), ECP_W(0x440A35E8, 0x00B5CFA9)}},
+	{{ECP_W(0x63E06277, 0x3F55F58C), ECP_W(0x64BA6E8C, 0x1A81DE8A),
+	  ECP_W(0xF4CC043B, 0x85CFDC74), ECP_W(0x048D26E0, 0x7CBEFB98)},
+	 {ECP_W(0x82ABA891, 0x5BDE4B3C), ECP_W(0x86DB6F46, 0x863D8F75),
+	  ECP_W(0x845186C5, 0xC7AF5C1F), ECP_W(0xCB527CEC, 0x41D7D404)}},
+	{{ECP_W(0x83E1A246, 0x3B446994), ECP_W(0xF6B819A2, 0x11C5CED4),
+	  ECP_W(0xAFF79A46, 0xC79D4660), ECP_W(0x5F22411A, 0x423BBDC1)},
+	 {ECP_W(0xA964039D, 0x22652251), ECP_W(0xE738657B, 0x808D6753),
+	  ECP_W(0x4E909DC8, 0xC0CA19E3), ECP_W(0x34AB0D07, 0x0E036E47)}},
+	{{ECP_W(0x7A26F742, 0x233593E7), ECP_W(0xFC0F14D9, 0xDDC1C79F),
+	  ECP_W(0x2D359358, 0xB33C8980), ECP_W(0x730AACFE, 0x51DF6155)},
+	 {ECP_W(0x0F2C0B8D, 0xA9A6066C), ECP_W(0x2E706F80, 0xB9212227),
+	  ECP_W(0x96A5EFE9, 0x3994A532), ECP_W(0x52316B12, 0xCF3D168B)}},
+	{{ECP_W(0x27EAFCC0, 0xBE47DD50), ECP_W(0xEC7E66DB, 0x23DF1041),
+	  ECP_W(0x78A4DDDD, 0x18C977FF), ECP_W(0x9D2D152E, 0xB51565D7)},
+	 {ECP_W(0x78F4A4DE, 0x24F6A6D5), ECP_W(0x7D86B2CA, 0xBBC15B20),
+	  ECP_W(0x1D3B43CA, 0xA064D39C), ECP_W(0x52200839, 0x55248667)}}
+};
+
+/*
+ * All-ones if a == b, zero otherwise
+ */
+static ecp_limb ecp_ct_eq(uint32_t a, uint32_t b)
+{
+	uint32_t x = a ^ b;
+
+	return ((ecp_limb) 0 - (((x | (0 - x)) >> 31) ^ 1));
+}
+
+/*
+ * r = a if mask is all-ones, r unchanged if it is zero
+ */
+static void fe_cmov(ecp_fe r, const ecp_fe a, ecp_limb mask)
+{
+	size_t i;
+
+	for (i = 0; i < ECP_LIMBS; i++)
+		r[i] = (r[i] & ~mask) | (a[i] & mask);
+}
+
+/*
+ * r = a - p if a + (carry << 256) >= p, else a
+ */
+static void fe_reduce_once(ecp_fe r, ecp_limb carry)
+{
+	size_t i;
+	ecp_dlimb d;
+	ecp_limb borrow = 0;
+	ecp_fe t;
+
+	for (i = 0; i < ECP_LIMBS; i++) {
+		d = (ecp_dlimb) r[i] - P256_P[i] - borrow;
+		t[i] = (ecp_limb) d;
+		borrow = (ecp_limb) (d >> ECP_LIMB_BITS) & 1;
+	}
+
+	fe_cmov(r, t, (ecp_limb) 0 - (carry | (borrow ^ 1)));
+}
+
+static void fe_add(ecp_fe r, const ecp_fe a, const ecp_fe b)
+{
+	size_t i;
+	ecp_dlimb t = 0;
+
+	for (i = 0; i < ECP_LIMBS; i++) {
+		t += (ecp_dlimb) a[i] + b[i];
+		r[i] = (ecp_limb) t;
+		t >>= ECP_LIMB_BITS;
+	}
+
+	fe_reduce_once(r, (ecp_limb) t);
+}
+
+static void fe_sub(ecp_fe r, const ecp_fe a, const ecp_fe b)
+{
+	size_t i;
+	ecp_dlimb d, t = 0;
+	ecp_limb mask, borrow = 0;
+
+	for (i = 0; i < ECP_LIMBS; i++) {
+		d = (ecp_dlimb) a[i] - b[i] - borrow;
+		r[i] = (ecp_limb) d;
+		borrow = (ecp_limb) (d >> ECP_LIMB_BITS) & 1;
+	}
+
+	/*
+	 * Add p back if it went negative
+	 */
+	mask = (ecp_limb) 0 - borrow;
+
+	for (i = 0; i < ECP_LIMBS; i++) {
+		t += (ecp_dlimb) r[i] + (P256_P[i] & mask);
+		r[i] = (ecp_limb) t;
+		t >>= ECP_LIMB_BITS;
+	}
+}
+
+#if defined(__SIZEOF_INT128__)
+
+/*
+ * (hi:lo) = a.b + c + d, which cannot overflow
+ */
+#define ECP_MAC(lo, hi, a, b, c, d)					\
+	do {								\
+		ecp_dlimb t_ = (ecp_dlimb) (a) * (b) + (c) + (d);	\
+		(lo) = (uint64_t) t_;					\
+		(hi) = (uint64_t) (t_ >> 64);				\
+	} while (0)
+
+#define ECP_ROW(x, r0, r1, r2, r3, r4)					\
+	do {								\
+		ECP_MAC(r0, k, x, b[0], r0, 0);				\
+		ECP_MAC(r1, k, x, b[1], r1, k);				\
+		ECP_MAC(r2, k, x, b[2], r2, k);				\
+		ECP_MAC(r3, r4, x, b[3], r3, k);			\
+	} while (0)
+
+/*
+ * One Montgomery step: m = r0 (as -1/p = 1 mod 2^64) cancels r0;
+ * p = 2^256 - 2^224 + 2^192 + 2^96 - 1 has the words
+ * { 2^64 - 1, 2^32 - 1, 0, 2^64 - 2^32 + 1 }, and m.(2^64 - 1) + r0
+ * is just m.2^64. cy carries into r4 from the previous step and out
+ * of it for the next one.
+ */
+#define ECP_REDC(r0, r1, r2, r3, r4)					\
+	do {								\
+		m = r0;							\
+		ECP_MAC(r1, k, m, 0x00000000FFFFFFFF, r1, m);		\
+		ECP_MAC(r2, k, 0, 0, r2, k);				\
+		ECP_MAC(r3, k, m, 0xFFFFFFFF00000001, r3, k);		\
+		ECP_MAC(r4, cy, 1, r4, k, cy);				\
+	} while (0)
+
+/*
+ * r = a.b / R mod p, unrolled on four 64-bit limbs
+ */
+static void fe_mul(ecp_fe r, const ecp_fe a, const ecp_fe b)
+{
+	uint64_t k, m, cy;
+	uint64_t z0 = 0, z1 = 0, z2 = 0, z3 = 0, z4, z5, z6, z7;
+
+	ECP_ROW(a[0], z0, z1, z2, z3, z4);
+	ECP_ROW(a[1], z1, z2, z3, z4, z5);
+	ECP_ROW(a[2], z2, z3, z4, z5, z6);
+	ECP_ROW(a[3], z3, z4, z5, z6, z7);
+
+	cy = 0;
+	ECP_REDC(z0, z1, z2, z3, z4);
+	ECP_REDC(z1, z2, z3, z4, z5);
+	ECP_REDC(z2, z3, z4, z5, z6);
+	ECP_REDC(z3, z4, z5, z6, z7);
+
+	r[0] = z4;
+	r[1] = z5;
+	r[2] = z6;
+	r[3] = z7;
+	fe_reduce_once(r, cy);
+}
+
+#else
+
+/*
+ * r = a.b / R mod p (word-by-word Montgomery). The low 96 bits of p
+ * are all ones, so -1/p is 1 modulo either limb size and each
+ * reduction factor is simply the low limb.
+ */
+static void fe_mul(ecp_fe r, const ecp_fe a, const ecp_fe b)
+{
+	size_t i, j;
+	ecp_dlimb t;
+	ecp_limb m, c[ECP_LIMBS + 2];
+
+	memset(c, 0, sizeof(c));
+
+	for (i = 0; i < ECP_LIMBS; i++) {
+		t = 0;
+
+		for (j = 0; j < ECP_LIMBS; j++) {
+			t += (ecp_dlimb) a[i] * b[j] + c[j];
+			c[j] = (ecp_limb) t;
+			t >>= ECP_LIMB_BITS;
+		}
+
+		t += c[ECP_LIMBS];
+		c[ECP_LIMBS] = (ecp_limb) t;
+		c[ECP_LIMBS + 1] = (ecp_limb) (t >> ECP_LIMB_BITS);
+
+		m = c[0];
+		t = ((ecp_dlimb) m * P256_P[0] + c[0]) >> ECP_LIMB_BITS;
+
+		for (j = 1; j < ECP_LIMBS; j++) {
+			t += (ecp_dlimb) m * P256_P[j] + c[j];
+			c[j - 1] = (ecp_limb) t;
+			t >>= ECP_LIMB_BITS;
+		}
+
+		t += c[ECP_LIMBS];
+		c[ECP_LIMBS - 1] = (ecp_limb) t;
+		c[ECP_LIMBS] = c[ECP_LIMBS + 1] + (ecp_limb) (t >> ECP_LIMB_BITS);
+	}
+
+	memcpy(r, c, sizeof(ecp_fe));
+	fe_reduce_once(r, c[ECP_LIMBS]);
+}
+
+#endif
+
+static void fe_sqr(ecp_fe r, const ecp_fe a)
+{
+	fe_mul(r, a, a);
+}
+
+static void fe_sqr_n(ecp_fe r, const ecp_fe a, int n)
+{
+	fe_sqr(r, a);
+
+	while (--n > 0)
+		fe_sqr(r, r);
+}
+
+/*
+ * r = a^(p - 2) = 1 / a, with the exponent
+ *
+ *     ffffffff 00000001 00000000 00000000
+ *     00000000 ffffffff ffffffff fffffffd
+ *
+ * built from runs of ones: 255 squarings and 13 multiplications
+ */
+static void fe_inv(ecp_fe r, const ecp_fe a)
+{
+	ecp_fe x2, x3, x6, x12, x15, x30, x32, t;
+
+	fe_sqr(x2, a);
+	fe_mul(x2, x2, a);
+	fe_sqr(x3, x2);
+	fe_mul(x3, x3, a);
+	fe_sqr_n(x6, x3, 3);
+	fe_mul(x6, x6, x3);
+	fe_sqr_n(x12, x6, 6);
+	fe_mul(x12, x12, x6);
+	fe_sqr_n(x15, x12, 3);
+	fe_mul(x15, x15, x3);
+	fe_sqr_n(x30, x15, 15);
+	fe_mul(x30, x30, x15);
+	fe_sqr_n(x32, x30, 2);
+	fe_mul(x32, x32, x2);
+
+	fe_sqr_n(t, x32, 32);
+	fe_mul(t, t, a);
+	fe_sqr_n(t, t, 96);
+	fe_sqr_n(t, t, 32);
+	fe_mul(t, t, x32);
+	fe_sqr_n(t, t, 32);
+	fe_mul(t, t, x32);
+	fe_sqr_n(t, t, 30);
+	fe_mul(t, t, x30);
+	fe_sqr_n(t, t, 2);
+	fe_mul(r, t, a);
+}
+
+/*
+ * Big-endian import and export, as is
+ */
+static void fe_read(ecp_fe r, const uint8_t *buf)
+{
+	size_t i;
+
+	memset(r, 0, sizeof(ecp_fe));
+
+	for (i = 0; i < ECP_P256_LEN; i++)
+		r[i / sizeof(ecp_limb)] |= (ecp_limb) buf[ECP_P256_LEN - 1 - i]
+		    << (8 * (i % sizeof(ecp_limb)));
+}
+
+static void fe_write(uint8_t *buf, const ecp_fe a)
+{
+	size_t i;
+
+	for (i = 0; i < ECP_P256_LEN; i++)
+		buf[ECP_P256_LEN - 1 - i] =
+		    (uint8_t) (a[i / sizeof(ecp_limb)] >> (8 * (i % sizeof(ecp_limb))));
+}
+
+/*
+ * 1 if a < m (no early exit)
+ */
+static int fe_less_than(const ecp_fe a, const ecp_fe m)
+{
+	size_t i;
+	ecp_dlimb d;
+	ecp_limb borrow = 0;
+
+	for (i = 0; i < ECP_LIMBS; i++) {
+		d = (ecp_dlimb) a[i] - m[i] - borrow;
+		borrow = (ecp_limb) (d >> ECP_LIMB_BITS) & 1;
+	}
+
+	return ((int)borrow);
+}
+
+static int fe_is_zero(const ecp_fe a)
+{
+	size_t i;
+	ecp_limb x = 0;
+
+	for (i = 0; i < ECP_LIMBS; i++)
+		x |= a[i];
+
+	return ((int)(((x | (0 - x)) >> (ECP_LIMB_BITS - 1)) ^ 1));
+}
+
+/*
+ * R = P + Q, RCB algorithm 4; R may be P or Q
+ */
+static void ecp_add(ecp_point * R, const ecp_point * P, const ecp_point * Q)
+{
+	ecp_fe t0, t1, t2, t3, t4, X3, Y3, Z3;
+
+	fe_mul(t0, P->X, Q->X);
+	fe_mul(t1, P->Y, Q->Y);
+	fe_mul(t2, P->Z, Q->Z);
+	fe_add(t3, P->X, P->Y);
+	fe_add(t4, Q->X, Q->Y);
+	fe_mul(t3, t3, t4);
+	fe_add(t4, t0, t1);
+	fe_sub(t3, t3, t4);
+	fe_add(t4, P->Y, P->Z);
+	fe_add(X3, Q->Y, Q->Z);
+	fe_mul(t4, t4, X3);
+	fe_add(X3, t1, t2);
+	fe_sub(t4, t4, X3);
+	fe_add(X3, P->X, P->Z);
+	fe_add(Y3, Q->X, Q->Z);
+	fe_mul(X3, X3, Y3);
+	fe_add(Y3, t0, t2);
+	fe_sub(Y3, X3, Y3);
+	fe_mul(Z3, P256_B, t2);
+	fe_sub(X3, Y3, Z3);
+	fe_add(Z3, X3, X3);
+	fe_add(X3, X3, Z3);
+	fe_sub(Z3, t1, X3);
+	fe_add(X3, t1, X3);
+	fe_mul(Y3, P256_B, Y3);
+	fe_add(t1, t2, t2);
+	fe_add(t2, t1, t2);
+	fe_sub(Y3, Y3, t2);
+	fe_sub(Y3, Y3, t0);
+	fe_add(t1, Y3, Y3);
+	fe_add(Y3, t1, Y3);
+	fe_add(t1, t0, t0);
+	fe_add(t0, t1, t0);
+	fe_sub(t0, t0, t2);
+	fe_mul(t1, t4, Y3);
+	fe_mul(t2, t0, Y3);
+	fe_mul(Y3, X3, Z3);
+	fe_add(Y3, Y3, t2);
+	fe_mul(X3, X3, t3);
+	fe_sub(X3, X3, t1);
+	fe_mul(Z3, Z3, t4);
+	fe_mul(t1, t3, t0);
+	fe_add(Z3, Z3, t1);
+
+	memcpy(R->X, X3, sizeof(ecp_fe));
+	memcpy(R->Y, Y3, sizeof(ecp_fe));
+	memcpy(R->Z, Z3, sizeof(ecp_fe));
+}
+
+/*
+ * R = 2 P, RCB algorithm 6; R may be P
+ */
+static void ecp_double(ecp_point * R, const ecp_point * P)
+{
+	ecp_fe t0, t1, t2, t3, X3, Y3, Z3;
+
+	fe_sqr(t0, P->X);
+	fe_sqr(t1, P->Y);
+	fe_sqr(t2, P->Z);
+	fe_mul(t3, P->X, P->Y);
+	fe_add(t3, t3, t3);
+	fe_mul(Z3, P->X, P->Z);
+	fe_add(Z3, Z3, Z3);
+	fe_mul(Y3, P256_B, t2);
+	fe_sub(Y3, Y3, Z3);
+	fe_add(X3, Y3, Y3);
+	fe_add(Y3, X3, Y3);
+	fe_sub(X3, t1, Y3);
+	fe_add(Y3, t1, Y3);
+	fe_mul(Y3, X3, Y3);
+	fe_mul(X3, X3, t3);
+	fe_add(t3, t2, t2);
+	fe_add(t2, t2, t3);
+	fe_mul(Z3, P256_B, Z3);
+	fe_sub(Z3, Z3, t2);
+	fe_sub(Z3, Z3, t0);
+	fe_add(t3, Z3, Z3);
+	fe_add(Z3, Z3, t3);
+	fe_add(t3, t0, t0);
+	fe_add(t0, t3, t0);
+	fe_sub(t0, t0, t2);
+	fe_mul(t0, t0, Z3);
+	fe_add(Y3, Y3, t0);
+	fe_mul(t0, P->Y, P->Z);
+	fe_add(t0, t0, t0);
+	fe_mul(Z3, t0, Z3);
+	fe_sub(X3, X3, Z3);
+	fe_mul(Z3, t0, t1);
+	fe_add(Z3, Z3, Z3);
+	fe_add(Z3, Z3, Z3);
+
+	memcpy(R->X, X3, sizeof(ecp_fe));
+	memcpy(R->Y, Y3, sizeof(ecp_fe));
+	memcpy(R->Z, Z3, sizeof(ecp_fe));
+}
+
+static void ecp_set_zero(ecp_point * R)
+{
+	memset(R, 0, sizeof(ecp_point));
+	memcpy(R->Y, P256_ONE, sizeof(ecp_fe));
+}
+
+/*
+ * R = T[i], reading every entry
+ */
+static void ecp_select(ecp_point * R, const ecp_point T[16], uint32_t i)
+{
+	uint32_t j;
+	ecp_limb mask;
+
+	memset(R, 0, sizeof(ecp_point));
+
+	for (j = 0; j < 16; j++) {
+		mask = ecp_ct_eq(i, j);
+		fe_cmov(R->X, T[j].X, mask);
+		fe_cmov(R->Y, T[j].Y, mask);
+		fe_cmov(R->Z, T[j].Z, mask);
+	}
+}
+
+/*
+ * R = comb entry i (1..31), or the point at infinity for i = 0
+ */
+static void ecp_select_comb(ecp_point * R, uint32_t i)
+{
+	uint32_t j;
+	ecp_limb mask;
+
+	ecp_set_zero(R);
+
+	for (j = 1; j < 32; j++) {
+		mask = ecp_ct_eq(i, j);
+		fe_cmov(R->X, ecp_p256_comb[j - 1][0], mask);
+		fe_cmov(R->Y, ecp_p256_comb[j - 1][1], mask);
+		fe_cmov(R->Z, P256_ONE, mask);
+	}
+}
+
+/*
+ * Bit i of a big-endian scalar, 0 past its end
+ */
+static uint32_t ecp_scalar_bit(const uint8_t k[ECP_P256_LEN], int i)
+{
+	if (i >= 8 * ECP_P256_LEN)
+		return (0);
+
+	return ((k[ECP_P256_LEN - 1 - (i >> 3)] >> (i & 7)) & 1);
+}
+
+/*
+ * R = k.G: 52 doublings and 52 additions
+ */
+static void ecp_mul_base(ecp_point * R, const uint8_t k[ECP_P256_LEN])
+{
+	int c, j;
+	uint32_t i;
+	ecp_point S;
+
+	ecp_set_zero(R);
+
+	for (c = ECP_COMB_COLS - 1; c >= 0; c--) {
+		ecp_double(R, R);
+
+		for (j = 0, i = 0; j < ECP_COMB_TEETH; j++)
+			i |= ecp_scalar_bit(k, j * ECP_COMB_COLS + c) << j;
+
+		ecp_select_comb(&S, i);
+		ecp_add(R, R, &S);
+	}
+
+	memset(&S, 0, sizeof(S));
+}
+
+/*
+ * R = k.P with a fixed 4-bit window: 256 doublings, 64 additions
+ */
+static void ecp_mul_point(ecp_point * R, const uint8_t k[ECP_P256_LEN],
+			  const ecp_point * P)
+{
+	int i;
+	uint32_t w;
+	ecp_point S, T[16];
+
+	ecp_set_zero(&T[0]);
+	memcpy(&T[1], P, sizeof(ecp_point));
+
+	for (i = 2; i < 16; i += 2) {
+		ecp_double(&T[i], &T[i >> 1]);
+		ecp_add(&T[i + 1], &T[i], P);
+	}
+
+	ecp_set_zero(R);
+
+	for (i = 0; i < 2 * ECP_P256_LEN; i++) {
+		ecp_double(R, R);
+		ecp_double(R, R);
+		ecp_double(R, R);
+		ecp_double(R, R);
+
+		w = (k[i >> 1] >> ((i & 1) ? 0 : 4)) & 0x0F;
+
+		ecp_select(&S, T, w);
+		ecp_add(R, R, &S);
+	}
+
+	memset(&S, 0, sizeof(S));
+	memset(T, 0, sizeof(T));
+}
+
+/*
+ * Export to affine coordinates; fails for the point at infinity
+ */
+static int ecp_write_point(uint8_t buf[ECP_P256_POINT_LEN],
+			   const ecp_point * R)
+{
+	static const ecp_fe one = { 1 };
+	ecp_fe zi, t;
+
+	if (fe_is_zero(R->Z))
+		return (TROPICSSL_ERR_ECP_INVALID_KEY);
+
+	/*
+	 * 1/Z, times 1/R to leave the Montgomery form
+	 */
+	fe_inv(zi, R->Z);
+	fe_mul(zi, zi, one);
+
+	buf[0] = 0x04;
+	fe_mul(t, R->X, zi);
+	fe_write(buf + 1, t);
+	fe_mul(t, R->Y, zi);
+	fe_write(buf + 1 + ECP_P256_LEN, t);
+
+	memset(zi, 0, sizeof(zi));
+	memset(t, 0, sizeof(t));
+
+	return (0);
+}
+
+/*
+ * Import an uncompressed point: x, y < p and y^2 = x^3 - 3x + b
+ */
+static int ecp_read_point(ecp_point * R, const uint8_t buf[ECP_P256_POINT_LEN])
+{
+	ecp_fe lhs, rhs;
+
+	if (buf[0] != 0x04)
+		return (TROPICSSL_ERR_ECP_INVALID_KEY);
+
+	fe_read(R->X, buf + 1);
+	fe_read(R->Y, buf + 1 + ECP_P256_LEN);
+
+	if (!fe_less_than(R->X, P256_P) || !fe_less_than(R->Y, P256_P))
+		return (TROPICSSL_ERR_ECP_INVALID_KEY);
+
+	fe_mul(R->X, R->X, P256_RR);
+	fe_mul(R->Y, R->Y, P256_RR);
+	memcpy(R->Z, P256_ONE, sizeof(ecp_fe));
+
+	fe_sqr(lhs, R->Y);
+
+	fe_sqr(rhs, R->X);
+	fe_mul(rhs, rhs, R->X);
+	fe_sub(rhs, rhs, R->X);
+	fe_sub(rhs, rhs, R->X);
+	fe_sub(rhs, rhs, R->X);
+	fe_add(rhs, rhs, P256_B);
+
+	if (memcmp(lhs, rhs, sizeof(ecp_fe)) != 0)
+		return (TROPICSSL_ERR_ECP_INVALID_KEY);
+
+	return (0);
+}
+
+/*
+ * 1 if 1 <= d < n
+ */
+static int ecp_scalar_valid(const uint8_t d[ECP_P256_LEN])
+{
+	ecp_fe k;
+	int ret;
+
+	fe_read(k, d);
+	ret = !fe_is_zero(k) && fe_less_than(k, P256_N);
+	memset(k, 0, sizeof(k));
+
+	return (ret);
+}
+
+/*
+ * Generate a P-256 key pair
+ */
+int ecp_p256_gen_key(uint8_t d[ECP_P256_LEN],
+		     uint8_t Q[ECP_P256_POINT_LEN],
+		     int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	int tries, ret;
+	ecp_point R;
+
+	/*
+	 * Draw until d is in [1, n-1]; n is so close to 2^256 that a
+	 * second draw is rarely needed
+	 */
+	for (tries = 0; tries < 16; tries++) {
+		if ((ret = f_rng(p_rng, d, ECP_P256_LEN)) != 0)
+			return (ret);
+
+		if (ecp_scalar_valid(d))
+			break;
+	}
+
+	if (tries == 16)
+		return (TROPICSSL_ERR_ECP_INVALID_KEY);
+
+	ecp_mul_base(&R, d);
+	ret = ecp_write_point(Q, &R);
+
+	memset(&R, 0, sizeof(R));
+
+	return (ret);
+}
+
+/*
+ * Check that an uncompressed point is on P-256
+ */
+int ecp_p256_check_public(const uint8_t P[ECP_P256_POINT_LEN])
+{
+	ecp_point R;
+
+	return (ecp_read_point(&R, P));
+}
+
+/*
+ * R = d.P
+ */
+int ecp_p256_mul(uint8_t R[ECP_P256_POINT_LEN],
+		 const uint8_t d[ECP_P256_LEN],
+		 const uint8_t P[ECP_P256_POINT_LEN])
+{
+	int ret;
+	ecp_point A, B;
+
+	if (!ecp_scalar_valid(d))
+		return (TROPICSSL_ERR_ECP_BAD_INPUT_DATA);
+
+	if ((ret = ecp_read_point(&A, P)) != 0)
+		return (ret);
+
+	ecp_mul_point(&B, d, &A);
+	ret = ecp_write_point(R, &B);
+
+	memset(&B, 0, sizeof(B));
+
+	return (ret);
+}
+
+/*
+ * Setup and write the ServerKeyExchange parameters:
+ *
+ * struct {
+ *     ECCurveType curve_type;     named_curve (3)
+ *     NamedCurve namedcurve;      secp256r1 (23)
+ *     opaque point <1..2^8-1>;
+ * } ServerECDHParams;
+ */
+int ecdh_make_params(ecdh_context * ctx, uint8_t *output, size_t *olen,
+		     int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	int ret;
+
+	TROPICSSL_TRACE1(ecdh_make_params_start, ctx);
+	ret = ecp_p256_gen_key(ctx->d, ctx->Q, f_rng, p_rng);
+	TROPICSSL_TRACE2(ecdh_make_params_done, ctx, ret);
+
+	if (ret != 0)
+		return (ret);
+
+	output[0] = ECP_TLS_NAMED_CURVE;
+	output[1] = (uint8_t) (ECP_TLS_SECP256R1 >> 8);
+	output[2] = (uint8_t) (ECP_TLS_SECP256R1);
+	output[3] = ECP_P256_POINT_LEN;
+	memcpy(output + 4, ctx->Q, ECP_P256_POINT_LEN);
+
+	*olen = 4 + ECP_P256_POINT_LEN;
+
+	return (0);
+}
+
+/*
+ * Parse the ServerKeyExchange parameters
+ */
+int ecdh_read_params(ecdh_context * ctx, uint8_t **p, const uint8_t *end)
+{
+	uint8_t *q = *p;
+
+	if (end - q < 4 + ECP_P256_POINT_LEN)
+		return (TROPICSSL_ERR_ECP_BAD_INPUT_DATA);
+
+	if (q[0] != ECP_TLS_NAMED_CURVE ||
+	    ((q[1] << 8) | q[2]) != ECP_TLS_SECP256R1 ||
+	    q[3] != ECP_P256_POINT_LEN)
+		return (TROPICSSL_ERR_ECP_BAD_INPUT_DATA);
+
+	if (ecp_p256_check_public(q + 4) != 0)
+		return (TROPICSSL_ERR_ECP_INVALID_KEY);
+
+	memcpy(ctx->Qp, q + 4, ECP_P256_POINT_LEN);
+	*p = q + 4 + ECP_P256_POINT_LEN;
+
+	return (0);
+}
+
+/*
+ * Create own key pair and export the ClientKeyExchange ECPoint
+ */
+int ecdh_make_public(ecdh_context * ctx, uint8_t *output, size_t *olen,
+		     int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	int ret;
+
+	TROPICSSL_TRACE1(ecdh_make_public_start, ctx);
+	ret = ecp_p256_gen_key(ctx->d, ctx->Q, f_rng, p_rng);
+	TROPICSSL_TRACE2(ecdh_make_public_done, ctx, ret);
+
+	if (ret != 0)
+		return (ret);
+
+	output[0] = ECP_P256_POINT_LEN;
+	memcpy(output + 1, ctx->Q, ECP_P256_POINT_LEN);
+
+	*olen = 1 + ECP_P256_POINT_LEN;
+
+	return (0);
+}
+
+/*
+ * Import the peer's ClientKeyExchange ECPoint
+ */
+int ecdh_read_public(ecdh_context * ctx, const uint8_t *input, size_t ilen)
+{
+	if (ilen != 1 + ECP_P256_POINT_LEN || input[0] != ECP_P256_POINT_LEN)
+		return (TROPICSSL_ERR_ECP_BAD_INPUT_DATA);
+
+	if (ecp_p256_check_public(input + 1) != 0)
+		return (TROPICSSL_ERR_ECP_INVALID_KEY);
+
+	memcpy(ctx->Qp, input + 1, ECP_P256_POINT_LEN);
+
+	return (0);
+}
+
+/*
+ * Derive and export the shared secret x(d.Qp)
+ */
+int ecdh_calc_secret(ecdh_context * ctx, uint8_t *output, size_t *olen)
+{
+	int ret;
+	uint8_t R[ECP_P256_POINT_LEN];
+
+	if (*olen < ECP_P256_LEN)
+		return (TROPICSSL_ERR_ECP_BAD_INPUT_DATA);
+
+	TROPICSSL_TRACE1(ecdh_calc_secret_start, ctx);
+	ret = ecp_p256_mul(R, ctx->d, ctx->Qp);
+	TROPICSSL_TRACE2(ecdh_calc_secret_done, ctx, ret);
+
+	if (ret != 0)
+		return (ret);
+
+	memcpy(ctx->K, R + 1, ECP_P256_LEN);
+	memcpy(output, ctx->K, ECP_P256_LEN);
+	*olen = ECP_P256_LEN;
+
+	memset(R, 0, sizeof(R));
+
+	return (0);
+}
+
+/*
+ * Wipe an ECDH context
+ */
+void ecdh_free(ecdh_context * ctx)
+{
+	memset(ctx, 0, sizeof(ecdh_context));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * RFC 5903, section 8.1: ECDH with the 256-bit random ECP group
+ */
+static const uint8_t ecp_test_i[ECP_P256_LEN] = {
+	0xC8, 0x8F, 0x01, 0xF5, 0x10, 0xD9, 0xAC, 0x3F,
+	0x70, 0xA2, 0x92, 0xDA, 0xA2, 0x31, 0x6D, 0xE5,
+	0x44, 0xE9, 0xAA, 0xB8, 0xAF, 0xE8, 0x40, 0x49,
+	0xC6, 0x2A, 0x9C, 0x57, 0x86, 0x2D, 0x14, 0x33
+};
+
+static const uint8_t ecp_test_gi[ECP_P256_POINT_LEN] = {
+	0x04,
+	0xDA, 0xD0, 0xB6, 0x53, 0x94, 0x22, 0x1C, 0xF9,
+	0xB0, 0x51, 0xE1, 0xFE, 0xCA, 0x57, 0x87, 0xD0,
+	0x98, 0xDF, 0xE6, 0x37, 0xFC, 0x90, 0xB9, 0xEF,
+	0x94, 0x5D, 0x0C, 0x37, 0x72, 0x58, 0x11, 0x80,
+	0x52, 0x71, 0xA0, 0x46, 0x1C, 0xDB, 0x82, 0x52,
+	0xD6, 0x1F, 0x1C, 0x45, 0x6F, 0xA3, 0xE5, 0x9A,
+	0xB1, 0xF4, 0x5B, 0x33, 0xAC, 0xCF, 0x5F, 0x58,
+	0x38, 0x9E, 0x05, 0x77, 0xB8, 0x99, 0x0B, 0xB3
+};
+
+static const uint8_t ecp_test_r[ECP_P256_LEN] = {
+	0xC6, 0xEF, 0x9C, 0x5D, 0x78, 0xAE, 0x01, 0x2A,
+	0x01, 0x11, 0x64, 0xAC, 0xB3, 0x97, 0xCE, 0x20,
+	0x88, 0x68, 0x5D, 0x8F, 0x06, 0xBF, 0x9B, 0xE0,
+	0xB2, 0x83, 0xAB, 0x46, 0x47, 0x6B, 0xEE, 0x53
+};
+
+static const uint8_t ecp_test_gr[ECP_P256_POINT_LEN] = {
+	0x04,
+	0xD1, 0x2D, 0xFB, 0x52, 0x89, 0xC8, 0xD4, 0xF8,
+	0x12, 0x08, 0xB7, 0x02, 0x70, 0x39, 0x8C, 0x34,
+	0x22, 0x96, 0x97, 0x0A, 0x0B, 0xCC, 0xB7, 0x4C,
+	0x73, 0x6F, 0xC7, 0x55, 0x44, 0x94, 0xBF, 0x63,
+	0x56, 0xFB, 0xF3, 0xCA, 0x36, 0x6C, 0xC2, 0x3E,
+	0x81, 0x57, 0x85, 0x4C, 0x13, 0xC5, 0x8D, 0x6A,
+	0xAC, 0x23, 0xF0, 0x46, 0xAD, 0xA3, 0x0F, 0x83,
+	0x53, 0xE7, 0x4F, 0x33, 0x03, 0x98, 0x72, 0xAB
+};
+
+static const uint8_t ecp_test_girx[ECP_P256_LEN] = {
+	0xD6, 0x84, 0x0F, 0x6B, 0x42, 0xF6, 0xED, 0xAF,
+	0xD1, 0x31, 0x16, 0xE0, 0xE1, 0x25, 0x65, 0x20,
+	0x2F, 0xEF, 0x8E, 0x9E, 0xCE, 0x7D, 0xCE, 0x03,
+	0x81, 0x24, 0x64, 0xD0, 0x4B, 0x94, 0x42, 0xDE
+};
+
+/*
+ * Replays a fixed scalar through f_rng
+ */
+static int ecp_test_rng(void *p_rng, uint8_t *output, size_t len)
+{
+	const uint8_t **p = (const uint8_t **)p_rng;
+
+	memcpy(output, *p, len);
+	*p += len;
+
+	return (0);
+}
+
+/*
+ * Checkup routine
+ */
+int ecp_self_test(int verbose)
+{
+	const uint8_t *p;
+	uint8_t out[4 + ECP_P256_POINT_LEN], K[ECP_P256_LEN];
+	uint8_t *q;
+	size_t n;
+	ecdh_context srv, cli;
+
+	if (verbose != 0)
+		printf("  ECDH P-256 (RFC 5903): ");
+
+	/*
+	 * Server side: i.G goes out in the ServerKeyExchange
+	 */
+	p = ecp_test_i;
+	if (ecdh_make_params(&srv, out, &n, ecp_test_rng, &p) != 0 ||
+	    n != sizeof(out) ||
+	    memcmp(out + 4, ecp_test_gi, ECP_P256_POINT_LEN) != 0)
+		goto fail;
+
+	/*
+	 * Client side: reads it, answers with r.G
+	 */
+	q = out;
+	if (ecdh_read_params(&cli, &q, out + n) != 0 || q != out + n)
+		goto fail;
+
+	p = ecp_test_r;
+	if (ecdh_make_public(&cli, out, &n, ecp_test_rng, &p) != 0 ||
+	    n != 1 + ECP_P256_POINT_LEN ||
+	    memcmp(out + 1, ecp_test_gr, ECP_P256_POINT_LEN) != 0)
+		goto fail;
+
+	if (ecdh_read_public(&srv, out, n) != 0)
+		goto fail;
+
+	n = sizeof(K);
+	if (ecdh_calc_secret(&srv, K, &n) != 0 || n != ECP_P256_LEN ||
+	    memcmp(K, ecp_test_girx, ECP_P256_LEN) != 0)
+		goto fail;
+
+	n = sizeof(K);
+	if (ecdh_calc_secret(&cli, K, &n) != 0 ||
+	    memcmp(K, ecp_test_girx, ECP_P256_LEN) != 0)
+		goto fail;
+
+	/*
+	 * A point off the curve is refused
+	 */
+	memcpy(out, ecp_test_gr, ECP_P256_POINT_LEN);
+	out[ECP_P256_POINT_LEN - 1] ^= 1;
+	if (ecp_p256_check_public(out) == 0)
+		goto fail;
+
+	ecdh_free(&srv);
+	ecdh_free(&cli);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
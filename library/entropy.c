@@ -0,0 +1,759 @@
+/*
+ *  Entropy pool: hardware, kernel and HAVEGE sources feeding DRBGs
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  Seed material is hashed into a running SHA-256 pool together with
+ *  the previous pool value, so that a weak or failing source never
+ *  makes the output worse than the others. HAVEGE, whose timing walk
+ *  is slow to set up, is only brought in when nothing else delivers.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_ENTROPY)
+
+#include "tropicssl/err.h"
+#include "tropicssl/entropy.h"
+#include "tropicssl/sha2.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#if !defined(WIN32)
+#include <errno.h>
+#include <sys/time.h>
+#endif
+
+#if defined(__GNUC__) && ( defined(__amd64__) || defined(__x86_64__) )
+#define ENTROPY_X86
+#include <cpuid.h>
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(SYS_getrandom)
+#define ENTROPY_GETRANDOM
+#endif
+#endif
+
+#if defined(WIN32)
+#define ENTROPY_LOCK(c)         EnterCriticalSection(&(c)->lock)
+#define ENTROPY_UNLOCK(c)       LeaveCriticalSection(&(c)->lock)
+#else
+#define ENTROPY_LOCK(c)         pthread_mutex_lock(&(c)->lock)
+#define ENTROPY_UNLOCK(c)       pthread_mutex_unlock(&(c)->lock)
+#endif
+
+#if defined(ENTROPY_X86)
+/*
+ * RDRAND and RDSEED support detection routine
+ */
+static int entropy_x86_sources(void)
+{
+	unsigned int a, b, c, d;
+	int sources = 0;
+
+	if (__get_cpuid(1, &a, &b, &c, &d) != 0 && (c & 0x40000000u))
+		sources |= ENTROPY_SRC_RDRAND;
+
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, a, b, c, d);
+
+		if (b & 0x00040000u)
+			sources |= ENTROPY_SRC_RDSEED;
+	}
+
+	return (sources);
+}
+
+/*
+ * Fill output from RDSEED or RDRAND. Both may come back empty when
+ * drained; RDSEED, which refills more slowly, gets more retries.
+ */
+static int entropy_x86_read(int rdseed, uint8_t *output, size_t len)
+{
+	uint64_t v;
+	uint8_t ok;
+	size_t n;
+	int tries;
+
+	while (len > 0) {
+		for (tries = 0;; tries++) {
+			if (rdseed != 0)
+				__asm__ volatile ("rdseed %0; setc %1"
+						  : "=r" (v), "=qm" (ok) :: "cc");
+			else
+				__asm__ volatile ("rdrand %0; setc %1"
+						  : "=r" (v), "=qm" (ok) :: "cc");
+
+			if (ok != 0)
+				break;
+
+			if (tries == ((rdseed != 0) ? 128 : 16))
+				return (-1);
+
+			__asm__ volatile ("pause");
+		}
+
+		n = (len < sizeof(v)) ? len : sizeof(v);
+		memcpy(output, &v, n);
+		output += n;
+		len -= n;
+	}
+
+	v = 0;
+
+	return (0);
+}
+#endif
+
+#if defined(ENTROPY_GETRANDOM)
+static int entropy_getrandom(uint8_t *output, size_t len)
+{
+	long r;
+
+	while (len > 0) {
+		if ((r = syscall(SYS_getrandom, output, len, 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return (-1);
+		}
+
+		output += r;
+		len -= (size_t) r;
+	}
+
+	return (0);
+}
+#endif
+
+/*
+ * Draw from every source into the pool, and derive one block from
+ * it; the lock is held
+ */
+static int entropy_gather(entropy_context * ctx,
+			  uint8_t output[ENTROPY_BLOCK_LEN])
+{
+	int got = 0;
+	sha2_context sha;
+	uint8_t buf[ENTROPY_BLOCK_LEN];
+	uint8_t tmp[ENTROPY_BLOCK_LEN + 1];
+
+	sha2_starts(&sha, 0);
+	sha2_update(&sha, ctx->pool, ENTROPY_BLOCK_LEN);
+
+#if defined(ENTROPY_X86)
+	if ((ctx->sources & ENTROPY_SRC_RDSEED) &&
+	    entropy_x86_read(1, buf, sizeof(buf)) == 0) {
+		sha2_update(&sha, buf, sizeof(buf));
+		got++;
+	}
+
+	if ((ctx->sources & ENTROPY_SRC_RDRAND) &&
+	    entropy_x86_read(0, buf, sizeof(buf)) == 0) {
+		sha2_update(&sha, buf, sizeof(buf));
+		got++;
+	}
+#endif
+
+#if defined(ENTROPY_GETRANDOM)
+	if (ctx->sources & ENTROPY_SRC_GETRANDOM) {
+		if (entropy_getrandom(buf, sizeof(buf)) == 0) {
+			sha2_update(&sha, buf, sizeof(buf));
+			got++;
+		} else
+			ctx->sources &= ~ENTROPY_SRC_GETRANDOM;
+	}
+#endif
+
+#if defined(TROPICSSL_HAVEGE)
+	if (got == 0) {
+		if (ctx->hs == NULL) {
+			ctx->hs = (havege_state *) malloc(sizeof(havege_state));
+
+			if (ctx->hs != NULL) {
+				havege_init(ctx->hs);
+				ctx->sources |= ENTROPY_SRC_HAVEGE;
+			}
+		}
+
+		if (ctx->hs != NULL) {
+			havege_random(ctx->hs, buf, sizeof(buf));
+			sha2_update(&sha, buf, sizeof(buf));
+			got++;
+		}
+	}
+#endif
+
+	memset(buf, 0, sizeof(buf));
+
+	if (got == 0) {
+		memset(&sha, 0, sizeof(sha2_context));
+		return (TROPICSSL_ERR_ENTROPY_SOURCE_FAILED);
+	}
+
+	sha2_finish(&sha, tmp);
+
+	tmp[ENTROPY_BLOCK_LEN] = 0;
+	sha2(tmp, sizeof(tmp), ctx->pool, 0);
+	tmp[ENTROPY_BLOCK_LEN] = 1;
+	sha2(tmp, sizeof(tmp), output, 0);
+
+	memset(tmp, 0, sizeof(tmp));
+	memset(&sha, 0, sizeof(sha2_context));
+
+	return (0);
+}
+
+#if !defined(WIN32)
+/*
+ * Forks of this process: a child starts with copies of its parent's
+ * DRBGs and reserve, which must not serve it as they are
+ */
+static volatile unsigned int entropy_forks;
+static pthread_once_t entropy_fork_once = PTHREAD_ONCE_INIT;
+
+static void entropy_fork_child(void)
+{
+	entropy_forks++;
+}
+
+static void entropy_fork_setup(void)
+{
+	pthread_atfork(NULL, NULL, entropy_fork_child);
+}
+#endif
+
+#if defined(TROPICSSL_CTR_DRBG_C) && !defined(WIN32)
+/*
+ * A thread's own DRBG, and the reseeder round and fork it was last
+ * seeded in
+ */
+typedef struct {
+	ctr_drbg_context drbg;
+	unsigned int generation;
+	unsigned int forks;
+} entropy_thread;
+
+static void entropy_thread_free(void *p)
+{
+	entropy_thread *t = (entropy_thread *) p;
+
+	ctr_drbg_free(&t->drbg);
+	memset(t, 0, sizeof(entropy_thread));
+	free(t);
+}
+#endif
+
+/*
+ * Set up an entropy pool and seed it
+ */
+int entropy_init(entropy_context * ctx)
+{
+	int ret;
+	uint8_t block[ENTROPY_BLOCK_LEN];
+
+	memset(ctx, 0, sizeof(entropy_context));
+
+#if defined(ENTROPY_X86)
+	ctx->sources |= entropy_x86_sources();
+#endif
+#if defined(ENTROPY_GETRANDOM)
+	ctx->sources |= ENTROPY_SRC_GETRANDOM;
+#endif
+
+#if defined(WIN32)
+	InitializeCriticalSection(&ctx->lock);
+#else
+	pthread_once(&entropy_fork_once, entropy_fork_setup);
+	ctx->forks = entropy_forks;
+
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->wake, NULL);
+#if defined(TROPICSSL_CTR_DRBG_C)
+	if (pthread_key_create(&ctx->key, entropy_thread_free) != 0) {
+		pthread_cond_destroy(&ctx->wake);
+		pthread_mutex_destroy(&ctx->lock);
+		return (TROPICSSL_ERR_ENTROPY_SOURCE_FAILED);
+	}
+#endif
+#endif
+
+	ENTROPY_LOCK(ctx);
+	ret = entropy_gather(ctx, block);
+	ENTROPY_UNLOCK(ctx);
+
+	memset(block, 0, sizeof(block));
+
+	if (ret != 0)
+		entropy_free(ctx);
+
+	return (ret);
+}
+
+/*
+ * Seed material, from the reserve first
+ */
+int entropy_func(void *p_entropy, uint8_t *output, size_t len)
+{
+	int ret = 0;
+	size_t n;
+	uint8_t block[ENTROPY_BLOCK_LEN];
+	entropy_context *ctx = (entropy_context *) p_entropy;
+
+	ENTROPY_LOCK(ctx);
+
+#if !defined(WIN32)
+	/*
+	 * The parent, or a sibling, holds the same reserve
+	 */
+	if (ctx->forks != entropy_forks) {
+		memset(ctx->reserve, 0, sizeof(ctx->reserve));
+		ctx->reserve_len = 0;
+		ctx->forks = entropy_forks;
+	}
+#endif
+
+	while (len > 0) {
+		if (ctx->reserve_len > 0) {
+			n = (len < ctx->reserve_len) ? len : ctx->reserve_len;
+			ctx->reserve_len -= n;
+			memcpy(output, ctx->reserve + ctx->reserve_len, n);
+			memset(ctx->reserve + ctx->reserve_len, 0, n);
+		} else {
+			if ((ret = entropy_gather(ctx, block)) != 0)
+				break;
+
+			n = (len < sizeof(block)) ? len : sizeof(block);
+			memcpy(output, block, n);
+		}
+
+		output += n;
+		len -= n;
+	}
+
+	ENTROPY_UNLOCK(ctx);
+
+	memset(block, 0, sizeof(block));
+
+	return (ret);
+}
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+/*
+ * The calling thread's DRBG
+ */
+int entropy_random(void *p_entropy, uint8_t *output, size_t len)
+{
+	int ret;
+	entropy_context *ctx = (entropy_context *) p_entropy;
+#if defined(WIN32)
+	ENTROPY_LOCK(ctx);
+
+	if (ctx->drbg_ready == 0) {
+		if ((ret = ctr_drbg_init(&ctx->drbg, entropy_func, ctx,
+					 NULL, 0)) != 0) {
+			ENTROPY_UNLOCK(ctx);
+			return (ret);
+		}
+
+		ctx->drbg_ready = 1;
+	}
+
+	ret = ctr_drbg_random(&ctx->drbg, output, len);
+
+	ENTROPY_UNLOCK(ctx);
+#else
+	entropy_thread *t;
+
+	/*
+	 * The generation is read without the lock: a stale value
+	 * only puts the reseed off by a request
+	 */
+	if ((t = (entropy_thread *) pthread_getspecific(ctx->key)) == NULL) {
+		if ((t = (entropy_thread *) malloc(sizeof(entropy_thread))) ==
+		    NULL)
+			return (TROPICSSL_ERR_ENTROPY_SOURCE_FAILED);
+
+		t->generation = ctx->generation;
+		t->forks = entropy_forks;
+
+		/*
+		 * The address tells the threads' DRBGs apart
+		 */
+		if ((ret = ctr_drbg_init(&t->drbg, entropy_func, ctx,
+					 (const uint8_t *)&t,
+					 sizeof(t))) != 0 ||
+		    pthread_setspecific(ctx->key, t) != 0) {
+			entropy_thread_free(t);
+			return ((ret != 0) ? ret :
+				TROPICSSL_ERR_ENTROPY_SOURCE_FAILED);
+		}
+	} else if (t->generation != ctx->generation ||
+		   t->forks != entropy_forks) {
+		/*
+		 * A new reseeder round, or a forked child whose DRBG
+		 * would otherwise repeat its parent's output
+		 */
+		t->generation = ctx->generation;
+		t->forks = entropy_forks;
+
+		if ((ret = ctr_drbg_reseed(&t->drbg, NULL, 0)) != 0)
+			return (ret);
+	}
+
+	ret = ctr_drbg_random(&t->drbg, output, len);
+#endif
+
+	return (ret);
+}
+#endif
+
+/*
+ * Refill the reserve; the lock is held
+ */
+static void entropy_refill(entropy_context * ctx)
+{
+	size_t i;
+
+	for (i = 0; i < ENTROPY_RESERVE_LEN; i += ENTROPY_BLOCK_LEN)
+		if (entropy_gather(ctx, ctx->reserve + i) != 0)
+			break;
+
+	ctx->reserve_len = i;
+	ctx->generation++;
+}
+
+#if !defined(WIN32)
+static void *entropy_reseeder(void *arg)
+{
+	struct timeval tv;
+	struct timespec ts;
+	entropy_context *ctx = (entropy_context *) arg;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	while (ctx->stop == 0) {
+		gettimeofday(&tv, NULL);
+
+		ts.tv_sec = tv.tv_sec + ctx->interval_ms / 1000;
+		ts.tv_nsec = tv.tv_usec * 1000L +
+		    (ctx->interval_ms % 1000) * 1000000L;
+
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+
+		if (pthread_cond_timedwait(&ctx->wake, &ctx->lock, &ts) ==
+		    ETIMEDOUT && ctx->stop == 0)
+			entropy_refill(ctx);
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return (NULL);
+}
+#endif
+
+/*
+ * Start the background reseeder
+ */
+int entropy_start_reseeder(entropy_context * ctx, int interval_ms)
+{
+#if defined(WIN32)
+	(void)ctx;
+	(void)interval_ms;
+
+	return (TROPICSSL_ERR_ENTROPY_THREAD_FAILED);
+#else
+	if (ctx->interval_ms != 0)
+		return (0);
+
+	pthread_mutex_lock(&ctx->lock);
+
+	ctx->interval_ms = (interval_ms > 0) ? interval_ms : ENTROPY_RESEED_MS;
+	ctx->stop = 0;
+
+	/*
+	 * Have a reserve ready for the first DRBGs
+	 */
+	entropy_refill(ctx);
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (pthread_create(&ctx->reseeder, NULL, entropy_reseeder, ctx) != 0) {
+		ctx->interval_ms = 0;
+		return (TROPICSSL_ERR_ENTROPY_THREAD_FAILED);
+	}
+
+	return (0);
+#endif
+}
+
+/*
+ * Stop the reseeder and wipe the pool
+ */
+void entropy_free(entropy_context * ctx)
+{
+#if defined(WIN32)
+#if defined(TROPICSSL_CTR_DRBG_C)
+	if (ctx->drbg_ready != 0)
+		ctr_drbg_free(&ctx->drbg);
+#endif
+	DeleteCriticalSection(&ctx->lock);
+#else
+#if defined(TROPICSSL_CTR_DRBG_C)
+	void *t;
+#endif
+
+	if (ctx->interval_ms != 0) {
+		pthread_mutex_lock(&ctx->lock);
+		ctx->stop = 1;
+		pthread_cond_signal(&ctx->wake);
+		pthread_mutex_unlock(&ctx->lock);
+
+		pthread_join(ctx->reseeder, NULL);
+	}
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+	if ((t = pthread_getspecific(ctx->key)) != NULL) {
+		pthread_setspecific(ctx->key, NULL);
+		entropy_thread_free(t);
+	}
+
+	pthread_key_delete(ctx->key);
+#endif
+	pthread_cond_destroy(&ctx->wake);
+	pthread_mutex_destroy(&ctx->lock);
+#endif
+
+#if defined(TROPICSSL_HAVEGE)
+	if (ctx->hs != NULL) {
+		memset(ctx->hs, 0, sizeof(havege_state));
+		free(ctx->hs);
+	}
+#endif
+
+	memset(ctx, 0, sizeof(entropy_context));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+#if defined(TROPICSSL_TIMING)
+#include "tropicssl/timing.h"
+#endif
+
+#if defined(TROPICSSL_CTR_DRBG_C) && !defined(WIN32)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#if defined(TROPICSSL_CTR_DRBG_C) && !defined(WIN32)
+typedef struct {
+	entropy_context *ctx;
+	uint8_t out[64];
+	int ret;
+} entropy_test_job;
+
+static void *entropy_test_thread(void *arg)
+{
+	entropy_test_job *job = (entropy_test_job *) arg;
+
+	job->ret = entropy_random(job->ctx, job->out, sizeof(job->out));
+
+	return (NULL);
+}
+#endif
+
+/*
+ * Checkup routine: the output is random, so only gross failures
+ * (repeats, the sources not being drawn from) can be caught
+ */
+int entropy_self_test(int verbose)
+{
+	int i;
+	entropy_context ctx;
+	uint8_t a[64], b[64];
+
+	if (entropy_init(&ctx) != 0) {
+		if (verbose != 0)
+			printf("  ENTROPY pool test: failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("  ENTROPY pool test (sources:%s%s%s%s): ",
+		       (ctx.sources & ENTROPY_SRC_RDSEED) ? " rdseed" : "",
+		       (ctx.sources & ENTROPY_SRC_RDRAND) ? " rdrand" : "",
+		       (ctx.sources & ENTROPY_SRC_GETRANDOM) ? " getrandom" : "",
+		       (ctx.sources & ENTROPY_SRC_HAVEGE) ? " havege" : "");
+
+	if (ctx.sources == 0 ||
+	    entropy_func(&ctx, a, sizeof(a)) != 0 ||
+	    entropy_func(&ctx, b, sizeof(b)) != 0 ||
+	    memcmp(a, b, sizeof(a)) == 0)
+		goto fail;
+
+#if defined(TROPICSSL_HAVEGE)
+	if (verbose != 0)
+		printf("passed\n  ENTROPY fallback test: ");
+
+	/*
+	 * With the other sources gone, HAVEGE is set up on demand
+	 */
+	i = ctx.sources;
+	ctx.sources = 0;
+
+	if (entropy_func(&ctx, a, sizeof(a)) != 0 ||
+	    (ctx.sources & ENTROPY_SRC_HAVEGE) == 0 ||
+	    memcmp(a, b, sizeof(a)) == 0)
+		goto fail;
+
+	ctx.sources |= i;
+#endif
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+	if (verbose != 0)
+		printf("passed\n  ENTROPY thread DRBG test: ");
+
+	if (entropy_random(&ctx, a, sizeof(a)) != 0 ||
+	    entropy_random(&ctx, b, sizeof(b)) != 0 ||
+	    memcmp(a, b, sizeof(a)) == 0)
+		goto fail;
+
+#if !defined(WIN32)
+	{
+		pthread_t tid;
+		entropy_test_job job;
+
+		job.ctx = &ctx;
+		job.ret = 1;
+
+		if (pthread_create(&tid, NULL, entropy_test_thread, &job) != 0)
+			goto fail;
+
+		pthread_join(tid, NULL);
+
+		if (job.ret != 0 || memcmp(a, job.out, sizeof(a)) == 0)
+			goto fail;
+	}
+
+	if (verbose != 0)
+		printf("passed\n  ENTROPY fork test: ");
+
+	/*
+	 * Parent and child start from the same DRBG state, and must
+	 * not draw the same bytes from it
+	 */
+	{
+		int fd[2], status;
+		pid_t pid;
+
+		if (pipe(fd) != 0)
+			goto fail;
+
+		if ((pid = fork()) < 0) {
+			close(fd[0]);
+			close(fd[1]);
+			goto fail;
+		}
+
+		if (pid == 0) {
+			close(fd[0]);
+			i = (entropy_random(&ctx, b, sizeof(b)) == 0 &&
+			     write(fd[1], b, sizeof(b)) == (int)sizeof(b));
+			_exit(i ? 0 : 1);
+		}
+
+		close(fd[1]);
+		i = (int)read(fd[0], b, sizeof(b));
+		close(fd[0]);
+
+		if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0 || i != (int)sizeof(b) ||
+		    entropy_random(&ctx, a, sizeof(a)) != 0 ||
+		    memcmp(a, b, sizeof(a)) == 0)
+			goto fail;
+	}
+#endif
+#endif
+
+#if defined(TROPICSSL_TIMING) && !defined(WIN32)
+	if (verbose != 0)
+		printf("passed\n  ENTROPY reseeder test: ");
+
+	{
+		unsigned int gen;
+
+		if (entropy_start_reseeder(&ctx, 10) != 0)
+			goto fail;
+
+		gen = ctx.generation;
+
+		for (i = 0; i < 200 && ctx.generation == gen; i++)
+			m_sleep(10);
+
+		if (ctx.generation == gen)
+			goto fail;
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+		if (entropy_random(&ctx, a, sizeof(a)) != 0)
+			goto fail;
+#endif
+	}
+#endif
+
+	entropy_free(&ctx);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	entropy_free(&ctx);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
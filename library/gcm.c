@@ -0,0 +1,835 @@
+/*
+ *  Galois/Counter Mode (GCM) for AES
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  The GCM specification was published by NIST as SP 800-38D.
+ *
+ *  http://csrc.nist.gov/publications/nistpubs/800-38D/SP-800-38D.pdf
+ *
+ *  The portable GHASH uses Shoup's 4-bit tables, as described in
+ *  the original GCM submission by McGrew and Viega:
+ *
+ *  http://csrc.nist.gov/groups/ST/toolkit/BCM/documents/proposedmodes/gcm/gcm-revised-spec.pdf
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_GCM)
+
+#include "tropicssl/err.h"
+#include "tropicssl/gcm.h"
+
+#if defined(TROPICSSL_AESNI)
+#include "tropicssl/aesni.h"
+#endif
+
+#include <string.h>
+
+/*
+ * 32-bit integer manipulation macros (big endian)
+ */
+#ifndef GET_UINT32_BE
+#define GET_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ] << 24 )             \
+        | ( (uint32_t) (b)[(i) + 1] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 2] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 3]       );            \
+}
+#endif
+
+#ifndef PUT_UINT32_BE
+#define PUT_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (uint8_t) ( (n) >> 24 );             \
+    (b)[(i) + 1] = (uint8_t) ( (n) >> 16 );             \
+    (b)[(i) + 2] = (uint8_t) ( (n) >>  8 );             \
+    (b)[(i) + 3] = (uint8_t) ( (n)       );             \
+}
+#endif
+
+/*
+ * Number of blocks encrypted and hashed per step in gcm_update(),
+ * small enough for the chunk to stay in L1 between the two passes
+ */
+#define GCM_CHUNK_BLOCKS        32
+
+/*
+ * Precompute the multiples of H for the 4-bit table method
+ */
+static void gcm_gen_table(gcm_context * ctx, const uint8_t h[16])
+{
+	int i, j;
+	uint32_t hi, lo;
+	uint64_t vl, vh;
+
+	ctx->HH[0] = 0;
+	ctx->HL[0] = 0;
+
+	GET_UINT32_BE(hi, h, 0);
+	GET_UINT32_BE(lo, h, 4);
+	vh = (uint64_t) hi << 32 | lo;
+
+	GET_UINT32_BE(hi, h, 8);
+	GET_UINT32_BE(lo, h, 12);
+	vl = (uint64_t) hi << 32 | lo;
+
+	ctx->HL[8] = vl;
+	ctx->HH[8] = vh;
+
+	for (i = 4; i > 0; i >>= 1) {
+		uint32_t T = (uint32_t)(vl & 1) * 0xE1000000U;
+
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ ((uint64_t) T << 32);
+
+		ctx->HL[i] = vl;
+		ctx->HH[i] = vh;
+	}
+
+	for (i = 2; i < 16; i <<= 1) {
+		uint64_t *HiL = ctx->HL + i, *HiH = ctx->HH + i;
+
+		vh = *HiH;
+		vl = *HiL;
+
+		for (j = 1; j < i; j++) {
+			HiH[j] = vh ^ ctx->HH[j];
+			HiL[j] = vl ^ ctx->HL[j];
+		}
+	}
+}
+
+/*
+ * Reduction table for the 4-bit shifts
+ */
+static const uint64_t last4[16] = {
+	0x0000, 0x1C20, 0x3840, 0x2460,
+	0x7080, 0x6CA0, 0x48C0, 0x54E0,
+	0xE100, 0xFD20, 0xD940, 0xC560,
+	0x9180, 0x8DA0, 0xA9C0, 0xB5E0
+};
+
+/*
+ * Multiply x by H in GF(2^128), using the precomputed tables
+ */
+static void gcm_mult(gcm_context * ctx, const uint8_t x[16],
+		     uint8_t output[16])
+{
+	int i;
+	uint8_t lo, hi, rem;
+	uint64_t zh, zl;
+
+	lo = x[15] & 0x0F;
+
+	zh = ctx->HH[lo];
+	zl = ctx->HL[lo];
+
+	for (i = 15; i >= 0; i--) {
+		lo = x[i] & 0x0F;
+		hi = x[i] >> 4;
+
+		if (i != 15) {
+			rem = (uint8_t)zl & 0x0F;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4);
+			zh ^= (uint64_t) last4[rem] << 48;
+			zh ^= ctx->HH[lo];
+			zl ^= ctx->HL[lo];
+		}
+
+		rem = (uint8_t)zl & 0x0F;
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4);
+		zh ^= (uint64_t) last4[rem] << 48;
+		zh ^= ctx->HH[hi];
+		zl ^= ctx->HL[hi];
+	}
+
+	PUT_UINT32_BE(zh >> 32, output, 0);
+	PUT_UINT32_BE(zh, output, 4);
+	PUT_UINT32_BE(zl >> 32, output, 8);
+	PUT_UINT32_BE(zl, output, 12);
+}
+
+/*
+ * GHASH update over whole blocks
+ */
+static void gcm_ghash_blocks(gcm_context * ctx, uint8_t y[16],
+			     const uint8_t *data, size_t nblocks)
+{
+	int i;
+
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (ctx->clmul) {
+		aesni_ghash(y, ctx->HP, data, nblocks);
+		return;
+	}
+#endif
+
+	while (nblocks > 0) {
+		for (i = 0; i < 16; i++)
+			y[i] ^= data[i];
+
+		gcm_mult(ctx, y, y);
+
+		data += 16;
+		nblocks--;
+	}
+}
+
+/*
+ * GHASH update over arbitrary data, zero-padding the last block
+ */
+static void gcm_ghash(gcm_context * ctx, uint8_t y[16],
+		      const uint8_t *data, size_t len)
+{
+	size_t i;
+	uint8_t last[16];
+
+	gcm_ghash_blocks(ctx, y, data, len >> 4);
+
+	if ((len & 0x0F) != 0) {
+		memset(last, 0, sizeof(last));
+		for (i = 0; i < (len & 0x0F); i++)
+			last[i] = data[(len & ~(size_t)0x0F) + i];
+
+		gcm_ghash_blocks(ctx, y, last, 1);
+	}
+}
+
+/*
+ * Increment the rightmost 32 bits of the counter block
+ */
+static void gcm_inc32(uint8_t y[16])
+{
+	int i;
+
+	for (i = 16; i > 12; i--)
+		if (++y[i - 1] != 0)
+			break;
+}
+
+/*
+ * GCM initialization
+ */
+void gcm_init(gcm_context * ctx, const uint8_t *key, unsigned int keysize)
+{
+	uint8_t h[16];
+
+	memset(ctx, 0, sizeof(gcm_context));
+
+	aes_setkey_enc(&ctx->aes, key, keysize);
+
+	memset(h, 0, sizeof(h));
+	aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, h, h);
+
+	gcm_gen_table(ctx, h);
+
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (aesni_supports(TROPICSSL_AESNI_CLMUL)) {
+		aesni_gcm_powers(ctx->HP, h);
+		ctx->clmul = 1;
+	}
+#endif
+
+	memset(h, 0, sizeof(h));
+}
+
+/*
+ * Start a GCM message: derive the counter block and hash the
+ * additional data
+ */
+int gcm_starts(gcm_context * ctx, int mode,
+	       const uint8_t *iv, size_t iv_len,
+	       const uint8_t *add, size_t add_len)
+{
+	uint8_t work_buf[16];
+
+	/*
+	 * IV and AD lengths are limited to 2^64 bits
+	 */
+	if (iv_len == 0 ||
+	    ((uint64_t) iv_len) >> 61 != 0 || ((uint64_t) add_len) >> 61 != 0)
+		return (TROPICSSL_ERR_GCM_BAD_INPUT);
+
+	memset(ctx->y, 0, sizeof(ctx->y));
+	memset(ctx->buf, 0, sizeof(ctx->buf));
+
+	ctx->mode = mode;
+	ctx->len = 0;
+	ctx->add_len = 0;
+
+	if (iv_len == 12) {
+		memcpy(ctx->y, iv, iv_len);
+		ctx->y[15] = 1;
+	} else {
+		memset(work_buf, 0, sizeof(work_buf));
+		PUT_UINT32_BE((uint64_t) iv_len >> 29, work_buf, 8);
+		PUT_UINT32_BE(iv_len << 3, work_buf, 12);
+
+		gcm_ghash(ctx, ctx->y, iv, iv_len);
+		gcm_ghash_blocks(ctx, ctx->y, work_buf, 1);
+	}
+
+	aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, ctx->y, ctx->base_ectr);
+	gcm_inc32(ctx->y);
+
+	ctx->add_len = add_len;
+	gcm_ghash(ctx, ctx->buf, add, add_len);
+
+	return (0);
+}
+
+/*
+ * Encrypt or decrypt part of a GCM message
+ */
+int gcm_update(gcm_context * ctx, size_t length,
+	       const uint8_t *input, uint8_t *output)
+{
+	size_t i, n;
+	uint32_t ctr;
+	uint8_t prefix[12];
+	uint8_t ectr[16];
+	uint8_t stream_block[16];
+
+	/*
+	 * A partial block may only come last, and the total is
+	 * limited to 2^32 - 2 blocks
+	 */
+	if ((ctx->len & 0x0F) != 0 ||
+	    ctx->len + length < ctx->len ||
+	    ctx->len + length > 0xFFFFFFFE0ull)
+		return (TROPICSSL_ERR_GCM_BAD_INPUT);
+
+	ctx->len += length;
+
+	while (length >= 16) {
+		n = length >> 4;
+		if (n > GCM_CHUNK_BLOCKS)
+			n = GCM_CHUNK_BLOCKS;
+
+		/*
+		 * The counter must wrap within its low 32 bits
+		 */
+		GET_UINT32_BE(ctr, ctx->y, 12);
+		if (ctr != 0 && n > (size_t)(0 - ctr))
+			n = (size_t)(0 - ctr);
+
+		if (ctx->mode == GCM_DECRYPT)
+			gcm_ghash_blocks(ctx, ctx->buf, input, n);
+
+		memcpy(prefix, ctx->y, 12);
+		i = 0;
+		aes_crypt_ctr(&ctx->aes, n << 4, &i, ctx->y, stream_block,
+			      input, output);
+		memcpy(ctx->y, prefix, 12);
+
+		if (ctx->mode == GCM_ENCRYPT)
+			gcm_ghash_blocks(ctx, ctx->buf, output, n);
+
+		input += n << 4;
+		output += n << 4;
+		length -= n << 4;
+	}
+
+	if (length > 0) {
+		if (ctx->mode == GCM_DECRYPT)
+			gcm_ghash(ctx, ctx->buf, input, length);
+
+		aes_crypt_ecb(&ctx->aes, AES_ENCRYPT, ctx->y, ectr);
+		gcm_inc32(ctx->y);
+
+		for (i = 0; i < length; i++)
+			output[i] = (uint8_t)(input[i] ^ ectr[i]);
+
+		if (ctx->mode == GCM_ENCRYPT)
+			gcm_ghash(ctx, ctx->buf, output, length);
+
+		memset(ectr, 0, sizeof(ectr));
+	}
+
+	return (0);
+}
+
+/*
+ * Finish a GCM message and output the tag
+ */
+int gcm_finish(gcm_context * ctx, uint8_t *tag, size_t tag_len)
+{
+	size_t i;
+	uint8_t work_buf[16];
+	uint64_t orig_len = ctx->len * 8;
+	uint64_t orig_add_len = ctx->add_len * 8;
+
+	if (tag_len > 16 || tag_len < 4)
+		return (TROPICSSL_ERR_GCM_BAD_INPUT);
+
+	PUT_UINT32_BE(orig_add_len >> 32, work_buf, 0);
+	PUT_UINT32_BE(orig_add_len, work_buf, 4);
+	PUT_UINT32_BE(orig_len >> 32, work_buf, 8);
+	PUT_UINT32_BE(orig_len, work_buf, 12);
+
+	gcm_ghash_blocks(ctx, ctx->buf, work_buf, 1);
+
+	for (i = 0; i < tag_len; i++)
+		tag[i] = (uint8_t)(ctx->base_ectr[i] ^ ctx->buf[i]);
+
+	return (0);
+}
+
+/*
+ * GCM buffer encryption/decryption with tag
+ */
+int gcm_crypt_and_tag(gcm_context * ctx, int mode, size_t length,
+		      const uint8_t *iv, size_t iv_len,
+		      const uint8_t *add, size_t add_len,
+		      const uint8_t *input, uint8_t *output,
+		      size_t tag_len, uint8_t *tag)
+{
+	int ret;
+
+	if ((ret = gcm_starts(ctx, mode, iv, iv_len, add, add_len)) != 0)
+		return (ret);
+
+	if ((ret = gcm_update(ctx, length, input, output)) != 0)
+		return (ret);
+
+	return (gcm_finish(ctx, tag, tag_len));
+}
+
+/*
+ * GCM buffer authenticated decryption
+ */
+int gcm_auth_decrypt(gcm_context * ctx, size_t length,
+		     const uint8_t *iv, size_t iv_len,
+		     const uint8_t *add, size_t add_len,
+		     const uint8_t *tag, size_t tag_len,
+		     const uint8_t *input, uint8_t *output)
+{
+	int ret;
+	size_t i;
+	uint8_t check_tag[16];
+	uint8_t diff;
+
+	if ((ret = gcm_crypt_and_tag(ctx, GCM_DECRYPT, length,
+				     iv, iv_len, add, add_len,
+				     input, output, tag_len, check_tag)) != 0)
+		return (ret);
+
+	/*
+	 * Check the tag in constant time
+	 */
+	for (diff = 0, i = 0; i < tag_len; i++)
+		diff |= tag[i] ^ check_tag[i];
+
+	if (diff != 0) {
+		memset(output, 0, length);
+		return (TROPICSSL_ERR_GCM_AUTH_FAILED);
+	}
+
+	return (0);
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * GCM test vectors from:
+ *
+ * http://csrc.nist.gov/groups/ST/toolkit/BCM/documents/proposedmodes/gcm/gcm-revised-spec.pdf
+ *
+ * Test cases 1 to 6 (AES-128) and 13 to 18 (AES-256)
+ */
+static const uint8_t gcm_test_key[32] = {
+	0xFE, 0xFF, 0xE9, 0x92, 0x86, 0x65, 0x73, 0x1C,
+	0x6D, 0x6A, 0x8F, 0x94, 0x67, 0x30, 0x83, 0x08,
+	0xFE, 0xFF, 0xE9, 0x92, 0x86, 0x65, 0x73, 0x1C,
+	0x6D, 0x6A, 0x8F, 0x94, 0x67, 0x30, 0x83, 0x08
+};
+
+static const uint8_t gcm_test_iv[64] = {
+	0xCA, 0xFE, 0xBA, 0xBE, 0xFA, 0xCE, 0xDB, 0xAD,
+	0xDE, 0xCA, 0xF8, 0x88
+};
+
+static const uint8_t gcm_test_iv60[60] = {
+	0x93, 0x13, 0x22, 0x5D, 0xF8, 0x84, 0x06, 0xE5,
+	0x55, 0x90, 0x9C, 0x5A, 0xFF, 0x52, 0x69, 0xAA,
+	0x6A, 0x7A, 0x95, 0x38, 0x53, 0x4F, 0x7D, 0xA1,
+	0xE4, 0xC3, 0x03, 0xD2, 0xA3, 0x18, 0xA7, 0x28,
+	0xC3, 0xC0, 0xC9, 0x51, 0x56, 0x80, 0x95, 0x39,
+	0xFC, 0xF0, 0xE2, 0x42, 0x9A, 0x6B, 0x52, 0x54,
+	0x16, 0xAE, 0xDB, 0xF5, 0xA0, 0xDE, 0x6A, 0x57,
+	0xA6, 0x37, 0xB3, 0x9B
+};
+
+static const uint8_t gcm_test_add[20] = {
+	0xFE, 0xED, 0xFA, 0xCE, 0xDE, 0xAD, 0xBE, 0xEF,
+	0xFE, 0xED, 0xFA, 0xCE, 0xDE, 0xAD, 0xBE, 0xEF,
+	0xAB, 0xAD, 0xDA, 0xD2
+};
+
+static const uint8_t gcm_test_pt[64] = {
+	0xD9, 0x31, 0x32, 0x25, 0xF8, 0x84, 0x06, 0xE5,
+	0xA5, 0x59, 0x09, 0xC5, 0xAF, 0xF5, 0x26, 0x9A,
+	0x86, 0xA7, 0xA9, 0x53, 0x15, 0x34, 0xF7, 0xDA,
+	0x2E, 0x4C, 0x30, 0x3D, 0x8A, 0x31, 0x8A, 0x72,
+	0x1C, 0x3C, 0x0C, 0x95, 0x95, 0x68, 0x09, 0x53,
+	0x2F, 0xCF, 0x0E, 0x24, 0x49, 0xA6, 0xB5, 0x25,
+	0xB1, 0x6A, 0xED, 0xF5, 0xAA, 0x0D, 0xE6, 0x57,
+	0xBA, 0x63, 0x7B, 0x39, 0x1A, 0xAF, 0xD2, 0x55
+};
+
+/*
+ * Per test case: plaintext length, additional data length, IV length
+ */
+static const size_t gcm_test_pt_len[6] = { 0, 16, 64, 60, 60, 60 };
+static const size_t gcm_test_add_len[6] = { 0, 0, 0, 20, 20, 20 };
+static const size_t gcm_test_iv_len[6] = { 12, 12, 12, 12, 8, 60 };
+
+static const uint8_t gcm_test_ct[2][6][64] = {
+	{
+	 {0},
+	 {
+	  0x03, 0x88, 0xDA, 0xCE, 0x60, 0xB6, 0xA3, 0x92,
+	  0xF3, 0x28, 0xC2, 0xB9, 0x71, 0xB2, 0xFE, 0x78},
+	 {
+	  0x42, 0x83, 0x1E, 0xC2, 0x21, 0x77, 0x74, 0x24,
+	  0x4B, 0x72, 0x21, 0xB7, 0x84, 0xD0, 0xD4, 0x9C,
+	  0xE3, 0xAA, 0x21, 0x2F, 0x2C, 0x02, 0xA4, 0xE0,
+	  0x35, 0xC1, 0x7E, 0x23, 0x29, 0xAC, 0xA1, 0x2E,
+	  0x21, 0xD5, 0x14, 0xB2, 0x54, 0x66, 0x93, 0x1C,
+	  0x7D, 0x8F, 0x6A, 0x5A, 0xAC, 0x84, 0xAA, 0x05,
+	  0x1B, 0xA3, 0x0B, 0x39, 0x6A, 0x0A, 0xAC, 0x97,
+	  0x3D, 0x58, 0xE0, 0x91, 0x47, 0x3F, 0x59, 0x85},
+	 {
+	  0x42, 0x83, 0x1E, 0xC2, 0x21, 0x77, 0x74, 0x24,
+	  0x4B, 0x72, 0x21, 0xB7, 0x84, 0xD0, 0xD4, 0x9C,
+	  0xE3, 0xAA, 0x21, 0x2F, 0x2C, 0x02, 0xA4, 0xE0,
+	  0x35, 0xC1, 0x7E, 0x23, 0x29, 0xAC, 0xA1, 0x2E,
+	  0x21, 0xD5, 0x14, 0xB2, 0x54, 0x66, 0x93, 0x1C,
+	  0x7D, 0x8F, 0x6A, 0x5A, 0xAC, 0x84, 0xAA, 0x05,
+	  0x1B, 0xA3, 0x0B, 0x39, 0x6A, 0x0A, 0xAC, 0x97,
+	  0x3D, 0x58, 0xE0, 0x91},
+	 {
+	  0x61, 0x35, 0x3B, 0x4C, 0x28, 0x06, 0x93, 0x4A,
+	  0x77, 0x7F, 0xF5, 0x1F, 0xA2, 0x2A, 0x47, 0x55,
+	  0x69, 0x9B, 0x2A, 0x71, 0x4F, 0xCD, 0xC6, 0xF8,
+	  0x37, 0x66, 0xE5, 0xF9, 0x7B, 0x6C, 0x74, 0x23,
+	  0x73, 0x80, 0x69, 0x00, 0xE4, 0x9F, 0x24, 0xB2,
+	  0x2B, 0x09, 0x75, 0x44, 0xD4, 0x89, 0x6B, 0x42,
+	  0x49, 0x89, 0xB5, 0xE1, 0xEB, 0xAC, 0x0F, 0x07,
+	  0xC2, 0x3F, 0x45, 0x98},
+	 {
+	  0x8C, 0xE2, 0x49, 0x98, 0x62, 0x56, 0x15, 0xB6,
+	  0x03, 0xA0, 0x33, 0xAC, 0xA1, 0x3F, 0xB8, 0x94,
+	  0xBE, 0x91, 0x12, 0xA5, 0xC3, 0xA2, 0x11, 0xA8,
+	  0xBA, 0x26, 0x2A, 0x3C, 0xCA, 0x7E, 0x2C, 0xA7,
+	  0x01, 0xE4, 0xA9, 0xA4, 0xFB, 0xA4, 0x3C, 0x90,
+	  0xCC, 0xDC, 0xB2, 0x81, 0xD4, 0x8C, 0x7C, 0x6F,
+	  0xD6, 0x28, 0x75, 0xD2, 0xAC, 0xA4, 0x17, 0x03,
+	  0x4C, 0x34, 0xAE, 0xE5}},
+	{
+	 {0},
+	 {
+	  0xCE, 0xA7, 0x40, 0x3D, 0x4D, 0x60, 0x6B, 0x6E,
+	  0x07, 0x4E, 0xC5, 0xD3, 0xBA, 0xF3, 0x9D, 0x18},
+	 {
+	  0x52, 0x2D, 0xC1, 0xF0, 0x99, 0x56, 0x7D, 0x07,
+	  0xF4, 0x7F, 0x37, 0xA3, 0x2A, 0x84, 0x42, 0x7D,
+	  0x64, 0x3A, 0x8C, 0xDC, 0xBF, 0xE5, 0xC0, 0xC9,
+	  0x75, 0x98, 0xA2, 0xBD, 0x25, 0x55, 0xD1, 0xAA,
+	  0x8C, 0xB0, 0x8E, 0x48, 0x59, 0x0D, 0xBB, 0x3D,
+	  0xA7, 0xB0, 0x8B, 0x10, 0x56, 0x82, 0x88, 0x38,
+	  0xC5, 0xF6, 0x1E, 0x63, 0x93, 0xBA, 0x7A, 0x0A,
+	  0xBC, 0xC9, 0xF6, 0x62, 0x89, 0x80, 0x15, 0xAD},
+	 {
+	  0x52, 0x2D, 0xC1, 0xF0, 0x99, 0x56, 0x7D, 0x07,
+	  0xF4, 0x7F, 0x37, 0xA3, 0x2A, 0x84, 0x42, 0x7D,
+	  0x64, 0x3A, 0x8C, 0xDC, 0xBF, 0xE5, 0xC0, 0xC9,
+	  0x75, 0x98, 0xA2, 0xBD, 0x25, 0x55, 0xD1, 0xAA,
+	  0x8C, 0xB0, 0x8E, 0x48, 0x59, 0x0D, 0xBB, 0x3D,
+	  0xA7, 0xB0, 0x8B, 0x10, 0x56, 0x82, 0x88, 0x38,
+	  0xC5, 0xF6, 0x1E, 0x63, 0x93, 0xBA, 0x7A, 0x0A,
+	  0xBC, 0xC9, 0xF6, 0x62},
+	 {
+	  0xC3, 0x76, 0x2D, 0xF1, 0xCA, 0x78, 0x7D, 0x32,
+	  0xAE, 0x47, 0xC1, 0x3B, 0xF1, 0x98, 0x44, 0xCB,
+	  0xAF, 0x1A, 0xE1, 0x4D, 0x0B, 0x97, 0x6A, 0xFA,
+	  0xC5, 0x2F, 0xF7, 0xD7, 0x9B, 0xBA, 0x9D, 0xE0,
+	  0xFE, 0xB5, 0x82, 0xD3, 0x39, 0x34, 0xA4, 0xF0,
+	  0x95, 0x4C, 0xC2, 0x36, 0x3B, 0xC7, 0x3F, 0x78,
+	  0x62, 0xAC, 0x43, 0x0E, 0x64, 0xAB, 0xE4, 0x99,
+	  0xF4, 0x7C, 0x9B, 0x1F},
+	 {
+	  0x5A, 0x8D, 0xEF, 0x2F, 0x0C, 0x9E, 0x53, 0xF1,
+	  0xF7, 0x5D, 0x78, 0x53, 0x65, 0x9E, 0x2A, 0x20,
+	  0xEE, 0xB2, 0xB2, 0x2A, 0xAF, 0xDE, 0x64, 0x19,
+	  0xA0, 0x58, 0xAB, 0x4F, 0x6F, 0x74, 0x6B, 0xF4,
+	  0x0F, 0xC0, 0xC3, 0xB7, 0x80, 0xF2, 0x44, 0x45,
+	  0x2D, 0xA3, 0xEB, 0xF1, 0xC5, 0xD8, 0x2C, 0xDE,
+	  0xA2, 0x41, 0x89, 0x97, 0x20, 0x0E, 0xF8, 0x2E,
+	  0x44, 0xAE, 0x7E, 0x3F}}
+};
+
+static const uint8_t gcm_test_tag[2][6][16] = {
+	{
+	 {
+	  0x58, 0xE2, 0xFC, 0xCE, 0xFA, 0x7E, 0x30, 0x61,
+	  0x36, 0x7F, 0x1D, 0x57, 0xA4, 0xE7, 0x45, 0x5A},
+	 {
+	  0xAB, 0x6E, 0x47, 0xD4, 0x2C, 0xEC, 0x13, 0xBD,
+	  0xF5, 0x3A, 0x67, 0xB2, 0x12, 0x57, 0xBD, 0xDF},
+	 {
+	  0x4D, 0x5C, 0x2A, 0xF3, 0x27, 0xCD, 0x64, 0xA6,
+	  0x2C, 0xF3, 0x5A, 0xBD, 0x2B, 0xA6, 0xFA, 0xB4},
+	 {
+	  0x5B, 0xC9, 0x4F, 0xBC, 0x32, 0x21, 0xA5, 0xDB,
+	  0x94, 0xFA, 0xE9, 0x5A, 0xE7, 0x12, 0x1A, 0x47},
+	 {
+	  0x36, 0x12, 0xD2, 0xE7, 0x9E, 0x3B, 0x07, 0x85,
+	  0x56, 0x1B, 0xE1, 0x4A, 0xAC, 0xA2, 0xFC, 0xCB},
+	 {
+	  0x61, 0x9C, 0xC5, 0xAE, 0xFF, 0xFE, 0x0B, 0xFA,
+	  0x46, 0x2A, 0xF4, 0x3C, 0x16, 0x99, 0xD0, 0x50}},
+	{
+	 {
+	  0x53, 0x0F, 0x8A, 0xFB, 0xC7, 0x45, 0x36, 0xB9,
+	  0xA9, 0x63, 0xB4, 0xF1, 0xC4, 0xCB, 0x73, 0x8B},
+	 {
+	  0xD0, 0xD1, 0xC8, 0xA7, 0x99, 0x99, 0x6B, 0xF0,
+	  0x26, 0x5B, 0x98, 0xB5, 0xD4, 0x8A, 0xB9, 0x19},
+	 {
+	  0xB0, 0x94, 0xDA, 0xC5, 0xD9, 0x34, 0x71, 0xBD,
+	  0xEC, 0x1A, 0x50, 0x22, 0x70, 0xE3, 0xCC, 0x6C},
+	 {
+	  0x76, 0xFC, 0x6E, 0xCE, 0x0F, 0x4E, 0x17, 0x68,
+	  0xCD, 0xDF, 0x88, 0x53, 0xBB, 0x2D, 0x55, 0x1B},
+	 {
+	  0x3A, 0x33, 0x7D, 0xBF, 0x46, 0xA7, 0x92, 0xC4,
+	  0x5E, 0x45, 0x49, 0x13, 0xFE, 0x2E, 0xA8, 0xF2},
+	 {
+	  0xA4, 0x4A, 0x82, 0x66, 0xEE, 0x1C, 0x8E, 0xB0,
+	  0xC8, 0xB5, 0xD4, 0xCF, 0x5A, 0xE9, 0xF1, 0x9A}}
+};
+
+/*
+ * Set up the key, IV and plaintext of test case tc
+ */
+static void gcm_test_vector(int tc, uint8_t key[32], uint8_t iv[64],
+			    uint8_t pt[64])
+{
+	memset(key, 0, 32);
+	memset(iv, 0, 64);
+	memset(pt, 0, 64);
+
+	if (tc < 2)
+		return;
+
+	memcpy(key, gcm_test_key, 32);
+	memcpy(pt, gcm_test_pt, 64);
+
+	if (tc == 5)
+		memcpy(iv, gcm_test_iv60, 60);
+	else
+		memcpy(iv, gcm_test_iv, 12);
+}
+
+static int gcm_test_vectors(int verbose)
+{
+	int i, j, tc;
+	uint8_t key[32];
+	uint8_t iv[64];
+	uint8_t pt[64];
+	uint8_t buf[64];
+	uint8_t tag[16];
+	gcm_context ctx;
+
+	for (j = 0; j < 2; j++) {
+		for (tc = 0; tc < 6; tc++) {
+			for (i = 0; i < 2; i++) {
+				if (verbose != 0)
+					printf("  AES-GCM-%3d #%d (%s): ",
+					       128 + j * 128, tc,
+					       (i == GCM_DECRYPT) ? "dec" : "enc");
+
+				gcm_test_vector(tc, key, iv, pt);
+				gcm_init(&ctx, key, 128 + j * 128);
+
+				if (i == GCM_DECRYPT) {
+					if (gcm_auth_decrypt(&ctx,
+							     gcm_test_pt_len[tc],
+							     iv, gcm_test_iv_len[tc],
+							     gcm_test_add,
+							     gcm_test_add_len[tc],
+							     gcm_test_tag[j][tc], 16,
+							     gcm_test_ct[j][tc],
+							     buf) != 0 ||
+					    memcmp(buf, pt,
+						   gcm_test_pt_len[tc]) != 0) {
+						if (verbose != 0)
+							printf("failed\n");
+
+						return (1);
+					}
+				} else {
+					gcm_crypt_and_tag(&ctx, GCM_ENCRYPT,
+							  gcm_test_pt_len[tc],
+							  iv, gcm_test_iv_len[tc],
+							  gcm_test_add,
+							  gcm_test_add_len[tc],
+							  pt, buf, 16, tag);
+
+					if (memcmp(buf, gcm_test_ct[j][tc],
+						   gcm_test_pt_len[tc]) != 0 ||
+					    memcmp(tag, gcm_test_tag[j][tc],
+						   16) != 0) {
+						if (verbose != 0)
+							printf("failed\n");
+
+						return (1);
+					}
+				}
+
+				if (verbose != 0)
+					printf("passed\n");
+			}
+		}
+	}
+
+	if (verbose != 0)
+		printf("\n");
+
+	return (0);
+}
+
+/*
+ * A long message processed in pieces, in place and with the portable
+ * GHASH must match the single-call result; a corrupted tag must fail
+ */
+static int gcm_test_bulk(int verbose)
+{
+	size_t i;
+	uint8_t key[16];
+	uint8_t iv[12];
+	uint8_t src[1040];
+	uint8_t buf1[1040 + 8], buf2[1040];
+	uint8_t tag1[16], tag2[16];
+	gcm_context ctx;
+
+	if (verbose != 0)
+		printf("  AES-GCM bulk       : ");
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = (uint8_t)(i * 11 + 3);
+
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = (uint8_t)(i * 7 + 1);
+
+	memset(iv, 0x5A, sizeof(iv));
+
+	gcm_init(&ctx, key, 128);
+	gcm_crypt_and_tag(&ctx, GCM_ENCRYPT, sizeof(src), iv, 12,
+			  gcm_test_add, 20, src, buf2, 16, tag2);
+
+	ctx.clmul = 0;
+	memcpy(buf1, src, sizeof(src));
+	gcm_starts(&ctx, GCM_ENCRYPT, iv, 12, gcm_test_add, 20);
+	gcm_update(&ctx, 48, buf1, buf1);
+	gcm_update(&ctx, 976, buf1 + 48, buf1 + 48);
+	gcm_update(&ctx, 16, buf1 + 1024, buf1 + 1024);
+	gcm_finish(&ctx, tag1, 16);
+
+	if (memcmp(buf1, buf2, sizeof(buf2)) != 0 ||
+	    memcmp(tag1, tag2, 16) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	/*
+	 * Decrypt with the output eight bytes ahead of the input, as the
+	 * record layer does for the explicit nonce
+	 */
+	gcm_init(&ctx, key, 128);
+	memmove(buf1 + 8, buf1, sizeof(src));
+
+	if (gcm_auth_decrypt(&ctx, sizeof(src), iv, 12, gcm_test_add, 20,
+			     tag2, 16, buf1 + 8, buf1) != 0 ||
+	    memcmp(buf1, src, sizeof(src)) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	tag2[15] ^= 1;
+
+	if (gcm_auth_decrypt(&ctx, sizeof(src), iv, 12, gcm_test_add, 20,
+			     tag2, 16, buf2, buf1) !=
+	    TROPICSSL_ERR_GCM_AUTH_FAILED) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+}
+
+/*
+ * Checkup routine
+ */
+int gcm_self_test(int verbose)
+{
+	int ret;
+
+	ret = gcm_test_vectors(verbose);
+	if (ret != 0)
+		return (ret);
+
+	ret = gcm_test_bulk(verbose);
+	if (ret != 0)
+		return (ret);
+
+	return (0);
+}
+
+#endif
+
+#endif
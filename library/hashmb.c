@@ -0,0 +1,833 @@
+/*
+ *  Multi-buffer MD5, SHA-1 and SHA-256
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  Independent messages are hashed side by side, one message per
+ *  32-bit lane of an AVX2 register, so that short inputs are bound by
+ *  vector throughput rather than by the latency of one compression.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_HASHMB)
+
+#include "tropicssl/hashmb.h"
+
+#if defined(TROPICSSL_MD5)
+#include "tropicssl/md5.h"
+#endif
+#if defined(TROPICSSL_SHA1)
+#include "tropicssl/sha1.h"
+#endif
+#if defined(TROPICSSL_SHA2)
+#include "tropicssl/sha2.h"
+#endif
+#if defined(TROPICSSL_SHANI)
+#include "tropicssl/shani.h"
+#endif
+
+#include <string.h>
+
+#if defined(TROPICSSL_HAVE_X86_64)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/*
+ * 32-bit integer manipulation macros
+ */
+#ifndef GET_UINT32_BE
+#define GET_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ] << 24 )             \
+        | ( (uint32_t) (b)[(i) + 1] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 2] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 3]       );            \
+}
+#endif
+
+#ifndef GET_UINT32_LE
+#define GET_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ]       )             \
+        | ( (uint32_t) (b)[(i) + 1] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 2] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 3] << 24 );            \
+}
+#endif
+
+#ifndef PUT_UINT32_BE
+#define PUT_UINT32_BE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (uint8_t) ( (n) >> 24 );             \
+    (b)[(i) + 1] = (uint8_t) ( (n) >> 16 );             \
+    (b)[(i) + 2] = (uint8_t) ( (n) >>  8 );             \
+    (b)[(i) + 3] = (uint8_t) ( (n)       );             \
+}
+#endif
+
+#ifndef PUT_UINT32_LE
+#define PUT_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (uint8_t) ( (n)       );             \
+    (b)[(i) + 1] = (uint8_t) ( (n) >>  8 );             \
+    (b)[(i) + 2] = (uint8_t) ( (n) >> 16 );             \
+    (b)[(i) + 3] = (uint8_t) ( (n) >> 24 );             \
+}
+#endif
+
+#if defined(TROPICSSL_HAVE_X86_64)
+
+/*
+ * Multi-buffer support detection routine: AVX2, with the YMM state
+ * saved by the OS
+ */
+int hashmb_supports(void)
+{
+	static int done = 0;
+	static int avx2 = 0;
+
+	if (done == 0) {
+		unsigned int a, b, c, d, xcr0;
+
+		if (__get_cpuid(1, &a, &b, &c, &d) != 0 &&
+		    (c & 0x18000000u) == 0x18000000u &&
+		    __get_cpuid_max(0, NULL) >= 7) {
+			__asm__ volatile ("xgetbv" : "=a" (xcr0),
+					  "=d" (d) : "c" (0));
+			__cpuid_count(7, 0, a, b, c, d);
+
+			avx2 = (xcr0 & 6) == 6 && (b & 0x00000020u) != 0;
+		}
+
+		done = 1;
+	}
+
+	return (avx2);
+}
+
+#define HASHMB_TARGET __attribute__((target("avx2")))
+
+#define HASHMB_LOAD(p)      _mm256_load_si256((const __m256i *)(p))
+#define HASHMB_STORE(p,x)   _mm256_store_si256((__m256i *)(p), (x))
+#define HASHMB_SET1(k)      _mm256_set1_epi32((int)(k))
+
+#define HASHMB_ADD(x,y)     _mm256_add_epi32(x, y)
+#define HASHMB_AND(x,y)     _mm256_and_si256(x, y)
+#define HASHMB_OR(x,y)      _mm256_or_si256(x, y)
+#define HASHMB_XOR(x,y)     _mm256_xor_si256(x, y)
+#define HASHMB_ROL(x,n)                                 \
+    HASHMB_OR(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+#define HASHMB_SHR(x,n)     _mm256_srli_epi32(x, n)
+#define HASHMB_NOT(x)       HASHMB_XOR(x, _mm256_set1_epi32(-1))
+
+#define HASHMB_CH(x,y,z)    HASHMB_XOR(z, HASHMB_AND(x, HASHMB_XOR(y, z)))
+#define HASHMB_PAR(x,y,z)   HASHMB_XOR(x, HASHMB_XOR(y, z))
+#define HASHMB_MAJ(x,y,z)                               \
+    HASHMB_OR(HASHMB_AND(x, y), HASHMB_AND(z, HASHMB_OR(x, y)))
+
+/*
+ * Gather word i of the block at p[lane] + off into lane "lane" of
+ * x[i], for the 16 words of each of the eight blocks
+ */
+#define HASHMB_TRANSPOSE(GET,x,p,off)                   \
+{                                                       \
+    int i_, l_;                                         \
+    for (l_ = 0; l_ < HASHMB_LANES; l_++)               \
+        for (i_ = 0; i_ < 16; i_++)                     \
+            GET(x[i_][l_], p[l_], (off) + 4 * i_);      \
+}
+
+/*
+ * MD5 on eight lanes
+ */
+#define HASHMB_F(x,y,z)     HASHMB_CH(x, y, z)
+#define HASHMB_G(x,y,z)     HASHMB_CH(z, x, y)
+#define HASHMB_H(x,y,z)     HASHMB_PAR(x, y, z)
+#define HASHMB_I(x,y,z)     HASHMB_XOR(y, HASHMB_OR(x, HASHMB_NOT(z)))
+
+#define HASHMB_MD5_P(f,a,b,c,d,k,s,t)                   \
+{                                                       \
+    a = HASHMB_ADD(a, HASHMB_ADD(f(b, c, d),            \
+        HASHMB_ADD(HASHMB_LOAD(x[k]), HASHMB_SET1(t)))); \
+    a = HASHMB_ADD(HASHMB_ROL(a, s), b);                \
+}
+
+HASHMB_TARGET static void hashmb_md5_x8(uint32_t st[][HASHMB_LANES],
+					 const uint8_t *p[HASHMB_LANES],
+					 size_t nblocks)
+{
+	uint32_t x[16][HASHMB_LANES] __attribute__((aligned(32)));
+	__m256i A, B, C, D;
+	size_t j;
+
+	for (j = 0; j < nblocks; j++) {
+		HASHMB_TRANSPOSE(GET_UINT32_LE, x, p, 64 * j);
+
+		A = HASHMB_LOAD(st[0]);
+		B = HASHMB_LOAD(st[1]);
+		C = HASHMB_LOAD(st[2]);
+		D = HASHMB_LOAD(st[3]);
+
+		HASHMB_MD5_P(HASHMB_F, A, B, C, D, 0, 7, 0xD76AA478);
+		HASHMB_MD5_P(HASHMB_F, D, A, B, C, 1, 12, 0xE8C7B756);
+		HASHMB_MD5_P(HASHMB_F, C, D, A, B, 2, 17, 0x242070DB);
+		HASHMB_MD5_P(HASHMB_F, B, C, D, A, 3, 22, 0xC1BDCEEE);
+		HASHMB_MD5_P(HASHMB_F, A, B, C, D, 4, 7, 0xF57C0FAF);
+		HASHMB_MD5_P(HASHMB_F, D, A, B, C, 5, 12, 0x4787C62A);
+		HASHMB_MD5_P(HASHMB_F, C, D, A, B, 6, 17, 0xA8304613);
+		HASHMB_MD5_P(HASHMB_F, B, C, D, A, 7, 22, 0xFD469501);
+		HASHMB_MD5_P(HASHMB_F, A, B, C, D, 8, 7, 0x698098D8);
+		HASHMB_MD5_P(HASHMB_F, D, A, B, C, 9, 12, 0x8B44F7AF);
+		HASHMB_MD5_P(HASHMB_F, C, D, A, B, 10, 17, 0xFFFF5BB1);
+		HASHMB_MD5_P(HASHMB_F, B, C, D, A, 11, 22, 0x895CD7BE);
+		HASHMB_MD5_P(HASHMB_F, A, B, C, D, 12, 7, 0x6B901122);
+		HASHMB_MD5_P(HASHMB_F, D, A, B, C, 13, 12, 0xFD987193);
+		HASHMB_MD5_P(HASHMB_F, C, D, A, B, 14, 17, 0xA679438E);
+		HASHMB_MD5_P(HASHMB_F, B, C, D, A, 15, 22, 0x49B40821);
+
+		HASHMB_MD5_P(HASHMB_G, A, B, C, D, 1, 5, 0xF61E2562);
+		HASHMB_MD5_P(HASHMB_G, D, A, B, C, 6, 9, 0xC040B340);
+		HASHMB_MD5_P(HASHMB_G, C, D, A, B, 11, 14, 0x265E5A51);
+		HASHMB_MD5_P(HASHMB_G, B, C, D, A, 0, 20, 0xE9B6C7AA);
+		HASHMB_MD5_P(HASHMB_G, A, B, C, D, 5, 5, 0xD62F105D);
+		HASHMB_MD5_P(HASHMB_G, D, A, B, C, 10, 9, 0x02441453);
+		HASHMB_MD5_P(HASHMB_G, C, D, A, B, 15, 14, 0xD8A1E681);
+		HASHMB_MD5_P(HASHMB_G, B, C, D, A, 4, 20, 0xE7D3FBC8);
+		HASHMB_MD5_P(HASHMB_G, A, B, C, D, 9, 5, 0x21E1CDE6);
+		HASHMB_MD5_P(HASHMB_G, D, A, B, C, 14, 9, 0xC33707D6);
+		HASHMB_MD5_P(HASHMB_G, C, D, A, B, 3, 14, 0xF4D50D87);
+		HASHMB_MD5_P(HASHMB_G, B, C, D, A, 8, 20, 0x455A14ED);
+		HASHMB_MD5_P(HASHMB_G, A, B, C, D, 13, 5, 0xA9E3E905);
+		HASHMB_MD5_P(HASHMB_G, D, A, B, C, 2, 9, 0xFCEFA3F8);
+		HASHMB_MD5_P(HASHMB_G, C, D, A, B, 7, 14, 0x676F02D9);
+		HASHMB_MD5_P(HASHMB_G, B, C, D, A, 12, 20, 0x8D2A4C8A);
+
+		HASHMB_MD5_P(HASHMB_H, A, B, C, D, 5, 4, 0xFFFA3942);
+		HASHMB_MD5_P(HASHMB_H, D, A, B, C, 8, 11, 0x8771F681);
+		HASHMB_MD5_P(HASHMB_H, C, D, A, B, 11, 16, 0x6D9D6122);
+		HASHMB_MD5_P(HASHMB_H, B, C, D, A, 14, 23, 0xFDE5380C);
+		HASHMB_MD5_P(HASHMB_H, A, B, C, D, 1, 4, 0xA4BEEA44);
+		HASHMB_MD5_P(HASHMB_H, D, A, B, C, 4, 11, 0x4BDECFA9);
+		HASHMB_MD5_P(HASHMB_H, C, D, A, B, 7, 16, 0xF6BB4B60);
+		HASHMB_MD5_P(HASHMB_H, B, C, D, A, 10, 23, 0xBEBFBC70);
+		HASHMB_MD5_P(HASHMB_H, A, B, C, D, 13, 4, 0x289B7EC6);
+		HASHMB_MD5_P(HASHMB_H, D, A, B, C, 0, 11, 0xEAA127FA);
+		HASHMB_MD5_P(HASHMB_H, C, D, A, B, 3, 16, 0xD4EF3085);
+		HASHMB_MD5_P(HASHMB_H, B, C, D, A, 6, 23, 0x04881D05);
+		HASHMB_MD5_P(HASHMB_H, A, B, C, D, 9, 4, 0xD9D4D039);
+		HASHMB_MD5_P(HASHMB_H, D, A, B, C, 12, 11, 0xE6DB99E5);
+		HASHMB_MD5_P(HASHMB_H, C, D, A, B, 15, 16, 0x1FA27CF8);
+		HASHMB_MD5_P(HASHMB_H, B, C, D, A, 2, 23, 0xC4AC5665);
+
+		HASHMB_MD5_P(HASHMB_I, A, B, C, D, 0, 6, 0xF4292244);
+		HASHMB_MD5_P(HASHMB_I, D, A, B, C, 7, 10, 0x432AFF97);
+		HASHMB_MD5_P(HASHMB_I, C, D, A, B, 14, 15, 0xAB9423A7);
+		HASHMB_MD5_P(HASHMB_I, B, C, D, A, 5, 21, 0xFC93A039);
+		HASHMB_MD5_P(HASHMB_I, A, B, C, D, 12, 6, 0x655B59C3);
+		HASHMB_MD5_P(HASHMB_I, D, A, B, C, 3, 10, 0x8F0CCC92);
+		HASHMB_MD5_P(HASHMB_I, C, D, A, B, 10, 15, 0xFFEFF47D);
+		HASHMB_MD5_P(HASHMB_I, B, C, D, A, 1, 21, 0x85845DD1);
+		HASHMB_MD5_P(HASHMB_I, A, B, C, D, 8, 6, 0x6FA87E4F);
+		HASHMB_MD5_P(HASHMB_I, D, A, B, C, 15, 10, 0xFE2CE6E0);
+		HASHMB_MD5_P(HASHMB_I, C, D, A, B, 6, 15, 0xA3014314);
+		HASHMB_MD5_P(HASHMB_I, B, C, D, A, 13, 21, 0x4E0811A1);
+		HASHMB_MD5_P(HASHMB_I, A, B, C, D, 4, 6, 0xF7537E82);
+		HASHMB_MD5_P(HASHMB_I, D, A, B, C, 11, 10, 0xBD3AF235);
+		HASHMB_MD5_P(HASHMB_I, C, D, A, B, 2, 15, 0x2AD7D2BB);
+		HASHMB_MD5_P(HASHMB_I, B, C, D, A, 9, 21, 0xEB86D391);
+
+		HASHMB_STORE(st[0], HASHMB_ADD(A, HASHMB_LOAD(st[0])));
+		HASHMB_STORE(st[1], HASHMB_ADD(B, HASHMB_LOAD(st[1])));
+		HASHMB_STORE(st[2], HASHMB_ADD(C, HASHMB_LOAD(st[2])));
+		HASHMB_STORE(st[3], HASHMB_ADD(D, HASHMB_LOAD(st[3])));
+	}
+}
+
+/*
+ * SHA-1 on eight lanes
+ */
+#define HASHMB_SHA1_W(t)                                \
+(                                                       \
+    w[(t) & 15] = HASHMB_ROL(HASHMB_XOR(                \
+        HASHMB_XOR(w[((t) - 3) & 15], w[((t) - 8) & 15]), \
+        HASHMB_XOR(w[((t) - 14) & 15], w[(t) & 15])), 1) \
+)
+
+#define HASHMB_SHA1_P(f,a,b,c,d,e,t)                    \
+{                                                       \
+    e = HASHMB_ADD(e, HASHMB_ADD(HASHMB_ROL(a, 5),      \
+        HASHMB_ADD(f(b, c, d), HASHMB_ADD(k,            \
+        (t) < 16 ? w[(t) & 15] : HASHMB_SHA1_W(t)))));  \
+    b = HASHMB_ROL(b, 30);                              \
+}
+
+#define HASHMB_SHA1_P5(f,t)                             \
+{                                                       \
+    HASHMB_SHA1_P(f, A, B, C, D, E, (t));               \
+    HASHMB_SHA1_P(f, E, A, B, C, D, (t) + 1);           \
+    HASHMB_SHA1_P(f, D, E, A, B, C, (t) + 2);           \
+    HASHMB_SHA1_P(f, C, D, E, A, B, (t) + 3);           \
+    HASHMB_SHA1_P(f, B, C, D, E, A, (t) + 4);           \
+}
+
+HASHMB_TARGET static void hashmb_sha1_x8(uint32_t st[][HASHMB_LANES],
+					  const uint8_t *p[HASHMB_LANES],
+					  size_t nblocks)
+{
+	uint32_t x[16][HASHMB_LANES] __attribute__((aligned(32)));
+	__m256i A, B, C, D, E, k, w[16];
+	size_t j;
+	int t;
+
+	for (j = 0; j < nblocks; j++) {
+		HASHMB_TRANSPOSE(GET_UINT32_BE, x, p, 64 * j);
+
+		for (t = 0; t < 16; t++)
+			w[t] = HASHMB_LOAD(x[t]);
+
+		A = HASHMB_LOAD(st[0]);
+		B = HASHMB_LOAD(st[1]);
+		C = HASHMB_LOAD(st[2]);
+		D = HASHMB_LOAD(st[3]);
+		E = HASHMB_LOAD(st[4]);
+
+		k = HASHMB_SET1(0x5A827999);
+		for (t = 0; t < 20; t += 5)
+			HASHMB_SHA1_P5(HASHMB_CH, t);
+
+		k = HASHMB_SET1(0x6ED9EBA1);
+		for (; t < 40; t += 5)
+			HASHMB_SHA1_P5(HASHMB_PAR, t);
+
+		k = HASHMB_SET1(0x8F1BBCDC);
+		for (; t < 60; t += 5)
+			HASHMB_SHA1_P5(HASHMB_MAJ, t);
+
+		k = HASHMB_SET1(0xCA62C1D6);
+		for (; t < 80; t += 5)
+			HASHMB_SHA1_P5(HASHMB_PAR, t);
+
+		HASHMB_STORE(st[0], HASHMB_ADD(A, HASHMB_LOAD(st[0])));
+		HASHMB_STORE(st[1], HASHMB_ADD(B, HASHMB_LOAD(st[1])));
+		HASHMB_STORE(st[2], HASHMB_ADD(C, HASHMB_LOAD(st[2])));
+		HASHMB_STORE(st[3], HASHMB_ADD(D, HASHMB_LOAD(st[3])));
+		HASHMB_STORE(st[4], HASHMB_ADD(E, HASHMB_LOAD(st[4])));
+	}
+}
+
+/*
+ * SHA-256 on eight lanes
+ */
+static const uint32_t hashmb_k256[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define HASHMB_ROR(x,n)     HASHMB_ROL(x, 32 - (n))
+
+#define HASHMB_S0(x) HASHMB_XOR(HASHMB_ROR(x, 7),       \
+    HASHMB_XOR(HASHMB_ROR(x, 18), HASHMB_SHR(x, 3)))
+#define HASHMB_S1(x) HASHMB_XOR(HASHMB_ROR(x, 17),      \
+    HASHMB_XOR(HASHMB_ROR(x, 19), HASHMB_SHR(x, 10)))
+#define HASHMB_S2(x) HASHMB_XOR(HASHMB_ROR(x, 2),       \
+    HASHMB_XOR(HASHMB_ROR(x, 13), HASHMB_ROR(x, 22)))
+#define HASHMB_S3(x) HASHMB_XOR(HASHMB_ROR(x, 6),       \
+    HASHMB_XOR(HASHMB_ROR(x, 11), HASHMB_ROR(x, 25)))
+
+#define HASHMB_SHA256_W(t)                              \
+(                                                       \
+    w[(t) & 15] = HASHMB_ADD(                           \
+        HASHMB_ADD(HASHMB_S1(w[((t) - 2) & 15]),        \
+                   w[((t) - 7) & 15]),                  \
+        HASHMB_ADD(HASHMB_S0(w[((t) - 15) & 15]),       \
+                   w[(t) & 15]))                        \
+)
+
+#define HASHMB_SHA256_P(a,b,c,d,e,f,g,h,t)              \
+{                                                       \
+    temp1 = HASHMB_ADD(HASHMB_ADD(h, HASHMB_S3(e)),     \
+        HASHMB_ADD(HASHMB_CH(e, f, g),                  \
+        HASHMB_ADD(HASHMB_SET1(hashmb_k256[t]),         \
+        (t) < 16 ? w[(t) & 15] : HASHMB_SHA256_W(t)))); \
+    temp2 = HASHMB_ADD(HASHMB_S2(a), HASHMB_MAJ(a, b, c)); \
+    d = HASHMB_ADD(d, temp1);                           \
+    h = HASHMB_ADD(temp1, temp2);                       \
+}
+
+HASHMB_TARGET static void hashmb_sha256_x8(uint32_t st[][HASHMB_LANES],
+					    const uint8_t *p[HASHMB_LANES],
+					    size_t nblocks)
+{
+	uint32_t x[16][HASHMB_LANES] __attribute__((aligned(32)));
+	__m256i A, B, C, D, E, F, G, H, temp1, temp2, w[16];
+	size_t j;
+	int t;
+
+	for (j = 0; j < nblocks; j++) {
+		HASHMB_TRANSPOSE(GET_UINT32_BE, x, p, 64 * j);
+
+		for (t = 0; t < 16; t++)
+			w[t] = HASHMB_LOAD(x[t]);
+
+		A = HASHMB_LOAD(st[0]);
+		B = HASHMB_LOAD(st[1]);
+		C = HASHMB_LOAD(st[2]);
+		D = HASHMB_LOAD(st[3]);
+		E = HASHMB_LOAD(st[4]);
+		F = HASHMB_LOAD(st[5]);
+		G = HASHMB_LOAD(st[6]);
+		H = HASHMB_LOAD(st[7]);
+
+		for (t = 0; t < 64; t += 8) {
+			HASHMB_SHA256_P(A, B, C, D, E, F, G, H, t);
+			HASHMB_SHA256_P(H, A, B, C, D, E, F, G, t + 1);
+			HASHMB_SHA256_P(G, H, A, B, C, D, E, F, t + 2);
+			HASHMB_SHA256_P(F, G, H, A, B, C, D, E, t + 3);
+			HASHMB_SHA256_P(E, F, G, H, A, B, C, D, t + 4);
+			HASHMB_SHA256_P(D, E, F, G, H, A, B, C, t + 5);
+			HASHMB_SHA256_P(C, D, E, F, G, H, A, B, t + 6);
+			HASHMB_SHA256_P(B, C, D, E, F, G, H, A, t + 7);
+		}
+
+		HASHMB_STORE(st[0], HASHMB_ADD(A, HASHMB_LOAD(st[0])));
+		HASHMB_STORE(st[1], HASHMB_ADD(B, HASHMB_LOAD(st[1])));
+		HASHMB_STORE(st[2], HASHMB_ADD(C, HASHMB_LOAD(st[2])));
+		HASHMB_STORE(st[3], HASHMB_ADD(D, HASHMB_LOAD(st[3])));
+		HASHMB_STORE(st[4], HASHMB_ADD(E, HASHMB_LOAD(st[4])));
+		HASHMB_STORE(st[5], HASHMB_ADD(F, HASHMB_LOAD(st[5])));
+		HASHMB_STORE(st[6], HASHMB_ADD(G, HASHMB_LOAD(st[6])));
+		HASHMB_STORE(st[7], HASHMB_ADD(H, HASHMB_LOAD(st[7])));
+	}
+}
+
+/*
+ * Description of one hash function for the lane scheduler
+ */
+typedef struct {
+	void (*x8) (uint32_t st[][HASHMB_LANES],
+		    const uint8_t *p[HASHMB_LANES], size_t nblocks);
+	const uint32_t *iv;	/*!< initial state              */
+	int words;		/*!< state words                */
+	int outlen;		/*!< digest length in bytes     */
+	int big_endian;		/*!< SHA (1) or MD5 (0) order   */
+} hashmb_algo;
+
+/*
+ * Per-lane progress: the whole blocks of the message are read in
+ * place, then the last partial block and the padding from tail.
+ */
+typedef struct {
+	size_t msg;		/*!< message index              */
+	const uint8_t *ptr;	/*!< next block to hash         */
+	size_t left;		/*!< blocks left in this part   */
+	int in_tail;		/*!< hashing the padded tail    */
+	size_t tail_blocks;	/*!< 1 or 2                     */
+	uint8_t tail[128];	/*!< last data + padding        */
+} hashmb_lane;
+
+static void hashmb_lane_start(const hashmb_algo * alg, hashmb_lane * ln,
+			      uint32_t st[][HASHMB_LANES], int l,
+			      size_t msg, const uint8_t *input, size_t ilen)
+{
+	size_t r = ilen & 63;
+	uint32_t hi = (uint32_t)((uint64_t)ilen >> 29);
+	uint32_t lo = (uint32_t)(ilen << 3);
+	uint8_t *len;
+	int i;
+
+	for (i = 0; i < alg->words; i++)
+		st[i][l] = alg->iv[i];
+
+	ln->msg = msg;
+	ln->ptr = input;
+	ln->left = ilen >> 6;
+
+	memset(ln->tail, 0, sizeof(ln->tail));
+	if (r > 0)
+		memcpy(ln->tail, input + (ilen - r), r);
+	ln->tail[r] = 0x80;
+
+	ln->tail_blocks = (r < 56) ? 1 : 2;
+	len = ln->tail + 64 * ln->tail_blocks - 8;
+
+	if (alg->big_endian) {
+		PUT_UINT32_BE(hi, len, 0);
+		PUT_UINT32_BE(lo, len, 4);
+	} else {
+		PUT_UINT32_LE(lo, len, 0);
+		PUT_UINT32_LE(hi, len, 4);
+	}
+
+	ln->in_tail = 0;
+	if (ln->left == 0) {
+		ln->ptr = ln->tail;
+		ln->left = ln->tail_blocks;
+		ln->in_tail = 1;
+	}
+}
+
+/*
+ * Keep all eight lanes busy: run them together for as many blocks as
+ * the shortest current part allows, then move each lane that ran out
+ * on to its tail, or to the next message once the tail is done.
+ * Lanes with nothing left to do re-read a busy lane's blocks and
+ * their result is thrown away.
+ */
+static void hashmb_run(const hashmb_algo * alg, size_t n,
+		       const uint8_t * const input[], const size_t ilen[],
+		       uint8_t * const output[])
+{
+	uint32_t st[8][HASHMB_LANES] __attribute__((aligned(32)));
+	hashmb_lane lane[HASHMB_LANES];
+	const uint8_t *p[HASHMB_LANES];
+	int active[HASHMB_LANES];
+	size_t next = 0, k;
+	int l, i, busy;
+
+	for (l = 0; l < HASHMB_LANES; l++) {
+		active[l] = next < n;
+		if (active[l] != 0) {
+			hashmb_lane_start(alg, &lane[l], st, l, next,
+					  input[next], ilen[next]);
+			next++;
+		}
+	}
+
+	for (;;) {
+		k = 0;
+		busy = -1;
+		for (l = 0; l < HASHMB_LANES; l++) {
+			if (active[l] == 0)
+				continue;
+			if (busy < 0 || lane[l].left < k)
+				k = lane[l].left;
+			busy = l;
+		}
+
+		if (busy < 0)
+			break;
+
+		for (l = 0; l < HASHMB_LANES; l++)
+			p[l] = lane[active[l] ? l : busy].ptr;
+
+		alg->x8(st, p, k);
+
+		for (l = 0; l < HASHMB_LANES; l++) {
+			hashmb_lane *ln = &lane[l];
+
+			if (active[l] == 0)
+				continue;
+
+			ln->ptr += 64 * k;
+			ln->left -= k;
+
+			if (ln->left > 0)
+				continue;
+
+			if (ln->in_tail == 0) {
+				ln->ptr = ln->tail;
+				ln->left = ln->tail_blocks;
+				ln->in_tail = 1;
+				continue;
+			}
+
+			for (i = 0; i < alg->outlen / 4; i++) {
+				if (alg->big_endian) {
+					PUT_UINT32_BE(st[i][l],
+						      output[ln->msg], 4 * i);
+				} else {
+					PUT_UINT32_LE(st[i][l],
+						      output[ln->msg], 4 * i);
+				}
+			}
+
+			active[l] = next < n;
+			if (active[l] != 0) {
+				hashmb_lane_start(alg, ln, st, l, next,
+						  input[next], ilen[next]);
+				next++;
+			}
+		}
+	}
+}
+
+/*
+ * The SHA extensions hash one SHA-1 or SHA-256 message faster than
+ * eight AVX2 lanes hash eight, so the lanes are only used without them
+ */
+static int hashmb_use_lanes(size_t n)
+{
+#if defined(TROPICSSL_SHANI)
+	if (shani_supports(TROPICSSL_SHANI_SHA))
+		return (0);
+#endif
+
+	return (n > 1 && hashmb_supports());
+}
+
+#else
+
+int hashmb_supports(void)
+{
+	return (0);
+}
+
+#endif
+
+#if defined(TROPICSSL_MD5)
+
+#if defined(TROPICSSL_HAVE_X86_64)
+static const uint32_t hashmb_md5_iv[4] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476
+};
+
+static const hashmb_algo hashmb_md5_algo = {
+	hashmb_md5_x8, hashmb_md5_iv, 4, 16, 0
+};
+#endif
+
+/*
+ * Output = MD5( input[i] ) for each message
+ */
+void hashmb_md5(size_t n, const uint8_t * const input[],
+		const size_t ilen[], uint8_t * const output[])
+{
+	size_t i;
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	if (n > 1 && hashmb_supports()) {
+		hashmb_run(&hashmb_md5_algo, n, input, ilen, output);
+		return;
+	}
+#endif
+
+	for (i = 0; i < n; i++)
+		md5(input[i], ilen[i], output[i]);
+}
+
+#endif
+
+#if defined(TROPICSSL_SHA1)
+
+#if defined(TROPICSSL_HAVE_X86_64)
+static const uint32_t hashmb_sha1_iv[5] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+static const hashmb_algo hashmb_sha1_algo = {
+	hashmb_sha1_x8, hashmb_sha1_iv, 5, 20, 1
+};
+#endif
+
+/*
+ * Output = SHA-1( input[i] ) for each message
+ */
+void hashmb_sha1(size_t n, const uint8_t * const input[],
+		 const size_t ilen[], uint8_t * const output[])
+{
+	size_t i;
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	if (hashmb_use_lanes(n)) {
+		hashmb_run(&hashmb_sha1_algo, n, input, ilen, output);
+		return;
+	}
+#endif
+
+	for (i = 0; i < n; i++)
+		sha1(input[i], ilen[i], output[i]);
+}
+
+#endif
+
+#if defined(TROPICSSL_SHA2)
+
+#if defined(TROPICSSL_HAVE_X86_64)
+static const uint32_t hashmb_sha256_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint32_t hashmb_sha224_iv[8] = {
+	0xC1059ED8, 0x367CD507, 0x3070DD17, 0xF70E5939,
+	0xFFC00B31, 0x68581511, 0x64F98FA7, 0xBEFA4FA4
+};
+
+static const hashmb_algo hashmb_sha256_algo = {
+	hashmb_sha256_x8, hashmb_sha256_iv, 8, 32, 1
+};
+
+static const hashmb_algo hashmb_sha224_algo = {
+	hashmb_sha256_x8, hashmb_sha224_iv, 8, 28, 1
+};
+#endif
+
+/*
+ * Output = SHA-256( input[i] ) for each message
+ */
+void hashmb_sha2(size_t n, const uint8_t * const input[],
+		 const size_t ilen[], uint8_t * const output[], int is224)
+{
+	size_t i;
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	if (hashmb_use_lanes(n)) {
+		hashmb_run(is224 ? &hashmb_sha224_algo : &hashmb_sha256_algo,
+			   n, input, ilen, output);
+		return;
+	}
+#endif
+
+	for (i = 0; i < n; i++)
+		sha2(input[i], ilen[i], output[i], is224);
+}
+
+#endif
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * Checkup routine: hash messages of every length from 0 to 300 bytes
+ * in one batch and compare with the one-message functions
+ */
+int hashmb_self_test(int verbose)
+{
+	static uint8_t buf[300];
+	const uint8_t *input[301];
+	size_t ilen[301];
+	uint8_t *output[301];
+	static uint8_t sum[301][32];
+	uint8_t ref[32];
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = (uint8_t)(i * 7 + 1);
+
+	for (i = 0; i <= sizeof(buf); i++) {
+		input[i] = buf;
+		ilen[i] = i;
+		output[i] = sum[i];
+	}
+
+#if defined(TROPICSSL_MD5)
+	if (verbose != 0)
+		printf("  Multi-buffer MD5 test: ");
+
+	hashmb_md5(301, input, ilen, output);
+	for (i = 0; i <= sizeof(buf); i++) {
+		md5(buf, i, ref);
+		if (memcmp(sum[i], ref, 16) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+			return (1);
+		}
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+#endif
+
+#if defined(TROPICSSL_SHA1)
+	if (verbose != 0)
+		printf("  Multi-buffer SHA-1 test: ");
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	/*
+	 * Test the lanes even when hashmb_sha1() would not use them
+	 */
+	if (hashmb_supports())
+		hashmb_run(&hashmb_sha1_algo, 301, input, ilen, output);
+	else
+#endif
+		hashmb_sha1(301, input, ilen, output);
+	for (i = 0; i <= sizeof(buf); i++) {
+		sha1(buf, i, ref);
+		if (memcmp(sum[i], ref, 20) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+			return (1);
+		}
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+#endif
+
+#if defined(TROPICSSL_SHA2)
+	if (verbose != 0)
+		printf("  Multi-buffer SHA-256 test: ");
+
+#if defined(TROPICSSL_HAVE_X86_64)
+	if (hashmb_supports())
+		hashmb_run(&hashmb_sha256_algo, 301, input, ilen, output);
+	else
+#endif
+		hashmb_sha2(301, input, ilen, output, 0);
+	for (i = 0; i <= sizeof(buf); i++) {
+		sha2(buf, i, ref, 0);
+		if (memcmp(sum[i], ref, 32) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+			return (1);
+		}
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+#endif
+
+	if (verbose != 0)
+		printf("\n");
+
+	return (0);
+}
+
+#endif
+
+#endif
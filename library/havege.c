@@ -217,4 +217,27 @@ int havege_rand(void *p_rng)
 	return (ret);
 }
 
+/*
+ * HAVEGE bulk function
+ */
+int havege_random(void *p_rng, uint8_t *output, size_t len)
+{
+	int val;
+	size_t use_len;
+
+	while (len > 0) {
+		use_len = len;
+		if (use_len > sizeof(int))
+			use_len = sizeof(int);
+
+		val = havege_rand(p_rng);
+		memcpy(output, &val, use_len);
+
+		output += use_len;
+		len -= use_len;
+	}
+
+	return (0);
+}
+
 #endif
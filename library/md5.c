@@ -335,6 +335,7 @@ void md5_hmac_starts(md5_context * ctx, const uint8_t *key, size_t keylen)
 {
 	size_t i;
 	uint8_t sum[16];
+	uint8_t pad[64];
 
 	if (keylen > 64) {
 		md5(key, keylen, sum);
@@ -342,18 +343,27 @@ void md5_hmac_starts(md5_context * ctx, const uint8_t *key, size_t keylen)
 		key = sum;
 	}
 
-	memset(ctx->ipad, 0x36, 64);
-	memset(ctx->opad, 0x5C, 64);
+	/*
+	 * Hash each padded key block once and keep the two states
+	 */
+	memset(pad, 0x5C, 64);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
-	for (i = 0; i < keylen; i++) {
-		ctx->ipad[i] = (uint8_t)(ctx->ipad[i] ^ key[i]);
-		ctx->opad[i] = (uint8_t)(ctx->opad[i] ^ key[i]);
-	}
+	md5_starts(ctx);
+	md5_update(ctx, pad, 64);
+	memcpy(ctx->ostate, ctx->state, sizeof(ctx->ostate));
+
+	memset(pad, 0x36, 64);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
 	md5_starts(ctx);
-	md5_update(ctx, ctx->ipad, 64);
+	md5_update(ctx, pad, 64);
+	memcpy(ctx->istate, ctx->state, sizeof(ctx->istate));
 
 	memset(sum, 0, sizeof(sum));
+	memset(pad, 0, sizeof(pad));
 }
 
 /*
@@ -372,14 +382,25 @@ void md5_hmac_finish(md5_context * ctx, uint8_t output[16])
 	uint8_t tmpbuf[16];
 
 	md5_finish(ctx, tmpbuf);
-	md5_starts(ctx);
-	md5_update(ctx, ctx->opad, 64);
+	memcpy(ctx->state, ctx->ostate, sizeof(ctx->state));
+	ctx->total[0] = 64;
+	ctx->total[1] = 0;
 	md5_update(ctx, tmpbuf, 16);
 	md5_finish(ctx, output);
 
 	memset(tmpbuf, 0, sizeof(tmpbuf));
 }
 
+/*
+ * MD5 HMAC context reset
+ */
+void md5_hmac_reset(md5_context * ctx)
+{
+	memcpy(ctx->state, ctx->istate, sizeof(ctx->state));
+	ctx->total[0] = 64;
+	ctx->total[1] = 0;
+}
+
 /*
  * output = HMAC-MD5( hmac key, input buffer )
  */
@@ -564,6 +585,21 @@ int md5_self_test(int verbose)
 			return (1);
 		}
 
+		/*
+		 * Same key again, from the saved key states
+		 */
+		md5_hmac_reset(&ctx);
+		md5_hmac_update(&ctx, md5_hmac_test_buf[i],
+				md5_hmac_test_buflen[i]);
+		md5_hmac_finish(&ctx, md5sum);
+
+		if (memcmp(md5sum, md5_hmac_test_sum[i], buflen) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+
 		if (verbose != 0)
 			printf("passed\n");
 	}
@@ -0,0 +1,1059 @@
+/*
+ *  In-memory transport for SSL/TLS contexts
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_MEM_BIO_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/mem_bio.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+int mem_bio_init(mem_bio * b, size_t size)
+{
+	memset(b, 0, sizeof(mem_bio));
+
+	if ((b->buf = (uint8_t *)malloc(size)) == NULL)
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+	b->size = size;
+
+	return (0);
+}
+
+void mem_bio_reset(mem_bio * b)
+{
+	b->head = 0;
+	b->len = 0;
+	b->eof = 0;
+}
+
+void mem_bio_close(mem_bio * b)
+{
+	b->eof = 1;
+}
+
+size_t mem_bio_pending(const mem_bio * b)
+{
+	return (b->len);
+}
+
+size_t mem_bio_space(const mem_bio * b)
+{
+	return (b->size - b->len);
+}
+
+size_t mem_bio_peek(const mem_bio * b, const uint8_t ** p)
+{
+	size_t n = b->size - b->head;
+
+	*p = b->buf + b->head;
+
+	return ((b->len < n) ? b->len : n);
+}
+
+void mem_bio_consume(mem_bio * b, size_t n)
+{
+	if (n > b->len)
+		n = b->len;
+
+	b->head += n;
+	b->len -= n;
+
+	if (b->head >= b->size)
+		b->head -= b->size;
+
+	/*
+	 * Rewind when empty, so that the next runs are as long as can be
+	 */
+	if (b->len == 0)
+		b->head = 0;
+}
+
+size_t mem_bio_reserve(mem_bio * b, uint8_t ** p)
+{
+	size_t tail = b->head + b->len;
+
+	/*
+	 * Past the end, the free space runs from the wrapped tail up to
+	 * the head; otherwise from the tail to the end of the storage
+	 */
+	if (tail >= b->size) {
+		*p = b->buf + tail - b->size;
+		return (b->size - b->len);
+	}
+
+	*p = b->buf + tail;
+
+	return (b->size - tail);
+}
+
+void mem_bio_commit(mem_bio * b, size_t n)
+{
+	if (n > b->size - b->len)
+		n = b->size - b->len;
+
+	b->len += n;
+}
+
+/*
+ * Copy in as much as fits, in up to two runs
+ */
+static size_t mem_bio_put(mem_bio * b, const uint8_t *buf, size_t len)
+{
+	size_t n, done = 0;
+	uint8_t *p;
+
+	while (done < len && (n = mem_bio_reserve(b, &p)) > 0) {
+		if (n > len - done)
+			n = len - done;
+
+		memcpy(p, buf + done, n);
+		mem_bio_commit(b, n);
+		done += n;
+	}
+
+	return (done);
+}
+
+int mem_bio_recv(void *ctx, uint8_t *buf, size_t len)
+{
+	size_t n, done = 0;
+	const uint8_t *p;
+	mem_bio *b = (mem_bio *) ctx;
+
+	if (b->len == 0 && len > 0)
+		return (b->eof ? TROPICSSL_ERR_NET_CONN_RESET :
+			TROPICSSL_ERR_NET_TRY_AGAIN);
+
+	while (done < len && (n = mem_bio_peek(b, &p)) > 0) {
+		if (n > len - done)
+			n = len - done;
+
+		memcpy(buf + done, p, n);
+		mem_bio_consume(b, n);
+		done += n;
+	}
+
+	return ((int)done);
+}
+
+int mem_bio_send(void *ctx, uint8_t *buf, size_t len)
+{
+	mem_bio *b = (mem_bio *) ctx;
+
+	if (b->eof)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
+
+	if (b->len == b->size && len > 0)
+		return (TROPICSSL_ERR_NET_TRY_AGAIN);
+
+	return ((int)mem_bio_put(b, buf, len));
+}
+
+int mem_bio_sendv(void *ctx, const net_iovec * iov, int iovcnt)
+{
+	int i;
+	size_t n, done = 0, want = 0;
+	mem_bio *b = (mem_bio *) ctx;
+
+	if (b->eof)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
+
+	for (i = 0; i < iovcnt; i++) {
+		want += iov[i].len;
+		n = mem_bio_put(b, (const uint8_t *)iov[i].base, iov[i].len);
+		done += n;
+
+		if (n < iov[i].len)
+			break;
+	}
+
+	if (done == 0 && want > 0)
+		return (TROPICSSL_ERR_NET_TRY_AGAIN);
+
+	return ((int)done);
+}
+
+void mem_bio_free(mem_bio * b)
+{
+	if (b->buf != NULL) {
+		memset(b->buf, 0, b->size);
+		free(b->buf);
+	}
+
+	memset(b, 0, sizeof(mem_bio));
+}
+
+int mem_bio_pair_init(mem_bio_pair * pair, size_t size)
+{
+	int ret;
+
+	if ((ret = mem_bio_init(&pair->c2s, size)) != 0)
+		return (ret);
+
+	if ((ret = mem_bio_init(&pair->s2c, size)) != 0) {
+		mem_bio_free(&pair->c2s);
+		return (ret);
+	}
+
+	return (0);
+}
+
+void mem_bio_pair_set(mem_bio_pair * pair,
+		      ssl_context * cli, ssl_context * srv)
+{
+	ssl_set_bio(cli, mem_bio_recv, &pair->s2c, mem_bio_send, &pair->c2s);
+	ssl_set_sendv(cli, mem_bio_sendv);
+
+	ssl_set_bio(srv, mem_bio_recv, &pair->c2s, mem_bio_send, &pair->s2c);
+	ssl_set_sendv(srv, mem_bio_sendv);
+}
+
+void mem_bio_pair_reset(mem_bio_pair * pair)
+{
+	mem_bio_reset(&pair->c2s);
+	mem_bio_reset(&pair->s2c);
+}
+
+void mem_bio_pair_free(mem_bio_pair * pair)
+{
+	mem_bio_free(&pair->c2s);
+	mem_bio_free(&pair->s2c);
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+#if defined(TROPICSSL_SSL_CLI_C) && defined(TROPICSSL_SSL_SRV_C) && \
+    defined(TROPICSSL_CERTS) && defined(TROPICSSL_X509_PARSE)
+#include "tropicssl/certs.h"
+#define MEM_BIO_TEST_SSL
+
+/*
+ * Not a secure generator: the test only needs the handshake to run
+ */
+static int mem_bio_test_rand(void *p, uint8_t *output, size_t len)
+{
+	uint32_t *state = (uint32_t *) p;
+
+	while (len-- > 0) {
+		*state = *state * 1103515245 + 12345;
+		*output++ = (uint8_t)(*state >> 16);
+	}
+
+	return (0);
+}
+
+/*
+ * A full handshake and a record each way, without a socket
+ */
+static int mem_bio_test_ssl(void)
+{
+	int ret = 1, rc = 1, rs = 1, steps, i, j, n;
+	uint32_t seed = 1;
+	uint8_t buf[16];
+	FILE *f = NULL;
+	mem_bio_pair pair;
+	ssl_context cli, srv;
+	ssl_session cli_ssn, srv_ssn;
+	x509_cert crt;
+	rsa_context rsa;
+
+	memset(&crt, 0, sizeof(crt));
+	memset(&rsa, 0, sizeof(rsa));
+	memset(&cli_ssn, 0, sizeof(cli_ssn));
+	memset(&srv_ssn, 0, sizeof(srv_ssn));
+
+	if (mem_bio_pair_init(&pair, 4 * SSL_BUFFER_LEN) != 0)
+		return (1);
+
+	if (ssl_init(&cli) != 0) {
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (ssl_init(&srv) != 0) {
+		ssl_free(&cli);
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (x509parse_crt(&crt, (uint8_t *)test_srv_crt,
+			  strlen(test_srv_crt)) != 0 ||
+	    x509parse_key(&rsa, (uint8_t *)test_srv_key,
+			  strlen(test_srv_key), NULL, 0) != 0)
+		goto exit;
+
+	ssl_set_endpoint(&cli, SSL_IS_CLIENT);
+	ssl_set_authmode(&cli, SSL_VERIFY_NONE);
+	ssl_set_rng(&cli, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&cli, ssl_default_ciphers);
+	ssl_set_session(&cli, 0, 0, &cli_ssn);
+
+	/*
+	 * The client reads ahead, the server one record at a time
+	 */
+	if (ssl_set_read_ahead(&cli, 2 * SSL_BUFFER_LEN) != 0)
+		goto exit;
+
+	ssl_set_endpoint(&srv, SSL_IS_SERVER);
+	ssl_set_authmode(&srv, SSL_VERIFY_NONE);
+	ssl_set_rng(&srv, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&srv, ssl_default_ciphers);
+	ssl_set_session(&srv, 0, 0, &srv_ssn);
+	ssl_set_own_cert(&srv, &crt, &rsa);
+
+	mem_bio_pair_set(&pair, &cli, &srv);
+
+	for (steps = 0; (rc != 0 || rs != 0) && steps < 100; steps++) {
+		if (rc != 0)
+			rc = ssl_handshake(&cli);
+
+		if (rs != 0)
+			rs = ssl_handshake(&srv);
+
+		if ((rc != 0 && rc != TROPICSSL_ERR_NET_WANT_READ) ||
+		    (rs != 0 && rs != TROPICSSL_ERR_NET_WANT_READ))
+			goto exit;
+	}
+
+	if (rc != 0 || rs != 0 ||
+	    ssl_write(&cli, (const uint8_t *)"ping", 4) != 4 ||
+	    ssl_read(&srv, buf, sizeof(buf)) != 4 ||
+	    memcmp(buf, "ping", 4) != 0 ||
+	    ssl_write(&srv, (const uint8_t *)"pong", 4) != 4 ||
+	    ssl_read(&cli, buf, sizeof(buf)) != 4 ||
+	    memcmp(buf, "pong", 4) != 0)
+		goto exit;
+
+	/*
+	 * The key only borrowed the server's RNG for its operations
+	 */
+	if (rsa.f_rng != NULL || rsa.p_rng != NULL)
+		goto exit;
+
+#if defined(TROPICSSL_SSL_STATS)
+	/*
+	 * What one side sent, the other counted in
+	 */
+	if (cli.stats.handshakes != 1 || srv.stats.handshakes != 1 ||
+	    cli.stats.records_out != srv.stats.records_in ||
+	    cli.stats.bytes_out != srv.stats.bytes_in ||
+	    srv.stats.rsa_ops == 0)
+		goto exit;
+#endif
+
+	/*
+	 * Part of a file, read straight into the output ring: more
+	 * than one record, and a short read at the end of the file
+	 */
+	if ((f = tmpfile()) == NULL)
+		goto exit;
+
+	for (i = 0; i < 20000; i++)
+		putc(i * 7, f);
+
+	if (fflush(f) != 0 ||
+	    ssl_sendfile(&srv, fileno(f), 100, 30000) != 19900 ||
+	    ssl_check_pending(&cli) != 0)
+		goto exit;
+
+	for (i = 100; i < 20000; i += n) {
+		if ((n = ssl_read(&cli, buf, sizeof(buf))) <= 0)
+			goto exit;
+
+		/*
+		 * Both records came in with the first read
+		 */
+		if (i == 100 && cli.in_ahead == 0)
+			goto exit;
+
+		for (j = 0; j < n; j++)
+			if (buf[j] != (uint8_t)((i + j) * 7))
+				goto exit;
+	}
+
+	/*
+	 * Nothing more to read, then the server hangs up
+	 */
+	if (ssl_read(&cli, buf, sizeof(buf)) != TROPICSSL_ERR_NET_WANT_READ)
+		goto exit;
+
+	mem_bio_close(&pair.s2c);
+
+	if (ssl_read(&cli, buf, sizeof(buf)) != TROPICSSL_ERR_NET_CONN_RESET)
+		goto exit;
+
+	ret = 0;
+
+exit:
+	if (f != NULL)
+		fclose(f);
+
+	ssl_free(&cli);
+	ssl_free(&srv);
+	x509_free(&crt);
+	rsa_free(&rsa);
+	mem_bio_pair_free(&pair);
+
+	return (ret);
+}
+
+/*
+ * A record each way, the sequence numbers and IVs moving on
+ */
+static int mem_bio_test_echo(ssl_context * a, ssl_context * b)
+{
+	uint8_t buf[16];
+
+	if (ssl_write(a, (const uint8_t *)"ping", 4) != 4 ||
+	    ssl_read(b, buf, sizeof(buf)) != 4 ||
+	    memcmp(buf, "ping", 4) != 0 ||
+	    ssl_write(b, (const uint8_t *)"pong", 4) != 4 ||
+	    ssl_read(a, buf, sizeof(buf)) != 4 ||
+	    memcmp(buf, "pong", 4) != 0)
+		return (1);
+
+	return (0);
+}
+
+#if defined(TROPICSSL_ECP) && defined(TROPICSSL_GCM) && \
+    defined(TROPICSSL_AES)
+#define MEM_BIO_TEST_FALSE_START
+
+/*
+ * Whether len bytes of data went into the ring as they are
+ */
+static int mem_bio_test_seen(const mem_bio * b, const uint8_t *data,
+			     size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + len <= b->size; i++)
+		if (memcmp(b->buf + i, data, len) == 0)
+			return (1);
+
+	return (0);
+}
+
+/*
+ * False Start with an AEAD suite, the client reading before the
+ * server's ChangeCipherSpec is in and writing then: the data must
+ * still go out protected. A CBC suite must not False Start.
+ */
+static int mem_bio_test_false_start(int cipher)
+{
+	int ret = 1, rc = 1, rs = 1, steps;
+	int ciphers[2];
+	uint32_t seed = 1;
+	uint8_t buf[16];
+	const uint8_t *secret = (const uint8_t *)"TOPSECRETDATA";
+	mem_bio_pair pair;
+	ssl_context cli, srv;
+	ssl_session cli_ssn, srv_ssn;
+	x509_cert crt;
+	rsa_context rsa;
+
+	ciphers[0] = cipher;
+	ciphers[1] = 0;
+
+	memset(&crt, 0, sizeof(crt));
+	memset(&rsa, 0, sizeof(rsa));
+	memset(&cli_ssn, 0, sizeof(cli_ssn));
+	memset(&srv_ssn, 0, sizeof(srv_ssn));
+
+	if (mem_bio_pair_init(&pair, 4 * SSL_BUFFER_LEN) != 0)
+		return (1);
+
+	if (ssl_init(&cli) != 0) {
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (ssl_init(&srv) != 0) {
+		ssl_free(&cli);
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (x509parse_crt(&crt, (uint8_t *)test_srv_crt,
+			  strlen(test_srv_crt)) != 0 ||
+	    x509parse_key(&rsa, (uint8_t *)test_srv_key,
+			  strlen(test_srv_key), NULL, 0) != 0)
+		goto exit;
+
+	ssl_set_endpoint(&cli, SSL_IS_CLIENT);
+	ssl_set_authmode(&cli, SSL_VERIFY_NONE);
+	ssl_set_rng(&cli, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&cli, ciphers);
+	ssl_set_session(&cli, 0, 0, &cli_ssn);
+	ssl_set_false_start(&cli, 1);
+
+	ssl_set_endpoint(&srv, SSL_IS_SERVER);
+	ssl_set_authmode(&srv, SSL_VERIFY_NONE);
+	ssl_set_rng(&srv, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&srv, ciphers);
+	ssl_set_session(&srv, 0, 0, &srv_ssn);
+	ssl_set_own_cert(&srv, &crt, &rsa);
+
+	mem_bio_pair_set(&pair, &cli, &srv);
+
+	/*
+	 * Up to the client's Finished, the server not running after it
+	 */
+	for (steps = 0; steps < 100; steps++) {
+		if ((rc = ssl_handshake(&cli)) == 0)
+			break;
+
+		if (rc != TROPICSSL_ERR_NET_WANT_READ)
+			goto exit;
+
+		if (cli.state >= SSL_SERVER_CHANGE_CIPHER_SPEC &&
+		    pair.s2c.len == 0)
+			break;
+
+		if ((rs = ssl_handshake(&srv)) != 0 &&
+		    rs != TROPICSSL_ERR_NET_WANT_READ)
+			goto exit;
+	}
+
+	if (ssl_cipher_is_aead(cipher) == 0) {
+		/*
+		 * Still waiting for the server's Finished
+		 */
+		if (rc == 0 || cli.false_started != 0)
+			goto exit;
+
+		ret = 0;
+		goto exit;
+	}
+
+	if (rc != 0 || cli.false_started == 0 ||
+	    ssl_read(&cli, buf, sizeof(buf)) != TROPICSSL_ERR_NET_WANT_READ ||
+	    ssl_write(&cli, secret, 13) != 13 ||
+	    mem_bio_test_seen(&pair.c2s, secret, 13) != 0)
+		goto exit;
+
+	for (steps = 0; rs != 0 && steps < 100; steps++)
+		if ((rs = ssl_handshake(&srv)) != 0 &&
+		    rs != TROPICSSL_ERR_NET_WANT_READ)
+			goto exit;
+
+	if (rs != 0 || ssl_read(&srv, buf, sizeof(buf)) != 13 ||
+	    memcmp(buf, secret, 13) != 0 ||
+	    ssl_read(&cli, buf, sizeof(buf)) != TROPICSSL_ERR_NET_WANT_READ ||
+	    cli.state != SSL_HANDSHAKE_OVER ||
+	    mem_bio_test_echo(&cli, &srv) != 0)
+		goto exit;
+
+	ret = 0;
+
+exit:
+	ssl_free(&cli);
+	ssl_free(&srv);
+	x509_free(&crt);
+	rsa_free(&rsa);
+	mem_bio_pair_free(&pair);
+
+	return (ret);
+}
+#endif
+
+/*
+ * Carry the connection over to a fresh context in the same place,
+ * at another protocol version if minor_ver is not negative: both
+ * sides moved that way derive the same keys
+ */
+static int mem_bio_test_reload(ssl_context * ssl, ssl_session * ssn,
+			       uint32_t *seed, int minor_ver)
+{
+	size_t len;
+	uint8_t buf[SSL_CONTEXT_SAVE_MAX_LEN];
+
+	if (ssl_context_save(ssl, buf, sizeof(buf), &len) != 0)
+		return (1);
+
+	if (minor_ver >= 0)
+		buf[3] = (uint8_t)minor_ver;
+
+	ssl_free(ssl);
+
+	if (ssl_init(ssl) != 0) {
+		memset(ssl, 0, sizeof(ssl_context));
+		return (1);
+	}
+
+	ssl_set_rng(ssl, mem_bio_test_rand, seed);
+	ssl_set_session(ssl, 0, 0, ssn);
+
+	if (ssl_set_saveable(ssl) != 0 ||
+	    ssl_context_load(ssl, buf, len) != 0)
+		return (1);
+
+	memset(buf, 0, sizeof(buf));
+
+	return (0);
+}
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+/*
+ * DEFLATE with read-ahead: records that inflate far beyond their
+ * size on the wire, several of them read at once
+ */
+static int mem_bio_test_deflate(void)
+{
+	int ret = 1, rc = 1, rs = 1, steps, i, j, n;
+	uint32_t seed = 1;
+	uint8_t buf[4096];
+	mem_bio_pair pair;
+	ssl_context cli, srv;
+	ssl_session cli_ssn, srv_ssn;
+	x509_cert crt;
+	rsa_context rsa;
+
+	memset(&crt, 0, sizeof(crt));
+	memset(&rsa, 0, sizeof(rsa));
+	memset(&cli_ssn, 0, sizeof(cli_ssn));
+	memset(&srv_ssn, 0, sizeof(srv_ssn));
+
+	if (mem_bio_pair_init(&pair, 4 * SSL_BUFFER_LEN) != 0)
+		return (1);
+
+	if (ssl_init(&cli) != 0) {
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (ssl_init(&srv) != 0) {
+		ssl_free(&cli);
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (x509parse_crt(&crt, (uint8_t *)test_srv_crt,
+			  strlen(test_srv_crt)) != 0 ||
+	    x509parse_key(&rsa, (uint8_t *)test_srv_key,
+			  strlen(test_srv_key), NULL, 0) != 0 ||
+	    ssl_set_compression(&cli, 6) != 0 ||
+	    ssl_set_compression(&srv, 6) != 0 ||
+	    ssl_set_read_ahead(&cli, 2 * SSL_BUFFER_LEN) != 0)
+		goto exit;
+
+	ssl_set_endpoint(&cli, SSL_IS_CLIENT);
+	ssl_set_authmode(&cli, SSL_VERIFY_NONE);
+	ssl_set_rng(&cli, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&cli, ssl_default_ciphers);
+	ssl_set_session(&cli, 0, 0, &cli_ssn);
+
+	ssl_set_endpoint(&srv, SSL_IS_SERVER);
+	ssl_set_authmode(&srv, SSL_VERIFY_NONE);
+	ssl_set_rng(&srv, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&srv, ssl_default_ciphers);
+	ssl_set_session(&srv, 0, 0, &srv_ssn);
+	ssl_set_own_cert(&srv, &crt, &rsa);
+
+	mem_bio_pair_set(&pair, &cli, &srv);
+
+	for (steps = 0; (rc != 0 || rs != 0) && steps < 100; steps++) {
+		if (rc != 0)
+			rc = ssl_handshake(&cli);
+
+		if (rs != 0)
+			rs = ssl_handshake(&srv);
+
+		if ((rc != 0 && rc != TROPICSSL_ERR_NET_WANT_READ) ||
+		    (rs != 0 && rs != TROPICSSL_ERR_NET_WANT_READ))
+			goto exit;
+	}
+
+	if (rc != 0 || rs != 0 ||
+	    cli.session->compression != SSL_COMPRESS_DEFLATE)
+		goto exit;
+
+	/*
+	 * Records of a repeated pattern, a few dozen bytes each once
+	 * compressed, all in the ring before the first read
+	 */
+	for (i = 0; i < (int)sizeof(buf); i++)
+		buf[i] = (uint8_t)(i % 16);
+
+	for (i = 0; i < 3 * SSL_MAX_CONTENT_LEN; i += n) {
+		j = i % sizeof(buf);
+
+		if ((n = ssl_write(&srv, buf + j, sizeof(buf) - j)) <= 0)
+			goto exit;
+	}
+
+	for (i = 0; i < 3 * SSL_MAX_CONTENT_LEN; i += n) {
+		if ((n = ssl_read(&cli, buf, 100)) <= 0)
+			goto exit;
+
+		for (j = 0; j < n; j++)
+			if (buf[j] != (uint8_t)((i + j) % 16))
+				goto exit;
+	}
+
+	ret = 0;
+
+exit:
+	ssl_free(&cli);
+	ssl_free(&srv);
+	x509_free(&crt);
+	rsa_free(&rsa);
+	mem_bio_pair_free(&pair);
+
+	return (ret);
+}
+#endif
+
+/*
+ * ssl_context_save() and ssl_context_load() with one suite at one
+ * protocol version
+ */
+static int mem_bio_test_save(int cipher, int minor_ver)
+{
+	int ret = 1, rc = 1, rs = 1, steps;
+	int ciphers[2];
+	uint32_t seed = 1;
+	size_t len;
+	uint8_t buf[SSL_CONTEXT_SAVE_MAX_LEN];
+	mem_bio_pair pair;
+	ssl_context cli, srv, tmp;
+	ssl_session cli_ssn, srv_ssn, tmp_ssn;
+	x509_cert crt;
+	rsa_context rsa;
+
+	ciphers[0] = cipher;
+	ciphers[1] = 0;
+
+	memset(&crt, 0, sizeof(crt));
+	memset(&rsa, 0, sizeof(rsa));
+	memset(&cli_ssn, 0, sizeof(cli_ssn));
+	memset(&srv_ssn, 0, sizeof(srv_ssn));
+	memset(&tmp_ssn, 0, sizeof(tmp_ssn));
+	memset(&tmp, 0, sizeof(tmp));
+
+	if (mem_bio_pair_init(&pair, 4 * SSL_BUFFER_LEN) != 0)
+		return (1);
+
+	if (ssl_init(&cli) != 0) {
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (ssl_init(&srv) != 0) {
+		ssl_free(&cli);
+		mem_bio_pair_free(&pair);
+		return (1);
+	}
+
+	if (x509parse_crt(&crt, (uint8_t *)test_srv_crt,
+			  strlen(test_srv_crt)) != 0 ||
+	    x509parse_key(&rsa, (uint8_t *)test_srv_key,
+			  strlen(test_srv_key), NULL, 0) != 0 ||
+	    ssl_set_saveable(&cli) != 0 || ssl_set_saveable(&srv) != 0)
+		goto exit;
+
+	ssl_set_endpoint(&cli, SSL_IS_CLIENT);
+	ssl_set_authmode(&cli, SSL_VERIFY_NONE);
+	ssl_set_rng(&cli, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&cli, ciphers);
+	ssl_set_session(&cli, 0, 0, &cli_ssn);
+
+	ssl_set_endpoint(&srv, SSL_IS_SERVER);
+	ssl_set_authmode(&srv, SSL_VERIFY_NONE);
+	ssl_set_rng(&srv, mem_bio_test_rand, &seed);
+	ssl_set_ciphers(&srv, ciphers);
+	ssl_set_session(&srv, 0, 0, &srv_ssn);
+	ssl_set_own_cert(&srv, &crt, &rsa);
+
+	mem_bio_pair_set(&pair, &cli, &srv);
+
+	for (steps = 0; (rc != 0 || rs != 0) && steps < 100; steps++) {
+		if (rc != 0)
+			rc = ssl_handshake(&cli);
+
+		if (rs != 0)
+			rs = ssl_handshake(&srv);
+
+		if ((rc != 0 && rc != TROPICSSL_ERR_NET_WANT_READ) ||
+		    (rs != 0 && rs != TROPICSSL_ERR_NET_WANT_READ))
+			goto exit;
+	}
+
+	if (rc != 0 || rs != 0 || srv.session->cipher != cipher ||
+	    mem_bio_test_echo(&cli, &srv) != 0)
+		goto exit;
+
+	/*
+	 * The peers have no lower version to agree on: move both
+	 * there together
+	 */
+	if (minor_ver != srv.minor_ver) {
+		if (mem_bio_test_reload(&cli, &cli_ssn, &seed, minor_ver) != 0 ||
+		    mem_bio_test_reload(&srv, &srv_ssn, &seed, minor_ver) != 0)
+			goto exit;
+
+		mem_bio_pair_set(&pair, &cli, &srv);
+
+		if (srv.minor_ver != minor_ver ||
+		    mem_bio_test_echo(&cli, &srv) != 0)
+			goto exit;
+	}
+
+	/*
+	 * The server after traffic, carried on by a fresh context
+	 */
+	if (ssl_context_save(&srv, buf, sizeof(buf), &len) != 0 ||
+	    ssl_init(&tmp) != 0)
+		goto exit;
+
+	ssl_set_rng(&tmp, mem_bio_test_rand, &seed);
+	ssl_set_session(&tmp, 0, 0, &tmp_ssn);
+
+	if (ssl_context_load(&tmp, buf, len) != 0)
+		goto exit;
+
+	mem_bio_pair_set(&pair, &cli, &tmp);
+
+	if (mem_bio_test_echo(&cli, &tmp) != 0 ||
+	    mem_bio_test_echo(&tmp, &cli) != 0)
+		goto exit;
+
+	/*
+	 * Not loaded at a version the suite does not allow
+	 */
+	if (ssl_cipher_min_minor_ver(cipher) > SSL_MINOR_VERSION_1) {
+		ssl_free(&tmp);
+
+		if (ssl_init(&tmp) != 0) {
+			memset(&tmp, 0, sizeof(tmp));
+			goto exit;
+		}
+
+		ssl_set_rng(&tmp, mem_bio_test_rand, &seed);
+		ssl_set_session(&tmp, 0, 0, &tmp_ssn);
+		buf[3] = SSL_MINOR_VERSION_1;
+
+		if (ssl_context_load(&tmp, buf, len) !=
+		    TROPICSSL_ERR_SSL_BAD_INPUT_DATA)
+			goto exit;
+	}
+
+	ret = 0;
+
+exit:
+	memset(buf, 0, sizeof(buf));
+
+	ssl_free(&cli);
+	ssl_free(&srv);
+	ssl_free(&tmp);
+	ssl_session_free(&cli_ssn);
+	ssl_session_free(&srv_ssn);
+	ssl_session_free(&tmp_ssn);
+	x509_free(&crt);
+	rsa_free(&rsa);
+	mem_bio_pair_free(&pair);
+
+	return (ret);
+}
+
+/*
+ * CBC with the IV chained (TLS 1.0) and explicit (TLS 1.1 on),
+ * GCM and RC4
+ */
+static const int mem_bio_test_suites[][2] = {
+#if defined(TROPICSSL_AES)
+	{TLS_RSA_WITH_AES_128_CBC_SHA, SSL_MINOR_VERSION_1},
+	{TLS_RSA_WITH_AES_128_CBC_SHA, SSL_MINOR_VERSION_2},
+#if defined(TROPICSSL_SHA2)
+	{TLS_RSA_WITH_AES_128_CBC_SHA256, SSL_MINOR_VERSION_3},
+#endif
+#if defined(TROPICSSL_GCM)
+	{TLS_RSA_WITH_AES_128_GCM_SHA256, SSL_MINOR_VERSION_3},
+#endif
+#endif
+#if defined(TROPICSSL_ARC4)
+	{TLS_RSA_WITH_RC4_128_SHA, SSL_MINOR_VERSION_3},
+#endif
+	{0, 0}
+};
+#endif
+
+/*
+ * Checkup routine
+ */
+int mem_bio_self_test(int verbose)
+{
+	int i;
+	uint8_t in[32], out[32];
+	const uint8_t *rp;
+	uint8_t *wp;
+	net_iovec iov[3];
+	mem_bio b;
+
+	for (i = 0; i < 32; i++)
+		in[i] = (uint8_t)i;
+
+	if (verbose != 0)
+		printf("  MEM BIO ring test: ");
+
+	if (mem_bio_init(&b, 16) != 0)
+		goto fail;
+
+	/*
+	 * 10 in, 6 out, 10 more in across the end of the storage
+	 */
+	if (mem_bio_recv(&b, out, 4) != TROPICSSL_ERR_NET_TRY_AGAIN ||
+	    mem_bio_send(&b, in, 10) != 10 ||
+	    mem_bio_recv(&b, out, 6) != 6 || memcmp(out, in, 6) != 0 ||
+	    mem_bio_send(&b, in + 10, 10) != 10 ||
+	    mem_bio_pending(&b) != 14 || mem_bio_space(&b) != 2 ||
+	    mem_bio_peek(&b, &rp) != 10 || rp != b.buf + 6 ||
+	    mem_bio_reserve(&b, &wp) != 2 || wp != b.buf + 4 ||
+	    mem_bio_send(&b, in + 20, 4) != 2 ||
+	    mem_bio_send(&b, in, 1) != TROPICSSL_ERR_NET_TRY_AGAIN ||
+	    mem_bio_recv(&b, out, 32) != 16 || memcmp(out, in + 6, 16) != 0)
+		goto fail;
+
+	/*
+	 * Empty again: rewound, and a vectored write fills what it can
+	 */
+	iov[0].base = in;
+	iov[0].len = 5;
+	iov[1].base = in + 5;
+	iov[1].len = 0;
+	iov[2].base = in + 5;
+	iov[2].len = 20;
+
+	if (b.head != 0 || mem_bio_sendv(&b, iov, 3) != 16 ||
+	    mem_bio_sendv(&b, iov, 3) != TROPICSSL_ERR_NET_TRY_AGAIN)
+		goto fail;
+
+	mem_bio_consume(&b, 12);
+	mem_bio_close(&b);
+
+	if (mem_bio_send(&b, in, 1) != TROPICSSL_ERR_NET_CONN_RESET ||
+	    mem_bio_recv(&b, out, 32) != 4 || memcmp(out, in + 12, 4) != 0 ||
+	    mem_bio_recv(&b, out, 32) != TROPICSSL_ERR_NET_CONN_RESET)
+		goto fail;
+
+	mem_bio_free(&b);
+
+	if (verbose != 0)
+		printf("passed\n");
+
+#if defined(MEM_BIO_TEST_SSL)
+	if (verbose != 0)
+		printf("  MEM BIO handshake test: ");
+
+	if (mem_bio_test_ssl() != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+	if (verbose != 0)
+		printf("  MEM BIO DEFLATE read-ahead test: ");
+
+	if (mem_bio_test_deflate() != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+#endif
+
+#if defined(MEM_BIO_TEST_FALSE_START)
+	if (verbose != 0)
+		printf("  MEM BIO False Start test: ");
+
+	if (mem_bio_test_false_start(TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256)
+	    != 0 ||
+	    mem_bio_test_false_start(TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n");
+#endif
+
+	for (i = 0; mem_bio_test_suites[i][0] != 0; i++) {
+		if (verbose != 0)
+			printf("  MEM BIO save/load test #%d: ", i + 1);
+
+		if (mem_bio_test_save(mem_bio_test_suites[i][0],
+				      mem_bio_test_suites[i][1]) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+
+		if (verbose != 0)
+			printf("passed\n");
+	}
+#endif
+
+	if (verbose != 0)
+		printf("\n");
+
+	return (0);
+
+fail:
+	mem_bio_free(&b);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ *  Allocator hook and arena allocator
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_MEMORY)
+
+#include "tropicssl/memory.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#if defined(_MSC_VER)
+#define MEMORY_THREAD __declspec(thread)
+#elif defined(__GNUC__)
+#define MEMORY_THREAD __thread
+#else
+#define MEMORY_THREAD		/* one allocator for the whole process */
+#endif
+
+/*
+ * Blocks and chunks start with a header; 16 bytes keep what follows
+ * aligned for any type
+ */
+#define MEMORY_ALIGN            16
+#define MEMORY_ROUND(n) (((n) + MEMORY_ALIGN - 1) & ~(size_t)(MEMORY_ALIGN - 1))
+
+typedef union {
+	struct {
+		void (*f_free) (void *, void *);
+		void *p_alloc;
+	} a;
+	uint8_t pad[MEMORY_ALIGN];
+} memory_header;
+
+struct _memory_chunk {
+	memory_chunk *next;
+	size_t len;
+};
+
+#define MEMORY_CHUNK_HDR MEMORY_ROUND(sizeof(memory_chunk))
+#define MEMORY_CHUNK_DATA(c) ((uint8_t *) (c) + MEMORY_CHUNK_HDR)
+
+static MEMORY_THREAD void *(*memory_f_alloc) (void *, size_t);
+static MEMORY_THREAD void (*memory_f_free) (void *, void *);
+static MEMORY_THREAD void *memory_p_alloc;
+
+/*
+ * Thread allocator
+ */
+void *memory_alloc(size_t len)
+{
+	memory_header *h;
+
+	if (len > (size_t)-1 - sizeof(memory_header))
+		return (NULL);
+
+	len += sizeof(memory_header);
+
+	if (memory_f_alloc == NULL) {
+		if ((h = (memory_header *) malloc(len)) == NULL)
+			return (NULL);
+
+		h->a.f_free = NULL;
+		h->a.p_alloc = NULL;
+	} else {
+		if ((h = (memory_header *) memory_f_alloc(memory_p_alloc,
+							    len)) == NULL)
+			return (NULL);
+
+		h->a.f_free = memory_f_free;
+		h->a.p_alloc = memory_p_alloc;
+	}
+
+	return (h + 1);
+}
+
+void memory_free(void *ptr)
+{
+	memory_header *h;
+
+	if (ptr == NULL)
+		return;
+
+	h = (memory_header *) ptr - 1;
+
+	if (h->a.f_free == NULL)
+		free(h);
+	else
+		h->a.f_free(h->a.p_alloc, h);
+}
+
+void memory_set_alloc(void *(*f_alloc) (void *, size_t),
+		      void (*f_free) (void *, void *), void *p_alloc)
+{
+	memory_f_alloc = f_alloc;
+	memory_f_free = f_free;
+	memory_p_alloc = p_alloc;
+}
+
+void memory_get_alloc(void *(**f_alloc) (void *, size_t),
+		      void (**f_free) (void *, void *), void **p_alloc)
+{
+	*f_alloc = memory_f_alloc;
+	*f_free = memory_f_free;
+	*p_alloc = memory_p_alloc;
+}
+
+/*
+ * Arena allocator: blocks are carved from chunks, and only the
+ * chunks go back to the heap
+ */
+void memory_arena_init(memory_arena * arena, size_t chunk_len)
+{
+	memset(arena, 0, sizeof(memory_arena));
+
+	arena->chunk_len = MEMORY_ROUND(chunk_len != 0 ?
+					chunk_len : MEMORY_ARENA_CHUNK);
+}
+
+static memory_chunk *memory_chunk_new(memory_arena * arena, size_t len)
+{
+	memory_chunk *c;
+
+	if (len == arena->chunk_len && arena->spare != NULL) {
+		c = arena->spare;
+		arena->spare = c->next;
+		return (c);
+	}
+
+	if ((c = (memory_chunk *) malloc(MEMORY_CHUNK_HDR + len)) == NULL)
+		return (NULL);
+
+	c->len = len;
+
+	return (c);
+}
+
+static void *memory_arena_alloc(void *p, size_t len)
+{
+	memory_arena *arena = (memory_arena *) p;
+	memory_chunk *c;
+	uint8_t *ptr;
+
+	len = MEMORY_ROUND(len);
+
+	if (len > arena->chunk_len) {
+		/*
+		 * Large blocks get a chunk of their own, behind the current
+		 * one so its free space is not lost
+		 */
+		if ((c = memory_chunk_new(arena, len)) == NULL)
+			return (NULL);
+
+		if (arena->chunks == NULL) {
+			c->next = NULL;
+			arena->chunks = c;
+			arena->left = 0;
+		} else {
+			c->next = arena->chunks->next;
+			arena->chunks->next = c;
+		}
+
+		return (MEMORY_CHUNK_DATA(c));
+	}
+
+	if (len > arena->left) {
+		if ((c = memory_chunk_new(arena, arena->chunk_len)) == NULL)
+			return (NULL);
+
+		c->next = arena->chunks;
+		arena->chunks = c;
+		arena->left = c->len;
+	}
+
+	c = arena->chunks;
+	ptr = MEMORY_CHUNK_DATA(c) + c->len - arena->left;
+	arena->left -= len;
+
+	return (ptr);
+}
+
+static void memory_arena_nofree(void *p, void *ptr)
+{
+	(void)p;
+	(void)ptr;
+}
+
+void memory_set_arena(memory_arena * arena)
+{
+	if (arena == NULL)
+		memory_set_alloc(NULL, NULL, NULL);
+	else
+		memory_set_alloc(memory_arena_alloc, memory_arena_nofree, arena);
+}
+
+void memory_arena_reset(memory_arena * arena)
+{
+	memory_chunk *c;
+
+	while ((c = arena->chunks) != NULL) {
+		arena->chunks = c->next;
+
+		memset(MEMORY_CHUNK_DATA(c), 0, c->len);
+
+		if (c->len == arena->chunk_len) {
+			c->next = arena->spare;
+			arena->spare = c;
+		} else
+			free(c);
+	}
+
+	arena->left = 0;
+}
+
+void memory_arena_free(memory_arena * arena)
+{
+	memory_chunk *c;
+
+	memory_arena_reset(arena);
+
+	while ((c = arena->spare) != NULL) {
+		arena->spare = c->next;
+		free(c);
+	}
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+static int memory_test_count;
+
+static void *memory_test_alloc(void *p, size_t len)
+{
+	(void)p;
+	memory_test_count++;
+	return (malloc(len));
+}
+
+static void memory_test_free(void *p, void *ptr)
+{
+	(void)p;
+	memory_test_count--;
+	free(ptr);
+}
+
+/*
+ * Checkup routine
+ */
+int memory_self_test(int verbose)
+{
+	int i;
+	uint8_t *b[64], *big, *heap;
+	memory_chunk *first;
+	memory_arena arena;
+
+	if (verbose != 0)
+		printf("  MEMORY arena test: ");
+
+	memory_arena_init(&arena, 512);
+	memory_set_arena(&arena);
+
+	for (i = 0; i < 64; i++) {
+		if ((b[i] = (uint8_t *)memory_alloc(i + 1)) == NULL ||
+		    ((uintptr_t) b[i] % MEMORY_ALIGN) != 0)
+			goto fail;
+
+		memset(b[i], i, i + 1);
+	}
+
+	big = (uint8_t *)memory_alloc(4000);
+	memory_set_arena(NULL);
+
+	/*
+	 * Arena blocks are still freed correctly after switching back
+	 */
+	heap = (uint8_t *)memory_alloc(100);
+
+	if (big == NULL || heap == NULL)
+		goto fail;
+
+	memset(big, 0xFF, 4000);
+
+	for (i = 0; i < 64; i++) {
+		if (b[i][0] != i || b[i][i] != i)
+			goto fail;
+
+		memory_free(b[i]);
+	}
+
+	memory_free(big);
+	memory_free(heap);
+
+	memory_arena_reset(&arena);
+
+	if (arena.chunks != NULL || (first = arena.spare) == NULL)
+		goto fail;
+
+	/*
+	 * Regular chunks are reused after a reset
+	 */
+	memory_set_arena(&arena);
+	b[0] = (uint8_t *)memory_alloc(1);
+	memory_set_arena(NULL);
+
+	if (b[0] == NULL || arena.chunks != first)
+		goto fail;
+
+	memory_arena_free(&arena);
+
+	if (arena.chunks != NULL || arena.spare != NULL)
+		goto fail;
+
+	if (verbose != 0)
+		printf("passed\n  MEMORY hook test: ");
+
+	memory_set_alloc(memory_test_alloc, memory_test_free, NULL);
+	b[0] = (uint8_t *)memory_alloc(10);
+	b[1] = (uint8_t *)memory_alloc(20);
+	memory_set_alloc(NULL, NULL, NULL);
+
+	if (b[0] == NULL || b[1] == NULL || memory_test_count != 2)
+		goto fail;
+
+	memory_free(b[0]);
+	memory_free(b[1]);
+
+	if (memory_test_count != 0)
+		goto fail;
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	memory_set_alloc(NULL, NULL, NULL);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
@@ -43,6 +43,7 @@
 #if defined(WIN32) || defined(_WIN32_WCE)
 
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 
 #if defined(_WIN32_WCE)
@@ -62,13 +63,33 @@ static int wsa_init_done = 0;
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <errno.h>
+#include <poll.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <linux/tls.h>
+
+#if defined(TLS_TX) && defined(TLS_RX) && defined(TLS_CIPHER_AES_GCM_256)
+#define NET_HAVE_KTLS
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP         31
+#endif
+
+#ifndef SOL_TLS
+#define SOL_TLS         282
+#endif
+#endif
 
 #endif
 
@@ -87,13 +108,10 @@ static int wsa_init_done = 0;
 #endif
 #define net_htons(n) HTONS(n)
 /*
- * Initiate a TCP connection with host:port
+ * Socket layer setup, once
  */
-int net_connect(int *fd, const char *host, int port)
+static int net_prepare(void)
 {
-	struct sockaddr_in server_addr;
-	struct hostent *server_host;
-
 #if defined(WIN32) || defined(_WIN32_WCE)
 	WSADATA wsaData;
 
@@ -107,54 +125,378 @@ int net_connect(int *fd, const char *host, int port)
 	signal(SIGPIPE, SIG_IGN);
 #endif
 
-	if ((server_host = gethostbyname(host)) == NULL)
-		return (TROPICSSL_ERR_NET_UNKNOWN_HOST);
+	return (0);
+}
 
-	if ((*fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP)) < 0)
+/*
+ * Milliseconds from some fixed point, for the connect timers
+ */
+static unsigned long net_msec(void)
+{
+#if defined(WIN32) || defined(_WIN32_WCE)
+	return ((unsigned long)GetTickCount());
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return ((unsigned long)tv.tv_sec * 1000 +
+		(unsigned long)tv.tv_usec / 1000);
+#endif
+}
+
+/*
+ * Look up host:port. The families alternate, starting with the one
+ * getaddrinfo() put first (RFC 8305, section 4), so that a broken
+ * IPv6 (or IPv4) path costs one attempt and not all of them.
+ */
+int net_resolve(net_addrs * addrs, const char *host, int port)
+{
+	int i, j, first;
+	char serv[16];
+	struct addrinfo hints, *res, *ai;
+	net_addrs found;
+
+	if (net_prepare() != 0)
 		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
 
-	memcpy((void *)&server_addr.sin_addr,
-	       (void *)server_host->h_addr, server_host->h_length);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+#if defined(AI_ADDRCONFIG)
+	hints.ai_flags = AI_ADDRCONFIG;
+#endif
 
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = net_htons(port);
+	sprintf(serv, "%d", port & 0xFFFF);
 
-	if (connect(*fd, (struct sockaddr *)&server_addr,
-		    sizeof(server_addr)) < 0) {
-		close(*fd);
-		return (TROPICSSL_ERR_NET_CONNECT_FAILED);
+	if (getaddrinfo(host, serv, &hints, &res) != 0)
+		return (TROPICSSL_ERR_NET_UNKNOWN_HOST);
+
+	found.count = 0;
+
+	for (ai = res; ai != NULL && found.count < NET_ADDRS_MAX;
+	     ai = ai->ai_next) {
+		if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6) ||
+		    ai->ai_addrlen > sizeof(found.addr[0].sa))
+			continue;
+
+		i = found.count++;
+		found.addr[i].family = ai->ai_family;
+		found.addr[i].len = (int)ai->ai_addrlen;
+		memcpy(found.addr[i].sa, ai->ai_addr, ai->ai_addrlen);
+	}
+
+	freeaddrinfo(res);
+
+	if (found.count == 0)
+		return (TROPICSSL_ERR_NET_UNKNOWN_HOST);
+
+	memset(addrs, 0, sizeof(net_addrs));
+	first = found.addr[0].family;
+
+	for (i = j = 0; addrs->count < found.count;) {
+		while (i < found.count && found.addr[i].family != first)
+			i++;
+
+		if (i < found.count)
+			addrs->addr[addrs->count++] = found.addr[i++];
+
+		while (j < found.count && found.addr[j].family == first)
+			j++;
+
+		if (j < found.count)
+			addrs->addr[addrs->count++] = found.addr[j++];
 	}
 
 	return (0);
 }
 
 /*
- * Create a listening socket on bind_ip:port
+ * Check if a non-blocking connect() is under way
  */
-int net_bind(int *fd, const char *bind_ip, int port)
+static int net_in_progress(void)
 {
-	int n, c[4];
-	struct sockaddr_in server_addr;
+#if defined(WIN32) || defined(_WIN32_WCE)
+	return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+	return (errno == EINPROGRESS || errno == EINTR);
+#endif
+}
+
+/*
+ * Start a connection to one of the addresses
+ */
+int net_connect_start(int *fd, const net_addrs * addrs, int index,
+		      int flags)
+{
+	if (index < 0 || index >= addrs->count)
+		return (TROPICSSL_ERR_NET_CONNECT_FAILED);
+
+	if (net_prepare() != 0)
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+
+	if ((*fd = socket(addrs->addr[index].family, SOCK_STREAM,
+			  IPPROTO_TCP)) < 0)
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+
+	if (net_set_nonblock(*fd) != 0) {
+		close(*fd);
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+	}
+
+	if ((flags & NET_CONNECT_NODELAY) != 0)
+		net_set_nodelay(*fd, 1);
+
+#if defined(TCP_FASTOPEN_CONNECT)
+	if ((flags & NET_CONNECT_FASTOPEN) != 0) {
+		int n = 1;
+
+		setsockopt(*fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+			   (const char *)&n, sizeof(n));
+	}
+#endif
+
+	if (connect(*fd, (const struct sockaddr *)addrs->addr[index].sa,
+		    addrs->addr[index].len) == 0)
+		return (0);
+
+	if (net_in_progress() != 0)
+		return (TROPICSSL_ERR_NET_WANT_WRITE);
+
+	close(*fd);
+	return (TROPICSSL_ERR_NET_CONNECT_FAILED);
+}
+
+/*
+ * A pending connection is made once it has a peer, failed once it
+ * has an error
+ */
+int net_connect_finish(int fd)
+{
+	int err = 0;
+	uint32_t peer[8];
+
+#if defined(__socklen_t_defined)
+	socklen_t n = (socklen_t) sizeof(err);
+#else
+	int n = (int)sizeof(err);
+#endif
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *)&err, &n) != 0 ||
+	    err != 0)
+		return (TROPICSSL_ERR_NET_CONNECT_FAILED);
+
+	n = sizeof(peer);
+
+	if (getpeername(fd, (struct sockaddr *)peer, &n) == 0)
+		return (0);
 
 #if defined(WIN32) || defined(_WIN32_WCE)
-	WSADATA wsaData;
+	if (WSAGetLastError() == WSAENOTCONN)
+#else
+	if (errno == ENOTCONN)
+#endif
+		return (TROPICSSL_ERR_NET_WANT_WRITE);
 
-	if (wsa_init_done == 0) {
-		if (WSAStartup(MAKEWORD(2, 0), &wsaData) == SOCKET_ERROR)
-			return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+	return (TROPICSSL_ERR_NET_CONNECT_FAILED);
+}
 
-		wsa_init_done = 1;
+/*
+ * Wait up to 'ms' milliseconds (forever if negative) for one of the
+ * pending connections to be made or to fail; its index, or -1
+ */
+static int net_wait_connect(const int *socks, int n, long ms)
+{
+	int i;
+#if defined(WIN32) || defined(_WIN32_WCE)
+	fd_set w, e;
+	struct timeval tv;
+
+	FD_ZERO(&w);
+	FD_ZERO(&e);
+
+	for (i = 0; i < n; i++) {
+		FD_SET(socks[i], &w);
+		FD_SET(socks[i], &e);
 	}
+
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+
+	if (select(0, NULL, &w, &e, (ms < 0) ? NULL : &tv) <= 0)
+		return (-1);
+
+	for (i = 0; i < n; i++)
+		if (FD_ISSET(socks[i], &w) || FD_ISSET(socks[i], &e))
+			return (i);
 #else
-	signal(SIGPIPE, SIG_IGN);
+	struct pollfd p[NET_ADDRS_MAX];
+
+	for (i = 0; i < n; i++) {
+		p[i].fd = socks[i];
+		p[i].events = POLLOUT;
+		p[i].revents = 0;
+	}
+
+	if (poll(p, n, (ms < 0) ? -1 : (int)ms) <= 0)
+		return (-1);
+
+	for (i = 0; i < n; i++)
+		if (p[i].revents != 0)
+			return (i);
 #endif
 
+	return (-1);
+}
+
+/*
+ * Happy eyeballs: each address has NET_CONNECT_DELAY ms to itself,
+ * then the next one is started alongside; the first connection made
+ * wins and the others are dropped. A failure starts the next address
+ * at once.
+ */
+int net_connect_addrs(int *fd, const net_addrs * addrs, int flags,
+		      int timeout, int *index)
+{
+	int i, ret, next = 0, live = 0, won = -1;
+	int err = TROPICSSL_ERR_NET_CONNECT_FAILED;
+	int socks[NET_ADDRS_MAX], which[NET_ADDRS_MAX];
+	unsigned long start = net_msec(), now, last = 0, elapsed;
+	long wait;
+
+	for (;;) {
+		now = net_msec();
+		elapsed = now - start;
+
+		if (timeout > 0 && elapsed >= (unsigned long)timeout) {
+			ret = TROPICSSL_ERR_NET_CONNECT_TIMEOUT;
+			break;
+		}
+
+		if (next < addrs->count &&
+		    (live == 0 || now - last >= NET_CONNECT_DELAY)) {
+			last = now;
+			which[live] = next;
+			ret = net_connect_start(&socks[live], addrs, next++,
+						flags);
+
+			if (ret == 0) {
+				won = live++;
+				break;
+			}
+
+			if (ret == TROPICSSL_ERR_NET_WANT_WRITE)
+				live++;
+			else
+				err = ret;
+
+			continue;
+		}
+
+		if (live == 0) {
+			ret = err;
+			break;
+		}
+
+		wait = -1;
+
+		if (next < addrs->count)
+			wait = NET_CONNECT_DELAY - (long)(now - last);
+
+		if (timeout > 0 &&
+		    (wait < 0 || wait > timeout - (long)elapsed))
+			wait = timeout - (long)elapsed;
+
+		if ((i = net_wait_connect(socks, live, wait)) < 0)
+			continue;
+
+		if ((ret = net_connect_finish(socks[i])) == 0) {
+			won = i;
+			break;
+		}
+
+		if (ret == TROPICSSL_ERR_NET_WANT_WRITE)
+			continue;
+
+		close(socks[i]);
+		err = ret;
+
+		live--;
+		socks[i] = socks[live];
+		which[i] = which[live];
+	}
+
+	for (i = 0; i < live; i++)
+		if (i != won)
+			close(socks[i]);
+
+	if (won < 0)
+		return (ret);
+
+	*fd = socks[won];
+
+	if (index != NULL)
+		*index = which[won];
+
+	if (net_set_block(*fd) != 0) {
+		close(*fd);
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+	}
+
+	return (0);
+}
+
+/*
+ * Initiate a TCP connection with host:port
+ */
+int net_connect_timeout(int *fd, const char *host, int port, int timeout)
+{
+	int ret;
+	net_addrs addrs;
+
+	if ((ret = net_resolve(&addrs, host, port)) != 0)
+		return (ret);
+
+	return (net_connect_addrs(fd, &addrs, 0, timeout, NULL));
+}
+
+int net_connect(int *fd, const char *host, int port)
+{
+	return (net_connect_timeout(fd, host, port, 0));
+}
+
+/*
+ * Create a listening socket on bind_ip:port, SO_REUSEPORT-shared
+ * with others if reuse is set
+ */
+static int net_bind_socket(int *fd, const char *bind_ip, int port, int reuse)
+{
+	int n, c[4];
+	struct sockaddr_in server_addr;
+
+	if (net_prepare() != 0)
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+
 	if ((*fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP)) < 0)
 		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
 
 	n = 1;
 	setsockopt(*fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&n, sizeof(n));
 
+	if (reuse != 0) {
+#if defined(SO_REUSEPORT)
+		if (setsockopt(*fd, SOL_SOCKET, SO_REUSEPORT,
+			       (const char *)&n, sizeof(n)) != 0) {
+			close(*fd);
+			return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+		}
+#else
+		close(*fd);
+		return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+#endif
+	}
+
 	server_addr.sin_addr.s_addr = INADDR_ANY;
 	server_addr.sin_family = AF_INET;
 	server_addr.sin_port = net_htons(port);
@@ -179,7 +521,7 @@ int net_bind(int *fd, const char *bind_ip, int port)
 		return (TROPICSSL_ERR_NET_BIND_FAILED);
 	}
 
-	if (listen(*fd, 10) != 0) {
+	if (listen(*fd, (reuse != 0) ? SOMAXCONN : 10) != 0) {
 		close(*fd);
 		return (TROPICSSL_ERR_NET_LISTEN_FAILED);
 	}
@@ -187,6 +529,23 @@ int net_bind(int *fd, const char *bind_ip, int port)
 	return (0);
 }
 
+/*
+ * Create a listening socket on bind_ip:port
+ */
+int net_bind(int *fd, const char *bind_ip, int port)
+{
+	return (net_bind_socket(fd, bind_ip, port, 0));
+}
+
+/*
+ * Create one of several listening sockets on bind_ip:port; the
+ * kernel spreads the incoming connections over them
+ */
+int net_bind_reuseport(int *fd, const char *bind_ip, int port)
+{
+	return (net_bind_socket(fd, bind_ip, port, 1));
+}
+
 /*
  * Check if the current operation is blocking
  */
@@ -261,6 +620,48 @@ int net_set_nonblock(int fd)
 #endif
 }
 
+/*
+ * Socket tuning
+ */
+int net_set_nodelay(int fd, int on)
+{
+	int n = (on != 0);
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+		       (const char *)&n, sizeof(n)) != 0)
+		return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+
+	return (0);
+}
+
+int net_set_fastopen(int fd, int qlen)
+{
+#if defined(TCP_FASTOPEN)
+	if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+		       (const char *)&qlen, sizeof(qlen)) == 0)
+		return (0);
+#endif
+
+	return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+}
+
+int net_set_bufsize(int fd, int sndbuf, int rcvbuf)
+{
+	int ret = 0;
+
+	if (sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+				     (const char *)&sndbuf,
+				     sizeof(sndbuf)) != 0)
+		ret = TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE;
+
+	if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+				     (const char *)&rcvbuf,
+				     sizeof(rcvbuf)) != 0)
+		ret = TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE;
+
+	return (ret);
+}
+
 /*
  * Portable usleep helper
  */
@@ -275,6 +676,25 @@ void net_usleep(unsigned long usec)
 /*
  * Read at most 'len' characters
  */
+static int net_recv_error(void)
+{
+	if (net_is_blocking() != 0)
+		return (TROPICSSL_ERR_NET_TRY_AGAIN);
+
+#if defined(WIN32) || defined(_WIN32_WCE)
+	if (WSAGetLastError() == WSAECONNRESET)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
+#else
+	if (errno == EPIPE || errno == ECONNRESET)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
+
+	if (errno == EINTR)
+		return (TROPICSSL_ERR_NET_TRY_AGAIN);
+#endif
+
+	return (TROPICSSL_ERR_NET_RECV_FAILED);
+}
+
 int net_recv(void *ctx, uint8_t *buf, size_t len)
 {
 	int ret = read(*((int *)ctx), buf, len);
@@ -282,54 +702,241 @@ int net_recv(void *ctx, uint8_t *buf, size_t len)
 	if (len > 0 && ret == 0)
 		return (TROPICSSL_ERR_NET_CONN_RESET);
 
-	if (ret < 0) {
-		if (net_is_blocking() != 0)
-			return (TROPICSSL_ERR_NET_TRY_AGAIN);
+	if (ret < 0)
+		return (net_recv_error());
+
+	return (ret);
+}
+
+/*
+ * Write at most 'len' characters
+ */
+/*
+ * Map a failed write() to an error code
+ */
+static int net_send_error(void)
+{
+	if (net_is_blocking() != 0)
+		return (TROPICSSL_ERR_NET_TRY_AGAIN);
 
 #if defined(WIN32) || defined(_WIN32_WCE)
-		if (WSAGetLastError() == WSAECONNRESET)
-			return (TROPICSSL_ERR_NET_CONN_RESET);
+	if (WSAGetLastError() == WSAECONNRESET)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
 #else
-		if (errno == EPIPE || errno == ECONNRESET)
-			return (TROPICSSL_ERR_NET_CONN_RESET);
+	if (errno == EPIPE || errno == ECONNRESET)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
 
-		if (errno == EINTR)
-			return (TROPICSSL_ERR_NET_TRY_AGAIN);
+	if (errno == EINTR)
+		return (TROPICSSL_ERR_NET_TRY_AGAIN);
 #endif
 
-		return (TROPICSSL_ERR_NET_RECV_FAILED);
-	}
+	return (TROPICSSL_ERR_NET_SEND_FAILED);
+}
+
+int net_send(void *ctx, uint8_t *buf, size_t len)
+{
+	int ret = write(*((int *)ctx), buf, len);
+
+	if (ret < 0)
+		return (net_send_error());
 
 	return (ret);
 }
 
 /*
- * Write at most 'len' characters
+ * Write a list of buffers at once
  */
-int net_send(void *ctx, uint8_t *buf, size_t len)
+#define NET_IOV_MAX     16
+
+int net_sendv(void *ctx, const net_iovec * iov, int iovcnt)
 {
-	int ret = write(*((int *)ctx), buf, len);
+#if defined(WIN32) || defined(_WIN32_WCE)
+	/*
+	 * No writev(): send the first buffer, the caller comes back
+	 * for the rest
+	 */
+	int ret;
 
-	if (ret < 0) {
-		if (net_is_blocking() != 0)
-			return (TROPICSSL_ERR_NET_TRY_AGAIN);
+	if (iovcnt < 1)
+		return (0);
 
-#if defined(WIN32) || defined(_WIN32_WCE)
-		if (WSAGetLastError() == WSAECONNRESET)
-			return (TROPICSSL_ERR_NET_CONN_RESET);
+	ret = write(*((int *)ctx), (const char *)iov[0].base, iov[0].len);
 #else
-		if (errno == EPIPE || errno == ECONNRESET)
-			return (TROPICSSL_ERR_NET_CONN_RESET);
+	struct iovec v[NET_IOV_MAX];
+	int i, ret;
 
-		if (errno == EINTR)
-			return (TROPICSSL_ERR_NET_TRY_AGAIN);
+	if (iovcnt > NET_IOV_MAX)
+		iovcnt = NET_IOV_MAX;
+
+	for (i = 0; i < iovcnt; i++) {
+		v[i].iov_base = (void *)iov[i].base;
+		v[i].iov_len = iov[i].len;
+	}
+
+	ret = writev(*((int *)ctx), v, iovcnt);
 #endif
 
-		return (TROPICSSL_ERR_NET_SEND_FAILED);
+	if (ret < 0)
+		return (net_send_error());
+
+	return (ret);
+}
+
+/*
+ * Send file data without it entering userspace
+ */
+int net_sendfile(int sock, int fd, uint64_t offset, size_t len)
+{
+#if defined(__linux__)
+	off_t off = (off_t)offset;
+	ssize_t ret = sendfile(sock, fd, &off, len);
+
+	if (ret < 0)
+		return (net_send_error());
+
+	return ((int)ret);
+#else
+	return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+#endif
+}
+
+#if defined(NET_HAVE_KTLS)
+/*
+ * Linux kernel TLS: TLS 1.2 AES-GCM only. The kernel counts the
+ * explicit nonce up from the one given, like the sequence number;
+ * they start equal, as the library uses the latter for the former.
+ */
+int net_set_ktls(int fd, int dir, const uint8_t *key, size_t keylen,
+		 const uint8_t salt[4], const uint8_t seq[8])
+{
+	int ret;
+	union {
+		struct tls12_crypto_info_aes_gcm_128 gcm128;
+		struct tls12_crypto_info_aes_gcm_256 gcm256;
+	} info;
+	socklen_t len;
+
+	memset(&info, 0, sizeof(info));
+
+	if (keylen == 16) {
+		info.gcm128.info.version = TLS_1_2_VERSION;
+		info.gcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		memcpy(info.gcm128.key, key, 16);
+		memcpy(info.gcm128.salt, salt, 4);
+		memcpy(info.gcm128.iv, seq, 8);
+		memcpy(info.gcm128.rec_seq, seq, 8);
+		len = sizeof(info.gcm128);
+	} else if (keylen == 32) {
+		info.gcm256.info.version = TLS_1_2_VERSION;
+		info.gcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		memcpy(info.gcm256.key, key, 32);
+		memcpy(info.gcm256.salt, salt, 4);
+		memcpy(info.gcm256.iv, seq, 8);
+		memcpy(info.gcm256.rec_seq, seq, 8);
+		len = sizeof(info.gcm256);
+	} else
+		return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+
+	/*
+	 * The upper layer is attached once, for both directions
+	 */
+	if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0 &&
+	    errno != EEXIST) {
+		memset(&info, 0, sizeof(info));
+		return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
 	}
 
+	ret = setsockopt(fd, SOL_TLS, (dir == NET_KTLS_TX) ? TLS_TX : TLS_RX,
+			 &info, len);
+
+	memset(&info, 0, sizeof(info));
+
+	return ((ret == 0) ? 0 : TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+}
+
+int net_send_record(int fd, int type, const uint8_t *buf, size_t len)
+{
+	int ret;
+	struct msghdr msg;
+	struct iovec v;
+	struct cmsghdr *cmsg;
+	uint8_t cbuf[CMSG_SPACE(1)];
+
+	v.iov_base = (void *)buf;
+	v.iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &v;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(1);
+	*CMSG_DATA(cmsg) = (uint8_t)type;
+
+	if ((ret = sendmsg(fd, &msg, 0)) < 0)
+		return (net_send_error());
+
+	return (ret);
+}
+
+int net_recv_record(int fd, int *type, uint8_t *buf, size_t len)
+{
+	int ret;
+	struct msghdr msg;
+	struct iovec v;
+	struct cmsghdr *cmsg;
+	uint8_t cbuf[CMSG_SPACE(1)];
+
+	v.iov_base = buf;
+	v.iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &v;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	ret = recvmsg(fd, &msg, 0);
+
+	if (len > 0 && ret == 0)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
+
+	if (ret < 0)
+		return (net_recv_error());
+
+	/*
+	 * No record type comes with application data
+	 */
+	*type = 23;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_TLS &&
+	    cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+		*type = *CMSG_DATA(cmsg);
+
 	return (ret);
 }
+#else
+int net_set_ktls(int fd, int dir, const uint8_t *key, size_t keylen,
+		 const uint8_t salt[4], const uint8_t seq[8])
+{
+	return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+}
+
+int net_send_record(int fd, int type, const uint8_t *buf, size_t len)
+{
+	return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+}
+
+int net_recv_record(int fd, int *type, uint8_t *buf, size_t len)
+{
+	return (TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE);
+}
+#endif
 
 /*
  * Gracefully close the connection
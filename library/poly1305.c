@@ -0,0 +1,680 @@
+/*
+ *  Poly1305 message authentication code
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  Poly1305 was designed by D. J. Bernstein; the one-time key form
+ *  used with ChaCha20 is specified in RFC 7539.
+ *
+ *  http://cr.yp.to/mac/poly1305-20050329.pdf
+ *  http://tools.ietf.org/html/rfc7539
+ *
+ *  The accumulator is kept in five 26-bit limbs, so that every
+ *  product fits 32x32->64 multiplies. The vector code runs two
+ *  interleaved accumulators, for the even and the odd blocks, each
+ *  multiplied by r^2; they are joined with r^2 and r at the end.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_POLY1305)
+
+#include "tropicssl/poly1305.h"
+
+#include <string.h>
+
+#if defined(TROPICSSL_HAVE_X86_64)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define TROPICSSL_POLY1305_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * 32-bit integer manipulation macros (little endian)
+ */
+#ifndef GET_UINT32_LE
+#define GET_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint32_t) (b)[(i)    ]       )             \
+        | ( (uint32_t) (b)[(i) + 1] <<  8 )             \
+        | ( (uint32_t) (b)[(i) + 2] << 16 )             \
+        | ( (uint32_t) (b)[(i) + 3] << 24 );            \
+}
+#endif
+
+#ifndef PUT_UINT32_LE
+#define PUT_UINT32_LE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (uint8_t) ( (n)       );             \
+    (b)[(i) + 1] = (uint8_t) ( (n) >>  8 );             \
+    (b)[(i) + 2] = (uint8_t) ( (n) >> 16 );             \
+    (b)[(i) + 3] = (uint8_t) ( (n) >> 24 );             \
+}
+#endif
+
+#define P1305_MASK      0x3FFFFFF
+#define P1305_HIBIT     (1 << 24)	/* 2^128 in the top limb */
+
+/*
+ * A 16-byte block as limbs, plus the 2^128 bit of a full block
+ */
+static void poly1305_limbs(const uint8_t *m, uint32_t hibit, uint32_t t[5])
+{
+	uint32_t t0, t1, t2, t3;
+
+	GET_UINT32_LE(t0, m, 0);
+	GET_UINT32_LE(t1, m, 4);
+	GET_UINT32_LE(t2, m, 8);
+	GET_UINT32_LE(t3, m, 12);
+
+	t[0] = t0 & P1305_MASK;
+	t[1] = ((t0 >> 26) | (t1 << 6)) & P1305_MASK;
+	t[2] = ((t1 >> 20) | (t2 << 12)) & P1305_MASK;
+	t[3] = ((t2 >> 14) | (t3 << 18)) & P1305_MASK;
+	t[4] = (t3 >> 8) | hibit;
+}
+
+/*
+ * h = h * r mod 2^130 - 5, partially reduced
+ */
+static void poly1305_mul(uint32_t h[5], const uint32_t r[5])
+{
+	uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+	uint64_t d0, d1, d2, d3, d4, c;
+
+	d0 = (uint64_t) h[0] * r[0] + (uint64_t) h[1] * s4 +
+	    (uint64_t) h[2] * s3 + (uint64_t) h[3] * s2 +
+	    (uint64_t) h[4] * s1;
+	d1 = (uint64_t) h[0] * r[1] + (uint64_t) h[1] * r[0] +
+	    (uint64_t) h[2] * s4 + (uint64_t) h[3] * s3 +
+	    (uint64_t) h[4] * s2;
+	d2 = (uint64_t) h[0] * r[2] + (uint64_t) h[1] * r[1] +
+	    (uint64_t) h[2] * r[0] + (uint64_t) h[3] * s4 +
+	    (uint64_t) h[4] * s3;
+	d3 = (uint64_t) h[0] * r[3] + (uint64_t) h[1] * r[2] +
+	    (uint64_t) h[2] * r[1] + (uint64_t) h[3] * r[0] +
+	    (uint64_t) h[4] * s4;
+	d4 = (uint64_t) h[0] * r[4] + (uint64_t) h[1] * r[3] +
+	    (uint64_t) h[2] * r[2] + (uint64_t) h[3] * r[1] +
+	    (uint64_t) h[4] * r[0];
+
+	c = d0 >> 26;
+	h[0] = (uint32_t) d0 & P1305_MASK;
+	d1 += c;
+	c = d1 >> 26;
+	h[1] = (uint32_t) d1 & P1305_MASK;
+	d2 += c;
+	c = d2 >> 26;
+	h[2] = (uint32_t) d2 & P1305_MASK;
+	d3 += c;
+	c = d3 >> 26;
+	h[3] = (uint32_t) d3 & P1305_MASK;
+	d4 += c;
+	c = d4 >> 26;
+	h[4] = (uint32_t) d4 & P1305_MASK;
+	h[0] += (uint32_t) c *5;
+	h[1] += h[0] >> 26;
+	h[0] &= P1305_MASK;
+}
+
+static void poly1305_blocks(poly1305_context * ctx, const uint8_t *m,
+			    size_t nblocks, uint32_t hibit)
+{
+	int i;
+	uint32_t t[5];
+
+	for (; nblocks > 0; nblocks--, m += 16) {
+		poly1305_limbs(m, hibit, t);
+
+		for (i = 0; i < 5; i++)
+			ctx->h[i] += t[i];
+
+		poly1305_mul(ctx->h, ctx->r);
+	}
+}
+
+/*
+ * Join the two accumulators, already multiplied by r^2 and r
+ */
+static void poly1305_join(poly1305_context * ctx, const uint64_t a[5],
+			  const uint64_t b[5])
+{
+	int i;
+	uint64_t d, c = 0;
+
+	for (i = 0; i < 5; i++) {
+		d = a[i] + b[i] + c;
+		ctx->h[i] = (uint32_t) d & P1305_MASK;
+		c = d >> 26;
+	}
+
+	ctx->h[0] += (uint32_t) c *5;
+	ctx->h[1] += ctx->h[0] >> 26;
+	ctx->h[0] &= P1305_MASK;
+}
+
+#if defined(TROPICSSL_HAVE_X86_64)
+/*
+ * Two blocks at a time in SSE2: lane 0 accumulates the even blocks,
+ * lane 1 the odd ones; _mm_mul_epu32 multiplies the low 32 bits of
+ * both 64-bit lanes
+ */
+static void poly1305_mul_sse2(__m128i h[5], const __m128i r[5],
+			      const __m128i s[5])
+{
+	__m128i d0, d1, d2, d3, d4, c;
+	const __m128i mask = _mm_set1_epi64x(P1305_MASK);
+
+#define MUL(a,b) _mm_mul_epu32(a, b)
+#define ADD(a,b) _mm_add_epi64(a, b)
+	d0 = ADD(ADD(ADD(ADD(MUL(h[0], r[0]), MUL(h[1], s[4])),
+			 MUL(h[2], s[3])), MUL(h[3], s[2])), MUL(h[4], s[1]));
+	d1 = ADD(ADD(ADD(ADD(MUL(h[0], r[1]), MUL(h[1], r[0])),
+			 MUL(h[2], s[4])), MUL(h[3], s[3])), MUL(h[4], s[2]));
+	d2 = ADD(ADD(ADD(ADD(MUL(h[0], r[2]), MUL(h[1], r[1])),
+			 MUL(h[2], r[0])), MUL(h[3], s[4])), MUL(h[4], s[3]));
+	d3 = ADD(ADD(ADD(ADD(MUL(h[0], r[3]), MUL(h[1], r[2])),
+			 MUL(h[2], r[1])), MUL(h[3], r[0])), MUL(h[4], s[4]));
+	d4 = ADD(ADD(ADD(ADD(MUL(h[0], r[4]), MUL(h[1], r[3])),
+			 MUL(h[2], r[2])), MUL(h[3], r[1])), MUL(h[4], r[0]));
+
+	c = _mm_srli_epi64(d0, 26);
+	h[0] = _mm_and_si128(d0, mask);
+	d1 = ADD(d1, c);
+	c = _mm_srli_epi64(d1, 26);
+	h[1] = _mm_and_si128(d1, mask);
+	d2 = ADD(d2, c);
+	c = _mm_srli_epi64(d2, 26);
+	h[2] = _mm_and_si128(d2, mask);
+	d3 = ADD(d3, c);
+	c = _mm_srli_epi64(d3, 26);
+	h[3] = _mm_and_si128(d3, mask);
+	d4 = ADD(d4, c);
+	c = _mm_srli_epi64(d4, 26);
+	h[4] = _mm_and_si128(d4, mask);
+	h[0] = ADD(h[0], ADD(c, _mm_slli_epi64(c, 2)));
+	c = _mm_srli_epi64(h[0], 26);
+	h[0] = _mm_and_si128(h[0], mask);
+	h[1] = ADD(h[1], c);
+#undef MUL
+#undef ADD
+}
+
+static void poly1305_blocks_sse2(poly1305_context * ctx, const uint8_t *m,
+				 size_t nblocks)
+{
+	int i;
+	uint32_t ta[5], tb[5];
+	uint64_t a[5], b[5];
+	__m128i h[5], r[5], s[5];
+
+	for (i = 0; i < 5; i++) {
+		r[i] = _mm_set1_epi64x(ctx->r2[i]);
+		s[i] = _mm_set1_epi64x(ctx->r2[i] * 5);
+	}
+
+	poly1305_limbs(m, P1305_HIBIT, ta);
+	poly1305_limbs(m + 16, P1305_HIBIT, tb);
+
+	for (i = 0; i < 5; i++)
+		h[i] = _mm_set_epi64x(tb[i], ta[i] + ctx->h[i]);
+
+	for (nblocks -= 2, m += 32; nblocks >= 2; nblocks -= 2, m += 32) {
+		poly1305_mul_sse2(h, r, s);
+
+		poly1305_limbs(m, P1305_HIBIT, ta);
+		poly1305_limbs(m + 16, P1305_HIBIT, tb);
+
+		for (i = 0; i < 5; i++)
+			h[i] = _mm_add_epi64(h[i],
+					     _mm_set_epi64x(tb[i], ta[i]));
+	}
+
+	for (i = 0; i < 5; i++) {
+		r[i] = _mm_set_epi64x(ctx->r[i], ctx->r2[i]);
+		s[i] = _mm_set_epi64x(ctx->r[i] * 5, ctx->r2[i] * 5);
+	}
+
+	poly1305_mul_sse2(h, r, s);
+
+	for (i = 0; i < 5; i++) {
+		a[i] = (uint64_t) _mm_cvtsi128_si64(h[i]);
+		b[i] = (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(h[i],
+								       h[i]));
+	}
+
+	poly1305_join(ctx, a, b);
+}
+#endif /* TROPICSSL_HAVE_X86_64 */
+
+#if defined(TROPICSSL_POLY1305_NEON)
+/*
+ * Two blocks at a time in NEON: lane 0 accumulates the even blocks,
+ * lane 1 the odd ones
+ */
+static void poly1305_mul_neon(uint32x2_t h[5], const uint32x2_t r[5],
+			      const uint32x2_t s[5])
+{
+	uint64x2_t d0, d1, d2, d3, d4, c, h0;
+	const uint64x2_t mask = vdupq_n_u64(P1305_MASK);
+
+	d0 = vmull_u32(h[0], r[0]);
+	d0 = vmlal_u32(d0, h[1], s[4]);
+	d0 = vmlal_u32(d0, h[2], s[3]);
+	d0 = vmlal_u32(d0, h[3], s[2]);
+	d0 = vmlal_u32(d0, h[4], s[1]);
+	d1 = vmull_u32(h[0], r[1]);
+	d1 = vmlal_u32(d1, h[1], r[0]);
+	d1 = vmlal_u32(d1, h[2], s[4]);
+	d1 = vmlal_u32(d1, h[3], s[3]);
+	d1 = vmlal_u32(d1, h[4], s[2]);
+	d2 = vmull_u32(h[0], r[2]);
+	d2 = vmlal_u32(d2, h[1], r[1]);
+	d2 = vmlal_u32(d2, h[2], r[0]);
+	d2 = vmlal_u32(d2, h[3], s[4]);
+	d2 = vmlal_u32(d2, h[4], s[3]);
+	d3 = vmull_u32(h[0], r[3]);
+	d3 = vmlal_u32(d3, h[1], r[2]);
+	d3 = vmlal_u32(d3, h[2], r[1]);
+	d3 = vmlal_u32(d3, h[3], r[0]);
+	d3 = vmlal_u32(d3, h[4], s[4]);
+	d4 = vmull_u32(h[0], r[4]);
+	d4 = vmlal_u32(d4, h[1], r[3]);
+	d4 = vmlal_u32(d4, h[2], r[2]);
+	d4 = vmlal_u32(d4, h[3], r[1]);
+	d4 = vmlal_u32(d4, h[4], r[0]);
+
+	c = vshrq_n_u64(d0, 26);
+	h0 = vandq_u64(d0, mask);
+	d1 = vaddq_u64(d1, c);
+	c = vshrq_n_u64(d1, 26);
+	h[1] = vmovn_u64(vandq_u64(d1, mask));
+	d2 = vaddq_u64(d2, c);
+	c = vshrq_n_u64(d2, 26);
+	h[2] = vmovn_u64(vandq_u64(d2, mask));
+	d3 = vaddq_u64(d3, c);
+	c = vshrq_n_u64(d3, 26);
+	h[3] = vmovn_u64(vandq_u64(d3, mask));
+	d4 = vaddq_u64(d4, c);
+	c = vshrq_n_u64(d4, 26);
+	h[4] = vmovn_u64(vandq_u64(d4, mask));
+	h0 = vaddq_u64(h0, vaddq_u64(c, vshlq_n_u64(c, 2)));
+	c = vshrq_n_u64(h0, 26);
+	h[0] = vmovn_u64(vandq_u64(h0, mask));
+	h[1] = vadd_u32(h[1], vmovn_u64(c));
+}
+
+static void poly1305_blocks_neon(poly1305_context * ctx, const uint8_t *m,
+				 size_t nblocks)
+{
+	int i;
+	uint32_t ta[5], tb[5], lane[2];
+	uint64_t a[5], b[5];
+	uint32x2_t h[5], r[5], s[5];
+
+	for (i = 0; i < 5; i++) {
+		r[i] = vdup_n_u32(ctx->r2[i]);
+		s[i] = vdup_n_u32(ctx->r2[i] * 5);
+	}
+
+	poly1305_limbs(m, P1305_HIBIT, ta);
+	poly1305_limbs(m + 16, P1305_HIBIT, tb);
+
+	for (i = 0; i < 5; i++) {
+		lane[0] = ta[i] + ctx->h[i];
+		lane[1] = tb[i];
+		h[i] = vld1_u32(lane);
+	}
+
+	for (nblocks -= 2, m += 32; nblocks >= 2; nblocks -= 2, m += 32) {
+		poly1305_mul_neon(h, r, s);
+
+		poly1305_limbs(m, P1305_HIBIT, ta);
+		poly1305_limbs(m + 16, P1305_HIBIT, tb);
+
+		for (i = 0; i < 5; i++) {
+			lane[0] = ta[i];
+			lane[1] = tb[i];
+			h[i] = vadd_u32(h[i], vld1_u32(lane));
+		}
+	}
+
+	for (i = 0; i < 5; i++) {
+		lane[0] = ctx->r2[i];
+		lane[1] = ctx->r[i];
+		r[i] = vld1_u32(lane);
+		s[i] = vmul_n_u32(r[i], 5);
+	}
+
+	poly1305_mul_neon(h, r, s);
+
+	for (i = 0; i < 5; i++) {
+		a[i] = vget_lane_u32(h[i], 0);
+		b[i] = vget_lane_u32(h[i], 1);
+	}
+
+	poly1305_join(ctx, a, b);
+}
+#endif /* TROPICSSL_POLY1305_NEON */
+
+/*
+ * Poly1305 key setup
+ */
+void poly1305_starts(poly1305_context * ctx, const uint8_t key[32])
+{
+	int i;
+	uint32_t t[5];
+
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	poly1305_limbs(key, 0, t);
+	ctx->r[0] = t[0] & 0x3FFFFFF;
+	ctx->r[1] = t[1] & 0x3FFFF03;
+	ctx->r[2] = t[2] & 0x3FFC0FF;
+	ctx->r[3] = t[3] & 0x3F03FFF;
+	ctx->r[4] = t[4] & 0x00FFFFF;
+
+	memcpy(ctx->r2, ctx->r, sizeof(ctx->r2));
+	poly1305_mul(ctx->r2, ctx->r);
+
+	for (i = 0; i < 4; i++)
+		GET_UINT32_LE(ctx->pad[i], key, 16 + i * 4);
+
+	memset(ctx->h, 0, sizeof(ctx->h));
+	ctx->left = 0;
+	ctx->simd = 0;
+
+#if defined(TROPICSSL_HAVE_X86_64) || defined(TROPICSSL_POLY1305_NEON)
+	ctx->simd = 1;
+#endif
+}
+
+/*
+ * Poly1305 process buffer
+ */
+void poly1305_update(poly1305_context * ctx, const uint8_t *input,
+		     size_t ilen)
+{
+	size_t n;
+
+	if (ctx->left > 0) {
+		n = 16 - ctx->left;
+		if (n > ilen)
+			n = ilen;
+
+		memcpy(ctx->buf + ctx->left, input, n);
+		ctx->left += n;
+		input += n;
+		ilen -= n;
+
+		if (ctx->left < 16)
+			return;
+
+		poly1305_blocks(ctx, ctx->buf, 1, P1305_HIBIT);
+		ctx->left = 0;
+	}
+
+	n = ilen / 16;
+
+	/*
+	 * Short messages are not worth the setup of the two lanes
+	 */
+	if (ctx->simd != 0 && n >= 4) {
+		n &= ~(size_t) 1;
+#if defined(TROPICSSL_HAVE_X86_64)
+		poly1305_blocks_sse2(ctx, input, n);
+#elif defined(TROPICSSL_POLY1305_NEON)
+		poly1305_blocks_neon(ctx, input, n);
+#endif
+		input += n * 16;
+		ilen -= n * 16;
+		n = ilen / 16;
+	}
+
+	poly1305_blocks(ctx, input, n, P1305_HIBIT);
+	input += n * 16;
+	ilen -= n * 16;
+
+	memcpy(ctx->buf, input, ilen);
+	ctx->left = ilen;
+}
+
+/*
+ * Poly1305 final tag
+ */
+void poly1305_finish(poly1305_context * ctx, uint8_t mac[16])
+{
+	uint32_t h0, h1, h2, h3, h4, c;
+	uint32_t g0, g1, g2, g3, g4, mask;
+	uint64_t f;
+
+	/*
+	 * A final partial block is padded with a 1 byte instead of
+	 * the 2^128 bit
+	 */
+	if (ctx->left > 0) {
+		ctx->buf[ctx->left] = 1;
+		memset(ctx->buf + ctx->left + 1, 0, 15 - ctx->left);
+		poly1305_blocks(ctx, ctx->buf, 1, 0);
+	}
+
+	h0 = ctx->h[0];
+	h1 = ctx->h[1];
+	h2 = ctx->h[2];
+	h3 = ctx->h[3];
+	h4 = ctx->h[4];
+
+	c = h1 >> 26;
+	h1 &= P1305_MASK;
+	h2 += c;
+	c = h2 >> 26;
+	h2 &= P1305_MASK;
+	h3 += c;
+	c = h3 >> 26;
+	h3 &= P1305_MASK;
+	h4 += c;
+	c = h4 >> 26;
+	h4 &= P1305_MASK;
+	h0 += c * 5;
+	c = h0 >> 26;
+	h0 &= P1305_MASK;
+	h1 += c;
+
+	/*
+	 * g = h + -p; keep h if that went negative, in constant time
+	 */
+	g0 = h0 + 5;
+	c = g0 >> 26;
+	g0 &= P1305_MASK;
+	g1 = h1 + c;
+	c = g1 >> 26;
+	g1 &= P1305_MASK;
+	g2 = h2 + c;
+	c = g2 >> 26;
+	g2 &= P1305_MASK;
+	g3 = h3 + c;
+	c = g3 >> 26;
+	g3 &= P1305_MASK;
+	g4 = h4 + c - (1 << 26);
+
+	mask = (g4 >> 31) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+	h3 = (h3 & ~mask) | (g3 & mask);
+	h4 = (h4 & ~mask) | (g4 & mask);
+
+	/*
+	 * h = (h + s) mod 2^128
+	 */
+	h0 = h0 | (h1 << 26);
+	h1 = (h1 >> 6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 << 8);
+
+	f = (uint64_t) h0 + ctx->pad[0];
+	h0 = (uint32_t) f;
+	f = (uint64_t) h1 + ctx->pad[1] + (f >> 32);
+	h1 = (uint32_t) f;
+	f = (uint64_t) h2 + ctx->pad[2] + (f >> 32);
+	h2 = (uint32_t) f;
+	f = (uint64_t) h3 + ctx->pad[3] + (f >> 32);
+	h3 = (uint32_t) f;
+
+	PUT_UINT32_LE(h0, mac, 0);
+	PUT_UINT32_LE(h1, mac, 4);
+	PUT_UINT32_LE(h2, mac, 8);
+	PUT_UINT32_LE(h3, mac, 12);
+
+	memset(ctx, 0, sizeof(poly1305_context));
+}
+
+/*
+ * Output = Poly1305(key, input buffer)
+ */
+void poly1305_mac(const uint8_t key[32], const uint8_t *input,
+		  size_t ilen, uint8_t mac[16])
+{
+	poly1305_context ctx;
+
+	poly1305_starts(&ctx, key);
+	poly1305_update(&ctx, input, ilen);
+	poly1305_finish(&ctx, mac);
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * RFC 7539 section 2.5.2 and appendix A.3 #5 and #6 (carries
+ * through the final reduction)
+ */
+static const uint8_t poly1305_test_key[3][32] = {
+	{0x85, 0xD6, 0xBE, 0x78, 0x57, 0x55, 0x6D, 0x33,
+	 0x7F, 0x44, 0x52, 0xFE, 0x42, 0xD5, 0x06, 0xA8,
+	 0x01, 0x03, 0x80, 0x8A, 0xFB, 0x0D, 0xB2, 0xFD,
+	 0x4A, 0xBF, 0xF6, 0xAF, 0x41, 0x49, 0xF5, 0x1B},
+	{0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+	{0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}
+};
+
+static const uint8_t poly1305_test_msg[3][34] = {
+	{"Cryptographic Forum Research Group"},
+	{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+	{0x02}
+};
+
+static const size_t poly1305_test_len[3] = { 34, 16, 16 };
+
+static const uint8_t poly1305_test_mac[3][16] = {
+	{0xA8, 0x06, 0x1D, 0xC1, 0x30, 0x51, 0x36, 0xC6,
+	 0xC2, 0x2B, 0x8B, 0xAF, 0x0C, 0x01, 0x27, 0xA9},
+	{0x03},
+	{0x03}
+};
+
+/*
+ * Checkup routine
+ */
+int poly1305_self_test(int verbose)
+{
+	int i;
+	size_t j;
+	uint8_t buf[1040];
+	uint8_t mac1[16], mac2[16];
+	poly1305_context ctx;
+
+	for (i = 0; i < 3; i++) {
+		if (verbose != 0)
+			printf("  Poly1305 test #%d: ", i + 1);
+
+		poly1305_mac(poly1305_test_key[i], poly1305_test_msg[i],
+			     poly1305_test_len[i], mac1);
+
+		if (memcmp(mac1, poly1305_test_mac[i], 16) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+
+		if (verbose != 0)
+			printf("passed\n");
+	}
+
+	/*
+	 * The two-lane code over a long message must match the portable
+	 * code run in uneven pieces
+	 */
+	if (verbose != 0)
+		printf("  Poly1305 test #4: ");
+
+	for (j = 0; j < sizeof(buf); j++)
+		buf[j] = (uint8_t)(j * 13 + 5);
+
+	poly1305_starts(&ctx, poly1305_test_key[0]);
+	poly1305_update(&ctx, buf, 7);
+	poly1305_update(&ctx, buf + 7, sizeof(buf) - 7 - 3);
+	poly1305_update(&ctx, buf + sizeof(buf) - 3, 3);
+	poly1305_finish(&ctx, mac1);
+
+	poly1305_starts(&ctx, poly1305_test_key[0]);
+	ctx.simd = 0;
+	poly1305_update(&ctx, buf, sizeof(buf) - 3);
+	poly1305_update(&ctx, buf + sizeof(buf) - 3, 3);
+	poly1305_finish(&ctx, mac2);
+
+	if (memcmp(mac1, mac2, 16) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+}
+
+#endif
+
+#endif
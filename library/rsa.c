@@ -45,6 +45,7 @@
 
 #include "tropicssl/err.h"
 #include "tropicssl/rsa.h"
+#include "tropicssl/trace.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -54,7 +55,8 @@
  * Initialize an RSA context
  */
 void rsa_init(rsa_context * ctx,
-	      int padding, int hash_id, int (*f_rng) (void *), void *p_rng)
+	      int padding, int hash_id, int (*f_rng) (void *, uint8_t *, size_t),
+	      void *p_rng)
 {
 	memset(ctx, 0, sizeof(rsa_context));
 
@@ -71,6 +73,14 @@ void rsa_init(rsa_context * ctx,
  * Generate an RSA keypair
  */
 int rsa_gen_key(rsa_context * ctx, int nbits, int exponent)
+{
+	return (rsa_gen_key_mt(ctx, nbits, exponent, 1));
+}
+
+/*
+ * Generate an RSA keypair, each prime searched for on several threads
+ */
+int rsa_gen_key_mt(rsa_context * ctx, int nbits, int exponent, int threads)
 {
 	int ret;
 	mpi P1, Q1, H, G;
@@ -87,11 +97,11 @@ int rsa_gen_key(rsa_context * ctx, int nbits, int exponent)
 	MPI_CHK(mpi_lset(&ctx->E, exponent));
 
 	do {
-		MPI_CHK(mpi_gen_prime(&ctx->P, (nbits + 1) >> 1, 0,
-				      ctx->f_rng, ctx->p_rng));
+		MPI_CHK(mpi_gen_prime_mt(&ctx->P, (nbits + 1) >> 1, 0,
+					 threads, ctx->f_rng, ctx->p_rng));
 
-		MPI_CHK(mpi_gen_prime(&ctx->Q, (nbits + 1) >> 1, 0,
-				      ctx->f_rng, ctx->p_rng));
+		MPI_CHK(mpi_gen_prime_mt(&ctx->Q, (nbits + 1) >> 1, 0,
+					 threads, ctx->f_rng, ctx->p_rng));
 
 		if (mpi_cmp_mpi(&ctx->P, &ctx->Q) < 0)
 			mpi_swap(&ctx->P, &ctx->Q);
@@ -122,6 +132,10 @@ int rsa_gen_key(rsa_context * ctx, int nbits, int exponent)
 
 	ctx->len = (mpi_msb(&ctx->N) + 7) >> 3;
 
+	MPI_CHK(mpi_mont_init(&ctx->MP, &ctx->P));
+	MPI_CHK(mpi_mont_init(&ctx->MQ, &ctx->Q));
+	MPI_CHK(mpi_mont_init(&ctx->MN, &ctx->N));
+
 cleanup:
 
 	mpi_free(&G, &H, &Q1, &P1, NULL);
@@ -195,7 +209,7 @@ int rsa_public(rsa_context * ctx, const uint8_t *input, uint8_t *output)
 	size_t olen;
 	mpi T;
 
-	mpi_init(&T, NULL);
+	mpi_init_tmp(&T, NULL);
 
 	MPI_CHK(mpi_read_binary(&T, input, ctx->len));
 
@@ -204,6 +218,8 @@ int rsa_public(rsa_context * ctx, const uint8_t *input, uint8_t *output)
 		return (TROPICSSL_ERR_BAD_ARG);
 	}
 
+	TROPICSSL_TRACE2(rsa_public_start, ctx, mpi_msb(&ctx->N));
+
 	olen = ctx->len;
 	MPI_CHK(mpi_exp_mod(&T, &T, &ctx->E, &ctx->N, &ctx->RN));
 	MPI_CHK(mpi_write_binary(&T, output, olen));
@@ -212,12 +228,87 @@ cleanup:
 
 	mpi_free(&T, NULL);
 
+	TROPICSSL_TRACE2(rsa_public_done, ctx, ret);
+
 	if (ret != 0)
 		return (TROPICSSL_ERR_RSA_PUBLIC_FAILED | ret);
 
 	return (0);
 }
 
+/*
+ * Precompute the Montgomery constants of P, Q and N
+ */
+int rsa_precompute(rsa_context * ctx)
+{
+	int ret;
+
+	MPI_CHK(mpi_mont_init(&ctx->MP, &ctx->P));
+	MPI_CHK(mpi_mont_init(&ctx->MQ, &ctx->Q));
+	MPI_CHK(mpi_mont_init(&ctx->MN, &ctx->N));
+
+cleanup:
+
+	if (ret != 0)
+		return (TROPICSSL_ERR_RSA_KEY_CHECK_FAILED | ret);
+
+	return (0);
+}
+
+/*
+ * Blind T for a private key operation: T = T * Vi mod N, Vf being
+ * what undoes it afterwards. The first pair is random, Vf prime to N
+ * and Vi = Vf^-E; after that both get squared, which is still a valid
+ * pair. Both are kept times R mod N, so that squaring them and
+ * applying them are Montgomery multiplications, with no division.
+ */
+static int rsa_blind(rsa_context * ctx, mpi * T)
+{
+	int ret, count = 0;
+	mpi G;
+
+	mpi_init_tmp(&G, NULL);
+
+	if (mpi_cmp_int(&ctx->Vf, 0) != 0) {
+		MPI_CHK(mpi_mont_mul(&ctx->Vi, &ctx->Vi, &ctx->Vi,
+				     &ctx->N, &ctx->MN));
+		MPI_CHK(mpi_mont_mul(&ctx->Vf, &ctx->Vf, &ctx->Vf,
+				     &ctx->N, &ctx->MN));
+	} else {
+		do {
+			if (count++ > 10) {
+				ret = TROPICSSL_ERR_MPI_NOT_ACCEPTABLE;
+				goto cleanup;
+			}
+
+			MPI_CHK(mpi_fill_random(&ctx->Vf, ctx->N.n,
+						ctx->f_rng, ctx->p_rng));
+			MPI_CHK(mpi_mod_mpi(&ctx->Vf, &ctx->Vf, &ctx->N));
+			MPI_CHK(mpi_gcd(&G, &ctx->Vf, &ctx->N));
+		} while (mpi_cmp_int(&G, 1) != 0);
+
+		MPI_CHK(mpi_inv_mod(&ctx->Vi, &ctx->Vf, &ctx->N));
+		MPI_CHK(mpi_exp_mod(&ctx->Vi, &ctx->Vi, &ctx->E, &ctx->N,
+				    &ctx->RN));
+
+		MPI_CHK(mpi_mont_mul(&ctx->Vi, &ctx->Vi, &ctx->MN.RR,
+				     &ctx->N, &ctx->MN));
+		MPI_CHK(mpi_mont_mul(&ctx->Vf, &ctx->Vf, &ctx->MN.RR,
+				     &ctx->N, &ctx->MN));
+	}
+
+	MPI_CHK(mpi_mont_mul(T, T, &ctx->Vi, &ctx->N, &ctx->MN));
+
+cleanup:
+
+	if (ret != 0)
+		mpi_free(&ctx->Vf, &ctx->Vi, NULL);
+
+	mpi_free(&G, NULL);
+
+	return (ret);
+}
+
 /*
  * Do an RSA private key operation
  */
@@ -227,7 +318,7 @@ int rsa_private(rsa_context * ctx, const uint8_t *input, uint8_t *output)
 	size_t olen;
 	mpi T, T1, T2;
 
-	mpi_init(&T, &T1, &T2, NULL);
+	mpi_init_tmp(&T, &T1, &T2, NULL);
 
 	MPI_CHK(mpi_read_binary(&T, input, ctx->len));
 
@@ -235,6 +326,17 @@ int rsa_private(rsa_context * ctx, const uint8_t *input, uint8_t *output)
 		mpi_free(&T, NULL);
 		return (TROPICSSL_ERR_BAD_ARG);
 	}
+
+	if ((ctx->MP.n == 0 || ctx->MQ.n == 0 || ctx->MN.n == 0) &&
+	    (ret = rsa_precompute(ctx)) != 0) {
+		mpi_free(&T, NULL);
+		return (ret);
+	}
+
+	TROPICSSL_TRACE2(rsa_private_start, ctx, mpi_msb(&ctx->N));
+
+	if (ctx->f_rng != NULL)
+		MPI_CHK(rsa_blind(ctx, &T));
 #if 0
 	MPI_CHK(mpi_exp_mod(&T, &T, &ctx->D, &ctx->N, &ctx->RN));
 #else
@@ -244,8 +346,8 @@ int rsa_private(rsa_context * ctx, const uint8_t *input, uint8_t *output)
 	 * T1 = input ^ dP mod P
 	 * T2 = input ^ dQ mod Q
 	 */
-	MPI_CHK(mpi_exp_mod(&T1, &T, &ctx->DP, &ctx->P, &ctx->RP));
-	MPI_CHK(mpi_exp_mod(&T2, &T, &ctx->DQ, &ctx->Q, &ctx->RQ));
+	MPI_CHK(mpi_exp_mod_fixed(&T1, &T, &ctx->DP, &ctx->P, &ctx->MP));
+	MPI_CHK(mpi_exp_mod_fixed(&T2, &T, &ctx->DQ, &ctx->Q, &ctx->MQ));
 
 	/*
 	 * T = (T1 - T2) * (Q^-1 mod P) mod P
@@ -261,6 +363,9 @@ int rsa_private(rsa_context * ctx, const uint8_t *input, uint8_t *output)
 	MPI_CHK(mpi_add_mpi(&T, &T2, &T1));
 #endif
 
+	if (ctx->f_rng != NULL)
+		MPI_CHK(mpi_mont_mul(&T, &T, &ctx->Vf, &ctx->N, &ctx->MN));
+
 	olen = ctx->len;
 	MPI_CHK(mpi_write_binary(&T, output, olen));
 
@@ -268,6 +373,98 @@ cleanup:
 
 	mpi_free(&T, &T1, &T2, NULL);
 
+	TROPICSSL_TRACE2(rsa_private_done, ctx, ret);
+
+	if (ret != 0)
+		return (TROPICSSL_ERR_RSA_PRIVATE_FAILED | ret);
+
+	return (0);
+}
+
+/*
+ * Do up to MPI_BATCH_LANES private key operations side by side
+ */
+static int rsa_private_lanes(rsa_context * ctx, int count,
+			     const uint8_t * const *input, uint8_t **output)
+{
+	int ret, i;
+	mpi T[MPI_BATCH_LANES], T1[MPI_BATCH_LANES], T2[MPI_BATCH_LANES];
+	mpi Vf[MPI_BATCH_LANES];
+
+	memset(T, 0, sizeof(T));
+	memset(T1, 0, sizeof(T1));
+	memset(T2, 0, sizeof(T2));
+	memset(Vf, 0, sizeof(Vf));
+
+	for (i = 0; i < count; i++) {
+		MPI_CHK(mpi_read_binary(&T[i], input[i], ctx->len));
+
+		if (mpi_cmp_mpi(&T[i], &ctx->N) >= 0) {
+			ret = TROPICSSL_ERR_BAD_ARG;
+			goto cleanup;
+		}
+
+		if (ctx->f_rng != NULL) {
+			MPI_CHK(rsa_blind(ctx, &T[i]));
+			MPI_CHK(mpi_copy(&Vf[i], &ctx->Vf));
+		}
+	}
+
+	/*
+	 * T1[i] = input[i] ^ dP mod P
+	 * T2[i] = input[i] ^ dQ mod Q
+	 */
+	MPI_CHK(mpi_exp_mod_batch(T1, T, count, &ctx->DP, &ctx->P, &ctx->RP));
+	MPI_CHK(mpi_exp_mod_batch(T2, T, count, &ctx->DQ, &ctx->Q, &ctx->RQ));
+
+	for (i = 0; i < count; i++) {
+		/*
+		 * T = (T1 - T2) * (Q^-1 mod P) mod P
+		 * output = T2 + T * Q
+		 */
+		MPI_CHK(mpi_sub_mpi(&T[i], &T1[i], &T2[i]));
+		MPI_CHK(mpi_mul_mpi(&T1[i], &T[i], &ctx->QP));
+		MPI_CHK(mpi_mod_mpi(&T[i], &T1[i], &ctx->P));
+		MPI_CHK(mpi_mul_mpi(&T1[i], &T[i], &ctx->Q));
+		MPI_CHK(mpi_add_mpi(&T[i], &T2[i], &T1[i]));
+
+		if (ctx->f_rng != NULL)
+			MPI_CHK(mpi_mont_mul(&T[i], &T[i], &Vf[i],
+					     &ctx->N, &ctx->MN));
+
+		MPI_CHK(mpi_write_binary(&T[i], output[i], ctx->len));
+	}
+
+cleanup:
+
+	for (i = 0; i < MPI_BATCH_LANES; i++)
+		mpi_free(&T[i], &T1[i], &T2[i], &Vf[i], NULL);
+
+	return (ret);
+}
+
+/*
+ * Do a batch of RSA private key operations
+ */
+int rsa_private_batch(rsa_context * ctx, int count,
+		      const uint8_t * const *input, uint8_t **output)
+{
+	int ret = 0, i, n;
+
+	if (ctx->MN.n == 0 && (ret = rsa_precompute(ctx)) != 0)
+		return (ret);
+
+	TROPICSSL_TRACE3(rsa_private_batch_start, ctx, mpi_msb(&ctx->N), count);
+
+	for (i = 0; i < count; i += n) {
+		n = (count - i < MPI_BATCH_LANES) ? count - i : MPI_BATCH_LANES;
+
+		if ((ret = rsa_private_lanes(ctx, n, input + i, output + i)) != 0)
+			break;
+	}
+
+	TROPICSSL_TRACE2(rsa_private_batch_done, ctx, ret);
+
 	if (ret != 0)
 		return (TROPICSSL_ERR_RSA_PRIVATE_FAILED | ret);
 
@@ -278,9 +475,11 @@ cleanup:
  * Add the message padding, then do an RSA operation
  */
 int rsa_pkcs1_encrypt(rsa_context * ctx,
-		      int mode, size_t ilen,
+		      int (*f_rng) (void *, uint8_t *, size_t),
+		      void *p_rng, int mode, size_t ilen,
 		      const uint8_t *input, uint8_t *output)
 {
+	int ret;
 	size_t nb_pad, olen;
 	uint8_t *p = output;
 
@@ -289,7 +488,7 @@ int rsa_pkcs1_encrypt(rsa_context * ctx,
 	switch (ctx->padding) {
 	case RSA_PKCS_V15:
 
-		if (ilen < 0 || olen < ilen + 11)
+		if (ilen < 0 || olen < ilen + 11 || f_rng == NULL)
 			return (TROPICSSL_ERR_BAD_ARG);
 
 		nb_pad = olen - 3 - ilen;
@@ -297,11 +496,17 @@ int rsa_pkcs1_encrypt(rsa_context * ctx,
 		*p++ = 0;
 		*p++ = RSA_CRYPT;
 
-		while (nb_pad-- > 0) {
-			do {
-				*p = (uint8_t)rand();
-			} while (*p == 0);
-			p++;
+		/*
+		 * All of the padding in one request; the odd zero byte
+		 * is drawn again
+		 */
+		if ((ret = f_rng(p_rng, p, nb_pad)) != 0)
+			return (ret);
+
+		for (; nb_pad > 0; nb_pad--, p++) {
+			while (*p == 0)
+				if ((ret = f_rng(p_rng, p, 1)) != 0)
+					return (ret);
 		}
 		*p++ = 0;
 		memcpy(p, input, ilen);
@@ -317,6 +522,44 @@ int rsa_pkcs1_encrypt(rsa_context * ctx,
 		: rsa_private(ctx, output, output));
 }
 
+/*
+ * Remove the message padding from a decrypted block
+ */
+static int rsa_pkcs1_unpad(rsa_context * ctx, size_t *olen,
+			   const uint8_t *buf,
+			   uint8_t *output, size_t output_max_len)
+{
+	size_t ilen = ctx->len;
+	const uint8_t *p = buf;
+
+	switch (ctx->padding) {
+	case RSA_PKCS_V15:
+
+		if (*p++ != 0 || *p++ != RSA_CRYPT)
+			return (TROPICSSL_ERR_RSA_INVALID_PADDING);
+
+		while (*p != 0) {
+			if (p >= buf + ilen - 1)
+				return (TROPICSSL_ERR_RSA_INVALID_PADDING);
+			p++;
+		}
+		p++;
+		break;
+
+	default:
+
+		return (TROPICSSL_ERR_RSA_INVALID_PADDING);
+	}
+
+	if (ilen - (p - buf) > output_max_len)
+		return (TROPICSSL_ERR_RSA_OUTPUT_TO_LARGE);
+
+	*olen = ilen - (int)(p - buf);
+	memcpy(output, p, *olen);
+
+	return (0);
+}
+
 /*
  * Do an RSA operation, then remove the message padding
  */
@@ -327,7 +570,6 @@ int rsa_pkcs1_decrypt(rsa_context * ctx,
 {
 	int ret;
 	size_t ilen;
-	uint8_t *p;
 	uint8_t buf[512];
 
 	ilen = ctx->len;
@@ -342,34 +584,66 @@ int rsa_pkcs1_decrypt(rsa_context * ctx,
 	if (ret != 0)
 		return (ret);
 
-	p = buf;
+	return (rsa_pkcs1_unpad(ctx, olen, buf, output, output_max_len));
+}
 
-	switch (ctx->padding) {
-	case RSA_PKCS_V15:
+/*
+ * Do a batch of private RSA operations, then remove the padding
+ */
+int rsa_pkcs1_decrypt_batch(rsa_context * ctx, int count,
+			    const uint8_t * const *input,
+			    uint8_t **output, size_t *olen,
+			    size_t output_max_len, int *status)
+{
+	int ret = 0, i, j, n;
+	int idx[MPI_BATCH_LANES];
+	const uint8_t *in[MPI_BATCH_LANES];
+	uint8_t *out[MPI_BATCH_LANES];
+	uint8_t buf[MPI_BATCH_LANES][512];
+	mpi T;
 
-		if (*p++ != 0 || *p++ != RSA_CRYPT)
-			return (TROPICSSL_ERR_RSA_INVALID_PADDING);
+	if (ctx->len < 16 || ctx->len > sizeof(buf[0]))
+		return (TROPICSSL_ERR_BAD_ARG);
 
-		while (*p != 0) {
-			if (p >= buf + ilen - 1)
-				return (TROPICSSL_ERR_RSA_INVALID_PADDING);
-			p++;
+	mpi_init(&T, NULL);
+
+	for (i = 0; i < count; i += MPI_BATCH_LANES) {
+		/*
+		 * Out of range ciphertexts are failed on their own,
+		 * so one bad peer cannot spoil the others' lanes
+		 */
+		for (j = n = 0; j < MPI_BATCH_LANES && i + j < count; j++) {
+			MPI_CHK(mpi_read_binary(&T, input[i + j], ctx->len));
+
+			if (mpi_cmp_mpi(&T, &ctx->N) >= 0) {
+				status[i + j] = TROPICSSL_ERR_BAD_ARG;
+				continue;
+			}
+
+			idx[n] = i + j;
+			in[n] = input[i + j];
+			out[n] = buf[n];
+			n++;
 		}
-		p++;
-		break;
 
-	default:
+		if (n == 0)
+			continue;
 
-		return (TROPICSSL_ERR_RSA_INVALID_PADDING);
+		if ((ret = rsa_private_batch(ctx, n, in, out)) != 0)
+			goto cleanup;
+
+		for (j = 0; j < n; j++)
+			status[idx[j]] = rsa_pkcs1_unpad(ctx, &olen[idx[j]], buf[j],
+							 output[idx[j]],
+							 output_max_len);
 	}
 
-	if (ilen - (p - buf) > output_max_len)
-		return (TROPICSSL_ERR_RSA_OUTPUT_TO_LARGE);
+cleanup:
 
-	*olen = ilen - (int)(p - buf);
-	memcpy(output, p, *olen);
+	memset(buf, 0, sizeof(buf));
+	mpi_free(&T, NULL);
 
-	return (0);
+	return (ret);
 }
 
 /*
@@ -546,7 +820,10 @@ int rsa_pkcs1_verify(rsa_context * ctx,
  */
 void rsa_free(rsa_context * ctx)
 {
-	mpi_free(&ctx->RQ, &ctx->RP, &ctx->RN,
+	mpi_mont_free(&ctx->MN);
+	mpi_mont_free(&ctx->MQ);
+	mpi_mont_free(&ctx->MP);
+	mpi_free(&ctx->Vf, &ctx->Vi, &ctx->RQ, &ctx->RP, &ctx->RN,
 		 &ctx->QP, &ctx->DQ, &ctx->DP,
 		 &ctx->Q, &ctx->P, &ctx->D, &ctx->E, &ctx->N, NULL);
 }
@@ -606,9 +883,67 @@ void rsa_free(rsa_context * ctx)
 	"A74206CEC169D74BF5A8C50D6F48EA08"
 
 #define PT_LEN	24
+#define BATCH_LEN	(MPI_BATCH_LANES + 1)
 #define RSA_PT	"\xAA\xBB\xCC\x03\x02\x01\x00\xFF\xFF\xFF\xFF\xFF"	\
 	"\x11\x22\x33\x0A\x0B\x0C\xCC\xDD\xDD\xDD\xDD\xDD"
 
+static int rsa_self_test_rng(void *p_rng, uint8_t *output, size_t len)
+{
+	(void) p_rng;
+
+	while (len-- > 0)
+		*output++ = (uint8_t)rand();
+
+	return (0);
+}
+
+/*
+ * Decrypt one more ciphertext than there are lanes, with an out of
+ * range one among them, and check against the one-at-a-time results
+ */
+static int rsa_self_test_batch(rsa_context * rsa)
+{
+	int i, status[BATCH_LEN];
+	size_t olen[BATCH_LEN];
+	uint8_t ct[BATCH_LEN][KEY_LEN], pt[BATCH_LEN][PT_LEN];
+	uint8_t *out[BATCH_LEN];
+	const uint8_t *in[BATCH_LEN];
+
+	for (i = 0; i < BATCH_LEN; i++) {
+		memcpy(pt[i], RSA_PT, PT_LEN);
+		pt[i][0] ^= (uint8_t) i;
+
+		if (rsa_pkcs1_encrypt(rsa, rsa_self_test_rng, NULL,
+				      RSA_PUBLIC, PT_LEN, pt[i], ct[i]) != 0)
+			return (1);
+
+		in[i] = ct[i];
+		out[i] = pt[i];
+	}
+
+	memset(ct[3], 0xFF, KEY_LEN);
+	memset(pt, 0, sizeof(pt));
+
+	if (rsa_pkcs1_decrypt_batch(rsa, BATCH_LEN, in, out, olen,
+				    PT_LEN, status) != 0)
+		return (1);
+
+	for (i = 0; i < BATCH_LEN; i++) {
+		if (i == 3) {
+			if (status[i] == 0)
+				return (1);
+			continue;
+		}
+
+		if (status[i] != 0 || olen[i] != PT_LEN ||
+		    (pt[i][0] ^ (uint8_t) i) != (uint8_t) RSA_PT[0] ||
+		    memcmp(pt[i] + 1, RSA_PT + 1, PT_LEN - 1) != 0)
+			return (1);
+	}
+
+	return (0);
+}
+
 /*
  * Checkup routine
  */
@@ -648,8 +983,8 @@ int rsa_self_test(int verbose)
 
 	memcpy(rsa_plaintext, RSA_PT, PT_LEN);
 
-	if (rsa_pkcs1_encrypt(&rsa, RSA_PUBLIC, PT_LEN,
-			      rsa_plaintext, rsa_ciphertext) != 0) {
+	if (rsa_pkcs1_encrypt(&rsa, rsa_self_test_rng, NULL, RSA_PUBLIC,
+			      PT_LEN, rsa_plaintext, rsa_ciphertext) != 0) {
 		if (verbose != 0)
 			printf("failed\n");
 
@@ -675,6 +1010,16 @@ int rsa_self_test(int verbose)
 		return (1);
 	}
 
+	if (verbose != 0)
+		printf("passed\n  PKCS#1 batch decr.: ");
+
+	if (rsa_self_test_batch(&rsa) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
 	if (verbose != 0)
 		printf("passed\n  PKCS#1 data sign	 : ");
 
@@ -699,6 +1044,31 @@ int rsa_self_test(int verbose)
 		return (1);
 	}
 
+	if (verbose != 0)
+		printf("passed\n  PKCS#1 blinded dec: ");
+
+	/*
+	 * Twice, for a fresh blinding pair and then a squared one
+	 */
+	rsa.f_rng = rsa_self_test_rng;
+
+	if (rsa_pkcs1_encrypt(&rsa, rsa_self_test_rng, NULL, RSA_PUBLIC,
+			      PT_LEN, rsa_plaintext, rsa_ciphertext) != 0 ||
+	    rsa_pkcs1_decrypt(&rsa, RSA_PRIVATE, &len,
+			      rsa_ciphertext, rsa_decrypted,
+			      sizeof(rsa_decrypted)) != 0 ||
+	    memcmp(rsa_decrypted, rsa_plaintext, len) != 0 ||
+	    rsa_pkcs1_decrypt(&rsa, RSA_PRIVATE, &len,
+			      rsa_ciphertext, rsa_decrypted,
+			      sizeof(rsa_decrypted)) != 0 ||
+	    memcmp(rsa_decrypted, rsa_plaintext, len) != 0 ||
+	    rsa_self_test_batch(&rsa) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
 	if (verbose != 0)
 		printf("passed\n\n");
 
@@ -45,6 +45,14 @@
 #include "tropicssl/err.h"
 #include "tropicssl/sha1.h"
 
+#if defined(TROPICSSL_SHANI)
+#include "tropicssl/shani.h"
+#endif
+
+#if defined(TROPICSSL_SHACE)
+#include "tropicssl/shace.h"
+#endif
+
 #include <stdio.h>
 
 /*
@@ -241,6 +249,33 @@ static void sha1_process(sha1_context * ctx, const uint8_t data[64])
 	ctx->state[4] += E;
 }
 
+/*
+ * SHA-1 compression of nblocks consecutive blocks, through the
+ * SHA instructions when the CPU has them
+ */
+static void sha1_process_blocks(sha1_context * ctx, const uint8_t *data,
+			       size_t nblocks)
+{
+#if defined(TROPICSSL_SHANI) && defined(TROPICSSL_HAVE_X86_64)
+	if (shani_supports(TROPICSSL_SHANI_SHA)) {
+		shani_sha1_process(ctx->state, data, nblocks);
+		return;
+	}
+#endif
+
+#if defined(TROPICSSL_SHACE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (shace_supports(TROPICSSL_SHACE_SHA1)) {
+		shace_sha1_process(ctx->state, data, nblocks);
+		return;
+	}
+#endif
+
+	while (nblocks-- > 0) {
+		sha1_process(ctx, data);
+		data += 64;
+	}
+}
+
 /*
  * SHA-1 process buffer
  */
@@ -263,16 +298,16 @@ void sha1_update(sha1_context * ctx, const uint8_t *input, size_t ilen)
 
 	if (left && ilen >= fill) {
 		memcpy((void *)(ctx->buffer + left), (void *)input, fill);
-		sha1_process(ctx, ctx->buffer);
+		sha1_process_blocks(ctx, ctx->buffer, 1);
 		input += fill;
 		ilen -= fill;
 		left = 0;
 	}
 
-	while (ilen >= 64) {
-		sha1_process(ctx, input);
-		input += 64;
-		ilen -= 64;
+	if (ilen >= 64) {
+		sha1_process_blocks(ctx, input, ilen / 64);
+		input += ilen & ~(size_t)63;
+		ilen &= 63;
 	}
 
 	if (ilen > 0) {
@@ -370,6 +405,7 @@ void sha1_hmac_starts(sha1_context * ctx, const uint8_t *key, size_t keylen)
 {
 	size_t i;
 	uint8_t sum[20];
+	uint8_t pad[64];
 
 	if (keylen > 64) {
 		sha1(key, keylen, sum);
@@ -377,18 +413,27 @@ void sha1_hmac_starts(sha1_context * ctx, const uint8_t *key, size_t keylen)
 		key = sum;
 	}
 
-	memset(ctx->ipad, 0x36, 64);
-	memset(ctx->opad, 0x5C, 64);
+	/*
+	 * Hash each padded key block once and keep the two states
+	 */
+	memset(pad, 0x5C, 64);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
-	for (i = 0; i < keylen; i++) {
-		ctx->ipad[i] = (uint8_t)(ctx->ipad[i] ^ key[i]);
-		ctx->opad[i] = (uint8_t)(ctx->opad[i] ^ key[i]);
-	}
+	sha1_starts(ctx);
+	sha1_update(ctx, pad, 64);
+	memcpy(ctx->ostate, ctx->state, sizeof(ctx->ostate));
+
+	memset(pad, 0x36, 64);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
 	sha1_starts(ctx);
-	sha1_update(ctx, ctx->ipad, 64);
+	sha1_update(ctx, pad, 64);
+	memcpy(ctx->istate, ctx->state, sizeof(ctx->istate));
 
 	memset(sum, 0, sizeof(sum));
+	memset(pad, 0, sizeof(pad));
 }
 
 /*
@@ -407,14 +452,25 @@ void sha1_hmac_finish(sha1_context * ctx, uint8_t output[20])
 	uint8_t tmpbuf[20];
 
 	sha1_finish(ctx, tmpbuf);
-	sha1_starts(ctx);
-	sha1_update(ctx, ctx->opad, 64);
+	memcpy(ctx->state, ctx->ostate, sizeof(ctx->state));
+	ctx->total[0] = 64;
+	ctx->total[1] = 0;
 	sha1_update(ctx, tmpbuf, 20);
 	sha1_finish(ctx, output);
 
 	memset(tmpbuf, 0, sizeof(tmpbuf));
 }
 
+/*
+ * SHA-1 HMAC context reset
+ */
+void sha1_hmac_reset(sha1_context * ctx)
+{
+	memcpy(ctx->state, ctx->istate, sizeof(ctx->state));
+	ctx->total[0] = 64;
+	ctx->total[1] = 0;
+}
+
 /*
  * output = HMAC-SHA-1( hmac key, input buffer )
  */
@@ -600,6 +656,21 @@ int sha1_self_test(int verbose)
 			return (1);
 		}
 
+		/*
+		 * Same key again, from the saved key states
+		 */
+		sha1_hmac_reset(&ctx);
+		sha1_hmac_update(&ctx, sha1_hmac_test_buf[i],
+				 sha1_hmac_test_buflen[i]);
+		sha1_hmac_finish(&ctx, sha1sum);
+
+		if (memcmp(sha1sum, sha1_hmac_test_sum[i], buflen) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+
 		if (verbose != 0)
 			printf("passed\n");
 	}
@@ -45,6 +45,14 @@
 #include "tropicssl/err.h"
 #include "tropicssl/sha2.h"
 
+#if defined(TROPICSSL_SHANI)
+#include "tropicssl/shani.h"
+#endif
+
+#if defined(TROPICSSL_SHACE)
+#include "tropicssl/shace.h"
+#endif
+
 #include <stdio.h>
 
 /*
@@ -234,6 +242,38 @@ static void sha2_process(sha2_context * ctx, const uint8_t data[64])
 	ctx->state[7] += H;
 }
 
+/*
+ * SHA-256 compression of nblocks consecutive blocks, through the
+ * SHA instructions when the CPU has them
+ */
+static void sha2_process_blocks(sha2_context * ctx, const uint8_t *data,
+			       size_t nblocks)
+{
+#if defined(TROPICSSL_SHANI) && defined(TROPICSSL_HAVE_X86_64)
+	if (shani_supports(TROPICSSL_SHANI_SHA)) {
+		shani_sha256_process(ctx->state, data, nblocks);
+		return;
+	}
+
+	if (shani_supports(TROPICSSL_SHANI_SSSE3)) {
+		shani_sha256_process_simd(ctx->state, data, nblocks);
+		return;
+	}
+#endif
+
+#if defined(TROPICSSL_SHACE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (shace_supports(TROPICSSL_SHACE_SHA256)) {
+		shace_sha256_process(ctx->state, data, nblocks);
+		return;
+	}
+#endif
+
+	while (nblocks-- > 0) {
+		sha2_process(ctx, data);
+		data += 64;
+	}
+}
+
 /*
  * SHA-256 process buffer
  */
@@ -256,16 +296,16 @@ void sha2_update(sha2_context * ctx, const uint8_t *input, size_t ilen)
 
 	if (left && ilen >= fill) {
 		memcpy((void *)(ctx->buffer + left), (void *)input, fill);
-		sha2_process(ctx, ctx->buffer);
+		sha2_process_blocks(ctx, ctx->buffer, 1);
 		input += fill;
 		ilen -= fill;
 		left = 0;
 	}
 
-	while (ilen >= 64) {
-		sha2_process(ctx, input);
-		input += 64;
-		ilen -= 64;
+	if (ilen >= 64) {
+		sha2_process_blocks(ctx, input, ilen / 64);
+		input += ilen & ~(size_t)63;
+		ilen &= 63;
 	}
 
 	if (ilen > 0) {
@@ -369,6 +409,7 @@ void sha2_hmac_starts(sha2_context * ctx, const uint8_t *key, size_t keylen,
 {
 	size_t i;
 	uint8_t sum[32];
+	uint8_t pad[64];
 
 	if (keylen > 64) {
 		sha2(key, keylen, sum, is224);
@@ -376,18 +417,27 @@ void sha2_hmac_starts(sha2_context * ctx, const uint8_t *key, size_t keylen,
 		key = sum;
 	}
 
-	memset(ctx->ipad, 0x36, 64);
-	memset(ctx->opad, 0x5C, 64);
+	/*
+	 * Hash each padded key block once and keep the two states
+	 */
+	memset(pad, 0x5C, 64);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
-	for (i = 0; i < keylen; i++) {
-		ctx->ipad[i] = (uint8_t)(ctx->ipad[i] ^ key[i]);
-		ctx->opad[i] = (uint8_t)(ctx->opad[i] ^ key[i]);
-	}
+	sha2_starts(ctx, is224);
+	sha2_update(ctx, pad, 64);
+	memcpy(ctx->ostate, ctx->state, sizeof(ctx->ostate));
+
+	memset(pad, 0x36, 64);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
 	sha2_starts(ctx, is224);
-	sha2_update(ctx, ctx->ipad, 64);
+	sha2_update(ctx, pad, 64);
+	memcpy(ctx->istate, ctx->state, sizeof(ctx->istate));
 
 	memset(sum, 0, sizeof(sum));
+	memset(pad, 0, sizeof(pad));
 }
 
 /*
@@ -410,14 +460,25 @@ void sha2_hmac_finish(sha2_context * ctx, uint8_t output[32])
 	hlen = (is224 == 0) ? 32 : 28;
 
 	sha2_finish(ctx, tmpbuf);
-	sha2_starts(ctx, is224);
-	sha2_update(ctx, ctx->opad, 64);
+	memcpy(ctx->state, ctx->ostate, sizeof(ctx->state));
+	ctx->total[0] = 64;
+	ctx->total[1] = 0;
 	sha2_update(ctx, tmpbuf, hlen);
 	sha2_finish(ctx, output);
 
 	memset(tmpbuf, 0, sizeof(tmpbuf));
 }
 
+/*
+ * SHA-256 HMAC context reset
+ */
+void sha2_hmac_reset(sha2_context * ctx)
+{
+	memcpy(ctx->state, ctx->istate, sizeof(ctx->state));
+	ctx->total[0] = 64;
+	ctx->total[1] = 0;
+}
+
 /*
  * output = HMAC-SHA-256( hmac key, input buffer )
  */
@@ -688,6 +749,21 @@ int sha2_self_test(int verbose)
 			return (1);
 		}
 
+		/*
+		 * Same key again, from the saved key states
+		 */
+		sha2_hmac_reset(&ctx);
+		sha2_hmac_update(&ctx, sha2_hmac_test_buf[j],
+				 sha2_hmac_test_buflen[j]);
+		sha2_hmac_finish(&ctx, sha2sum);
+
+		if (memcmp(sha2sum, sha2_hmac_test_sum[i], buflen) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+
 		if (verbose != 0)
 			printf("passed\n");
 	}
@@ -368,6 +368,7 @@ void sha4_hmac_starts(sha4_context * ctx, const uint8_t *key, size_t keylen,
 {
 	size_t i;
 	uint8_t sum[64];
+	uint8_t pad[128];
 
 	if (keylen > 128) {
 		sha4(key, keylen, sum, is384);
@@ -375,18 +376,27 @@ void sha4_hmac_starts(sha4_context * ctx, const uint8_t *key, size_t keylen,
 		key = sum;
 	}
 
-	memset(ctx->ipad, 0x36, 128);
-	memset(ctx->opad, 0x5C, 128);
+	/*
+	 * Hash each padded key block once and keep the two states
+	 */
+	memset(pad, 0x5C, 128);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
-	for (i = 0; i < keylen; i++) {
-		ctx->ipad[i] = (uint8_t)(ctx->ipad[i] ^ key[i]);
-		ctx->opad[i] = (uint8_t)(ctx->opad[i] ^ key[i]);
-	}
+	sha4_starts(ctx, is384);
+	sha4_update(ctx, pad, 128);
+	memcpy(ctx->ostate, ctx->state, sizeof(ctx->ostate));
+
+	memset(pad, 0x36, 128);
+	for (i = 0; i < keylen; i++)
+		pad[i] = (uint8_t)(pad[i] ^ key[i]);
 
 	sha4_starts(ctx, is384);
-	sha4_update(ctx, ctx->ipad, 128);
+	sha4_update(ctx, pad, 128);
+	memcpy(ctx->istate, ctx->state, sizeof(ctx->istate));
 
 	memset(sum, 0, sizeof(sum));
+	memset(pad, 0, sizeof(pad));
 }
 
 /*
@@ -409,14 +419,25 @@ void sha4_hmac_finish(sha4_context * ctx, uint8_t output[64])
 	hlen = (is384 == 0) ? 64 : 48;
 
 	sha4_finish(ctx, tmpbuf);
-	sha4_starts(ctx, is384);
-	sha4_update(ctx, ctx->opad, 128);
+	memcpy(ctx->state, ctx->ostate, sizeof(ctx->state));
+	ctx->total[0] = 128;
+	ctx->total[1] = 0;
 	sha4_update(ctx, tmpbuf, hlen);
 	sha4_finish(ctx, output);
 
 	memset(tmpbuf, 0, sizeof(tmpbuf));
 }
 
+/*
+ * SHA-512 HMAC context reset
+ */
+void sha4_hmac_reset(sha4_context * ctx)
+{
+	memcpy(ctx->state, ctx->istate, sizeof(ctx->state));
+	ctx->total[0] = 128;
+	ctx->total[1] = 0;
+}
+
 /*
  * output = HMAC-SHA-512( hmac key, input buffer )
  */
@@ -745,6 +766,21 @@ int sha4_self_test(int verbose)
 			return (1);
 		}
 
+		/*
+		 * Same key again, from the saved key states
+		 */
+		sha4_hmac_reset(&ctx);
+		sha4_hmac_update(&ctx, sha4_hmac_test_buf[j],
+				 sha4_hmac_test_buflen[j]);
+		sha4_hmac_finish(&ctx, sha4sum);
+
+		if (memcmp(sha4sum, sha4_hmac_test_sum[i], buflen) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+
+			return (1);
+		}
+
 		if (verbose != 0)
 			printf("passed\n");
 	}
@@ -0,0 +1,229 @@
+/*
+ *  ARMv8 SHA instructions support functions
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SHACE)
+
+#include "tropicssl/shace.h"
+
+#if defined(TROPICSSL_HAVE_ARMV8)
+
+/*
+ * Enable the SHA instructions for this file only, as in aesce.c
+ */
+#if !defined(__ARM_FEATURE_CRYPTO) && !defined(__ARM_FEATURE_SHA2)
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sha2"))), apply_to = function)
+#define SHACE_POP_TARGET
+#else
+#pragma GCC push_options
+#pragma GCC target ("+crypto")
+#define SHACE_POP_TARGET
+#endif
+#endif
+
+#include <arm_neon.h>
+
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/*
+ * ARMv8 SHA instructions detection routine
+ */
+int shace_supports(unsigned int what)
+{
+#if defined(__linux__)
+	static int done = 0;
+	static unsigned int flags = 0;
+
+	if (done == 0) {
+		unsigned long hwcap = getauxval(AT_HWCAP);
+
+		if (hwcap & HWCAP_SHA1)
+			flags |= TROPICSSL_SHACE_SHA1;
+		if (hwcap & HWCAP_SHA2)
+			flags |= TROPICSSL_SHACE_SHA256;
+
+		done = 1;
+	}
+
+	return ((flags & what) != 0);
+#elif defined(__APPLE__)
+	/* every 64-bit Apple core has SHA1 and SHA256 */
+	(void)what;
+	return (1);
+#else
+	(void)what;
+	return (0);
+#endif
+}
+
+#define SHACE_LOAD_BE(p) vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)))
+
+static const uint32_t shace_k1[4] = {
+	0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+};
+
+/*
+ * SHA-1 compression of whole blocks
+ */
+void shace_sha1_process(uint32_t state[5], const uint8_t *data,
+			size_t nblocks)
+{
+	uint32x4_t abcd, abcd_save, w[4], wk;
+	uint32_t e, e_next, e_save;
+	int i;
+
+	abcd = vld1q_u32(state);
+	e = state[4];
+
+	while (nblocks-- > 0) {
+		abcd_save = abcd;
+		e_save = e;
+
+		w[0] = SHACE_LOAD_BE(data);
+		w[1] = SHACE_LOAD_BE(data + 16);
+		w[2] = SHACE_LOAD_BE(data + 32);
+		w[3] = SHACE_LOAD_BE(data + 48);
+
+		/*
+		 * Four rounds per instruction; from group four on, the
+		 * message words are extended in place with SHA1SU0/SU1.
+		 */
+		for (i = 0; i < 20; i++) {
+			if (i >= 4)
+				w[i & 3] = vsha1su1q_u32(vsha1su0q_u32(w[i & 3],
+								       w[(i + 1) & 3],
+								       w[(i + 2) & 3]),
+							 w[(i + 3) & 3]);
+
+			wk = vaddq_u32(w[i & 3], vdupq_n_u32(shace_k1[i / 5]));
+			e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+			if (i < 5)
+				abcd = vsha1cq_u32(abcd, e, wk);
+			else if (i < 10 || i >= 15)
+				abcd = vsha1pq_u32(abcd, e, wk);
+			else
+				abcd = vsha1mq_u32(abcd, e, wk);
+
+			e = e_next;
+		}
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		e += e_save;
+
+		data += 64;
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e;
+}
+
+static const uint32_t shace_k256[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+/*
+ * SHA-256 compression of whole blocks
+ */
+void shace_sha256_process(uint32_t state[8], const uint8_t *data,
+			  size_t nblocks)
+{
+	uint32x4_t abcd, efgh, abcd_save, efgh_save, abcd_prev, w[4], wk;
+	int i;
+
+	abcd = vld1q_u32(state);
+	efgh = vld1q_u32(state + 4);
+
+	while (nblocks-- > 0) {
+		abcd_save = abcd;
+		efgh_save = efgh;
+
+		w[0] = SHACE_LOAD_BE(data);
+		w[1] = SHACE_LOAD_BE(data + 16);
+		w[2] = SHACE_LOAD_BE(data + 32);
+		w[3] = SHACE_LOAD_BE(data + 48);
+
+		for (i = 0; i < 16; i++) {
+			if (i >= 4)
+				w[i & 3] = vsha256su1q_u32(vsha256su0q_u32(w[i & 3],
+									   w[(i + 1) & 3]),
+							   w[(i + 2) & 3],
+							   w[(i + 3) & 3]);
+
+			wk = vaddq_u32(w[i & 3], vld1q_u32(shace_k256 + 4 * i));
+
+			abcd_prev = abcd;
+			abcd = vsha256hq_u32(abcd_prev, efgh, wk);
+			efgh = vsha256h2q_u32(efgh, abcd_prev, wk);
+		}
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		efgh = vaddq_u32(efgh, efgh_save);
+
+		data += 64;
+	}
+
+	vst1q_u32(state, abcd);
+	vst1q_u32(state + 4, efgh);
+}
+
+#if defined(SHACE_POP_TARGET)
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+
+#endif
+#endif
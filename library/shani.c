@@ -0,0 +1,438 @@
+/*
+ *  SHA extensions support functions
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  The SHA extensions were announced by Intel in 2013.
+ *
+ *  https://software.intel.com/en-us/articles/intel-sha-extensions
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SHANI)
+
+#include "tropicssl/shani.h"
+
+#if defined(TROPICSSL_HAVE_X86_64)
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+
+/*
+ * As in aesni.c the accelerated code paths are compiled for the
+ * instructions they use and only reached after shani_supports().
+ */
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+#define SHANI_LOAD(p)       _mm_loadu_si128((const __m128i *)(p))
+#define SHANI_STORE(p,x)    _mm_storeu_si128((__m128i *)(p), (x))
+
+/*
+ * SHA extensions support detection routine
+ */
+int shani_supports(unsigned int what)
+{
+	static int done = 0;
+	static unsigned int flags = 0;
+
+	if (done == 0) {
+		unsigned int a, b, c, d, xcr0 = 0;
+		int avx = 0;
+
+		if (__get_cpuid(1, &a, &b, &c, &d) != 0) {
+			if (c & 0x00000200u)
+				flags |= TROPICSSL_SHANI_SSSE3;
+
+			/*
+			 * AVX is usable only when the OS saves the YMM
+			 * registers (OSXSAVE and XCR0 bits 1 and 2).
+			 */
+			if ((c & 0x18000000u) == 0x18000000u) {
+				__asm__ volatile ("xgetbv" : "=a" (xcr0),
+						  "=d" (d) : "c" (0));
+				avx = (xcr0 & 6) == 6;
+			}
+		}
+
+		if (__get_cpuid_max(0, NULL) >= 7) {
+			__cpuid_count(7, 0, a, b, c, d);
+
+			if (b & 0x20000000u)
+				flags |= TROPICSSL_SHANI_SHA;
+
+			if ((b & 0x00000020u) && avx)
+				flags |= TROPICSSL_SHANI_AVX2;
+		}
+
+		done = 1;
+	}
+
+	return ((flags & what) != 0);
+}
+
+/*
+ * SHA-1 compression, four rounds per SHA1RNDS4; the message words
+ * for the next group are prepared by SHA1MSG1/SHA1MSG2 while the
+ * current group runs.
+ *
+ * G(n, e_in, e_out, m, m1, m2, m3) runs group n with m holding
+ * W[4n..4n+3] and m1, m2, m3 the next / previous / one-before-previous
+ * message registers.
+ */
+#define SHANI_SHA1_G(n,ei,eo,m,m1,m2,m3)                         \
+{                                                                \
+    if ((n) == 0)                                                \
+        ei = _mm_add_epi32(ei, m);                               \
+    else                                                         \
+        ei = _mm_sha1nexte_epu32(ei, m);                         \
+    eo = abcd;                                                   \
+    if ((n) >= 3 && (n) <= 18)                                   \
+        m1 = _mm_sha1msg2_epu32(m1, m);                          \
+    abcd = _mm_sha1rnds4_epu32(abcd, ei, (n) / 5);               \
+    if ((n) >= 1 && (n) <= 16)                                   \
+        m3 = _mm_sha1msg1_epu32(m3, m);                          \
+    if ((n) >= 2 && (n) <= 17)                                   \
+        m2 = _mm_xor_si128(m2, m);                               \
+}
+
+SHANI_TARGET void shani_sha1_process(uint32_t state[5],
+				      const uint8_t *data, size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090A0B0C0D0E0FULL);
+	__m128i abcd, e0, e1, m0, m1, m2, m3, abcd_save, e_save;
+
+	abcd = _mm_shuffle_epi32(SHANI_LOAD(state), 0x1B);
+	e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	while (nblocks-- > 0) {
+		abcd_save = abcd;
+		e_save = e0;
+
+		m0 = _mm_shuffle_epi8(SHANI_LOAD(data), mask);
+		m1 = _mm_shuffle_epi8(SHANI_LOAD(data + 16), mask);
+		m2 = _mm_shuffle_epi8(SHANI_LOAD(data + 32), mask);
+		m3 = _mm_shuffle_epi8(SHANI_LOAD(data + 48), mask);
+
+		SHANI_SHA1_G(0, e0, e1, m0, m1, m2, m3);
+		SHANI_SHA1_G(1, e1, e0, m1, m2, m3, m0);
+		SHANI_SHA1_G(2, e0, e1, m2, m3, m0, m1);
+		SHANI_SHA1_G(3, e1, e0, m3, m0, m1, m2);
+		SHANI_SHA1_G(4, e0, e1, m0, m1, m2, m3);
+		SHANI_SHA1_G(5, e1, e0, m1, m2, m3, m0);
+		SHANI_SHA1_G(6, e0, e1, m2, m3, m0, m1);
+		SHANI_SHA1_G(7, e1, e0, m3, m0, m1, m2);
+		SHANI_SHA1_G(8, e0, e1, m0, m1, m2, m3);
+		SHANI_SHA1_G(9, e1, e0, m1, m2, m3, m0);
+		SHANI_SHA1_G(10, e0, e1, m2, m3, m0, m1);
+		SHANI_SHA1_G(11, e1, e0, m3, m0, m1, m2);
+		SHANI_SHA1_G(12, e0, e1, m0, m1, m2, m3);
+		SHANI_SHA1_G(13, e1, e0, m1, m2, m3, m0);
+		SHANI_SHA1_G(14, e0, e1, m2, m3, m0, m1);
+		SHANI_SHA1_G(15, e1, e0, m3, m0, m1, m2);
+		SHANI_SHA1_G(16, e0, e1, m0, m1, m2, m3);
+		SHANI_SHA1_G(17, e1, e0, m1, m2, m3, m0);
+		SHANI_SHA1_G(18, e0, e1, m2, m3, m0, m1);
+		SHANI_SHA1_G(19, e1, e0, m3, m0, m1, m2);
+
+		e0 = _mm_sha1nexte_epu32(e0, e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+
+		data += 64;
+	}
+
+	SHANI_STORE(state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static const uint32_t shani_k256[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+/*
+ * SHA-256 compression, two rounds per SHA256RNDS2 on the ABEF / CDGH
+ * halves of the state; G(n, m, m1, m3, ...) runs rounds 4n..4n+3 with
+ * m holding W[4n..4n+3], m1 the next and m3 the previous registers.
+ */
+#define SHANI_SHA256_G(n,m,m1,m3)                                \
+{                                                                \
+    msg = _mm_add_epi32(m, SHANI_LOAD(shani_k256 + 4 * (n)));    \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);               \
+    if ((n) >= 3 && (n) <= 14) {                                 \
+        tmp = _mm_alignr_epi8(m, m3, 4);                         \
+        m1 = _mm_add_epi32(m1, tmp);                             \
+        m1 = _mm_sha256msg2_epu32(m1, m);                        \
+    }                                                            \
+    msg = _mm_shuffle_epi32(msg, 0x0E);                          \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);               \
+    if ((n) >= 1 && (n) <= 12)                                   \
+        m3 = _mm_sha256msg1_epu32(m3, m);                        \
+}
+
+SHANI_TARGET void shani_sha256_process(uint32_t state[8],
+					const uint8_t *data, size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0C0D0E0F08090A0BULL,
+					    0x0405060700010203ULL);
+	__m128i abef, cdgh, msg, tmp, m0, m1, m2, m3, abef_save, cdgh_save;
+
+	tmp = _mm_shuffle_epi32(SHANI_LOAD(state), 0xB1);	/* CDAB */
+	cdgh = _mm_shuffle_epi32(SHANI_LOAD(state + 4), 0x1B);	/* EFGH */
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+	while (nblocks-- > 0) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+
+		m0 = _mm_shuffle_epi8(SHANI_LOAD(data), mask);
+		m1 = _mm_shuffle_epi8(SHANI_LOAD(data + 16), mask);
+		m2 = _mm_shuffle_epi8(SHANI_LOAD(data + 32), mask);
+		m3 = _mm_shuffle_epi8(SHANI_LOAD(data + 48), mask);
+
+		SHANI_SHA256_G(0, m0, m1, m3);
+		SHANI_SHA256_G(1, m1, m2, m0);
+		SHANI_SHA256_G(2, m2, m3, m1);
+		SHANI_SHA256_G(3, m3, m0, m2);
+		SHANI_SHA256_G(4, m0, m1, m3);
+		SHANI_SHA256_G(5, m1, m2, m0);
+		SHANI_SHA256_G(6, m2, m3, m1);
+		SHANI_SHA256_G(7, m3, m0, m2);
+		SHANI_SHA256_G(8, m0, m1, m3);
+		SHANI_SHA256_G(9, m1, m2, m0);
+		SHANI_SHA256_G(10, m2, m3, m1);
+		SHANI_SHA256_G(11, m3, m0, m2);
+		SHANI_SHA256_G(12, m0, m1, m3);
+		SHANI_SHA256_G(13, m1, m2, m0);
+		SHANI_SHA256_G(14, m2, m3, m1);
+		SHANI_SHA256_G(15, m3, m0, m2);
+
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(abef, 0x1B);	/* FEBA */
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);	/* DCHG */
+	abef = _mm_blend_epi16(tmp, cdgh, 0xF0);	/* DCBA */
+	cdgh = _mm_alignr_epi8(cdgh, tmp, 8);	/* HGFE */
+
+	SHANI_STORE(state, abef);
+	SHANI_STORE(state + 4, cdgh);
+}
+
+/*
+ * SHA-256 fallback for CPUs without the SHA extensions: the message
+ * schedule (plus the round constants) is computed four words at a
+ * time in vector registers ahead of the rounds, which leaves the
+ * scalar round function alone on the critical path.  The schedule
+ * only needs SSE2; it is instantiated once for SSSE3-class CPUs and
+ * once with VEX encoding for AVX2-class ones.
+ *
+ * SHA-1 has no such path: its schedule is cheap enough that moving it
+ * to vector registers did not beat the plain C code.
+ */
+#define SHANI_ROTL(x,n)                                          \
+    _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+#define SHANI_ROR32(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define SHANI_GET_BE(p)                                          \
+    (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) |       \
+     ((uint32_t)(p)[2] <<  8) | ((uint32_t)(p)[3]      ))
+
+#define SHANI_SET_BE(p)                                          \
+    _mm_set_epi32((int)SHANI_GET_BE((p) + 12),                   \
+                  (int)SHANI_GET_BE((p) + 8),                    \
+                  (int)SHANI_GET_BE((p) + 4),                    \
+                  (int)SHANI_GET_BE((p)))
+
+/*
+ * w[i..i+3] >> 32 * n, i.e. the words starting n lanes into lo:hi
+ */
+#define SHANI_SPLICE(lo,hi,n)                                    \
+    _mm_or_si128(_mm_srli_si128(lo, 4 * (n)),                    \
+                 _mm_slli_si128(hi, 16 - 4 * (n)))
+
+#define SHANI_CH(x,y,z) (z ^ (x & (y ^ z)))
+#define SHANI_MAJ(x,y,z) ((x & y) | (z & (x | y)))
+
+#define SHANI_S0(x) (SHANI_ROR32(x, 2) ^ SHANI_ROR32(x,13) ^ SHANI_ROR32(x,22))
+#define SHANI_S1(x) (SHANI_ROR32(x, 6) ^ SHANI_ROR32(x,11) ^ SHANI_ROR32(x,25))
+
+#define SHANI_P8(a,b,c,d,e,f,g,h,i)                              \
+{                                                                \
+    temp1 = SHANI_S1(e) + (SHANI_CH(e, f, g) + (h + wk[i]));     \
+    temp2 = SHANI_S0(a) + SHANI_MAJ(a, b, c);                     \
+    d += temp1; h = temp1 + temp2;                               \
+}
+
+static inline __attribute__((always_inline))
+__m128i shani_sigma0(__m128i x)
+{
+	return (_mm_xor_si128(_mm_xor_si128(SHANI_ROTL(x, 25),
+					    SHANI_ROTL(x, 14)),
+			      _mm_srli_epi32(x, 3)));
+}
+
+static inline __attribute__((always_inline))
+__m128i shani_sigma1(__m128i x)
+{
+	return (_mm_xor_si128(_mm_xor_si128(SHANI_ROTL(x, 15),
+					    SHANI_ROTL(x, 13)),
+			      _mm_srli_epi32(x, 10)));
+}
+
+#define SHANI_STORE_WK(t,x)                                      \
+    _mm_store_si128((__m128i *)(wk + (t)),                       \
+                    _mm_add_epi32(x, SHANI_LOAD(shani_k256 + (t))))
+
+static inline __attribute__((always_inline))
+void shani_sha256_simd(uint32_t state[8], const uint8_t *data,
+		       size_t nblocks)
+{
+	uint32_t wk[64] __attribute__((aligned(16)));
+	uint32_t temp1, temp2, A, B, C, D, E, F, G, H;
+	__m128i x0, x1, x2, x3, w;
+	int t;
+
+	while (nblocks-- > 0) {
+		x0 = SHANI_SET_BE(data);
+		x1 = SHANI_SET_BE(data + 16);
+		x2 = SHANI_SET_BE(data + 32);
+		x3 = SHANI_SET_BE(data + 48);
+
+		SHANI_STORE_WK(0, x0);
+		SHANI_STORE_WK(4, x1);
+		SHANI_STORE_WK(8, x2);
+		SHANI_STORE_WK(12, x3);
+
+		/*
+		 * W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16]; the
+		 * upper two lanes need s1 of the lower two, so the s1
+		 * term is added in two halves.
+		 */
+		for (t = 16; t < 64; t += 4) {
+			w = _mm_add_epi32(x0, shani_sigma0(SHANI_SPLICE(x0,
+									x1,
+									1)));
+			w = _mm_add_epi32(w, SHANI_SPLICE(x2, x3, 1));
+			w = _mm_add_epi32(w, shani_sigma1(_mm_srli_si128(x3,
+									 8)));
+			w = _mm_add_epi32(w, shani_sigma1(_mm_slli_si128(w,
+									 8)));
+
+			SHANI_STORE_WK(t, w);
+
+			x0 = x1;
+			x1 = x2;
+			x2 = x3;
+			x3 = w;
+		}
+
+		A = state[0];
+		B = state[1];
+		C = state[2];
+		D = state[3];
+		E = state[4];
+		F = state[5];
+		G = state[6];
+		H = state[7];
+
+		for (t = 0; t < 64; t += 8) {
+			SHANI_P8(A, B, C, D, E, F, G, H, t);
+			SHANI_P8(H, A, B, C, D, E, F, G, t + 1);
+			SHANI_P8(G, H, A, B, C, D, E, F, t + 2);
+			SHANI_P8(F, G, H, A, B, C, D, E, t + 3);
+			SHANI_P8(E, F, G, H, A, B, C, D, t + 4);
+			SHANI_P8(D, E, F, G, H, A, B, C, t + 5);
+			SHANI_P8(C, D, E, F, G, H, A, B, t + 6);
+			SHANI_P8(B, C, D, E, F, G, H, A, t + 7);
+		}
+
+		state[0] += A;
+		state[1] += B;
+		state[2] += C;
+		state[3] += D;
+		state[4] += E;
+		state[5] += F;
+		state[6] += G;
+		state[7] += H;
+
+		data += 64;
+	}
+}
+
+__attribute__((target("avx2")))
+static void shani_sha256_avx2(uint32_t state[8], const uint8_t *data,
+			      size_t nblocks)
+{
+	shani_sha256_simd(state, data, nblocks);
+}
+
+__attribute__((target("ssse3")))
+static void shani_sha256_ssse3(uint32_t state[8], const uint8_t *data,
+			       size_t nblocks)
+{
+	shani_sha256_simd(state, data, nblocks);
+}
+
+void shani_sha256_process_simd(uint32_t state[8], const uint8_t *data,
+			       size_t nblocks)
+{
+	if (shani_supports(TROPICSSL_SHANI_AVX2))
+		shani_sha256_avx2(state, data, nblocks);
+	else
+		shani_sha256_ssse3(state, data, nblocks);
+}
+
+#endif
+#endif
@@ -0,0 +1,286 @@
+/*
+ *  Handshake admission control: a token bucket for full handshakes
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_ADMIT_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/ssl_admit.h"
+
+#include <string.h>
+
+#if !defined(WIN32)
+#include <sys/time.h>
+#endif
+
+#if defined(WIN32)
+#define SSL_ADMIT_LOCK(a)       EnterCriticalSection(&(a)->lock)
+#define SSL_ADMIT_UNLOCK(a)     LeaveCriticalSection(&(a)->lock)
+#else
+#define SSL_ADMIT_LOCK(a)       pthread_mutex_lock(&(a)->lock)
+#define SSL_ADMIT_UNLOCK(a)     pthread_mutex_unlock(&(a)->lock)
+#endif
+
+/*
+ * A full handshake costs one token, kept in thousandths so that
+ * low rates still refill every millisecond
+ */
+#define SSL_ADMIT_TOKEN         1000
+
+/*
+ * Milliseconds from some fixed point; never 0, which ssl->admit_since
+ * keeps for "not deferred"
+ */
+static unsigned long ssl_admit_now(void)
+{
+	unsigned long ms;
+#if defined(WIN32)
+	ms = (unsigned long)GetTickCount();
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	ms = (unsigned long)tv.tv_sec * 1000 +
+	    (unsigned long)tv.tv_usec / 1000;
+#endif
+
+	return ((ms != 0) ? ms : 1);
+}
+
+/*
+ * Add the tokens earned since the last refill, up to the burst
+ */
+static void ssl_admit_refill(ssl_admit_context * admit, unsigned long now)
+{
+	uint64_t max = (uint64_t)admit->burst * SSL_ADMIT_TOKEN;
+
+	/*
+	 * A clock stepping back earns nothing
+	 */
+	if ((long)(now - admit->last) > 0)
+		admit->tokens += (uint64_t)(now - admit->last) * admit->rate;
+
+	admit->last = now;
+
+	if (admit->tokens > max)
+		admit->tokens = max;
+}
+
+void ssl_admit_init(ssl_admit_context * admit, int rate, int burst,
+		    int max_wait)
+{
+	memset(admit, 0, sizeof(ssl_admit_context));
+
+#if defined(WIN32)
+	InitializeCriticalSection(&admit->lock);
+#else
+	pthread_mutex_init(&admit->lock, NULL);
+#endif
+
+	admit->rate = (rate > 0) ? rate : 1;
+	admit->burst = (burst > 0) ? burst : 1;
+	admit->max_wait = (max_wait > 0) ? max_wait : 0;
+	admit->tokens = (uint64_t)admit->burst * SSL_ADMIT_TOKEN;
+	admit->last = ssl_admit_now();
+}
+
+void ssl_admit_set_rate(ssl_admit_context * admit, int rate, int burst)
+{
+	SSL_ADMIT_LOCK(admit);
+
+	ssl_admit_refill(admit, ssl_admit_now());
+
+	admit->rate = (rate > 0) ? rate : 1;
+	admit->burst = (burst > 0) ? burst : 1;
+
+	if (admit->tokens > (uint64_t)admit->burst * SSL_ADMIT_TOKEN)
+		admit->tokens = (uint64_t)admit->burst * SSL_ADMIT_TOKEN;
+
+	SSL_ADMIT_UNLOCK(admit);
+}
+
+void ssl_set_admission_control(ssl_context * ssl, ssl_admit_context * admit)
+{
+	ssl_set_admission(ssl, ssl_admit_check, admit);
+}
+
+/*
+ * Resumptions cost little and always go; a full handshake takes a
+ * token, or waits for one (the caller asks again) until max_wait
+ */
+int ssl_admit_check(void *p_admit, ssl_context * ssl, int resume)
+{
+	int ret = 0;
+	unsigned long now;
+	ssl_admit_context *admit = (ssl_admit_context *) p_admit;
+
+	if (resume != 0) {
+		SSL_ADMIT_LOCK(admit);
+		admit->resumed++;
+		SSL_ADMIT_UNLOCK(admit);
+
+		return (0);
+	}
+
+	now = ssl_admit_now();
+
+	SSL_ADMIT_LOCK(admit);
+
+	ssl_admit_refill(admit, now);
+
+	if (admit->tokens >= SSL_ADMIT_TOKEN) {
+		admit->tokens -= SSL_ADMIT_TOKEN;
+		admit->full++;
+		ssl->admit_since = 0;
+	} else {
+		if (ssl->admit_since == 0) {
+			ssl->admit_since = now;
+			admit->deferred++;
+		}
+
+		if (now - ssl->admit_since < (unsigned long)admit->max_wait)
+			ret = TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED;
+		else {
+			admit->refused++;
+			ssl->admit_since = 0;
+			ret = TROPICSSL_ERR_SSL_HANDSHAKE_REFUSED;
+		}
+	}
+
+	SSL_ADMIT_UNLOCK(admit);
+
+	return (ret);
+}
+
+void ssl_admit_free(ssl_admit_context * admit)
+{
+#if defined(WIN32)
+	DeleteCriticalSection(&admit->lock);
+#else
+	pthread_mutex_destroy(&admit->lock);
+#endif
+
+	memset(admit, 0, sizeof(ssl_admit_context));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * Checkup routine
+ */
+int ssl_admit_self_test(int verbose)
+{
+	int i;
+	ssl_context ssl;
+	ssl_admit_context admit;
+
+	if (verbose != 0)
+		printf("  SSL admission control test: ");
+
+	memset(&ssl, 0, sizeof(ssl_context));
+
+	/*
+	 * A bucket of two and one more per second: two full handshakes
+	 * go, the third waits, resumptions do not
+	 */
+	ssl_admit_init(&admit, 1, 2, 100);
+	ssl_set_admission_control(&ssl, &admit);
+
+	for (i = 0; i < 2; i++)
+		if (ssl_admit_check(&admit, &ssl, 0) != 0)
+			goto fail;
+
+	if (ssl_admit_check(&admit, &ssl, 0) !=
+	    TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED || ssl.admit_since == 0)
+		goto fail;
+
+	if (ssl_admit_check(&admit, &ssl, 1) != 0)
+		goto fail;
+
+	/*
+	 * Waited too long: refused
+	 */
+	ssl.admit_since -= 100;
+
+	if (ssl_admit_check(&admit, &ssl, 0) !=
+	    TROPICSSL_ERR_SSL_HANDSHAKE_REFUSED || ssl.admit_since != 0)
+		goto fail;
+
+	/*
+	 * A second later there is one token, not two
+	 */
+	admit.last -= 1000;
+
+	if (ssl_admit_check(&admit, &ssl, 0) != 0 ||
+	    ssl_admit_check(&admit, &ssl, 0) == 0)
+		goto fail;
+
+	if (admit.full != 3 || admit.resumed != 1 || admit.deferred != 2 ||
+	    admit.refused != 1)
+		goto fail;
+
+	ssl_admit_free(&admit);
+
+	/*
+	 * No waiting at all
+	 */
+	ssl_admit_init(&admit, 1, 1, 0);
+	ssl.admit_since = 0;
+
+	if (ssl_admit_check(&admit, &ssl, 0) != 0 ||
+	    ssl_admit_check(&admit, &ssl, 0) !=
+	    TROPICSSL_ERR_SSL_HANDSHAKE_REFUSED)
+		goto fail;
+
+	ssl_admit_free(&admit);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	ssl_admit_free(&admit);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,573 @@
+/*
+ *  Sharded server-side session cache
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_CACHE_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/ssl_cache.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct _ssl_cache_entry {
+	ssl_session session;
+	ssl_cache_entry *hnext;	/* next in the hash bucket       */
+	ssl_cache_entry *prev;	/* more recently used            */
+	ssl_cache_entry *next;	/* less recently used            */
+	uint8_t *key;		/* lookup key, after the entry   */
+	size_t keylen;
+};
+
+/*
+ * A server looks sessions up by id, a client by the port and name
+ * of the server it connects to
+ */
+#define SSL_CACHE_KEY_MAX       (2 + 255)
+
+#if defined(WIN32)
+#define SSL_CACHE_LOCK(s)       EnterCriticalSection(&(s)->lock)
+#define SSL_CACHE_UNLOCK(s)     LeaveCriticalSection(&(s)->lock)
+#else
+#define SSL_CACHE_LOCK(s)       pthread_mutex_lock(&(s)->lock)
+#define SSL_CACHE_UNLOCK(s)     pthread_mutex_unlock(&(s)->lock)
+#endif
+
+/*
+ * FNV-1a over the key: the low bits pick the shard, the others the
+ * bucket. Stored ids come from the server's RNG.
+ */
+static unsigned long ssl_cache_hash(const uint8_t *id, size_t len)
+{
+	unsigned long h = 2166136261UL;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = ((h ^ id[i]) * 16777619UL) & 0xFFFFFFFFUL;
+
+	return (h);
+}
+
+static ssl_cache_entry **ssl_cache_bucket(ssl_cache_shard * shard,
+					  unsigned long h)
+{
+	return (&shard->table[(h / SSL_CACHE_SHARDS) & shard->mask]);
+}
+
+static ssl_cache_entry **ssl_cache_find(ssl_cache_shard * shard,
+					unsigned long h,
+					const uint8_t *key, size_t keylen)
+{
+	ssl_cache_entry **pp, *e;
+
+	for (pp = ssl_cache_bucket(shard, h); (e = *pp) != NULL;
+	     pp = &e->hnext) {
+		if (e->keylen == keylen && memcmp(e->key, key, keylen) == 0)
+			break;
+	}
+
+	return (pp);
+}
+
+/*
+ * The key of the session of ssl; 1 if it has none
+ */
+static int ssl_cache_key(const ssl_context * ssl, uint8_t *key,
+			 size_t *keylen)
+{
+	const ssl_session *session = ssl->session;
+
+	if (ssl->endpoint == SSL_IS_SERVER) {
+		if (session->length > sizeof(session->id))
+			return (1);
+
+		memcpy(key, session->id, session->length);
+		*keylen = session->length;
+		return (0);
+	}
+
+	if (ssl->hostname == NULL || ssl->hostname_len > 255)
+		return (1);
+
+	key[0] = (uint8_t)(ssl->scb_port >> 8);
+	key[1] = (uint8_t)(ssl->scb_port);
+	memcpy(key + 2, ssl->hostname, ssl->hostname_len);
+	*keylen = 2 + ssl->hostname_len;
+
+	return (0);
+}
+
+/*
+ * Copy a session, with a ticket of its own
+ */
+static int ssl_cache_copy(ssl_session * dst, const ssl_session * src)
+{
+	memcpy(dst, src, sizeof(ssl_session));
+	dst->next = NULL;
+
+	if (src->ticket == NULL)
+		return (0);
+
+	if ((dst->ticket = (uint8_t *)malloc(src->ticket_len)) == NULL) {
+		dst->ticket_len = 0;
+		return (1);
+	}
+
+	memcpy(dst->ticket, src->ticket, src->ticket_len);
+
+	return (0);
+}
+
+static void ssl_cache_entry_free(ssl_cache_entry * e)
+{
+	ssl_session_free(&e->session);
+	memset(e, 0, sizeof(ssl_cache_entry) + e->keylen);
+	free(e);
+}
+
+static void ssl_cache_lru_unlink(ssl_cache_shard * shard, ssl_cache_entry * e)
+{
+	if (e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		shard->lru_first = e->next;
+
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		shard->lru_last = e->prev;
+}
+
+static void ssl_cache_lru_push(ssl_cache_shard * shard, ssl_cache_entry * e)
+{
+	e->prev = NULL;
+	e->next = shard->lru_first;
+
+	if (shard->lru_first != NULL)
+		shard->lru_first->prev = e;
+	else
+		shard->lru_last = e;
+
+	shard->lru_first = e;
+}
+
+/*
+ * Take an entry out of the shard; the caller reuses or frees it
+ */
+static void ssl_cache_remove(ssl_cache_shard * shard, ssl_cache_entry * e)
+{
+	ssl_cache_entry **pp;
+
+	pp = ssl_cache_find(shard, ssl_cache_hash(e->key, e->keylen),
+			    e->key, e->keylen);
+	*pp = e->hnext;
+
+	ssl_cache_lru_unlink(shard, e);
+	shard->count--;
+}
+
+int ssl_cache_init(ssl_cache_context * cache, size_t max)
+{
+	int i;
+	size_t n, per_shard;
+	ssl_cache_shard *shard;
+
+	memset(cache, 0, sizeof(ssl_cache_context));
+
+	per_shard = (max + SSL_CACHE_SHARDS - 1) / SSL_CACHE_SHARDS;
+	if (per_shard == 0)
+		per_shard = 1;
+
+	for (n = 1; n < per_shard; n <<= 1) ;
+
+	/*
+	 * Entries outlive the connections that create them, so they
+	 * come from the heap rather than a thread's arena
+	 */
+	for (i = 0; i < SSL_CACHE_SHARDS; i++) {
+		shard = &cache->shard[i];
+
+		shard->table = (ssl_cache_entry **)
+		    malloc(n * sizeof(ssl_cache_entry *));
+
+		if (shard->table == NULL) {
+			ssl_cache_free(cache);
+			return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+		}
+
+		memset(shard->table, 0, n * sizeof(ssl_cache_entry *));
+		shard->mask = n - 1;
+		shard->max = per_shard;
+
+#if defined(WIN32)
+		InitializeCriticalSection(&shard->lock);
+#else
+		pthread_mutex_init(&shard->lock, NULL);
+#endif
+	}
+
+	return (0);
+}
+
+void ssl_set_session_cache(ssl_context * ssl, ssl_cache_context * cache)
+{
+	ssl_set_scb(ssl, ssl_cache_get, ssl_cache_set);
+	ssl->p_scb = cache;
+}
+
+void ssl_set_client_session_cache(ssl_context * ssl,
+				  ssl_cache_context * cache, int port)
+{
+	ssl_set_session_cache(ssl, cache);
+	ssl->scb_port = port;
+}
+
+int ssl_cache_get(ssl_context * ssl)
+{
+	int ret = 1;
+	unsigned long h;
+	size_t keylen;
+	uint8_t key[SSL_CACHE_KEY_MAX];
+	ssl_cache_entry **pp, *e;
+	ssl_cache_shard *shard;
+	ssl_session *session = ssl->session, *next;
+	ssl_cache_context *cache = (ssl_cache_context *) ssl->p_scb;
+
+	/*
+	 * A server resumes what the client offers; a client only looks
+	 * for a session when the application did not hand one in
+	 */
+	if (cache == NULL || session == NULL ||
+	    (ssl->endpoint == SSL_IS_SERVER) != (ssl->resume != 0) ||
+	    ssl_cache_key(ssl, key, &keylen) != 0)
+		return (1);
+
+	h = ssl_cache_hash(key, keylen);
+	shard = &cache->shard[h % SSL_CACHE_SHARDS];
+
+	SSL_CACHE_LOCK(shard);
+
+	pp = ssl_cache_find(shard, h, key, keylen);
+
+	if ((e = *pp) != NULL) {
+		if (ssl->timeout != 0 &&
+		    time(NULL) - e->session.start > ssl->timeout) {
+			ssl_cache_remove(shard, e);
+			ssl_cache_entry_free(e);
+		} else if (ssl->endpoint == SSL_IS_CLIENT) {
+			next = session->next;
+			ssl_session_free(session);
+
+			if (ssl_cache_copy(session, &e->session) == 0) {
+				ssl->resume = 1;
+				ret = 0;
+			}
+
+			session->next = next;
+		} else if (e->session.cipher == session->cipher) {
+			memcpy(session->master, e->session.master, 48);
+			ret = 0;
+		}
+
+		if (ret == 0) {
+			ssl_cache_lru_unlink(shard, e);
+			ssl_cache_lru_push(shard, e);
+		}
+	}
+
+	SSL_CACHE_UNLOCK(shard);
+
+	return (ret);
+}
+
+int ssl_cache_set(ssl_context * ssl)
+{
+	unsigned long h;
+	size_t keylen;
+	time_t t = time(NULL);
+	uint8_t key[SSL_CACHE_KEY_MAX];
+	ssl_cache_entry **pp, *e;
+	ssl_cache_shard *shard;
+	ssl_session *session = ssl->session;
+	ssl_cache_context *cache = (ssl_cache_context *) ssl->p_scb;
+
+	if (cache == NULL || session == NULL ||
+	    ssl_cache_key(ssl, key, &keylen) != 0)
+		return (1);
+
+	/*
+	 * Nothing to resume: the server sent neither an id nor a ticket
+	 */
+	if (session->length == 0 && session->ticket == NULL)
+		return (1);
+
+	h = ssl_cache_hash(key, keylen);
+	shard = &cache->shard[h % SSL_CACHE_SHARDS];
+
+	SSL_CACHE_LOCK(shard);
+
+	/*
+	 * Drop the expired sessions at the cold end, then make room
+	 */
+	while ((e = shard->lru_last) != NULL && ssl->timeout != 0 &&
+	       t - e->session.start > ssl->timeout) {
+		ssl_cache_remove(shard, e);
+		ssl_cache_entry_free(e);
+	}
+
+	pp = ssl_cache_find(shard, h, key, keylen);
+
+	if ((e = *pp) != NULL || shard->count >= shard->max) {
+		if (e == NULL)
+			e = shard->lru_last;
+
+		ssl_cache_remove(shard, e);
+		ssl_cache_entry_free(e);
+	}
+
+	if ((e = (ssl_cache_entry *)
+	     malloc(sizeof(ssl_cache_entry) + keylen)) == NULL) {
+		SSL_CACHE_UNLOCK(shard);
+		return (1);
+	}
+
+	e->key = (uint8_t *)(e + 1);
+	e->keylen = keylen;
+	memcpy(e->key, key, keylen);
+
+	if (ssl_cache_copy(&e->session, session) != 0) {
+		free(e);
+		SSL_CACHE_UNLOCK(shard);
+		return (1);
+	}
+
+	pp = ssl_cache_bucket(shard, h);
+	e->hnext = *pp;
+	*pp = e;
+
+	ssl_cache_lru_push(shard, e);
+	shard->count++;
+
+	SSL_CACHE_UNLOCK(shard);
+
+	return (0);
+}
+
+void ssl_cache_free(ssl_cache_context * cache)
+{
+	int i;
+	ssl_cache_entry *e;
+	ssl_cache_shard *shard;
+
+	for (i = 0; i < SSL_CACHE_SHARDS; i++) {
+		shard = &cache->shard[i];
+
+		if (shard->table == NULL)
+			continue;
+
+		while ((e = shard->lru_first) != NULL) {
+			shard->lru_first = e->next;
+			ssl_cache_entry_free(e);
+		}
+
+		free(shard->table);
+
+#if defined(WIN32)
+		DeleteCriticalSection(&shard->lock);
+#else
+		pthread_mutex_destroy(&shard->lock);
+#endif
+	}
+
+	memset(cache, 0, sizeof(ssl_cache_context));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * Fill in a session whose id lands in shard 0
+ */
+static void ssl_cache_test_session(ssl_session * session, int n)
+{
+	int i;
+
+	memset(session, 0, sizeof(ssl_session));
+	session->start = time(NULL);
+	session->cipher = TLS_RSA_WITH_AES_128_CBC_SHA;
+	session->length = 32;
+
+	memset(session->master, n + 1, 48);
+
+	for (i = 0; i < 32; i++)
+		session->id[i] = (uint8_t)i;
+
+	n <<= 16;
+
+	do {
+		session->id[0] = (uint8_t)(n);
+		session->id[1] = (uint8_t)(n >> 8);
+		session->id[2] = (uint8_t)(n >> 16);
+		n++;
+	} while (ssl_cache_hash(session->id, 32) % SSL_CACHE_SHARDS != 0);
+}
+
+/*
+ * Checkup routine
+ */
+int ssl_cache_self_test(int verbose)
+{
+	int i;
+	uint8_t ticket[4] = { 1, 2, 3, 4 };
+	ssl_context ssl;
+	ssl_session session, s[3];
+	ssl_cache_context cache;
+
+	if (verbose != 0)
+		printf("  SSL session cache test: ");
+
+	memset(&ssl, 0, sizeof(ssl_context));
+
+	if (ssl_cache_init(&cache, 2 * SSL_CACHE_SHARDS) != 0)
+		goto fail;
+
+	ssl_set_session_cache(&ssl, &cache);
+	ssl.endpoint = SSL_IS_SERVER;
+	ssl.resume = 1;
+	ssl.timeout = 60;
+	ssl.session = &session;
+
+	for (i = 0; i < 3; i++)
+		ssl_cache_test_session(&s[i], i);
+
+	/*
+	 * Two sessions fit in a shard: touching the first one makes
+	 * the second one the next to go
+	 */
+	memcpy(&session, &s[0], sizeof(ssl_session));
+	if (ssl_cache_set(&ssl) != 0)
+		goto fail;
+
+	memcpy(&session, &s[1], sizeof(ssl_session));
+	if (ssl_cache_set(&ssl) != 0)
+		goto fail;
+
+	memcpy(&session, &s[0], sizeof(ssl_session));
+	memset(session.master, 0, 48);
+	if (ssl_cache_get(&ssl) != 0 ||
+	    memcmp(session.master, s[0].master, 48) != 0)
+		goto fail;
+
+	memcpy(&session, &s[2], sizeof(ssl_session));
+	if (ssl_cache_set(&ssl) != 0 || cache.shard[0].count != 2)
+		goto fail;
+
+	memcpy(&session, &s[1], sizeof(ssl_session));
+	if (ssl_cache_get(&ssl) == 0)
+		goto fail;
+
+	memcpy(&session, &s[0], sizeof(ssl_session));
+	if (ssl_cache_get(&ssl) != 0)
+		goto fail;
+
+	/*
+	 * Expired sessions are not resumed, and are dropped
+	 */
+	cache.shard[0].lru_first->session.start -= 120;
+	if (ssl_cache_get(&ssl) == 0 || cache.shard[0].count != 1)
+		goto fail;
+
+	ssl_cache_free(&cache);
+
+	/*
+	 * Client side: the session and its ticket come back for the
+	 * same server name and port only, and only when none was set
+	 */
+	if (ssl_cache_init(&cache, 2 * SSL_CACHE_SHARDS) != 0)
+		goto fail;
+
+	ssl_set_client_session_cache(&ssl, &cache, 443);
+	ssl.endpoint = SSL_IS_CLIENT;
+	ssl.hostname = (uint8_t *)"example.com";
+	ssl.hostname_len = 11;
+
+	memcpy(&session, &s[1], sizeof(ssl_session));
+	session.ticket = ticket;
+	session.ticket_len = sizeof(ticket);
+	if (ssl_cache_set(&ssl) != 0)
+		goto fail;
+
+	memset(&session, 0, sizeof(ssl_session));
+	ssl.resume = 1;
+	if (ssl_cache_get(&ssl) == 0)
+		goto fail;
+
+	ssl.resume = 0;
+	ssl.scb_port = 444;
+	if (ssl_cache_get(&ssl) == 0 || ssl.resume != 0)
+		goto fail;
+
+	ssl.scb_port = 443;
+	if (ssl_cache_get(&ssl) != 0 || ssl.resume != 1 ||
+	    memcmp(session.master, s[1].master, 48) != 0 ||
+	    memcmp(session.id, s[1].id, 32) != 0 ||
+	    session.ticket == NULL || session.ticket == ticket ||
+	    session.ticket_len != sizeof(ticket) ||
+	    memcmp(session.ticket, ticket, sizeof(ticket)) != 0) {
+		ssl_session_free(&session);
+		goto fail;
+	}
+
+	ssl_session_free(&session);
+	ssl_cache_free(&cache);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	ssl_cache_free(&cache);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
@@ -40,19 +40,47 @@
 #include "tropicssl/err.h"
 #include "tropicssl/debug.h"
 #include "tropicssl/ssl.h"
+#include "tropicssl/trace.h"
+
+#if defined(TROPICSSL_AESNI)
+#include "tropicssl/aesni.h"
+#endif
+
+#if defined(TROPICSSL_AESCE)
+#include "tropicssl/aesce.h"
+#endif
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 
+/*
+ * Whether aes.c runs on AES instructions, rather than the tables
+ */
+static int ssl_aes_in_hardware(void)
+{
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+	if (aesni_supports(TROPICSSL_AESNI_AES))
+		return (1);
+#endif
+
+#if defined(TROPICSSL_AESCE) && defined(TROPICSSL_HAVE_ARMV8)
+	if (aesce_supports())
+		return (1);
+#endif
+
+	return (0);
+}
+
 static int ssl_write_client_hello(ssl_context * ssl)
 {
-	int ret;
+	int ret, ticket, pass, first;
 	size_t i, n;
 	uint8_t *buf;
-	uint8_t *p;
+	uint8_t *p, *ext;
 	time_t t;
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> write client hello"));
 
@@ -60,7 +88,7 @@ static int ssl_write_client_hello(ssl_context * ssl)
 	ssl->minor_ver = SSL_MINOR_VERSION_0;
 
 	ssl->max_major_ver = SSL_MAJOR_VERSION_3;
-	ssl->max_minor_ver = SSL_MINOR_VERSION_1;
+	ssl->max_minor_ver = SSL_MINOR_VERSION_3;
 
 	/*
 	 *         0  .   0       handshake type
@@ -86,10 +114,13 @@ static int ssl_write_client_hello(ssl_context * ssl)
 
 	SSL_DEBUG_MSG(3, ("client hello, current time: %lu", t));
 
-	for (i = 28; i > 0; i--)
-		*p++ = (uint8_t)ssl->f_rng(ssl->p_rng);
+	if ((ret = ssl->f_rng(ssl->p_rng, p, 28)) != 0) {
+		SSL_DEBUG_RET(1, "f_rng", ret);
+		return (ret);
+	}
+	p += 28;
 
-	memcpy(ssl->randbytes, buf + 6, 32);
+	memcpy(hs->randbytes, buf + 6, 32);
 
 	SSL_DEBUG_BUF(3, "client hello, random bytes", buf + 6, 32);
 
@@ -101,12 +132,36 @@ static int ssl_write_client_hello(ssl_context * ssl)
 	 *       ..       . ..    compression alg. (0)
 	 *       ..       . ..    extensions (unused)
 	 */
+	/*
+	 * A client session cache offers the last session with this
+	 * server, unless the application handed one in
+	 */
+	if (ssl->resume == 0)
+		ssl_session_get(ssl);
+
 	n = ssl->session->length;
 
 	if (n < 16 || n > 32 || ssl->resume == 0 ||
 	    t - ssl->session->start > ssl->timeout)
 		n = 0;
 
+	/*
+	 * A ticket goes with a session id, made up if need be: the
+	 * server echoes it back when it accepts the ticket
+	 */
+	ticket = ssl->use_tickets != 0 && ssl->session->ticket != NULL &&
+	    ssl->resume != 0 && t - ssl->session->start <= ssl->timeout;
+
+	if (ticket != 0 && n == 0) {
+		n = 32;
+		ssl->session->length = n;
+
+		if ((ret = ssl->f_rng(ssl->p_rng, ssl->session->id, n)) != 0) {
+			SSL_DEBUG_RET(1, "f_rng", ret);
+			return (ret);
+		}
+	}
+
 	*p++ = (uint8_t)n;
 
 	for (i = 0; i < n; i++)
@@ -115,33 +170,68 @@ static int ssl_write_client_hello(ssl_context * ssl)
 	SSL_DEBUG_MSG(3, ("client hello, session id len.: %d", n));
 	SSL_DEBUG_BUF(3, "client hello, session id", buf + 39, n);
 
-	for (n = 0; ssl->ciphers[n] != 0; n++) ;
+	/*
+	 * Only offer the ciphersuites usable with max_minor_ver
+	 */
+	for (i = n = 0; ssl->ciphers[i] != 0; i++)
+		if (ssl_cipher_min_minor_ver(ssl->ciphers[i]) <=
+		    ssl->max_minor_ver)
+			n++;
+
 	*p++ = (uint8_t)(n >> 7);
 	*p++ = (uint8_t)(n << 1);
 
 	SSL_DEBUG_MSG(3, ("client hello, got %d ciphers", n));
 
-	for (i = 0; i < n; i++) {
-		SSL_DEBUG_MSG(3, ("client hello, add cipher: %2d",
-				  ssl->ciphers[i]));
+	/*
+	 * Without AES instructions, ChaCha20-Poly1305 goes first when
+	 * asked for: pass 0 then writes those suites, pass 1 the others
+	 */
+	first = (ssl->chacha_prio != 0 && ssl_aes_in_hardware() == 0);
+
+	for (pass = first ? 0 : 1; pass < 2; pass++) {
+		for (i = 0; ssl->ciphers[i] != 0; i++) {
+			if (ssl_cipher_min_minor_ver(ssl->ciphers[i]) >
+			    ssl->max_minor_ver)
+				continue;
 
-		*p++ = (uint8_t)(ssl->ciphers[i] >> 8);
-		*p++ = (uint8_t)(ssl->ciphers[i]);
+			if (first && (pass == 0) !=
+			    ssl_cipher_is_chachapoly(ssl->ciphers[i]))
+				continue;
+
+			SSL_DEBUG_MSG(3, ("client hello, add cipher: %2d",
+					  ssl->ciphers[i]));
+
+			*p++ = (uint8_t)(ssl->ciphers[i] >> 8);
+			*p++ = (uint8_t)(ssl->ciphers[i]);
+		}
 	}
 
-	SSL_DEBUG_MSG(3, ("client hello, compress len.: %d", 1));
-	SSL_DEBUG_MSG(3, ("client hello, compress alg.: %d", 0));
+	if (ssl->compress_level > 0) {
+		SSL_DEBUG_MSG(3, ("client hello, compress len.: %d", 2));
+		SSL_DEBUG_MSG(3, ("client hello, compress alg.: %d %d",
+				  SSL_COMPRESS_DEFLATE, SSL_COMPRESS_NULL));
+
+		*p++ = 2;
+		*p++ = SSL_COMPRESS_DEFLATE;
+	} else {
+		SSL_DEBUG_MSG(3, ("client hello, compress len.: %d", 1));
+		SSL_DEBUG_MSG(3, ("client hello, compress alg.: %d", 0));
 
-	*p++ = 1;
+		*p++ = 1;
+	}
 	*p++ = SSL_COMPRESS_NULL;
 
+	/*
+	 * The extensions length is filled in once they are all written
+	 */
+	ext = p;
+	p += 2;
+
 	if (ssl->hostname != NULL) {
 		SSL_DEBUG_MSG(3, ("client hello, server name extension: %s",
 				  ssl->hostname));
 
-		*p++ = (uint8_t)(((ssl->hostname_len + 9) >> 8) & 0xFF);
-		*p++ = (uint8_t)(((ssl->hostname_len + 9)) & 0xFF);
-
 		*p++ = (uint8_t)((TLS_EXT_SERVERNAME >> 8) & 0xFF);
 		*p++ = (uint8_t)((TLS_EXT_SERVERNAME) & 0xFF);
 
@@ -160,6 +250,100 @@ static int ssl_write_client_hello(ssl_context * ssl)
 		p += ssl->hostname_len;
 	}
 
+	/*
+	 * RSA signatures over SHA-256, SHA-384 or SHA-1, in that order
+	 */
+	SSL_DEBUG_MSG(3, ("client hello, signature_algorithms extension"));
+
+	*p++ = (uint8_t)((TLS_EXT_SIG_ALG >> 8) & 0xFF);
+	*p++ = (uint8_t)((TLS_EXT_SIG_ALG) & 0xFF);
+
+	*p++ = 0;
+	*p++ = 8;
+
+	*p++ = 0;
+	*p++ = 6;
+	*p++ = SSL_HASH_SHA256;
+	*p++ = SSL_SIG_RSA;
+	*p++ = SSL_HASH_SHA384;
+	*p++ = SSL_SIG_RSA;
+	*p++ = SSL_HASH_SHA1;
+	*p++ = SSL_SIG_RSA;
+
+	if (ssl->mfl_code != SSL_MAX_FRAG_LEN_NONE) {
+		SSL_DEBUG_MSG(3, ("client hello, max_fragment_length "
+				  "extension: %d", ssl->mfl_code));
+
+		*p++ = (uint8_t)((TLS_EXT_MAX_FRAGMENT_LENGTH >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_MAX_FRAGMENT_LENGTH) & 0xFF);
+
+		*p++ = 0;
+		*p++ = 1;
+
+		*p++ = (uint8_t)ssl->mfl_code;
+	}
+
+#if defined(TROPICSSL_ECP)
+	for (i = 0; ssl->ciphers[i] != 0; i++)
+		if (ssl_cipher_is_ecdhe(ssl->ciphers[i]))
+			break;
+
+	if (ssl->ciphers[i] != 0) {
+		SSL_DEBUG_MSG(3, ("client hello, elliptic curves and "
+				  "ec_point_formats extensions"));
+
+		*p++ = (uint8_t)((TLS_EXT_SUPPORTED_ELLIPTIC_CURVES >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_SUPPORTED_ELLIPTIC_CURVES) & 0xFF);
+
+		*p++ = 0;
+		*p++ = 4;
+
+		*p++ = 0;
+		*p++ = 2;
+		*p++ = (uint8_t)((ECP_TLS_SECP256R1 >> 8) & 0xFF);
+		*p++ = (uint8_t)((ECP_TLS_SECP256R1) & 0xFF);
+
+		*p++ = (uint8_t)((TLS_EXT_EC_POINT_FORMATS >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_EC_POINT_FORMATS) & 0xFF);
+
+		*p++ = 0;
+		*p++ = 2;
+
+		*p++ = 1;
+		*p++ = ECP_TLS_UNCOMPRESSED;
+	}
+#endif
+
+	if (ssl->use_tickets != 0) {
+		n = (ticket != 0) ? ssl->session->ticket_len : 0;
+
+		if (p + 4 + n > buf + ssl->out_content_len)
+			n = 0;
+
+		SSL_DEBUG_MSG(3, ("client hello, session ticket extension: "
+				  "%d bytes", n));
+
+		*p++ = (uint8_t)((TLS_EXT_SESSION_TICKET >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_SESSION_TICKET) & 0xFF);
+
+		*p++ = (uint8_t)((n >> 8) & 0xFF);
+		*p++ = (uint8_t)((n) & 0xFF);
+
+		if (n != 0)
+			memcpy(p, ssl->session->ticket, n);
+
+		p += n;
+	}
+
+	n = p - ext - 2;
+
+	if (n == 0)
+		p = ext;
+	else {
+		ext[0] = (uint8_t)((n >> 8) & 0xFF);
+		ext[1] = (uint8_t)((n) & 0xFF);
+	}
+
 	ssl->out_msglen = p - buf;
 	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
 	ssl->out_msg[0] = SSL_HS_CLIENT_HELLO;
@@ -176,6 +360,88 @@ static int ssl_write_client_hello(ssl_context * ssl)
 	return (0);
 }
 
+/*
+ * Walk the ServerHello extensions; only those the client asked for
+ * may appear
+ */
+static int ssl_parse_server_hello_ext(ssl_context * ssl,
+				      const uint8_t *p, size_t len)
+{
+	size_t ext_size;
+	int ext_id;
+
+	while (len > 0) {
+		if (len < 4) {
+			SSL_DEBUG_MSG(1, ("bad server hello message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
+		}
+
+		ext_id = (p[0] << 8) | p[1];
+		ext_size = (p[2] << 8) | p[3];
+
+		if (ext_size > len - 4) {
+			SSL_DEBUG_MSG(1, ("bad server hello message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
+		}
+
+		switch (ext_id) {
+		case TLS_EXT_SERVERNAME:
+			SSL_DEBUG_MSG(3, ("server hello, server name "
+					  "extension"));
+			break;
+
+		case TLS_EXT_MAX_FRAGMENT_LENGTH:
+			if (ssl->mfl_code == SSL_MAX_FRAG_LEN_NONE ||
+			    ext_size != 1 || p[4] != ssl->mfl_code) {
+				SSL_DEBUG_MSG(1, ("bad server hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
+			}
+
+			SSL_DEBUG_MSG(3, ("server hello, max_fragment_length "
+					  "extension: %d", p[4]));
+
+			ssl->mfl_nego = ssl->mfl_code;
+			break;
+
+#if defined(TROPICSSL_ECP)
+		case TLS_EXT_EC_POINT_FORMATS:
+			if (ext_size < 1 || p[4] != ext_size - 1 ||
+			    memchr(p + 5, ECP_TLS_UNCOMPRESSED,
+				   ext_size - 1) == NULL) {
+				SSL_DEBUG_MSG(1, ("bad server hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
+			}
+
+			SSL_DEBUG_MSG(3, ("server hello, ec_point_formats "
+					  "extension"));
+			break;
+#endif
+
+		case TLS_EXT_SESSION_TICKET:
+			if (ssl->use_tickets == 0 || ext_size != 0) {
+				SSL_DEBUG_MSG(1, ("bad server hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
+			}
+
+			SSL_DEBUG_MSG(3, ("server hello, session ticket "
+					  "extension"));
+
+			ssl->new_ticket = 1;
+			break;
+
+		default:
+			SSL_DEBUG_MSG(3, ("server hello, unknown extension: %d",
+					  ext_id));
+			break;
+		}
+
+		p += 4 + ext_size;
+		len -= 4 + ext_size;
+	}
+
+	return (0);
+}
+
 static int ssl_parse_server_hello(ssl_context * ssl)
 {
 	time_t t;
@@ -183,6 +449,7 @@ static int ssl_parse_server_hello(ssl_context * ssl)
 	size_t n;
 	int ext_len;
 	uint8_t *buf;
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> parse server hello"));
 
@@ -214,7 +481,7 @@ static int ssl_parse_server_hello(ssl_context * ssl)
 		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
 	}
 
-	if (buf[5] != SSL_MINOR_VERSION_0 && buf[5] != SSL_MINOR_VERSION_1) {
+	if (buf[5] > ssl->max_minor_ver) {
 		SSL_DEBUG_MSG(1, ("bad server hello message"));
 		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
 	}
@@ -226,7 +493,7 @@ static int ssl_parse_server_hello(ssl_context * ssl)
 	    | ((time_t) buf[8] << 8)
 	    | ((time_t) buf[9]);
 
-	memcpy(ssl->randbytes + 32, buf + 6, 32);
+	memcpy(hs->randbytes + 32, buf + 6, 32);
 
 	n = buf[38];
 
@@ -255,6 +522,9 @@ static int ssl_parse_server_hello(ssl_context * ssl)
 
 	i = (buf[39 + n] << 8) | buf[40 + n];
 
+	ssl_transcript_select(&hs->transcript,
+			      ssl_transcript_digests(ssl->minor_ver, i));
+
 	SSL_DEBUG_MSG(3, ("server hello, session id len.: %d", n));
 	SSL_DEBUG_BUF(3, "server hello, session id", buf + 39, n);
 
@@ -265,6 +535,9 @@ static int ssl_parse_server_hello(ssl_context * ssl)
 	    ssl->session->cipher != i ||
 	    ssl->session->length != n ||
 	    memcmp(ssl->session->id, buf + 39, n) != 0) {
+		if (ssl->resume != 0)
+			SSL_STATS_INC(ssl, resume_misses);
+
 		ssl->state++;
 		ssl->resume = 0;
 		ssl->session->start = time(NULL);
@@ -272,6 +545,7 @@ static int ssl_parse_server_hello(ssl_context * ssl)
 		ssl->session->length = n;
 		memcpy(ssl->session->id, buf + 39, n);
 	} else {
+		SSL_STATS_INC(ssl, resume_hits);
 		ssl->state = SSL_SERVER_CHANGE_CIPHER_SPEC;
 		ssl_derive_keys(ssl);
 	}
@@ -293,40 +567,143 @@ static int ssl_parse_server_hello(ssl_context * ssl)
 			break;
 	}
 
-	if (buf[41 + n] != SSL_COMPRESS_NULL) {
+	if (ssl_cipher_min_minor_ver(ssl->session->cipher) > ssl->minor_ver) {
+		SSL_DEBUG_MSG(1, ("bad server hello message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
+	}
+
+	if (buf[41 + n] != SSL_COMPRESS_NULL &&
+	    (buf[41 + n] != SSL_COMPRESS_DEFLATE ||
+	     ssl->compress_level == 0)) {
 		SSL_DEBUG_MSG(1, ("bad server hello message"));
 		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_HELLO);
 	}
 
-	/* TODO: Process extensions */
+	ssl->session->compression = buf[41 + n];
+
+	ssl->mfl_nego = SSL_MAX_FRAG_LEN_NONE;
+	ssl->new_ticket = 0;
+
+	if (ext_len > 0 &&
+	    (ret = ssl_parse_server_hello_ext(ssl, buf + 44 + n,
+					      ext_len - 2)) != 0)
+		return (ret);
+
+	/*
+	 * A renewed ticket comes before the server's ChangeCipherSpec;
+	 * a ticket the server neither took nor renews is of no more use
+	 */
+	if (ssl->resume != 0 && ssl->new_ticket != 0)
+		ssl->state = SSL_SERVER_NEW_SESSION_TICKET;
+
+	if (ssl->resume == 0 && ssl->new_ticket == 0)
+		ssl_session_free(ssl->session);
 
 	SSL_DEBUG_MSG(2, ("<= parse server hello"));
 
 	return (0);
 }
 
-static int ssl_parse_server_key_exchange(ssl_context * ssl)
+static int ssl_parse_new_session_ticket(ssl_context * ssl)
 {
 	int ret;
 	size_t n;
+	uint8_t *buf, *ticket;
+
+	SSL_DEBUG_MSG(2, ("=> parse new session ticket"));
+
+	if (ssl->new_ticket == 0) {
+		SSL_DEBUG_MSG(2, ("<= skip parse new session ticket"));
+		ssl->state++;
+		return (0);
+	}
+
+	/*
+	 * Sent in the clear, before the server's ChangeCipherSpec
+	 */
+	ssl->in_crypt = 0;
+
+	if ((ret = ssl_read_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_read_record", ret);
+		return (ret);
+	}
+
+	buf = ssl->in_msg;
+
+	if (ssl->in_msgtype != SSL_MSG_HANDSHAKE) {
+		SSL_DEBUG_MSG(1, ("bad new session ticket message"));
+		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+	}
+
+	/*
+	 *     0  .   0   handshake type
+	 *     1  .   3   handshake length
+	 *     4  .   7   ticket lifetime hint
+	 *     8  .   9   ticket length (n)
+	 *    10  . 9+n   ticket
+	 */
+	if (buf[0] != SSL_HS_NEW_SESSION_TICKET || ssl->in_hslen < 10) {
+		SSL_DEBUG_MSG(1, ("bad new session ticket message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_NEW_SESSION_TICKET);
+	}
+
+	n = (buf[8] << 8) | buf[9];
+
+	if (ssl->in_hslen != 10 + n) {
+		SSL_DEBUG_MSG(1, ("bad new session ticket message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_NEW_SESSION_TICKET);
+	}
+
+	SSL_DEBUG_MSG(3, ("new session ticket, lifetime: %lu, length: %d",
+			  ((unsigned long)buf[4] << 24) | (buf[5] << 16) |
+			  (buf[6] << 8) | buf[7], n));
+
+	ssl->state++;
+
+	/*
+	 * An empty ticket means the server will not issue one after all
+	 */
+	if (n == 0)
+		return (0);
+
+	/*
+	 * The session outlives this context, so does its ticket
+	 */
+	if ((ticket = (uint8_t *)malloc(n)) == NULL) {
+		SSL_DEBUG_MSG(1, ("malloc(%d bytes) failed", n));
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+	}
+
+	memcpy(ticket, buf + 10, n);
+
+	ssl_session_free(ssl->session);
+	ssl->session->ticket = ticket;
+	ssl->session->ticket_len = n;
+	ssl->session->ticket_lifetime = ((uint32_t) buf[4] << 24) |
+	    ((uint32_t) buf[5] << 16) | ((uint32_t) buf[6] << 8) | buf[7];
+
+	SSL_DEBUG_MSG(2, ("<= parse new session ticket"));
+
+	return (0);
+}
+
+static int ssl_parse_server_key_exchange(ssl_context * ssl)
+{
+	int ret, sig_hash = 0;
+	size_t n, hlen;
 	uint8_t *p, *end;
-	uint8_t hash[36];
-	md5_context md5;
-	sha1_context sha1;
+	uint8_t hash[SSL_SIG_INPUT_MAX];
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> parse server key exchange"));
 
-	if (ssl->session->cipher != TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA &&
-	    ssl->session->cipher != TLS_DHE_RSA_WITH_AES_256_CBC_SHA &&
-	    ssl->session->cipher != TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA) {
+	if (!ssl_cipher_is_dhe(ssl->session->cipher) &&
+	    !ssl_cipher_is_ecdhe(ssl->session->cipher)) {
 		SSL_DEBUG_MSG(2, ("<= skip parse server key exchange"));
 		ssl->state++;
 		return (0);
 	}
-#if !defined(TROPICSSL_DHM)
-	SSL_DEBUG_MSG(1, ("support for dhm in not available"));
-	return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
-#else
+
 	if ((ret = ssl_read_record(ssl)) != 0) {
 		SSL_DEBUG_RET(1, "ssl_read_record", ret);
 		return (ret);
@@ -342,36 +719,86 @@ static int ssl_parse_server_key_exchange(ssl_context * ssl)
 		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
 	}
 
-	/*
-	 * Ephemeral DH parameters:
-	 *
-	 * struct {
-	 *         opaque dh_p<1..2^16-1>;
-	 *         opaque dh_g<1..2^16-1>;
-	 *         opaque dh_Ys<1..2^16-1>;
-	 * } ServerDHParams;
-	 */
 	p = ssl->in_msg + 4;
 	end = ssl->in_msg + ssl->in_hslen;
 
-	if ((ret = dhm_read_params(&ssl->dhm_ctx, &p, end)) != 0) {
-		SSL_DEBUG_MSG(1, ("bad server key exchange message"));
-		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
+	if (ssl_cipher_is_ecdhe(ssl->session->cipher)) {
+#if !defined(TROPICSSL_ECP)
+		SSL_DEBUG_MSG(1, ("support for ecp in not available"));
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#else
+		/*
+		 * Ephemeral ECDH parameters:
+		 *
+		 * struct {
+		 *         ECCurveType curve_type;     (named_curve)
+		 *         NamedCurve namedcurve;      (secp256r1)
+		 *         opaque point<1..2^8-1>;
+		 * } ServerECDHParams;
+		 */
+		if ((ret = ecdh_read_params(&hs->ecdh_ctx, &p, end)) != 0) {
+			SSL_DEBUG_MSG(1, ("bad server key exchange message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
+		}
+
+		SSL_DEBUG_BUF(3, "ECDH: Qp", hs->ecdh_ctx.Qp,
+			      ECP_P256_POINT_LEN);
+#endif
+	} else {
+#if !defined(TROPICSSL_DHM)
+		SSL_DEBUG_MSG(1, ("support for dhm in not available"));
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#else
+		/*
+		 * Ephemeral DH parameters:
+		 *
+		 * struct {
+		 *         opaque dh_p<1..2^16-1>;
+		 *         opaque dh_g<1..2^16-1>;
+		 *         opaque dh_Ys<1..2^16-1>;
+		 * } ServerDHParams;
+		 */
+		if ((ret = dhm_read_params(&hs->dhm_ctx, &p, end)) != 0) {
+			SSL_DEBUG_MSG(1, ("bad server key exchange message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
+		}
+
+		if (hs->dhm_ctx.len < 64 || hs->dhm_ctx.len > 256) {
+			SSL_DEBUG_MSG(1, ("bad server key exchange message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
+		}
+
+		SSL_DEBUG_MPI(3, "DHM: P ", &hs->dhm_ctx.P);
+		SSL_DEBUG_MPI(3, "DHM: G ", &hs->dhm_ctx.G);
+		SSL_DEBUG_MPI(3, "DHM: GY", &hs->dhm_ctx.GY);
+#endif
 	}
 
-	if ((int)(end - p) != ssl->peer_cert->rsa.len) {
-		SSL_DEBUG_MSG(1, ("bad server key exchange message"));
-		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
+	n = p - ssl->in_msg - 4;
+
+	/*
+	 * TLSv1.2: the signature is preceded by the SignatureAndHash-
+	 * Algorithm it was made with, one of those offered
+	 */
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3) {
+		if (end - p < 4 || p[1] != SSL_SIG_RSA ||
+		    (p[0] != SSL_HASH_SHA1 && p[0] != SSL_HASH_SHA256 &&
+		     p[0] != SSL_HASH_SHA384)) {
+			SSL_DEBUG_MSG(1, ("bad server key exchange message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
+		}
+
+		sig_hash = p[0];
+		p += 2;
 	}
 
-	if (ssl->dhm_ctx.len < 64 || ssl->dhm_ctx.len > 256) {
+	if (end - p < 2 || ((p[0] << 8) | p[1]) != end - p - 2 ||
+	    (int)(end - p - 2) != ssl->peer_cert->rsa.len) {
 		SSL_DEBUG_MSG(1, ("bad server key exchange message"));
 		return (TROPICSSL_ERR_SSL_BAD_HS_SERVER_KEY_EXCHANGE);
 	}
 
-	SSL_DEBUG_MPI(3, "DHM: P ", &ssl->dhm_ctx.P);
-	SSL_DEBUG_MPI(3, "DHM: G ", &ssl->dhm_ctx.G);
-	SSL_DEBUG_MPI(3, "DHM: GY", &ssl->dhm_ctx.GY);
+	p += 2;
 
 	/*
 	 * digitally-signed struct {
@@ -385,23 +812,19 @@ static int ssl_parse_server_key_exchange(ssl_context * ssl)
 	 * sha_hash
 	 *         SHA(ClientHello.random + ServerHello.random
 	 *                                                        + ServerParams);
+	 *
+	 * or, from TLSv1.2 on, the one hash named before the signature
 	 */
-	n = ssl->in_hslen - (end - p) - 6;
+	hlen = ssl_calc_params_hash(ssl, sig_hash, ssl->in_msg + 4, n, hash);
 
-	md5_starts(&md5);
-	md5_update(&md5, ssl->randbytes, 64);
-	md5_update(&md5, ssl->in_msg + 4, n);
-	md5_finish(&md5, hash);
+	SSL_STATS_OP_START(ssl);
 
-	sha1_starts(&sha1);
-	sha1_update(&sha1, ssl->randbytes, 64);
-	sha1_update(&sha1, ssl->in_msg + 4, n);
-	sha1_finish(&sha1, hash + 16);
+	ret = rsa_pkcs1_verify(&ssl->peer_cert->rsa, RSA_PUBLIC,
+			       RSA_RAW, hlen, hash, p);
 
-	SSL_DEBUG_BUF(3, "parameters hash", hash, 36);
+	SSL_STATS_OP_END(ssl, rsa);
 
-	if ((ret = rsa_pkcs1_verify(&ssl->peer_cert->rsa, RSA_PUBLIC,
-				    RSA_RAW, 36, hash, p)) != 0) {
+	if (ret != 0) {
 		SSL_DEBUG_RET(1, "rsa_pkcs1_verify", ret);
 		return (ret);
 	}
@@ -411,7 +834,6 @@ static int ssl_parse_server_key_exchange(ssl_context * ssl)
 	SSL_DEBUG_MSG(2, ("<= parse server key exchange"));
 
 	return (0);
-#endif
 }
 
 static int ssl_parse_certificate_request(ssl_context * ssl)
@@ -489,12 +911,50 @@ static int ssl_write_client_key_exchange(ssl_context * ssl)
 {
 	int ret;
 	size_t i, n;
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> write client key exchange"));
 
-	if (ssl->session->cipher == TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA ||
-	    ssl->session->cipher == TLS_DHE_RSA_WITH_AES_256_CBC_SHA ||
-	    ssl->session->cipher == TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA) {
+	if (ssl_cipher_is_ecdhe(ssl->session->cipher)) {
+#if !defined(TROPICSSL_ECP)
+		SSL_DEBUG_MSG(1, ("support for ecp in not available"));
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#else
+		/*
+		 * ECDH key exchange -- send own point Qc
+		 */
+		i = 4;
+
+		SSL_STATS_OP_START(ssl);
+
+		ret = ecdh_make_public(&hs->ecdh_ctx, &ssl->out_msg[i], &n,
+				       ssl->f_rng, ssl->p_rng);
+
+		SSL_STATS_OP_END(ssl, ecdh);
+
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "ecdh_make_public", ret);
+			return (ret);
+		}
+
+		SSL_DEBUG_BUF(3, "ECDH: Q ", hs->ecdh_ctx.Q,
+			      ECP_P256_POINT_LEN);
+
+		hs->pmslen = sizeof(hs->premaster);
+
+		SSL_STATS_OP_START(ssl);
+
+		ret = ecdh_calc_secret(&hs->ecdh_ctx, hs->premaster,
+				       &hs->pmslen);
+
+		SSL_STATS_OP_END(ssl, ecdh);
+
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "ecdh_calc_secret", ret);
+			return (ret);
+		}
+#endif
+	} else if (ssl_cipher_is_dhe(ssl->session->cipher)) {
 #if !defined(TROPICSSL_DHM)
 		SSL_DEBUG_MSG(1, ("support for dhm in not available"));
 		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
@@ -502,45 +962,58 @@ static int ssl_write_client_key_exchange(ssl_context * ssl)
 		/*
 		 * DHM key exchange -- send G^X mod P
 		 */
-		n = ssl->dhm_ctx.len;
+		n = hs->dhm_ctx.len;
 
 		ssl->out_msg[4] = (uint8_t)(n >> 8);
 		ssl->out_msg[5] = (uint8_t)(n);
 		i = 6;
 
-		ret = dhm_make_public(&ssl->dhm_ctx, 256,
+		SSL_STATS_OP_START(ssl);
+
+		ret = dhm_make_public(&hs->dhm_ctx, 256,
 				      &ssl->out_msg[i], n,
 				      ssl->f_rng, ssl->p_rng);
+
+		SSL_STATS_OP_END(ssl, dh);
+
 		if (ret != 0) {
 			SSL_DEBUG_RET(1, "dhm_make_public", ret);
 			return (ret);
 		}
 
-		SSL_DEBUG_MPI(3, "DHM: X ", &ssl->dhm_ctx.X);
-		SSL_DEBUG_MPI(3, "DHM: GX", &ssl->dhm_ctx.GX);
+		SSL_DEBUG_MPI(3, "DHM: X ", &hs->dhm_ctx.X);
+		SSL_DEBUG_MPI(3, "DHM: GX", &hs->dhm_ctx.GX);
+
+		hs->pmslen = hs->dhm_ctx.len;
 
-		ssl->pmslen = ssl->dhm_ctx.len;
+		SSL_STATS_OP_START(ssl);
 
-		if ((ret = dhm_calc_secret(&ssl->dhm_ctx,
-					   ssl->premaster,
-					   &ssl->pmslen)) != 0) {
+		ret = dhm_calc_secret(&hs->dhm_ctx, hs->premaster,
+				      &hs->pmslen);
+
+		SSL_STATS_OP_END(ssl, dh);
+
+		if (ret != 0) {
 			SSL_DEBUG_RET(1, "dhm_calc_secret", ret);
 			return (ret);
 		}
 
-		SSL_DEBUG_MPI(3, "DHM: K ", &ssl->dhm_ctx.K);
+		SSL_DEBUG_MPI(3, "DHM: K ", &hs->dhm_ctx.K);
 #endif
 	} else {
 		/*
 		 * RSA key exchange -- send rsa_public(pkcs1 v1.5(premaster))
 		 */
-		ssl->premaster[0] = (uint8_t)ssl->max_major_ver;
-		ssl->premaster[1] = (uint8_t)ssl->max_minor_ver;
-		ssl->pmslen = 48;
+		hs->premaster[0] = (uint8_t)ssl->max_major_ver;
+		hs->premaster[1] = (uint8_t)ssl->max_minor_ver;
+		hs->pmslen = 48;
 
-		for (i = 2; i < ssl->pmslen; i++)
-			ssl->premaster[i] =
-			    (uint8_t)ssl->f_rng(ssl->p_rng);
+		ret = ssl->f_rng(ssl->p_rng, hs->premaster + 2,
+				 hs->pmslen - 2);
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "f_rng", ret);
+			return (ret);
+		}
 
 		i = 4;
 		n = ssl->peer_cert->rsa.len;
@@ -551,9 +1024,15 @@ static int ssl_write_client_key_exchange(ssl_context * ssl)
 			ssl->out_msg[5] = (uint8_t)(n);
 		}
 
-		ret = rsa_pkcs1_encrypt(&ssl->peer_cert->rsa, RSA_PUBLIC,
-					ssl->pmslen, ssl->premaster,
+		SSL_STATS_OP_START(ssl);
+
+		ret = rsa_pkcs1_encrypt(&ssl->peer_cert->rsa,
+					ssl->f_rng, ssl->p_rng, RSA_PUBLIC,
+					hs->pmslen, hs->premaster,
 					ssl->out_msg + i);
+
+		SSL_STATS_OP_END(ssl, rsa);
+
 		if (ret != 0) {
 			SSL_DEBUG_RET(1, "rsa_pkcs1_encrypt", ret);
 			return (ret);
@@ -581,8 +1060,8 @@ static int ssl_write_client_key_exchange(ssl_context * ssl)
 static int ssl_write_certificate_verify(ssl_context * ssl)
 {
 	int ret;
-	size_t n;
-	uint8_t hash[36];
+	size_t n, hlen, i = 4;
+	uint8_t hash[SSL_SIG_INPUT_MAX];
 
 	SSL_DEBUG_MSG(2, ("=> write certificate verify"));
 
@@ -598,21 +1077,33 @@ static int ssl_write_certificate_verify(ssl_context * ssl)
 	}
 
 	/*
-	 * Make an RSA signature of the handshake digests
+	 * Make an RSA signature of the handshake digests; TLSv1.2 names
+	 * the PRF hash used, which the server is assumed to accept
 	 */
-	ssl_calc_verify(ssl, hash);
+	hlen = ssl_calc_verify(ssl, hash);
+
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3) {
+		ssl->out_msg[i++] =
+		    (uint8_t)ssl_cipher_prf_hash(ssl->session->cipher);
+		ssl->out_msg[i++] = SSL_SIG_RSA;
+	}
 
 	n = ssl->rsa_key->len;
-	ssl->out_msg[4] = (uint8_t)(n >> 8);
-	ssl->out_msg[5] = (uint8_t)(n);
+	ssl->out_msg[i++] = (uint8_t)(n >> 8);
+	ssl->out_msg[i++] = (uint8_t)(n);
+
+	SSL_STATS_OP_START(ssl);
 
-	if ((ret = rsa_pkcs1_sign(ssl->rsa_key, RSA_PRIVATE, RSA_RAW,
-				  36, hash, ssl->out_msg + 6)) != 0) {
+	ret = ssl_rsa_sign(ssl, hlen, hash, ssl->out_msg + i);
+
+	SSL_STATS_OP_END(ssl, rsa);
+
+	if (ret != 0) {
 		SSL_DEBUG_RET(1, "rsa_pkcs1_sign", ret);
 		return (ret);
 	}
 
-	ssl->out_msglen = 6 + n;
+	ssl->out_msglen = i + n;
 	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
 	ssl->out_msg[0] = SSL_HS_CERTIFICATE_VERIFY;
 
@@ -631,6 +1122,32 @@ static int ssl_write_certificate_verify(ssl_context * ssl)
 /*
  * SSL handshake -- client side
  */
+/*
+ * False Start (RFC 7918): our Finished is out on a full handshake
+ * with a forward-secret key exchange and an AEAD suite, so
+ * application data may go before the server's Finished arrives
+ */
+static int ssl_false_start(ssl_context * ssl)
+{
+	if (ssl->false_start == 0 || ssl->false_started != 0 ||
+	    ssl->resume != 0)
+		return (0);
+
+	if (ssl->state != SSL_SERVER_NEW_SESSION_TICKET &&
+	    ssl->state != SSL_SERVER_CHANGE_CIPHER_SPEC)
+		return (0);
+
+	if ((ssl_cipher_is_dhe(ssl->session->cipher) == 0 &&
+	     ssl_cipher_is_ecdhe(ssl->session->cipher) == 0) ||
+	    ssl_cipher_is_aead(ssl->session->cipher) == 0)
+		return (0);
+
+	SSL_DEBUG_MSG(2, ("handshake: false start"));
+	ssl->false_started = 1;
+
+	return (1);
+}
+
 int ssl_handshake_client(ssl_context * ssl)
 {
 	int ret = 0;
@@ -643,6 +1160,12 @@ int ssl_handshake_client(ssl_context * ssl)
 		if ((ret = ssl_flush_output(ssl)) != 0)
 			break;
 
+		if (ssl_false_start(ssl) != 0)
+			break;
+
+		SSL_STATS_STATE_START(ssl);
+		TROPICSSL_TRACE3(handshake_state_start, ssl, SSL_IS_CLIENT, ssl->state);
+
 		switch (ssl->state) {
 		case SSL_HELLO_REQUEST:
 			ssl->state = SSL_CLIENT_HELLO;
@@ -710,9 +1233,14 @@ int ssl_handshake_client(ssl_context * ssl)
 			break;
 
 			/*
-			 *      <==       ChangeCipherSpec
+			 *      <==     ( NewSessionTicket )
+			 *                ChangeCipherSpec
 			 *                Finished
 			 */
+		case SSL_SERVER_NEW_SESSION_TICKET:
+			ret = ssl_parse_new_session_ticket(ssl);
+			break;
+
 		case SSL_SERVER_CHANGE_CIPHER_SPEC:
 			ret = ssl_parse_change_cipher_spec(ssl);
 			break;
@@ -723,6 +1251,11 @@ int ssl_handshake_client(ssl_context * ssl)
 
 		case SSL_FLUSH_BUFFERS:
 			SSL_DEBUG_MSG(2, ("handshake: done"));
+			SSL_STATS_INC(ssl, handshakes);
+
+			ssl_session_set(ssl);
+
+			ssl->false_started = 0;
 			ssl->state = SSL_HANDSHAKE_OVER;
 			break;
 
@@ -731,10 +1264,15 @@ int ssl_handshake_client(ssl_context * ssl)
 			return (TROPICSSL_ERR_BAD_ARG);
 		}
 
+		SSL_STATS_STATE_END(ssl);
+		TROPICSSL_TRACE3(handshake_state_done, ssl, SSL_IS_CLIENT, ret);
+
 		if (ret != 0)
 			break;
 	}
 
+	TROPICSSL_TRACE3(handshake_done, ssl, SSL_IS_CLIENT, ret);
+
 	SSL_DEBUG_MSG(2, ("<= handshake client"));
 
 	return (ret);
@@ -0,0 +1,826 @@
+/*
+ *  Event loop for non-blocking SSL/TLS connections
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_ENGINE_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/net.h"
+#include "tropicssl/ssl_engine.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#define SSL_ENGINE_EPOLL
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+      defined(__OpenBSD__) || defined(__DragonFly__)
+#define SSL_ENGINE_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/*
+ * Readiness notification: the one part that differs between systems.
+ * Registrations are level-triggered; ptr is NULL for the listener.
+ */
+static int engine_poll_open(void)
+{
+#if defined(SSL_ENGINE_EPOLL)
+	return (epoll_create(1024));
+#elif defined(SSL_ENGINE_KQUEUE)
+	return (kqueue());
+#else
+	return (-1);
+#endif
+}
+
+static int engine_poll_set(ssl_engine * e, int fd, void *ptr,
+			   int old, int events)
+{
+#if defined(SSL_ENGINE_EPOLL)
+	struct epoll_event ev;
+	int op;
+
+	if (old == events)
+		return (0);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.ptr = ptr;
+
+	if (events & SSL_ENGINE_READ)
+		ev.events |= EPOLLIN;
+
+	if (events & SSL_ENGINE_WRITE)
+		ev.events |= EPOLLOUT;
+
+	op = (old == 0) ? EPOLL_CTL_ADD :
+	    (events == 0) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+
+	return (epoll_ctl(e->poll_fd, op, fd, &ev));
+#elif defined(SSL_ENGINE_KQUEUE)
+	struct kevent ch[2];
+	int n = 0;
+
+	if ((old ^ events) & SSL_ENGINE_READ) {
+		EV_SET(&ch[n], fd, EVFILT_READ,
+		       (events & SSL_ENGINE_READ) ? EV_ADD : EV_DELETE,
+		       0, 0, ptr);
+		n++;
+	}
+
+	if ((old ^ events) & SSL_ENGINE_WRITE) {
+		EV_SET(&ch[n], fd, EVFILT_WRITE,
+		       (events & SSL_ENGINE_WRITE) ? EV_ADD : EV_DELETE,
+		       0, 0, ptr);
+		n++;
+	}
+
+	if (n == 0)
+		return (0);
+
+	return (kevent(e->poll_fd, ch, n, NULL, 0, NULL));
+#else
+	return (-1);
+#endif
+}
+
+/*
+ * Wait for up to max ready sockets; returns their number, or -1
+ */
+static int engine_poll_wait(ssl_engine * e, void **ptrs, int max,
+			    int timeout)
+{
+#if defined(SSL_ENGINE_EPOLL)
+	struct epoll_event ev[SSL_ENGINE_EVENTS];
+	int i, n;
+
+	n = epoll_wait(e->poll_fd, ev, max, timeout);
+
+	if (n < 0)
+		return ((errno == EINTR) ? 0 : -1);
+
+	for (i = 0; i < n; i++)
+		ptrs[i] = ev[i].data.ptr;
+
+	return (n);
+#elif defined(SSL_ENGINE_KQUEUE)
+	struct kevent ev[SSL_ENGINE_EVENTS];
+	struct timespec ts, *tp = NULL;
+	int i, n;
+
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		tp = &ts;
+	}
+
+	n = kevent(e->poll_fd, NULL, 0, ev, max, tp);
+
+	if (n < 0)
+		return ((errno == EINTR) ? 0 : -1);
+
+	for (i = 0; i < n; i++)
+		ptrs[i] = ev[i].udata;
+
+	return (n);
+#else
+	return (-1);
+#endif
+}
+
+static void engine_poll_close(ssl_engine * e)
+{
+#if defined(SSL_ENGINE_EPOLL) || defined(SSL_ENGINE_KQUEUE)
+	if (e->poll_fd >= 0)
+		close(e->poll_fd);
+#endif
+	e->poll_fd = -1;
+}
+
+/*
+ * Accept backpressure: the listener is only registered while there
+ * is room for more connections
+ */
+static void engine_listen(ssl_engine * e, int on)
+{
+	if (e->listen_fd < 0 || e->accepting == on)
+		return;
+
+	if (engine_poll_set(e, e->listen_fd, NULL,
+			    e->accepting ? SSL_ENGINE_READ : 0,
+			    on ? SSL_ENGINE_READ : 0) == 0)
+		e->accepting = on;
+}
+
+static void engine_set_events(ssl_conn * c, int events)
+{
+	if (engine_poll_set(c->engine, c->fd, c, c->events, events) == 0)
+		c->events = events;
+}
+
+/*
+ * Take a connection out of the loop: the socket is closed at once,
+ * the structure only after the current run, as events may still
+ * point to it
+ */
+static void engine_retire(ssl_conn * c, int reason)
+{
+	ssl_engine *e = c->engine;
+
+	if (c->closing)
+		return;
+
+	c->closing = 1;
+
+	if (e->h.f_close != NULL)
+		e->h.f_close(e->p_h, c, reason);
+
+	engine_set_events(c, 0);
+	net_close(c->fd);
+	c->fd = -1;
+
+	/*
+	 * Not on the list while ssl_engine_run() retries it
+	 */
+	if (c->deferred != 0) {
+		ssl_conn **pp = &e->deferred;
+
+		while (*pp != NULL && *pp != c)
+			pp = &(*pp)->defer_next;
+
+		if (*pp != NULL)
+			*pp = c->defer_next;
+
+		c->deferred = 0;
+	}
+
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		e->live = c->next;
+
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+
+	c->prev = NULL;
+	c->next = e->dead;
+	e->dead = c;
+
+	e->conns--;
+
+	if (e->conns < e->max_conns)
+		engine_listen(e, 1);
+}
+
+static void engine_reap(ssl_engine * e)
+{
+	ssl_conn *c;
+
+	while ((c = e->dead) != NULL) {
+		e->dead = c->next;
+
+		ssl_free(&c->ssl);
+		ssl_session_free(&c->session);
+
+		memset(c, 0, sizeof(ssl_conn));
+		free(c);
+	}
+}
+
+/*
+ * Run the handshake, then hand over whatever application data the
+ * socket has, and register for what is needed next
+ */
+static void engine_drive(ssl_conn * c)
+{
+	int ret, want = SSL_ENGINE_READ;
+	const uint8_t *buf;
+	size_t len;
+	ssl_engine *e = c->engine;
+
+	if (c->open == 0) {
+		ret = ssl_handshake(&c->ssl);
+
+		if (ret == TROPICSSL_ERR_NET_WANT_READ) {
+			engine_set_events(c, SSL_ENGINE_READ);
+			return;
+		}
+
+		if (ret == TROPICSSL_ERR_NET_WANT_WRITE) {
+			engine_set_events(c, SSL_ENGINE_WRITE);
+			return;
+		}
+
+		/*
+		 * Nothing to wait for on the socket: the retry is timed
+		 */
+		if (ret == TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED) {
+			engine_set_events(c, 0);
+			c->deferred = 1;
+			c->defer_next = e->deferred;
+			e->deferred = c;
+			return;
+		}
+
+		if (ret != 0) {
+			engine_retire(c, ret);
+			return;
+		}
+
+		c->open = 1;
+
+		if (e->h.f_open != NULL)
+			e->h.f_open(e->p_h, c);
+	}
+
+	if (c->closing == 0 && c->pending != 0) {
+		ret = ssl_write_commit(&c->ssl, c->pending);
+
+		if (ret >= 0) {
+			c->pending = 0;
+
+			if (c->shutdown != 0 ||
+			    (e->h.f_write != NULL &&
+			     e->h.f_write(e->p_h, c) < 0))
+				ssl_engine_close(c);
+		} else if (ret != TROPICSSL_ERR_NET_WANT_WRITE) {
+			engine_retire(c, ret);
+			return;
+		}
+	}
+
+	while (c->closing == 0) {
+		ret = ssl_read_view(&c->ssl, &buf, &len);
+
+		if (ret == TROPICSSL_ERR_NET_WANT_READ)
+			break;
+
+		if (ret == TROPICSSL_ERR_NET_WANT_WRITE) {
+			want |= SSL_ENGINE_WRITE;
+			break;
+		}
+
+		if (ret != 0) {
+			engine_retire(c, ret);
+			return;
+		}
+
+		ret = e->h.f_read(e->p_h, c, buf, len);
+		ssl_read_release(&c->ssl, len);
+
+		if (ret < 0)
+			ssl_engine_close(c);
+	}
+
+	if (c->closing != 0)
+		return;
+
+	if (c->pending != 0)
+		want |= SSL_ENGINE_WRITE;
+
+	engine_set_events(c, want);
+}
+
+int ssl_engine_init(ssl_engine * e, int listen_fd, size_t max_conns,
+		    const ssl_engine_handlers * h, void *p_h)
+{
+	memset(e, 0, sizeof(ssl_engine));
+
+	e->listen_fd = -1;
+	e->max_conns = max_conns;
+	e->h = *h;
+	e->p_h = p_h;
+
+#if !defined(SSL_ENGINE_EPOLL) && !defined(SSL_ENGINE_KQUEUE)
+	e->poll_fd = -1;
+	return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#else
+	if ((e->poll_fd = engine_poll_open()) < 0)
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+
+	if (listen_fd >= 0) {
+		if (net_set_nonblock(listen_fd) != 0) {
+			engine_poll_close(e);
+			return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+		}
+
+		e->listen_fd = listen_fd;
+		engine_listen(e, max_conns > 0);
+	}
+
+	return (0);
+#endif
+}
+
+int ssl_engine_add(ssl_engine * e, int fd, ssl_conn ** conn)
+{
+	int ret;
+	ssl_conn *c;
+
+	if (conn != NULL)
+		*conn = NULL;
+
+	if (net_set_nonblock(fd) != 0) {
+		net_close(fd);
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+	}
+
+	/*
+	 * Otherwise the records of a flight that do not share a write
+	 * wait for the client's delayed ACK
+	 */
+	net_set_nodelay(fd, 1);
+
+	if ((c = (ssl_conn *) malloc(sizeof(ssl_conn))) == NULL) {
+		net_close(fd);
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+	}
+
+	memset(c, 0, sizeof(ssl_conn));
+	c->fd = fd;
+	c->engine = e;
+
+	if (ssl_init(&c->ssl) != 0) {
+		net_close(fd);
+		free(c);
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+	}
+
+	ssl_set_bio(&c->ssl, net_recv, &c->fd, net_send, &c->fd);
+	ssl_set_sendv(&c->ssl, net_sendv);
+	ssl_set_session(&c->ssl, 1, 0, &c->session);
+
+	if ((ret = e->h.f_setup(e->p_h, c)) != 0) {
+		net_close(fd);
+		ssl_free(&c->ssl);
+		free(c);
+		return (ret);
+	}
+
+	c->next = e->live;
+	if (c->next != NULL)
+		c->next->prev = c;
+	e->live = c;
+	e->conns++;
+
+	engine_set_events(c, SSL_ENGINE_READ);
+
+	if (c->events == 0) {
+		engine_retire(c, TROPICSSL_ERR_NET_SOCKET_FAILED);
+		engine_reap(e);
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+	}
+
+	if (conn != NULL)
+		*conn = c;
+
+	return (0);
+}
+
+/*
+ * New clients, a batch at a time so that live ones are not starved
+ */
+static void engine_accept(ssl_engine * e)
+{
+	int i, ret, fd;
+
+	for (i = 0; i < SSL_ENGINE_ACCEPT_BATCH; i++) {
+		if (e->conns >= e->max_conns) {
+			engine_listen(e, 0);
+			return;
+		}
+
+		ret = net_accept(e->listen_fd, &fd, NULL);
+
+		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			return;
+
+		if (ret != 0) {
+			/*
+			 * Out of descriptors most likely: wait for some
+			 * connection to close rather than spin
+			 */
+			if (e->conns > 0)
+				engine_listen(e, 0);
+			return;
+		}
+
+		e->accepted++;
+		ssl_engine_add(e, fd, NULL);
+	}
+}
+
+int ssl_engine_run(ssl_engine * e, int timeout)
+{
+	int i, n;
+	void *ptrs[SSL_ENGINE_EVENTS];
+	ssl_conn *c, *next;
+
+	if (e->deferred != NULL &&
+	    (timeout < 0 || timeout > SSL_ENGINE_DEFER_MS))
+		timeout = SSL_ENGINE_DEFER_MS;
+
+	n = engine_poll_wait(e, ptrs, SSL_ENGINE_EVENTS, timeout);
+
+	if (n < 0)
+		return (TROPICSSL_ERR_NET_SOCKET_FAILED);
+
+	for (i = 0; i < n; i++) {
+		if (ptrs[i] == NULL) {
+			engine_accept(e);
+			continue;
+		}
+
+		c = (ssl_conn *) ptrs[i];
+
+		if (c->closing == 0)
+			engine_drive(c);
+	}
+
+	/*
+	 * Those deferred again go back on the list
+	 */
+	c = e->deferred;
+	e->deferred = NULL;
+
+	for (; c != NULL; c = next) {
+		next = c->defer_next;
+		c->deferred = 0;
+		c->defer_next = NULL;
+
+		if (c->closing == 0)
+			engine_drive(c);
+	}
+
+	engine_reap(e);
+
+	return (n);
+}
+
+int ssl_engine_loop(ssl_engine * e)
+{
+	int ret;
+
+	e->stop = 0;
+
+	while (e->stop == 0)
+		if ((ret = ssl_engine_run(e, -1)) < 0)
+			return (ret);
+
+	return (0);
+}
+
+void ssl_engine_stop(ssl_engine * e)
+{
+	e->stop = 1;
+}
+
+int ssl_engine_write(ssl_conn * c, const uint8_t *buf, size_t len)
+{
+	int ret;
+	size_t n;
+	uint8_t *p;
+
+	if (c->closing != 0)
+		return (TROPICSSL_ERR_NET_CONN_RESET);
+
+	if (c->open == 0 || c->pending != 0)
+		return (TROPICSSL_ERR_NET_WANT_WRITE);
+
+	if ((ret = ssl_write_reserve(&c->ssl, &p, &n)) != 0)
+		return (ret);
+
+	if (n > len)
+		n = len;
+
+	memcpy(p, buf, n);
+
+	ret = ssl_write_commit(&c->ssl, n);
+
+	if (ret == TROPICSSL_ERR_NET_WANT_WRITE) {
+		/*
+		 * Encrypted and queued: the engine finishes it
+		 */
+		c->pending = n;
+		engine_set_events(c, c->events | SSL_ENGINE_WRITE);
+		return ((int)n);
+	}
+
+	return (ret);
+}
+
+void ssl_engine_close(ssl_conn * c)
+{
+	if (c->closing != 0)
+		return;
+
+	if (c->pending != 0) {
+		c->shutdown = 1;
+		return;
+	}
+
+	if (c->open != 0)
+		ssl_close_notify(&c->ssl);
+
+	engine_retire(c, 0);
+}
+
+void ssl_engine_free(ssl_engine * e)
+{
+	while (e->live != NULL)
+		engine_retire(e->live, 0);
+
+	engine_reap(e);
+	engine_listen(e, 0);
+	engine_poll_close(e);
+
+	memset(e, 0, sizeof(ssl_engine));
+	e->poll_fd = -1;
+	e->listen_fd = -1;
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+#if (defined(SSL_ENGINE_EPOLL) || defined(SSL_ENGINE_KQUEUE)) && \
+    defined(TROPICSSL_SSL_CLI_C) && defined(TROPICSSL_SSL_SRV_C) && \
+    defined(TROPICSSL_CERTS) && defined(TROPICSSL_X509_PARSE)
+#include "tropicssl/certs.h"
+#include <sys/socket.h>
+#define SSL_ENGINE_TEST_SSL
+
+typedef struct {
+	x509_cert crt;
+	rsa_context rsa;
+	uint32_t seed;
+	int opened;
+	int closed;
+	int reason;
+} engine_test;
+
+/*
+ * Not a secure generator: the test only needs the handshake to run
+ */
+static int engine_test_rand(void *p, uint8_t *output, size_t len)
+{
+	uint32_t *state = (uint32_t *) p;
+
+	while (len-- > 0) {
+		*state = *state * 1103515245 + 12345;
+		*output++ = (uint8_t)(*state >> 16);
+	}
+
+	return (0);
+}
+
+static int engine_test_setup(void *p, ssl_conn * c)
+{
+	engine_test *t = (engine_test *) p;
+
+	ssl_set_endpoint(&c->ssl, SSL_IS_SERVER);
+	ssl_set_authmode(&c->ssl, SSL_VERIFY_NONE);
+	ssl_set_rng(&c->ssl, engine_test_rand, &t->seed);
+	ssl_set_ciphers(&c->ssl, ssl_default_ciphers);
+	ssl_set_own_cert(&c->ssl, &t->crt, &t->rsa);
+
+	return (0);
+}
+
+static void engine_test_open(void *p, ssl_conn * c)
+{
+	((engine_test *) p)->opened++;
+}
+
+/*
+ * Echo
+ */
+static int engine_test_read(void *p, ssl_conn * c,
+			    const uint8_t *buf, size_t len)
+{
+	return (ssl_engine_write(c, buf, len));
+}
+
+static void engine_test_close(void *p, ssl_conn * c, int reason)
+{
+	((engine_test *) p)->closed++;
+	((engine_test *) p)->reason = reason;
+}
+
+/*
+ * A client on one end of a socket pair, the engine on the other
+ */
+static int engine_test_ssl(void)
+{
+	int ret = 1, rc = 1, steps, fds[2];
+	uint8_t buf[16];
+	engine_test t;
+	ssl_engine e;
+	ssl_engine_handlers h;
+	ssl_context cli;
+	ssl_session cli_ssn;
+
+	memset(&t, 0, sizeof(t));
+	memset(&h, 0, sizeof(h));
+	memset(&cli_ssn, 0, sizeof(cli_ssn));
+	t.seed = 1;
+
+	h.f_setup = engine_test_setup;
+	h.f_open = engine_test_open;
+	h.f_read = engine_test_read;
+	h.f_close = engine_test_close;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return (1);
+
+	if (ssl_engine_init(&e, -1, 16, &h, &t) != 0) {
+		net_close(fds[0]);
+		net_close(fds[1]);
+		return (1);
+	}
+
+	if (ssl_init(&cli) != 0) {
+		net_close(fds[0]);
+		net_close(fds[1]);
+		ssl_engine_free(&e);
+		return (1);
+	}
+
+	if (x509parse_crt(&t.crt, (uint8_t *)test_srv_crt,
+			  strlen(test_srv_crt)) != 0 ||
+	    x509parse_key(&t.rsa, (uint8_t *)test_srv_key,
+			  strlen(test_srv_key), NULL, 0) != 0) {
+		net_close(fds[1]);
+		goto close;
+	}
+
+	/*
+	 * From here on the engine owns fds[1]
+	 */
+	if (ssl_engine_add(&e, fds[1], NULL) != 0 || e.conns != 1)
+		goto close;
+
+	net_set_nonblock(fds[0]);
+
+	ssl_set_endpoint(&cli, SSL_IS_CLIENT);
+	ssl_set_authmode(&cli, SSL_VERIFY_NONE);
+	ssl_set_rng(&cli, engine_test_rand, &t.seed);
+	ssl_set_ciphers(&cli, ssl_default_ciphers);
+	ssl_set_session(&cli, 0, 0, &cli_ssn);
+	ssl_set_bio(&cli, net_recv, &fds[0], net_send, &fds[0]);
+
+	for (steps = 0; (rc != 0 || t.opened == 0) && steps < 100; steps++) {
+		if (rc != 0)
+			rc = ssl_handshake(&cli);
+
+		if (rc != 0 && rc != TROPICSSL_ERR_NET_WANT_READ &&
+		    rc != TROPICSSL_ERR_NET_WANT_WRITE)
+			goto close;
+
+		if (ssl_engine_run(&e, 0) < 0)
+			goto close;
+	}
+
+	if (rc != 0 || t.opened != 1 ||
+	    ssl_write(&cli, (const uint8_t *)"ping", 4) != 4)
+		goto close;
+
+	/*
+	 * The echo, then a close_notify the engine acts upon
+	 */
+	for (steps = 0; steps < 100; steps++) {
+		if (ssl_engine_run(&e, 0) < 0)
+			goto close;
+
+		if ((rc = ssl_read(&cli, buf, sizeof(buf))) !=
+		    TROPICSSL_ERR_NET_WANT_READ)
+			break;
+	}
+
+	if (rc != 4 || memcmp(buf, "ping", 4) != 0 ||
+	    ssl_close_notify(&cli) != 0)
+		goto close;
+
+	for (steps = 0; t.closed == 0 && steps < 100; steps++)
+		if (ssl_engine_run(&e, 0) < 0)
+			goto close;
+
+	if (t.closed == 1 && e.conns == 0 &&
+	    t.reason == TROPICSSL_ERR_SSL_PEER_CLOSE_NOTIFY)
+		ret = 0;
+
+close:
+	net_close(fds[0]);
+	ssl_engine_free(&e);
+	ssl_free(&cli);
+	x509_free(&t.crt);
+	rsa_free(&t.rsa);
+
+	return (ret);
+}
+#endif
+
+/*
+ * Checkup routine
+ */
+int ssl_engine_self_test(int verbose)
+{
+#if defined(SSL_ENGINE_TEST_SSL)
+	if (verbose != 0)
+		printf("  SSL engine test: ");
+
+	if (engine_test_ssl() != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n\n");
+#endif
+
+	return (0);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,518 @@
+/*
+ *  Session cache in shared memory, for multi-process servers
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_SHM_CACHE_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/ssl_shm_cache.h"
+
+#include <string.h>
+#include <time.h>
+
+#if !defined(WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
+#endif
+
+/*
+ * Segment: a header, then the sets one after the other
+ *
+ *      header   "TROPSHMC", version (4), sets (4), ways (4),
+ *               slot size (4), zero up to SSL_SHM_HEADER_LEN
+ *
+ * A slot is written by whoever wins the compare-and-swap that makes
+ * its sequence number odd, and made even again once written; readers
+ * copy it out and keep the copy only if the number was even and did
+ * not change (a seqlock).
+ */
+#define SSL_SHM_HEADER_LEN      64
+#define SSL_SHM_VERSION         1
+
+/*
+ * Tries at a slot whose writer keeps changing it under the reader
+ */
+#define SSL_SHM_READ_TRIES      4
+
+typedef struct {
+	uint32_t seq;		/* odd while being written       */
+	uint32_t cipher;
+	int64_t start;		/* 0: free                       */
+	uint32_t id_len;
+	uint8_t id[32];
+	uint8_t master[48];
+	uint8_t pad[20];	/* 128 bytes, two per cache line */
+} ssl_shm_slot;
+
+static const uint8_t ssl_shm_magic[8] = "TROPSHMC";
+
+#define PUT_U32(p, v)                                   \
+	do {                                            \
+		(p)[0] = (uint8_t)((v) >> 24);          \
+		(p)[1] = (uint8_t)((v) >> 16);          \
+		(p)[2] = (uint8_t)((v) >> 8);           \
+		(p)[3] = (uint8_t)(v);                  \
+	} while (0)
+
+#define GET_U32(p)                                      \
+	(((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+	 ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+static void ssl_shm_header(uint8_t *h, uint32_t sets)
+{
+	memset(h, 0, SSL_SHM_HEADER_LEN);
+	memcpy(h, ssl_shm_magic, 8);
+	PUT_U32(h + 8, SSL_SHM_VERSION);
+	PUT_U32(h + 12, sets);
+	PUT_U32(h + 16, SSL_SHM_CACHE_WAYS);
+	PUT_U32(h + 20, sizeof(ssl_shm_slot));
+}
+
+/*
+ * FNV-1a over the session id picks the set
+ */
+static ssl_shm_slot *ssl_shm_set(const ssl_shm_cache * cache,
+				 const uint8_t *id, size_t len)
+{
+	size_t i;
+	unsigned long h = 2166136261UL;
+
+	for (i = 0; i < len; i++)
+		h = ((h ^ id[i]) * 16777619UL) & 0xFFFFFFFFUL;
+
+	return ((ssl_shm_slot *) (cache->map + SSL_SHM_HEADER_LEN) +
+		(h & (cache->sets - 1)) * SSL_SHM_CACHE_WAYS);
+}
+
+/*
+ * Copy a slot out; 0 if the copy is consistent
+ */
+static int ssl_shm_read(ssl_shm_slot * slot, ssl_shm_slot * copy)
+{
+	int i;
+	uint32_t seq;
+
+	for (i = 0; i < SSL_SHM_READ_TRIES; i++) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if ((seq & 1) != 0)
+			continue;
+
+		memcpy(copy, slot, sizeof(ssl_shm_slot));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Claim a slot for writing; 0 on success, with *seq its even number
+ */
+static int ssl_shm_lock(ssl_shm_slot * slot, uint32_t *seq)
+{
+	*seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+	if ((*seq & 1) != 0 ||
+	    !__atomic_compare_exchange_n(&slot->seq, seq, *seq + 1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return (1);
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	return (0);
+}
+
+static void ssl_shm_unlock(ssl_shm_slot * slot, uint32_t seq)
+{
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int ssl_shm_cache_init(ssl_shm_cache * cache, const char *path, size_t max)
+{
+#if defined(WIN32)
+	memset(cache, 0, sizeof(ssl_shm_cache));
+	return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#else
+	int fd;
+	void *map;
+	uint32_t sets;
+	struct stat st;
+	uint8_t header[SSL_SHM_HEADER_LEN];
+
+	memset(cache, 0, sizeof(ssl_shm_cache));
+
+	for (sets = 1; (size_t)sets * SSL_SHM_CACHE_WAYS < max &&
+	     sets < 0x1000000; sets <<= 1) ;
+
+	cache->sets = sets;
+	cache->map_len = SSL_SHM_HEADER_LEN +
+	    (size_t)sets * SSL_SHM_CACHE_WAYS * sizeof(ssl_shm_slot);
+
+	ssl_shm_header(header, sets);
+
+	if (path == NULL) {
+		map = mmap(NULL, cache->map_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+		if (map == MAP_FAILED)
+			return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+		cache->map = (uint8_t *)map;
+		memcpy(cache->map, header, SSL_SHM_HEADER_LEN);
+
+		return (0);
+	}
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+		return (TROPICSSL_ERR_FILE_IO_ERROR);
+
+	/*
+	 * The first process sizes the file; its zeroes are free slots
+	 */
+	if (fstat(fd, &st) != 0 ||
+	    (st.st_size == 0 && ftruncate(fd, (off_t) cache->map_len) != 0)) {
+		close(fd);
+		return (TROPICSSL_ERR_FILE_IO_ERROR);
+	}
+
+	if (st.st_size != 0 && (size_t)st.st_size != cache->map_len) {
+		close(fd);
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+	}
+
+	map = mmap(NULL, cache->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return (TROPICSSL_ERR_FILE_IO_ERROR);
+
+	cache->map = (uint8_t *)map;
+
+	/*
+	 * A header still zero was not written yet by the process that
+	 * sized the file: it is the same for all of them
+	 */
+	if (memcmp(cache->map, ssl_shm_magic, 8) != 0) {
+		uint8_t zero[8];
+
+		memset(zero, 0, sizeof(zero));
+
+		if (memcmp(cache->map, zero, 8) == 0)
+			memcpy(cache->map, header, SSL_SHM_HEADER_LEN);
+	}
+
+	if (memcmp(cache->map, header, SSL_SHM_HEADER_LEN) != 0) {
+		ssl_shm_cache_free(cache);
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+	}
+
+	return (0);
+#endif
+}
+
+void ssl_set_shm_session_cache(ssl_context * ssl, ssl_shm_cache * cache)
+{
+	ssl_set_scb(ssl, ssl_shm_cache_get, ssl_shm_cache_set);
+	ssl->p_scb = cache;
+}
+
+int ssl_shm_cache_get(ssl_context * ssl)
+{
+	int i, ret = 1;
+	ssl_shm_slot *set, copy;
+	ssl_session *session = ssl->session;
+	ssl_shm_cache *cache = (ssl_shm_cache *) ssl->p_scb;
+
+	if (cache == NULL || cache->map == NULL || session == NULL ||
+	    ssl->endpoint != SSL_IS_SERVER || ssl->resume == 0 ||
+	    session->length == 0 || session->length > 32)
+		return (1);
+
+	set = ssl_shm_set(cache, session->id, session->length);
+
+	for (i = 0; i < SSL_SHM_CACHE_WAYS && ret != 0; i++) {
+		if (ssl_shm_read(&set[i], &copy) != 0 ||
+		    copy.start == 0 || copy.id_len != session->length ||
+		    memcmp(copy.id, session->id, session->length) != 0)
+			continue;
+
+		if ((ssl->timeout == 0 ||
+		     time(NULL) - (time_t) copy.start <= ssl->timeout) &&
+		    copy.cipher == (uint32_t)session->cipher) {
+			memcpy(session->master, copy.master, 48);
+			ret = 0;
+		}
+
+		break;
+	}
+
+	memset(&copy, 0, sizeof(copy));
+
+	return (ret);
+}
+
+int ssl_shm_cache_set(ssl_context * ssl)
+{
+	int i, victim = -1;
+	uint32_t seq;
+	int64_t t = (int64_t) time(NULL), oldest = 0;
+	ssl_shm_slot *set, *slot;
+	ssl_session *session = ssl->session;
+	ssl_shm_cache *cache = (ssl_shm_cache *) ssl->p_scb;
+
+	if (cache == NULL || cache->map == NULL || session == NULL ||
+	    ssl->endpoint != SSL_IS_SERVER ||
+	    session->length == 0 || session->length > 32)
+		return (1);
+
+	set = ssl_shm_set(cache, session->id, session->length);
+
+	/*
+	 * The same id, else a free slot, else an expired one, else the
+	 * oldest; the fields are only peeked at, the choice may be stale
+	 */
+	for (i = 0; i < SSL_SHM_CACHE_WAYS; i++) {
+		slot = &set[i];
+
+		if (slot->start != 0 && slot->id_len == session->length &&
+		    memcmp(slot->id, session->id, session->length) == 0) {
+			victim = i;
+			break;
+		}
+
+		if (slot->start == 0 ||
+		    (ssl->timeout != 0 && t - slot->start > ssl->timeout))
+			oldest = 0, victim = i;
+		else if (victim < 0 || (oldest != 0 && slot->start < oldest))
+			oldest = slot->start, victim = i;
+	}
+
+	slot = &set[victim];
+
+	if (ssl_shm_lock(slot, &seq) != 0)
+		return (1);
+
+	slot->cipher = (uint32_t)session->cipher;
+	slot->start = (int64_t) session->start;
+	slot->id_len = (uint32_t)session->length;
+	memcpy(slot->id, session->id, session->length);
+	memcpy(slot->master, session->master, 48);
+
+	ssl_shm_unlock(slot, seq);
+
+	return (0);
+}
+
+void ssl_shm_cache_free(ssl_shm_cache * cache)
+{
+#if !defined(WIN32)
+	if (cache->map != NULL)
+		munmap(cache->map, cache->map_len);
+#endif
+
+	memset(cache, 0, sizeof(ssl_shm_cache));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+#if !defined(WIN32)
+#include <sys/wait.h>
+#endif
+
+static void ssl_shm_test_session(ssl_session * session, int n)
+{
+	memset(session, 0, sizeof(ssl_session));
+	session->start = time(NULL) - 10 + n;
+	session->cipher = TLS_RSA_WITH_AES_128_CBC_SHA;
+	session->length = 32;
+
+	memset(session->id, n + 1, 32);
+	memset(session->master, n + 0x40, 48);
+}
+
+/*
+ * Checkup routine
+ */
+int ssl_shm_cache_self_test(int verbose)
+{
+#if defined(WIN32)
+	if (verbose != 0)
+		printf("  SSL shared session cache test: skipped\n\n");
+
+	return (0);
+#else
+	int i, status;
+	pid_t pid;
+	ssl_context ssl;
+	ssl_session session, s[SSL_SHM_CACHE_WAYS + 2];
+	ssl_shm_cache cache;
+	ssl_shm_slot *slot;
+
+	if (verbose != 0)
+		printf("  SSL shared session cache test: ");
+
+	memset(&ssl, 0, sizeof(ssl_context));
+
+	/*
+	 * A single set, so that all the sessions compete for it
+	 */
+	if (ssl_shm_cache_init(&cache, NULL, SSL_SHM_CACHE_WAYS) != 0 ||
+	    cache.sets != 1)
+		goto fail;
+
+	ssl_set_shm_session_cache(&ssl, &cache);
+	ssl.endpoint = SSL_IS_SERVER;
+	ssl.resume = 1;
+	ssl.timeout = 60;
+	ssl.session = &session;
+
+	for (i = 0; i < SSL_SHM_CACHE_WAYS + 2; i++)
+		ssl_shm_test_session(&s[i], i);
+
+	for (i = 0; i < SSL_SHM_CACHE_WAYS; i++) {
+		memcpy(&session, &s[i], sizeof(ssl_session));
+		if (ssl_shm_cache_set(&ssl) != 0)
+			goto fail;
+	}
+
+	for (i = 0; i < SSL_SHM_CACHE_WAYS; i++) {
+		memcpy(&session, &s[i], sizeof(ssl_session));
+		memset(session.master, 0, 48);
+		if (ssl_shm_cache_get(&ssl) != 0 ||
+		    memcmp(session.master, s[i].master, 48) != 0)
+			goto fail;
+	}
+
+	/*
+	 * Another cipher suite does not resume
+	 */
+	memcpy(&session, &s[0], sizeof(ssl_session));
+	session.cipher = TLS_RSA_WITH_AES_256_CBC_SHA;
+	if (ssl_shm_cache_get(&ssl) == 0)
+		goto fail;
+
+	/*
+	 * A full set gives up its oldest session
+	 */
+	memcpy(&session, &s[SSL_SHM_CACHE_WAYS], sizeof(ssl_session));
+	if (ssl_shm_cache_set(&ssl) != 0)
+		goto fail;
+
+	memcpy(&session, &s[0], sizeof(ssl_session));
+	if (ssl_shm_cache_get(&ssl) == 0)
+		goto fail;
+
+	memcpy(&session, &s[1], sizeof(ssl_session));
+	if (ssl_shm_cache_get(&ssl) != 0)
+		goto fail;
+
+	/*
+	 * A slot being written is neither read nor written over
+	 */
+	slot = (ssl_shm_slot *) (cache.map + SSL_SHM_HEADER_LEN);
+	for (i = 0; i < SSL_SHM_CACHE_WAYS; i++)
+		if (slot[i].id[0] == s[1].id[0])
+			break;
+
+	slot[i].seq++;
+	if (ssl_shm_cache_get(&ssl) == 0 || ssl_shm_cache_set(&ssl) == 0)
+		goto fail;
+
+	slot[i].seq++;
+	if (ssl_shm_cache_get(&ssl) != 0)
+		goto fail;
+
+	/*
+	 * Expired sessions are not resumed
+	 */
+	slot[i].start -= 120;
+	if (ssl_shm_cache_get(&ssl) == 0)
+		goto fail;
+
+	/*
+	 * A session stored by another process is seen by this one
+	 */
+	if ((pid = fork()) < 0)
+		goto fail;
+
+	if (pid == 0) {
+		memcpy(&session, &s[SSL_SHM_CACHE_WAYS + 1],
+		       sizeof(ssl_session));
+		_exit(ssl_shm_cache_set(&ssl));
+	}
+
+	if (waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		goto fail;
+
+	memcpy(&session, &s[SSL_SHM_CACHE_WAYS + 1], sizeof(ssl_session));
+	memset(session.master, 0, 48);
+	if (ssl_shm_cache_get(&ssl) != 0 ||
+	    memcmp(session.master, s[SSL_SHM_CACHE_WAYS + 1].master,
+		   48) != 0)
+		goto fail;
+
+	ssl_shm_cache_free(&cache);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	ssl_shm_cache_free(&cache);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+#endif
+}
+
+#endif
+
+#endif
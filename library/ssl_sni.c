@@ -0,0 +1,275 @@
+/*
+ *  Server-side host name (SNI) to certificate map
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_SNI_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/ssl_sni.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+struct _ssl_sni_entry {
+	uint8_t name[SSL_SNI_MAX_NAME + 1];	/* lower case   */
+	size_t len;
+	unsigned long hash;
+	x509_cert *own_cert;
+	rsa_context *rsa_key;
+	ssl_sni_entry *next;	/* next in the hash bucket */
+};
+
+/*
+ * Lower-case copy of a host name, and its FNV-1a hash
+ */
+static unsigned long ssl_sni_hash(uint8_t *dst, const uint8_t *name,
+				  size_t len)
+{
+	unsigned long h = 2166136261UL;
+	size_t i;
+	uint8_t c;
+
+	for (i = 0; i < len; i++) {
+		c = name[i];
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+
+		dst[i] = c;
+		h = ((h ^ c) * 16777619UL) & 0xFFFFFFFFUL;
+	}
+
+	return (h);
+}
+
+static ssl_sni_entry *ssl_sni_lookup(const ssl_sni_map * map,
+				     const uint8_t *name, size_t len,
+				     unsigned long h)
+{
+	ssl_sni_entry *e;
+
+	for (e = map->table[h & map->mask]; e != NULL; e = e->next) {
+		if (e->hash == h && e->len == len &&
+		    memcmp(e->name, name, len) == 0)
+			break;
+	}
+
+	return (e);
+}
+
+int ssl_sni_init(ssl_sni_map * map, size_t max)
+{
+	size_t n;
+
+	memset(map, 0, sizeof(ssl_sni_map));
+
+	for (n = 1; n < max; n <<= 1) ;
+
+	/*
+	 * The map outlives the connections, so it comes from the heap
+	 */
+	map->table = (ssl_sni_entry **) malloc(n * sizeof(ssl_sni_entry *));
+
+	if (map->table == NULL)
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+	memset(map->table, 0, n * sizeof(ssl_sni_entry *));
+	map->mask = n - 1;
+
+	return (0);
+}
+
+int ssl_sni_add(ssl_sni_map * map, const char *name,
+		x509_cert * own_cert, rsa_context * rsa_key)
+{
+	size_t len = strlen(name);
+	uint8_t key[SSL_SNI_MAX_NAME];
+	unsigned long h;
+	ssl_sni_entry *e;
+
+	if (len == 0 || len > SSL_SNI_MAX_NAME)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	h = ssl_sni_hash(key, (const uint8_t *)name, len);
+
+	if ((e = ssl_sni_lookup(map, key, len, h)) == NULL) {
+		if ((e = (ssl_sni_entry *) malloc(sizeof(ssl_sni_entry))) == NULL)
+			return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+		memcpy(e->name, key, len);
+		e->name[len] = '\0';
+		e->len = len;
+		e->hash = h;
+		e->next = map->table[h & map->mask];
+		map->table[h & map->mask] = e;
+		map->count++;
+	}
+
+	e->own_cert = own_cert;
+	e->rsa_key = rsa_key;
+
+	return (0);
+}
+
+/*
+ * The exact name first, then "*." and all but its first label
+ */
+static const ssl_sni_entry *ssl_sni_find(const ssl_sni_map * map,
+					 const uint8_t *name, size_t len)
+{
+	uint8_t key[SSL_SNI_MAX_NAME + 1];
+	const uint8_t *dot;
+	unsigned long h;
+	ssl_sni_entry *e;
+
+	if (len == 0 || len > SSL_SNI_MAX_NAME)
+		return (NULL);
+
+	h = ssl_sni_hash(key, name, len);
+	if ((e = ssl_sni_lookup(map, key, len, h)) != NULL)
+		return (e);
+
+	if ((dot = memchr(name, '.', len)) == NULL || dot == name)
+		return (NULL);
+
+	len -= dot - name;
+	memmove(key + 1, key + (dot - name), len);
+	key[0] = '*';
+	h = ssl_sni_hash(key, key, len + 1);
+
+	return (ssl_sni_lookup(map, key, len + 1, h));
+}
+
+void ssl_set_sni_map(ssl_context * ssl, ssl_sni_map * map)
+{
+	ssl_set_sni(ssl, ssl_sni_get, map);
+}
+
+int ssl_sni_get(void *p_sni, ssl_context * ssl,
+		const uint8_t *name, size_t len)
+{
+	const ssl_sni_entry *e;
+
+	if ((e = ssl_sni_find((const ssl_sni_map *)p_sni, name, len)) != NULL)
+		ssl_set_own_cert(ssl, e->own_cert, e->rsa_key);
+
+	return (0);
+}
+
+void ssl_sni_free(ssl_sni_map * map)
+{
+	size_t i;
+	ssl_sni_entry *e;
+
+	if (map->table == NULL)
+		return;
+
+	for (i = 0; i <= map->mask; i++) {
+		while ((e = map->table[i]) != NULL) {
+			map->table[i] = e->next;
+			free(e);
+		}
+	}
+
+	free(map->table);
+	memset(map, 0, sizeof(ssl_sni_map));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+static int ssl_sni_test_pick(ssl_sni_map * map, const char *name,
+			     x509_cert * want)
+{
+	ssl_context ssl;
+
+	memset(&ssl, 0, sizeof(ssl_context));
+	ssl_set_sni_map(&ssl, map);
+
+	if (ssl.f_sni(ssl.p_sni, &ssl, (const uint8_t *)name,
+		      strlen(name)) != 0)
+		return (1);
+
+	return (ssl.own_cert != want);
+}
+
+/*
+ * Checkup routine
+ */
+int ssl_sni_self_test(int verbose)
+{
+	ssl_sni_map map;
+	x509_cert crt[3];
+
+	if (verbose != 0)
+		printf("  SSL SNI map test: ");
+
+	if (ssl_sni_init(&map, 4) != 0)
+		goto fail;
+
+	if (ssl_sni_add(&map, "www.example.com", &crt[0], NULL) != 0 ||
+	    ssl_sni_add(&map, "*.Example.COM", &crt[1], NULL) != 0 ||
+	    ssl_sni_add(&map, "*.example.com", &crt[2], NULL) != 0 ||
+	    ssl_sni_add(&map, "", &crt[0], NULL) == 0 || map.count != 2)
+		goto fail;
+
+	/*
+	 * Exact name, case folded wildcard, one label only, and a miss
+	 */
+	if (ssl_sni_test_pick(&map, "WWW.example.com", &crt[0]) != 0 ||
+	    ssl_sni_test_pick(&map, "mail.example.com", &crt[2]) != 0 ||
+	    ssl_sni_test_pick(&map, "a.b.example.com", NULL) != 0 ||
+	    ssl_sni_test_pick(&map, "example.com", NULL) != 0 ||
+	    ssl_sni_test_pick(&map, "www.example.org", NULL) != 0)
+		goto fail;
+
+	ssl_sni_free(&map);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	ssl_sni_free(&map);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
@@ -40,22 +40,282 @@
 #include "tropicssl/err.h"
 #include "tropicssl/debug.h"
 #include "tropicssl/ssl.h"
+#include "tropicssl/trace.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 
+/*
+ * Unseal a session ticket; on success the ticket's master secret
+ * replaces the session's, and ticket_cipher says which cipher it
+ * may be resumed with (ssl_write_server_hello has the final say)
+ */
+static void ssl_parse_ticket(ssl_context * ssl, const uint8_t *ticket,
+			     size_t len)
+{
+	ssl_session tmp;
+
+	memset(&tmp, 0, sizeof(ssl_session));
+
+	if (ssl->f_ticket_parse(ssl->p_ticket, ssl, &tmp, ticket, len) != 0) {
+		SSL_DEBUG_MSG(3, ("client hello, ticket not accepted"));
+		memset(&tmp, 0, sizeof(ssl_session));
+		return;
+	}
+
+	ssl->ticket_cipher = tmp.cipher;
+	ssl->session->start = tmp.start;
+	memcpy(ssl->session->master, tmp.master, sizeof(tmp.master));
+
+	memset(&tmp, 0, sizeof(ssl_session));
+}
+
+/*
+ * Hand the first host_name of the server_name list (RFC 6066) to
+ * the SNI callback
+ */
+static int ssl_parse_servername(ssl_context * ssl,
+				const uint8_t *p, size_t len)
+{
+	size_t list_len, name_len;
+
+	if (len < 2 || (list_len = (p[0] << 8) | p[1]) != len - 2) {
+		SSL_DEBUG_MSG(1, ("bad client hello message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+	}
+
+	for (p += 2; list_len > 0; p += 3 + name_len, list_len -= 3 + name_len) {
+		if (list_len < 3 ||
+		    (name_len = (p[1] << 8) | p[2]) > list_len - 3) {
+			SSL_DEBUG_MSG(1, ("bad client hello message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+		}
+
+		if (p[0] != TLS_EXT_SERVERNAME_HOSTNAME || name_len == 0)
+			continue;
+
+		SSL_DEBUG_MSG(3, ("client hello, server_name: %.*s",
+			       (int)name_len, p + 3));
+
+		if (ssl->f_sni(ssl->p_sni, ssl, p + 3, name_len) != 0) {
+			SSL_DEBUG_MSG(1, ("server_name not accepted"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+		}
+
+		ssl->sni_ack = 1;
+		break;
+	}
+
+	return (0);
+}
+
+/*
+ * Walk the ClientHello extensions, noting those the server answers
+ */
+static int ssl_parse_client_hello_ext(ssl_context * ssl,
+				      const uint8_t *p, size_t len)
+{
+	size_t i, ext_size;
+	int ext_id, ret;
+
+	while (len > 0) {
+		if (len < 4) {
+			SSL_DEBUG_MSG(1, ("bad client hello message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+		}
+
+		ext_id = (p[0] << 8) | p[1];
+		ext_size = (p[2] << 8) | p[3];
+
+		if (ext_size > len - 4) {
+			SSL_DEBUG_MSG(1, ("bad client hello message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+		}
+
+		switch (ext_id) {
+		case TLS_EXT_MAX_FRAGMENT_LENGTH:
+			if (ext_size != 1 ||
+			    p[4] < SSL_MAX_FRAG_LEN_512 ||
+			    p[4] > SSL_MAX_FRAG_LEN_4096) {
+				SSL_DEBUG_MSG(1, ("bad client hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+			}
+
+			SSL_DEBUG_MSG(3, ("client hello, max_fragment_length "
+					  "extension: %d", p[4]));
+
+			ssl->mfl_nego = p[4];
+			break;
+
+#if defined(TROPICSSL_ECP)
+		case TLS_EXT_SUPPORTED_ELLIPTIC_CURVES:
+			if (ext_size < 2 || (ext_size & 1) != 0 ||
+			    ((p[4] << 8) | p[5]) != ext_size - 2) {
+				SSL_DEBUG_MSG(1, ("bad client hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+			}
+
+			/*
+			 * Without the extension any curve will do (RFC 4492)
+			 */
+			ssl->ec_ok = 0;
+			for (i = 6; i < 4 + ext_size; i += 2)
+				if (((p[i] << 8) | p[i + 1]) == ECP_TLS_SECP256R1)
+					ssl->ec_ok = 1;
+
+			SSL_DEBUG_MSG(3, ("client hello, elliptic curves "
+					  "extension, secp256r1: %d",
+					  ssl->ec_ok));
+			break;
+
+		case TLS_EXT_EC_POINT_FORMATS:
+			if (ext_size < 1 || p[4] != ext_size - 1) {
+				SSL_DEBUG_MSG(1, ("bad client hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+			}
+
+			ssl->ec_fmt = 1;
+			if (memchr(p + 5, ECP_TLS_UNCOMPRESSED,
+				   ext_size - 1) == NULL)
+				ssl->ec_ok = 0;
+			break;
+#endif
+
+		case TLS_EXT_SIG_ALG:
+			if (ext_size < 2 || (ext_size & 1) != 0 ||
+			    ((p[4] << 8) | p[5]) != ext_size - 2) {
+				SSL_DEBUG_MSG(1, ("bad client hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+			}
+
+			/*
+			 * Sign with SHA-256 when offered, the fastest here;
+			 * else SHA-384, else the SHA-1 assumed by default
+			 */
+			for (i = 6; i < 4 + ext_size; i += 2) {
+				if (p[i + 1] != SSL_SIG_RSA)
+					continue;
+
+				if (p[i] == SSL_HASH_SHA256 ||
+				    (p[i] == SSL_HASH_SHA384 &&
+				     ssl->sig_hash != SSL_HASH_SHA256))
+					ssl->sig_hash = p[i];
+			}
+
+			SSL_DEBUG_MSG(3, ("client hello, signature_algorithms "
+					  "extension, hash: %d", ssl->sig_hash));
+			break;
+
+		case TLS_EXT_SERVERNAME:
+			if (ssl->f_sni == NULL)
+				break;
+
+			if ((ret = ssl_parse_servername(ssl, p + 4,
+							ext_size)) != 0)
+				return (ret);
+			break;
+
+		case TLS_EXT_SESSION_TICKET:
+			if (ssl->f_ticket_parse == NULL)
+				break;
+
+			SSL_DEBUG_MSG(3, ("client hello, session ticket "
+					  "extension: %d bytes", ext_size));
+
+			ssl->new_ticket = 1;
+
+			if (ext_size > 0)
+				ssl_parse_ticket(ssl, p + 4, ext_size);
+			break;
+
+		default:
+			SSL_DEBUG_MSG(3, ("client hello, ignored extension: %d",
+					  ext_id));
+			break;
+		}
+
+		p += 4 + ext_size;
+		len -= 4 + ext_size;
+	}
+
+	return (0);
+}
+
+/*
+ * Resume the session the client offered, from its ticket or the
+ * cache, or start a new one: settled with the ClientHello so that
+ * the admission callback knows which it is
+ */
+static int ssl_choose_session(ssl_context * ssl)
+{
+	int ret, offered;
+
+	if (ssl->ticket_cipher != 0 &&
+	    ssl->ticket_cipher == ssl->session->cipher &&
+	    ssl->session->length != 0) {
+		/*
+		 * Valid ticket, resume it under the client's session id
+		 */
+		SSL_STATS_INC(ssl, resume_hits);
+		ssl->resume = 1;
+		ssl->new_ticket = 0;
+		return (0);
+	}
+
+	/*
+	 * An empty session id offers nothing to resume
+	 */
+	offered = (ssl->session->length != 0);
+
+	ssl->session->length = 32;
+
+	if (ssl_session_get(ssl) == 0) {
+		/*
+		 * Found a matching session, resume it
+		 */
+		SSL_STATS_INC(ssl, resume_hits);
+		ssl->resume = 1;
+		ssl->new_ticket = 0;
+		return (0);
+	}
+
+	/*
+	 * Not found, create a new session id
+	 */
+	if (offered)
+		SSL_STATS_INC(ssl, resume_misses);
+
+	ssl->resume = 0;
+	ssl->session->start = time(NULL);
+
+	if ((ret = ssl->f_rng(ssl->p_rng, ssl->session->id, 32)) != 0) {
+		SSL_DEBUG_RET(1, "f_rng", ret);
+		return (ret);
+	}
+
+	return (0);
+}
+
 static int ssl_parse_client_hello(ssl_context * ssl)
 {
-	int ret;
+	int ret, pass;
 	unsigned int i, j;
 	size_t n;
 	unsigned int ciph_len, sess_len;
 	unsigned int chal_len, comp_len;
 	uint8_t *buf, *p;
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> parse client hello"));
 
+	ssl->sig_hash = SSL_HASH_SHA1;
+
+#if defined(TROPICSSL_ECP)
+	ssl->ec_ok = 1;
+	ssl->ec_fmt = 0;
+#endif
+
 	if ((ret = ssl_fetch_input(ssl, 5)) != 0) {
 		SSL_DEBUG_RET(1, "ssl_fetch_input", ret);
 		return (ret);
@@ -99,16 +359,21 @@ static int ssl_parse_client_hello(ssl_context * ssl)
 		ssl->max_minor_ver = buf[4];
 
 		ssl->major_ver = SSL_MAJOR_VERSION_3;
-		ssl->minor_ver = (buf[4] <= SSL_MINOR_VERSION_1)
-		    ? buf[4] : SSL_MINOR_VERSION_1;
+		ssl->minor_ver = (buf[4] <= SSL_MINOR_VERSION_3)
+		    ? buf[4] : SSL_MINOR_VERSION_3;
 
 		if ((ret = ssl_fetch_input(ssl, 2 + n)) != 0) {
 			SSL_DEBUG_RET(1, "ssl_fetch_input", ret);
 			return (ret);
 		}
 
-		md5_update(&ssl->fin_md5, buf + 2, n);
-		sha1_update(&ssl->fin_sha1, buf + 2, n);
+		SSL_STATS_INC(ssl, records_in);
+		SSL_STATS_ADD(ssl, bytes_in, ssl->in_left);
+		SSL_STATS_MAX(ssl, in_hwm, ssl->in_left);
+
+		if ((ret = ssl_transcript_update(&hs->transcript,
+						 buf + 2, n)) != 0)
+			return (ret);
 
 		buf = ssl->in_msg;
 		n = ssl->in_left - 5;
@@ -165,13 +430,23 @@ static int ssl_parse_client_hello(ssl_context * ssl)
 		memcpy(ssl->session->id, p, ssl->session->length);
 
 		p += sess_len;
-		memset(ssl->randbytes, 0, 64);
-		memcpy(ssl->randbytes + 32 - chal_len, p, chal_len);
+		memset(hs->randbytes, 0, 64);
+		memcpy(hs->randbytes + 32 - chal_len, p, chal_len);
 
 		for (i = 0; ssl->ciphers[i] != 0; i++) {
+			if (ssl_cipher_min_minor_ver(ssl->ciphers[i]) >
+			    ssl->minor_ver)
+				continue;
+
+#if defined(TROPICSSL_ECP)
+			if (ssl_cipher_is_ecdhe(ssl->ciphers[i]) &&
+			    ssl->ec_ok == 0)
+				continue;
+#endif
+
 			for (j = 0, p = buf + 6; j < ciph_len; j += 3, p += 3) {
 				if (p[0] == 0 &&
-				    p[1] == 0 && p[2] == ssl->ciphers[i])
+				    ((p[1] << 8) | p[2]) == ssl->ciphers[i])
 					goto have_cipher;
 			}
 		}
@@ -210,11 +485,16 @@ static int ssl_parse_client_hello(ssl_context * ssl)
 			return (ret);
 		}
 
+		SSL_STATS_INC(ssl, records_in);
+		SSL_STATS_ADD(ssl, bytes_in, ssl->in_left);
+		SSL_STATS_MAX(ssl, in_hwm, ssl->in_left);
+
 		buf = ssl->in_msg;
 		n = ssl->in_left - 5;
 
-		md5_update(&ssl->fin_md5, buf, n);
-		sha1_update(&ssl->fin_sha1, buf, n);
+		if ((ret = ssl_transcript_update(&hs->transcript,
+						 buf, n)) != 0)
+			return (ret);
 
 		/*
 		 * SSL layer:
@@ -249,13 +529,13 @@ static int ssl_parse_client_hello(ssl_context * ssl)
 		}
 
 		ssl->major_ver = SSL_MAJOR_VERSION_3;
-		ssl->minor_ver = (buf[5] <= SSL_MINOR_VERSION_1)
-		    ? buf[5] : SSL_MINOR_VERSION_1;
+		ssl->minor_ver = (buf[5] <= SSL_MINOR_VERSION_3)
+		    ? buf[5] : SSL_MINOR_VERSION_3;
 
 		ssl->max_major_ver = buf[4];
 		ssl->max_minor_ver = buf[5];
 
-		memcpy(ssl->randbytes, buf + 6, 32);
+		memcpy(hs->randbytes, buf + 6, 32);
 
 		/*
 		 * Check the handshake message length
@@ -308,14 +588,62 @@ static int ssl_parse_client_hello(ssl_context * ssl)
 		SSL_DEBUG_BUF(3, "client hello, compression",
 			      buf + 42 + sess_len + ciph_len, comp_len);
 
+		hs->deflate_offered =
+		    (memchr(buf + 42 + sess_len + ciph_len,
+			    SSL_COMPRESS_DEFLATE, comp_len) != NULL);
+
 		/*
-		 * Search for a matching cipher
+		 * Check the extensions, if any
 		 */
-		for (i = 0; ssl->ciphers[i] != 0; i++) {
-			for (j = 0, p = buf + 41 + sess_len; j < ciph_len;
-			     j += 2, p += 2) {
-				if (p[0] == 0 && p[1] == ssl->ciphers[i])
-					goto have_cipher;
+		ssl->mfl_nego = SSL_MAX_FRAG_LEN_NONE;
+		ssl->sni_ack = 0;
+		ssl->new_ticket = 0;
+		ssl->ticket_cipher = 0;
+		p = buf + 42 + sess_len + ciph_len + comp_len;
+
+		if (p < buf + n) {
+			if (p + 2 > buf + n ||
+			    p + 2 + ((p[0] << 8) | p[1]) != buf + n) {
+				SSL_DEBUG_MSG(1, ("bad client hello message"));
+				return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_HELLO);
+			}
+
+			if ((ret = ssl_parse_client_hello_ext(ssl, p + 2,
+							      n - (p + 2 - buf))) != 0)
+				return (ret);
+		}
+
+		/*
+		 * Search for a matching cipher. A client that lists
+		 * ChaCha20-Poly1305 first has no AES hardware: with
+		 * chacha_prio, those suites are searched first.
+		 */
+		p = buf + 41 + sess_len;
+		pass = (ssl->chacha_prio != 0 &&
+			ssl_cipher_is_chachapoly((p[0] << 8) | p[1])) ? 0 : 1;
+
+		for (; pass < 2; pass++) {
+			for (i = 0; ssl->ciphers[i] != 0; i++) {
+				if (pass == 0 &&
+				    !ssl_cipher_is_chachapoly(ssl->ciphers[i]))
+					continue;
+
+				if (ssl_cipher_min_minor_ver(ssl->ciphers[i]) >
+				    ssl->minor_ver)
+					continue;
+
+#if defined(TROPICSSL_ECP)
+				if (ssl_cipher_is_ecdhe(ssl->ciphers[i]) &&
+				    ssl->ec_ok == 0)
+					continue;
+#endif
+
+				for (j = 0, p = buf + 41 + sess_len;
+				     j < ciph_len; j += 2, p += 2) {
+					if (((p[0] << 8) | p[1]) ==
+					    ssl->ciphers[i])
+						goto have_cipher;
+				}
 			}
 		}
 	}
@@ -327,7 +655,16 @@ static int ssl_parse_client_hello(ssl_context * ssl)
 have_cipher:
 
 	ssl->session->cipher = ssl->ciphers[i];
+
+	ssl_transcript_select(&hs->transcript,
+			      ssl_transcript_digests(ssl->minor_ver,
+						     ssl->session->cipher));
+
 	ssl->in_left = 0;
+
+	if ((ret = ssl_choose_session(ssl)) != 0)
+		return (ret);
+
 	ssl->state++;
 
 	SSL_DEBUG_MSG(2, ("<= parse client hello"));
@@ -335,12 +672,37 @@ have_cipher:
 	return (0);
 }
 
+/*
+ * Let the admission callback hold back or refuse the handshake, now
+ * that it is known to be full or resumed
+ */
+static int ssl_check_admission(ssl_context * ssl)
+{
+	int ret;
+
+	if (ssl->f_admit == NULL)
+		return (0);
+
+	ret = ssl->f_admit(ssl->p_admit, ssl, ssl->resume);
+
+	TROPICSSL_TRACE3(handshake_admit, ssl, ssl->resume, ret);
+
+	if (ret == TROPICSSL_ERR_SSL_HANDSHAKE_DEFERRED) {
+		SSL_DEBUG_MSG(3, ("handshake deferred"));
+	} else if (ret != 0) {
+		SSL_DEBUG_RET(1, "f_admit", ret);
+	}
+
+	return (ret);
+}
+
 static int ssl_write_server_hello(ssl_context * ssl)
 {
 	time_t t;
-	int ret, i;
-	size_t n;
+	int ret;
+	size_t n, ext_len;
 	uint8_t *buf, *p;
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> write server hello"));
 
@@ -368,10 +730,13 @@ static int ssl_write_server_hello(ssl_context * ssl)
 
 	SSL_DEBUG_MSG(3, ("server hello, current time: %lu", t));
 
-	for (i = 28; i > 0; i--)
-		*p++ = (uint8_t)ssl->f_rng(ssl->p_rng);
+	if ((ret = ssl->f_rng(ssl->p_rng, p, 28)) != 0) {
+		SSL_DEBUG_RET(1, "f_rng", ret);
+		return (ret);
+	}
+	p += 28;
 
-	memcpy(ssl->randbytes + 32, buf + 6, 32);
+	memcpy(hs->randbytes + 32, buf + 6, 32);
 
 	SSL_DEBUG_BUF(3, "server hello, random bytes", buf + 6, 32);
 
@@ -380,28 +745,25 @@ static int ssl_write_server_hello(ssl_context * ssl)
 	 *    39  . 38+n  session id
 	 *   39+n . 40+n  chosen cipher
 	 *   41+n . 41+n  chosen compression alg.
+	 *
+	 * The session was chosen with the ClientHello
 	 */
-	ssl->session->length = n = 32;
-	*p++ = (uint8_t)ssl->session->length;
-
-	if (ssl->s_get == NULL || ssl->s_get(ssl) != 0) {
-		/*
-		 * Not found, create a new session id
-		 */
-		ssl->resume = 0;
-		ssl->state++;
-
-		for (i = 0; i < n; i++)
-			ssl->session->id[i] =
-			    (uint8_t)ssl->f_rng(ssl->p_rng);
-	} else {
-		/*
-		 * Found a matching session, resume it
-		 */
-		ssl->resume = 1;
+	if (ssl->resume != 0) {
 		ssl->state = SSL_SERVER_CHANGE_CIPHER_SPEC;
 		ssl_derive_keys(ssl);
-	}
+	} else
+		ssl->state++;
+
+	/*
+	 * Settled after any resumed session was copied in, as the
+	 * client may not offer what the session had
+	 */
+	ssl->session->compression =
+	    (ssl->compress_level > 0 && hs->deflate_offered)
+	    ? SSL_COMPRESS_DEFLATE : SSL_COMPRESS_NULL;
+
+	n = ssl->session->length;
+	*p++ = (uint8_t)n;
 
 	memcpy(p, ssl->session->id, ssl->session->length);
 	p += ssl->session->length;
@@ -413,11 +775,76 @@ static int ssl_write_server_hello(ssl_context * ssl)
 
 	*p++ = (uint8_t)(ssl->session->cipher >> 8);
 	*p++ = (uint8_t)(ssl->session->cipher);
-	*p++ = SSL_COMPRESS_NULL;
+	*p++ = (uint8_t)(ssl->session->compression);
 
 	SSL_DEBUG_MSG(3, ("server hello, chosen cipher: %d",
 			  ssl->session->cipher));
-	SSL_DEBUG_MSG(3, ("server hello, compress alg.: %d", 0));
+	SSL_DEBUG_MSG(3, ("server hello, compress alg.: %d",
+			  ssl->session->compression));
+
+	/*
+	 *   42+n . 43+n  extensions length
+	 *   44+n . ...   extensions
+	 */
+	ext_len = ((ssl->mfl_nego != SSL_MAX_FRAG_LEN_NONE) ? 5 : 0) +
+	    ((ssl->new_ticket != 0) ? 4 : 0) + ((ssl->sni_ack != 0) ? 4 : 0);
+#if defined(TROPICSSL_ECP)
+	if (ssl->ec_fmt != 0 && ssl_cipher_is_ecdhe(ssl->session->cipher))
+		ext_len += 6;
+#endif
+
+	if (ext_len != 0) {
+		*p++ = (uint8_t)((ext_len >> 8) & 0xFF);
+		*p++ = (uint8_t)((ext_len) & 0xFF);
+	}
+
+	if (ssl->sni_ack != 0) {
+		SSL_DEBUG_MSG(3, ("server hello, server_name extension"));
+
+		*p++ = (uint8_t)((TLS_EXT_SERVERNAME >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_SERVERNAME) & 0xFF);
+
+		*p++ = 0;
+		*p++ = 0;
+	}
+
+	if (ssl->mfl_nego != SSL_MAX_FRAG_LEN_NONE) {
+		SSL_DEBUG_MSG(3, ("server hello, max_fragment_length "
+				  "extension: %d", ssl->mfl_nego));
+
+		*p++ = (uint8_t)((TLS_EXT_MAX_FRAGMENT_LENGTH >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_MAX_FRAGMENT_LENGTH) & 0xFF);
+
+		*p++ = 0;
+		*p++ = 1;
+
+		*p++ = (uint8_t)ssl->mfl_nego;
+	}
+
+	if (ssl->new_ticket != 0) {
+		SSL_DEBUG_MSG(3, ("server hello, session ticket extension"));
+
+		*p++ = (uint8_t)((TLS_EXT_SESSION_TICKET >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_SESSION_TICKET) & 0xFF);
+
+		*p++ = 0;
+		*p++ = 0;
+	}
+
+#if defined(TROPICSSL_ECP)
+	if (ssl->ec_fmt != 0 && ssl_cipher_is_ecdhe(ssl->session->cipher)) {
+		SSL_DEBUG_MSG(3, ("server hello, ec_point_formats extension"));
+
+		*p++ = (uint8_t)((TLS_EXT_EC_POINT_FORMATS >> 8) & 0xFF);
+		*p++ = (uint8_t)((TLS_EXT_EC_POINT_FORMATS) & 0xFF);
+
+		*p++ = 0;
+		*p++ = 2;
+
+		*p++ = 1;
+		*p++ = ECP_TLS_UNCOMPRESSED;
+	}
+#endif
 
 	ssl->out_msglen = p - buf;
 	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
@@ -430,12 +857,78 @@ static int ssl_write_server_hello(ssl_context * ssl)
 	return (ret);
 }
 
+static int ssl_write_new_session_ticket(ssl_context * ssl)
+{
+	int ret;
+	size_t n;
+	uint32_t lifetime;
+	uint8_t *buf;
+
+	SSL_DEBUG_MSG(2, ("=> write new session ticket"));
+
+	if (ssl->new_ticket == 0) {
+		SSL_DEBUG_MSG(2, ("<= skip write new session ticket"));
+		ssl->state++;
+		return (0);
+	}
+
+	/*
+	 *     0  .   0   handshake type
+	 *     1  .   3   handshake length
+	 *     4  .   7   ticket lifetime hint
+	 *     8  .   9   ticket length (n)
+	 *    10  . 9+n   ticket
+	 *
+	 * A ticket that cannot be sealed goes out empty: the
+	 * ServerHello promised this message already.
+	 */
+	buf = ssl->out_msg;
+	n = ssl->out_content_len - 10;
+	lifetime = 0;
+
+	if (ssl->f_ticket_write(ssl->p_ticket, ssl, buf + 10, &n,
+				&lifetime) != 0) {
+		SSL_DEBUG_MSG(1, ("session ticket not sealed"));
+		n = 0;
+		lifetime = 0;
+	}
+
+	SSL_DEBUG_MSG(3, ("new session ticket, lifetime: %lu, length: %d",
+			  (unsigned long)lifetime, n));
+
+	buf[4] = (uint8_t)(lifetime >> 24);
+	buf[5] = (uint8_t)(lifetime >> 16);
+	buf[6] = (uint8_t)(lifetime >> 8);
+	buf[7] = (uint8_t)(lifetime);
+
+	buf[8] = (uint8_t)((n >> 8) & 0xFF);
+	buf[9] = (uint8_t)((n) & 0xFF);
+
+	ssl->out_msglen = 10 + n;
+	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
+	ssl->out_msg[0] = SSL_HS_NEW_SESSION_TICKET;
+
+	/*
+	 * Sent in the clear, before our ChangeCipherSpec
+	 */
+	ssl->out_crypt = 0;
+	ssl->state++;
+
+	if ((ret = ssl_write_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_write_record", ret);
+		return (ret);
+	}
+
+	SSL_DEBUG_MSG(2, ("<= write new session ticket"));
+
+	return (0);
+}
+
 static int ssl_write_certificate_request(ssl_context * ssl)
 {
 	int ret;
 	size_t n;
-	uint8_t *buf, *p;
-	const x509_cert *crt;
+	uint8_t *buf, *p, *dn;
 
 	SSL_DEBUG_MSG(2, ("=> write certificate request"));
 
@@ -451,6 +944,7 @@ static int ssl_write_certificate_request(ssl_context * ssl)
 	 *     1  .   3   handshake length
 	 *     4  .   4   cert type count
 	 *     5  .. n-1  cert types
+	 *   (TLSv1.2: signature and hash algorithms, 2-byte counted)
 	 *     n  .. n+1  length of all DNs
 	 *    n+2 .. n+3  length of DN 1
 	 *    n+4 .. ...  Distinguished Name #1
@@ -465,28 +959,33 @@ static int ssl_write_certificate_request(ssl_context * ssl)
 	*p++ = 1;
 	*p++ = 1;
 
-	p += 2;
-	crt = ssl->ca_chain;
-
-	while (crt != NULL && crt->next != NULL) {
-		if (p - buf > 4096)
-			break;
+	/*
+	 * TLSv1.2: the client is to sign with the PRF hash, the only
+	 * one kept of the handshake messages
+	 */
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3) {
+		*p++ = 0;
+		*p++ = 2;
+		*p++ = (uint8_t)ssl_cipher_prf_hash(ssl->session->cipher);
+		*p++ = SSL_SIG_RSA;
+	}
 
-		n = crt->subject_raw.len;
-		*p++ = (uint8_t)(n >> 8);
-		*p++ = (uint8_t)(n);
-		memcpy(p, crt->subject_raw.p, n);
+	/*
+	 * The DN list is encoded once by ssl_set_ca_chain(), when
+	 * memory allowed
+	 */
+	if (ssl->ca_chain != NULL && (dn = ssl->ca_chain->dn_list) != NULL) {
+		n = 2 + (((size_t)dn[0] << 8) | (size_t)dn[1]);
+		memcpy(p, dn, n);
+	} else
+		n = ssl_encode_dn_list(ssl->ca_chain, p);
 
-		SSL_DEBUG_BUF(3, "requested DN", p, n);
-		p += n;
-		crt = crt->next;
-	}
+	SSL_DEBUG_BUF(3, "requested DNs", p + 2, n - 2);
+	p += n;
 
-	ssl->out_msglen = n = p - buf;
+	ssl->out_msglen = p - buf;
 	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
 	ssl->out_msg[0] = SSL_HS_CERTIFICATE_REQUEST;
-	ssl->out_msg[6] = (uint8_t)((n - 8) >> 8);
-	ssl->out_msg[7] = (uint8_t)((n - 8));
 
 	ret = ssl_write_record(ssl);
 
@@ -495,46 +994,152 @@ static int ssl_write_certificate_request(ssl_context * ssl)
 	return (ret);
 }
 
+/*
+ * Run a private key operation, or start / poll it through the
+ * async callbacks. The caller's state is re-entered while it is
+ * pending, with ssl->async_op set so that its input is not redone.
+ */
+static int ssl_private_op(ssl_context * ssl, int op,
+			  const uint8_t *input, size_t ilen,
+			  uint8_t *output, size_t *olen, size_t osize)
+{
+	int ret;
+
+	if (ssl->async_op == 0) {
+		ret = TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE;
+
+		if (ssl->f_async_start != NULL)
+			ret = ssl->f_async_start(ssl->p_async, ssl, op,
+						 input, ilen);
+
+		if (ret == TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE) {
+			SSL_STATS_OP_START(ssl);
+
+			if (op == SSL_ASYNC_SIGN) {
+				*olen = ssl->rsa_key->len;
+				ret = ssl_rsa_sign(ssl, ilen, input, output);
+			} else
+				ret = ssl_rsa_decrypt(ssl, olen, input,
+						      output, osize);
+
+			SSL_STATS_OP_END(ssl, rsa);
+
+			return (ret);
+		}
+
+		if (ret != 0)
+			return (ret);
+
+		SSL_DEBUG_MSG(3, ("private key operation %d started", op));
+
+		ssl->async_op = op;
+	}
+
+	ret = ssl->f_async_resume(ssl->p_async, ssl, output, olen, osize);
+
+	if (ret == TROPICSSL_ERR_SSL_ASYNC_IN_PROGRESS)
+		return (ret);
+
+	SSL_DEBUG_RET(3, "private key operation done", ret);
+
+	ssl->async_op = 0;
+
+	return (ret);
+}
+
 static int ssl_write_server_key_exchange(ssl_context * ssl)
 {
 	int ret;
-	size_t n;
-	uint8_t hash[36];
-	md5_context md5;
-	sha1_context sha1;
+	size_t n, len, hlen = 0, i;
+	uint8_t hash[SSL_SIG_INPUT_MAX];
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> write server key exchange"));
 
-	if (ssl->session->cipher != TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA &&
-	    ssl->session->cipher != TLS_DHE_RSA_WITH_AES_256_CBC_SHA &&
-	    ssl->session->cipher != TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA) {
+	if (!ssl_cipher_is_dhe(ssl->session->cipher) &&
+	    !ssl_cipher_is_ecdhe(ssl->session->cipher)) {
 		SSL_DEBUG_MSG(2, ("<= skip write server key exchange"));
 		ssl->state++;
 		return (0);
 	}
+
+	if (ssl->async_op != 0) {
+		/*
+		 * Back for the signature; the parameters are already
+		 * in out_msg
+		 */
+		n = ssl->async_off;
+		i = (ssl->minor_ver >= SSL_MINOR_VERSION_3) ? 8 : 6;
+		goto sign;
+	}
+
+	if (ssl_cipher_is_ecdhe(ssl->session->cipher)) {
+#if !defined(TROPICSSL_ECP)
+		SSL_DEBUG_MSG(1, ("support for ecp is not available"));
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#else
+		/*
+		 * Ephemeral ECDH parameters:
+		 *
+		 * struct {
+		 *     ECCurveType curve_type;     (named_curve)
+		 *     NamedCurve namedcurve;      (secp256r1)
+		 *     opaque point<1..2^8-1>;
+		 * } ServerECDHParams;
+		 */
+		SSL_STATS_OP_START(ssl);
+
+		ret = ecdh_make_params(&hs->ecdh_ctx, ssl->out_msg + 4, &n,
+				       ssl->f_rng, ssl->p_rng);
+
+		SSL_STATS_OP_END(ssl, ecdh);
+
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "ecdh_make_params", ret);
+			return (ret);
+		}
+
+		SSL_DEBUG_BUF(3, "ECDH: Q ", hs->ecdh_ctx.Q,
+			      ECP_P256_POINT_LEN);
+#endif
+	} else {
 #if !defined(TROPICSSL_DHM)
-	SSL_DEBUG_MSG(1, ("support for dhm is not available"));
-	return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+		SSL_DEBUG_MSG(1, ("support for dhm is not available"));
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
 #else
-	/*
-	 * Ephemeral DH parameters:
-	 *
-	 * struct {
-	 *     opaque dh_p<1..2^16-1>;
-	 *     opaque dh_g<1..2^16-1>;
-	 *     opaque dh_Ys<1..2^16-1>;
-	 * } ServerDHParams;
-	 */
-	if ((ret = dhm_make_params(&ssl->dhm_ctx, 256, ssl->out_msg + 4,
-				   &n, ssl->f_rng, ssl->p_rng)) != 0) {
-		SSL_DEBUG_RET(1, "dhm_make_params", ret);
-		return (ret);
-	}
+		/*
+		 * Ephemeral DH parameters:
+		 *
+		 * struct {
+		 *     opaque dh_p<1..2^16-1>;
+		 *     opaque dh_g<1..2^16-1>;
+		 *     opaque dh_Ys<1..2^16-1>;
+		 * } ServerDHParams;
+		 */
+		SSL_STATS_OP_START(ssl);
+
+		if (ssl->dhm_sh != NULL)
+			ret = dhm_make_params_shared(&hs->dhm_ctx, ssl->dhm_sh,
+						     ssl->out_msg + 4, &n,
+						     ssl->f_rng, ssl->p_rng);
+		else
+			ret = dhm_make_params(&hs->dhm_ctx, 256,
+					      ssl->out_msg + 4, &n, ssl->f_rng,
+					      ssl->p_rng);
+
+		SSL_STATS_OP_END(ssl, dh);
 
-	SSL_DEBUG_MPI(3, "DHM: X ", &ssl->dhm_ctx.X);
-	SSL_DEBUG_MPI(3, "DHM: P ", &ssl->dhm_ctx.P);
-	SSL_DEBUG_MPI(3, "DHM: G ", &ssl->dhm_ctx.G);
-	SSL_DEBUG_MPI(3, "DHM: GX", &ssl->dhm_ctx.GX);
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "dhm_make_params", ret);
+			return (ret);
+		}
+
+		SSL_DEBUG_MPI(3, "DHM: X ", &hs->dhm_ctx.X);
+		SSL_DEBUG_MPI(3, "DHM: P ", &hs->dhm_ctx.P);
+		SSL_DEBUG_MPI(3, "DHM: G ", &hs->dhm_ctx.G);
+		SSL_DEBUG_MPI(3, "DHM: GX", &hs->dhm_ctx.GX);
+#endif
+	}
 
 	/*
 	 * digitally-signed struct {
@@ -548,32 +1153,41 @@ static int ssl_write_server_key_exchange(ssl_context * ssl)
 	 * sha_hash
 	 *     SHA(ClientHello.random + ServerHello.random
 	 *                            + ServerParams);
+	 *
+	 * or, from TLSv1.2 on, the DigestInfo of the hash the client
+	 * preferred, named in front of the signature
 	 */
-	md5_starts(&md5);
-	md5_update(&md5, ssl->randbytes, 64);
-	md5_update(&md5, ssl->out_msg + 4, n);
-	md5_finish(&md5, hash);
+	hlen = ssl_calc_params_hash(ssl, ssl->sig_hash, ssl->out_msg + 4, n,
+				    hash);
 
-	sha1_starts(&sha1);
-	sha1_update(&sha1, ssl->randbytes, 64);
-	sha1_update(&sha1, ssl->out_msg + 4, n);
-	sha1_finish(&sha1, hash + 16);
+	i = 4 + n;
 
-	SSL_DEBUG_BUF(3, "parameters hash", hash, 36);
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3) {
+		ssl->out_msg[i++] = (uint8_t)ssl->sig_hash;
+		ssl->out_msg[i++] = SSL_SIG_RSA;
+	}
 
-	ssl->out_msg[4 + n] = (uint8_t)(ssl->rsa_key->len >> 8);
-	ssl->out_msg[5 + n] = (uint8_t)(ssl->rsa_key->len);
+	ssl->out_msg[i++] = (uint8_t)(ssl->rsa_key->len >> 8);
+	ssl->out_msg[i++] = (uint8_t)(ssl->rsa_key->len);
 
-	ret = rsa_pkcs1_sign(ssl->rsa_key, RSA_PRIVATE,
-			     RSA_RAW, 36, hash, ssl->out_msg + 6 + n);
-	if (ret != 0) {
-		SSL_DEBUG_RET(1, "rsa_pkcs1_sign", ret);
+	i -= n;
+	ssl->async_off = n;
+
+sign:
+	ret = ssl_private_op(ssl, SSL_ASYNC_SIGN, hash, hlen,
+			     ssl->out_msg + i + n, &len, ssl->rsa_key->len);
+	if (ret == TROPICSSL_ERR_SSL_ASYNC_IN_PROGRESS)
 		return (ret);
+
+	if (ret != 0 || len != ssl->rsa_key->len) {
+		SSL_DEBUG_RET(1, "rsa_pkcs1_sign", ret);
+		return (ret != 0 ? ret : TROPICSSL_ERR_RSA_PRIVATE_FAILED);
 	}
 
-	SSL_DEBUG_BUF(3, "my RSA sig", ssl->out_msg + 6 + n, ssl->rsa_key->len);
+	SSL_DEBUG_BUF(3, "my RSA sig", ssl->out_msg + i + n,
+		      ssl->rsa_key->len);
 
-	ssl->out_msglen = 6 + n + ssl->rsa_key->len;
+	ssl->out_msglen = i + n + ssl->rsa_key->len;
 	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
 	ssl->out_msg[0] = SSL_HS_SERVER_KEY_EXCHANGE;
 
@@ -587,7 +1201,6 @@ static int ssl_write_server_key_exchange(ssl_context * ssl)
 	SSL_DEBUG_MSG(2, ("<= write server key exchange"));
 
 	return (0);
-#endif
 }
 
 static int ssl_write_server_hello_done(ssl_context * ssl)
@@ -616,9 +1229,19 @@ static int ssl_parse_client_key_exchange(ssl_context * ssl)
 {
 	int ret;
 	size_t i, n;
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> parse client key exchange"));
 
+	/*
+	 * Back for the premaster: the message was read and checked
+	 */
+	if (ssl->async_op != 0) {
+		i = ssl->async_off;
+		n = ssl->rsa_key->len;
+		goto decrypt;
+	}
+
 	if ((ret = ssl_read_record(ssl)) != 0) {
 		SSL_DEBUG_RET(1, "ssl_read_record", ret);
 		return (ret);
@@ -634,9 +1257,40 @@ static int ssl_parse_client_key_exchange(ssl_context * ssl)
 		return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE);
 	}
 
-	if (ssl->session->cipher == TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA ||
-	    ssl->session->cipher == TLS_DHE_RSA_WITH_AES_256_CBC_SHA ||
-	    ssl->session->cipher == TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA) {
+	if (ssl_cipher_is_ecdhe(ssl->session->cipher)) {
+#if !defined(TROPICSSL_ECP)
+		SSL_DEBUG_MSG(1, ("support for ecp is not available"));
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#else
+		/*
+		 * Receive the client's point Qc, premaster = x(d.Qc)
+		 */
+		if ((ret = ecdh_read_public(&hs->ecdh_ctx, ssl->in_msg + 4,
+					    ssl->in_hslen - 4)) != 0) {
+			SSL_DEBUG_RET(1, "ecdh_read_public", ret);
+			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE |
+				ret);
+		}
+
+		SSL_DEBUG_BUF(3, "ECDH: Qp", hs->ecdh_ctx.Qp,
+			      ECP_P256_POINT_LEN);
+
+		hs->pmslen = sizeof(hs->premaster);
+
+		SSL_STATS_OP_START(ssl);
+
+		ret = ecdh_calc_secret(&hs->ecdh_ctx, hs->premaster,
+				       &hs->pmslen);
+
+		SSL_STATS_OP_END(ssl, ecdh);
+
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "ecdh_calc_secret", ret);
+			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE |
+				ret);
+		}
+#endif
+	} else if (ssl_cipher_is_dhe(ssl->session->cipher)) {
 #if !defined(TROPICSSL_DHM)
 		SSL_DEBUG_MSG(1, ("support for dhm is not available"));
 		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
@@ -646,31 +1300,36 @@ static int ssl_parse_client_key_exchange(ssl_context * ssl)
 		 */
 		n = (ssl->in_msg[4] << 8) | ssl->in_msg[5];
 
-		if (n < 1 || n > ssl->dhm_ctx.len || n + 6 != ssl->in_hslen) {
+		if (n < 1 || n > hs->dhm_ctx.len || n + 6 != ssl->in_hslen) {
 			SSL_DEBUG_MSG(1, ("bad client key exchange message"));
 			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE);
 		}
 
-		if ((ret = dhm_read_public(&ssl->dhm_ctx,
+		if ((ret = dhm_read_public(&hs->dhm_ctx,
 					   ssl->in_msg + 6, n)) != 0) {
 			SSL_DEBUG_RET(1, "dhm_read_public", ret);
 			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE |
 				ret);
 		}
 
-		SSL_DEBUG_MPI(3, "DHM: GY", &ssl->dhm_ctx.GY);
+		SSL_DEBUG_MPI(3, "DHM: GY", &hs->dhm_ctx.GY);
+
+		hs->pmslen = hs->dhm_ctx.len;
+
+		SSL_STATS_OP_START(ssl);
 
-		ssl->pmslen = ssl->dhm_ctx.len;
+		ret = dhm_calc_secret(&hs->dhm_ctx, hs->premaster,
+				      &hs->pmslen);
 
-		if ((ret = dhm_calc_secret(&ssl->dhm_ctx,
-					   ssl->premaster,
-					   &ssl->pmslen)) != 0) {
+		SSL_STATS_OP_END(ssl, dh);
+
+		if (ret != 0) {
 			SSL_DEBUG_RET(1, "dhm_calc_secret", ret);
 			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE |
 				ret);
 		}
 
-		SSL_DEBUG_MPI(3, "DHM: K ", &ssl->dhm_ctx.K);
+		SSL_DEBUG_MPI(3, "DHM: K ", &hs->dhm_ctx.K);
 #endif
 	} else {
 		/*
@@ -678,7 +1337,7 @@ static int ssl_parse_client_key_exchange(ssl_context * ssl)
 		 */
 		i = 4;
 		n = ssl->rsa_key->len;
-		ssl->pmslen = 48;
+		hs->pmslen = 48;
 
 		if (ssl->minor_ver != SSL_MINOR_VERSION_0) {
 			i += 2;
@@ -696,13 +1355,18 @@ static int ssl_parse_client_key_exchange(ssl_context * ssl)
 			return (TROPICSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE);
 		}
 
-		ret = rsa_pkcs1_decrypt(ssl->rsa_key, RSA_PRIVATE, &ssl->pmslen,
-					ssl->in_msg + i, ssl->premaster,
-					sizeof(ssl->premaster));
+		ssl->async_off = i;
+
+decrypt:
+		ret = ssl_private_op(ssl, SSL_ASYNC_DECRYPT, ssl->in_msg + i,
+				     n, hs->premaster, &hs->pmslen,
+				     sizeof(hs->premaster));
+		if (ret == TROPICSSL_ERR_SSL_ASYNC_IN_PROGRESS)
+			return (ret);
 
-		if (ret != 0 || ssl->pmslen != 48 ||
-		    ssl->premaster[0] != ssl->max_major_ver ||
-		    ssl->premaster[1] != ssl->max_minor_ver) {
+		if (ret != 0 || hs->pmslen != 48 ||
+		    hs->premaster[0] != ssl->max_major_ver ||
+		    hs->premaster[1] != ssl->max_minor_ver) {
 			SSL_DEBUG_MSG(1, ("bad client key exchange message"));
 
 			/*
@@ -711,18 +1375,20 @@ static int ssl_parse_client_key_exchange(ssl_context * ssl)
 			 * the connection to end immediately; instead,
 			 * send a bad_record_mac later in the handshake.
 			 */
-			ssl->pmslen = 48;
+			hs->pmslen = 48;
 
-			for (i = 0; i < ssl->pmslen; i++)
-				ssl->premaster[i] =
-				    (uint8_t)ssl->f_rng(ssl->p_rng);
+			ret = ssl->f_rng(ssl->p_rng, hs->premaster,
+					 hs->pmslen);
+			if (ret != 0) {
+				SSL_DEBUG_RET(1, "f_rng", ret);
+				return (ret);
+			}
 		}
 	}
 
 	ssl_derive_keys(ssl);
 
-	if (ssl->s_set != NULL)
-		ssl->s_set(ssl);
+	ssl_session_set(ssl);
 
 	ssl->state++;
 
@@ -734,8 +1400,8 @@ static int ssl_parse_client_key_exchange(ssl_context * ssl)
 static int ssl_parse_certificate_verify(ssl_context * ssl)
 {
 	int ret;
-	size_t n1, n2;
-	uint8_t hash[36];
+	size_t n1, n2, hlen, i = 4;
+	uint8_t hash[SSL_SIG_INPUT_MAX];
 
 	SSL_DEBUG_MSG(2, ("=> parse certificate verify"));
 
@@ -745,7 +1411,7 @@ static int ssl_parse_certificate_verify(ssl_context * ssl)
 		return (0);
 	}
 
-	ssl_calc_verify(ssl, hash);
+	hlen = ssl_calc_verify(ssl, hash);
 
 	if ((ret = ssl_read_record(ssl)) != 0) {
 		SSL_DEBUG_RET(1, "ssl_read_record", ret);
@@ -764,16 +1430,35 @@ static int ssl_parse_certificate_verify(ssl_context * ssl)
 		return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE_VERIFY);
 	}
 
+	/*
+	 * TLSv1.2: only the algorithm asked for in the request will do
+	 */
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3) {
+		if (ssl->in_hslen < 6 ||
+		    ssl->in_msg[4] != ssl_cipher_prf_hash(ssl->session->cipher) ||
+		    ssl->in_msg[5] != SSL_SIG_RSA) {
+			SSL_DEBUG_MSG(1, ("bad certificate verify message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE_VERIFY);
+		}
+
+		i += 2;
+	}
+
 	n1 = ssl->peer_cert->rsa.len;
-	n2 = (ssl->in_msg[4] << 8) | ssl->in_msg[5];
+	n2 = (ssl->in_msg[i] << 8) | ssl->in_msg[i + 1];
 
-	if (n1 + 6 != ssl->in_hslen || n1 != n2) {
+	if (n1 + i + 2 != ssl->in_hslen || n1 != n2) {
 		SSL_DEBUG_MSG(1, ("bad certificate verify message"));
 		return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE_VERIFY);
 	}
 
+	SSL_STATS_OP_START(ssl);
+
 	ret = rsa_pkcs1_verify(&ssl->peer_cert->rsa, RSA_PUBLIC,
-			       RSA_RAW, 36, hash, ssl->in_msg + 6);
+			       RSA_RAW, hlen, hash, ssl->in_msg + i + 2);
+
+	SSL_STATS_OP_END(ssl, rsa);
+
 	if (ret != 0) {
 		SSL_DEBUG_RET(1, "rsa_pkcs1_verify", ret);
 		return (ret);
@@ -799,6 +1484,9 @@ int ssl_handshake_server(ssl_context * ssl)
 		if ((ret = ssl_flush_output(ssl)) != 0)
 			break;
 
+		SSL_STATS_STATE_START(ssl);
+		TROPICSSL_TRACE3(handshake_state_start, ssl, SSL_IS_SERVER, ssl->state);
+
 		switch (ssl->state) {
 		case SSL_HELLO_REQUEST:
 			ssl->state = SSL_CLIENT_HELLO;
@@ -819,7 +1507,8 @@ int ssl_handshake_server(ssl_context * ssl)
 			 *        ServerHelloDone
 			 */
 		case SSL_SERVER_HELLO:
-			ret = ssl_write_server_hello(ssl);
+			if ((ret = ssl_check_admission(ssl)) == 0)
+				ret = ssl_write_server_hello(ssl);
 			break;
 
 		case SSL_SERVER_CERTIFICATE:
@@ -866,9 +1555,14 @@ int ssl_handshake_server(ssl_context * ssl)
 			break;
 
 			/*
-			 *  ==>   ChangeCipherSpec
+			 *  ==> ( NewSessionTicket )
+			 *        ChangeCipherSpec
 			 *        Finished
 			 */
+		case SSL_SERVER_NEW_SESSION_TICKET:
+			ret = ssl_write_new_session_ticket(ssl);
+			break;
+
 		case SSL_SERVER_CHANGE_CIPHER_SPEC:
 			ret = ssl_write_change_cipher_spec(ssl);
 			break;
@@ -879,6 +1573,7 @@ int ssl_handshake_server(ssl_context * ssl)
 
 		case SSL_FLUSH_BUFFERS:
 			SSL_DEBUG_MSG(2, ("handshake: done"));
+			SSL_STATS_INC(ssl, handshakes);
 			ssl->state = SSL_HANDSHAKE_OVER;
 			break;
 
@@ -887,10 +1582,15 @@ int ssl_handshake_server(ssl_context * ssl)
 			return (TROPICSSL_ERR_BAD_ARG);
 		}
 
+		SSL_STATS_STATE_END(ssl);
+		TROPICSSL_TRACE3(handshake_state_done, ssl, SSL_IS_SERVER, ret);
+
 		if (ret != 0)
 			break;
 	}
 
+	TROPICSSL_TRACE3(handshake_done, ssl, SSL_IS_SERVER, ret);
+
 	SSL_DEBUG_MSG(2, ("<= handshake server"));
 
 	return (ret);
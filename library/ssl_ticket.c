@@ -0,0 +1,381 @@
+/*
+ *  RFC 5077 session ticket keys
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  The ticket seals the session state under keys known only to the
+ *  server (fleet), so that resumption needs no server-side cache:
+ *
+ *    key name (16) | IV (16) | AES-256-CBC (state) (80) | HMAC (32)
+ *
+ *  The HMAC-SHA-256 covers everything before it, and is checked before
+ *  anything gets decrypted. The state is the protocol version, the
+ *  cipher, the session start and issue times and the master secret.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_SSL_TICKET_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/sha2.h"
+#include "tropicssl/ssl_ticket.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(WIN32)
+#define SSL_TICKET_LOCK(c)      EnterCriticalSection(&(c)->lock)
+#define SSL_TICKET_UNLOCK(c)    LeaveCriticalSection(&(c)->lock)
+#else
+#define SSL_TICKET_LOCK(c)      pthread_mutex_lock(&(c)->lock)
+#define SSL_TICKET_UNLOCK(c)    pthread_mutex_unlock(&(c)->lock)
+#endif
+
+#define SSL_TICKET_STATE_LEN    80
+
+#define PUT_UINT64_BE(n,b,i)                            \
+{                                                       \
+    (b)[(i)    ] = (uint8_t) ( (uint64_t) (n) >> 56 );  \
+    (b)[(i) + 1] = (uint8_t) ( (uint64_t) (n) >> 48 );  \
+    (b)[(i) + 2] = (uint8_t) ( (uint64_t) (n) >> 40 );  \
+    (b)[(i) + 3] = (uint8_t) ( (uint64_t) (n) >> 32 );  \
+    (b)[(i) + 4] = (uint8_t) ( (uint64_t) (n) >> 24 );  \
+    (b)[(i) + 5] = (uint8_t) ( (uint64_t) (n) >> 16 );  \
+    (b)[(i) + 6] = (uint8_t) ( (uint64_t) (n) >>  8 );  \
+    (b)[(i) + 7] = (uint8_t) ( (uint64_t) (n)       );  \
+}
+
+#define GET_UINT64_BE(n,b,i)                            \
+{                                                       \
+    (n) = ( (uint64_t) (b)[(i)    ] << 56 )             \
+        | ( (uint64_t) (b)[(i) + 1] << 48 )             \
+        | ( (uint64_t) (b)[(i) + 2] << 40 )             \
+        | ( (uint64_t) (b)[(i) + 3] << 32 )             \
+        | ( (uint64_t) (b)[(i) + 4] << 24 )             \
+        | ( (uint64_t) (b)[(i) + 5] << 16 )             \
+        | ( (uint64_t) (b)[(i) + 6] <<  8 )             \
+        | ( (uint64_t) (b)[(i) + 7]       );            \
+}
+
+int ssl_ticket_init(ssl_ticket_context * ctx,
+		    int (*f_rng) (void *, uint8_t *, size_t),
+		    void *p_rng, uint32_t lifetime)
+{
+	memset(ctx, 0, sizeof(ssl_ticket_context));
+
+#if defined(WIN32)
+	InitializeCriticalSection(&ctx->lock);
+#else
+	pthread_mutex_init(&ctx->lock, NULL);
+#endif
+
+	ctx->lifetime = lifetime;
+
+	return (ssl_ticket_rotate(ctx, f_rng, p_rng));
+}
+
+int ssl_ticket_rotate(ssl_ticket_context * ctx,
+		      int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	int ret;
+	uint8_t key[SSL_TICKET_KEY_LEN];
+
+	if ((ret = f_rng(p_rng, key, SSL_TICKET_KEY_LEN)) == 0)
+		ssl_ticket_set_key(ctx, key);
+
+	memset(key, 0, sizeof(key));
+
+	return (ret);
+}
+
+void ssl_ticket_set_key(ssl_ticket_context * ctx,
+			const uint8_t key[SSL_TICKET_KEY_LEN])
+{
+	ssl_ticket_key *k;
+
+	SSL_TICKET_LOCK(ctx);
+
+	ctx->current ^= 1;
+	k = &ctx->keys[ctx->current];
+
+	memcpy(k->name, key, 16);
+	aes_setkey_enc(&k->enc, key + 16, 256);
+	aes_setkey_dec(&k->dec, key + 16, 256);
+	memcpy(k->mac, key + 48, 32);
+	k->active = 1;
+
+	SSL_TICKET_UNLOCK(ctx);
+}
+
+void ssl_set_session_ticket_keys(ssl_context * ssl, ssl_ticket_context * ctx)
+{
+	ssl_set_ticket_cb(ssl, ssl_ticket_write, ssl_ticket_parse, ctx);
+}
+
+int ssl_ticket_write(void *p_ticket, ssl_context * ssl,
+		     uint8_t *ticket, size_t *len, uint32_t *lifetime)
+{
+	int ret;
+	ssl_ticket_context *ctx = (ssl_ticket_context *) p_ticket;
+	ssl_ticket_key *k;
+	ssl_session *session = ssl->session;
+	uint8_t iv[16], *state;
+
+	if (*len < SSL_TICKET_LEN)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	state = ticket + 32;
+
+	state[0] = (uint8_t)ssl->major_ver;
+	state[1] = (uint8_t)ssl->minor_ver;
+	state[2] = (uint8_t)(session->cipher >> 8);
+	state[3] = (uint8_t)(session->cipher);
+	PUT_UINT64_BE(session->start, state, 4);
+	PUT_UINT64_BE(time(NULL), state, 12);
+	memcpy(state + 20, session->master, 48);
+	memset(state + 68, 0, SSL_TICKET_STATE_LEN - 68);
+
+	if ((ret = ssl->f_rng(ssl->p_rng, iv, 16)) != 0)
+		return (ret);
+
+	SSL_TICKET_LOCK(ctx);
+
+	k = &ctx->keys[ctx->current];
+
+	memcpy(ticket, k->name, 16);
+	memcpy(ticket + 16, iv, 16);
+	aes_crypt_cbc(&k->enc, AES_ENCRYPT, SSL_TICKET_STATE_LEN, iv,
+		      state, state);
+	sha2_hmac(k->mac, 32, ticket, 32 + SSL_TICKET_STATE_LEN,
+		  ticket + 32 + SSL_TICKET_STATE_LEN, 0);
+
+	*lifetime = ctx->lifetime;
+
+	SSL_TICKET_UNLOCK(ctx);
+
+	*len = SSL_TICKET_LEN;
+
+	return (0);
+}
+
+int ssl_ticket_parse(void *p_ticket, ssl_context * ssl,
+		     ssl_session * session, const uint8_t *ticket, size_t len)
+{
+	int i, diff;
+	uint64_t start, issued;
+	time_t t;
+	ssl_ticket_context *ctx = (ssl_ticket_context *) p_ticket;
+	ssl_ticket_key *k;
+	uint8_t mac[32], iv[16], state[SSL_TICKET_STATE_LEN];
+
+	if (len != SSL_TICKET_LEN)
+		return (TROPICSSL_ERR_SSL_NO_SESSION_FOUND);
+
+	SSL_TICKET_LOCK(ctx);
+
+	for (i = 0; i < 2; i++) {
+		k = &ctx->keys[ctx->current ^ i];
+
+		if (k->active != 0 && memcmp(k->name, ticket, 16) == 0)
+			break;
+	}
+
+	if (i == 2) {
+		SSL_TICKET_UNLOCK(ctx);
+		return (TROPICSSL_ERR_SSL_NO_SESSION_FOUND);
+	}
+
+	sha2_hmac(k->mac, 32, ticket, 32 + SSL_TICKET_STATE_LEN, mac, 0);
+
+	for (diff = 0, i = 0; i < 32; i++)
+		diff |= mac[i] ^ ticket[32 + SSL_TICKET_STATE_LEN + i];
+
+	if (diff != 0) {
+		SSL_TICKET_UNLOCK(ctx);
+		return (TROPICSSL_ERR_SSL_NO_SESSION_FOUND);
+	}
+
+	memcpy(iv, ticket + 16, 16);
+	aes_crypt_cbc(&k->dec, AES_DECRYPT, SSL_TICKET_STATE_LEN, iv,
+		      ticket + 32, state);
+
+	SSL_TICKET_UNLOCK(ctx);
+
+	GET_UINT64_BE(start, state, 4);
+	GET_UINT64_BE(issued, state, 12);
+	t = time(NULL);
+
+	if (state[0] != ssl->major_ver || state[1] != ssl->minor_ver ||
+	    (uint64_t) t < issued || (uint64_t) t - issued > ctx->lifetime ||
+	    (ssl->timeout != 0 && (uint64_t) t - start > ssl->timeout)) {
+		memset(state, 0, sizeof(state));
+		return (TROPICSSL_ERR_SSL_NO_SESSION_FOUND);
+	}
+
+	session->cipher = (state[2] << 8) | state[3];
+	session->start = (time_t) start;
+	memcpy(session->master, state + 20, 48);
+
+	memset(state, 0, sizeof(state));
+
+	return (0);
+}
+
+void ssl_ticket_free(ssl_ticket_context * ctx)
+{
+#if defined(WIN32)
+	DeleteCriticalSection(&ctx->lock);
+#else
+	pthread_mutex_destroy(&ctx->lock);
+#endif
+
+	memset(ctx, 0, sizeof(ssl_ticket_context));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+static int ssl_ticket_test_rng(void *p, uint8_t *output, size_t len)
+{
+	unsigned long *x = (unsigned long *)p;
+
+	while (len-- > 0) {
+		*x = *x * 1103515245UL + 12345UL;
+		*output++ = (uint8_t)(*x >> 16);
+	}
+
+	return (0);
+}
+
+/*
+ * Checkup routine
+ */
+int ssl_ticket_self_test(int verbose)
+{
+	int i;
+	size_t len;
+	uint32_t lifetime;
+	unsigned long seed = 1;
+	ssl_context ssl;
+	ssl_session session, out;
+	ssl_ticket_context ctx;
+	uint8_t ticket[SSL_TICKET_LEN + 16];
+
+	if (verbose != 0)
+		printf("  SSL session ticket test: ");
+
+	memset(&ssl, 0, sizeof(ssl_context));
+	memset(&session, 0, sizeof(ssl_session));
+
+	ssl_ticket_init(&ctx, ssl_ticket_test_rng, &seed, 3600);
+	ssl_set_session_ticket_keys(&ssl, &ctx);
+	ssl_set_rng(&ssl, ssl_ticket_test_rng, &seed);
+
+	ssl.major_ver = SSL_MAJOR_VERSION_3;
+	ssl.minor_ver = SSL_MINOR_VERSION_1;
+	ssl.timeout = 60;
+	ssl.session = &session;
+
+	session.cipher = TLS_RSA_WITH_AES_256_CBC_SHA;
+	session.start = time(NULL);
+	for (i = 0; i < 48; i++)
+		session.master[i] = (uint8_t)i;
+
+	/*
+	 * A ticket opens to its session, and only once intact
+	 */
+	len = sizeof(ticket);
+	if (ssl_ticket_write(&ctx, &ssl, ticket, &len, &lifetime) != 0 ||
+	    len != SSL_TICKET_LEN || lifetime != 3600)
+		goto fail;
+
+	memset(&out, 0, sizeof(ssl_session));
+	if (ssl_ticket_parse(&ctx, &ssl, &out, ticket, len) != 0 ||
+	    out.cipher != session.cipher || out.start != session.start ||
+	    memcmp(out.master, session.master, 48) != 0)
+		goto fail;
+
+	ticket[40] ^= 1;
+	if (ssl_ticket_parse(&ctx, &ssl, &out, ticket, len) == 0)
+		goto fail;
+	ticket[40] ^= 1;
+
+	/*
+	 * One rotation later it is still good, two are one too many
+	 */
+	ssl_ticket_rotate(&ctx, ssl_ticket_test_rng, &seed);
+	if (ssl_ticket_parse(&ctx, &ssl, &out, ticket, len) != 0)
+		goto fail;
+
+	ssl_ticket_rotate(&ctx, ssl_ticket_test_rng, &seed);
+	if (ssl_ticket_parse(&ctx, &ssl, &out, ticket, len) == 0)
+		goto fail;
+
+	/*
+	 * Neither a session past its timeout nor another version
+	 */
+	session.start -= 120;
+	len = sizeof(ticket);
+	if (ssl_ticket_write(&ctx, &ssl, ticket, &len, &lifetime) != 0 ||
+	    ssl_ticket_parse(&ctx, &ssl, &out, ticket, len) == 0)
+		goto fail;
+
+	session.start += 120;
+	len = sizeof(ticket);
+	if (ssl_ticket_write(&ctx, &ssl, ticket, &len, &lifetime) != 0)
+		goto fail;
+
+	ssl.minor_ver = SSL_MINOR_VERSION_0;
+	if (ssl_ticket_parse(&ctx, &ssl, &out, ticket, len) == 0)
+		goto fail;
+
+	ssl_ticket_free(&ctx);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	ssl_ticket_free(&ctx);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
+}
+
+#endif
+
+#endif
@@ -39,6 +39,7 @@
  *  http://wp.netscape.com/eng/ssl3/
  *  http://www.ietf.org/rfc/rfc2246.txt
  *  http://www.ietf.org/rfc/rfc4346.txt
+ *  http://www.ietf.org/rfc/rfc5246.txt
  */
 
 #include "tropicssl/config.h"
@@ -47,16 +48,50 @@
 
 #include "tropicssl/err.h"
 #include "tropicssl/aes.h"
+#if defined(TROPICSSL_AESNI)
+#include "tropicssl/aesni.h"
+#endif
 #include "tropicssl/arc4.h"
 #include "tropicssl/camellia.h"
 #include "tropicssl/des.h"
+#include "tropicssl/gcm.h"
+#include "tropicssl/chachapoly.h"
 #include "tropicssl/debug.h"
 #include "tropicssl/ssl.h"
+#include "tropicssl/memory.h"
+#include "tropicssl/rsa.h"
+#include "tropicssl/trace.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 
+#if defined(WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+#include <zlib.h>
+#endif
+
+#if defined(TROPICSSL_SSL_STATS)
+#include <stdio.h>
+
+#if defined _MSC_VER && !defined  snprintf
+#define	 snprintf  _snprintf
+#endif
+
+#if defined(WIN32)
+#define SSL_STATS_LOCK(s)       EnterCriticalSection(&(s)->lock)
+#define SSL_STATS_UNLOCK(s)     LeaveCriticalSection(&(s)->lock)
+#else
+#define SSL_STATS_LOCK(s)       pthread_mutex_lock(&(s)->lock)
+#define SSL_STATS_UNLOCK(s)     pthread_mutex_unlock(&(s)->lock)
+#endif
+#endif
+
 /*
  * Key material generation
  */
@@ -69,6 +104,8 @@ static int tls1_prf(uint8_t *secret, size_t slen, char *label,
 	uint8_t *S1, *S2;
 	uint8_t tmp[128];
 	uint8_t h_i[20];
+	md5_context md5;
+	sha1_context sha1;
 
 	if (sizeof(tmp) < 20 + strlen(label) + rlen)
 		return (TROPICSSL_ERR_BAD_ARG);
@@ -83,13 +120,21 @@ static int tls1_prf(uint8_t *secret, size_t slen, char *label,
 	nb += rlen;
 
 	/*
-	 * First compute P_md5(secret,label+random)[0..dlen]
+	 * First compute P_md5(secret,label+random)[0..dlen]; the key
+	 * is the same throughout, so its HMAC state is set up once
 	 */
-	md5_hmac(S1, hs, tmp + 20, nb, 4 + tmp);
+	md5_hmac_starts(&md5, S1, hs);
+	md5_hmac_update(&md5, tmp + 20, nb);
+	md5_hmac_finish(&md5, 4 + tmp);
 
 	for (i = 0; i < dlen; i += 16) {
-		md5_hmac(S1, hs, 4 + tmp, 16 + nb, h_i);
-		md5_hmac(S1, hs, 4 + tmp, 16, 4 + tmp);
+		md5_hmac_reset(&md5);
+		md5_hmac_update(&md5, 4 + tmp, 16 + nb);
+		md5_hmac_finish(&md5, h_i);
+
+		md5_hmac_reset(&md5);
+		md5_hmac_update(&md5, 4 + tmp, 16);
+		md5_hmac_finish(&md5, 4 + tmp);
 
 		k = (i + 16 > dlen) ? dlen % 16 : 16;
 
@@ -100,11 +145,18 @@ static int tls1_prf(uint8_t *secret, size_t slen, char *label,
 	/*
 	 * XOR out with P_sha1(secret,label+random)[0..dlen]
 	 */
-	sha1_hmac(S2, hs, tmp + 20, nb, tmp);
+	sha1_hmac_starts(&sha1, S2, hs);
+	sha1_hmac_update(&sha1, tmp + 20, nb);
+	sha1_hmac_finish(&sha1, tmp);
 
 	for (i = 0; i < dlen; i += 20) {
-		sha1_hmac(S2, hs, tmp, 20 + nb, h_i);
-		sha1_hmac(S2, hs, tmp, 20, tmp);
+		sha1_hmac_reset(&sha1);
+		sha1_hmac_update(&sha1, tmp, 20 + nb);
+		sha1_hmac_finish(&sha1, h_i);
+
+		sha1_hmac_reset(&sha1);
+		sha1_hmac_update(&sha1, tmp, 20);
+		sha1_hmac_finish(&sha1, tmp);
 
 		k = (i + 20 > dlen) ? dlen % 20 : 20;
 
@@ -114,10 +166,229 @@ static int tls1_prf(uint8_t *secret, size_t slen, char *label,
 
 	memset(tmp, 0, sizeof(tmp));
 	memset(h_i, 0, sizeof(h_i));
+	memset(&md5, 0, sizeof(md5));
+	memset(&sha1, 0, sizeof(sha1));
+
+	return (0);
+}
+
+/*
+ * TLSv1.2: P_SHA256 or P_SHA384 alone, again with the key's HMAC
+ * state set up once for all the iterations
+ */
+static int tls12_prf(int hash, uint8_t *secret, size_t slen, char *label,
+		     uint8_t *random, size_t rlen,
+		     uint8_t *dstbuf, size_t dlen)
+{
+	size_t nb, hs;
+	size_t i, k;
+	uint8_t tmp[128];
+	uint8_t h_i[64];
+	sha2_context sha2;
+	sha4_context sha4;
+
+	hs = (hash == SSL_HASH_SHA384) ? 48 : 32;
+
+	if (sizeof(tmp) < hs + strlen(label) + rlen)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	nb = strlen(label);
+	memcpy(tmp + hs, label, nb);
+	memcpy(tmp + hs + nb, random, rlen);
+	nb += rlen;
+
+	/*
+	 * A(1) = HMAC(secret, label+random); each round then outputs
+	 * HMAC(secret, A(i)+label+random) and computes A(i+1)
+	 */
+	if (hash == SSL_HASH_SHA384) {
+		sha4_hmac_starts(&sha4, secret, slen, 1);
+		sha4_hmac_update(&sha4, tmp + hs, nb);
+		sha4_hmac_finish(&sha4, tmp);
+	} else {
+		sha2_hmac_starts(&sha2, secret, slen, 0);
+		sha2_hmac_update(&sha2, tmp + hs, nb);
+		sha2_hmac_finish(&sha2, tmp);
+	}
+
+	for (i = 0; i < dlen; i += hs) {
+		if (hash == SSL_HASH_SHA384) {
+			sha4_hmac_reset(&sha4);
+			sha4_hmac_update(&sha4, tmp, hs + nb);
+			sha4_hmac_finish(&sha4, h_i);
+
+			sha4_hmac_reset(&sha4);
+			sha4_hmac_update(&sha4, tmp, hs);
+			sha4_hmac_finish(&sha4, tmp);
+		} else {
+			sha2_hmac_reset(&sha2);
+			sha2_hmac_update(&sha2, tmp, hs + nb);
+			sha2_hmac_finish(&sha2, h_i);
+
+			sha2_hmac_reset(&sha2);
+			sha2_hmac_update(&sha2, tmp, hs);
+			sha2_hmac_finish(&sha2, tmp);
+		}
+
+		k = (i + hs > dlen) ? dlen % hs : hs;
+
+		memcpy(dstbuf + i, h_i, k);
+	}
+
+	memset(tmp, 0, sizeof(tmp));
+	memset(h_i, 0, sizeof(h_i));
+	memset(&sha2, 0, sizeof(sha2));
+	memset(&sha4, 0, sizeof(sha4));
 
 	return (0);
 }
 
+static int ssl_prf(ssl_context * ssl, uint8_t *secret, size_t slen,
+		   char *label, uint8_t *random, size_t rlen,
+		   uint8_t *dstbuf, size_t dlen)
+{
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3)
+		return (tls12_prf(ssl_cipher_prf_hash(ssl->session->cipher),
+				  secret, slen, label, random, rlen,
+				  dstbuf, dlen));
+
+	return (tls1_prf(secret, slen, label, random, rlen, dstbuf, dlen));
+}
+
+/*
+ * Lowest protocol version a ciphersuite may be negotiated with
+ */
+int ssl_cipher_min_minor_ver(int cipher)
+{
+	switch (cipher) {
+	case TLS_RSA_WITH_AES_128_CBC_SHA256:
+	case TLS_RSA_WITH_AES_256_CBC_SHA256:
+	case TLS_DHE_RSA_WITH_AES_128_CBC_SHA256:
+	case TLS_DHE_RSA_WITH_AES_256_CBC_SHA256:
+	case TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256:
+	case TLS_RSA_WITH_AES_128_GCM_SHA256:
+	case TLS_RSA_WITH_AES_256_GCM_SHA384:
+	case TLS_DHE_RSA_WITH_AES_128_GCM_SHA256:
+	case TLS_DHE_RSA_WITH_AES_256_GCM_SHA384:
+	case TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256:
+	case TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384:
+	case TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256:
+	case TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256:
+		return (SSL_MINOR_VERSION_3);
+
+	default:
+		break;
+	}
+
+	return (SSL_MINOR_VERSION_0);
+}
+
+/*
+ * Hash of the TLS 1.2 PRF, Finished and this side's CertificateVerify
+ */
+int ssl_cipher_prf_hash(int cipher)
+{
+	if (cipher == TLS_RSA_WITH_AES_256_GCM_SHA384 ||
+	    cipher == TLS_DHE_RSA_WITH_AES_256_GCM_SHA384 ||
+	    cipher == TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384)
+		return (SSL_HASH_SHA384);
+
+	return (SSL_HASH_SHA256);
+}
+
+/*
+ * Key exchange of a ciphersuite: ephemeral DH or ECDH, both signed
+ * with the server's RSA key, else plain RSA
+ */
+int ssl_cipher_is_dhe(int cipher)
+{
+	return (cipher == TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA ||
+		cipher == TLS_DHE_RSA_WITH_AES_256_CBC_SHA ||
+		cipher == TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA ||
+		cipher == TLS_DHE_RSA_WITH_AES_128_CBC_SHA256 ||
+		cipher == TLS_DHE_RSA_WITH_AES_256_CBC_SHA256 ||
+		cipher == TLS_DHE_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_DHE_RSA_WITH_AES_256_GCM_SHA384 ||
+		cipher == TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256);
+}
+
+int ssl_cipher_is_ecdhe(int cipher)
+{
+	return (cipher == TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256 ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384 ||
+		cipher == TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256);
+}
+
+int ssl_cipher_is_chachapoly(int cipher)
+{
+	return (cipher == TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 ||
+		cipher == TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256);
+}
+
+/*
+ * Record protection of a ciphersuite: GCM or ChaCha20-Poly1305,
+ * else a stream or CBC cipher with a MAC
+ */
+int ssl_cipher_is_aead(int cipher)
+{
+	return (cipher == TLS_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_RSA_WITH_AES_256_GCM_SHA384 ||
+		cipher == TLS_DHE_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_DHE_RSA_WITH_AES_256_GCM_SHA384 ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384 ||
+		ssl_cipher_is_chachapoly(cipher));
+}
+
+#if defined(TROPICSSL_GCM) && defined(TROPICSSL_SSL_KTLS)
+/*
+ * The suites kernel TLS can take over
+ */
+static int ssl_cipher_is_gcm(int cipher)
+{
+	return (cipher == TLS_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_RSA_WITH_AES_256_GCM_SHA384 ||
+		cipher == TLS_DHE_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_DHE_RSA_WITH_AES_256_GCM_SHA384 ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256 ||
+		cipher == TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384);
+}
+#endif
+
+/*
+ * Record protection of the negotiated ciphersuite, looked up once by
+ * ssl_derive_keys(): a cipher primitive and the record functions that
+ * use it, so that records do not have to find them again
+ */
+typedef struct {
+	size_t ctx_len;		/* size of one direction's context */
+	void (*setkey) (void *ctx_enc, void *ctx_dec,
+			const uint8_t *key_enc, const uint8_t *key_dec,
+			unsigned int keylen);
+	void (*crypt) (void *ctx, int enc, size_t len, uint8_t *iv,
+		       uint8_t *buf);
+	int (*encrypt) (ssl_context * ssl);
+	int (*decrypt) (ssl_context * ssl);
+} ssl_cipher_base;
+
+struct _ssl_cipher_info {
+	int cipher;		/* ciphersuite identifier          */
+	const ssl_cipher_base *base;	/* its cipher primitive    */
+	unsigned int keylen;	/* symmetric key length            */
+	size_t minlen;		/* min. ciphertext length          */
+	size_t ivlen;		/* IV length                       */
+	size_t maclen;		/* MAC length                      */
+};
+
+static const ssl_cipher_info *ssl_cipher_lookup(int cipher);
+static int ssl_cipher_setup(ssl_context * ssl, const uint8_t *key1,
+			    const uint8_t *key2);
+static int ssl_explicit_iv(const ssl_context * ssl);
+
 int ssl_derive_keys(ssl_context * ssl)
 {
 	size_t i;
@@ -129,6 +400,8 @@ int ssl_derive_keys(ssl_context * ssl)
 	uint8_t keyblk[256];
 	uint8_t *key1;
 	uint8_t *key2;
+	int ret;
+	ssl_handshake_params *hs = ssl->handshake;
 
 	SSL_DEBUG_MSG(2, ("=> derive keys"));
 
@@ -141,11 +414,13 @@ int ssl_derive_keys(ssl_context * ssl)
 	 *
 	 * TLSv1:
 	 *   master = PRF( premaster, "master secret", randbytes )[0..47]
+	 *
+	 * with the P_SHA256 (or P_SHA384) PRF from TLSv1.2 on
 	 */
 	if (ssl->resume == 0) {
-		size_t len = ssl->pmslen;
+		size_t len = hs->pmslen;
 
-		SSL_DEBUG_BUF(3, "premaster secret", ssl->premaster, len);
+		SSL_DEBUG_BUF(3, "premaster secret", hs->premaster, len);
 
 		if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
 			for (i = 0; i < 3; i++) {
@@ -153,29 +428,31 @@ int ssl_derive_keys(ssl_context * ssl)
 
 				sha1_starts(&sha1);
 				sha1_update(&sha1, padding, 1 + i);
-				sha1_update(&sha1, ssl->premaster, len);
-				sha1_update(&sha1, ssl->randbytes, 64);
+				sha1_update(&sha1, hs->premaster, len);
+				sha1_update(&sha1, hs->randbytes, 64);
 				sha1_finish(&sha1, sha1sum);
 
 				md5_starts(&md5);
-				md5_update(&md5, ssl->premaster, len);
+				md5_update(&md5, hs->premaster, len);
 				md5_update(&md5, sha1sum, 20);
 				md5_finish(&md5, ssl->session->master + i * 16);
 			}
 		} else
-			tls1_prf(ssl->premaster, len, "master secret",
-				 ssl->randbytes, 64, ssl->session->master, 48);
+			ssl_prf(ssl, hs->premaster, len, "master secret",
+				hs->randbytes, 64, ssl->session->master, 48);
 
-		memset(ssl->premaster, 0, sizeof(ssl->premaster));
+		memset(hs->premaster, 0, sizeof(hs->premaster));
 	} else
 		SSL_DEBUG_MSG(3, ("no premaster (session resumed)"));
 
 	/*
 	 * Swap the client and server random values.
 	 */
-	memcpy(tmp, ssl->randbytes, 64);
-	memcpy(ssl->randbytes, tmp + 32, 32);
-	memcpy(ssl->randbytes + 32, tmp, 32);
+	memcpy(tmp, hs->randbytes, 64);
+	memcpy(hs->randbytes, tmp + 32, 32);
+	memcpy(hs->randbytes + 32, tmp, 32);
+	if (ssl->key_rand != NULL)
+		memcpy(ssl->key_rand, tmp, 64);
 	memset(tmp, 0, sizeof(tmp));
 
 	/*
@@ -197,7 +474,7 @@ int ssl_derive_keys(ssl_context * ssl)
 			sha1_starts(&sha1);
 			sha1_update(&sha1, padding, 1 + i);
 			sha1_update(&sha1, ssl->session->master, 48);
-			sha1_update(&sha1, ssl->randbytes, 64);
+			sha1_update(&sha1, hs->randbytes, 64);
 			sha1_finish(&sha1, sha1sum);
 
 			md5_starts(&md5);
@@ -212,86 +489,38 @@ int ssl_derive_keys(ssl_context * ssl)
 		memset(padding, 0, sizeof(padding));
 		memset(sha1sum, 0, sizeof(sha1sum));
 	} else
-		tls1_prf(ssl->session->master, 48, "key expansion",
-			 ssl->randbytes, 64, keyblk, 256);
+		ssl_prf(ssl, ssl->session->master, 48, "key expansion",
+			hs->randbytes, 64, keyblk, 256);
 
 	SSL_DEBUG_MSG(3, ("cipher = %s", ssl_get_cipher(ssl)));
 	SSL_DEBUG_BUF(3, "master secret", ssl->session->master, 48);
-	SSL_DEBUG_BUF(4, "random bytes", ssl->randbytes, 64);
+	SSL_DEBUG_BUF(4, "random bytes", hs->randbytes, 64);
 	SSL_DEBUG_BUF(4, "key block", keyblk, 256);
 
-	memset(ssl->randbytes, 0, sizeof(ssl->randbytes));
+	memset(hs->randbytes, 0, sizeof(hs->randbytes));
 
 	/*
 	 * Determine the appropriate key, IV and MAC length.
 	 */
-	switch (ssl->session->cipher) {
-#if defined(TROPICSSL_ARC4)
-	case TLS_RSA_WITH_RC4_128_MD5:
-		ssl->keylen = 16;
-		ssl->minlen = 16;
-		ssl->ivlen = 0;
-		ssl->maclen = 16;
-		break;
-
-	case TLS_RSA_WITH_RC4_128_SHA:
-		ssl->keylen = 16;
-		ssl->minlen = 20;
-		ssl->ivlen = 0;
-		ssl->maclen = 20;
-		break;
-#endif
-
-#if defined(TROPICSSL_DES)
-	case TLS_RSA_WITH_3DES_EDE_CBC_SHA:
-	case TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA:
-		ssl->keylen = 24;
-		ssl->minlen = 24;
-		ssl->ivlen = 8;
-		ssl->maclen = 20;
-		break;
-#endif
-
-#if defined(TROPICSSL_AES)
-	case TLS_RSA_WITH_AES_128_CBC_SHA:
-		ssl->keylen = 16;
-		ssl->minlen = 32;
-		ssl->ivlen = 16;
-		ssl->maclen = 20;
-		break;
-
-	case TLS_RSA_WITH_AES_256_CBC_SHA:
-	case TLS_DHE_RSA_WITH_AES_256_CBC_SHA:
-		ssl->keylen = 32;
-		ssl->minlen = 32;
-		ssl->ivlen = 16;
-		ssl->maclen = 20;
-		break;
-#endif
-
-#if defined(TROPICSSL_CAMELLIA)
-	case TLS_RSA_WITH_CAMELLIA_128_CBC_SHA:
-		ssl->keylen = 16;
-		ssl->minlen = 32;
-		ssl->ivlen = 16;
-		ssl->maclen = 20;
-		break;
-
-	case TLS_RSA_WITH_CAMELLIA_256_CBC_SHA:
-	case TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA:
-		ssl->keylen = 32;
-		ssl->minlen = 32;
-		ssl->ivlen = 16;
-		ssl->maclen = 20;
-		break;
-#endif
+	ssl->cipher_info = ssl_cipher_lookup(ssl->session->cipher);
 
-	default:
+	if (ssl->cipher_info == NULL) {
 		SSL_DEBUG_MSG(1, ("cipher %s is not available",
 				  ssl_get_cipher(ssl)));
 		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
 	}
 
+	ssl->keylen = ssl->cipher_info->keylen;
+	ssl->minlen = ssl->cipher_info->minlen;
+	ssl->ivlen = ssl->cipher_info->ivlen;
+	ssl->maclen = ssl->cipher_info->maclen;
+
+	/*
+	 * TLSv1.1 and later send a CBC record's IV in front of it
+	 */
+	if (ssl_explicit_iv(ssl))
+		ssl->minlen += ssl->ivlen;
+
 	SSL_DEBUG_MSG(3, ("keylen: %d, minlen: %d, ivlen: %d, maclen: %d",
 			  ssl->keylen, ssl->minlen, ssl->ivlen, ssl->maclen));
 
@@ -320,1638 +549,5464 @@ int ssl_derive_keys(ssl_context * ssl)
 		       ssl->ivlen);
 	}
 
-	switch (ssl->session->cipher) {
-#if defined(TROPICSSL_ARC4)
-	case TLS_RSA_WITH_RC4_128_MD5:
-	case TLS_RSA_WITH_RC4_128_SHA:
-		arc4_setup((arc4_context *) ssl->ctx_enc, key1, ssl->keylen);
-		arc4_setup((arc4_context *) ssl->ctx_dec, key2, ssl->keylen);
-		break;
-#endif
-
-#if defined(TROPICSSL_DES)
-	case TLS_RSA_WITH_3DES_EDE_CBC_SHA:
-	case TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA:
-		des3_set3key_enc((des3_context *) ssl->ctx_enc, key1);
-		des3_set3key_dec((des3_context *) ssl->ctx_dec, key2);
-		break;
-#endif
-
-#if defined(TROPICSSL_AES)
-	case TLS_RSA_WITH_AES_128_CBC_SHA:
-		aes_setkey_enc((aes_context *) ssl->ctx_enc, key1, 128);
-		aes_setkey_dec((aes_context *) ssl->ctx_dec, key2, 128);
-		break;
-
-	case TLS_RSA_WITH_AES_256_CBC_SHA:
-	case TLS_DHE_RSA_WITH_AES_256_CBC_SHA:
-		aes_setkey_enc((aes_context *) ssl->ctx_enc, key1, 256);
-		aes_setkey_dec((aes_context *) ssl->ctx_dec, key2, 256);
-		break;
-#endif
-
-#if defined(TROPICSSL_CAMELLIA)
-	case TLS_RSA_WITH_CAMELLIA_128_CBC_SHA:
-		camellia_setkey_enc((camellia_context *) ssl->ctx_enc, key1,
-				    128);
-		camellia_setkey_dec((camellia_context *) ssl->ctx_dec, key2,
-				    128);
-		break;
-
-	case TLS_RSA_WITH_CAMELLIA_256_CBC_SHA:
-	case TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA:
-		camellia_setkey_enc((camellia_context *) ssl->ctx_enc, key1,
-				    256);
-		camellia_setkey_dec((camellia_context *) ssl->ctx_dec, key2,
-				    256);
-		break;
-#endif
+	ret = ssl_cipher_setup(ssl, key1, key2);
 
-	default:
-		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#if defined(TROPICSSL_SSL_KTLS) && defined(TROPICSSL_GCM)
+	/*
+	 * The kernel wants the keys themselves, not a schedule
+	 */
+	if (ret == 0 && ssl->ktls_fd >= 0 &&
+	    ssl_cipher_is_gcm(ssl->session->cipher)) {
+		memcpy(ssl->ktls_key_enc, key1, ssl->keylen);
+		memcpy(ssl->ktls_key_dec, key2, ssl->keylen);
 	}
+#endif
 
 	memset(keyblk, 0, sizeof(keyblk));
 
+	if (ret != 0)
+		return (ret);
+
 	SSL_DEBUG_MSG(2, ("<= derive keys"));
 
 	return (0);
 }
 
-void ssl_calc_verify(ssl_context * ssl, uint8_t hash[36])
+/*
+ * Handshake transcript
+ */
+int ssl_transcript_update(ssl_transcript * t, const uint8_t *buf,
+			  size_t len)
 {
-	md5_context md5;
-	sha1_context sha1;
-	uint8_t pad_1[48];
-	uint8_t pad_2[48];
+	uint8_t *p;
+	size_t size;
 
-	SSL_DEBUG_MSG(2, ("=> calc verify"));
+	if (t->digests & SSL_TRANSCRIPT_MD5)
+		md5_update(&t->md5, buf, len);
 
-	memcpy(&md5, &ssl->fin_md5, sizeof(md5_context));
-	memcpy(&sha1, &ssl->fin_sha1, sizeof(sha1_context));
+	if (t->digests & SSL_TRANSCRIPT_SHA1)
+		sha1_update(&t->sha1, buf, len);
 
-	if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
-		memset(pad_1, 0x36, 48);
-		memset(pad_2, 0x5C, 48);
+	if (t->digests & SSL_TRANSCRIPT_SHA256)
+		sha2_update(&t->sha2, buf, len);
 
-		md5_update(&md5, ssl->session->master, 48);
-		md5_update(&md5, pad_1, 48);
-		md5_finish(&md5, hash);
+	if (t->digests & SSL_TRANSCRIPT_SHA384)
+		sha4_update(&t->sha4, buf, len);
 
-		md5_starts(&md5);
-		md5_update(&md5, ssl->session->master, 48);
-		md5_update(&md5, pad_2, 48);
-		md5_update(&md5, hash, 16);
-		md5_finish(&md5, hash);
+	if (t->digests != 0)
+		return (0);
 
-		sha1_update(&sha1, ssl->session->master, 48);
-		sha1_update(&sha1, pad_1, 40);
-		sha1_finish(&sha1, hash + 16);
+	if (t->len + len > t->size) {
+		size = (t->size != 0) ? t->size : 512;
+		while (size < t->len + len)
+			size *= 2;
 
-		sha1_starts(&sha1);
-		sha1_update(&sha1, ssl->session->master, 48);
-		sha1_update(&sha1, pad_2, 40);
-		sha1_update(&sha1, hash + 16, 20);
-		sha1_finish(&sha1, hash + 16);
-	} else {		/* TLSv1 */
-		md5_finish(&md5, hash);
-		sha1_finish(&sha1, hash + 16);
+		if ((p = (uint8_t *)memory_alloc(size)) == NULL)
+			return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+		if (t->buf != NULL) {
+			memcpy(p, t->buf, t->len);
+			memset(t->buf, 0, t->len);
+			memory_free(t->buf);
+		}
+
+		t->buf = p;
+		t->size = size;
 	}
 
-	SSL_DEBUG_BUF(3, "calculated verify result", hash, 36);
-	SSL_DEBUG_MSG(2, ("<= calc verify"));
+	memcpy(t->buf + t->len, buf, len);
+	t->len += len;
 
-	return;
+	return (0);
 }
 
 /*
- * SSLv3.0 MAC functions
+ * Start the given digests over the buffered messages; from now on
+ * messages are hashed as they come instead of being kept
  */
-static void ssl_mac_md5(uint8_t *secret,
-			uint8_t *buf, size_t len,
-			uint8_t *ctr, int type)
+void ssl_transcript_select(ssl_transcript * t, int digests)
 {
-	uint8_t header[11];
-	uint8_t padding[48];
-	md5_context md5;
+	if (t->digests != 0)
+		return;
 
-	memcpy(header, ctr, 8);
-	header[8] = (uint8_t)type;
-	header[9] = (uint8_t)(len >> 8);
-	header[10] = (uint8_t)(len);
+	t->digests = digests;
 
-	memset(padding, 0x36, 48);
-	md5_starts(&md5);
-	md5_update(&md5, secret, 16);
-	md5_update(&md5, padding, 48);
-	md5_update(&md5, header, 11);
-	md5_update(&md5, buf, len);
-	md5_finish(&md5, buf + len);
+	if (digests & SSL_TRANSCRIPT_MD5)
+		md5_starts(&t->md5);
 
-	memset(padding, 0x5C, 48);
-	md5_starts(&md5);
-	md5_update(&md5, secret, 16);
-	md5_update(&md5, padding, 48);
-	md5_update(&md5, buf + len, 16);
-	md5_finish(&md5, buf + len);
-}
+	if (digests & SSL_TRANSCRIPT_SHA1)
+		sha1_starts(&t->sha1);
 
-static void ssl_mac_sha1(uint8_t *secret,
-			 uint8_t *buf, size_t len,
-			 uint8_t *ctr, int type)
-{
-	uint8_t header[11];
-	uint8_t padding[40];
-	sha1_context sha1;
+	if (digests & SSL_TRANSCRIPT_SHA256)
+		sha2_starts(&t->sha2, 0);
 
-	memcpy(header, ctr, 8);
-	header[8] = (uint8_t)type;
-	header[9] = (uint8_t)(len >> 8);
-	header[10] = (uint8_t)(len);
+	if (digests & SSL_TRANSCRIPT_SHA384)
+		sha4_starts(&t->sha4, 1);
 
-	memset(padding, 0x36, 40);
-	sha1_starts(&sha1);
-	sha1_update(&sha1, secret, 20);
-	sha1_update(&sha1, padding, 40);
-	sha1_update(&sha1, header, 11);
-	sha1_update(&sha1, buf, len);
-	sha1_finish(&sha1, buf + len);
+	ssl_transcript_update(t, t->buf, t->len);
 
-	memset(padding, 0x5C, 40);
-	sha1_starts(&sha1);
-	sha1_update(&sha1, secret, 20);
-	sha1_update(&sha1, padding, 40);
-	sha1_update(&sha1, buf + len, 20);
-	sha1_finish(&sha1, buf + len);
+	if (t->buf != NULL) {
+		memset(t->buf, 0, t->len);
+		memory_free(t->buf);
+	}
+
+	t->buf = NULL;
+	t->len = t->size = 0;
 }
 
 /*
- * Encryption/decryption functions
+ * Snapshots of the running digests, to be finished by the caller: only
+ * the hashing state is copied, not the HMAC pads of the contexts
  */
-static int ssl_encrypt_buf(ssl_context * ssl)
+void ssl_transcript_md5(ssl_transcript * t, md5_context * md5)
 {
-	size_t i, padlen;
+	if (t->digests == 0)
+		ssl_transcript_select(t, SSL_TRANSCRIPT_MD5 |
+				      SSL_TRANSCRIPT_SHA1);
 
-	SSL_DEBUG_MSG(2, ("=> encrypt buf"));
+	memcpy(md5->total, t->md5.total, sizeof(md5->total));
+	memcpy(md5->state, t->md5.state, sizeof(md5->state));
+	memcpy(md5->buffer, t->md5.buffer, t->md5.total[0] & 0x3F);
+}
 
-	/*
-	 * Add MAC then encrypt
+void ssl_transcript_sha1(ssl_transcript * t, sha1_context * sha1)
+{
+	if (t->digests == 0)
+		ssl_transcript_select(t, SSL_TRANSCRIPT_MD5 |
+				      SSL_TRANSCRIPT_SHA1);
+
+	memcpy(sha1->total, t->sha1.total, sizeof(sha1->total));
+	memcpy(sha1->state, t->sha1.state, sizeof(sha1->state));
+	memcpy(sha1->buffer, t->sha1.buffer, t->sha1.total[0] & 0x3F);
+}
+
+void ssl_transcript_sha2(ssl_transcript * t, sha2_context * sha2)
+{
+	memcpy(sha2->total, t->sha2.total, sizeof(sha2->total));
+	memcpy(sha2->state, t->sha2.state, sizeof(sha2->state));
+	memcpy(sha2->buffer, t->sha2.buffer, t->sha2.total[0] & 0x3F);
+	sha2->is224 = t->sha2.is224;
+}
+
+void ssl_transcript_sha4(ssl_transcript * t, sha4_context * sha4)
+{
+	memcpy(sha4->total, t->sha4.total, sizeof(sha4->total));
+	memcpy(sha4->state, t->sha4.state, sizeof(sha4->state));
+	memcpy(sha4->buffer, t->sha4.buffer, t->sha4.total[0] & 0x7F);
+	sha4->is384 = t->sha4.is384;
+}
+
+/*
+ * Digests a version needs: both MD5 and SHA-1 up to TLSv1.1, only the
+ * PRF hash of the ciphersuite from TLSv1.2 on
+ */
+int ssl_transcript_digests(int minor_ver, int cipher)
+{
+	if (minor_ver < SSL_MINOR_VERSION_3)
+		return (SSL_TRANSCRIPT_MD5 | SSL_TRANSCRIPT_SHA1);
+
+	if (ssl_cipher_prf_hash(cipher) == SSL_HASH_SHA384)
+		return (SSL_TRANSCRIPT_SHA384);
+
+	return (SSL_TRANSCRIPT_SHA256);
+}
+
+void ssl_transcript_free(ssl_transcript * t)
+{
+	if (t->buf != NULL) {
+		memset(t->buf, 0, t->len);
+		memory_free(t->buf);
+	}
+
+	memset(t, 0, sizeof(ssl_transcript));
+}
+
+/*
+ * The DigestInfo prefix PKCS#1 v1.5 puts in front of a TLSv1.2 hash
+ */
+static size_t ssl_digest_info(int sig_hash, uint8_t *buf)
+{
+	switch (sig_hash) {
+	case SSL_HASH_SHA256:
+		memcpy(buf, ASN1_HASH_SHA256, 19);
+		return (19);
+
+	case SSL_HASH_SHA384:
+		memcpy(buf, ASN1_HASH_SHA384, 19);
+		return (19);
+
+	default:
+		break;
+	}
+
+	memcpy(buf, ASN1_HASH_SHA1, 15);
+	return (15);
+}
+
+/*
+ * Hash of the ServerKeyExchange parameters, with sig_hash from
+ * TLSv1.2 on, as signed by a raw PKCS#1 v1.5 signature
+ */
+size_t ssl_calc_params_hash(ssl_context * ssl, int sig_hash,
+			    const uint8_t *params, size_t len,
+			    uint8_t hash[SSL_SIG_INPUT_MAX])
+{
+	size_t n;
+	md5_context md5;
+	sha1_context sha1;
+	sha2_context sha2;
+	sha4_context sha4;
+	uint8_t sum[64];
+	ssl_handshake_params *hs = ssl->handshake;
+
+	if (ssl->minor_ver < SSL_MINOR_VERSION_3) {
+		md5_starts(&md5);
+		md5_update(&md5, hs->randbytes, 64);
+		md5_update(&md5, params, len);
+		md5_finish(&md5, hash);
+
+		sha1_starts(&sha1);
+		sha1_update(&sha1, hs->randbytes, 64);
+		sha1_update(&sha1, params, len);
+		sha1_finish(&sha1, hash + 16);
+
+		n = 36;
+	} else {
+		n = ssl_digest_info(sig_hash, hash);
+
+		switch (sig_hash) {
+		case SSL_HASH_SHA256:
+			sha2_starts(&sha2, 0);
+			sha2_update(&sha2, hs->randbytes, 64);
+			sha2_update(&sha2, params, len);
+			sha2_finish(&sha2, hash + n);
+			n += 32;
+			break;
+
+		case SSL_HASH_SHA384:
+			sha4_starts(&sha4, 1);
+			sha4_update(&sha4, hs->randbytes, 64);
+			sha4_update(&sha4, params, len);
+			sha4_finish(&sha4, sum);
+			memcpy(hash + n, sum, 48);
+			n += 48;
+			break;
+
+		default:
+			sha1_starts(&sha1);
+			sha1_update(&sha1, hs->randbytes, 64);
+			sha1_update(&sha1, params, len);
+			sha1_finish(&sha1, hash + n);
+			n += 20;
+			break;
+		}
+	}
+
+	SSL_DEBUG_BUF(3, "parameters hash", hash, n);
+
+	return (n);
+}
+
+size_t ssl_calc_verify(ssl_context * ssl, uint8_t hash[SSL_SIG_INPUT_MAX])
+{
+	size_t n;
+	md5_context md5;
+	sha1_context sha1;
+	sha2_context sha2;
+	sha4_context sha4;
+	uint8_t pad_1[48];
+	uint8_t pad_2[48];
+	uint8_t sum[64];
+	ssl_handshake_params *hs = ssl->handshake;
+
+	SSL_DEBUG_MSG(2, ("=> calc verify"));
+
+	/*
+	 * TLSv1.2: the DigestInfo of the PRF hash of the messages
 	 */
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3) {
+		n = ssl_digest_info(ssl_cipher_prf_hash(ssl->session->cipher),
+				    hash);
+
+		if (ssl_cipher_prf_hash(ssl->session->cipher) ==
+		    SSL_HASH_SHA384) {
+			ssl_transcript_sha4(&hs->transcript, &sha4);
+			sha4_finish(&sha4, sum);
+			memcpy(hash + n, sum, 48);
+			n += 48;
+		} else {
+			ssl_transcript_sha2(&hs->transcript, &sha2);
+			sha2_finish(&sha2, hash + n);
+			n += 32;
+		}
+
+		SSL_DEBUG_BUF(3, "calculated verify result", hash, n);
+		SSL_DEBUG_MSG(2, ("<= calc verify"));
+
+		return (n);
+	}
+
+	ssl_transcript_md5(&hs->transcript, &md5);
+	ssl_transcript_sha1(&hs->transcript, &sha1);
+
 	if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
-		if (ssl->maclen == 16)
-			ssl_mac_md5(ssl->mac_enc,
-				    ssl->out_msg, ssl->out_msglen,
-				    ssl->out_ctr, ssl->out_msgtype);
+		memset(pad_1, 0x36, 48);
+		memset(pad_2, 0x5C, 48);
+
+		md5_update(&md5, ssl->session->master, 48);
+		md5_update(&md5, pad_1, 48);
+		md5_finish(&md5, hash);
+
+		md5_starts(&md5);
+		md5_update(&md5, ssl->session->master, 48);
+		md5_update(&md5, pad_2, 48);
+		md5_update(&md5, hash, 16);
+		md5_finish(&md5, hash);
+
+		sha1_update(&sha1, ssl->session->master, 48);
+		sha1_update(&sha1, pad_1, 40);
+		sha1_finish(&sha1, hash + 16);
+
+		sha1_starts(&sha1);
+		sha1_update(&sha1, ssl->session->master, 48);
+		sha1_update(&sha1, pad_2, 40);
+		sha1_update(&sha1, hash + 16, 20);
+		sha1_finish(&sha1, hash + 16);
+	} else {		/* TLSv1 */
+		md5_finish(&md5, hash);
+		sha1_finish(&sha1, hash + 16);
+	}
+
+	SSL_DEBUG_BUF(3, "calculated verify result", hash, 36);
+	SSL_DEBUG_MSG(2, ("<= calc verify"));
+
+	return (36);
+}
+
+/*
+ * MAC functions: each appends the MAC of the len bytes at buf, whose
+ * counter and record header sit contiguous in front of them at ctr
+ */
+
+/*
+ * SSLv3.0 MAC functions
+ */
+static void ssl_mac_md5(const uint8_t *secret, void *hmac,
+			const uint8_t *ctr, int type,
+			uint8_t *buf, size_t len)
+{
+	uint8_t header[11];
+	uint8_t padding[48];
+	md5_context md5;
+
+	(void) hmac;
+
+	memcpy(header, ctr, 8);
+	header[8] = (uint8_t)type;
+	header[9] = (uint8_t)(len >> 8);
+	header[10] = (uint8_t)(len);
+
+	memset(padding, 0x36, 48);
+	md5_starts(&md5);
+	md5_update(&md5, secret, 16);
+	md5_update(&md5, padding, 48);
+	md5_update(&md5, header, 11);
+	md5_update(&md5, buf, len);
+	md5_finish(&md5, buf + len);
+
+	memset(padding, 0x5C, 48);
+	md5_starts(&md5);
+	md5_update(&md5, secret, 16);
+	md5_update(&md5, padding, 48);
+	md5_update(&md5, buf + len, 16);
+	md5_finish(&md5, buf + len);
+}
+
+static void ssl_mac_sha1(const uint8_t *secret, void *hmac,
+			 const uint8_t *ctr, int type,
+			 uint8_t *buf, size_t len)
+{
+	uint8_t header[11];
+	uint8_t padding[40];
+	sha1_context sha1;
+
+	(void) hmac;
+
+	memcpy(header, ctr, 8);
+	header[8] = (uint8_t)type;
+	header[9] = (uint8_t)(len >> 8);
+	header[10] = (uint8_t)(len);
+
+	memset(padding, 0x36, 40);
+	sha1_starts(&sha1);
+	sha1_update(&sha1, secret, 20);
+	sha1_update(&sha1, padding, 40);
+	sha1_update(&sha1, header, 11);
+	sha1_update(&sha1, buf, len);
+	sha1_finish(&sha1, buf + len);
+
+	memset(padding, 0x5C, 40);
+	sha1_starts(&sha1);
+	sha1_update(&sha1, secret, 20);
+	sha1_update(&sha1, padding, 40);
+	sha1_update(&sha1, buf + len, 20);
+	sha1_finish(&sha1, buf + len);
+}
+
+/*
+ * TLSv1 HMACs, from the key state ssl_derive_keys() left in hmac
+ */
+static void ssl_hmac_md5(const uint8_t *secret, void *hmac,
+			 const uint8_t *ctr, int type,
+			 uint8_t *buf, size_t len)
+{
+	md5_context *md5 = (md5_context *) hmac;
+
+	(void) secret;
+	(void) type;
+
+	md5_hmac_reset(md5);
+	md5_hmac_update(md5, ctr, len + 13);
+	md5_hmac_finish(md5, buf + len);
+}
+
+static void ssl_hmac_sha1(const uint8_t *secret, void *hmac,
+			  const uint8_t *ctr, int type,
+			  uint8_t *buf, size_t len)
+{
+	sha1_context *sha1 = (sha1_context *) hmac;
+
+	(void) secret;
+	(void) type;
+
+	sha1_hmac_reset(sha1);
+	sha1_hmac_update(sha1, ctr, len + 13);
+	sha1_hmac_finish(sha1, buf + len);
+}
+
+static void ssl_hmac_sha2(const uint8_t *secret, void *hmac,
+			  const uint8_t *ctr, int type,
+			  uint8_t *buf, size_t len)
+{
+	sha2_context *sha2 = (sha2_context *) hmac;
+
+	(void) secret;
+	(void) type;
+
+	sha2_hmac_reset(sha2);
+	sha2_hmac_update(sha2, ctr, len + 13);
+	sha2_hmac_finish(sha2, buf + len);
+}
+
+/*
+ * Encryption/decryption functions
+ */
+#if defined(TROPICSSL_GCM) || defined(TROPICSSL_CHACHAPOLY)
+/*
+ * The AEAD additional data is seq_num + type + version + plaintext
+ * length, for GCM and ChaCha20-Poly1305 alike
+ */
+static void ssl_aead_add_data(uint8_t add[13], const uint8_t ctr[8],
+			      const ssl_context * ssl, int msgtype, size_t len)
+{
+	memcpy(add, ctr, 8);
+	add[8] = (uint8_t)msgtype;
+	add[9] = (uint8_t)ssl->major_ver;
+	add[10] = (uint8_t)ssl->minor_ver;
+	add[11] = (uint8_t)(len >> 8);
+	add[12] = (uint8_t)(len);
+}
+#endif
+
+#if defined(TROPICSSL_GCM)
+/*
+ * RFC 5288: the nonce is the 4-byte implicit salt followed by the
+ * 8-byte explicit part sent in front of the record.
+ */
+static int ssl_encrypt_gcm(ssl_context * ssl)
+{
+	int ret;
+	uint8_t iv[12];
+	uint8_t add[13];
+
+	ssl_aead_add_data(add, ssl->out_ctr, ssl, ssl->out_msgtype,
+			  ssl->out_msglen);
+
+	/*
+	 * The sequence number is unique per key, so it doubles
+	 * as the explicit nonce
+	 */
+	memcpy(iv, ssl->iv_enc, 4);
+	memcpy(iv + 4, ssl->out_ctr, 8);
+
+	memmove(ssl->out_msg + 8, ssl->out_msg, ssl->out_msglen);
+	memcpy(ssl->out_msg, ssl->out_ctr, 8);
+
+	SSL_DEBUG_BUF(4, "before encrypt: output payload",
+		      ssl->out_msg + 8, ssl->out_msglen);
+
+	ret = gcm_crypt_and_tag((gcm_context *) ssl->ctx_enc, GCM_ENCRYPT,
+				ssl->out_msglen, iv, 12, add, 13,
+				ssl->out_msg + 8, ssl->out_msg + 8,
+				16, ssl->out_msg + 8 + ssl->out_msglen);
+	if (ret != 0)
+		return (ret);
+
+	ssl->out_msglen += 8 + 16;
+
+	return (0);
+}
+
+static int ssl_decrypt_gcm(ssl_context * ssl)
+{
+	int ret;
+	size_t len = ssl->in_msglen - 24;
+	uint8_t iv[12];
+	uint8_t add[13];
+
+	ssl_aead_add_data(add, ssl->in_ctr, ssl, ssl->in_msgtype, len);
+
+	memcpy(iv, ssl->iv_dec, 4);
+	memcpy(iv + 4, ssl->in_msg, 8);
+
+	/*
+	 * Decrypt over the explicit nonce, so that the plaintext
+	 * starts at in_msg
+	 */
+	ret = gcm_auth_decrypt((gcm_context *) ssl->ctx_dec, len,
+			       iv, 12, add, 13, ssl->in_msg + 8 + len, 16,
+			       ssl->in_msg + 8, ssl->in_msg);
+	if (ret != 0) {
+		SSL_DEBUG_MSG(1, ("message tag does not match"));
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+	}
+
+	ssl->in_msglen = len;
+
+	ssl->in_hdr[3] = (uint8_t)(ssl->in_msglen >> 8);
+	ssl->in_hdr[4] = (uint8_t)(ssl->in_msglen);
+
+	return (0);
+}
+#endif
+
+#if defined(TROPICSSL_CHACHAPOLY)
+/*
+ * RFC 7905: the nonce is the 12-byte IV with the sequence number
+ * XORed into its last 8 bytes; nothing is sent but the ciphertext
+ * and the 16-byte tag.
+ */
+static void ssl_chachapoly_nonce(uint8_t nonce[12], const uint8_t iv[12],
+				 const uint8_t ctr[8])
+{
+	int i;
+
+	memcpy(nonce, iv, 12);
+
+	for (i = 0; i < 8; i++)
+		nonce[4 + i] ^= ctr[i];
+}
+
+static int ssl_encrypt_chachapoly(ssl_context * ssl)
+{
+	uint8_t nonce[12];
+	uint8_t add[13];
+
+	ssl_aead_add_data(add, ssl->out_ctr, ssl, ssl->out_msgtype,
+			  ssl->out_msglen);
+	ssl_chachapoly_nonce(nonce, ssl->iv_enc, ssl->out_ctr);
+
+	SSL_DEBUG_BUF(4, "before encrypt: output payload",
+		      ssl->out_msg, ssl->out_msglen);
+
+	chachapoly_crypt_and_tag((chachapoly_context *) ssl->ctx_enc,
+				 CHACHAPOLY_ENCRYPT, ssl->out_msglen, nonce,
+				 add, 13, ssl->out_msg, ssl->out_msg,
+				 ssl->out_msg + ssl->out_msglen);
+
+	ssl->out_msglen += 16;
+
+	return (0);
+}
+
+static int ssl_decrypt_chachapoly(ssl_context * ssl)
+{
+	size_t len = ssl->in_msglen - 16;
+	uint8_t nonce[12];
+	uint8_t add[13];
+
+	ssl_aead_add_data(add, ssl->in_ctr, ssl, ssl->in_msgtype, len);
+	ssl_chachapoly_nonce(nonce, ssl->iv_dec, ssl->in_ctr);
+
+	if (chachapoly_auth_decrypt((chachapoly_context *) ssl->ctx_dec, len,
+				    nonce, add, 13, ssl->in_msg + len,
+				    ssl->in_msg, ssl->in_msg) != 0) {
+		SSL_DEBUG_MSG(1, ("message tag does not match"));
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+	}
+
+	ssl->in_msglen = len;
+
+	ssl->in_hdr[3] = (uint8_t)(ssl->in_msglen >> 8);
+	ssl->in_hdr[4] = (uint8_t)(ssl->in_msglen);
+
+	return (0);
+}
+#endif
+
+/*
+ * TLSv1.1 and later: each CBC record starts with its own random IV.
+ * The record is encrypted in place under it as before, and moved up
+ * behind it afterwards, so that the MAC input stays contiguous.
+ */
+static int ssl_explicit_iv(const ssl_context * ssl)
+{
+	return (ssl->minor_ver >= SSL_MINOR_VERSION_2 && ssl->ivlen >= 8 &&
+		ssl->maclen != 0);
+}
+
+static int ssl_cbc_iv_start(ssl_context * ssl, uint8_t iv[16])
+{
+	int ret;
+
+	if (ssl_explicit_iv(ssl) == 0)
+		return (0);
+
+	if ((ret = ssl->f_rng(ssl->p_rng, iv, ssl->ivlen)) != 0) {
+		SSL_DEBUG_RET(1, "f_rng", ret);
+		return (ret);
+	}
+
+	memcpy(ssl->iv_enc, iv, ssl->ivlen);
+
+	return (0);
+}
+
+static void ssl_cbc_iv_finish(ssl_context * ssl, const uint8_t iv[16])
+{
+	if (ssl_explicit_iv(ssl) == 0)
+		return;
+
+	memmove(ssl->out_msg + ssl->ivlen, ssl->out_msg, ssl->out_msglen);
+	memcpy(ssl->out_msg, iv, ssl->ivlen);
+	ssl->out_msglen += ssl->ivlen;
+}
+
+/*
+ * Take the explicit IV off the front, the record then decrypts
+ * just like a TLSv1.0 one
+ */
+static void ssl_cbc_iv_strip(ssl_context * ssl)
+{
+	if (ssl_explicit_iv(ssl) == 0)
+		return;
+
+	memcpy(ssl->iv_dec, ssl->in_msg, ssl->ivlen);
+	ssl->in_msglen -= ssl->ivlen;
+	memmove(ssl->in_msg, ssl->in_msg + ssl->ivlen, ssl->in_msglen);
+}
+
+#if defined(TROPICSSL_AES) && defined(TROPICSSL_SHA1)
+/*
+ * Stitched HMAC-SHA1 + AES-CBC (TLS only; SSLv3 has its own MAC).
+ *
+ * The MAC input -- sequence number, record header and payload -- is
+ * contiguous from the counter, so each chunk is hashed and encrypted
+ * while it is still in L1 instead of streaming the record through the
+ * cache twice. With AES-NI the SHA-1 rounds and the AES rounds are
+ * interleaved instruction by instruction.
+ */
+#define SSL_STITCH_CHUNK        1024
+
+static int ssl_encrypt_aes_sha1(ssl_context * ssl)
+{
+	int ret;
+	size_t i, n, len, done, hashed, padlen;
+	size_t hlen = 13 + ssl->out_msglen;
+	uint8_t *p = ssl->out_ctr;
+	uint8_t iv[16];
+	aes_context *aes = (aes_context *) ssl->ctx_enc;
+	sha1_context *sha1 = (sha1_context *) ssl->hmac_enc;
+
+	if ((ret = ssl_cbc_iv_start(ssl, iv)) != 0)
+		return (ret);
+
+	sha1_hmac_reset(sha1);
+
+	done = hashed = 0;
+
+	if (hlen >= 128) {
+		/*
+		 * The hash runs one block ahead: block i + 1 of the MAC
+		 * input is hashed while block i of the payload is encrypted
+		 */
+		sha1_hmac_update(sha1, p, 64);
+		n = hlen / 64 - 1;
+
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+		if (aesni_supports(TROPICSSL_AESNI_AES))
+			aesni_cbc_sha1_enc(aes, ssl->iv_enc, sha1, p + 64,
+					   ssl->out_msg, n);
+		else
+#endif
+			for (i = 0; i < n * 64; i += len) {
+				len = n * 64 - i;
+				if (len > SSL_STITCH_CHUNK)
+					len = SSL_STITCH_CHUNK;
+
+				sha1_hmac_update(sha1, p + 64 + i, len);
+				aes_crypt_cbc(aes, AES_ENCRYPT, len, ssl->iv_enc,
+					      ssl->out_msg + i,
+					      ssl->out_msg + i);
+			}
+
+		done = n * 64;
+		hashed = done + 64;
+	}
+
+	sha1_hmac_update(sha1, p + hashed, hlen - hashed);
+	sha1_hmac_finish(sha1, ssl->out_msg + ssl->out_msglen);
+
+	SSL_DEBUG_BUF(4, "computed mac",
+		      ssl->out_msg + ssl->out_msglen, 20);
+
+	ssl->out_msglen += 20;
+
+	padlen = 16 - (ssl->out_msglen + 1) % 16;
+	if (padlen == 16)
+		padlen = 0;
+
+	for (i = 0; i <= padlen; i++)
+		ssl->out_msg[ssl->out_msglen + i] = (uint8_t)padlen;
+
+	ssl->out_msglen += padlen + 1;
+
+	SSL_DEBUG_MSG(3, ("stitched encrypt: msglen = %d, "
+			  "including %d bytes of padding",
+			  ssl->out_msglen, padlen + 1));
+
+	aes_crypt_cbc(aes, AES_ENCRYPT, ssl->out_msglen - done, ssl->iv_enc,
+		      ssl->out_msg + done, ssl->out_msg + done);
+
+	ssl_cbc_iv_finish(ssl, iv);
+
+	return (0);
+}
+
+static int ssl_decrypt_aes_sha1(ssl_context * ssl)
+{
+	size_t i, n, len, done, hashed, padlen, msglen, hlen;
+	uint8_t *p = ssl->in_ctr;
+	uint8_t iv[16];
+	uint8_t last[16];
+	uint8_t mac[20];
+	aes_context *aes = (aes_context *) ssl->ctx_dec;
+	sha1_context *sha1 = (sha1_context *) ssl->hmac_dec;
+	int bad = 0;
+
+	ssl_cbc_iv_strip(ssl);
+
+	if (ssl->in_msglen % 16 != 0) {
+		SSL_DEBUG_MSG(1, ("msglen (%d) %% ivlen (%d) != 0",
+				  ssl->in_msglen, 16));
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+	}
+
+	/*
+	 * The MAC covers the header with the payload length, so decrypt
+	 * the last block up front to learn the padding length
+	 */
+	len = ssl->in_msglen;
+	memcpy(iv, (len > 16) ? ssl->in_msg + len - 32 : ssl->iv_dec, 16);
+	aes_crypt_cbc(aes, AES_DECRYPT, 16, iv, ssl->in_msg + len - 16, last);
+
+	padlen = 1 + last[15];
+	if (padlen + 20 > len) {
+		SSL_DEBUG_MSG(1, ("bad padding length: is %d, "
+				  "should be no more than %d",
+				  padlen, len - 20));
+		padlen = 0;
+		bad = 1;
+	}
+
+	msglen = len - 20 - padlen;
+	hlen = 13 + msglen;
+
+	ssl->in_hdr[3] = (uint8_t)(msglen >> 8);
+	ssl->in_hdr[4] = (uint8_t)(msglen);
+
+	sha1_hmac_reset(sha1);
+
+	done = hashed = 0;
+
+	if (hlen >= 64 && len >= 128) {
+		/*
+		 * The decryption runs one block ahead: block i of the MAC
+		 * input is hashed while block i + 1 of the payload is
+		 * decrypted
+		 */
+		aes_crypt_cbc(aes, AES_DECRYPT, 64, ssl->iv_dec,
+			      ssl->in_msg, ssl->in_msg);
+
+		n = hlen / 64;
+		if (n > len / 64 - 1)
+			n = len / 64 - 1;
+
+#if defined(TROPICSSL_AESNI) && defined(TROPICSSL_HAVE_X86_64)
+		if (aesni_supports(TROPICSSL_AESNI_AES))
+			aesni_cbc_sha1_dec(aes, ssl->iv_dec, sha1, p,
+					   ssl->in_msg + 64, n);
+		else
+#endif
+			for (i = 0; i < n * 64; i += len) {
+				len = n * 64 - i;
+				if (len > SSL_STITCH_CHUNK)
+					len = SSL_STITCH_CHUNK;
+
+				aes_crypt_cbc(aes, AES_DECRYPT, len, ssl->iv_dec,
+					      ssl->in_msg + 64 + i,
+					      ssl->in_msg + 64 + i);
+				sha1_hmac_update(sha1, p + i, len);
+			}
+
+		done = 64 + n * 64;
+		hashed = n * 64;
+	}
+
+	aes_crypt_cbc(aes, AES_DECRYPT, ssl->in_msglen - done, ssl->iv_dec,
+		      ssl->in_msg + done, ssl->in_msg + done);
+
+	sha1_hmac_update(sha1, p + hashed, hlen - hashed);
+	sha1_hmac_finish(sha1, mac);
+
+	SSL_DEBUG_BUF(4, "raw buffer after decryption",
+		      ssl->in_msg, ssl->in_msglen);
+
+	/*
+	 * TLSv1: always check the padding
+	 */
+	for (i = 1; i <= padlen; i++) {
+		if (ssl->in_msg[ssl->in_msglen - i] != padlen - 1) {
+			SSL_DEBUG_MSG(1, ("bad padding byte: should be "
+					  "%02x, but is %02x", padlen - 1,
+					  ssl->in_msg[ssl->in_msglen - i]));
+			bad = 1;
+		}
+	}
+
+	SSL_DEBUG_BUF(4, "message  mac", ssl->in_msg + msglen, 20);
+	SSL_DEBUG_BUF(4, "computed mac", mac, 20);
+
+	if (memcmp(mac, ssl->in_msg + msglen, 20) != 0) {
+		SSL_DEBUG_MSG(1, ("message mac does not match"));
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+	}
+
+	/*
+	 * Bad padding produces the same error as an invalid MAC
+	 */
+	if (bad != 0)
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+
+	ssl->in_msglen = msglen;
+
+	return (0);
+}
+#endif
+
+/*
+ * Stream and CBC ciphersuites: MAC then encrypt
+ */
+static void ssl_add_mac(ssl_context * ssl)
+{
+	ssl->f_mac(ssl->mac_enc, ssl->hmac_enc, ssl->out_ctr,
+		   ssl->out_msgtype, ssl->out_msg, ssl->out_msglen);
+
+	SSL_DEBUG_BUF(4, "computed mac",
+		      ssl->out_msg + ssl->out_msglen, ssl->maclen);
+
+	ssl->out_msglen += ssl->maclen;
+}
+
+static int ssl_encrypt_stream(ssl_context * ssl)
+{
+	ssl_add_mac(ssl);
+
+	SSL_DEBUG_MSG(3, ("before encrypt: msglen = %d, "
+			  "including %d bytes of padding",
+			  ssl->out_msglen, 0));
+
+	SSL_DEBUG_BUF(4, "before encrypt: output payload",
+		      ssl->out_msg, ssl->out_msglen);
+
+	ssl->cipher_info->base->crypt(ssl->ctx_enc, 1, ssl->out_msglen,
+				      NULL, ssl->out_msg);
+
+	return (0);
+}
+
+static int ssl_encrypt_cbc(ssl_context * ssl)
+{
+	int ret;
+	size_t i, padlen;
+	uint8_t iv[16];
+
+	if ((ret = ssl_cbc_iv_start(ssl, iv)) != 0)
+		return (ret);
+
+	ssl_add_mac(ssl);
+
+	padlen = ssl->ivlen - (ssl->out_msglen + 1) % ssl->ivlen;
+	if (padlen == ssl->ivlen)
+		padlen = 0;
+
+	for (i = 0; i <= padlen; i++)
+		ssl->out_msg[ssl->out_msglen + i] = (uint8_t)padlen;
+
+	ssl->out_msglen += padlen + 1;
+
+	SSL_DEBUG_MSG(3, ("before encrypt: msglen = %d, "
+			  "including %d bytes of padding",
+			  ssl->out_msglen, padlen + 1));
+
+	SSL_DEBUG_BUF(4, "before encrypt: output payload",
+		      ssl->out_msg, ssl->out_msglen);
+
+	ssl->cipher_info->base->crypt(ssl->ctx_enc, 1, ssl->out_msglen,
+				      ssl->iv_enc, ssl->out_msg);
+
+	ssl_cbc_iv_finish(ssl, iv);
+
+	return (0);
+}
+
+static int ssl_encrypt_buf(ssl_context * ssl)
+{
+	int ret;
+	size_t i;
+
+	SSL_DEBUG_MSG(2, ("=> encrypt buf"));
+
+	if ((ret = ssl->f_encrypt(ssl)) == 0) {
+		for (i = 7; i >= 0; i--)
+			if (++ssl->out_ctr[i] != 0)
+				break;
+	}
+
+	SSL_DEBUG_MSG(2, ("<= encrypt buf"));
+
+	return (ret);
+}
+
+/*
+ * Common tail of record decryption: empty record accounting and
+ * the incoming sequence number
+ */
+static int ssl_decrypt_done(ssl_context * ssl)
+{
+	size_t i;
+
+	if (ssl->in_msglen == 0) {
+		ssl->nb_zero++;
+
+		/*
+		 * Three or more empty messages may be a DoS attack
+		 * (excessive CPU consumption).
+		 */
+		if (ssl->nb_zero > 3) {
+			SSL_DEBUG_MSG(1, ("received four consecutive empty "
+					  "messages, possible DoS attack"));
+			return (TROPICSSL_ERR_SSL_INVALID_MAC);
+		}
+	} else
+		ssl->nb_zero = 0;
+
+	for (i = 7; i >= 0; i--)
+		if (++ssl->in_ctr[i] != 0)
+			break;
+
+	SSL_DEBUG_MSG(2, ("<= decrypt buf"));
+
+	return (0);
+}
+
+/*
+ * Strip the MAC and padlen bytes of padding, then check the MAC.
+ * Always compute the MAC (RFC4346, CBCTIME).
+ */
+static int ssl_check_mac(ssl_context * ssl, size_t padlen)
+{
+	uint8_t tmp[32];
+
+	SSL_DEBUG_BUF(4, "raw buffer after decryption",
+		      ssl->in_msg, ssl->in_msglen);
+
+	ssl->in_msglen -= (ssl->maclen + padlen);
+
+	ssl->in_hdr[3] = (uint8_t)(ssl->in_msglen >> 8);
+	ssl->in_hdr[4] = (uint8_t)(ssl->in_msglen);
+
+	memcpy(tmp, ssl->in_msg + ssl->in_msglen, ssl->maclen);
+
+	ssl->f_mac(ssl->mac_dec, ssl->hmac_dec, ssl->in_ctr,
+		   ssl->in_msgtype, ssl->in_msg, ssl->in_msglen);
+
+	SSL_DEBUG_BUF(4, "message  mac", tmp, ssl->maclen);
+	SSL_DEBUG_BUF(4, "computed mac", ssl->in_msg + ssl->in_msglen,
+		      ssl->maclen);
+
+	if (memcmp(tmp, ssl->in_msg + ssl->in_msglen, ssl->maclen) != 0) {
+		SSL_DEBUG_MSG(1, ("message mac does not match"));
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+	}
+
+	return (0);
+}
+
+static int ssl_decrypt_stream(ssl_context * ssl)
+{
+	ssl->cipher_info->base->crypt(ssl->ctx_dec, 0, ssl->in_msglen,
+				      NULL, ssl->in_msg);
+
+	return (ssl_check_mac(ssl, 0));
+}
+
+static int ssl_decrypt_cbc(ssl_context * ssl)
+{
+	int ret;
+	size_t i, padlen;
+
+	ssl_cbc_iv_strip(ssl);
+
+	/*
+	 * Decrypt and check the padding
+	 */
+	if (ssl->in_msglen % ssl->ivlen != 0) {
+		SSL_DEBUG_MSG(1, ("msglen (%d) %% ivlen (%d) != 0",
+				  ssl->in_msglen, ssl->ivlen));
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+	}
+
+	ssl->cipher_info->base->crypt(ssl->ctx_dec, 0, ssl->in_msglen,
+				      ssl->iv_dec, ssl->in_msg);
+
+	padlen = 1 + ssl->in_msg[ssl->in_msglen - 1];
+
+	if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
+		if (padlen > ssl->ivlen) {
+			SSL_DEBUG_MSG(1, ("bad padding length: is %d, "
+					  "should be no more than %d",
+					  padlen, ssl->ivlen));
+			padlen = 0;
+		}
+	} else {
+		if (padlen + ssl->maclen > ssl->in_msglen) {
+			SSL_DEBUG_MSG(1, ("bad padding length: is %d, "
+					  "should be no more than %d",
+					  padlen,
+					  ssl->in_msglen - ssl->maclen));
+			padlen = 0;
+		}
+
+		/*
+		 * TLSv1: always check the padding
+		 */
+		for (i = 1; i <= padlen; i++) {
+			if (ssl->in_msg[ssl->in_msglen - i] != padlen - 1) {
+				SSL_DEBUG_MSG(1, ("bad padding byte: should be "
+						  "%02x, but is %02x",
+						  padlen - 1,
+						  ssl->in_msg[ssl->in_msglen -
+							      i]));
+				padlen = 0;
+			}
+		}
+	}
+
+	if ((ret = ssl_check_mac(ssl, padlen)) != 0)
+		return (ret);
+
+	/*
+	 * Finally check the padding length; bad padding
+	 * will produce the same error as an invalid MAC.
+	 */
+	if (padlen == 0)
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+
+	return (0);
+}
+
+static int ssl_decrypt_buf(ssl_context * ssl)
+{
+	int ret;
+
+	SSL_DEBUG_MSG(2, ("=> decrypt buf"));
+
+	if (ssl->in_msglen < ssl->minlen) {
+		SSL_DEBUG_MSG(1, ("in_msglen (%d) < minlen (%d)",
+				  ssl->in_msglen, ssl->minlen));
+		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+	}
+
+	if ((ret = ssl->f_decrypt(ssl)) != 0)
+		return (ret);
+
+	return (ssl_decrypt_done(ssl));
+}
+
+/*
+ * Cipher primitives, behind one interface: setkey() keys both
+ * directions, crypt() en- or decrypts a buffer in place (under iv
+ * for block ciphers), and the record functions use them
+ */
+#if defined(TROPICSSL_ARC4)
+static void ssl_arc4_setkey(void *ctx_enc, void *ctx_dec,
+			    const uint8_t *key_enc, const uint8_t *key_dec,
+			    unsigned int keylen)
+{
+	arc4_setup((arc4_context *) ctx_enc, key_enc, keylen);
+	arc4_setup((arc4_context *) ctx_dec, key_dec, keylen);
+}
+
+static void ssl_arc4_crypt(void *ctx, int enc, size_t len, uint8_t *iv,
+			   uint8_t *buf)
+{
+	(void) enc;
+	(void) iv;
+
+	arc4_crypt((arc4_context *) ctx, buf, (int)len);
+}
+
+static const ssl_cipher_base ssl_arc4_base = {
+	sizeof(arc4_context), ssl_arc4_setkey, ssl_arc4_crypt,
+	ssl_encrypt_stream, ssl_decrypt_stream
+};
+#endif
+
+#if defined(TROPICSSL_DES)
+static void ssl_des3_setkey(void *ctx_enc, void *ctx_dec,
+			    const uint8_t *key_enc, const uint8_t *key_dec,
+			    unsigned int keylen)
+{
+	(void) keylen;
+
+	des3_set3key_enc((des3_context *) ctx_enc, key_enc);
+	des3_set3key_dec((des3_context *) ctx_dec, key_dec);
+}
+
+static void ssl_des3_crypt(void *ctx, int enc, size_t len, uint8_t *iv,
+			   uint8_t *buf)
+{
+	des3_crypt_cbc((des3_context *) ctx,
+		       enc ? DES_ENCRYPT : DES_DECRYPT, len, iv, buf, buf);
+}
+
+static const ssl_cipher_base ssl_des3_base = {
+	sizeof(des3_context), ssl_des3_setkey, ssl_des3_crypt,
+	ssl_encrypt_cbc, ssl_decrypt_cbc
+};
+#endif
+
+#if defined(TROPICSSL_AES)
+static void ssl_aes_setkey(void *ctx_enc, void *ctx_dec,
+			   const uint8_t *key_enc, const uint8_t *key_dec,
+			   unsigned int keylen)
+{
+	aes_setkey_enc((aes_context *) ctx_enc, key_enc, keylen * 8);
+	aes_setkey_dec((aes_context *) ctx_dec, key_dec, keylen * 8);
+}
+
+static void ssl_aes_crypt(void *ctx, int enc, size_t len, uint8_t *iv,
+			  uint8_t *buf)
+{
+	aes_crypt_cbc((aes_context *) ctx,
+		      enc ? AES_ENCRYPT : AES_DECRYPT, len, iv, buf, buf);
+}
+
+static const ssl_cipher_base ssl_aes_base = {
+	sizeof(aes_context), ssl_aes_setkey, ssl_aes_crypt,
+	ssl_encrypt_cbc, ssl_decrypt_cbc
+};
+#endif
+
+#if defined(TROPICSSL_CAMELLIA)
+static void ssl_camellia_setkey(void *ctx_enc, void *ctx_dec,
+				const uint8_t *key_enc,
+				const uint8_t *key_dec, unsigned int keylen)
+{
+	camellia_setkey_enc((camellia_context *) ctx_enc, key_enc,
+			    keylen * 8);
+	camellia_setkey_dec((camellia_context *) ctx_dec, key_dec,
+			    keylen * 8);
+}
+
+static void ssl_camellia_crypt(void *ctx, int enc, size_t len,
+			       uint8_t *iv, uint8_t *buf)
+{
+	camellia_crypt_cbc((camellia_context *) ctx,
+			   enc ? CAMELLIA_ENCRYPT : CAMELLIA_DECRYPT,
+			   len, iv, buf, buf);
+}
+
+static const ssl_cipher_base ssl_camellia_base = {
+	sizeof(camellia_context), ssl_camellia_setkey, ssl_camellia_crypt,
+	ssl_encrypt_cbc, ssl_decrypt_cbc
+};
+#endif
+
+#if defined(TROPICSSL_GCM)
+static void ssl_gcm_setkey(void *ctx_enc, void *ctx_dec,
+			   const uint8_t *key_enc, const uint8_t *key_dec,
+			   unsigned int keylen)
+{
+	gcm_init((gcm_context *) ctx_enc, key_enc, keylen * 8);
+	gcm_init((gcm_context *) ctx_dec, key_dec, keylen * 8);
+}
+
+/*
+ * AEAD: the record functions do all of it, there is no crypt()
+ */
+static const ssl_cipher_base ssl_gcm_base = {
+	sizeof(gcm_context), ssl_gcm_setkey, NULL,
+	ssl_encrypt_gcm, ssl_decrypt_gcm
+};
+#endif
+
+#if defined(TROPICSSL_CHACHAPOLY)
+static void ssl_chachapoly_setkey(void *ctx_enc, void *ctx_dec,
+				  const uint8_t *key_enc,
+				  const uint8_t *key_dec, unsigned int keylen)
+{
+	(void)keylen;
+
+	chachapoly_setkey((chachapoly_context *) ctx_enc, key_enc);
+	chachapoly_setkey((chachapoly_context *) ctx_dec, key_dec);
+}
+
+static const ssl_cipher_base ssl_chachapoly_base = {
+	sizeof(chachapoly_context), ssl_chachapoly_setkey, NULL,
+	ssl_encrypt_chachapoly, ssl_decrypt_chachapoly
+};
+#endif
+
+/*
+ * Ciphersuites: primitive, key length, min. ciphertext length (before
+ * any explicit IV), IV length and MAC length.
+ *
+ * AEAD suites have no MAC keys, a 4-byte implicit nonce part (the
+ * "IV") and 8 explicit nonce bytes plus the 16-byte tag on every
+ * record. ChaCha20-Poly1305 has a 12-byte IV and sends just the tag.
+ */
+static const ssl_cipher_info ssl_cipher_infos[] = {
+#if defined(TROPICSSL_ARC4)
+	{TLS_RSA_WITH_RC4_128_MD5, &ssl_arc4_base, 16, 16, 0, 16},
+	{TLS_RSA_WITH_RC4_128_SHA, &ssl_arc4_base, 16, 20, 0, 20},
+#endif
+
+#if defined(TROPICSSL_DES)
+	{TLS_RSA_WITH_3DES_EDE_CBC_SHA, &ssl_des3_base, 24, 24, 8, 20},
+	{TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA, &ssl_des3_base, 24, 24, 8, 20},
+	{TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA, &ssl_des3_base, 24, 24, 8, 20},
+#endif
+
+#if defined(TROPICSSL_AES)
+	{TLS_RSA_WITH_AES_128_CBC_SHA, &ssl_aes_base, 16, 32, 16, 20},
+	{TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA, &ssl_aes_base, 16, 32, 16, 20},
+	{TLS_RSA_WITH_AES_256_CBC_SHA, &ssl_aes_base, 32, 32, 16, 20},
+	{TLS_DHE_RSA_WITH_AES_256_CBC_SHA, &ssl_aes_base, 32, 32, 16, 20},
+	{TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA, &ssl_aes_base, 32, 32, 16, 20},
+	{TLS_RSA_WITH_AES_128_CBC_SHA256, &ssl_aes_base, 16, 48, 16, 32},
+	{TLS_DHE_RSA_WITH_AES_128_CBC_SHA256, &ssl_aes_base, 16, 48, 16, 32},
+	{TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256, &ssl_aes_base, 16, 48, 16, 32},
+	{TLS_RSA_WITH_AES_256_CBC_SHA256, &ssl_aes_base, 32, 48, 16, 32},
+	{TLS_DHE_RSA_WITH_AES_256_CBC_SHA256, &ssl_aes_base, 32, 48, 16, 32},
+#endif
+
+#if defined(TROPICSSL_CAMELLIA)
+	{TLS_RSA_WITH_CAMELLIA_128_CBC_SHA, &ssl_camellia_base, 16, 32, 16, 20},
+	{TLS_RSA_WITH_CAMELLIA_256_CBC_SHA, &ssl_camellia_base, 32, 32, 16, 20},
+	{TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA, &ssl_camellia_base, 32, 32, 16, 20},
+#endif
+
+#if defined(TROPICSSL_GCM)
+	{TLS_RSA_WITH_AES_128_GCM_SHA256, &ssl_gcm_base, 16, 24, 4, 0},
+	{TLS_DHE_RSA_WITH_AES_128_GCM_SHA256, &ssl_gcm_base, 16, 24, 4, 0},
+	{TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256, &ssl_gcm_base, 16, 24, 4, 0},
+	{TLS_RSA_WITH_AES_256_GCM_SHA384, &ssl_gcm_base, 32, 24, 4, 0},
+	{TLS_DHE_RSA_WITH_AES_256_GCM_SHA384, &ssl_gcm_base, 32, 24, 4, 0},
+	{TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384, &ssl_gcm_base, 32, 24, 4, 0},
+#endif
+
+#if defined(TROPICSSL_CHACHAPOLY)
+	{TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256, &ssl_chachapoly_base,
+	 32, 16, 12, 0},
+	{TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256, &ssl_chachapoly_base,
+	 32, 16, 12, 0},
+#endif
+
+	{0, NULL, 0, 0, 0, 0}
+};
+
+static const ssl_cipher_info *ssl_cipher_lookup(int cipher)
+{
+	const ssl_cipher_info *info;
+
+	for (info = ssl_cipher_infos; info->base != NULL; info++)
+		if (info->cipher == cipher)
+			return (info);
+
+	return (NULL);
+}
+
+/*
+ * Allocate the cipher contexts and HMAC states of both directions in
+ * one block, sized for the negotiated suite
+ */
+static int ssl_cipher_state_alloc(ssl_context * ssl, size_t ctx_len,
+				  size_t hmac_len)
+{
+	uint8_t *p;
+	size_t len;
+
+	ctx_len = (ctx_len + 7) & ~(size_t)7;
+	hmac_len = (hmac_len + 7) & ~(size_t)7;
+	len = 2 * (ctx_len + hmac_len);
+
+	if (ssl->ctx_enc != NULL) {
+		memset(ssl->ctx_enc, 0, ssl->ctx_len);
+		memory_free(ssl->ctx_enc);
+		ssl->ctx_enc = NULL;
+	}
+
+	if ((p = (uint8_t *)memory_alloc(len)) == NULL) {
+		SSL_DEBUG_MSG(1, ("memory_alloc(%d bytes) failed", len));
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+	}
+
+	memset(p, 0, len);
+
+	ssl->ctx_enc = p;
+	ssl->ctx_dec = p + ctx_len;
+	ssl->hmac_enc = (hmac_len != 0) ? p + 2 * ctx_len : NULL;
+	ssl->hmac_dec = (hmac_len != 0) ? p + 2 * ctx_len + hmac_len : NULL;
+	ssl->ctx_len = len;
+
+	return (0);
+}
+
+/*
+ * Key the cipher state of ssl->cipher_info, and pick the MAC and
+ * the record functions every record of the connection then uses
+ */
+static int ssl_cipher_setup(ssl_context * ssl, const uint8_t *key1,
+			    const uint8_t *key2)
+{
+	int ret;
+	size_t hmac_len = 0;
+	const ssl_cipher_base *base = ssl->cipher_info->base;
+
+	ssl->f_mac = NULL;
+
+	if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
+		if (ssl->maclen == 16)
+			ssl->f_mac = ssl_mac_md5;
+
+		if (ssl->maclen == 20)
+			ssl->f_mac = ssl_mac_sha1;
+	} else {
+		if (ssl->maclen == 16) {
+			ssl->f_mac = ssl_hmac_md5;
+			hmac_len = sizeof(md5_context);
+		}
+
+		if (ssl->maclen == 20) {
+			ssl->f_mac = ssl_hmac_sha1;
+			hmac_len = sizeof(sha1_context);
+		}
+
+		if (ssl->maclen == 32) {
+			ssl->f_mac = ssl_hmac_sha2;
+			hmac_len = sizeof(sha2_context);
+		}
+	}
+
+	if ((ret = ssl_cipher_state_alloc(ssl, base->ctx_len, hmac_len)) != 0)
+		return (ret);
+
+	/*
+	 * TLSv1: hash the padded MAC keys once per connection; each
+	 * record then only resets the HMAC contexts
+	 */
+	if (ssl->maclen == 16 && hmac_len != 0) {
+		md5_hmac_starts((md5_context *) ssl->hmac_enc,
+				ssl->mac_enc, 16);
+		md5_hmac_starts((md5_context *) ssl->hmac_dec,
+				ssl->mac_dec, 16);
+	}
+
+	if (ssl->maclen == 20 && hmac_len != 0) {
+		sha1_hmac_starts((sha1_context *) ssl->hmac_enc,
+				 ssl->mac_enc, 20);
+		sha1_hmac_starts((sha1_context *) ssl->hmac_dec,
+				 ssl->mac_dec, 20);
+	}
+
+	if (ssl->maclen == 32 && hmac_len != 0) {
+		sha2_hmac_starts((sha2_context *) ssl->hmac_enc,
+				 ssl->mac_enc, 32, 0);
+		sha2_hmac_starts((sha2_context *) ssl->hmac_dec,
+				 ssl->mac_dec, 32, 0);
+	}
+
+	base->setkey(ssl->ctx_enc, ssl->ctx_dec, key1, key2, ssl->keylen);
+
+	ssl->f_encrypt = base->encrypt;
+	ssl->f_decrypt = base->decrypt;
+
+#if defined(TROPICSSL_AES) && defined(TROPICSSL_SHA1)
+	if (base == &ssl_aes_base && ssl->f_mac == ssl_hmac_sha1) {
+		ssl->f_encrypt = ssl_encrypt_aes_sha1;
+		ssl->f_decrypt = ssl_decrypt_aes_sha1;
+	}
+#endif
+
+	return (0);
+}
+
+#if defined(TROPICSSL_SSL_KTLS)
+/*
+ * Kernel TLS: once the handshake is over, the directions that can
+ * be offloaded get the keys, salts and sequence numbers. A direction
+ * with data in flight stays in userspace, as the kernel would not
+ * know about it.
+ */
+static void ssl_ktls_start(ssl_context * ssl)
+{
+#if defined(TROPICSSL_GCM)
+	const uint8_t *seq;
+
+	if (ssl->ktls_fd < 0 || ssl->ktls != 0 ||
+	    ssl->minor_ver != SSL_MINOR_VERSION_3 ||
+	    ssl_cipher_is_gcm(ssl->session->cipher) == 0 ||
+	    ssl->session->compression != SSL_COMPRESS_NULL ||
+	    ssl->mfl_nego != SSL_MAX_FRAG_LEN_NONE)
+		goto done;
+
+	if (ssl->out_left == 0 && ssl->out_ring_used == 0) {
+		seq = (ssl->out_ctr != NULL) ? ssl->out_ctr : ssl->out_seq;
+
+		if (net_set_ktls(ssl->ktls_fd, NET_KTLS_TX, ssl->ktls_key_enc,
+				 ssl->keylen, ssl->iv_enc, seq) == 0)
+			ssl->ktls |= SSL_KTLS_TX;
+	}
+
+	if (ssl->in_left == 0 && ssl->in_ahead == 0 && ssl->in_offt == NULL) {
+		seq = (ssl->in_ctr != NULL) ? ssl->in_ctr : ssl->in_seq;
+
+		if (net_set_ktls(ssl->ktls_fd, NET_KTLS_RX, ssl->ktls_key_dec,
+				 ssl->keylen, ssl->iv_dec, seq) == 0)
+			ssl->ktls |= SSL_KTLS_RX;
+	}
+
+	SSL_DEBUG_MSG(2, ("kernel TLS: tx %d, rx %d",
+			  (ssl->ktls & SSL_KTLS_TX) != 0,
+			  (ssl->ktls & SSL_KTLS_RX) != 0));
+
+done:
+#endif
+	memset(ssl->ktls_key_enc, 0, sizeof(ssl->ktls_key_enc));
+	memset(ssl->ktls_key_dec, 0, sizeof(ssl->ktls_key_dec));
+}
+
+/*
+ * Plaintext out of an offloaded socket: application data is a plain
+ * send(), anything else needs its record type
+ */
+static int ssl_ktls_send(ssl_context * ssl, int msgtype,
+			 const uint8_t *buf, size_t len)
+{
+	int ret;
+
+	if (msgtype == SSL_MSG_APPLICATION_DATA)
+		ret = net_send(&ssl->ktls_fd, (uint8_t *)buf, len);
+	else
+		ret = net_send_record(ssl->ktls_fd, msgtype, buf, len);
+
+	SSL_DEBUG_RET(2, "kernel TLS send", ret);
+
+	if (ret > 0)
+		SSL_STATS_ADD(ssl, bytes_out, ret);
+
+	return (ret);
+}
+
+/*
+ * Plaintext in from an offloaded socket, with the alerts handled
+ * as ssl_read_record() would
+ */
+static int ssl_ktls_recv(ssl_context * ssl, uint8_t *buf, size_t len)
+{
+	int ret, type;
+
+	for (;;) {
+		ret = net_recv_record(ssl->ktls_fd, &type, buf, len);
+		SSL_DEBUG_RET(2, "kernel TLS recv", ret);
+
+		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			return (TROPICSSL_ERR_NET_WANT_READ);
+
+		if (ret < 0)
+			return (ret);
+
+		SSL_STATS_ADD(ssl, bytes_in, ret);
+
+		if (type == SSL_MSG_APPLICATION_DATA)
+			return (ret);
+
+		if (type != SSL_MSG_ALERT || ret < 2) {
+			SSL_DEBUG_MSG(1, ("bad application data message"));
+			return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+		}
+
+		SSL_DEBUG_MSG(2, ("got an alert message, type: [%d:%d]",
+				  buf[0], buf[1]));
+
+		if (buf[0] == SSL_ALERT_FATAL)
+			return (TROPICSSL_ERR_SSL_FATAL_ALERT_MESSAGE | buf[1]);
+
+		if (buf[0] == SSL_ALERT_WARNING &&
+		    buf[1] == SSL_ALERT_CLOSE_NOTIFY)
+			return (TROPICSSL_ERR_SSL_PEER_CLOSE_NOTIFY);
+	}
+}
+#endif
+
+/*
+ * How far read-ahead may fill the input buffer: all of it, but with
+ * DEFLATE the record must keep room to grow in place as it inflates
+ */
+static size_t ssl_fetch_room(const ssl_context * ssl, size_t nb_want)
+{
+	size_t room = ssl->in_buf_len - 8;
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+	if (ssl->session != NULL &&
+	    ssl->session->compression == SSL_COMPRESS_DEFLATE) {
+		room -= ssl->in_content_len;
+
+		if (room < nb_want)
+			room = nb_want;
+	}
+#else
+	(void)nb_want;
+#endif
+
+	return (room);
+}
+
+/*
+ * Fill the input message buffer; with read-ahead, take whatever else
+ * fits in it too (only records go through ssl_read_record(), which
+ * knows to keep what follows the current one)
+ */
+static int ssl_fetch(ssl_context * ssl, size_t nb_want, int ahead)
+{
+	int ret;
+	size_t len;
+
+	SSL_DEBUG_MSG(2, ("=> fetch input"));
+
+	while (ssl->in_left < nb_want) {
+		len = nb_want - ssl->in_left;
+
+		if (ahead != 0 && ssl->in_ahead_len != 0)
+			len = ssl_fetch_room(ssl, nb_want) - ssl->in_left;
+
+		ret = ssl->f_recv(ssl->p_recv, ssl->in_hdr + ssl->in_left, len);
+
+		SSL_DEBUG_MSG(2, ("in_left: %d, nb_want: %d",
+				  ssl->in_left, nb_want));
+		SSL_DEBUG_RET(2, "ssl->f_recv", ret);
+
+		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			return (TROPICSSL_ERR_NET_WANT_READ);
+
+		if (ret < 0)
+			return (ret);
+
+		ssl->in_left += ret;
+	}
+
+	SSL_DEBUG_MSG(2, ("<= fetch input"));
+
+	return (0);
+}
+
+int ssl_fetch_input(ssl_context * ssl, size_t nb_want)
+{
+	return (ssl_fetch(ssl, nb_want, 0));
+}
+
+/*
+ * Send the queued records; they are contiguous, so this is a single
+ * write per attempt. A regular record waiting behind them joins the
+ * same vectored write when the BIO has one.
+ */
+static int ssl_flush_ring(ssl_context * ssl)
+{
+	int n, ret;
+	net_iovec iov[2];
+
+	while (ssl->out_ring_sent < ssl->out_ring_used) {
+		iov[0].base = ssl->out_ring + 8 + ssl->out_ring_sent;
+		iov[0].len = ssl->out_ring_used - ssl->out_ring_sent;
+		n = 1;
+
+		SSL_DEBUG_MSG(2, ("queued records: %d bytes, out_left: %d",
+				  ssl->out_ring_used, iov[0].len));
+
+		if (ssl->f_sendv != NULL && ssl->out_left != 0) {
+			iov[1].base = ssl->out_hdr + 5 + ssl->out_msglen -
+			    ssl->out_left;
+			iov[1].len = ssl->out_left;
+			n = 2;
+		}
+
+		if (n == 2) {
+			ret = ssl->f_sendv(ssl->p_send, iov, n);
+			SSL_DEBUG_RET(2, "ssl->f_sendv", ret);
+		} else {
+			ret = ssl->f_send(ssl->p_send, (uint8_t *)iov[0].base,
+					  iov[0].len);
+			SSL_DEBUG_RET(2, "ssl->f_send", ret);
+		}
+
+		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			return (TROPICSSL_ERR_NET_WANT_WRITE);
+
+		if (ret <= 0)
+			return (ret);
+
+		if ((size_t)ret > iov[0].len) {
+			ssl->out_left -= ret - iov[0].len;
+			ret = (int)iov[0].len;
+		}
+
+		ssl->out_ring_sent += ret;
+	}
+
+	ssl->out_ring_used = 0;
+	ssl->out_ring_sent = 0;
+
+	return (0);
+}
+
+/*
+ * Flush any data not yet written
+ */
+int ssl_flush_output(ssl_context * ssl)
+{
+	int ret;
+	uint8_t *buf;
+
+	SSL_DEBUG_MSG(2, ("=> flush output"));
+
+	/*
+	 * Queued records go first, they were written earlier
+	 */
+	if (ssl->out_ring_used != 0) {
+		if ((ret = ssl_flush_ring(ssl)) != 0)
+			return (ret);
+	}
+
+	while (ssl->out_left > 0) {
+		SSL_DEBUG_MSG(2, ("message length: %d, out_left: %d",
+				  5 + ssl->out_msglen, ssl->out_left));
+
+		buf = ssl->out_hdr + 5 + ssl->out_msglen - ssl->out_left;
+
+#if defined(TROPICSSL_SSL_KTLS)
+		if ((ssl->ktls & SSL_KTLS_TX) != 0)
+			ret = ssl_ktls_send(ssl, ssl->out_msgtype, buf,
+					    ssl->out_left);
+		else
+#endif
+			ret = ssl->f_send(ssl->p_send, buf, ssl->out_left);
+		SSL_DEBUG_RET(2, "ssl->f_send", ret);
+
+		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			return (TROPICSSL_ERR_NET_WANT_WRITE);
+
+		if (ret <= 0)
+			return (ret);
+
+		ssl->out_left -= ret;
+	}
+
+	SSL_DEBUG_MSG(2, ("<= flush output"));
+
+	return (0);
+}
+
+/*
+ * Hash a handshake message into the transcript; once the handshake
+ * is over there is none left to update
+ */
+static int ssl_transcript_add(ssl_context * ssl, const uint8_t *buf,
+			      size_t len)
+{
+	if (ssl->handshake == NULL)
+		return (0);
+
+	return (ssl_transcript_update(&ssl->handshake->transcript, buf, len));
+}
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+/*
+ * zlib state comes from the same allocator as the record buffers
+ */
+static voidpf ssl_zalloc(voidpf opaque, uInt items, uInt size)
+{
+	(void)opaque;
+
+	return (memory_alloc((size_t)items * size));
+}
+
+static void ssl_zfree(voidpf opaque, voidpf ptr)
+{
+	(void)opaque;
+
+	memory_free(ptr);
+}
+
+/*
+ * Set up both streams once the first compressed record is due
+ */
+static int ssl_compress_setup(ssl_context * ssl)
+{
+	z_stream *zo, *zi;
+
+	if (ssl->deflate_ctx != NULL)
+		return (0);
+
+	zo = (z_stream *) memory_alloc(sizeof(z_stream));
+	zi = (z_stream *) memory_alloc(sizeof(z_stream));
+	ssl->compress_buf = (uint8_t *)
+	    memory_alloc(SSL_MAX_CONTENT_LEN + SSL_COMPRESSION_ADD);
+
+	if (zo == NULL || zi == NULL || ssl->compress_buf == NULL) {
+		SSL_DEBUG_MSG(1, ("memory_alloc(compression) failed"));
+		goto fail;
+	}
+
+	memset(zo, 0, sizeof(z_stream));
+	memset(zi, 0, sizeof(z_stream));
+	zo->zalloc = zi->zalloc = ssl_zalloc;
+	zo->zfree = zi->zfree = ssl_zfree;
+
+	if (deflateInit2(zo, ssl->compress_level, Z_DEFLATED,
+			 SSL_DEFLATE_WINDOW_BITS, SSL_DEFLATE_MEM_LEVEL,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		goto fail;
+
+	if (inflateInit(zi) != Z_OK) {
+		deflateEnd(zo);
+		goto fail;
+	}
+
+	ssl->deflate_ctx = zo;
+	ssl->inflate_ctx = zi;
+
+	return (0);
+
+fail:
+	if (zo != NULL)
+		memory_free(zo);
+	if (zi != NULL)
+		memory_free(zi);
+	if (ssl->compress_buf != NULL)
+		memory_free(ssl->compress_buf);
+	ssl->compress_buf = NULL;
+
+	return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+}
+
+/*
+ * Compress out_msg in place; a sync flush ends every record so the
+ * peer can decompress it on its own
+ */
+static int ssl_compress_buf(ssl_context * ssl)
+{
+	int ret;
+	size_t room = ssl->out_content_len + SSL_COMPRESSION_ADD;
+	z_stream *zs;
+
+	if ((ret = ssl_compress_setup(ssl)) != 0)
+		return (ret);
+
+	zs = (z_stream *) ssl->deflate_ctx;
+	zs->next_in = ssl->out_msg;
+	zs->avail_in = (uInt) ssl->out_msglen;
+	zs->next_out = ssl->compress_buf;
+	zs->avail_out = (uInt) room;
+
+	ret = deflate(zs, Z_SYNC_FLUSH);
+
+	if ((ret != Z_OK && ret != Z_BUF_ERROR) || zs->avail_in != 0 ||
+	    zs->avail_out == 0) {
+		SSL_DEBUG_MSG(1, ("deflate returned %d", ret));
+		return (TROPICSSL_ERR_SSL_COMPRESSION_FAILED);
+	}
+
+	SSL_DEBUG_MSG(3, ("compressed %d bytes to %d", ssl->out_msglen,
+			  room - zs->avail_out));
+
+	ssl->out_msglen = room - zs->avail_out;
+	memcpy(ssl->out_msg, ssl->compress_buf, ssl->out_msglen);
+
+	return (0);
+}
+
+/*
+ * Decompress in_msg in place; more than in_content_len bytes out of
+ * one record is an error, as it would be uncompressed. The records
+ * read ahead behind it move along, *reclen being where they start.
+ */
+static int ssl_decompress_buf(ssl_context * ssl, size_t *reclen)
+{
+	int ret;
+	size_t room = ssl->in_content_len + 1, ahead;
+	z_stream *zs;
+
+	if ((ret = ssl_compress_setup(ssl)) != 0)
+		return (ret);
+
+	zs = (z_stream *) ssl->inflate_ctx;
+	zs->next_in = ssl->in_msg;
+	zs->avail_in = (uInt) ssl->in_msglen;
+	zs->next_out = ssl->compress_buf;
+	zs->avail_out = (uInt) room;
+
+	ret = inflate(zs, Z_SYNC_FLUSH);
+
+	if ((ret != Z_OK && ret != Z_BUF_ERROR) || zs->avail_in != 0 ||
+	    zs->avail_out == 0) {
+		SSL_DEBUG_MSG(1, ("inflate returned %d", ret));
+		return (TROPICSSL_ERR_SSL_COMPRESSION_FAILED);
+	}
+
+	SSL_DEBUG_MSG(3, ("decompressed %d bytes to %d", ssl->in_msglen,
+			  room - zs->avail_out));
+
+	ssl->in_msglen = room - zs->avail_out;
+	ahead = ssl->in_left - *reclen;
+
+	if (5 + ssl->in_msglen + ahead > ssl->in_buf_len - 8) {
+		SSL_DEBUG_MSG(1, ("no room to decompress the record"));
+		return (TROPICSSL_ERR_SSL_COMPRESSION_FAILED);
+	}
+
+	memmove(ssl->in_hdr + 5 + ssl->in_msglen, ssl->in_hdr + *reclen,
+		ahead);
+	memcpy(ssl->in_msg, ssl->compress_buf, ssl->in_msglen);
+
+	*reclen = 5 + ssl->in_msglen;
+	ssl->in_left = *reclen + ahead;
+
+	return (0);
+}
+
+static void ssl_compress_free(ssl_context * ssl)
+{
+	if (ssl->deflate_ctx != NULL) {
+		deflateEnd((z_stream *) ssl->deflate_ctx);
+		inflateEnd((z_stream *) ssl->inflate_ctx);
+		memory_free(ssl->deflate_ctx);
+		memory_free(ssl->inflate_ctx);
+		memset(ssl->compress_buf, 0,
+		       SSL_MAX_CONTENT_LEN + SSL_COMPRESSION_ADD);
+		memory_free(ssl->compress_buf);
+	}
+
+	ssl->deflate_ctx = NULL;
+	ssl->inflate_ctx = NULL;
+	ssl->compress_buf = NULL;
+}
+#endif
+
+/*
+ * Whether the records going one way are compressed from now on;
+ * they are exactly when they are protected
+ */
+static int ssl_compressed(const ssl_context * ssl, int out)
+{
+	return ((out ? ssl->out_crypt : ssl->in_crypt) != 0 &&
+		ssl->session != NULL &&
+		ssl->session->compression == SSL_COMPRESS_DEFLATE);
+}
+
+/*
+ * Record layer functions
+ */
+static int ssl_prepare_record(ssl_context * ssl)
+{
+	int ret;
+	size_t len = ssl->out_msglen;
+
+	ssl->out_hdr[0] = (uint8_t)ssl->out_msgtype;
+	ssl->out_hdr[1] = (uint8_t)ssl->major_ver;
+	ssl->out_hdr[2] = (uint8_t)ssl->minor_ver;
+	ssl->out_hdr[3] = (uint8_t)(len >> 8);
+	ssl->out_hdr[4] = (uint8_t)(len);
+
+	if (ssl->out_msgtype == SSL_MSG_HANDSHAKE) {
+		ssl->out_msg[1] = (uint8_t)((len - 4) >> 16);
+		ssl->out_msg[2] = (uint8_t)((len - 4) >> 8);
+		ssl->out_msg[3] = (uint8_t)((len - 4));
+
+		if ((ret = ssl_transcript_add(ssl, ssl->out_msg, len)) != 0)
+			return (ret);
+	}
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+	if (ssl_compressed(ssl, 1)) {
+		if ((ret = ssl_compress_buf(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_compress_buf", ret);
+			return (ret);
+		}
+
+		/*
+		 * The MAC covers the compressed length
+		 */
+		len = ssl->out_msglen;
+		ssl->out_hdr[3] = (uint8_t)(len >> 8);
+		ssl->out_hdr[4] = (uint8_t)(len);
+	}
+#endif
+
+	if (ssl->out_crypt != 0) {
+		TROPICSSL_TRACE3(record_encrypt_start, ssl, ssl->out_msgtype,
+				 ssl->out_msglen);
+		ret = ssl_encrypt_buf(ssl);
+		TROPICSSL_TRACE3(record_encrypt_done, ssl, ssl->out_msglen, ret);
+
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "ssl_encrypt_buf", ret);
+			return (ret);
+		}
+
+		len = ssl->out_msglen;
+		ssl->out_hdr[3] = (uint8_t)(len >> 8);
+		ssl->out_hdr[4] = (uint8_t)(len);
+	}
+
+	SSL_STATS_INC(ssl, records_out);
+	SSL_STATS_ADD(ssl, bytes_out, 5 + len);
+
+	return (0);
+}
+
+/*
+ * Make sure the output ring exists
+ */
+static int ssl_ring_alloc(ssl_context * ssl)
+{
+	size_t len;
+
+	if (ssl->out_ring != NULL)
+		return (0);
+
+	len = SSL_OUT_RING_RECORDS *
+	    (ssl->out_content_len + SSL_BUFFER_OVERHEAD);
+
+	ssl->out_ring = (uint8_t *)memory_alloc(len);
+
+	if (ssl->out_ring == NULL) {
+		SSL_DEBUG_MSG(1, ("memory_alloc(%d bytes) failed", len));
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+	}
+
+	ssl->out_ring_len = len;
+
+	return (0);
+}
+
+/*
+ * Where the payload of the next queued record goes, or NULL if the
+ * ring has no room left for a full record
+ */
+static uint8_t *ssl_ring_next(ssl_context * ssl)
+{
+	if (ssl->out_ring_used + ssl->out_content_len +
+	    SSL_BUFFER_OVERHEAD > ssl->out_ring_len)
+		return (NULL);
+
+	return (ssl->out_ring + ssl->out_ring_used + 13);
+}
+
+/*
+ * Turn the n bytes of application data at ssl_ring_next() into a
+ * record, in place, right behind the previous one. The output
+ * pointers follow it so the usual record code applies unchanged.
+ * The sequence number is only read while the record is protected,
+ * so it borrows the last 8 bytes of the previous record meanwhile.
+ */
+static int ssl_queue_record(ssl_context * ssl, size_t n)
+{
+	int ret, msgtype = ssl->out_msgtype;
+	size_t msglen = ssl->out_msglen;
+	uint8_t tail[8];
+	uint8_t *out_buf = ssl->out_ctr;
+	uint8_t *p = ssl->out_ring + ssl->out_ring_used;
+
+	memcpy(tail, p, 8);
+	memcpy(p, out_buf, 8);
+	ssl->out_ctr = p;
+	ssl->out_hdr = p + 8;
+	ssl->out_msg = p + 13;
+
+	ssl->out_msglen = n;
+	ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
+
+	if ((ret = ssl_prepare_record(ssl)) == 0) {
+		ssl->out_ring_used += 5 + ssl->out_msglen;
+		SSL_STATS_MAX(ssl, out_hwm, ssl->out_ring_used);
+	}
+
+	memcpy(out_buf, p, 8);
+	memcpy(p, tail, 8);
+	ssl->out_ctr = out_buf;
+	ssl->out_hdr = out_buf + 8;
+	ssl->out_msg = out_buf + 13;
+
+	ssl->out_msglen = msglen;
+	ssl->out_msgtype = msgtype;
+
+	return (ret);
+}
+
+int ssl_write_record(ssl_context * ssl)
+{
+	int ret;
+
+	SSL_DEBUG_MSG(2, ("=> write record"));
+
+#if defined(TROPICSSL_SSL_KTLS)
+	/*
+	 * The kernel frames and protects the plaintext; out_left then
+	 * counts from out_msg, which is where flushing starts anyway
+	 */
+	if ((ssl->ktls & SSL_KTLS_TX) != 0) {
+		ssl->out_left = ssl->out_msglen;
+
+		if ((ret = ssl_flush_output(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+			return (ret);
+		}
+
+		SSL_DEBUG_MSG(2, ("<= write record"));
+
+		return (0);
+	}
+#endif
+
+	if ((ret = ssl_prepare_record(ssl)) != 0)
+		return (ret);
+
+	ssl->out_left = 5 + ssl->out_msglen;
+	SSL_STATS_MAX(ssl, out_hwm, ssl->out_left);
+
+	SSL_DEBUG_MSG(3, ("output record: msgtype = %d, "
+			  "version = [%d:%d], msglen = %d",
+			  ssl->out_hdr[0], ssl->out_hdr[1], ssl->out_hdr[2],
+			  (ssl->out_hdr[3] << 8) | ssl->out_hdr[4]));
+
+	SSL_DEBUG_BUF(4, "output record sent to network",
+		      ssl->out_hdr, 5 + ssl->out_msglen);
+
+	if ((ret = ssl_flush_output(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+		return (ret);
+	}
+
+	SSL_DEBUG_MSG(2, ("<= write record"));
+
+	return (0);
+}
+
+/*
+ * Make room for len bytes of the handshake message being gathered
+ */
+static int ssl_gather_reserve(ssl_context * ssl, size_t len)
+{
+	uint8_t *p;
+	ssl_handshake_params *hs = ssl->handshake;
+
+	if (len <= hs->msg_size)
+		return (0);
+
+	if ((p = (uint8_t *)memory_alloc(len)) == NULL) {
+		SSL_DEBUG_MSG(1, ("memory_alloc(%d bytes) failed", len));
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+	}
+
+	if (hs->msg != NULL) {
+		memcpy(p, hs->msg, hs->msg_fill);
+		memset(hs->msg, 0, hs->msg_size);
+		memory_free(hs->msg);
+	}
+
+	hs->msg = p;
+	hs->msg_size = len;
+
+	return (0);
+}
+
+/*
+ * Drop the gathered message; in_msg is the record's again
+ */
+static void ssl_gather_free(ssl_context * ssl)
+{
+	ssl_handshake_params *hs = ssl->handshake;
+
+	if (hs->gather == SSL_GATHER_DONE) {
+		ssl->in_msg = (ssl->in_hdr != NULL) ? ssl->in_hdr + 5 : NULL;
+		ssl->in_msglen = ssl->in_hslen = 0;
+	}
+
+	if (hs->msg != NULL) {
+		memset(hs->msg, 0, hs->msg_size);
+		memory_free(hs->msg);
+	}
+
+	hs->gather = SSL_GATHER_NONE;
+	hs->stream = 0;
+	hs->msg = NULL;
+	hs->msg_size = hs->msg_fill = 0;
+	hs->msg_len = hs->msg_done = hs->msg_rest = 0;
+}
+
+/*
+ * Bytes the part of the message now held should come to: its
+ * header, then the whole message, or with a Certificate parsed on
+ * the fly, its own header and then one certificate at a time
+ */
+static size_t ssl_gather_want(const ssl_handshake_params * hs)
+{
+	if (hs->msg_len == 0)
+		return (4);
+
+	if (hs->stream == 0)
+		return (hs->msg_len);
+
+	if (hs->msg_done == 0)
+		return (7);
+
+	if (hs->msg_fill < 3)
+		return (3);
+
+	return (3 + (((size_t)hs->msg[1] << 8) | (size_t)hs->msg[2]));
+}
+
+/*
+ * Parse the part of a Certificate message now held, as
+ * ssl_parse_crt_list() does for a whole one, and let it go
+ */
+static int ssl_gather_crt(ssl_context * ssl)
+{
+	int ret;
+	size_t n;
+	ssl_handshake_params *hs = ssl->handshake;
+	uint8_t *p = hs->msg;
+
+	if (hs->msg_done == 0) {
+		n = ((size_t)p[4] << 16) | ((size_t)p[5] << 8) | (size_t)p[6];
+
+		if (p[0] != SSL_HS_CERTIFICATE || hs->msg_len != 7 + n) {
+			SSL_DEBUG_MSG(1, ("bad certificate message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+		}
+
+		ssl->peer_cert = (x509_cert *) memory_alloc(sizeof(x509_cert));
+		if (ssl->peer_cert == NULL) {
+			SSL_DEBUG_MSG(1, ("memory_alloc(%d bytes) failed",
+					  sizeof(x509_cert)));
+			return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+		}
+
+		memset(ssl->peer_cert, 0, sizeof(x509_cert));
+	} else if (hs->msg_fill == 3) {
+		n = ((size_t)p[1] << 8) | (size_t)p[2];
+
+		if (p[0] != 0 || n < 128 || hs->msg_done + 3 + n > hs->msg_len) {
+			SSL_DEBUG_MSG(1, ("bad certificate message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+		}
+
+		return (0);
+	} else {
+		ret = x509parse_crt_lazy(ssl->peer_cert, p + 3,
+					 hs->msg_fill - 3);
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, " x509parse_crt_lazy", ret);
+			return (ret);
+		}
+	}
+
+	if ((ret = ssl_transcript_add(ssl, p, hs->msg_fill)) != 0)
+		return (ret);
+
+	hs->msg_done += hs->msg_fill;
+	hs->msg_fill = 0;
+
+	return (0);
+}
+
+/*
+ * Add the handshake data of the record to the message being
+ * gathered: 0 once it is whole (in_msg then points to it), or
+ * SSL_GATHER_MORE when it takes more records
+ */
+static int ssl_gather(ssl_context * ssl)
+{
+	int ret;
+	size_t used = 0, want, n;
+	ssl_handshake_params *hs = ssl->handshake;
+
+	while (hs->msg_len == 0 || hs->msg_done + hs->msg_fill < hs->msg_len) {
+		if (used == ssl->in_msglen)
+			return (SSL_GATHER_MORE);
+
+		want = ssl_gather_want(hs);
+
+		if ((ret = ssl_gather_reserve(ssl, want)) != 0)
+			return (ret);
+
+		n = want - hs->msg_fill;
+		if (n > ssl->in_msglen - used)
+			n = ssl->in_msglen - used;
+
+		memcpy(hs->msg + hs->msg_fill, ssl->in_msg + used, n);
+		hs->msg_fill += n;
+		used += n;
+
+		if (hs->msg_fill < want)
+			continue;
+
+		if (hs->msg_len == 0) {
+			hs->msg_len = 4 + (((size_t)hs->msg[1] << 16) |
+					   ((size_t)hs->msg[2] << 8) |
+					   (size_t)hs->msg[3]);
+
+			SSL_DEBUG_MSG(3, ("handshake message: type = %d, "
+					  "hslen = %d, gathered", hs->msg[0],
+					  hs->msg_len));
+
+			if (hs->msg_len > ssl->hs_max_len) {
+				SSL_DEBUG_MSG(1, ("bad handshake length"));
+				return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+			}
+
+			/*
+			 * Only where a Certificate is expected; a
+			 * certificate cache takes the whole list
+			 */
+			hs->stream = hs->msg[0] == SSL_HS_CERTIFICATE &&
+			    hs->msg_len > 7 &&
+			    (ssl->state == SSL_SERVER_CERTIFICATE ||
+			     ssl->state == SSL_CLIENT_CERTIFICATE);
+#if defined(TROPICSSL_X509_CRT_CACHE)
+			if (ssl->crt_cache != NULL)
+				hs->stream = 0;
+#endif
+		} else if (hs->stream != 0 &&
+			   (ret = ssl_gather_crt(ssl)) != 0)
+			return (ret);
+	}
+
+	/*
+	 * A Certificate parsed on the fly must end with its last
+	 * certificate, as ssl_parse_crt_list() requires
+	 */
+	if (hs->stream != 0 && hs->msg_fill != 0) {
+		SSL_DEBUG_MSG(1, ("bad certificate message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+	}
+
+	/*
+	 * What follows the message in the record waits in front of it
+	 */
+	hs->msg_rest = ssl->in_msglen - used;
+	memmove(ssl->in_msg, ssl->in_msg + used, hs->msg_rest);
+
+	if (hs->stream == 0) {
+		ret = ssl_transcript_add(ssl, hs->msg, hs->msg_len);
+		if (ret != 0)
+			return (ret);
+	} else {
+		/*
+		 * The certificates are in peer_cert: only the header is
+		 * left for ssl_parse_certificate()
+		 */
+		n = hs->msg_len - 7;
+		hs->msg[0] = SSL_HS_CERTIFICATE;
+		hs->msg[1] = (uint8_t)((n + 3) >> 16);
+		hs->msg[2] = (uint8_t)((n + 3) >> 8);
+		hs->msg[3] = (uint8_t)((n + 3));
+		hs->msg[4] = (uint8_t)(n >> 16);
+		hs->msg[5] = (uint8_t)(n >> 8);
+		hs->msg[6] = (uint8_t)(n);
+	}
+
+	hs->gather = SSL_GATHER_DONE;
+	ssl->in_msgtype = SSL_MSG_HANDSHAKE;
+	ssl->in_msg = hs->msg;
+	ssl->in_msglen = ssl->in_hslen = hs->msg_len;
+
+	return (0);
+}
+
+/*
+ * The record holds handshake data from the start of a message on:
+ * the message is used in place when whole, gathered otherwise
+ */
+static int ssl_handshake_msg(ssl_context * ssl)
+{
+	if (ssl->in_msglen >= 4) {
+		ssl->in_hslen = 4 + (((size_t)ssl->in_msg[1] << 16) |
+				     ((size_t)ssl->in_msg[2] << 8) |
+				     (size_t)ssl->in_msg[3]);
+
+		SSL_DEBUG_MSG(3, ("handshake message: msglen ="
+				  " %d, type = %d, hslen = %d",
+				  ssl->in_msglen, ssl->in_msg[0],
+				  ssl->in_hslen));
+
+		if (ssl->in_msglen >= ssl->in_hslen)
+			return (ssl_transcript_add(ssl, ssl->in_msg,
+						   ssl->in_hslen));
+	}
+
+	ssl->in_hslen = 0;
+
+	if (ssl->handshake == NULL || ssl->hs_max_len == 0 ||
+	    ssl->in_msglen == 0) {
+		SSL_DEBUG_MSG(1, ("bad handshake length"));
+		return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+	}
+
+	ssl->handshake->gather = SSL_GATHER_MORE;
+
+	return (ssl_gather(ssl));
+}
+
+int ssl_read_record(ssl_context * ssl)
+{
+	int ret = 0;
+	size_t reclen, maxlen;
+	ssl_handshake_params *hs = ssl->handshake;
+
+	SSL_DEBUG_MSG(2, ("=> read record"));
+
+	if (hs != NULL && hs->gather == SSL_GATHER_DONE) {
+		/*
+		 * Done with a gathered message: on to what followed it
+		 */
+		reclen = hs->msg_rest;
+		ssl_gather_free(ssl);
+		ssl->in_msglen = reclen;
+
+		if (ssl->in_msglen != 0 &&
+		    (ret = ssl_handshake_msg(ssl)) != SSL_GATHER_MORE)
+			return (ret);
+	} else if (ssl->in_hslen != 0 && ssl->in_hslen < ssl->in_msglen) {
+		/*
+		 * Get next Handshake message in the current record
+		 */
+		ssl->in_msglen -= ssl->in_hslen;
+
+		memmove(ssl->in_msg, ssl->in_msg + ssl->in_hslen,
+			ssl->in_msglen);
+
+		if ((ret = ssl_handshake_msg(ssl)) != SSL_GATHER_MORE)
+			return (ret);
+	}
+
+next_record:
+
+	ssl->in_hslen = 0;
+
+	/*
+	 * Records read ahead with the previous one move to the front
+	 */
+	if (ssl->in_ahead != 0) {
+		memmove(ssl->in_hdr, ssl->in_hdr + ssl->in_ahead_off,
+			ssl->in_ahead);
+		ssl->in_left = ssl->in_ahead;
+		ssl->in_ahead = 0;
+	}
+
+	/*
+	 * Read the record header and validate it
+	 */
+	if ((ret = ssl_fetch(ssl, 5, 1)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_fetch_input", ret);
+		return (ret);
+	}
+
+	ssl->in_msgtype = ssl->in_hdr[0];
+	ssl->in_msglen = (ssl->in_hdr[3] << 8) | ssl->in_hdr[4];
+
+	SSL_DEBUG_MSG(3, ("input record: msgtype = %d, "
+			  "version = [%d:%d], msglen = %d",
+			  ssl->in_hdr[0], ssl->in_hdr[1], ssl->in_hdr[2],
+			  (ssl->in_hdr[3] << 8) | ssl->in_hdr[4]));
+
+	if (ssl->in_hdr[1] != ssl->major_ver) {
+		SSL_DEBUG_MSG(1, ("major version mismatch"));
+		return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+	}
+
+	if (ssl->in_hdr[2] > SSL_MINOR_VERSION_3) {
+		SSL_DEBUG_MSG(1, ("minor version mismatch"));
+		return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+	}
+
+	/*
+	 * Make sure the message length is acceptable
+	 */
+	maxlen = ssl->in_content_len;
+	if (ssl_compressed(ssl, 0))
+		maxlen += SSL_COMPRESSION_ADD;
+
+	if (ssl->in_crypt == 0) {
+		if (ssl->in_msglen < 1 ||
+		    ssl->in_msglen > ssl->in_content_len) {
+			SSL_DEBUG_MSG(1, ("bad message length"));
+			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+		}
+	} else {
+		if (ssl->in_msglen < ssl->minlen) {
+			SSL_DEBUG_MSG(1, ("bad message length"));
+			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+		}
+
+		if (ssl->minor_ver == SSL_MINOR_VERSION_0 &&
+		    ssl->in_msglen > ssl->minlen + maxlen) {
+			SSL_DEBUG_MSG(1, ("bad message length"));
+			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+		}
+
+		/*
+		 * TLS encrypted messages can have up to 256 bytes of padding
+		 */
+		if (ssl->minor_ver >= SSL_MINOR_VERSION_1 &&
+		    ssl->in_msglen > ssl->minlen + maxlen + 256) {
+			SSL_DEBUG_MSG(1, ("bad message length"));
+			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+		}
+	}
+
+	/*
+	 * Read and optionally decrypt the message contents
+	 */
+	if ((ret = ssl_fetch(ssl, 5 + ssl->in_msglen, 1)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_fetch_input", ret);
+		return (ret);
+	}
+
+	SSL_DEBUG_BUF(4, "input record from network",
+		      ssl->in_hdr, 5 + ssl->in_msglen);
+
+	reclen = 5 + ssl->in_msglen;
+
+	SSL_STATS_INC(ssl, records_in);
+	SSL_STATS_ADD(ssl, bytes_in, 5 + ssl->in_msglen);
+	SSL_STATS_MAX(ssl, in_hwm, ssl->in_left);
+
+	if (ssl->in_crypt != 0) {
+		TROPICSSL_TRACE3(record_decrypt_start, ssl, ssl->in_msgtype,
+				 ssl->in_msglen);
+		ret = ssl_decrypt_buf(ssl);
+		TROPICSSL_TRACE3(record_decrypt_done, ssl, ssl->in_msglen, ret);
+
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "ssl_decrypt_buf", ret);
+			return (ret);
+		}
+
+		SSL_DEBUG_BUF(4, "input payload after decrypt",
+			      ssl->in_msg, ssl->in_msglen);
+
+		if (ssl->in_msglen > maxlen) {
+			SSL_DEBUG_MSG(1, ("bad message length"));
+			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+		}
+	}
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+	if (ssl_compressed(ssl, 0) &&
+	    (ret = ssl_decompress_buf(ssl, &reclen)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_decompress_buf", ret);
+		return (ret);
+	}
+#endif
+
+	ret = 0;
+
+	if (ssl->in_msgtype == SSL_MSG_HANDSHAKE) {
+		if (hs != NULL && hs->gather == SSL_GATHER_MORE)
+			ret = ssl_gather(ssl);
+		else
+			ret = ssl_handshake_msg(ssl);
+
+		if (ret < 0)
+			return (ret);
+	} else if (hs != NULL && hs->gather == SSL_GATHER_MORE) {
+		SSL_DEBUG_MSG(1, ("record inside a handshake message"));
+		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+	}
+
+	if (ssl->in_msgtype == SSL_MSG_ALERT) {
+		SSL_DEBUG_MSG(2, ("got an alert message, type: [%d:%d]",
+				  ssl->in_msg[0], ssl->in_msg[1]));
+
+		/*
+		 * Ignore non-fatal alerts, except close_notify
+		 */
+		if (ssl->in_msg[0] == SSL_ALERT_FATAL) {
+			SSL_DEBUG_MSG(1, ("is a fatal alert message"));
+			return (TROPICSSL_ERR_SSL_FATAL_ALERT_MESSAGE |
+				ssl->in_msg[1]);
+		}
+
+		if (ssl->in_msg[0] == SSL_ALERT_WARNING &&
+		    ssl->in_msg[1] == SSL_ALERT_CLOSE_NOTIFY) {
+			SSL_DEBUG_MSG(2, ("is a close notify message"));
+			return (TROPICSSL_ERR_SSL_PEER_CLOSE_NOTIFY);
+		}
+	}
+
+	/*
+	 * What was read beyond this record waits behind it
+	 */
+	ssl->in_ahead = ssl->in_left - reclen;
+	ssl->in_ahead_off = reclen;
+	ssl->in_left = 0;
+
+	if (ret == SSL_GATHER_MORE)
+		goto next_record;
+
+	SSL_DEBUG_MSG(2, ("<= read record"));
+
+	return (0);
+}
+
+/*
+ * Handshake functions
+ */
+int ssl_write_certificate(ssl_context * ssl)
+{
+	int ret;
+	size_t i, n;
+	const x509_cert *crt;
+
+	SSL_DEBUG_MSG(2, ("=> write certificate"));
+
+	if (ssl->endpoint == SSL_IS_CLIENT) {
+		if (ssl->client_auth == 0) {
+			SSL_DEBUG_MSG(2, ("<= skip write certificate"));
+			ssl->state++;
+			return (0);
+		}
+
+		/*
+		 * If using SSLv3 and got no cert, send an Alert message
+		 * (otherwise an empty Certificate message will be sent).
+		 */
+		if (ssl->own_cert == NULL &&
+		    ssl->minor_ver == SSL_MINOR_VERSION_0) {
+			ssl->out_msglen = 2;
+			ssl->out_msgtype = SSL_MSG_ALERT;
+			ssl->out_msg[0] = SSL_ALERT_WARNING;
+			ssl->out_msg[1] = SSL_ALERT_NO_CERTIFICATE;
+
+			SSL_DEBUG_MSG(2, ("got no certificate to send"));
+			goto write_msg;
+		}
+	} else {		/* SSL_IS_SERVER */
+		if (ssl->own_cert == NULL) {
+			SSL_DEBUG_MSG(1, ("got no certificate to send"));
+			return (TROPICSSL_ERR_SSL_CERTIFICATE_REQUIRED);
+		}
+	}
+
+	SSL_DEBUG_CRT(3, "own certificate", ssl->own_cert);
+
+	/*
+	 * Encoded once by ssl_set_own_cert(), when memory allowed
+	 */
+	if (ssl->own_cert != NULL && ssl->own_cert->crt_msg != NULL) {
+		const uint8_t *msg = ssl->own_cert->crt_msg;
+
+		n = 4 + (((size_t)msg[1] << 16) | ((size_t)msg[2] << 8) |
+			 (size_t)msg[3]);
+		if (n > ssl->out_content_len) {
+			SSL_DEBUG_MSG(1, ("certificate too large, %d > %d",
+					  n, ssl->out_content_len));
+			return (TROPICSSL_ERR_SSL_CERTIFICATE_TOO_LARGE);
+		}
+
+		memcpy(ssl->out_msg, msg, n);
+
+		ssl->out_msglen = n;
+		ssl->out_msgtype = SSL_MSG_HANDSHAKE;
+		goto write_msg;
+	}
+
+	/*
+	 *     0  .  0    handshake type
+	 *     1  .  3    handshake length
+	 *     4  .  6    length of all certs
+	 *     7  .  9    length of cert. 1
+	 *    10  . n-1   peer certificate
+	 *     n  . n+2   length of cert. 2
+	 *    n+3 . ...   upper level cert, etc.
+	 */
+	i = 7;
+	crt = ssl->own_cert;
+
+	while (crt != NULL && crt->next != NULL) {
+		n = crt->raw.len;
+		if (i + 3 + n > ssl->out_content_len) {
+			SSL_DEBUG_MSG(1, ("certificate too large, %d > %d",
+					  i + 3 + n, ssl->out_content_len));
+			return (TROPICSSL_ERR_SSL_CERTIFICATE_TOO_LARGE);
+		}
+
+		ssl->out_msg[i] = (uint8_t)(n >> 16);
+		ssl->out_msg[i + 1] = (uint8_t)(n >> 8);
+		ssl->out_msg[i + 2] = (uint8_t)(n);
+
+		i += 3;
+		memcpy(ssl->out_msg + i, crt->raw.p, n);
+		i += n;
+		crt = crt->next;
+	}
+
+	ssl->out_msg[4] = (uint8_t)((i - 7) >> 16);
+	ssl->out_msg[5] = (uint8_t)((i - 7) >> 8);
+	ssl->out_msg[6] = (uint8_t)((i - 7));
+
+	ssl->out_msglen = i;
+	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
+	ssl->out_msg[0] = SSL_HS_CERTIFICATE;
+
+write_msg:
+
+	ssl->state++;
+
+	if ((ret = ssl_write_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_write_record", ret);
+		return (ret);
+	}
+
+	SSL_DEBUG_MSG(2, ("<= write certificate"));
+
+	return (0);
+}
+
+/*
+ * Parse the certificate_list of the Certificate message into a
+ * chain of the connection's own
+ */
+static int ssl_parse_crt_list(ssl_context * ssl)
+{
+	int ret;
+	size_t i, n;
+
+	if ((ssl->peer_cert = (x509_cert *) memory_alloc(sizeof(x509_cert))) == NULL) {
+		SSL_DEBUG_MSG(1, ("memory_alloc(%d bytes) failed",
+				  sizeof(x509_cert)));
+		return (1);
+	}
+
+	memset(ssl->peer_cert, 0, sizeof(x509_cert));
+
+	i = 7;
+
+	while (i < ssl->in_hslen) {
+		if (ssl->in_msg[i] != 0) {
+			SSL_DEBUG_MSG(1, ("bad certificate message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+		}
+
+		n = ((unsigned int)ssl->in_msg[i + 1] << 8)
+		    | (unsigned int)ssl->in_msg[i + 2];
+		i += 3;
+
+		if (n < 128 || i + n > ssl->in_hslen) {
+			SSL_DEBUG_MSG(1, ("bad certificate message"));
+			return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+		}
+
+		ret = x509parse_crt_lazy(ssl->peer_cert, ssl->in_msg + i, n);
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, " x509parse_crt_lazy", ret);
+			return (ret);
+		}
+
+		i += n;
+	}
+
+	return (0);
+}
+
+int ssl_parse_certificate(ssl_context * ssl)
+{
+	int ret;
+	size_t n;
+
+	SSL_DEBUG_MSG(2, ("=> parse certificate"));
+
+	if (ssl->endpoint == SSL_IS_SERVER && ssl->authmode == SSL_VERIFY_NONE) {
+		SSL_DEBUG_MSG(2, ("<= skip parse certificate"));
+		ssl->state++;
+		return (0);
+	}
+
+	if ((ret = ssl_read_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_read_record", ret);
+		return (ret);
+	}
+
+	ssl->state++;
+
+	/*
+	 * Check if the client sent an empty certificate
+	 */
+	if (ssl->endpoint == SSL_IS_SERVER &&
+	    ssl->minor_ver == SSL_MINOR_VERSION_0) {
+		if (ssl->in_msglen == 2 &&
+		    ssl->in_msgtype == SSL_MSG_ALERT &&
+		    ssl->in_msg[0] == SSL_ALERT_WARNING &&
+		    ssl->in_msg[1] == SSL_ALERT_NO_CERTIFICATE) {
+			SSL_DEBUG_MSG(1, ("SSLv3 client has no certificate"));
+
+			if (ssl->authmode == SSL_VERIFY_OPTIONAL)
+				return (0);
+			else
+				return
+				    (TROPICSSL_ERR_SSL_NO_CLIENT_CERTIFICATE);
+		}
+	}
+
+	if (ssl->endpoint == SSL_IS_SERVER &&
+	    ssl->minor_ver != SSL_MINOR_VERSION_0) {
+		if (ssl->in_hslen == 7 &&
+		    ssl->in_msgtype == SSL_MSG_HANDSHAKE &&
+		    ssl->in_msg[0] == SSL_HS_CERTIFICATE &&
+		    memcmp(ssl->in_msg + 4, "\0\0\0", 3) == 0) {
+			SSL_DEBUG_MSG(1, ("TLSv1 client has no certificate"));
+
+			if (ssl->authmode == SSL_VERIFY_REQUIRED)
+				return
+				    (TROPICSSL_ERR_SSL_NO_CLIENT_CERTIFICATE);
+			else
+				return (0);
+		}
+	}
+
+	if (ssl->in_msgtype != SSL_MSG_HANDSHAKE) {
+		SSL_DEBUG_MSG(1, ("bad certificate message"));
+		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+	}
+
+	if (ssl->in_msg[0] != SSL_HS_CERTIFICATE || ssl->in_hslen < 10) {
+		SSL_DEBUG_MSG(1, ("bad certificate message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+	}
+
+	/*
+	 * Same message structure as in ssl_write_certificate()
+	 */
+	n = ((size_t)ssl->in_msg[4] << 16) | ((size_t)ssl->in_msg[5] << 8) |
+	    (size_t)ssl->in_msg[6];
+
+	if (ssl->in_hslen != 7 + n) {
+		SSL_DEBUG_MSG(1, ("bad certificate message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+	}
+
+	/*
+	 * A chain gathered from several records was parsed as it came
+	 */
+	if (ssl->handshake != NULL && ssl->handshake->stream != 0 &&
+	    ssl->handshake->gather == SSL_GATHER_DONE) {
+		SSL_DEBUG_MSG(3, ("certificates parsed on the fly"));
+	} else
+#if defined(TROPICSSL_X509_CRT_CACHE)
+	if (ssl->crt_cache != NULL) {
+		ret = x509parse_crt_shared(ssl->crt_cache, &ssl->peer_cert,
+					   ssl->in_msg + 7, ssl->in_hslen - 7);
+		if (ret != 0) {
+			SSL_DEBUG_RET(1, "x509parse_crt_shared", ret);
+			return (ret);
+		}
+
+		ssl->peer_cache = ssl->crt_cache;
+	} else
+#endif
+	if ((ret = ssl_parse_crt_list(ssl)) != 0)
+		return (ret);
+
+	SSL_DEBUG_CRT(3, "peer certificate", ssl->peer_cert);
+
+	if (ssl->authmode != SSL_VERIFY_NONE) {
+		if (ssl->ca_chain == NULL) {
+			SSL_DEBUG_MSG(1, ("got no CA chain"));
+			return (TROPICSSL_ERR_SSL_CA_CHAIN_REQUIRED);
+		}
+
+		ret = x509parse_verify(ssl->peer_cert, ssl->ca_chain,
+				       ssl->peer_cn, &ssl->verify_result);
+
+		if (ret != 0)
+			SSL_DEBUG_RET(1, "x509_verify_cert", ret);
+
+		if (ssl->authmode != SSL_VERIFY_REQUIRED)
+			ret = 0;
+	}
+
+	SSL_DEBUG_MSG(2, ("<= parse certificate"));
+
+	return (ret);
+}
+
+int ssl_write_change_cipher_spec(ssl_context * ssl)
+{
+	int ret;
+
+	SSL_DEBUG_MSG(2, ("=> write change cipher spec"));
+
+	ssl->out_msgtype = SSL_MSG_CHANGE_CIPHER_SPEC;
+	ssl->out_msglen = 1;
+	ssl->out_msg[0] = 1;
+
+	ssl->out_crypt = 0;
+	ssl->state++;
+
+	if ((ret = ssl_write_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_write_record", ret);
+		return (ret);
+	}
+
+	SSL_DEBUG_MSG(2, ("<= write change cipher spec"));
+
+	return (0);
+}
+
+int ssl_parse_change_cipher_spec(ssl_context * ssl)
+{
+	int ret;
+
+	SSL_DEBUG_MSG(2, ("=> parse change cipher spec"));
+
+	ssl->in_crypt = 0;
+
+	if ((ret = ssl_read_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_read_record", ret);
+		return (ret);
+	}
+
+	if (ssl->in_msgtype != SSL_MSG_CHANGE_CIPHER_SPEC) {
+		SSL_DEBUG_MSG(1, ("bad change cipher spec message"));
+		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+	}
+
+	if (ssl->in_msglen != 1 || ssl->in_msg[0] != 1) {
+		SSL_DEBUG_MSG(1, ("bad change cipher spec message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_CHANGE_CIPHER_SPEC);
+	}
+
+	ssl->state++;
+
+	SSL_DEBUG_MSG(2, ("<= parse change cipher spec"));
+
+	return (0);
+}
+
+/*
+ * The Finished contents so far, from snapshots of the transcript
+ */
+static void ssl_calc_finished(ssl_context * ssl, uint8_t *buf, int from)
+{
+	int len = 12;
+	char *sender;
+	uint8_t padbuf[64];
+	uint8_t md5sum[16];
+	uint8_t sha1sum[20];
+	md5_context md5ctx, *md5 = &md5ctx;
+	sha1_context sha1ctx, *sha1 = &sha1ctx;
+	sha2_context sha2;
+	sha4_context sha4;
+	ssl_handshake_params *hs = ssl->handshake;
+
+	SSL_DEBUG_MSG(2, ("=> calc  finished"));
+
+	sender = (from == SSL_IS_CLIENT)
+	    ? (char *)"client finished" : (char *)"server finished";
+
+	/*
+	 * TLSv1.2:
+	 *   hash = PRF( master, finished_label, Hash( handshake ) )[0..11]
+	 */
+	if (ssl->minor_ver >= SSL_MINOR_VERSION_3) {
+		if (ssl_cipher_prf_hash(ssl->session->cipher) ==
+		    SSL_HASH_SHA384) {
+			ssl_transcript_sha4(&hs->transcript, &sha4);
+			sha4_finish(&sha4, padbuf);
+			tls12_prf(SSL_HASH_SHA384, ssl->session->master, 48,
+				  sender, padbuf, 48, buf, len);
+		} else {
+			ssl_transcript_sha2(&hs->transcript, &sha2);
+			sha2_finish(&sha2, padbuf);
+			tls12_prf(SSL_HASH_SHA256, ssl->session->master, 48,
+				  sender, padbuf, 32, buf, len);
+		}
+
+		SSL_DEBUG_BUF(3, "calc finished result", buf, len);
+
+		memset(&sha2, 0, sizeof(sha2));
+		memset(&sha4, 0, sizeof(sha4));
+		memset(padbuf, 0, sizeof(padbuf));
+
+		SSL_DEBUG_MSG(2, ("<= calc  finished"));
+
+		return;
+	}
+
+	ssl_transcript_md5(&hs->transcript, md5);
+	ssl_transcript_sha1(&hs->transcript, sha1);
+
+	/*
+	 * SSLv3:
+	 *   hash =
+	 *      MD5( master + pad2 +
+	 *          MD5( handshake + sender + master + pad1 ) )
+	 *   + SHA1( master + pad2 +
+	 *         SHA1( handshake + sender + master + pad1 ) )
+	 *
+	 * TLSv1:
+	 *   hash = PRF( master, finished_label,
+	 *               MD5( handshake ) + SHA1( handshake ) )[0..11]
+	 */
+
+	SSL_DEBUG_BUF(4, "finished  md5 state", (uint8_t *)
+		      md5->state, sizeof(md5->state));
+
+	SSL_DEBUG_BUF(4, "finished sha1 state", (uint8_t *)
+		      sha1->state, sizeof(sha1->state));
+
+	if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
+		sender = (from == SSL_IS_CLIENT) ? (char *)"CLNT"
+		    : (char *)"SRVR";
+
+		memset(padbuf, 0x36, 48);
+
+		md5_update(md5, (uint8_t *)sender, 4);
+		md5_update(md5, ssl->session->master, 48);
+		md5_update(md5, padbuf, 48);
+		md5_finish(md5, md5sum);
+
+		sha1_update(sha1, (uint8_t *)sender, 4);
+		sha1_update(sha1, ssl->session->master, 48);
+		sha1_update(sha1, padbuf, 40);
+		sha1_finish(sha1, sha1sum);
+
+		memset(padbuf, 0x5C, 48);
+
+		md5_starts(md5);
+		md5_update(md5, ssl->session->master, 48);
+		md5_update(md5, padbuf, 48);
+		md5_update(md5, md5sum, 16);
+		md5_finish(md5, buf);
+
+		sha1_starts(sha1);
+		sha1_update(sha1, ssl->session->master, 48);
+		sha1_update(sha1, padbuf, 40);
+		sha1_update(sha1, sha1sum, 20);
+		sha1_finish(sha1, buf + 16);
+
+		len += 24;
+	} else {
+		md5_finish(md5, padbuf);
+		sha1_finish(sha1, padbuf + 16);
+
+		tls1_prf(ssl->session->master, 48, sender,
+			 padbuf, 36, buf, len);
+	}
+
+	SSL_DEBUG_BUF(3, "calc finished result", buf, len);
+
+	memset(md5, 0, sizeof(md5_context));
+	memset(sha1, 0, sizeof(sha1_context));
+
+	memset(padbuf, 0, sizeof(padbuf));
+	memset(md5sum, 0, sizeof(md5sum));
+	memset(sha1sum, 0, sizeof(sha1sum));
+
+	SSL_DEBUG_MSG(2, ("<= calc  finished"));
+}
+
+int ssl_write_finished(ssl_context * ssl)
+{
+	int ret, hash_len;
+
+	SSL_DEBUG_MSG(2, ("=> write finished"));
+
+	ssl_calc_finished(ssl, ssl->out_msg + 4, ssl->endpoint);
+
+	hash_len = (ssl->minor_ver == SSL_MINOR_VERSION_0) ? 36 : 12;
+
+	ssl->out_msglen = 4 + hash_len;
+	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
+	ssl->out_msg[0] = SSL_HS_FINISHED;
+
+	/*
+	 * In case of session resuming, invert the client and server
+	 * ChangeCipherSpec messages order.
+	 */
+	if (ssl->resume != 0) {
+		if (ssl->endpoint == SSL_IS_CLIENT)
+			ssl->state = SSL_FLUSH_BUFFERS;
+		else
+			ssl->state = SSL_CLIENT_CHANGE_CIPHER_SPEC;
+	} else
+		ssl->state++;
+
+	ssl->out_crypt = 1;
+
+	if ((ret = ssl_write_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_write_record", ret);
+		return (ret);
+	}
+
+	SSL_DEBUG_MSG(2, ("<= write finished"));
+
+	return (0);
+}
+
+int ssl_parse_finished(ssl_context * ssl)
+{
+	int ret;
+	unsigned int hash_len;
+	uint8_t buf[36];
+
+	SSL_DEBUG_MSG(2, ("=> parse finished"));
+
+	/*
+	 * The peer's Finished covers the messages before it
+	 */
+	ssl_calc_finished(ssl, buf, ssl->endpoint ^ 1);
+
+	ssl->in_crypt = 1;
+
+	if ((ret = ssl_read_record(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_read_record", ret);
+		return (ret);
+	}
+
+	if (ssl->in_msgtype != SSL_MSG_HANDSHAKE) {
+		SSL_DEBUG_MSG(1, ("bad finished message"));
+		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+	}
+
+	hash_len = (ssl->minor_ver == SSL_MINOR_VERSION_0) ? 36 : 12;
+
+	if (ssl->in_msg[0] != SSL_HS_FINISHED || ssl->in_hslen != 4 + hash_len) {
+		SSL_DEBUG_MSG(1, ("bad finished message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_FINISHED);
+	}
+
+	if (memcmp(ssl->in_msg + 4, buf, hash_len) != 0) {
+		SSL_DEBUG_MSG(1, ("bad finished message"));
+		return (TROPICSSL_ERR_SSL_BAD_HS_FINISHED);
+	}
+
+	if (ssl->resume != 0) {
+		if (ssl->endpoint == SSL_IS_CLIENT)
+			ssl->state = SSL_CLIENT_CHANGE_CIPHER_SPEC;
+
+		if (ssl->endpoint == SSL_IS_SERVER)
+			ssl->state = SSL_HANDSHAKE_OVER;
+	} else
+		ssl->state++;
+
+	SSL_DEBUG_MSG(2, ("<= parse finished"));
+
+	return (0);
+}
+
+/*
+ * Record buffers: each context sizes its own, and may hand them to a
+ * shared pool between records. The first bytes of an idle buffer in
+ * the pool link it to the next one.
+ */
+static uint8_t *ssl_buf_get(ssl_context * ssl, size_t len, size_t *size)
+{
+	ssl_buffer_pool *pool = ssl->pool;
+	uint8_t *buf;
+
+	if (pool != NULL && pool->head != NULL && pool->len >= len) {
+		buf = pool->head;
+		memcpy(&pool->head, buf, sizeof(uint8_t *));
+		pool->count--;
+
+		*size = pool->len;
+		return (buf);
+	}
+
+	if ((buf = (uint8_t *)memory_alloc(len)) == NULL) {
+		SSL_DEBUG_MSG(1, ("memory_alloc(%d bytes) failed", len));
+		return (NULL);
+	}
+
+	*size = len;
+	return (buf);
+}
+
+static void ssl_buf_put(ssl_context * ssl, uint8_t *buf, size_t size)
+{
+	ssl_buffer_pool *pool = ssl->pool;
+
+	memset(buf, 0, size);
+
+	if (pool != NULL && size == pool->len && pool->count < pool->max) {
+		memcpy(buf, &pool->head, sizeof(uint8_t *));
+		pool->head = buf;
+		pool->count++;
+		return;
+	}
+
+	memory_free(buf);
+}
+
+/*
+ * Give an idle buffer (or none at all) the size wanted; the sequence
+ * number kept in its first 8 bytes moves along
+ */
+static int ssl_buf_fit(ssl_context * ssl, uint8_t **ctr, size_t *size,
+		       size_t len, uint8_t seq[8])
+{
+	uint8_t *buf;
+	size_t got;
+
+	if (*ctr != NULL) {
+		if (*size == len || (*size > len && ssl->pool != NULL))
+			return (0);
+
+		memcpy(seq, *ctr, 8);
+	}
+
+	if ((buf = ssl_buf_get(ssl, len, &got)) == NULL)
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+	memcpy(buf, seq, 8);
+
+	if (*ctr != NULL)
+		ssl_buf_put(ssl, *ctr, *size);
+
+	*ctr = buf;
+	*size = got;
+
+	return (0);
+}
+
+static void ssl_buf_release(ssl_context * ssl, uint8_t **ctr, size_t *size,
+			    uint8_t seq[8])
+{
+	memcpy(seq, *ctr, 8);
+	ssl_buf_put(ssl, *ctr, *size);
+
+	*ctr = NULL;
+	*size = 0;
+}
+
+/*
+ * Attach the record buffers at their configured size; directions
+ * with data pending keep theirs until they are idle
+ */
+static int ssl_buffers_get(ssl_context * ssl)
+{
+	int ret;
+
+	if (ssl->in_left == 0 && ssl->in_ahead == 0 && ssl->in_offt == NULL) {
+		ret = ssl_buf_fit(ssl, &ssl->in_ctr, &ssl->in_buf_len,
+				  ssl->in_content_len + SSL_BUFFER_OVERHEAD +
+				  ssl->in_ahead_len, ssl->in_seq);
+		if (ret != 0)
+			return (ret);
+
+		ssl->in_hdr = ssl->in_ctr + 8;
+		ssl->in_msg = ssl->in_ctr + 13;
+	}
+
+	if (ssl->out_left == 0 && ssl->out_ring_used == 0) {
+		ret = ssl_buf_fit(ssl, &ssl->out_ctr, &ssl->out_buf_len,
+				  ssl->out_content_len + SSL_BUFFER_OVERHEAD,
+				  ssl->out_seq);
+		if (ret != 0)
+			return (ret);
+
+		ssl->out_hdr = ssl->out_ctr + 8;
+		ssl->out_msg = ssl->out_ctr + 13;
+
+		/*
+		 * The ring is allocated again, to size, when needed
+		 */
+		if (ssl->out_ring != NULL &&
+		    ssl->out_ring_len != SSL_OUT_RING_RECORDS *
+		    (ssl->out_content_len + SSL_BUFFER_OVERHEAD)) {
+			memset(ssl->out_ring, 0, ssl->out_ring_len);
+			memory_free(ssl->out_ring);
+			ssl->out_ring = NULL;
+			ssl->out_ring_len = 0;
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * With a buffer pool, hand back the buffers that hold no data
+ */
+static void ssl_buffers_idle(ssl_context * ssl)
+{
+	if (ssl->pool == NULL || ssl->state != SSL_HANDSHAKE_OVER)
+		return;
+
+	if (ssl->in_ctr != NULL && ssl->in_left == 0 && ssl->in_ahead == 0 &&
+	    ssl->in_offt == NULL) {
+		ssl_buf_release(ssl, &ssl->in_ctr, &ssl->in_buf_len,
+				ssl->in_seq);
+		ssl->in_hdr = NULL;
+		ssl->in_msg = NULL;
+	}
+
+	if (ssl->out_ctr != NULL && ssl->out_left == 0 &&
+	    ssl->out_ring_used == 0) {
+		ssl_buf_release(ssl, &ssl->out_ctr, &ssl->out_buf_len,
+				ssl->out_seq);
+		ssl->out_hdr = NULL;
+		ssl->out_msg = NULL;
+
+		if (ssl->out_ring != NULL) {
+			memset(ssl->out_ring, 0, ssl->out_ring_len);
+			memory_free(ssl->out_ring);
+			ssl->out_ring = NULL;
+			ssl->out_ring_len = 0;
+		}
+	}
+}
+
+/*
+ * Initialize an SSL context
+ */
+int ssl_init(ssl_context * ssl)
+{
+	memset(ssl, 0, sizeof(ssl_context));
+
+	ssl->in_content_len = SSL_MAX_CONTENT_LEN;
+	ssl->out_content_len = SSL_MAX_CONTENT_LEN;
+	ssl->hs_max_len = SSL_MAX_HANDSHAKE_LEN;
+
+	ssl->handshake = (ssl_handshake_params *)
+	    memory_alloc(sizeof(ssl_handshake_params));
+
+	if (ssl->handshake == NULL)
+		return (1);
+
+	memset(ssl->handshake, 0, sizeof(ssl_handshake_params));
+
+	if (ssl_buffers_get(ssl) != 0) {
+		if (ssl->in_ctr != NULL)
+			memory_free(ssl->in_ctr);
+		memory_free(ssl->handshake);
+		ssl->handshake = NULL;
+		return (1);
+	}
+
+	ssl->hostname = NULL;
+	ssl->hostname_len = 0;
+
+#if defined(TROPICSSL_SSL_KTLS)
+	ssl->ktls_fd = -1;
+#endif
+
+	return (0);
+}
+
+/*
+ * SSL set accessors
+ */
+void ssl_set_endpoint(ssl_context * ssl, int endpoint)
+{
+	ssl->endpoint = endpoint;
+}
+
+void ssl_set_authmode(ssl_context * ssl, int authmode)
+{
+	ssl->authmode = authmode;
+}
+
+void ssl_set_rng(ssl_context * ssl,
+		 int (*f_rng) (void *, uint8_t *, size_t), void *p_rng)
+{
+	ssl->f_rng = f_rng;
+	ssl->p_rng = p_rng;
+}
+
+void ssl_set_dbg(ssl_context * ssl,
+		 void (*f_dbg) (void *, int, const char *), void *p_dbg)
+{
+	ssl->f_dbg = f_dbg;
+	ssl->p_dbg = p_dbg;
+}
+
+void ssl_set_bio(ssl_context * ssl,
+		 int (*f_recv) (void *, uint8_t *, size_t), void *p_recv,
+		 int (*f_send) (void *, uint8_t *, size_t), void *p_send)
+{
+	ssl->f_recv = f_recv;
+	ssl->f_send = f_send;
+	ssl->p_recv = p_recv;
+	ssl->p_send = p_send;
+}
+
+void ssl_set_sendv(ssl_context * ssl,
+		   int (*f_sendv) (void *, const net_iovec *, int))
+{
+	ssl->f_sendv = f_sendv;
+}
+
+#if defined(TROPICSSL_SSL_KTLS)
+void ssl_set_ktls(ssl_context * ssl, int fd)
+{
+	ssl->ktls_fd = fd;
+}
+
+int ssl_get_ktls(const ssl_context * ssl)
+{
+	return (ssl->ktls);
+}
+#endif
+
+void ssl_set_scb(ssl_context * ssl,
+		 int (*s_get) (ssl_context *), int (*s_set) (ssl_context *))
+{
+	ssl->s_get = s_get;
+	ssl->s_set = s_set;
+}
+
+void ssl_set_sni(ssl_context * ssl,
+		 int (*f_sni) (void *, ssl_context *, const uint8_t *, size_t),
+		 void *p_sni)
+{
+	ssl->f_sni = f_sni;
+	ssl->p_sni = p_sni;
+}
+
+void ssl_set_admission(ssl_context * ssl,
+		       int (*f_admit) (void *, ssl_context *, int),
+		       void *p_admit)
+{
+	ssl->f_admit = f_admit;
+	ssl->p_admit = p_admit;
+}
+
+void ssl_set_session_tickets(ssl_context * ssl, int use_tickets)
+{
+	ssl->use_tickets = use_tickets;
+}
 
-		if (ssl->maclen == 20)
-			ssl_mac_sha1(ssl->mac_enc,
-				     ssl->out_msg, ssl->out_msglen,
-				     ssl->out_ctr, ssl->out_msgtype);
-	} else {
-		if (ssl->maclen == 16)
-			md5_hmac(ssl->mac_enc, 16,
-				 ssl->out_ctr, ssl->out_msglen + 13,
-				 ssl->out_msg + ssl->out_msglen);
+void ssl_set_false_start(ssl_context * ssl, int enabled)
+{
+	ssl->false_start = enabled;
+}
 
-		if (ssl->maclen == 20)
-			sha1_hmac(ssl->mac_enc, 20,
-				  ssl->out_ctr, ssl->out_msglen + 13,
-				  ssl->out_msg + ssl->out_msglen);
-	}
+void ssl_set_ticket_cb(ssl_context * ssl,
+		       int (*f_ticket_write) (void *, ssl_context *,
+					      uint8_t *, size_t *, uint32_t *),
+		       int (*f_ticket_parse) (void *, ssl_context *,
+					      ssl_session *,
+					      const uint8_t *, size_t),
+		       void *p_ticket)
+{
+	ssl->f_ticket_write = f_ticket_write;
+	ssl->f_ticket_parse = f_ticket_parse;
+	ssl->p_ticket = p_ticket;
+}
 
-	SSL_DEBUG_BUF(4, "computed mac",
-		      ssl->out_msg + ssl->out_msglen, ssl->maclen);
+void ssl_set_session(ssl_context * ssl, int resume, int timeout,
+		     ssl_session * session)
+{
+	ssl->resume = resume;
+	ssl->timeout = timeout;
+	ssl->session = session;
+}
 
-	ssl->out_msglen += ssl->maclen;
+/*
+ * Session cache callbacks, as the handshake calls them
+ */
+int ssl_session_get(ssl_context * ssl)
+{
+	int ret;
 
-	for (i = 7; i >= 0; i--)
-		if (++ssl->out_ctr[i] != 0)
-			break;
+	if (ssl->s_get == NULL)
+		return (1);
 
-	if (ssl->ivlen == 0) {
-#if defined(TROPICSSL_ARC4)
-		padlen = 0;
+	TROPICSSL_TRACE1(cache_get_start, ssl);
+	ret = ssl->s_get(ssl);
+	TROPICSSL_TRACE2(cache_get_done, ssl, ret);
+
+	return (ret);
+}
+
+void ssl_session_set(ssl_context * ssl)
+{
+	int ret;
+
+	if (ssl->s_set == NULL)
+		return;
+
+	ret = ssl->s_set(ssl);
+	TROPICSSL_TRACE2(cache_set_done, ssl, ret);
+	((void)ret);
+}
+
+void ssl_set_ciphers(ssl_context * ssl, int *ciphers)
+{
+	ssl->ciphers = ciphers;
+}
+
+void ssl_set_prioritize_chacha(ssl_context * ssl, int enabled)
+{
+	ssl->chacha_prio = enabled;
+}
 
-		SSL_DEBUG_MSG(3, ("before encrypt: msglen = %d, "
-				  "including %d bytes of padding",
-				  ssl->out_msglen, 0));
+int ssl_set_compression(ssl_context * ssl, int level)
+{
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+	if (level < 0 || level > 9)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
 
-		SSL_DEBUG_BUF(4, "before encrypt: output payload",
-			      ssl->out_msg, ssl->out_msglen);
+	ssl->compress_level = level;
 
-		arc4_crypt((arc4_context *) ssl->ctx_enc,
-			   ssl->out_msg, ssl->out_msglen);
+	return (0);
 #else
-		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+	(void)ssl;
+
+	return ((level == 0) ? 0 : TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
 #endif
-	} else {
-		padlen = ssl->ivlen - (ssl->out_msglen + 1) % ssl->ivlen;
-		if (padlen == ssl->ivlen)
-			padlen = 0;
+}
+
+/*
+ * Publish a message encoded for a chain that threads may share:
+ * the first one to get there wins, the others drop their copy
+ */
+static void ssl_publish_encoded(uint8_t **slot, uint8_t *p)
+{
+#if defined(WIN32)
+	if (InterlockedCompareExchangePointer((PVOID *) slot, p, NULL) != NULL)
+#else
+	if (!__sync_bool_compare_and_swap(slot, NULL, p))
+#endif
+		memory_free(p);
+}
+
+/*
+ * The Certificate message of a chain, handshake header included
+ */
+static uint8_t *ssl_encode_certificate(const x509_cert * chain)
+{
+	size_t n, len = 0;
+	uint8_t *msg, *p;
+	const x509_cert *crt;
+
+	for (crt = chain; crt != NULL && crt->next != NULL; crt = crt->next)
+		len += 3 + crt->raw.len;
 
-		for (i = 0; i <= padlen; i++)
-			ssl->out_msg[ssl->out_msglen + i] =
-			    (uint8_t)padlen;
+	if (len > 0xFFFFFF - 3 ||
+	    (msg = (uint8_t *)memory_alloc(7 + len)) == NULL)
+		return (NULL);
 
-		ssl->out_msglen += padlen + 1;
+	msg[0] = SSL_HS_CERTIFICATE;
+	msg[1] = (uint8_t)((len + 3) >> 16);
+	msg[2] = (uint8_t)((len + 3) >> 8);
+	msg[3] = (uint8_t)((len + 3));
+	msg[4] = (uint8_t)(len >> 16);
+	msg[5] = (uint8_t)(len >> 8);
+	msg[6] = (uint8_t)(len);
+	p = msg + 7;
 
-		SSL_DEBUG_MSG(3, ("before encrypt: msglen = %d, "
-				  "including %d bytes of padding",
-				  ssl->out_msglen, padlen + 1));
+	for (crt = chain; crt->next != NULL; crt = crt->next) {
+		n = crt->raw.len;
+		*p++ = (uint8_t)(n >> 16);
+		*p++ = (uint8_t)(n >> 8);
+		*p++ = (uint8_t)(n);
+		memcpy(p, crt->raw.p, n);
+		p += n;
+	}
 
-		SSL_DEBUG_BUF(4, "before encrypt: output payload",
-			      ssl->out_msg, ssl->out_msglen);
+	return (msg);
+}
 
-		switch (ssl->ivlen) {
-		case 8:
-#if defined(TROPICSSL_DES)
-			des3_crypt_cbc((des3_context *) ssl->ctx_enc,
-				       DES_ENCRYPT, ssl->out_msglen,
-				       ssl->iv_enc, ssl->out_msg, ssl->out_msg);
+/*
+ * The DN list of a CertificateRequest, its 2-byte length included;
+ * it stops past about 4 KB (with buf NULL, only measure it)
+ */
+size_t ssl_encode_dn_list(const x509_cert * ca_chain, uint8_t *buf)
+{
+	size_t n, len = 0;
+	const x509_cert *crt;
+
+	for (crt = ca_chain; crt != NULL && crt->next != NULL;
+	     crt = crt->next) {
+		if (len > 4096 - 12)
 			break;
+
+		n = crt->subject_raw.len;
+
+		if (buf != NULL) {
+			buf[2 + len] = (uint8_t)(n >> 8);
+			buf[3 + len] = (uint8_t)(n);
+			memcpy(buf + 4 + len, crt->subject_raw.p, n);
+		}
+
+		len += 2 + n;
+	}
+
+	if (buf != NULL) {
+		buf[0] = (uint8_t)(len >> 8);
+		buf[1] = (uint8_t)(len);
+	}
+
+	return (2 + len);
+}
+
+void ssl_set_ca_chain(ssl_context * ssl, x509_cert * ca_chain, const char *peer_cn)
+{
+	uint8_t *p;
+
+	ssl->ca_chain = ca_chain;
+	ssl->peer_cn = peer_cn;
+
+	if (ca_chain == NULL || ca_chain->dn_list != NULL)
+		return;
+
+	if ((p = (uint8_t *)memory_alloc(ssl_encode_dn_list(ca_chain,
+							    NULL))) == NULL)
+		return;
+
+	ssl_encode_dn_list(ca_chain, p);
+	ssl_publish_encoded(&ca_chain->dn_list, p);
+}
+
+#if defined(TROPICSSL_X509_CRT_CACHE)
+void ssl_set_crt_cache(ssl_context * ssl, x509_crt_cache * cache)
+{
+	ssl->crt_cache = cache;
+}
 #endif
 
-		case 16:
-#if defined(TROPICSSL_AES)
-			if (ssl->session->cipher == TLS_RSA_WITH_AES_128_CBC_SHA ||
-			    ssl->session->cipher == TLS_RSA_WITH_AES_256_CBC_SHA ||
-			    ssl->session->cipher == TLS_DHE_RSA_WITH_AES_256_CBC_SHA) {
-				aes_crypt_cbc((aes_context *) ssl->ctx_enc,
-					      AES_ENCRYPT, ssl->out_msglen,
-					      ssl->iv_enc, ssl->out_msg,
-					      ssl->out_msg);
-				break;
-			}
+void ssl_set_own_cert(ssl_context * ssl, x509_cert * own_cert,
+		      rsa_context * rsa_key)
+{
+	uint8_t *p;
+
+	ssl->own_cert = own_cert;
+	ssl->rsa_key = rsa_key;
+
+	if (own_cert != NULL && own_cert->crt_msg == NULL &&
+	    (p = ssl_encode_certificate(own_cert)) != NULL)
+		ssl_publish_encoded(&own_cert->crt_msg, p);
+}
+
+/*
+ * Keys from x509parse_key() come without an RNG, which rsa_private()
+ * needs to blind with: lend them the context's for the operation
+ * only, so that the key never points into a context
+ */
+static int ssl_lend_rng(ssl_context * ssl)
+{
+	if (ssl->rsa_key->f_rng != NULL)
+		return (0);
+
+	ssl->rsa_key->f_rng = ssl->f_rng;
+	ssl->rsa_key->p_rng = ssl->p_rng;
+
+	return (1);
+}
+
+static void ssl_return_rng(ssl_context * ssl, int lent)
+{
+	if (lent != 0) {
+		ssl->rsa_key->f_rng = NULL;
+		ssl->rsa_key->p_rng = NULL;
+	}
+}
+
+int ssl_rsa_sign(ssl_context * ssl, unsigned int hashlen,
+		 const uint8_t *hash, uint8_t *sig)
+{
+	int ret, lent = ssl_lend_rng(ssl);
+
+	ret = rsa_pkcs1_sign(ssl->rsa_key, RSA_PRIVATE, RSA_RAW,
+			     hashlen, hash, sig);
+
+	ssl_return_rng(ssl, lent);
+
+	return (ret);
+}
+
+int ssl_rsa_decrypt(ssl_context * ssl, size_t *olen, const uint8_t *input,
+		    uint8_t *output, size_t output_max_len)
+{
+	int ret, lent = ssl_lend_rng(ssl);
+
+	ret = rsa_pkcs1_decrypt(ssl->rsa_key, RSA_PRIVATE, olen,
+				input, output, output_max_len);
+
+	ssl_return_rng(ssl, lent);
+
+	return (ret);
+}
+
+void ssl_set_async_key(ssl_context * ssl,
+		       int (*f_start) (void *, ssl_context *, int,
+				       const uint8_t *, size_t),
+		       int (*f_resume) (void *, ssl_context *,
+					uint8_t *, size_t *, size_t),
+		       void *p_async)
+{
+	ssl->f_async_start = f_start;
+	ssl->f_async_resume = f_resume;
+	ssl->p_async = p_async;
+}
+
+int ssl_set_dh_param(ssl_context * ssl, const char *dhm_P, const char *dhm_G)
+{
+	int ret;
+	ssl_handshake_params *hs = ssl->handshake;
+
+	if (hs == NULL)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	if ((ret = mpi_read_string(&hs->dhm_ctx.P, 16, dhm_P)) != 0) {
+		SSL_DEBUG_RET(1, "mpi_read_string", ret);
+		return (ret);
+	}
+
+	if ((ret = mpi_read_string(&hs->dhm_ctx.G, 16, dhm_G)) != 0) {
+		SSL_DEBUG_RET(1, "mpi_read_string", ret);
+		return (ret);
+	}
+
+	return (0);
+}
+
+void ssl_set_dh_shared(ssl_context * ssl, dhm_shared * S)
+{
+	ssl->dhm_sh = S;
+}
+
+int ssl_set_hostname(ssl_context * ssl, const char *hostname)
+{
+	if (hostname == NULL)
+		return (TROPICSSL_ERR_BAD_ARG);
+
+	ssl->hostname_len = strlen(hostname);
+	ssl->hostname = (uint8_t *)memory_alloc(ssl->hostname_len + 1);
+
+	if (ssl->hostname == NULL)
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+	memcpy(ssl->hostname, (uint8_t *)hostname, ssl->hostname_len);
+	ssl->hostname[ssl->hostname_len] = '\0';
+
+	return (0);
+}
+
+void ssl_set_max_frag_len(ssl_context * ssl, int mfl_code)
+{
+	ssl->mfl_code = mfl_code;
+}
+
+int ssl_set_buffer_len(ssl_context * ssl, size_t in_len, size_t out_len)
+{
+	if (in_len < SSL_MIN_CONTENT_LEN || in_len > SSL_MAX_CONTENT_LEN ||
+	    out_len < SSL_MIN_CONTENT_LEN || out_len > SSL_MAX_CONTENT_LEN)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	/*
+	 * A pending record may need the full size of its buffer
+	 */
+	if (ssl->in_left != 0 || ssl->in_ahead != 0 || ssl->in_offt != NULL ||
+	    ssl->out_left != 0 || ssl->out_ring_used != 0)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	ssl->in_content_len = in_len;
+	ssl->out_content_len = out_len;
+
+	return (ssl_buffers_get(ssl));
+}
+
+void ssl_set_handshake_max_len(ssl_context * ssl, size_t len)
+{
+	ssl->hs_max_len = len;
+}
+
+void ssl_set_record_sizing(ssl_context * ssl, size_t small_len,
+			   size_t ramp_len, int idle_ms)
+{
+	ssl->drs_small_len = small_len;
+	ssl->drs_ramp_len = ramp_len;
+	ssl->drs_idle_ms = idle_ms;
+	ssl->drs_sent = 0;
+}
+
+int ssl_set_read_ahead(ssl_context * ssl, size_t len)
+{
+	if (ssl->in_left != 0 || ssl->in_ahead != 0 || ssl->in_offt != NULL)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	ssl->in_ahead_len = len;
+
+	return (ssl_buffers_get(ssl));
+}
+
+int ssl_check_pending(const ssl_context * ssl)
+{
+	return (ssl->in_offt != NULL || ssl->in_ahead != 0);
+}
+
+void ssl_set_buffer_pool(ssl_context * ssl, ssl_buffer_pool * pool)
+{
+	ssl->pool = pool;
+}
+
+/*
+ * Buffer pool
+ */
+void ssl_pool_init(ssl_buffer_pool * pool, size_t len, int max)
+{
+	memset(pool, 0, sizeof(ssl_buffer_pool));
+
+	pool->len = len + SSL_BUFFER_OVERHEAD;
+	pool->max = max;
+}
+
+void ssl_pool_free(ssl_buffer_pool * pool)
+{
+	uint8_t *buf;
+
+	while ((buf = pool->head) != NULL) {
+		memcpy(&pool->head, buf, sizeof(uint8_t *));
+		memory_free(buf);
+	}
+
+	memset(pool, 0, sizeof(ssl_buffer_pool));
+}
+
+/*
+ * SSL get accessors
+ */
+size_t ssl_get_bytes_avail(const ssl_context * ssl)
+{
+	return (ssl->in_offt == NULL ? 0 : ssl->in_msglen);
+}
+
+int ssl_get_verify_result(const ssl_context * ssl)
+{
+	return (ssl->verify_result);
+}
+
+const char *ssl_get_cipher(const ssl_context * ssl)
+{
+	return (ssl_get_cipher_name(ssl->session->cipher));
+}
+
+const char *ssl_get_cipher_name(int cipher)
+{
+	switch (cipher) {
+#if defined(TROPICSSL_ARC4)
+	case TLS_RSA_WITH_RC4_128_MD5:
+		return ("TLS_RSA_WITH_RC4_128_MD5");
+
+	case TLS_RSA_WITH_RC4_128_SHA:
+		return ("TLS_RSA_WITH_RC4_128_SHA");
 #endif
 
-#if defined(TROPICSSL_CAMELLIA)
-			if (ssl->session->cipher == TLS_RSA_WITH_CAMELLIA_128_CBC_SHA ||
-			    ssl->session->cipher == TLS_RSA_WITH_CAMELLIA_256_CBC_SHA ||
-			    ssl->session->cipher ==
-			    TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA) {
-				camellia_crypt_cbc((camellia_context *)
-						   ssl->ctx_enc,
-						   CAMELLIA_ENCRYPT,
-						   ssl->out_msglen, ssl->iv_enc,
-						   ssl->out_msg, ssl->out_msg);
-				break;
-			}
+#if defined(TROPICSSL_DES)
+	case TLS_RSA_WITH_3DES_EDE_CBC_SHA:
+		return ("TLS_RSA_WITH_3DES_EDE_CBC_SHA");
+
+	case TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA:
+		return ("TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA");
+
+	case TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA:
+		return ("TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA");
 #endif
 
-		default:
-			return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
-		}
-	}
+#if defined(TROPICSSL_AES)
+	case TLS_RSA_WITH_AES_128_CBC_SHA:
+		return ("TLS_RSA_WITH_AES_128_CBC_SHA");
+
+	case TLS_RSA_WITH_AES_256_CBC_SHA:
+		return ("TLS_RSA_WITH_AES_256_CBC_SHA");
 
-	SSL_DEBUG_MSG(2, ("<= encrypt buf"));
+	case TLS_DHE_RSA_WITH_AES_256_CBC_SHA:
+		return ("TLS_DHE_RSA_WITH_AES_256_CBC_SHA");
 
-	return (0);
-}
+	case TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA:
+		return ("TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA");
 
-static int ssl_decrypt_buf(ssl_context * ssl)
-{
-	size_t i, padlen;
-	uint8_t tmp[20];
+	case TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA:
+		return ("TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA");
 
-	SSL_DEBUG_MSG(2, ("=> decrypt buf"));
+	case TLS_RSA_WITH_AES_128_CBC_SHA256:
+		return ("TLS_RSA_WITH_AES_128_CBC_SHA256");
 
-	if (ssl->in_msglen < ssl->minlen) {
-		SSL_DEBUG_MSG(1, ("in_msglen (%d) < minlen (%d)",
-				  ssl->in_msglen, ssl->minlen));
-		return (TROPICSSL_ERR_SSL_INVALID_MAC);
-	}
+	case TLS_RSA_WITH_AES_256_CBC_SHA256:
+		return ("TLS_RSA_WITH_AES_256_CBC_SHA256");
 
-	if (ssl->ivlen == 0) {
-#if defined(TROPICSSL_ARC4)
-		padlen = 0;
-		arc4_crypt((arc4_context *) ssl->ctx_dec,
-			   ssl->in_msg, ssl->in_msglen);
-#else
-		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
-#endif
-	} else {
-		/*
-		 * Decrypt and check the padding
-		 */
-		if (ssl->in_msglen % ssl->ivlen != 0) {
-			SSL_DEBUG_MSG(1, ("msglen (%d) %% ivlen (%d) != 0",
-					  ssl->in_msglen, ssl->ivlen));
-			return (TROPICSSL_ERR_SSL_INVALID_MAC);
-		}
+	case TLS_DHE_RSA_WITH_AES_128_CBC_SHA256:
+		return ("TLS_DHE_RSA_WITH_AES_128_CBC_SHA256");
 
-		switch (ssl->ivlen) {
-#if defined(TROPICSSL_DES)
-		case 8:
-			des3_crypt_cbc((des3_context *) ssl->ctx_dec,
-				       DES_DECRYPT, ssl->in_msglen,
-				       ssl->iv_dec, ssl->in_msg, ssl->in_msg);
-			break;
-#endif
+	case TLS_DHE_RSA_WITH_AES_256_CBC_SHA256:
+		return ("TLS_DHE_RSA_WITH_AES_256_CBC_SHA256");
 
-		case 16:
-#if defined(TROPICSSL_AES)
-			if (ssl->session->cipher == TLS_RSA_WITH_AES_128_CBC_SHA ||
-			    ssl->session->cipher == TLS_RSA_WITH_AES_256_CBC_SHA ||
-			    ssl->session->cipher == TLS_DHE_RSA_WITH_AES_256_CBC_SHA) {
-				aes_crypt_cbc((aes_context *) ssl->ctx_dec,
-					      AES_DECRYPT, ssl->in_msglen,
-					      ssl->iv_dec, ssl->in_msg,
-					      ssl->in_msg);
-				break;
-			}
+	case TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256:
+		return ("TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256");
 #endif
 
 #if defined(TROPICSSL_CAMELLIA)
-			if (ssl->session->cipher == TLS_RSA_WITH_CAMELLIA_128_CBC_SHA ||
-			    ssl->session->cipher == TLS_RSA_WITH_CAMELLIA_256_CBC_SHA ||
-			    ssl->session->cipher ==
-			    TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA) {
-				camellia_crypt_cbc((camellia_context *)
-						   ssl->ctx_dec,
-						   CAMELLIA_DECRYPT,
-						   ssl->in_msglen, ssl->iv_dec,
-						   ssl->in_msg, ssl->in_msg);
-				break;
-			}
+	case TLS_RSA_WITH_CAMELLIA_128_CBC_SHA:
+		return ("TLS_RSA_WITH_CAMELLIA_128_CBC_SHA");
+
+	case TLS_RSA_WITH_CAMELLIA_256_CBC_SHA:
+		return ("TLS_RSA_WITH_CAMELLIA_256_CBC_SHA");
+
+	case TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA:
+		return ("TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA");
 #endif
 
-		default:
-			return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
-		}
+#if defined(TROPICSSL_GCM)
+	case TLS_RSA_WITH_AES_128_GCM_SHA256:
+		return ("TLS_RSA_WITH_AES_128_GCM_SHA256");
 
-		padlen = 1 + ssl->in_msg[ssl->in_msglen - 1];
+	case TLS_RSA_WITH_AES_256_GCM_SHA384:
+		return ("TLS_RSA_WITH_AES_256_GCM_SHA384");
 
-		if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
-			if (padlen > ssl->ivlen) {
-				SSL_DEBUG_MSG(1, ("bad padding length: is %d, "
-						  "should be no more than %d",
-						  padlen, ssl->ivlen));
-				padlen = 0;
-			}
-		} else {
-			/*
-			 * TLSv1: always check the padding
-			 */
-			for (i = 1; i <= padlen; i++) {
-				if (ssl->in_msg[ssl->in_msglen - i] !=
-				    padlen - 1) {
-					SSL_DEBUG_MSG(1,
-						      ("bad padding byte: should be "
-						       "%02x, but is %02x",
-						       padlen - 1,
-						       ssl->
-						       in_msg[ssl->in_msglen -
-							      i]));
-					padlen = 0;
-				}
-			}
-		}
-	}
+	case TLS_DHE_RSA_WITH_AES_128_GCM_SHA256:
+		return ("TLS_DHE_RSA_WITH_AES_128_GCM_SHA256");
 
-	SSL_DEBUG_BUF(4, "raw buffer after decryption",
-		      ssl->in_msg, ssl->in_msglen);
+	case TLS_DHE_RSA_WITH_AES_256_GCM_SHA384:
+		return ("TLS_DHE_RSA_WITH_AES_256_GCM_SHA384");
 
-	/*
-	 * Always compute the MAC (RFC4346, CBCTIME).
-	 */
-	ssl->in_msglen -= (ssl->maclen + padlen);
+	case TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256:
+		return ("TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256");
 
-	ssl->in_hdr[3] = (uint8_t)(ssl->in_msglen >> 8);
-	ssl->in_hdr[4] = (uint8_t)(ssl->in_msglen);
+	case TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384:
+		return ("TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384");
+#endif
 
-	memcpy(tmp, ssl->in_msg + ssl->in_msglen, 20);
+#if defined(TROPICSSL_CHACHAPOLY)
+	case TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256:
+		return ("TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256");
 
-	if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
-		if (ssl->maclen == 16)
-			ssl_mac_md5(ssl->mac_dec,
-				    ssl->in_msg, ssl->in_msglen,
-				    ssl->in_ctr, ssl->in_msgtype);
-		else
-			ssl_mac_sha1(ssl->mac_dec,
-				     ssl->in_msg, ssl->in_msglen,
-				     ssl->in_ctr, ssl->in_msgtype);
-	} else {
-		if (ssl->maclen == 16)
-			md5_hmac(ssl->mac_dec, 16,
-				 ssl->in_ctr, ssl->in_msglen + 13,
-				 ssl->in_msg + ssl->in_msglen);
-		else
-			sha1_hmac(ssl->mac_dec, 20,
-				  ssl->in_ctr, ssl->in_msglen + 13,
-				  ssl->in_msg + ssl->in_msglen);
+	case TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256:
+		return ("TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256");
+#endif
+
+	default:
+		break;
 	}
 
-	SSL_DEBUG_BUF(4, "message  mac", tmp, ssl->maclen);
-	SSL_DEBUG_BUF(4, "computed mac", ssl->in_msg + ssl->in_msglen,
-		      ssl->maclen);
+	return ("unknown");
+}
 
-	if (memcmp(tmp, ssl->in_msg + ssl->in_msglen, ssl->maclen) != 0) {
-		SSL_DEBUG_MSG(1, ("message mac does not match"));
-		return (TROPICSSL_ERR_SSL_INVALID_MAC);
-	}
+int ssl_default_ciphers[] = {
+#if defined(TROPICSSL_ECP)
+#if defined(TROPICSSL_GCM)
+	TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+	TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+#endif
+#if defined(TROPICSSL_CHACHAPOLY)
+	TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+#endif
+#if defined(TROPICSSL_AES)
+	TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256,
+	TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA,
+	TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA,
+#endif
+#if defined(TROPICSSL_DES)
+	TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA,
+#endif
+#endif
 
-	/*
-	 * Finally check the padding length; bad padding
-	 * will produce the same error as an invalid MAC.
-	 */
-	if (ssl->ivlen != 0 && padlen == 0)
-		return (TROPICSSL_ERR_SSL_INVALID_MAC);
+#if defined(TROPICSSL_DHM)
+#if defined(TROPICSSL_GCM)
+	TLS_DHE_RSA_WITH_AES_256_GCM_SHA384,
+	TLS_DHE_RSA_WITH_AES_128_GCM_SHA256,
+#endif
+#if defined(TROPICSSL_CHACHAPOLY)
+	TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+#endif
+#if defined(TROPICSSL_AES)
+	TLS_DHE_RSA_WITH_AES_256_CBC_SHA256,
+	TLS_DHE_RSA_WITH_AES_128_CBC_SHA256,
+	TLS_DHE_RSA_WITH_AES_256_CBC_SHA,
+#endif
+#if defined(TROPICSSL_CAMELLIA)
+	TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA,
+#endif
+#if defined(TROPICSSL_DES)
+	TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA,
+#endif
+#endif
 
-	if (ssl->in_msglen == 0) {
-		ssl->nb_zero++;
+#if defined(TROPICSSL_GCM)
+	TLS_RSA_WITH_AES_256_GCM_SHA384,
+	TLS_RSA_WITH_AES_128_GCM_SHA256,
+#endif
+#if defined(TROPICSSL_AES)
+	TLS_RSA_WITH_AES_128_CBC_SHA256,
+	TLS_RSA_WITH_AES_256_CBC_SHA256,
+	TLS_RSA_WITH_AES_128_CBC_SHA,
+	TLS_RSA_WITH_AES_256_CBC_SHA,
+#endif
+#if defined(TROPICSSL_CAMELLIA)
+	TLS_RSA_WITH_CAMELLIA_128_CBC_SHA,
+	TLS_RSA_WITH_CAMELLIA_256_CBC_SHA,
+#endif
+#if defined(TROPICSSL_DES)
+	TLS_RSA_WITH_3DES_EDE_CBC_SHA,
+#endif
+#if defined(TROPICSSL_ARC4)
+	TLS_RSA_WITH_RC4_128_SHA,
+	TLS_RSA_WITH_RC4_128_MD5,
+#endif
+	0
+};
 
-		/*
-		 * Three or more empty messages may be a DoS attack
-		 * (excessive CPU consumption).
-		 */
-		if (ssl->nb_zero > 3) {
-			SSL_DEBUG_MSG(1, ("received four consecutive empty "
-					  "messages, possible DoS attack"));
-			return (TROPICSSL_ERR_SSL_INVALID_MAC);
-		}
-	} else
-		ssl->nb_zero = 0;
+/*
+ * Perform the SSL handshake
+ */
+/*
+ * The handshake is over: records of either direction are now limited
+ * to the agreed max_fragment_length, and the buffers shrink to match
+ */
+static int ssl_apply_max_frag_len(ssl_context * ssl)
+{
+	size_t len = (size_t)256 << ssl->mfl_nego;
 
-	for (i = 7; i >= 0; i--)
-		if (++ssl->in_ctr[i] != 0)
-			break;
+	if (ssl->in_content_len > len)
+		ssl->in_content_len = len;
 
-	SSL_DEBUG_MSG(2, ("<= decrypt buf"));
+	if (ssl->out_content_len > len)
+		ssl->out_content_len = len;
 
-	return (0);
+	return (ssl_buffers_get(ssl));
 }
 
 /*
- * Fill the input message buffer
+ * Release the key exchange state and the transcript: the records
+ * from now on only need the cipher state
  */
-int ssl_fetch_input(ssl_context * ssl, size_t nb_want)
+static void ssl_handshake_free(ssl_context * ssl)
 {
-	int ret;
-	size_t len;
-
-	SSL_DEBUG_MSG(2, ("=> fetch input"));
-
-	while (ssl->in_left < nb_want) {
-		len = nb_want - ssl->in_left;
-		ret = ssl->f_recv(ssl->p_recv, ssl->in_hdr + ssl->in_left, len);
-
-		SSL_DEBUG_MSG(2, ("in_left: %d, nb_want: %d",
-				  ssl->in_left, nb_want));
-		SSL_DEBUG_RET(2, "ssl->f_recv", ret);
+	ssl_handshake_params *hs = ssl->handshake;
 
-		if (ret < 0)
-			return (ret);
+	if (hs == NULL)
+		return;
 
-		ssl->in_left += ret;
-	}
+#if defined(TROPICSSL_DHM)
+	dhm_free(&hs->dhm_ctx);
+#if defined(TROPICSSL_ECP)
+	ecdh_free(&hs->ecdh_ctx);
+#endif
+#endif
 
-	SSL_DEBUG_MSG(2, ("<= fetch input"));
+	ssl_transcript_free(&hs->transcript);
+	ssl_gather_free(ssl);
 
-	return (0);
+	memset(hs, 0, sizeof(ssl_handshake_params));
+	memory_free(hs);
+	ssl->handshake = NULL;
 }
 
-/*
- * Flush any data not yet written
- */
-int ssl_flush_output(ssl_context * ssl)
+int ssl_handshake(ssl_context * ssl)
 {
-	int ret;
-	uint8_t *buf;
+	int ret = TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE;
 
-	SSL_DEBUG_MSG(2, ("=> flush output"));
+	SSL_DEBUG_MSG(2, ("=> handshake"));
 
-	while (ssl->out_left > 0) {
-		SSL_DEBUG_MSG(2, ("message length: %d, out_left: %d",
-				  5 + ssl->out_msglen, ssl->out_left));
+#if defined(TROPICSSL_SSL_CLI_C)
+	if (ssl->endpoint == SSL_IS_CLIENT)
+		ret = ssl_handshake_client(ssl);
+#endif
 
-		buf = ssl->out_hdr + 5 + ssl->out_msglen - ssl->out_left;
-		ret = ssl->f_send(ssl->p_send, buf, ssl->out_left);
-		SSL_DEBUG_RET(2, "ssl->f_send", ret);
+#if defined(TROPICSSL_SSL_SRV_C)
+	if (ssl->endpoint == SSL_IS_SERVER)
+		ret = ssl_handshake_server(ssl);
+#endif
 
-		if (ret <= 0)
-			return (ret);
+	if (ret == 0 && ssl->mfl_nego != SSL_MAX_FRAG_LEN_NONE)
+		ret = ssl_apply_max_frag_len(ssl);
 
-		ssl->out_left -= ret;
-	}
+	/*
+	 * After a False Start the handshake is finished by ssl_read()
+	 */
+	if (ret == 0 && ssl->state == SSL_HANDSHAKE_OVER)
+		ssl_handshake_free(ssl);
 
-	SSL_DEBUG_MSG(2, ("<= flush output"));
+#if defined(TROPICSSL_SSL_KTLS)
+	if (ret == 0 && ssl->state == SSL_HANDSHAKE_OVER)
+		ssl_ktls_start(ssl);
+#endif
 
-	return (0);
+	SSL_DEBUG_MSG(2, ("<= handshake"));
+
+	return (ret);
 }
 
 /*
- * Record layer functions
+ * Make sure some decrypted application data is pending at in_offt
  */
-int ssl_write_record(ssl_context * ssl)
+static int ssl_read_fill(ssl_context * ssl)
 {
 	int ret;
-	size_t len = ssl->out_msglen;
 
-	SSL_DEBUG_MSG(2, ("=> write record"));
+	if (ssl->state != SSL_HANDSHAKE_OVER) {
+		if ((ret = ssl_handshake(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_handshake", ret);
+			return (ret);
+		}
+	}
 
-	ssl->out_hdr[0] = (uint8_t)ssl->out_msgtype;
-	ssl->out_hdr[1] = (uint8_t)ssl->major_ver;
-	ssl->out_hdr[2] = (uint8_t)ssl->minor_ver;
-	ssl->out_hdr[3] = (uint8_t)(len >> 8);
-	ssl->out_hdr[4] = (uint8_t)(len);
+	if (ssl->in_offt == NULL) {
+		if (ssl->in_ctr == NULL && (ret = ssl_buffers_get(ssl)) != 0)
+			return (ret);
 
-	if (ssl->out_msgtype == SSL_MSG_HANDSHAKE) {
-		ssl->out_msg[1] = (uint8_t)((len - 4) >> 16);
-		ssl->out_msg[2] = (uint8_t)((len - 4) >> 8);
-		ssl->out_msg[3] = (uint8_t)((len - 4));
+#if defined(TROPICSSL_SSL_KTLS)
+		if ((ssl->ktls & SSL_KTLS_RX) != 0) {
+			ret = ssl_ktls_recv(ssl, ssl->in_msg,
+					    ssl->in_content_len);
+			if (ret < 0)
+				return (ret);
 
-		md5_update(&ssl->fin_md5, ssl->out_msg, len);
-		sha1_update(&ssl->fin_sha1, ssl->out_msg, len);
-	}
+			ssl->in_msgtype = SSL_MSG_APPLICATION_DATA;
+			ssl->in_msglen = ret;
+			ssl->in_offt = ssl->in_msg;
 
-	if (ssl->do_crypt != 0) {
-		if ((ret = ssl_encrypt_buf(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_encrypt_buf", ret);
+			return (0);
+		}
+#endif
+
+		if ((ret = ssl_read_record(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_read_record", ret);
 			return (ret);
 		}
 
-		len = ssl->out_msglen;
-		ssl->out_hdr[3] = (uint8_t)(len >> 8);
-		ssl->out_hdr[4] = (uint8_t)(len);
+		if (ssl->in_msglen == 0 &&
+		    ssl->in_msgtype == SSL_MSG_APPLICATION_DATA) {
+			/*
+			 * OpenSSL sends empty messages to randomize the IV
+			 */
+			if ((ret = ssl_read_record(ssl)) != 0) {
+				SSL_DEBUG_RET(1, "ssl_read_record", ret);
+				return (ret);
+			}
+		}
+
+		if (ssl->in_msgtype != SSL_MSG_APPLICATION_DATA) {
+			SSL_DEBUG_MSG(1, ("bad application data message"));
+			return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+		}
+
+		ssl->in_offt = ssl->in_msg;
 	}
 
-	ssl->out_left = 5 + ssl->out_msglen;
+	return (0);
+}
+
+/*
+ * Receive application data decrypted from the SSL layer
+ */
+int ssl_read(ssl_context * ssl, uint8_t *buf, size_t len)
+{
+	int ret;
+	size_t n;
 
-	SSL_DEBUG_MSG(3, ("output record: msgtype = %d, "
-			  "version = [%d:%d], msglen = %d",
-			  ssl->out_hdr[0], ssl->out_hdr[1], ssl->out_hdr[2],
-			  (ssl->out_hdr[3] << 8) | ssl->out_hdr[4]));
+	SSL_DEBUG_MSG(2, ("=> read"));
 
-	SSL_DEBUG_BUF(4, "output record sent to network",
-		      ssl->out_hdr, 5 + ssl->out_msglen);
+#if defined(TROPICSSL_SSL_KTLS)
+	/*
+	 * Nothing to copy: the kernel decrypts straight into buf
+	 */
+	if ((ssl->ktls & SSL_KTLS_RX) != 0 && ssl->in_offt == NULL &&
+	    len >= 2)
+		return (ssl_ktls_recv(ssl, buf, len));
+#endif
 
-	if ((ret = ssl_flush_output(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+	if ((ret = ssl_read_fill(ssl)) != 0)
 		return (ret);
-	}
 
-	SSL_DEBUG_MSG(2, ("<= write record"));
+	n = (len < ssl->in_msglen)
+	    ? len : ssl->in_msglen;
 
-	return (0);
+	memcpy(buf, ssl->in_offt, n);
+	ssl_read_release(ssl, n);
+
+	SSL_DEBUG_MSG(2, ("<= read"));
+
+	return (n);
 }
 
-int ssl_read_record(ssl_context * ssl)
+/*
+ * Hand out the decrypted application data, in place
+ */
+int ssl_read_view(ssl_context * ssl, const uint8_t **buf, size_t *len)
 {
 	int ret;
 
-	SSL_DEBUG_MSG(2, ("=> read record"));
-
-	if (ssl->in_hslen != 0 && ssl->in_hslen < ssl->in_msglen) {
-		/*
-		 * Get next Handshake message in the current record
-		 */
-		ssl->in_msglen -= ssl->in_hslen;
-
-		memcpy(ssl->in_msg, ssl->in_msg + ssl->in_hslen,
-		       ssl->in_msglen);
+	SSL_DEBUG_MSG(2, ("=> read view"));
 
-		ssl->in_hslen = 4;
-		ssl->in_hslen += (ssl->in_msg[2] << 8) | ssl->in_msg[3];
+	if ((ret = ssl_read_fill(ssl)) != 0)
+		return (ret);
 
-		SSL_DEBUG_MSG(3, ("handshake message: msglen ="
-				  " %d, type = %d, hslen = %d",
-				  ssl->in_msglen, ssl->in_msg[0],
-				  ssl->in_hslen));
+	*buf = ssl->in_offt;
+	*len = ssl->in_msglen;
 
-		if (ssl->in_msglen < 4 || ssl->in_msg[1] != 0) {
-			SSL_DEBUG_MSG(1, ("bad handshake length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
+	SSL_DEBUG_MSG(2, ("<= read view"));
 
-		if (ssl->in_msglen < ssl->in_hslen) {
-			SSL_DEBUG_MSG(1, ("bad handshake length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
+	return (0);
+}
 
-		md5_update(&ssl->fin_md5, ssl->in_msg, ssl->in_hslen);
-		sha1_update(&ssl->fin_sha1, ssl->in_msg, ssl->in_hslen);
+/*
+ * Consume data handed out by ssl_read_view()
+ */
+void ssl_read_release(ssl_context * ssl, size_t len)
+{
+	if (ssl->in_offt == NULL)
+		return;
 
-		return (0);
-	}
+	if (len > ssl->in_msglen)
+		len = ssl->in_msglen;
 
-	ssl->in_hslen = 0;
+	ssl->in_msglen -= len;
 
-	/*
-	 * Read the record header and validate it
-	 */
-	if ((ret = ssl_fetch_input(ssl, 5)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_fetch_input", ret);
-		return (ret);
-	}
+	if (ssl->in_msglen == 0) {
+		/* all bytes consumed  */
+		ssl->in_offt = NULL;
+		ssl_buffers_idle(ssl);
+	} else
+		/* more data available */
+		ssl->in_offt += len;
+}
 
-	ssl->in_msgtype = ssl->in_hdr[0];
-	ssl->in_msglen = (ssl->in_hdr[3] << 8) | ssl->in_hdr[4];
+/*
+ * Whether application records go to the output ring; an offloaded
+ * socket has the kernel do the framing instead
+ */
+static int ssl_corked(const ssl_context * ssl)
+{
+#if defined(TROPICSSL_SSL_KTLS)
+	if ((ssl->ktls & SSL_KTLS_TX) != 0)
+		return (0);
+#endif
 
-	SSL_DEBUG_MSG(3, ("input record: msgtype = %d, "
-			  "version = [%d:%d], msglen = %d",
-			  ssl->in_hdr[0], ssl->in_hdr[1], ssl->in_hdr[2],
-			  (ssl->in_hdr[3] << 8) | ssl->in_hdr[4]));
+	return (ssl->out_cork != 0);
+}
 
-	if (ssl->in_hdr[1] != ssl->major_ver) {
-		SSL_DEBUG_MSG(1, ("major version mismatch"));
-		return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-	}
+/*
+ * Plaintext length of the next application data record: small ones
+ * until drs_ramp_len bytes are out, and again after an idle period.
+ * Idleness is only checked with nothing pending, so that a write
+ * retried after TROPICSSL_ERR_NET_WANT_WRITE sees the same length.
+ */
+static size_t ssl_record_len(ssl_context * ssl)
+{
+	if (ssl->drs_small_len == 0 ||
+	    ssl->drs_small_len >= ssl->out_content_len)
+		return (ssl->out_content_len);
+
+#if defined(TROPICSSL_TIMING)
+	if (ssl->out_left == 0 && ssl->out_ring_used == 0 &&
+	    get_timer(&ssl->drs_timer, 1) > (unsigned long)ssl->drs_idle_ms &&
+	    ssl->drs_idle_ms > 0)
+		ssl->drs_sent = 0;
+#endif
 
-	if (ssl->in_hdr[2] != SSL_MINOR_VERSION_0 &&
-	    ssl->in_hdr[2] != SSL_MINOR_VERSION_1) {
-		SSL_DEBUG_MSG(1, ("minor version mismatch"));
-		return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-	}
+	return ((ssl->drs_sent < ssl->drs_ramp_len)
+		? ssl->drs_small_len : ssl->out_content_len);
+}
 
-	/*
-	 * Make sure the message length is acceptable
-	 */
-	if (ssl->do_crypt == 0) {
-		if (ssl->in_msglen < 1 || ssl->in_msglen > SSL_MAX_CONTENT_LEN) {
-			SSL_DEBUG_MSG(1, ("bad message length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
-	} else {
-		if (ssl->in_msglen < ssl->minlen) {
-			SSL_DEBUG_MSG(1, ("bad message length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
+/*
+ * Account for n bytes of application data accepted
+ */
+static void ssl_record_sent(ssl_context * ssl, size_t n)
+{
+	if (ssl->drs_sent < ssl->drs_ramp_len)
+		ssl->drs_sent += n;
+}
 
-		if (ssl->minor_ver == SSL_MINOR_VERSION_0 &&
-		    ssl->in_msglen > ssl->minlen + SSL_MAX_CONTENT_LEN) {
-			SSL_DEBUG_MSG(1, ("bad message length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
+/*
+ * Finish the handshake before writing, unless a False Start lets
+ * application data go ahead of the server's Finished
+ */
+static int ssl_write_handshake(ssl_context * ssl)
+{
+	int ret;
 
-		/*
-		 * TLS encrypted messages can have up to 256 bytes of padding
-		 */
-		if (ssl->minor_ver == SSL_MINOR_VERSION_1 &&
-		    ssl->in_msglen > ssl->minlen + SSL_MAX_CONTENT_LEN + 256) {
-			SSL_DEBUG_MSG(1, ("bad message length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
-	}
+	if (ssl->state == SSL_HANDSHAKE_OVER || ssl->false_started != 0)
+		return (0);
 
-	/*
-	 * Read and optionally decrypt the message contents
-	 */
-	if ((ret = ssl_fetch_input(ssl, 5 + ssl->in_msglen)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_fetch_input", ret);
+	if ((ret = ssl_handshake(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_handshake", ret);
 		return (ret);
 	}
 
-	SSL_DEBUG_BUF(4, "input record from network",
-		      ssl->in_hdr, 5 + ssl->in_msglen);
-
-	if (ssl->do_crypt != 0) {
-		if ((ret = ssl_decrypt_buf(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_decrypt_buf", ret);
-			return (ret);
-		}
+	return (0);
+}
 
-		SSL_DEBUG_BUF(4, "input payload after decrypt",
-			      ssl->in_msg, ssl->in_msglen);
+/*
+ * Lend the plaintext area of the output record to the caller
+ */
+int ssl_write_reserve(ssl_context * ssl, uint8_t **buf, size_t *len)
+{
+	int ret;
 
-		if (ssl->in_msglen > SSL_MAX_CONTENT_LEN) {
-			SSL_DEBUG_MSG(1, ("bad message length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
-	}
+	SSL_DEBUG_MSG(2, ("=> write reserve"));
 
-	if (ssl->in_msgtype == SSL_MSG_HANDSHAKE) {
-		ssl->in_hslen = 4;
-		ssl->in_hslen += (ssl->in_msg[2] << 8) | ssl->in_msg[3];
+	if ((ret = ssl_write_handshake(ssl)) != 0)
+		return (ret);
 
-		SSL_DEBUG_MSG(3, ("handshake message: msglen ="
-				  " %d, type = %d, hslen = %d",
-				  ssl->in_msglen, ssl->in_msg[0],
-				  ssl->in_hslen));
+	if (ssl->out_ctr == NULL && (ret = ssl_buffers_get(ssl)) != 0)
+		return (ret);
 
+	if (ssl_corked(ssl) != 0) {
 		/*
-		 * Additional checks to validate the handshake header
+		 * Lend the next free ring slot, flushing a full ring first
 		 */
-		if (ssl->in_msglen < 4 || ssl->in_msg[1] != 0) {
-			SSL_DEBUG_MSG(1, ("bad handshake length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
-		}
+		if ((ret = ssl_ring_alloc(ssl)) != 0)
+			return (ret);
 
-		if (ssl->in_msglen < ssl->in_hslen) {
-			SSL_DEBUG_MSG(1, ("bad handshake length"));
-			return (TROPICSSL_ERR_SSL_INVALID_RECORD);
+		if (ssl->out_left != 0 || ssl_ring_next(ssl) == NULL) {
+			if ((ret = ssl_flush_output(ssl)) != 0) {
+				SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+				return (ret);
+			}
 		}
 
-		md5_update(&ssl->fin_md5, ssl->in_msg, ssl->in_hslen);
-		sha1_update(&ssl->fin_sha1, ssl->in_msg, ssl->in_hslen);
-	}
+		*buf = ssl_ring_next(ssl);
+		*len = ssl_record_len(ssl);
 
-	if (ssl->in_msgtype == SSL_MSG_ALERT) {
-		SSL_DEBUG_MSG(2, ("got an alert message, type: [%d:%d]",
-				  ssl->in_msg[0], ssl->in_msg[1]));
+		SSL_DEBUG_MSG(2, ("<= write reserve"));
 
-		/*
-		 * Ignore non-fatal alerts, except close_notify
-		 */
-		if (ssl->in_msg[0] == SSL_ALERT_FATAL) {
-			SSL_DEBUG_MSG(1, ("is a fatal alert message"));
-			return (TROPICSSL_ERR_SSL_FATAL_ALERT_MESSAGE |
-				ssl->in_msg[1]);
-		}
+		return (0);
+	}
 
-		if (ssl->in_msg[0] == SSL_ALERT_WARNING &&
-		    ssl->in_msg[1] == SSL_ALERT_CLOSE_NOTIFY) {
-			SSL_DEBUG_MSG(2, ("is a close notify message"));
-			return (TROPICSSL_ERR_SSL_PEER_CLOSE_NOTIFY);
+	/*
+	 * The previous record must be gone before out_msg is reused
+	 */
+	if (ssl->out_left != 0 || ssl->out_ring_used != 0) {
+		if ((ret = ssl_flush_output(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+			return (ret);
 		}
 	}
 
-	ssl->in_left = 0;
+	*buf = ssl->out_msg;
+	*len = ssl_record_len(ssl);
 
-	SSL_DEBUG_MSG(2, ("<= read record"));
+	SSL_DEBUG_MSG(2, ("<= write reserve"));
 
 	return (0);
 }
 
 /*
- * Handshake functions
+ * Encrypt and send the data the caller placed in out_msg
  */
-int ssl_write_certificate(ssl_context * ssl)
+int ssl_write_commit(ssl_context * ssl, size_t len)
 {
 	int ret;
-	size_t i, n;
-	const x509_cert *crt;
-
-	SSL_DEBUG_MSG(2, ("=> write certificate"));
 
-	if (ssl->endpoint == SSL_IS_CLIENT) {
-		if (ssl->client_auth == 0) {
-			SSL_DEBUG_MSG(2, ("<= skip write certificate"));
-			ssl->state++;
-			return (0);
-		}
+	SSL_DEBUG_MSG(2, ("=> write commit"));
 
-		/*
-		 * If using SSLv3 and got no cert, send an Alert message
-		 * (otherwise an empty Certificate message will be sent).
-		 */
-		if (ssl->own_cert == NULL &&
-		    ssl->minor_ver == SSL_MINOR_VERSION_0) {
-			ssl->out_msglen = 2;
-			ssl->out_msgtype = SSL_MSG_ALERT;
-			ssl->out_msg[0] = SSL_ALERT_WARNING;
-			ssl->out_msg[1] = SSL_ALERT_NO_CERTIFICATE;
+	if (len > ssl->out_content_len || ssl->out_ctr == NULL)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
 
-			SSL_DEBUG_MSG(2, ("got no certificate to send"));
-			goto write_msg;
-		}
-	} else {		/* SSL_IS_SERVER */
-		if (ssl->own_cert == NULL) {
-			SSL_DEBUG_MSG(1, ("got no certificate to send"));
-			return (TROPICSSL_ERR_SSL_CERTIFICATE_REQUIRED);
+	if (ssl_corked(ssl) != 0) {
+		if ((ret = ssl_queue_record(ssl, len)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_queue_record", ret);
+			return (ret);
 		}
-	}
 
-	SSL_DEBUG_CRT(3, "own certificate", ssl->own_cert);
+		ssl_record_sent(ssl, len);
 
-	/*
-	 *     0  .  0    handshake type
-	 *     1  .  3    handshake length
-	 *     4  .  6    length of all certs
-	 *     7  .  9    length of cert. 1
-	 *    10  . n-1   peer certificate
-	 *     n  . n+2   length of cert. 2
-	 *    n+3 . ...   upper level cert, etc.
-	 */
-	i = 7;
-	crt = ssl->own_cert;
+		/*
+		 * The data is accepted once queued; a full ring that
+		 * cannot go out yet is flushed by the next reserve
+		 */
+		if (ssl_ring_next(ssl) == NULL) {
+			ret = ssl_flush_output(ssl);
 
-	while (crt != NULL && crt->next != NULL) {
-		n = crt->raw.len;
-		if (i + 3 + n > SSL_MAX_CONTENT_LEN) {
-			SSL_DEBUG_MSG(1, ("certificate too large, %d > %d",
-					  i + 3 + n, SSL_MAX_CONTENT_LEN));
-			return (TROPICSSL_ERR_SSL_CERTIFICATE_TOO_LARGE);
+			if (ret != 0 && ret != TROPICSSL_ERR_NET_WANT_WRITE) {
+				SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+				return (ret);
+			}
 		}
 
-		ssl->out_msg[i] = (uint8_t)(n >> 16);
-		ssl->out_msg[i + 1] = (uint8_t)(n >> 8);
-		ssl->out_msg[i + 2] = (uint8_t)(n);
+		SSL_DEBUG_MSG(2, ("<= write commit"));
 
-		i += 3;
-		memcpy(ssl->out_msg + i, crt->raw.p, n);
-		i += n;
-		crt = crt->next;
+		return ((int)len);
 	}
 
-	ssl->out_msg[4] = (uint8_t)((i - 7) >> 16);
-	ssl->out_msg[5] = (uint8_t)((i - 7) >> 8);
-	ssl->out_msg[6] = (uint8_t)((i - 7));
-
-	ssl->out_msglen = i;
-	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
-	ssl->out_msg[0] = SSL_HS_CERTIFICATE;
-
-write_msg:
-
-	ssl->state++;
+	if (ssl->out_left != 0) {
+		/*
+		 * Retry after TROPICSSL_ERR_NET_WANT_WRITE: the record was
+		 * already encrypted, only the rest needs sending
+		 */
+		if ((ret = ssl_flush_output(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+			return (ret);
+		}
+	} else {
+		ssl->out_msglen = len;
+		ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
 
-	if ((ret = ssl_write_record(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_write_record", ret);
-		return (ret);
+		if ((ret = ssl_write_record(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_write_record", ret);
+			return (ret);
+		}
 	}
 
-	SSL_DEBUG_MSG(2, ("<= write certificate"));
+	ssl_record_sent(ssl, len);
+	ssl_buffers_idle(ssl);
 
-	return (0);
+	SSL_DEBUG_MSG(2, ("<= write commit"));
+
+	return ((int)len);
 }
 
-int ssl_parse_certificate(ssl_context * ssl)
+/*
+ * Send application data to be encrypted by the SSL layer
+ */
+int ssl_write(ssl_context * ssl, const uint8_t *buf, size_t len)
 {
 	int ret;
-	size_t i, n;
-
-	SSL_DEBUG_MSG(2, ("=> parse certificate"));
+	size_t n, avail;
+	uint8_t *p;
 
-	if (ssl->endpoint == SSL_IS_SERVER && ssl->authmode == SSL_VERIFY_NONE) {
-		SSL_DEBUG_MSG(2, ("<= skip parse certificate"));
-		ssl->state++;
-		return (0);
-	}
+	SSL_DEBUG_MSG(2, ("=> write"));
 
-	if ((ret = ssl_read_record(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_read_record", ret);
+	if ((ret = ssl_write_handshake(ssl)) != 0)
 		return (ret);
-	}
-
-	ssl->state++;
 
+#if defined(TROPICSSL_SSL_KTLS)
 	/*
-	 * Check if the client sent an empty certificate
+	 * Nothing to copy: the kernel encrypts straight from buf, once
+	 * what was committed earlier is out
 	 */
-	if (ssl->endpoint == SSL_IS_SERVER &&
-	    ssl->minor_ver == SSL_MINOR_VERSION_0) {
-		if (ssl->in_msglen == 2 &&
-		    ssl->in_msgtype == SSL_MSG_ALERT &&
-		    ssl->in_msg[0] == SSL_ALERT_WARNING &&
-		    ssl->in_msg[1] == SSL_ALERT_NO_CERTIFICATE) {
-			SSL_DEBUG_MSG(1, ("SSLv3 client has no certificate"));
-
-			if (ssl->authmode == SSL_VERIFY_OPTIONAL)
-				return (0);
-			else
-				return
-				    (TROPICSSL_ERR_SSL_NO_CLIENT_CERTIFICATE);
-		}
-	}
+	if ((ssl->ktls & SSL_KTLS_TX) != 0) {
+		if ((ret = ssl_flush_output(ssl)) != 0)
+			return (ret);
 
-	if (ssl->endpoint == SSL_IS_SERVER &&
-	    ssl->minor_ver != SSL_MINOR_VERSION_0) {
-		if (ssl->in_hslen == 7 &&
-		    ssl->in_msgtype == SSL_MSG_HANDSHAKE &&
-		    ssl->in_msg[0] == SSL_HS_CERTIFICATE &&
-		    memcmp(ssl->in_msg + 4, "\0\0\0", 3) == 0) {
-			SSL_DEBUG_MSG(1, ("TLSv1 client has no certificate"));
+		ret = ssl_ktls_send(ssl, SSL_MSG_APPLICATION_DATA, buf, len);
 
-			if (ssl->authmode == SSL_VERIFY_REQUIRED)
-				return
-				    (TROPICSSL_ERR_SSL_NO_CLIENT_CERTIFICATE);
-			else
-				return (0);
-		}
+		return ((ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			? TROPICSSL_ERR_NET_WANT_WRITE : ret);
 	}
+#endif
 
-	if (ssl->in_msgtype != SSL_MSG_HANDSHAKE) {
-		SSL_DEBUG_MSG(1, ("bad certificate message"));
-		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
-	}
+	n = ssl_record_len(ssl);
+	if (len < n)
+		n = len;
 
-	if (ssl->in_msg[0] != SSL_HS_CERTIFICATE || ssl->in_hslen < 10) {
-		SSL_DEBUG_MSG(1, ("bad certificate message"));
-		return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
-	}
+	if (ssl->out_left == 0 || ssl_corked(ssl) != 0) {
+		if ((ret = ssl_write_reserve(ssl, &p, &avail)) != 0)
+			return (ret);
 
-	/*
-	 * Same message structure as in ssl_write_certificate()
-	 */
-	n = (ssl->in_msg[5] << 8) | ssl->in_msg[6];
+		if (n > avail)
+			n = avail;
 
-	if (ssl->in_msg[4] != 0 || ssl->in_hslen != 7 + n) {
-		SSL_DEBUG_MSG(1, ("bad certificate message"));
-		return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
+		memcpy(p, buf, n);
 	}
 
-	if ((ssl->peer_cert = (x509_cert *) malloc(sizeof(x509_cert))) == NULL) {
-		SSL_DEBUG_MSG(1, ("malloc(%d bytes) failed",
-				  sizeof(x509_cert)));
-		return (1);
-	}
+	ret = ssl_write_commit(ssl, n);
 
-	memset(ssl->peer_cert, 0, sizeof(x509_cert));
+	SSL_DEBUG_MSG(2, ("<= write"));
 
-	i = 7;
+	return (ret);
+}
 
-	while (i < ssl->in_hslen) {
-		if (ssl->in_msg[i] != 0) {
-			SSL_DEBUG_MSG(1, ("bad certificate message"));
-			return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
-		}
+/*
+ * Gather application data into full records, queue them in the
+ * output ring and flush them together
+ */
+int ssl_writev(ssl_context * ssl, const net_iovec * iov, int iovcnt)
+{
+	int ret, i;
+	size_t n, len, off, max, total;
+	uint8_t *msg;
 
-		n = ((unsigned int)ssl->in_msg[i + 1] << 8)
-		    | (unsigned int)ssl->in_msg[i + 2];
-		i += 3;
+	SSL_DEBUG_MSG(2, ("=> writev"));
 
-		if (n < 128 || i + n > ssl->in_hslen) {
-			SSL_DEBUG_MSG(1, ("bad certificate message"));
-			return (TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE);
-		}
+	if ((ret = ssl_write_handshake(ssl)) != 0)
+		return (ret);
 
-		ret = x509parse_crt(ssl->peer_cert, ssl->in_msg + i, n);
-		if (ret != 0) {
-			SSL_DEBUG_RET(1, " x509parse_crt", ret);
+#if defined(TROPICSSL_SSL_KTLS)
+	if ((ssl->ktls & SSL_KTLS_TX) != 0) {
+		if ((ret = ssl_flush_output(ssl)) != 0)
 			return (ret);
-		}
-
-		i += n;
-	}
-
-	SSL_DEBUG_CRT(3, "peer certificate", ssl->peer_cert);
 
-	if (ssl->authmode != SSL_VERIFY_NONE) {
-		if (ssl->ca_chain == NULL) {
-			SSL_DEBUG_MSG(1, ("got no CA chain"));
-			return (TROPICSSL_ERR_SSL_CA_CHAIN_REQUIRED);
-		}
+		ret = net_sendv(&ssl->ktls_fd, iov, iovcnt);
+		SSL_DEBUG_RET(2, "kernel TLS sendv", ret);
 
-		ret = x509parse_verify(ssl->peer_cert, ssl->ca_chain,
-				       ssl->peer_cn, &ssl->verify_result);
+		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			return (TROPICSSL_ERR_NET_WANT_WRITE);
 
-		if (ret != 0)
-			SSL_DEBUG_RET(1, "x509_verify_cert", ret);
+		if (ret > 0)
+			SSL_STATS_ADD(ssl, bytes_out, ret);
 
-		if (ssl->authmode != SSL_VERIFY_REQUIRED)
-			ret = 0;
+		return (ret);
 	}
+#endif
 
-	SSL_DEBUG_MSG(2, ("<= parse certificate"));
+	if (ssl->out_ring_data != 0) {
+		/*
+		 * Retry after TROPICSSL_ERR_NET_WANT_WRITE: the records
+		 * are already encrypted, only the rest needs sending
+		 */
+		if ((ret = ssl_flush_output(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+			return (ret);
+		}
 
-	return (ret);
-}
+		total = ssl->out_ring_data;
+		ssl->out_ring_data = 0;
 
-int ssl_write_change_cipher_spec(ssl_context * ssl)
-{
-	int ret;
+		ssl_buffers_idle(ssl);
 
-	SSL_DEBUG_MSG(2, ("=> write change cipher spec"));
+		return ((int)total);
+	}
 
-	ssl->out_msgtype = SSL_MSG_CHANGE_CIPHER_SPEC;
-	ssl->out_msglen = 1;
-	ssl->out_msg[0] = 1;
+	/*
+	 * Anything queued or pending goes first
+	 */
+	if ((ret = ssl_flush_output(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+		return (ret);
+	}
 
-	ssl->do_crypt = 0;
-	ssl->state++;
+	if ((ret = ssl_buffers_get(ssl)) != 0)
+		return (ret);
 
-	if ((ret = ssl_write_record(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_write_record", ret);
+	if ((ret = ssl_ring_alloc(ssl)) != 0)
 		return (ret);
-	}
 
-	SSL_DEBUG_MSG(2, ("<= write change cipher spec"));
+	total = 0;
+	off = 0;
+	i = 0;
+	ret = 0;
 
-	return (0);
-}
+	while (i < iovcnt && (msg = ssl_ring_next(ssl)) != NULL) {
+		max = ssl_record_len(ssl);
 
-int ssl_parse_change_cipher_spec(ssl_context * ssl)
-{
-	int ret;
+		for (n = 0; i < iovcnt && n < max; n += len) {
+			len = iov[i].len - off;
+			if (len > max - n)
+				len = max - n;
 
-	SSL_DEBUG_MSG(2, ("=> parse change cipher spec"));
+			memcpy(msg + n, iov[i].base + off, len);
+			off += len;
 
-	ssl->do_crypt = 0;
+			if (off == iov[i].len) {
+				off = 0;
+				i++;
+			}
+		}
 
-	if ((ret = ssl_read_record(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_read_record", ret);
-		return (ret);
-	}
+		if (n == 0)
+			break;
 
-	if (ssl->in_msgtype != SSL_MSG_CHANGE_CIPHER_SPEC) {
-		SSL_DEBUG_MSG(1, ("bad change cipher spec message"));
-		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
+		if ((ret = ssl_queue_record(ssl, n)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_queue_record", ret);
+			return (ret);
+		}
+
+		ssl_record_sent(ssl, n);
+		total += n;
 	}
 
-	if (ssl->in_msglen != 1 || ssl->in_msg[0] != 1) {
-		SSL_DEBUG_MSG(1, ("bad change cipher spec message"));
-		return (TROPICSSL_ERR_SSL_BAD_HS_CHANGE_CIPHER_SPEC);
+	if ((ret = ssl_flush_output(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+		ssl->out_ring_data = total;
+		return (ret);
 	}
 
-	ssl->state++;
+	ssl_buffers_idle(ssl);
 
-	SSL_DEBUG_MSG(2, ("<= parse change cipher spec"));
+	SSL_DEBUG_MSG(2, ("<= writev"));
 
-	return (0);
+	return ((int)total);
 }
 
-static void ssl_calc_finished(ssl_context * ssl, uint8_t *buf, int from,
-			      md5_context * md5, sha1_context * sha1)
+/*
+ * Read file data for ssl_sendfile()
+ */
+static int ssl_file_read(int fd, uint8_t *buf, size_t len, uint64_t offset)
 {
-	int len = 12;
-	char *sender;
-	uint8_t padbuf[48];
-	uint8_t md5sum[16];
-	uint8_t sha1sum[20];
+#if defined(WIN32)
+	if (_lseeki64(fd, (__int64)offset, SEEK_SET) < 0)
+		return (-1);
 
-	SSL_DEBUG_MSG(2, ("=> calc  finished"));
+	return (_read(fd, buf, (unsigned int)len));
+#else
+	return ((int)pread(fd, buf, len, (off_t)offset));
+#endif
+}
 
-	/*
-	 * SSLv3:
-	 *   hash =
-	 *      MD5( master + pad2 +
-	 *          MD5( handshake + sender + master + pad1 ) )
-	 *   + SHA1( master + pad2 +
-	 *         SHA1( handshake + sender + master + pad1 ) )
-	 *
-	 * TLSv1:
-	 *   hash = PRF( master, finished_label,
-	 *               MD5( handshake ) + SHA1( handshake ) )[0..11]
-	 */
+/*
+ * Send file data: each record is read straight into its slot of the
+ * output ring, encrypted in place, and the ring flushed at once. An
+ * offloaded socket leaves it all to the kernel's sendfile().
+ */
+int ssl_sendfile(ssl_context * ssl, int fd, uint64_t offset, size_t len)
+{
+	int ret;
+	size_t n, max, total;
+	uint8_t *msg;
 
-	SSL_DEBUG_BUF(4, "finished  md5 state", (uint8_t *)
-		      md5->state, sizeof(md5->state));
+	SSL_DEBUG_MSG(2, ("=> sendfile"));
 
-	SSL_DEBUG_BUF(4, "finished sha1 state", (uint8_t *)
-		      sha1->state, sizeof(sha1->state));
+	if ((ret = ssl_write_handshake(ssl)) != 0)
+		return (ret);
 
-	if (ssl->minor_ver == SSL_MINOR_VERSION_0) {
-		sender = (from == SSL_IS_CLIENT) ? (char *)"CLNT"
-		    : (char *)"SRVR";
+#if defined(TROPICSSL_SSL_KTLS)
+	if ((ssl->ktls & SSL_KTLS_TX) != 0) {
+		if ((ret = ssl_flush_output(ssl)) != 0)
+			return (ret);
 
-		memset(padbuf, 0x36, 48);
+		ret = net_sendfile(ssl->ktls_fd, fd, offset, len);
+		SSL_DEBUG_RET(2, "kernel TLS sendfile", ret);
 
-		md5_update(md5, (uint8_t *)sender, 4);
-		md5_update(md5, ssl->session->master, 48);
-		md5_update(md5, padbuf, 48);
-		md5_finish(md5, md5sum);
+		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+			return (TROPICSSL_ERR_NET_WANT_WRITE);
 
-		sha1_update(sha1, (uint8_t *)sender, 4);
-		sha1_update(sha1, ssl->session->master, 48);
-		sha1_update(sha1, padbuf, 40);
-		sha1_finish(sha1, sha1sum);
+		if (ret > 0)
+			SSL_STATS_ADD(ssl, bytes_out, ret);
 
-		memset(padbuf, 0x5C, 48);
+		return (ret);
+	}
+#endif
 
-		md5_starts(md5);
-		md5_update(md5, ssl->session->master, 48);
-		md5_update(md5, padbuf, 48);
-		md5_update(md5, md5sum, 16);
-		md5_finish(md5, buf);
+	if (ssl->out_ring_data != 0) {
+		/*
+		 * Retry after TROPICSSL_ERR_NET_WANT_WRITE: the records
+		 * are already encrypted, only the rest needs sending
+		 */
+		if ((ret = ssl_flush_output(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+			return (ret);
+		}
 
-		sha1_starts(sha1);
-		sha1_update(sha1, ssl->session->master, 48);
-		sha1_update(sha1, padbuf, 40);
-		sha1_update(sha1, sha1sum, 20);
-		sha1_finish(sha1, buf + 16);
+		total = ssl->out_ring_data;
+		ssl->out_ring_data = 0;
 
-		len += 24;
-	} else {
-		sender = (from == SSL_IS_CLIENT)
-		    ? (char *)"client finished" : (char *)"server finished";
+		ssl_buffers_idle(ssl);
 
-		md5_finish(md5, padbuf);
-		sha1_finish(sha1, padbuf + 16);
+		return ((int)total);
+	}
 
-		tls1_prf(ssl->session->master, 48, sender,
-			 padbuf, 36, buf, len);
+	if ((ret = ssl_flush_output(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+		return (ret);
 	}
 
-	SSL_DEBUG_BUF(3, "calc finished result", buf, len);
-
-	memset(md5, 0, sizeof(md5_context));
-	memset(sha1, 0, sizeof(sha1_context));
+	if ((ret = ssl_buffers_get(ssl)) != 0)
+		return (ret);
 
-	memset(padbuf, 0, sizeof(padbuf));
-	memset(md5sum, 0, sizeof(md5sum));
-	memset(sha1sum, 0, sizeof(sha1sum));
+	if ((ret = ssl_ring_alloc(ssl)) != 0)
+		return (ret);
 
-	SSL_DEBUG_MSG(2, ("<= calc  finished"));
-}
+	total = 0;
 
-int ssl_write_finished(ssl_context * ssl)
-{
-	int ret, hash_len;
-	md5_context md5;
-	sha1_context sha1;
+	while (total < len && (msg = ssl_ring_next(ssl)) != NULL) {
+		n = len - total;
+		max = ssl_record_len(ssl);
+		if (n > max)
+			n = max;
 
-	SSL_DEBUG_MSG(2, ("=> write finished"));
+		ret = ssl_file_read(fd, msg, n, offset + total);
 
-	memcpy(&md5, &ssl->fin_md5, sizeof(md5_context));
-	memcpy(&sha1, &ssl->fin_sha1, sizeof(sha1_context));
+		/*
+		 * A read error is reported once what came before is out
+		 */
+		if (ret < 0) {
+			SSL_DEBUG_MSG(1, ("file read failed at %d", total));
 
-	ssl_calc_finished(ssl, ssl->out_msg + 4, ssl->endpoint, &md5, &sha1);
+			if (total == 0)
+				return (TROPICSSL_ERR_FILE_IO_ERROR);
+			break;
+		}
 
-	hash_len = (ssl->minor_ver == SSL_MINOR_VERSION_0) ? 36 : 12;
+		if (ret == 0)
+			break;
 
-	ssl->out_msglen = 4 + hash_len;
-	ssl->out_msgtype = SSL_MSG_HANDSHAKE;
-	ssl->out_msg[0] = SSL_HS_FINISHED;
+		n = (size_t)ret;
 
-	/*
-	 * In case of session resuming, invert the client and server
-	 * ChangeCipherSpec messages order.
-	 */
-	if (ssl->resume != 0) {
-		if (ssl->endpoint == SSL_IS_CLIENT)
-			ssl->state = SSL_HANDSHAKE_OVER;
-		else
-			ssl->state = SSL_CLIENT_CHANGE_CIPHER_SPEC;
-	} else
-		ssl->state++;
+		if ((ret = ssl_queue_record(ssl, n)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_queue_record", ret);
+			return (ret);
+		}
 
-	ssl->do_crypt = 1;
+		ssl_record_sent(ssl, n);
+		total += n;
+	}
 
-	if ((ret = ssl_write_record(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_write_record", ret);
+	if ((ret = ssl_flush_output(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+		ssl->out_ring_data = total;
 		return (ret);
 	}
 
-	SSL_DEBUG_MSG(2, ("<= write finished"));
+	ssl_buffers_idle(ssl);
 
-	return (0);
+	SSL_DEBUG_MSG(2, ("<= sendfile"));
+
+	return ((int)total);
 }
 
-int ssl_parse_finished(ssl_context * ssl)
+/*
+ * Output corking
+ */
+void ssl_set_cork(ssl_context * ssl, int cork)
 {
-	int ret;
-	unsigned int hash_len;
-	md5_context md5;
-	sha1_context sha1;
-	uint8_t buf[36];
-
-	SSL_DEBUG_MSG(2, ("=> parse finished"));
+	ssl->out_cork = cork;
+}
 
-	memcpy(&md5, &ssl->fin_md5, sizeof(md5_context));
-	memcpy(&sha1, &ssl->fin_sha1, sizeof(sha1_context));
+int ssl_flush(ssl_context * ssl)
+{
+	int ret;
 
-	ssl->do_crypt = 1;
+	SSL_DEBUG_MSG(2, ("=> flush"));
 
-	if ((ret = ssl_read_record(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_read_record", ret);
+	if ((ret = ssl_flush_output(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
 		return (ret);
 	}
 
-	if (ssl->in_msgtype != SSL_MSG_HANDSHAKE) {
-		SSL_DEBUG_MSG(1, ("bad finished message"));
-		return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
-	}
-
-	hash_len = (ssl->minor_ver == SSL_MINOR_VERSION_0) ? 36 : 12;
-
-	if (ssl->in_msg[0] != SSL_HS_FINISHED || ssl->in_hslen != 4 + hash_len) {
-		SSL_DEBUG_MSG(1, ("bad finished message"));
-		return (TROPICSSL_ERR_SSL_BAD_HS_FINISHED);
-	}
-
-	ssl_calc_finished(ssl, buf, ssl->endpoint ^ 1, &md5, &sha1);
-
-	if (memcmp(ssl->in_msg + 4, buf, hash_len) != 0) {
-		SSL_DEBUG_MSG(1, ("bad finished message"));
-		return (TROPICSSL_ERR_SSL_BAD_HS_FINISHED);
-	}
-
-	if (ssl->resume != 0) {
-		if (ssl->endpoint == SSL_IS_CLIENT)
-			ssl->state = SSL_CLIENT_CHANGE_CIPHER_SPEC;
-
-		if (ssl->endpoint == SSL_IS_SERVER)
-			ssl->state = SSL_HANDSHAKE_OVER;
-	} else
-		ssl->state++;
+	ssl_buffers_idle(ssl);
 
-	SSL_DEBUG_MSG(2, ("<= parse finished"));
+	SSL_DEBUG_MSG(2, ("<= flush"));
 
 	return (0);
 }
 
 /*
- * Initialize an SSL context
+ * Notify the peer that the connection is being closed
  */
-int ssl_init(ssl_context * ssl)
+int ssl_close_notify(ssl_context * ssl)
 {
-	int len = SSL_BUFFER_LEN;
-
-	memset(ssl, 0, sizeof(ssl_context));
+	int ret;
 
-	ssl->in_ctr = (uint8_t *)malloc(len);
-	ssl->in_hdr = ssl->in_ctr + 8;
-	ssl->in_msg = ssl->in_ctr + 13;
+	SSL_DEBUG_MSG(2, ("=> write close notify"));
 
-	if (ssl->in_ctr == NULL) {
-		SSL_DEBUG_MSG(1, ("malloc(%d bytes) failed", len));
-		return (1);
+	if ((ret = ssl_flush_output(ssl)) != 0) {
+		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
+		return (ret);
 	}
 
-	ssl->out_ctr = (uint8_t *)malloc(len);
-	ssl->out_hdr = ssl->out_ctr + 8;
-	ssl->out_msg = ssl->out_ctr + 13;
-
-	if (ssl->out_ctr == NULL) {
-		SSL_DEBUG_MSG(1, ("malloc(%d bytes) failed", len));
-		free(ssl->in_ctr);
-		return (1);
-	}
+	if (ssl->state == SSL_HANDSHAKE_OVER || ssl->false_started != 0) {
+		if ((ret = ssl_buffers_get(ssl)) != 0)
+			return (ret);
 
-	memset(ssl->in_ctr, 0, SSL_BUFFER_LEN);
-	memset(ssl->out_ctr, 0, SSL_BUFFER_LEN);
+		ssl->out_msgtype = SSL_MSG_ALERT;
+		ssl->out_msglen = 2;
+		ssl->out_msg[0] = SSL_ALERT_WARNING;
+		ssl->out_msg[1] = SSL_ALERT_CLOSE_NOTIFY;
 
-	ssl->hostname = NULL;
-	ssl->hostname_len = 0;
+		if ((ret = ssl_write_record(ssl)) != 0) {
+			SSL_DEBUG_RET(1, "ssl_write_record", ret);
+			return (ret);
+		}
+	}
 
-	md5_starts(&ssl->fin_md5);
-	sha1_starts(&ssl->fin_sha1);
+	SSL_DEBUG_MSG(2, ("<= write close notify"));
 
-	return (0);
+	return (ret);
 }
 
 /*
- * SSL set accessors
+ * Exported connection state, all integers big endian:
+ *
+ *      0           format version (SSL_CONTEXT_SAVE_VERSION)
+ *      1           endpoint
+ *      2 ..   3    major, minor version
+ *      4 ..   5    ciphersuite
+ *      6           max_fragment_length agreed
+ *      7           reserved, zero
+ *      8 ..  15    incoming sequence number
+ *     16 ..  23    outgoing sequence number
+ *     24 ..  31    session start time
+ *     32           session id length
+ *     33 ..  64    session id
+ *     65 .. 112    master secret
+ *    113 .. 176    client random, server random
+ *    177 .. 192    IV (encryption)
+ *    193 .. 208    IV (decryption)
+ *    209 .. 724    RC4 only: x, y and permutation of each direction
  */
-void ssl_set_endpoint(ssl_context * ssl, int endpoint)
-{
-	ssl->endpoint = endpoint;
-}
+#define SSL_SAVE_FIXED_LEN      209
 
-void ssl_set_authmode(ssl_context * ssl, int authmode)
+static const uint8_t *ssl_seq(const ssl_context * ssl, int out)
 {
-	ssl->authmode = authmode;
-}
+	if (out)
+		return ((ssl->out_ctr != NULL) ? ssl->out_ctr : ssl->out_seq);
 
-void ssl_set_rng(ssl_context * ssl, int (*f_rng) (void *), void *p_rng)
-{
-	ssl->f_rng = f_rng;
-	ssl->p_rng = p_rng;
+	return ((ssl->in_ctr != NULL) ? ssl->in_ctr : ssl->in_seq);
 }
 
-void ssl_set_dbg(ssl_context * ssl,
-		 void (*f_dbg) (void *, int, const char *), void *p_dbg)
+static int ssl_is_arc4(const ssl_context * ssl)
 {
-	ssl->f_dbg = f_dbg;
-	ssl->p_dbg = p_dbg;
-}
+#if defined(TROPICSSL_ARC4)
+	return (ssl->cipher_info != NULL &&
+		ssl->cipher_info->base == &ssl_arc4_base);
+#else
+	(void)ssl;
 
-void ssl_set_bio(ssl_context * ssl,
-		 int (*f_recv) (void *, uint8_t *, size_t), void *p_recv,
-		 int (*f_send) (void *, uint8_t *, size_t), void *p_send)
-{
-	ssl->f_recv = f_recv;
-	ssl->f_send = f_send;
-	ssl->p_recv = p_recv;
-	ssl->p_send = p_send;
+	return (0);
+#endif
 }
 
-void ssl_set_scb(ssl_context * ssl,
-		 int (*s_get) (ssl_context *), int (*s_set) (ssl_context *))
+int ssl_set_saveable(ssl_context * ssl)
 {
-	ssl->s_get = s_get;
-	ssl->s_set = s_set;
-}
+	if (ssl->key_rand != NULL)
+		return (0);
 
-void ssl_set_session(ssl_context * ssl, int resume, int timeout,
-		     ssl_session * session)
-{
-	ssl->resume = resume;
-	ssl->timeout = timeout;
-	ssl->session = session;
-}
+	ssl->key_rand = (uint8_t *)memory_alloc(64);
 
-void ssl_set_ciphers(ssl_context * ssl, int *ciphers)
-{
-	ssl->ciphers = ciphers;
-}
+	if (ssl->key_rand == NULL)
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
 
-void ssl_set_ca_chain(ssl_context * ssl, x509_cert * ca_chain, const char *peer_cn)
-{
-	ssl->ca_chain = ca_chain;
-	ssl->peer_cn = peer_cn;
+	memset(ssl->key_rand, 0, 64);
+
+	return (0);
 }
 
-void ssl_set_own_cert(ssl_context * ssl, x509_cert * own_cert,
-		      rsa_context * rsa_key)
+int ssl_context_save(ssl_context * ssl, uint8_t *buf, size_t len,
+		     size_t *olen)
 {
-	ssl->own_cert = own_cert;
-	ssl->rsa_key = rsa_key;
+	int i;
+	size_t n = SSL_SAVE_FIXED_LEN;
+	uint64_t start;
+	ssl_session *session = ssl->session;
+
+	if (ssl->state != SSL_HANDSHAKE_OVER || ssl->handshake != NULL ||
+	    ssl->key_rand == NULL ||
+	    session == NULL || session->length > sizeof(session->id))
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	if (ssl->out_left != 0 || ssl->out_ring_used != 0 ||
+	    ssl->in_left != 0 || ssl->in_ahead != 0 || ssl->in_offt != NULL)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+#if defined(TROPICSSL_SSL_KTLS)
+	if (ssl->ktls != 0)
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+#endif
+
+	if (session->compression != SSL_COMPRESS_NULL)
+		return (TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE);
+
+	if (ssl_is_arc4(ssl))
+		n += 2 * (2 + 256);
+
+	if (len < n)
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	memset(buf, 0, n);
+
+	buf[0] = SSL_CONTEXT_SAVE_VERSION;
+	buf[1] = (uint8_t)ssl->endpoint;
+	buf[2] = (uint8_t)ssl->major_ver;
+	buf[3] = (uint8_t)ssl->minor_ver;
+	buf[4] = (uint8_t)(session->cipher >> 8);
+	buf[5] = (uint8_t)(session->cipher);
+	buf[6] = (uint8_t)ssl->mfl_nego;
+
+	memcpy(buf + 8, ssl_seq(ssl, 0), 8);
+	memcpy(buf + 16, ssl_seq(ssl, 1), 8);
+
+	start = (uint64_t)session->start;
+	for (i = 0; i < 8; i++)
+		buf[24 + i] = (uint8_t)(start >> (56 - 8 * i));
+
+	buf[32] = (uint8_t)session->length;
+	memcpy(buf + 33, session->id, session->length);
+	memcpy(buf + 65, session->master, 48);
+	memcpy(buf + 113, ssl->key_rand, 64);
+	memcpy(buf + 177, ssl->iv_enc, 16);
+	memcpy(buf + 193, ssl->iv_dec, 16);
+
+#if defined(TROPICSSL_ARC4)
+	if (ssl_is_arc4(ssl)) {
+		const arc4_context *a[2];
+		uint8_t *p = buf + SSL_SAVE_FIXED_LEN;
+
+		a[0] = (const arc4_context *)ssl->ctx_enc;
+		a[1] = (const arc4_context *)ssl->ctx_dec;
+
+		for (i = 0; i < 2; i++) {
+			*p++ = (uint8_t)a[i]->x;
+			*p++ = (uint8_t)a[i]->y;
+			memcpy(p, a[i]->m, 256);
+			p += 256;
+		}
+	}
+#endif
+
+	*olen = n;
+
+	SSL_DEBUG_MSG(2, ("saved the connection state, %d bytes", n));
+
+	return (0);
 }
 
-int ssl_set_dh_param(ssl_context * ssl, const char *dhm_P, const char *dhm_G)
+int ssl_context_load(ssl_context * ssl, const uint8_t *buf, size_t len)
 {
-	int ret;
+	int i, ret;
+	uint64_t start = 0;
+	ssl_session *session = ssl->session, *next;
+
+	if (ssl->state != SSL_HELLO_REQUEST || ssl->handshake == NULL ||
+	    session == NULL || len < SSL_SAVE_FIXED_LEN ||
+	    buf[0] != SSL_CONTEXT_SAVE_VERSION ||
+	    buf[1] > SSL_IS_SERVER || buf[2] != SSL_MAJOR_VERSION_3 ||
+	    buf[3] > SSL_MINOR_VERSION_3 ||
+	    buf[6] > SSL_MAX_FRAG_LEN_4096 || buf[32] > 32 ||
+	    buf[3] < ssl_cipher_min_minor_ver((buf[4] << 8) | buf[5]))
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	ssl->endpoint = buf[1];
+	ssl->major_ver = buf[2];
+	ssl->minor_ver = buf[3];
+	ssl->mfl_nego = buf[6];
+
+	for (i = 0; i < 8; i++)
+		start = (start << 8) | buf[24 + i];
+
+	next = session->next;
+	ssl_session_free(session);
+	memset(session, 0, sizeof(ssl_session));
+	session->next = next;
+	session->start = (time_t) start;
+	session->cipher = (buf[4] << 8) | buf[5];
+	session->compression = SSL_COMPRESS_NULL;
+	session->length = buf[32];
+	memcpy(session->id, buf + 33, session->length);
+	memcpy(session->master, buf + 65, 48);
 
-	if ((ret = mpi_read_string(&ssl->dhm_ctx.P, 16, dhm_P)) != 0) {
-		SSL_DEBUG_RET(1, "mpi_read_string", ret);
+	/*
+	 * Same key block as the exporting context, from the same
+	 * master secret and randoms
+	 */
+	memcpy(ssl->handshake->randbytes, buf + 113, 64);
+	ssl->resume = 1;
+
+	if ((ret = ssl_derive_keys(ssl)) != 0)
 		return (ret);
+
+	if (len != SSL_SAVE_FIXED_LEN +
+	    (ssl_is_arc4(ssl) ? 2 * (2 + 256) : 0))
+		return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
+
+	memcpy(ssl->iv_enc, buf + 177, 16);
+	memcpy(ssl->iv_dec, buf + 193, 16);
+
+#if defined(TROPICSSL_ARC4)
+	if (ssl_is_arc4(ssl)) {
+		arc4_context *a[2];
+		const uint8_t *p = buf + SSL_SAVE_FIXED_LEN;
+
+		a[0] = (arc4_context *) ssl->ctx_enc;
+		a[1] = (arc4_context *) ssl->ctx_dec;
+
+		for (i = 0; i < 2; i++) {
+			a[i]->x = *p++;
+			a[i]->y = *p++;
+			memcpy(a[i]->m, p, 256);
+			p += 256;
+		}
 	}
+#endif
 
-	if ((ret = mpi_read_string(&ssl->dhm_ctx.G, 16, dhm_G)) != 0) {
-		SSL_DEBUG_RET(1, "mpi_read_string", ret);
+	if (ssl->mfl_nego != SSL_MAX_FRAG_LEN_NONE &&
+	    (ret = ssl_apply_max_frag_len(ssl)) != 0)
 		return (ret);
-	}
+
+	memcpy((ssl->in_ctr != NULL) ? ssl->in_ctr : ssl->in_seq,
+	       buf + 8, 8);
+	memcpy((ssl->out_ctr != NULL) ? ssl->out_ctr : ssl->out_seq,
+	       buf + 16, 8);
+
+	ssl->in_crypt = 1;
+	ssl->out_crypt = 1;
+	ssl->state = SSL_HANDSHAKE_OVER;
+	ssl_handshake_free(ssl);
+
+#if defined(TROPICSSL_SSL_KTLS)
+	ssl_ktls_start(ssl);
+#endif
+
+	SSL_DEBUG_MSG(2, ("loaded the connection state"));
 
 	return (0);
 }
 
-int ssl_set_hostname(ssl_context * ssl, const char *hostname)
+/*
+ * Free an SSL context
+ */
+void ssl_free(ssl_context * ssl)
 {
-	if (hostname == NULL)
-		return (TROPICSSL_ERR_BAD_ARG);
+	SSL_DEBUG_MSG(2, ("=> free"));
 
-	ssl->hostname_len = strlen(hostname);
-	ssl->hostname = (uint8_t *)malloc(ssl->hostname_len + 1);
+#if defined(TROPICSSL_X509_CRT_CACHE)
+	if (ssl->peer_cache != NULL) {
+		x509_crt_release(ssl->peer_cache, ssl->peer_cert);
+		ssl->peer_cert = NULL;
+	}
+#endif
 
-	memcpy(ssl->hostname, (uint8_t *)hostname, ssl->hostname_len);
+	if (ssl->peer_cert != NULL) {
+		x509_free(ssl->peer_cert);
+		memset(ssl->peer_cert, 0, sizeof(x509_cert));
+		memory_free(ssl->peer_cert);
+	}
+
+	if (ssl->out_ctr != NULL)
+		ssl_buf_put(ssl, ssl->out_ctr, ssl->out_buf_len);
+
+	if (ssl->in_ctr != NULL)
+		ssl_buf_put(ssl, ssl->in_ctr, ssl->in_buf_len);
+
+	if (ssl->out_ring != NULL) {
+		memset(ssl->out_ring, 0, ssl->out_ring_len);
+		memory_free(ssl->out_ring);
+	}
+	ssl_handshake_free(ssl);
+
+	if (ssl->ctx_enc != NULL) {
+		memset(ssl->ctx_enc, 0, ssl->ctx_len);
+		memory_free(ssl->ctx_enc);
+	}
+
+#if defined(TROPICSSL_ZLIB_SUPPORT)
+	ssl_compress_free(ssl);
+#endif
+
+	if (ssl->hostname != NULL) {
+		memset(ssl->hostname, 0, ssl->hostname_len);
+		memory_free(ssl->hostname);
+		ssl->hostname_len = 0;
+	}
+
+	if (ssl->key_rand != NULL) {
+		memset(ssl->key_rand, 0, 64);
+		memory_free(ssl->key_rand);
+	}
+
+#if defined(TROPICSSL_SSL_STATS)
+	ssl_stats_merge(ssl);
+#endif
+
+	memset(ssl, 0, sizeof(ssl_context));
+
+	SSL_DEBUG_MSG(2, ("<= free"));
+}
+
+/*
+ * Free the data held by a session; the ticket comes from the heap as
+ * the session outlives the context (and any arena it used)
+ */
+void ssl_session_free(ssl_session * session)
+{
+	if (session->ticket != NULL) {
+		memset(session->ticket, 0, session->ticket_len);
+		free(session->ticket);
+	}
 
-	return (0);
+	session->ticket = NULL;
+	session->ticket_len = 0;
+	session->ticket_lifetime = 0;
 }
 
+#if defined(TROPICSSL_SSL_STATS)
 /*
- * SSL get accessors
+ * Names of the handshake states, as exported by ssl_stats_write()
  */
-size_t ssl_get_bytes_avail(const ssl_context * ssl)
+static const char *ssl_state_names[SSL_HANDSHAKE_OVER] = {
+	"hello_request", "client_hello", "server_hello",
+	"server_certificate", "server_key_exchange",
+	"certificate_request", "server_hello_done",
+	"client_certificate", "client_key_exchange",
+	"certificate_verify", "client_change_cipher_spec",
+	"client_finished", "server_new_session_ticket",
+	"server_change_cipher_spec", "server_finished", "flush_buffers"
+};
+
+void ssl_get_stats(const ssl_context * ssl, ssl_stats * stats)
 {
-	return (ssl->in_offt == NULL ? 0 : ssl->in_msglen);
+	memcpy(stats, &ssl->stats, sizeof(ssl_stats));
 }
 
-int ssl_get_verify_result(const ssl_context * ssl)
+int ssl_stats_sink_init(ssl_stats_sink * sink)
 {
-	return (ssl->verify_result);
+	memset(sink, 0, sizeof(ssl_stats_sink));
+
+#if defined(WIN32)
+	InitializeCriticalSection(&sink->lock);
+#else
+	if (pthread_mutex_init(&sink->lock, NULL) != 0)
+		return (1);
+#endif
+
+	return (0);
 }
 
-const char *ssl_get_cipher(const ssl_context * ssl)
+void ssl_set_stats_sink(ssl_context * ssl, ssl_stats_sink * sink)
 {
-	switch (ssl->session->cipher) {
-#if defined(TROPICSSL_ARC4)
-	case TLS_RSA_WITH_RC4_128_MD5:
-		return ("TLS_RSA_WITH_RC4_128_MD5");
+	ssl->stats_sink = sink;
+}
 
-	case TLS_RSA_WITH_RC4_128_SHA:
-		return ("TLS_RSA_WITH_RC4_128_SHA");
-#endif
+/*
+ * Counters add up; high-water marks keep the largest
+ */
+static void ssl_stats_add(ssl_stats * dst, const ssl_stats * src)
+{
+	int i;
 
-#if defined(TROPICSSL_DES)
-	case TLS_RSA_WITH_3DES_EDE_CBC_SHA:
-		return ("TLS_RSA_WITH_3DES_EDE_CBC_SHA");
+	dst->records_in += src->records_in;
+	dst->records_out += src->records_out;
+	dst->bytes_in += src->bytes_in;
+	dst->bytes_out += src->bytes_out;
 
-	case TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA:
-		return ("TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA");
-#endif
+	dst->handshakes += src->handshakes;
+	dst->resume_hits += src->resume_hits;
+	dst->resume_misses += src->resume_misses;
 
-#if defined(TROPICSSL_AES)
-	case TLS_RSA_WITH_AES_128_CBC_SHA:
-		return ("TLS_RSA_WITH_AES_128_CBC_SHA");
+	dst->rsa_ops += src->rsa_ops;
+	dst->rsa_usec += src->rsa_usec;
+	dst->dh_ops += src->dh_ops;
+	dst->dh_usec += src->dh_usec;
+	dst->ecdh_ops += src->ecdh_ops;
+	dst->ecdh_usec += src->ecdh_usec;
 
-	case TLS_RSA_WITH_AES_256_CBC_SHA:
-		return ("TLS_RSA_WITH_AES_256_CBC_SHA");
+	for (i = 0; i < SSL_HANDSHAKE_OVER; i++)
+		dst->state_usec[i] += src->state_usec[i];
 
-	case TLS_DHE_RSA_WITH_AES_256_CBC_SHA:
-		return ("TLS_DHE_RSA_WITH_AES_256_CBC_SHA");
-#endif
+	if (dst->in_hwm < src->in_hwm)
+		dst->in_hwm = src->in_hwm;
 
-#if defined(TROPICSSL_CAMELLIA)
-	case TLS_RSA_WITH_CAMELLIA_128_CBC_SHA:
-		return ("TLS_RSA_WITH_CAMELLIA_128_CBC_SHA");
+	if (dst->out_hwm < src->out_hwm)
+		dst->out_hwm = src->out_hwm;
+}
 
-	case TLS_RSA_WITH_CAMELLIA_256_CBC_SHA:
-		return ("TLS_RSA_WITH_CAMELLIA_256_CBC_SHA");
+void ssl_stats_merge(ssl_context * ssl)
+{
+	ssl_stats_sink *sink = ssl->stats_sink;
 
-	case TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA:
-		return ("TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA");
-#endif
+	if (sink == NULL)
+		return;
 
-	default:
-		break;
-	}
+	SSL_STATS_LOCK(sink);
+	ssl_stats_add(&sink->total, &ssl->stats);
+	sink->contexts++;
+	SSL_STATS_UNLOCK(sink);
 
-	return ("unknown");
+	memset(&ssl->stats, 0, sizeof(ssl_stats));
 }
 
-int ssl_default_ciphers[] = {
-#if defined(TROPICSSL_DHM)
-#if defined(TROPICSSL_AES)
-	TLS_DHE_RSA_WITH_AES_256_CBC_SHA,
-#endif
-#if defined(TROPICSSL_CAMELLIA)
-	TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA,
-#endif
-#if defined(TROPICSSL_DES)
-	TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA,
-#endif
-#endif
+uint64_t ssl_stats_sink_get(ssl_stats_sink * sink, ssl_stats * stats)
+{
+	uint64_t n;
 
-#if defined(TROPICSSL_AES)
-	TLS_RSA_WITH_AES_128_CBC_SHA,
-	TLS_RSA_WITH_AES_256_CBC_SHA,
-#endif
-#if defined(TROPICSSL_CAMELLIA)
-	TLS_RSA_WITH_CAMELLIA_128_CBC_SHA,
-	TLS_RSA_WITH_CAMELLIA_256_CBC_SHA,
-#endif
-#if defined(TROPICSSL_DES)
-	TLS_RSA_WITH_3DES_EDE_CBC_SHA,
-#endif
-#if defined(TROPICSSL_ARC4)
-	TLS_RSA_WITH_RC4_128_SHA,
-	TLS_RSA_WITH_RC4_128_MD5,
-#endif
-	0
-};
+	SSL_STATS_LOCK(sink);
+	memcpy(stats, &sink->total, sizeof(ssl_stats));
+	n = sink->contexts;
+	SSL_STATS_UNLOCK(sink);
 
-/*
- * Perform the SSL handshake
- */
-int ssl_handshake(ssl_context * ssl)
+	return (n);
+}
+
+void ssl_stats_sink_free(ssl_stats_sink * sink)
 {
-	int ret = TROPICSSL_ERR_SSL_FEATURE_UNAVAILABLE;
+#if defined(WIN32)
+	DeleteCriticalSection(&sink->lock);
+#else
+	pthread_mutex_destroy(&sink->lock);
+#endif
 
-	SSL_DEBUG_MSG(2, ("=> handshake"));
+	memset(sink, 0, sizeof(ssl_stats_sink));
+}
 
-#if defined(TROPICSSL_SSL_CLI_C)
-	if (ssl->endpoint == SSL_IS_CLIENT)
-		ret = ssl_handshake_client(ssl);
-#endif
+int ssl_stats_write(const ssl_stats * stats, char *buf, size_t len)
+{
+	int i, n;
+	size_t off = 0;
+	const char *names[15] = {
+		"records_in", "records_out", "bytes_in", "bytes_out",
+		"handshakes", "resume_hits", "resume_misses",
+		"rsa_ops", "rsa_usec", "dh_ops", "dh_usec",
+		"ecdh_ops", "ecdh_usec", "in_hwm", "out_hwm"
+	};
+	uint64_t values[15];
+
+	values[0] = stats->records_in;
+	values[1] = stats->records_out;
+	values[2] = stats->bytes_in;
+	values[3] = stats->bytes_out;
+	values[4] = stats->handshakes;
+	values[5] = stats->resume_hits;
+	values[6] = stats->resume_misses;
+	values[7] = stats->rsa_ops;
+	values[8] = stats->rsa_usec;
+	values[9] = stats->dh_ops;
+	values[10] = stats->dh_usec;
+	values[11] = stats->ecdh_ops;
+	values[12] = stats->ecdh_usec;
+	values[13] = stats->in_hwm;
+	values[14] = stats->out_hwm;
+
+	for (i = 0; i < 15 + SSL_HANDSHAKE_OVER; i++) {
+		if (i < 15)
+			n = snprintf(buf + off, len - off, "%s %llu\n",
+				     names[i],
+				     (unsigned long long)values[i]);
+		else
+			n = snprintf(buf + off, len - off, "%s_usec %llu\n",
+				     ssl_state_names[i - 15],
+				     (unsigned long long)
+				     stats->state_usec[i - 15]);
 
-#if defined(TROPICSSL_SSL_SRV_C)
-	if (ssl->endpoint == SSL_IS_SERVER)
-		ret = ssl_handshake_server(ssl);
-#endif
+		if (n < 0 || (size_t)n >= len - off)
+			return (TROPICSSL_ERR_SSL_BAD_INPUT_DATA);
 
-	SSL_DEBUG_MSG(2, ("<= handshake"));
+		off += n;
+	}
 
-	return (ret);
+	return ((int)off);
 }
 
+#if defined(TROPICSSL_SELF_TEST)
+
 /*
- * Receive application data decrypted from the SSL layer
+ * Checkup routine
  */
-int ssl_read(ssl_context * ssl, uint8_t *buf, size_t len)
+int ssl_stats_self_test(int verbose)
 {
-	int ret;
-	size_t n;
+	char buf[1024];
+	ssl_context ssl;
+	ssl_stats st;
+	ssl_stats_sink sink;
 
-	SSL_DEBUG_MSG(2, ("=> read"));
+	if (verbose != 0)
+		printf("  SSL statistics test: ");
 
-	if (ssl->state != SSL_HANDSHAKE_OVER) {
-		if ((ret = ssl_handshake(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_handshake", ret);
-			return (ret);
-		}
+	memset(&ssl, 0, sizeof(ssl_context));
+
+	if (ssl_stats_sink_init(&sink) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
 	}
 
-	if (ssl->in_offt == NULL) {
-		if ((ret = ssl_read_record(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_read_record", ret);
-			return (ret);
-		}
+	ssl_set_stats_sink(&ssl, &sink);
 
-		if (ssl->in_msglen == 0 &&
-		    ssl->in_msgtype == SSL_MSG_APPLICATION_DATA) {
-			/*
-			 * OpenSSL sends empty messages to randomize the IV
-			 */
-			if ((ret = ssl_read_record(ssl)) != 0) {
-				SSL_DEBUG_RET(1, "ssl_read_record", ret);
-				return (ret);
-			}
-		}
+	/*
+	 * Two contexts' worth of counters: sums, except the high-water
+	 * marks, and the context starts over after each merge
+	 */
+	ssl.stats.records_in = 3;
+	ssl.stats.handshakes = 1;
+	ssl.stats.state_usec[SSL_CLIENT_HELLO] = 10;
+	ssl.stats.in_hwm = 500;
+	ssl_stats_merge(&ssl);
+
+	if (ssl.stats.records_in != 0)
+		goto fail;
+
+	ssl.stats.records_in = 4;
+	ssl.stats.handshakes = 1;
+	ssl.stats.resume_hits = 1;
+	ssl.stats.state_usec[SSL_CLIENT_HELLO] = 5;
+	ssl.stats.in_hwm = 200;
+	ssl_stats_merge(&ssl);
+
+	if (ssl_stats_sink_get(&sink, &st) != 2 ||
+	    st.records_in != 7 || st.handshakes != 2 ||
+	    st.resume_hits != 1 || st.in_hwm != 500 ||
+	    st.state_usec[SSL_CLIENT_HELLO] != 15)
+		goto fail;
 
-		if (ssl->in_msgtype != SSL_MSG_APPLICATION_DATA) {
-			SSL_DEBUG_MSG(1, ("bad application data message"));
-			return (TROPICSSL_ERR_SSL_UNEXPECTED_MESSAGE);
-		}
+	/*
+	 * Text export, and a buffer too small for it
+	 */
+	if (ssl_stats_write(&st, buf, sizeof(buf)) <= 0 ||
+	    strstr(buf, "records_in 7\n") == NULL ||
+	    strstr(buf, "\nclient_hello_usec 15\n") == NULL ||
+	    strstr(buf, "\nin_hwm 500\n") == NULL)
+		goto fail;
 
-		ssl->in_offt = ssl->in_msg;
-	}
+	if (ssl_stats_write(&st, buf, 64) !=
+	    TROPICSSL_ERR_SSL_BAD_INPUT_DATA)
+		goto fail;
 
-	n = (len < ssl->in_msglen)
-	    ? len : ssl->in_msglen;
+	ssl_stats_sink_free(&sink);
 
-	memcpy(buf, ssl->in_offt, n);
-	ssl->in_msglen -= n;
+	if (verbose != 0)
+		printf("passed\n\n");
 
-	if (ssl->in_msglen == 0)
-		/* all bytes consumed  */
-		ssl->in_offt = NULL;
-	else
-		/* more data available */
-		ssl->in_offt += n;
+	return (0);
 
-	SSL_DEBUG_MSG(2, ("<= read"));
+fail:
+	ssl_stats_sink_free(&sink);
 
-	return (n);
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
 }
 
-/*
- * Send application data to be encrypted by the SSL layer
- */
-int ssl_write(ssl_context * ssl, const uint8_t *buf, size_t len)
+#endif
+#endif
+
+#if defined(TROPICSSL_SELF_TEST) && defined(TROPICSSL_CERTS)
+
+#include "tropicssl/certs.h"
+#include <stdio.h>
+
+typedef struct {
+	const uint8_t *p;
+	size_t len;
+} ssl_gather_test_input;
+
+static int ssl_gather_test_recv(void *ctx, uint8_t *buf, size_t len)
 {
-	int ret;
-	size_t n;
+	ssl_gather_test_input *in = (ssl_gather_test_input *) ctx;
 
-	SSL_DEBUG_MSG(2, ("=> write"));
+	if (in->len == 0)
+		return (TROPICSSL_ERR_NET_WANT_READ);
 
-	if (ssl->state != SSL_HANDSHAKE_OVER) {
-		if ((ret = ssl_handshake(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_handshake", ret);
-			return (ret);
-		}
-	}
+	if (len > in->len)
+		len = in->len;
 
-	n = (len < SSL_MAX_CONTENT_LEN)
-	    ? len : SSL_MAX_CONTENT_LEN;
+	memcpy(buf, in->p, len);
+	in->p += len;
+	in->len -= len;
 
-	if (ssl->out_left != 0) {
-		if ((ret = ssl_flush_output(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_flush_output", ret);
-			return (ret);
-		}
-	} else {
-		ssl->out_msglen = n;
-		ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
-		memcpy(ssl->out_msg, buf, n);
+	return ((int)len);
+}
 
-		if ((ret = ssl_write_record(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_write_record", ret);
-			return (ret);
-		}
+/*
+ * Handshake messages cut into small records regardless of where
+ * they start; returns the length of the records
+ */
+static size_t ssl_gather_test_cut(uint8_t *wire, const uint8_t *msgs,
+				  size_t len)
+{
+	size_t i, n, off;
+	static const size_t cuts[4] = { 3, 300, 1, 450 };
+
+	for (i = off = n = 0; off < len; i++, off += n) {
+		n = (cuts[i % 4] < len - off) ? cuts[i % 4] : len - off;
+
+		wire[i * 5 + off] = SSL_MSG_HANDSHAKE;
+		wire[i * 5 + off + 1] = SSL_MAJOR_VERSION_3;
+		wire[i * 5 + off + 2] = SSL_MINOR_VERSION_3;
+		wire[i * 5 + off + 3] = (uint8_t)(n >> 8);
+		wire[i * 5 + off + 4] = (uint8_t)(n);
+		memcpy(wire + i * 5 + off + 5, msgs + off, n);
 	}
 
-	SSL_DEBUG_MSG(2, ("<= write"));
-
-	return ((int)n);
+	return (i * 5 + len);
 }
 
 /*
- * Notify the peer that the connection is being closed
+ * Checkup routine
  */
-int ssl_close_notify(ssl_context * ssl)
+int ssl_gather_self_test(int verbose)
 {
-	int ret;
+	size_t i, len, wire_len;
+	uint8_t msgs[3072], wire[4096], *crt_msg = NULL;
+	ssl_gather_test_input in;
+	ssl_context ssl;
+	x509_cert crt;
 
-	SSL_DEBUG_MSG(2, ("=> write close notify"));
+	if (verbose != 0)
+		printf("  SSL handshake gathering test: ");
 
-	if ((ret = ssl_flush_output(ssl)) != 0) {
-		SSL_DEBUG_RET(1, "ssl_flush_output", ret);
-		return (ret);
-	}
+	memset(&ssl, 0, sizeof(ssl_context));
+	memset(&crt, 0, sizeof(x509_cert));
 
-	if (ssl->state == SSL_HANDSHAKE_OVER) {
-		ssl->out_msgtype = SSL_MSG_ALERT;
-		ssl->out_msglen = 2;
-		ssl->out_msg[0] = SSL_ALERT_WARNING;
-		ssl->out_msg[1] = SSL_ALERT_CLOSE_NOTIFY;
+	if (x509parse_crt(&crt, (uint8_t *)test_srv_crt,
+			  strlen(test_srv_crt)) != 0 ||
+	    x509parse_crt(&crt, (uint8_t *)test_ca_crt,
+			  strlen(test_ca_crt)) != 0 ||
+	    (crt_msg = ssl_encode_certificate(&crt)) == NULL)
+		goto fail;
 
-		if ((ret = ssl_write_record(ssl)) != 0) {
-			SSL_DEBUG_RET(1, "ssl_write_record", ret);
-			return (ret);
-		}
-	}
+	/*
+	 * A Certificate, a message of another kind, then an empty one
+	 */
+	len = 4 + (((size_t)crt_msg[1] << 16) | ((size_t)crt_msg[2] << 8) |
+		   (size_t)crt_msg[3]);
+	if (len + 604 + 4 > sizeof(msgs))
+		goto fail;
+
+	memcpy(msgs, crt_msg, len);
+	msgs[len] = SSL_HS_SERVER_KEY_EXCHANGE;
+	msgs[len + 1] = 0;
+	msgs[len + 2] = 600 >> 8;
+	msgs[len + 3] = 600 & 0xFF;
+	for (i = 0; i < 600; i++)
+		msgs[len + 4 + i] = (uint8_t)(i * 7);
+	len += 604;
+	memcpy(msgs + len, "\x0E\0\0\0", 4);
+	len += 4;
+
+	wire_len = ssl_gather_test_cut(wire, msgs, len);
+
+	in.p = wire;
+	in.len = wire_len;
+
+	if (ssl_init(&ssl) != 0 ||
+	    ssl_set_buffer_len(&ssl, SSL_MIN_CONTENT_LEN,
+			       SSL_MIN_CONTENT_LEN) != 0)
+		goto fail;
+
+	ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
+	ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
+	ssl_set_bio(&ssl, ssl_gather_test_recv, &in, NULL, NULL);
+	ssl.major_ver = SSL_MAJOR_VERSION_3;
+	ssl.minor_ver = SSL_MINOR_VERSION_3;
+	ssl.state = SSL_SERVER_CERTIFICATE;
 
-	SSL_DEBUG_MSG(2, ("<= write close notify"));
+	/*
+	 * The chain is parsed as it comes, from records smaller than
+	 * its certificates
+	 */
+	if (ssl_parse_certificate(&ssl) != 0 || ssl.peer_cert == NULL ||
+	    ssl.peer_cert->next == NULL ||
+	    ssl.peer_cert->raw.len != crt.raw.len ||
+	    memcmp(ssl.peer_cert->raw.p, crt.raw.p, crt.raw.len) != 0 ||
+	    ssl.peer_cert->next->raw.len != crt.next->raw.len)
+		goto fail;
+
+	if (ssl_read_record(&ssl) != 0 || ssl.in_hslen != 604 ||
+	    ssl.in_msg[0] != SSL_HS_SERVER_KEY_EXCHANGE ||
+	    memcmp(ssl.in_msg + 4, msgs + len - 604, 600) != 0)
+		goto fail;
+
+	if (ssl_read_record(&ssl) != 0 || ssl.in_hslen != 4 ||
+	    ssl.in_msg[0] != SSL_HS_SERVER_HELLO_DONE)
+		goto fail;
 
-	return (ret);
-}
+	/*
+	 * All of it went into the transcript, in order
+	 */
+	if (ssl.handshake->transcript.len != len ||
+	    memcmp(ssl.handshake->transcript.buf, msgs, len) != 0)
+		goto fail;
 
-/*
- * Free an SSL context
- */
-void ssl_free(ssl_context * ssl)
-{
-	SSL_DEBUG_MSG(2, ("=> free"));
+	ssl_free(&ssl);
 
-	if (ssl->peer_cert != NULL) {
-		x509_free(ssl->peer_cert);
-		memset(ssl->peer_cert, 0, sizeof(x509_cert));
-		free(ssl->peer_cert);
-	}
+	/*
+	 * Messages that must fit in a record do not
+	 */
+	in.p = wire;
+	in.len = wire_len;
 
-	if (ssl->out_ctr != NULL) {
-		memset(ssl->out_ctr, 0, SSL_BUFFER_LEN);
-		free(ssl->out_ctr);
-	}
+	if (ssl_init(&ssl) != 0)
+		goto fail;
 
-	if (ssl->in_ctr != NULL) {
-		memset(ssl->in_ctr, 0, SSL_BUFFER_LEN);
-		free(ssl->in_ctr);
-	}
-#if defined(TROPICSSL_DHM)
-	dhm_free(&ssl->dhm_ctx);
-#endif
+	ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
+	ssl_set_bio(&ssl, ssl_gather_test_recv, &in, NULL, NULL);
+	ssl_set_handshake_max_len(&ssl, 0);
+	ssl.major_ver = SSL_MAJOR_VERSION_3;
+	ssl.state = SSL_SERVER_CERTIFICATE;
 
-	if (ssl->hostname != NULL) {
-		memset(ssl->hostname, 0, ssl->hostname_len);
-		free(ssl->hostname);
-		ssl->hostname_len = 0;
-	}
+	if (ssl_parse_certificate(&ssl) != TROPICSSL_ERR_SSL_INVALID_RECORD)
+		goto fail;
 
-	memset(ssl, 0, sizeof(ssl_context));
+	ssl_free(&ssl);
 
-	SSL_DEBUG_MSG(2, ("<= free"));
+	/*
+	 * Nor do bytes left after the last certificate
+	 */
+	len = 4 + (((size_t)crt_msg[1] << 16) | ((size_t)crt_msg[2] << 8) |
+		   (size_t)crt_msg[3]);
+	memcpy(msgs, crt_msg, len);
+	memset(msgs + len, 0, 2);
+	msgs[1] = (uint8_t)((len - 2) >> 16);
+	msgs[2] = (uint8_t)((len - 2) >> 8);
+	msgs[3] = (uint8_t)((len - 2));
+	msgs[4] = (uint8_t)((len - 5) >> 16);
+	msgs[5] = (uint8_t)((len - 5) >> 8);
+	msgs[6] = (uint8_t)((len - 5));
+
+	in.p = wire;
+	in.len = ssl_gather_test_cut(wire, msgs, len + 2);
+
+	if (ssl_init(&ssl) != 0 ||
+	    ssl_set_buffer_len(&ssl, SSL_MIN_CONTENT_LEN,
+			       SSL_MIN_CONTENT_LEN) != 0)
+		goto fail;
+
+	ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
+	ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
+	ssl_set_bio(&ssl, ssl_gather_test_recv, &in, NULL, NULL);
+	ssl.major_ver = SSL_MAJOR_VERSION_3;
+	ssl.state = SSL_SERVER_CERTIFICATE;
+
+	if (ssl_parse_certificate(&ssl) != TROPICSSL_ERR_SSL_BAD_HS_CERTIFICATE)
+		goto fail;
+
+	ssl_free(&ssl);
+	x509_free(&crt);
+	memory_free(crt_msg);
+
+	if (verbose != 0)
+		printf("passed\n\n");
+
+	return (0);
+
+fail:
+	ssl_free(&ssl);
+	x509_free(&crt);
+	memory_free(crt_msg);
+
+	if (verbose != 0)
+		printf("failed\n");
+
+	return (1);
 }
 
 #endif
+
+#endif
@@ -188,6 +188,25 @@ unsigned long get_timer(struct hr_time *val, int reset)
 	return (delta);
 }
 
+unsigned long get_timer_us(struct hr_time *val, int reset)
+{
+	unsigned long delta;
+	LARGE_INTEGER offset, hfreq;
+	struct _hr_time *t = (struct _hr_time *)val;
+
+	QueryPerformanceCounter(&offset);
+	QueryPerformanceFrequency(&hfreq);
+
+	delta = (unsigned long)((1000000 *
+				 (offset.QuadPart - t->start.QuadPart)) /
+				hfreq.QuadPart);
+
+	if (reset)
+		QueryPerformanceCounter(&t->start);
+
+	return (delta);
+}
+
 DWORD WINAPI TimerProc(LPVOID uElapse)
 {
 	Sleep((DWORD) uElapse);
@@ -230,6 +249,25 @@ unsigned long get_timer(struct hr_time *val, int reset)
 	return (delta);
 }
 
+unsigned long get_timer_us(struct hr_time *val, int reset)
+{
+	unsigned long delta;
+	struct timeval offset;
+	struct _hr_time *t = (struct _hr_time *)val;
+
+	gettimeofday(&offset, NULL);
+
+	delta = (offset.tv_sec - t->start.tv_sec) * 1000000
+	    + (offset.tv_usec - t->start.tv_usec);
+
+	if (reset) {
+		t->start.tv_sec = offset.tv_sec;
+		t->start.tv_usec = offset.tv_usec;
+	}
+
+	return (delta);
+}
+
 static void sighandler(int signum)
 {
 	alarmed = 1;
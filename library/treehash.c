@@ -0,0 +1,354 @@
+/*
+ *  Parallel tree hashing of large buffers and files
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_TREEHASH)
+
+#include "tropicssl/treehash.h"
+#include "tropicssl/md5.h"
+#include "tropicssl/sha1.h"
+#include "tropicssl/sha2.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#if defined(TROPICSSL_FS_IO)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Shared by the hashing threads; chunks are handed out in order
+ */
+typedef struct {
+	int type;
+	const uint8_t *input;
+	size_t ilen;
+	size_t nchunks;
+	size_t next;		/* next chunk to hand out */
+	int advise;		/* input is a file mapping */
+	int threads;
+	size_t hlen;
+	uint8_t *leaves;	/* nchunks * hlen bytes */
+	pthread_mutex_t lock;
+} treehash_job;
+
+static size_t treehash_len(int type)
+{
+	switch (type) {
+	case TREEHASH_MD5:
+		return (16);
+	case TREEHASH_SHA1:
+		return (20);
+	case TREEHASH_SHA224:
+		return (28);
+	case TREEHASH_SHA256:
+		return (32);
+	}
+
+	return (0);
+}
+
+/*
+ * Output = H( prefix || input )
+ */
+static void treehash_node(int type, uint8_t prefix, const uint8_t *input,
+			  size_t ilen, uint8_t *output)
+{
+	md5_context md5_ctx;
+	sha1_context sha1_ctx;
+	sha2_context sha2_ctx;
+
+	switch (type) {
+	case TREEHASH_MD5:
+		md5_starts(&md5_ctx);
+		md5_update(&md5_ctx, &prefix, 1);
+		md5_update(&md5_ctx, input, ilen);
+		md5_finish(&md5_ctx, output);
+		memset(&md5_ctx, 0, sizeof(md5_context));
+		break;
+
+	case TREEHASH_SHA1:
+		sha1_starts(&sha1_ctx);
+		sha1_update(&sha1_ctx, &prefix, 1);
+		sha1_update(&sha1_ctx, input, ilen);
+		sha1_finish(&sha1_ctx, output);
+		memset(&sha1_ctx, 0, sizeof(sha1_context));
+		break;
+
+	default:
+		sha2_starts(&sha2_ctx, type == TREEHASH_SHA224);
+		sha2_update(&sha2_ctx, &prefix, 1);
+		sha2_update(&sha2_ctx, input, ilen);
+		sha2_finish(&sha2_ctx, output);
+		memset(&sha2_ctx, 0, sizeof(sha2_context));
+		break;
+	}
+}
+
+#if defined(TROPICSSL_FS_IO)
+static void treehash_advise(treehash_job * job, size_t chunk, int advice)
+{
+	size_t off = chunk * TREEHASH_CHUNK_SIZE, len;
+
+	if (chunk >= job->nchunks)
+		return;
+
+	len = job->ilen - off;
+	if (len > TREEHASH_CHUNK_SIZE)
+		len = TREEHASH_CHUNK_SIZE;
+
+	madvise((void *)(job->input + off), len, advice);
+}
+#endif
+
+static void *treehash_thread(void *arg)
+{
+	treehash_job *job = (treehash_job *) arg;
+	size_t i, off, len;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (i >= job->nchunks)
+			break;
+
+#if defined(TROPICSSL_FS_IO)
+		/*
+		 * The chunk this thread will most likely get next
+		 */
+		if (job->advise != 0)
+			treehash_advise(job, i + job->threads, MADV_WILLNEED);
+#endif
+
+		off = i * TREEHASH_CHUNK_SIZE;
+		len = job->ilen - off;
+		if (len > TREEHASH_CHUNK_SIZE)
+			len = TREEHASH_CHUNK_SIZE;
+
+		treehash_node(job->type, 0x00, job->input + off, len,
+			      job->leaves + i * job->hlen);
+
+#if defined(TROPICSSL_FS_IO)
+		if (job->advise != 0)
+			treehash_advise(job, i, MADV_DONTNEED);
+#endif
+	}
+
+	return (NULL);
+}
+
+static int treehash_run(int type, const uint8_t *input, size_t ilen,
+			int threads, int advise, uint8_t *output)
+{
+	treehash_job job;
+	pthread_t tid[TREEHASH_MAX_THREADS];
+	int i, n;
+
+	if ((job.hlen = treehash_len(type)) == 0)
+		return (1);
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > TREEHASH_MAX_THREADS)
+		threads = TREEHASH_MAX_THREADS;
+
+	job.type = type;
+	job.input = input;
+	job.ilen = ilen;
+	job.nchunks = (ilen + TREEHASH_CHUNK_SIZE - 1) / TREEHASH_CHUNK_SIZE;
+	job.next = 0;
+	job.advise = advise;
+
+	if ((size_t)threads > job.nchunks)
+		threads = (job.nchunks > 0) ? (int)job.nchunks : 1;
+	job.threads = threads;
+
+	job.leaves = (uint8_t *)malloc(job.nchunks * job.hlen + 1);
+	if (job.leaves == NULL)
+		return (1);
+
+	pthread_mutex_init(&job.lock, NULL);
+
+#if defined(TROPICSSL_FS_IO)
+	if (advise != 0) {
+		for (i = 0; i < threads; i++)
+			treehash_advise(&job, i, MADV_WILLNEED);
+	}
+#endif
+
+	/*
+	 * The calling thread hashes too; if a thread cannot be started
+	 * the others simply take more chunks
+	 */
+	for (n = 0; n < threads - 1; n++) {
+		if (pthread_create(&tid[n], NULL, treehash_thread, &job) != 0)
+			break;
+	}
+
+	treehash_thread(&job);
+
+	for (i = 0; i < n; i++)
+		pthread_join(tid[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+
+	treehash_node(type, 0x01, job.leaves, job.nchunks * job.hlen, output);
+
+	memset(job.leaves, 0, job.nchunks * job.hlen);
+	free(job.leaves);
+
+	return (0);
+}
+
+/*
+ * Tree digest of a buffer
+ */
+int treehash(int type, const uint8_t *input, size_t ilen,
+	     int threads, uint8_t *output)
+{
+	return (treehash_run(type, input, ilen, threads, 0, output));
+}
+
+#if defined(TROPICSSL_FS_IO)
+/*
+ * Tree digest of a file
+ */
+int treehash_file(int type, const char *path, int threads,
+		  uint8_t *output)
+{
+	int fd, ret;
+	void *map;
+	struct stat st;
+
+	if (treehash_len(type) == 0)
+		return (2);
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (1);
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return (2);
+	}
+
+	if (threads <= 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = (n > 0) ? (int)n : 1;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return (treehash_run(type, (const uint8_t *)"", 0, 1, 0,
+				     output) ? 2 : 0);
+	}
+
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return (2);
+
+	ret = treehash_run(type, (const uint8_t *)map, (size_t) st.st_size,
+			   threads, 1, output);
+
+	munmap(map, (size_t) st.st_size);
+
+	return (ret ? 2 : 0);
+}
+#endif
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include <stdio.h>
+
+/*
+ * Checkup routine: 2.5 chunks hashed on 1 and 3 threads, against the
+ * leaves and root computed by hand
+ */
+int treehash_self_test(int verbose)
+{
+	size_t len = 2 * TREEHASH_CHUNK_SIZE + TREEHASH_CHUNK_SIZE / 2, i;
+	uint8_t *buf, leaves[3 * 32], ref[32], sum[32];
+	int type, ret = 0;
+
+	if ((buf = (uint8_t *)malloc(len)) == NULL)
+		return (1);
+
+	for (i = 0; i < len; i++)
+		buf[i] = (uint8_t)(i * 31 + (i >> 12));
+
+	for (type = TREEHASH_MD5; type <= TREEHASH_SHA256; type++) {
+		size_t hlen = treehash_len(type);
+
+		if (verbose != 0)
+			printf("  Tree hash test #%d: ", type + 1);
+
+		for (i = 0; i < 3; i++)
+			treehash_node(type, 0x00, buf + i * TREEHASH_CHUNK_SIZE,
+				      (i < 2) ? TREEHASH_CHUNK_SIZE :
+				      TREEHASH_CHUNK_SIZE / 2,
+				      leaves + i * hlen);
+		treehash_node(type, 0x01, leaves, 3 * hlen, ref);
+
+		if (treehash(type, buf, len, 1, sum) != 0 ||
+		    memcmp(sum, ref, hlen) != 0 ||
+		    treehash(type, buf, len, 3, sum) != 0 ||
+		    memcmp(sum, ref, hlen) != 0) {
+			if (verbose != 0)
+				printf("failed\n");
+			ret = 1;
+			break;
+		}
+
+		if (verbose != 0)
+			printf("passed\n");
+	}
+
+	if (verbose != 0)
+		printf("\n");
+
+	free(buf);
+	return (ret);
+}
+
+#endif
+
+#endif
@@ -54,12 +54,23 @@
 #include "tropicssl/des.h"
 #include "tropicssl/md5.h"
 #include "tropicssl/sha1.h"
+#include "tropicssl/sha2.h"
+#include "tropicssl/memory.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 
+#if defined(TROPICSSL_FS_IO) && defined(TROPICSSL_X509_CRTPATH)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#endif
+
 /*
  * ASN.1 DER decoding routines
  */
@@ -88,6 +99,15 @@ static int asn1_get_len(uint8_t **p, const uint8_t *end, size_t *len)
 			(*p) += 3;
 			break;
 
+		case 3:
+			if ((end - *p) < 4)
+				return (TROPICSSL_ERR_ASN1_OUT_OF_DATA);
+
+			*len = ((size_t) (*p)[1] << 16) |
+			    ((*p)[2] << 8) | (*p)[3];
+			(*p) += 4;
+			break;
+
 		default:
 			return (TROPICSSL_ERR_ASN1_INVALID_LENGTH);
 			break;
@@ -275,19 +295,19 @@ static int x509_get_alg(uint8_t **p, const uint8_t *end, x509_buf * alg)
  *
  *	AttributeValue ::= ANY DEFINED BY AttributeType
  */
-static int x509_get_name(uint8_t **p, const uint8_t *end, x509_name * cur)
+static int x509_get_attr(uint8_t **p, const uint8_t *end, x509_name * cur)
 {
 	int ret;
 	size_t len;
-	const uint8_t *end2;
 	x509_buf *oid;
 	x509_buf *val;
 
+	cur->next = NULL;
+
 	if ((ret = asn1_get_tag(p, end, &len,
 				ASN1_CONSTRUCTED | ASN1_SET)) != 0)
 		return (TROPICSSL_ERR_X509_CERT_INVALID_NAME | ret);
 
-	end2 = end;
 	end = *p + len;
 
 	if ((ret = asn1_get_tag(p, end, &len,
@@ -326,84 +346,147 @@ static int x509_get_name(uint8_t **p, const uint8_t *end, x509_name * cur)
 	val->p = *p;
 	*p += val->len;
 
-	cur->next = NULL;
-
 	if (*p != end)
 		return (TROPICSSL_ERR_X509_CERT_INVALID_NAME |
 			TROPICSSL_ERR_ASN1_LENGTH_MISMATCH);
 
+	return (0);
+}
+
+static int x509_get_name(uint8_t **p, const uint8_t *end, x509_name * cur)
+{
+	int ret;
+
+	if ((ret = x509_get_attr(p, end, cur)) != 0)
+		return (ret);
+
 	/*
 	 * recurse until end of SEQUENCE is reached
 	 */
-	if (*p == end2)
+	if (*p == end)
 		return (0);
 
-	cur->next = (x509_name *) malloc(sizeof(x509_name));
+	cur->next = (x509_name *) memory_alloc(sizeof(x509_name));
 
 	if (cur->next == NULL)
 		return (1);
 
-	return (x509_get_name(p, end2, cur->next));
+	return (x509_get_name(p, end, cur->next));
+}
+
+/*
+ * Same checks as x509_get_name(), without keeping anything
+ */
+static int x509_skip_name(uint8_t **p, const uint8_t *end)
+{
+	int ret;
+	x509_name cur;
+
+	do {
+		if ((ret = x509_get_attr(p, end, &cur)) != 0)
+			return (ret);
+	} while (*p != end);
+
+	return (0);
+}
+
+/*
+ * Return 1 if a raw Name has the given CN, as the CN check of
+ * x509parse_verify() does over the decoded subject
+ */
+static int x509_raw_has_cn(const x509_buf * raw, const char *cn,
+			   size_t cn_len)
+{
+	size_t len;
+	uint8_t *p, *end;
+	x509_name cur;
+
+	p = raw->p;
+	end = p + raw->len;
+
+	if (asn1_get_tag(&p, end, &len, ASN1_CONSTRUCTED | ASN1_SEQUENCE) != 0)
+		return (0);
+
+	end = p + len;
+
+	while (p < end) {
+		if (x509_get_attr(&p, end, &cur) != 0)
+			return (0);
+
+		if (memcmp(cur.oid.p, OID_CN, 3) == 0 &&
+		    cur.val.len == cn_len && memcmp(cur.val.p, cn, cn_len) == 0)
+			return (1);
+	}
+
+	return (0);
 }
 
 /*
- *	Validity ::= SEQUENCE {
- *		 notBefore		Time,
- *		 notAfter		Time }
- *
  *	Time ::= CHOICE {
  *		 utcTime		UTCTime,
  *		 generalTime	GeneralizedTime }
  */
-static int x509_get_dates(uint8_t **p,
-			  const uint8_t *end, x509_time * from, x509_time * to)
+static int x509_get_time(uint8_t **p, const uint8_t *end, x509_time * t)
 {
-	int ret;
+	int ret, n, gen;
 	size_t len;
 	char date[64];
 
-	if ((ret = asn1_get_tag(p, end, &len,
-				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
-		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE | ret);
+	if ((end - *p) < 1)
+		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE |
+			TROPICSSL_ERR_ASN1_OUT_OF_DATA);
 
-	end = *p + len;
+	gen = (**p == ASN1_GENERALIZED_TIME);
 
-	/*
-	 * TODO: also handle GeneralizedTime
-	 */
-	if ((ret = asn1_get_tag(p, end, &len, ASN1_UTC_TIME)) != 0)
+	if ((ret = asn1_get_tag(p, end, &len, gen ? ASN1_GENERALIZED_TIME :
+				ASN1_UTC_TIME)) != 0)
 		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE | ret);
 
 	memset(date, 0, sizeof(date));
 	memcpy(date, *p, (len < (int)sizeof(date) - 1) ?
 	       len : (int)sizeof(date) - 1);
 
-	if (sscanf(date, "%2d%2d%2d%2d%2d%2d",
-		   &from->year, &from->mon, &from->day,
-		   &from->hour, &from->min, &from->sec) < 5)
-		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE);
+	if (gen)
+		n = sscanf(date, "%4d%2d%2d%2d%2d%2d",
+			   &t->year, &t->mon, &t->day,
+			   &t->hour, &t->min, &t->sec);
+	else {
+		n = sscanf(date, "%2d%2d%2d%2d%2d%2d",
+			   &t->year, &t->mon, &t->day,
+			   &t->hour, &t->min, &t->sec);
+
+		t->year += 100 * (t->year < 90);
+		t->year += 1900;
+	}
 
-	from->year += 100 * (from->year < 90);
-	from->year += 1900;
+	if (n < 5)
+		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE);
 
 	*p += len;
 
-	if ((ret = asn1_get_tag(p, end, &len, ASN1_UTC_TIME)) != 0)
-		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE | ret);
+	return (0);
+}
 
-	memset(date, 0, sizeof(date));
-	memcpy(date, *p, (len < (int)sizeof(date) - 1) ?
-	       len : (int)sizeof(date) - 1);
+/*
+ *	Validity ::= SEQUENCE {
+ *		 notBefore		Time,
+ *		 notAfter		Time }
+ */
+static int x509_get_dates(uint8_t **p,
+			  const uint8_t *end, x509_time * from, x509_time * to)
+{
+	int ret;
+	size_t len;
 
-	if (sscanf(date, "%2d%2d%2d%2d%2d%2d",
-		   &to->year, &to->mon, &to->day,
-		   &to->hour, &to->min, &to->sec) < 5)
-		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE);
+	if ((ret = asn1_get_tag(p, end, &len,
+				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
+		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE | ret);
 
-	to->year += 100 * (to->year < 90);
-	to->year += 1900;
+	end = *p + len;
 
-	*p += len;
+	if ((ret = x509_get_time(p, end, from)) != 0 ||
+	    (ret = x509_get_time(p, end, to)) != 0)
+		return (ret);
 
 	if (*p != end)
 		return (TROPICSSL_ERR_X509_CERT_INVALID_DATE |
@@ -643,88 +726,138 @@ static int x509_get_ext(uint8_t **p,
 /*
  * Parse one or more certificates and add them to the chained list
  */
-int x509parse_crt(x509_cert * chain, const uint8_t *buf, size_t buflen)
+/*
+ * FNV-1a over a DER name, as found in subject_raw and issuer_raw
+ */
+static unsigned long x509_name_hash(const x509_buf * name)
 {
-	int ret;
-	size_t len;
-	const uint8_t *s1, *s2;
-	uint8_t *p, *end;
-	x509_cert *crt;
+	unsigned long h = 2166136261UL;
+	size_t i;
 
-	crt = chain;
+	for (i = 0; i < name->len; i++)
+		h = ((h ^ name->p[i]) * 16777619UL) & 0xFFFFFFFFUL;
 
-	while (crt->version != 0)
-		crt = crt->next;
+	return (h);
+}
 
-	/*
-	 * check if the certificate is encoded in base64
-	 */
-	s1 = (uint8_t *)strstr((char *)buf,
-				     "-----BEGIN CERTIFICATE-----");
+/*
+ * rsa_public() computes R^2 mod N on first use; do it up front for
+ * certificates that several threads read at once
+ */
+static int x509_precompute(x509_cert * chain)
+{
+	int ret = 0;
+	x509_cert *cur;
+	rsa_context *rsa;
 
-	if (s1 != NULL) {
-		s2 = (uint8_t *)strstr((char *)buf,
-					     "-----END CERTIFICATE-----");
+	for (cur = chain; cur != NULL && cur->version != 0; cur = cur->next) {
+		rsa = &cur->rsa;
 
-		if (s2 == NULL || s2 <= s1)
-			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
+		if (rsa->RN.p != NULL)
+			continue;
 
-		s1 += 27;
-		if (*s1 == '\r')
-			s1++;
-		if (*s1 == '\n')
-			s1++;
-		else
-			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
+		MPI_CHK(mpi_lset(&rsa->RN, 1));
+		MPI_CHK(mpi_shift_l(&rsa->RN, rsa->N.n * 2 * sizeof(t_uint) * 8));
+		MPI_CHK(mpi_mod_mpi(&rsa->RN, &rsa->RN, &rsa->N));
+	}
 
-		/*
-		 * get the DER data length and decode the buffer
-		 */
-		len = 0;
-		ret = base64_decode(NULL, &len, s1, s2 - s1);
+cleanup:
 
-		if (ret == TROPICSSL_ERR_BASE64_INVALID_CHARACTER)
-			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM | ret);
+	return (ret);
+}
 
-		if ((p = (uint8_t *)malloc(len)) == NULL)
-			return (1);
+/*
+ * The Certificate message and DN list ssl_set_own_cert() and
+ * ssl_set_ca_chain() encode once: stale when the chain grows
+ */
+static void x509_encoded_free(x509_cert * chain)
+{
+	memory_free(chain->crt_msg);
+	memory_free(chain->dn_list);
 
-		if ((ret = base64_decode(p, &len, s1, s2 - s1)) != 0) {
-			free(p);
-			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM | ret);
-		}
+	chain->crt_msg = NULL;
+	chain->dn_list = NULL;
+}
 
-		/*
-		 * update the buffer size and offset
-		 */
-		s2 += 25;
-		if (*s2 == '\r')
-			s2++;
-		if (*s2 == '\n')
-			s2++;
-		else {
-			free(p);
-			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
-		}
+static void x509_index_free(x509_cert * chain)
+{
+	x509_index *idx = chain->index;
 
-		buflen -= s2 - buf;
-		buf = s2;
-	} else {
-		/*
-		 * nope, copy the raw DER data
-		 */
-		p = (uint8_t *)malloc(len = buflen);
+	if (idx == NULL)
+		return;
 
-		if (p == NULL)
-			return (1);
+	free(idx->hash);
+	free(idx->slot);
+	free(idx);
 
-		memcpy(p, buf, buflen);
+	chain->index = NULL;
+}
 
-		buflen = 0;
+/*
+ * Build the subject index; certificates sharing a subject keep
+ * their chain order, which is the order verification tries them in
+ */
+int x509parse_index(x509_cert * chain)
+{
+	size_t n, count, i;
+	unsigned long h;
+	x509_index *idx;
+	x509_cert *cur;
+
+	x509_index_free(chain);
+
+	count = 0;
+	for (cur = chain; cur != NULL && cur->version != 0; cur = cur->next)
+		count++;
+
+	for (n = 2; n < 2 * count; n <<= 1) ;
+
+	/*
+	 * Shared by every thread, so from the heap rather than an arena
+	 */
+	if ((idx = (x509_index *) malloc(sizeof(x509_index))) == NULL)
+		return (1);
+
+	idx->hash = (unsigned long *)malloc(n * sizeof(unsigned long));
+	idx->slot = (x509_cert **) malloc(n * sizeof(x509_cert *));
+
+	if (idx->hash == NULL || idx->slot == NULL) {
+		free(idx->hash);
+		free(idx->slot);
+		free(idx);
+		return (1);
+	}
+
+	memset(idx->slot, 0, n * sizeof(x509_cert *));
+	idx->mask = n - 1;
+
+	for (cur = chain; cur != NULL && cur->version != 0; cur = cur->next) {
+		h = x509_name_hash(&cur->subject_raw);
+
+		for (i = h & idx->mask; idx->slot[i] != NULL;
+		     i = (i + 1) & idx->mask) ;
+
+		idx->hash[i] = h;
+		idx->slot[i] = cur;
 	}
 
+	chain->index = idx;
+
+	return (x509_precompute(chain) != 0);
+}
+
+/*
+ * Parse one DER certificate into crt, the empty node at the end of a
+ * chain; crt owns p from then on, whether parsing succeeds or not
+ */
+static int x509_parse_der(x509_cert * crt, uint8_t *p, size_t len, int lazy)
+{
+	int ret;
+	uint8_t *end;
+
 	crt->raw.p = p;
 	crt->raw.len = len;
+	crt->lazy = lazy;
 	end = p + len;
 
 	/*
@@ -802,7 +935,12 @@ int x509parse_crt(x509_cert * chain, const uint8_t *buf, size_t buflen)
 		return (TROPICSSL_ERR_X509_CERT_INVALID_FORMAT | ret);
 	}
 
-	if ((ret = x509_get_name(&p, p + len, &crt->issuer)) != 0) {
+	if (lazy)
+		ret = x509_skip_name(&p, p + len);
+	else
+		ret = x509_get_name(&p, p + len, &crt->issuer);
+
+	if (ret != 0) {
 		x509_free(crt);
 		return (ret);
 	}
@@ -832,7 +970,12 @@ int x509parse_crt(x509_cert * chain, const uint8_t *buf, size_t buflen)
 		return (TROPICSSL_ERR_X509_CERT_INVALID_FORMAT | ret);
 	}
 
-	if ((ret = x509_get_name(&p, p + len, &crt->subject)) != 0) {
+	if (lazy)
+		ret = x509_skip_name(&p, p + len);
+	else
+		ret = x509_get_name(&p, p + len, &crt->subject);
+
+	if (ret != 0) {
 		x509_free(crt);
 		return (ret);
 	}
@@ -929,62 +1072,523 @@ int x509parse_crt(x509_cert * chain, const uint8_t *buf, size_t buflen)
 			TROPICSSL_ERR_ASN1_LENGTH_MISMATCH);
 	}
 
-	crt->next = (x509_cert *) malloc(sizeof(x509_cert));
+	crt->next = (x509_cert *) memory_alloc(sizeof(x509_cert));
 
 	if (crt->next == NULL) {
 		x509_free(crt);
 		return (1);
 	}
 
-	crt = crt->next;
-	memset(crt, 0, sizeof(x509_cert));
-
-	if (buflen > 0)
-		return (x509parse_crt(crt, buf, buflen));
+	memset(crt->next, 0, sizeof(x509_cert));
 
 	return (0);
 }
 
-#if defined(TROPICSSL_FS_IO)
-/*
- * Load one or more certificates and add them to the chained list
- */
-int x509parse_crtfile(x509_cert * chain, const char *path)
+static int x509_parse_crt(x509_cert * chain, const uint8_t *buf,
+			  size_t buflen, int lazy)
 {
 	int ret;
-	FILE *f;
-	size_t n;
-	uint8_t *buf;
-
-	if ((f = fopen(path, "rb")) == NULL)
-		return (1);
+	size_t len;
+	const uint8_t *s1, *s2;
+	uint8_t *p;
+	x509_cert *crt;
 
-	fseek(f, 0, SEEK_END);
-	n = (size_t) ftell(f);
-	fseek(f, 0, SEEK_SET);
+	x509_index_free(chain);
+	x509_encoded_free(chain);
 
-	if ((buf = (uint8_t *)malloc(n + 1)) == NULL)
-		return (1);
+	crt = chain;
 
-	if (fread(buf, 1, n, f) != n) {
-		fclose(f);
-		free(buf);
-		return (1);
-	}
+	while (crt->version != 0)
+		crt = crt->next;
 
-	buf[n] = '\0';
+	/*
+	 * check if the certificate is encoded in base64
+	 */
+	s1 = (uint8_t *)strstr((char *)buf,
+				     "-----BEGIN CERTIFICATE-----");
 
-	ret = x509parse_crt(chain, buf, (int)n);
+	if (s1 != NULL) {
+		s2 = (uint8_t *)strstr((char *)buf,
+					     "-----END CERTIFICATE-----");
 
-	memset(buf, 0, n + 1);
-	free(buf);
-	fclose(f);
+		if (s2 == NULL || s2 <= s1)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
 
-	return (ret);
-}
-#endif
+		s1 += 27;
+		if (*s1 == '\r')
+			s1++;
+		if (*s1 == '\n')
+			s1++;
+		else
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
 
-#if defined(TROPICSSL_DES)
+		/*
+		 * get the DER data length and decode the buffer
+		 */
+		len = 0;
+		ret = base64_decode(NULL, &len, s1, s2 - s1);
+
+		if (ret == TROPICSSL_ERR_BASE64_INVALID_CHARACTER)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM | ret);
+
+		if ((p = (uint8_t *)memory_alloc(len)) == NULL)
+			return (1);
+
+		if ((ret = base64_decode(p, &len, s1, s2 - s1)) != 0) {
+			memory_free(p);
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM | ret);
+		}
+
+		/*
+		 * update the buffer size and offset
+		 */
+		s2 += 25;
+		if (*s2 == '\r')
+			s2++;
+		if (*s2 == '\n')
+			s2++;
+		else {
+			memory_free(p);
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
+		}
+
+		buflen -= s2 - buf;
+		buf = s2;
+	} else {
+		/*
+		 * nope, copy the raw DER data
+		 */
+		p = (uint8_t *)memory_alloc(len = buflen);
+
+		if (p == NULL)
+			return (1);
+
+		memcpy(p, buf, buflen);
+
+		buflen = 0;
+	}
+
+	if ((ret = x509_parse_der(crt, p, len, lazy)) != 0)
+		return (ret);
+
+	if (buflen > 0)
+		return (x509_parse_crt(crt->next, buf, buflen, lazy));
+
+	return (0);
+}
+
+int x509parse_crt(x509_cert * chain, const uint8_t *buf, size_t buflen)
+{
+	return (x509_parse_crt(chain, buf, buflen, 0));
+}
+
+int x509parse_crt_lazy(x509_cert * chain, const uint8_t *buf, size_t buflen)
+{
+	return (x509_parse_crt(chain, buf, buflen, 1));
+}
+
+#if (defined(TROPICSSL_FS_IO) && defined(TROPICSSL_X509_CRTPATH)) || \
+    defined(TROPICSSL_X509_CRL)
+/*
+ * strstr() for data that need not be NUL-terminated
+ */
+static const uint8_t *x509_memstr(const uint8_t *p, const uint8_t *end,
+				  const char *str)
+{
+	size_t n = strlen(str);
+
+	while ((size_t)(end - p) >= n) {
+		if ((p = memchr(p, str[0], (end - p) - n + 1)) == NULL)
+			return (NULL);
+
+		if (memcmp(p, str, n) == 0)
+			return (p);
+
+		p++;
+	}
+
+	return (NULL);
+}
+#endif
+
+#if defined(TROPICSSL_FS_IO)
+/*
+ * Load one or more certificates and add them to the chained list
+ */
+int x509parse_crtfile(x509_cert * chain, const char *path)
+{
+	int ret;
+	FILE *f;
+	size_t n;
+	uint8_t *buf;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		return (1);
+
+	fseek(f, 0, SEEK_END);
+	n = (size_t) ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	if ((buf = (uint8_t *)memory_alloc(n + 1)) == NULL)
+		return (1);
+
+	if (fread(buf, 1, n, f) != n) {
+		fclose(f);
+		memory_free(buf);
+		return (1);
+	}
+
+	buf[n] = '\0';
+
+	ret = x509parse_crt(chain, buf, (int)n);
+
+	memset(buf, 0, n + 1);
+	memory_free(buf);
+	fclose(f);
+
+	return (ret);
+}
+
+#if defined(TROPICSSL_X509_CRTPATH)
+#define PEM_BEGIN_CRT   "-----BEGIN CERTIFICATE-----"
+#define PEM_END_CRT     "-----END CERTIFICATE-----"
+
+/*
+ * A certificate, PEM body or DER, inside a mapped file
+ */
+typedef struct {
+	const uint8_t *p;
+	size_t len;
+	int pem;
+} x509_block;
+
+typedef struct {
+	void *p;
+	size_t len;
+} x509_map;
+
+typedef struct {
+	x509_block *blocks;
+	size_t count, max;
+	x509_map *maps;
+	size_t nmaps, maxmaps;
+} x509_bundle;
+
+/*
+ * Blocks [first, first + count) parsed into chain by one thread
+ */
+typedef struct {
+	const x509_block *blocks;
+	size_t count;
+	x509_cert *chain;
+	int ret;
+	int started;
+	pthread_t thread;
+} x509_load_job;
+
+static int x509_bundle_add(x509_bundle * b, const uint8_t *p, size_t len,
+			   int pem)
+{
+	x509_block *blocks;
+
+	if (b->count == b->max) {
+		b->max = (b->max != 0) ? b->max * 2 : 64;
+		blocks = (x509_block *) realloc(b->blocks,
+						b->max * sizeof(x509_block));
+		if (blocks == NULL)
+			return (1);
+
+		b->blocks = blocks;
+	}
+
+	b->blocks[b->count].p = p;
+	b->blocks[b->count].len = len;
+	b->blocks[b->count].pem = pem;
+	b->count++;
+
+	return (0);
+}
+
+/*
+ * Map a file and list its PEM certificates; a file without any is
+ * taken as a single DER certificate
+ */
+static int x509_bundle_map(x509_bundle * b, const char *path)
+{
+	int fd, ret;
+	void *map;
+	x509_map *maps;
+	struct stat st;
+	const uint8_t *p, *s1, *s2, *end;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (1);
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return (1);
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return (0);
+	}
+
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return (1);
+
+	if (b->nmaps == b->maxmaps) {
+		b->maxmaps = (b->maxmaps != 0) ? b->maxmaps * 2 : 16;
+		maps = (x509_map *) realloc(b->maps,
+					    b->maxmaps * sizeof(x509_map));
+		if (maps == NULL) {
+			munmap(map, (size_t) st.st_size);
+			return (1);
+		}
+
+		b->maps = maps;
+	}
+
+	b->maps[b->nmaps].p = map;
+	b->maps[b->nmaps].len = (size_t) st.st_size;
+	b->nmaps++;
+
+	p = (const uint8_t *)map;
+	end = p + st.st_size;
+
+	if (x509_memstr(p, end, PEM_BEGIN_CRT) == NULL)
+		return (x509_bundle_add(b, p, end - p, 0));
+
+	while ((s1 = x509_memstr(p, end, PEM_BEGIN_CRT)) != NULL) {
+		s1 += sizeof(PEM_BEGIN_CRT) - 1;
+		if (s1 < end && *s1 == '\r')
+			s1++;
+		if (s1 == end || *s1++ != '\n')
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
+
+		if ((s2 = x509_memstr(s1, end, PEM_END_CRT)) == NULL)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM);
+
+		if ((ret = x509_bundle_add(b, s1, s2 - s1, 1)) != 0)
+			return (ret);
+
+		p = s2 + sizeof(PEM_END_CRT) - 1;
+	}
+
+	return (0);
+}
+
+static void x509_bundle_free(x509_bundle * b)
+{
+	size_t i;
+
+	for (i = 0; i < b->nmaps; i++)
+		munmap(b->maps[i].p, b->maps[i].len);
+
+	free(b->maps);
+	free(b->blocks);
+	memset(b, 0, sizeof(x509_bundle));
+}
+
+static int x509_load_block(x509_cert * crt, const x509_block * blk)
+{
+	int ret;
+	size_t len;
+	uint8_t *p;
+
+	len = 0;
+
+	if (blk->pem) {
+		ret = base64_decode(NULL, &len, blk->p, blk->len);
+
+		if (ret == TROPICSSL_ERR_BASE64_INVALID_CHARACTER)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM | ret);
+	} else
+		len = blk->len;
+
+	if ((p = (uint8_t *)memory_alloc(len)) == NULL)
+		return (1);
+
+	if (blk->pem) {
+		if ((ret = base64_decode(p, &len, blk->p, blk->len)) != 0) {
+			memory_free(p);
+			return (TROPICSSL_ERR_X509_CERT_INVALID_PEM | ret);
+		}
+	} else
+		memcpy(p, blk->p, len);
+
+	return (x509_parse_der(crt, p, len, 0));
+}
+
+static void *x509_load_thread(void *arg)
+{
+	x509_load_job *job = (x509_load_job *) arg;
+	x509_cert *crt = job->chain;
+	size_t i;
+
+	for (i = 0; i < job->count; i++) {
+		if ((job->ret = x509_load_block(crt, &job->blocks[i])) != 0)
+			break;
+
+		crt = crt->next;
+	}
+
+	return (NULL);
+}
+
+static int x509_bundle_load(x509_bundle * b, const char *path)
+{
+	int ret = 0, n, i;
+	struct stat st;
+	struct dirent **names;
+	char *file;
+	size_t len;
+
+	if (stat(path, &st) != 0)
+		return (1);
+
+	if (!S_ISDIR(st.st_mode))
+		return (x509_bundle_map(b, path));
+
+	if ((n = scandir(path, &names, NULL, alphasort)) < 0)
+		return (1);
+
+	for (i = 0; i < n; i++) {
+		len = strlen(path) + strlen(names[i]->d_name) + 2;
+
+		if (ret == 0 && names[i]->d_name[0] != '.') {
+			if ((file = (char *)malloc(len)) == NULL)
+				ret = 1;
+			else {
+				snprintf(file, len, "%s/%s", path,
+					 names[i]->d_name);
+
+				if (stat(file, &st) == 0 && S_ISREG(st.st_mode))
+					ret = x509_bundle_map(b, file);
+
+				free(file);
+			}
+		}
+
+		free(names[i]);
+	}
+
+	free(names);
+
+	return (ret);
+}
+
+int x509parse_crtpath(x509_cert * chain, const char *path, int threads)
+{
+	int ret, i;
+	size_t first, count;
+	x509_bundle b;
+	x509_load_job *jobs;
+	x509_cert *tail, *next;
+
+	memset(&b, 0, sizeof(x509_bundle));
+
+	if ((ret = x509_bundle_load(&b, path)) != 0 || b.count == 0) {
+		x509_bundle_free(&b);
+		return (ret);
+	}
+
+	if (threads < 1)
+		threads = 1;
+	if ((size_t) threads > b.count)
+		threads = (int)b.count;
+
+	if ((jobs = (x509_load_job *) malloc(threads *
+					     sizeof(x509_load_job))) == NULL) {
+		x509_bundle_free(&b);
+		return (1);
+	}
+
+	x509_index_free(chain);
+	x509_encoded_free(chain);
+
+	tail = chain;
+	while (tail->version != 0)
+		tail = tail->next;
+
+	/*
+	 * The first job parses straight into the chain, on this thread;
+	 * the others into chains of their own, spliced on afterwards
+	 */
+	for (i = 0, first = 0; i < threads; i++, first += count) {
+		count = (b.count * (i + 1)) / threads - first;
+
+		jobs[i].blocks = b.blocks + first;
+		jobs[i].count = count;
+		jobs[i].ret = 0;
+		jobs[i].started = 0;
+		jobs[i].chain = tail;
+
+		if (i == 0)
+			continue;
+
+		jobs[i].chain = (x509_cert *) memory_alloc(sizeof(x509_cert));
+
+		if (jobs[i].chain == NULL) {
+			jobs[i].ret = 1;
+			continue;
+		}
+
+		memset(jobs[i].chain, 0, sizeof(x509_cert));
+
+		jobs[i].started = (pthread_create(&jobs[i].thread, NULL,
+						  x509_load_thread,
+						  &jobs[i]) == 0);
+	}
+
+	/*
+	 * Jobs whose thread could not start run here as well
+	 */
+	for (i = 0; i < threads; i++) {
+		if (jobs[i].started == 0 && jobs[i].chain != NULL)
+			x509_load_thread(&jobs[i]);
+	}
+
+	for (i = 1; i < threads; i++) {
+		if (jobs[i].started != 0)
+			pthread_join(jobs[i].thread, NULL);
+	}
+
+	/*
+	 * Splice the chains in order, up to the first error
+	 */
+	ret = jobs[0].ret;
+
+	for (i = 1; i < threads; i++) {
+		while (tail->version != 0)
+			tail = tail->next;
+
+		next = jobs[i].chain;
+
+		if (ret == 0 && next != NULL && next->version != 0) {
+			memcpy(tail, next, sizeof(x509_cert));
+			memset(next, 0, sizeof(x509_cert));
+			ret = jobs[i].ret;
+		} else if (ret == 0)
+			ret = jobs[i].ret;
+		else if (next != NULL)
+			x509_free(next);
+
+		memory_free(next);
+	}
+
+	free(jobs);
+	x509_bundle_free(&b);
+
+	return (ret);
+}
+#endif
+#endif
+
+#if defined(TROPICSSL_DES)
 /*
  * Read a 16-byte hex string and convert it to binary
  */
@@ -1120,11 +1724,11 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 		if (ret == TROPICSSL_ERR_BASE64_INVALID_CHARACTER)
 			return (ret | TROPICSSL_ERR_X509_KEY_INVALID_PEM);
 
-		if ((buf = (uint8_t *)malloc(len)) == NULL)
+		if ((buf = (uint8_t *)memory_alloc(len)) == NULL)
 			return (1);
 
 		if ((ret = base64_decode(buf, &len, s1, s2 - s1)) != 0) {
-			free(buf);
+			memory_free(buf);
 			return (ret | TROPICSSL_ERR_X509_KEY_INVALID_PEM);
 		}
 
@@ -1133,7 +1737,7 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 		if (enc != 0) {
 #if defined(TROPICSSL_DES)
 			if (pwd == NULL) {
-				free(buf);
+				memory_free(buf);
 				return
 				    (TROPICSSL_ERR_X509_KEY_PASSWORD_REQUIRED);
 			}
@@ -1142,7 +1746,7 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 
 			if (buf[0] != 0x30 || buf[1] != 0x82 ||
 			    buf[4] != 0x02 || buf[5] != 0x01) {
-				free(buf);
+				memory_free(buf);
 				return
 				    (TROPICSSL_ERR_X509_KEY_PASSWORD_MISMATCH);
 			}
@@ -1176,7 +1780,7 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 	if ((ret = asn1_get_tag(&p, end, &len,
 				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0) {
 		if (s1 != NULL)
-			free(buf);
+			memory_free(buf);
 
 		rsa_free(rsa);
 		return (TROPICSSL_ERR_X509_KEY_INVALID_FORMAT | ret);
@@ -1186,7 +1790,7 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 
 	if ((ret = asn1_get_int(&p, end, &rsa->ver)) != 0) {
 		if (s1 != NULL)
-			free(buf);
+			memory_free(buf);
 
 		rsa_free(rsa);
 		return (TROPICSSL_ERR_X509_KEY_INVALID_FORMAT | ret);
@@ -1194,7 +1798,7 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 
 	if (rsa->ver != 0) {
 		if (s1 != NULL)
-			free(buf);
+			memory_free(buf);
 
 		rsa_free(rsa);
 		return (ret | TROPICSSL_ERR_X509_KEY_INVALID_VERSION);
@@ -1209,7 +1813,7 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 	    (ret = asn1_get_mpi(&p, end, &rsa->DQ)) != 0 ||
 	    (ret = asn1_get_mpi(&p, end, &rsa->QP)) != 0) {
 		if (s1 != NULL)
-			free(buf);
+			memory_free(buf);
 
 		rsa_free(rsa);
 		return (ret | TROPICSSL_ERR_X509_KEY_INVALID_FORMAT);
@@ -1219,23 +1823,24 @@ int x509parse_key(rsa_context * rsa, const uint8_t *key, size_t keylen,
 
 	if (p != end) {
 		if (s1 != NULL)
-			free(buf);
+			memory_free(buf);
 
 		rsa_free(rsa);
 		return (TROPICSSL_ERR_X509_KEY_INVALID_FORMAT |
 			TROPICSSL_ERR_ASN1_LENGTH_MISMATCH);
 	}
 
-	if ((ret = rsa_check_privkey(rsa)) != 0) {
+	if ((ret = rsa_check_privkey(rsa)) != 0 ||
+	    (ret = rsa_precompute(rsa)) != 0) {
 		if (s1 != NULL)
-			free(buf);
+			memory_free(buf);
 
 		rsa_free(rsa);
 		return (ret);
 	}
 
 	if (s1 != NULL)
-		free(buf);
+		memory_free(buf);
 
 	return (0);
 }
@@ -1258,12 +1863,12 @@ int x509parse_keyfile(rsa_context * rsa, const char *path, const char *pwd)
 	n = (size_t) ftell(f);
 	fseek(f, 0, SEEK_SET);
 
-	if ((buf = (uint8_t *)malloc(n + 1)) == NULL)
+	if ((buf = (uint8_t *)memory_alloc(n + 1)) == NULL)
 		return (1);
 
 	if (fread(buf, 1, n, f) != n) {
 		fclose(f);
-		free(buf);
+		memory_free(buf);
 		return (1);
 	}
 
@@ -1276,7 +1881,7 @@ int x509parse_keyfile(rsa_context * rsa, const char *path, const char *pwd)
 				    (uint8_t *)pwd, strlen(pwd));
 
 	memset(buf, 0, n + 1);
-	free(buf);
+	memory_free(buf);
 	fclose(f);
 
 	return (ret);
@@ -1291,7 +1896,46 @@ int x509parse_keyfile(rsa_context * rsa, const char *path, const char *pwd)
  * Store the name in printable form into buf; no more
  * than (end - buf) characters will be written
  */
-int x509parse_dn_gets(char *buf, char *end, const x509_name * dn)
+int x509parse_dn(const x509_buf * raw, x509_name * dn)
+{
+	int ret;
+	size_t len;
+	uint8_t *p, *end;
+
+	memset(dn, 0, sizeof(x509_name));
+
+	p = raw->p;
+	end = p + raw->len;
+
+	if ((ret = asn1_get_tag(&p, end, &len,
+				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
+		return (TROPICSSL_ERR_X509_CERT_INVALID_NAME | ret);
+
+	if ((ret = x509_get_name(&p, p + len, dn)) != 0) {
+		x509_name_free(dn);
+		return (ret);
+	}
+
+	return (0);
+}
+
+void x509_name_free(x509_name * dn)
+{
+	x509_name *name_cur;
+	x509_name *name_prv;
+
+	name_cur = dn->next;
+	while (name_cur != NULL) {
+		name_prv = name_cur;
+		name_cur = name_cur->next;
+		memset(name_prv, 0, sizeof(x509_name));
+		memory_free(name_prv);
+	}
+
+	memset(dn, 0, sizeof(x509_name));
+}
+
+int x509parse_dn_gets(char *buf, char *end, const x509_name * dn)
 {
 	int i;
 	uint8_t c;
@@ -1380,6 +2024,18 @@ char *x509parse_cert_info(char *prefix, const x509_cert * crt)
 	size_t n;
 	char *p, *end;
 	static char buf[1024];
+	x509_name issuer, subject;
+	const x509_name *pi, *ps;
+
+	pi = &crt->issuer;
+	ps = &crt->subject;
+
+	if (crt->lazy) {
+		pi = (x509parse_dn(&crt->issuer_raw, &issuer) == 0) ?
+		    &issuer : NULL;
+		ps = (x509parse_dn(&crt->subject_raw, &subject) == 0) ?
+		    &subject : NULL;
+	}
 
 	p = buf;
 	end = buf + sizeof(buf) - 1;
@@ -1396,10 +2052,15 @@ char *x509parse_cert_info(char *prefix, const x509_cert * crt)
 			      crt->serial.p[i], (i < n - 1) ? ":" : "");
 
 	p += snprintf(p, end - p, "\n%sissuer	name  : ", prefix);
-	p += x509parse_dn_gets(p, end, &crt->issuer);
+	p += x509parse_dn_gets(p, end, pi);
 
 	p += snprintf(p, end - p, "\n%ssubject name  : ", prefix);
-	p += x509parse_dn_gets(p, end, &crt->subject);
+	p += x509parse_dn_gets(p, end, ps);
+
+	if (pi == &issuer)
+		x509_name_free(&issuer);
+	if (ps == &subject)
+		x509_name_free(&subject);
 
 	p += snprintf(p, end - p, "\n%sissued	on	  : "
 		      "%04d-%02d-%02d %02d:%02d:%02d", prefix,
@@ -1474,219 +2135,1523 @@ static void x509_hash(const uint8_t *in, size_t len, int alg, uint8_t *out)
 	case RSA_SHA1:
 		sha1(in, len, out);
 		break;
+#if defined(TROPICSSL_SHA2)
+	case RSA_SHA256:
+		sha2(in, len, out, 0);
+		break;
+#endif
 	default:
 		memset(out, '\xFF', len);
 		break;
 	}
 }
 
-/*
- * Verify the certificate validity
- */
-int x509parse_verify(x509_cert * crt,
-		     x509_cert * trust_ca, const char *cn, int *flags)
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+
+#if defined(WIN32)
+#define X509_VCACHE_LOCK(c)     EnterCriticalSection(&(c)->lock)
+#define X509_VCACHE_UNLOCK(c)   LeaveCriticalSection(&(c)->lock)
+#else
+#define X509_VCACHE_LOCK(c)     pthread_mutex_lock(&(c)->lock)
+#define X509_VCACHE_UNLOCK(c)   pthread_mutex_unlock(&(c)->lock)
+#endif
+
+int x509_vcache_init(x509_vcache * cache, size_t max, int timeout)
 {
-	int cn_len;
-	int hash_id;
-	int pathlen;
-	x509_cert *cur;
-	x509_name *name;
-	uint8_t hash[20];
+	size_t n;
 
-	*flags = x509parse_expired(crt);
+	memset(cache, 0, sizeof(x509_vcache));
 
-	if (cn != NULL) {
-		name = &crt->subject;
-		cn_len = strlen(cn);
+	for (n = 1; n * X509_VCACHE_WAYS < max; n <<= 1) ;
 
-		while (name != NULL) {
-			if (memcmp(name->oid.p, OID_CN, 3) == 0 &&
-			    memcmp(name->val.p, cn, cn_len) == 0 &&
-			    name->val.len == cn_len)
-				break;
+	/*
+	 * Like the session cache, this outlives any one connection
+	 */
+	cache->table = (x509_vcache_entry *)
+	    malloc(n * X509_VCACHE_WAYS * sizeof(x509_vcache_entry));
 
-			name = name->next;
-		}
+	if (cache->table == NULL)
+		return (1);
 
-		if (name == NULL)
-			*flags |= BADCERT_CN_MISMATCH;
-	}
+	memset(cache->table, 0, n * X509_VCACHE_WAYS *
+	       sizeof(x509_vcache_entry));
+	cache->mask = n - 1;
+	cache->timeout = timeout;
 
-	*flags |= BADCERT_NOT_TRUSTED;
+#if defined(WIN32)
+	InitializeCriticalSection(&cache->lock);
+#else
+	pthread_mutex_init(&cache->lock, NULL);
+#endif
 
-	/*
-	 * Iterate upwards in the given cert chain,
-	 * ignoring any upper cert with CA != TRUE.
-	 */
-	cur = crt->next;
+	return (0);
+}
 
-	pathlen = 1;
+void x509_set_verify_cache(x509_cert * trust_ca, x509_vcache * cache)
+{
+	trust_ca->vcache = cache;
+}
 
-	while (cur->version != 0) {
-		if (cur->ca_istrue == 0 ||
-		    crt->issuer_raw.len != cur->subject_raw.len ||
-		    memcmp(crt->issuer_raw.p, cur->subject_raw.p,
-			   crt->issuer_raw.len) != 0) {
-			cur = cur->next;
-			continue;
-		}
+void x509_vcache_flush(x509_vcache * cache)
+{
+	if (cache == NULL || cache->table == NULL)
+		return;
 
-		hash_id = crt->sig_oid1.p[8];
+	X509_VCACHE_LOCK(cache);
+	memset(cache->table, 0, (cache->mask + 1) * X509_VCACHE_WAYS *
+	       sizeof(x509_vcache_entry));
+	X509_VCACHE_UNLOCK(cache);
+}
 
-		x509_hash(crt->tbs.p, crt->tbs.len, hash_id, hash);
+void x509_vcache_free(x509_vcache * cache)
+{
+	if (cache->table == NULL)
+		return;
 
-		if (rsa_pkcs1_verify(&cur->rsa, RSA_PUBLIC, hash_id,
-				     0, hash, crt->sig.p) != 0)
-			return (TROPICSSL_ERR_X509_CERT_VERIFY_FAILED);
+	free(cache->table);
 
-		pathlen++;
+#if defined(WIN32)
+	DeleteCriticalSection(&cache->lock);
+#else
+	pthread_mutex_destroy(&cache->lock);
+#endif
 
-		crt = cur;
-		cur = crt->next;
+	memset(cache, 0, sizeof(x509_vcache));
+}
+
+/*
+ * The key covers every certificate the peer presented, each one
+ * prefixed with its length; the CA chain is implied by the cache.
+ */
+static void x509_vcache_digest(const x509_cert * crt, uint8_t digest[32])
+{
+	sha2_context ctx;
+	uint8_t len[4];
+
+	sha2_starts(&ctx, 0);
+
+	while (crt != NULL && crt->version != 0) {
+		len[0] = (uint8_t)(crt->raw.len >> 24);
+		len[1] = (uint8_t)(crt->raw.len >> 16);
+		len[2] = (uint8_t)(crt->raw.len >> 8);
+		len[3] = (uint8_t)(crt->raw.len);
+
+		sha2_update(&ctx, len, 4);
+		sha2_update(&ctx, crt->raw.p, crt->raw.len);
+		crt = crt->next;
 	}
 
-	/*
-	 * Atempt to validate topmost cert with our CA chain.
-	 */
-	while (trust_ca->version != 0) {
-		if (crt->issuer_raw.len != trust_ca->subject_raw.len ||
-		    memcmp(crt->issuer_raw.p, trust_ca->subject_raw.p,
-			   crt->issuer_raw.len) != 0) {
-			trust_ca = trust_ca->next;
-			continue;
-		}
+	sha2_finish(&ctx, digest);
+	memset(&ctx, 0, sizeof(sha2_context));
+}
 
-		if (trust_ca->max_pathlen > 0 &&
-		    trust_ca->max_pathlen < pathlen)
-			break;
+static x509_vcache_entry *x509_vcache_set(x509_vcache * cache,
+					  const uint8_t digest[32])
+{
+	size_t i;
 
-		hash_id = crt->sig_oid1.p[8];
+	i = (((size_t) digest[0] << 8) | digest[1]) & cache->mask;
 
-		x509_hash(crt->tbs.p, crt->tbs.len, hash_id, hash);
+	return (&cache->table[i * X509_VCACHE_WAYS]);
+}
 
-		if (rsa_pkcs1_verify(&trust_ca->rsa, RSA_PUBLIC, hash_id,
-				     0, hash, crt->sig.p) == 0) {
-			/*
-			 * cert. is signed by a trusted CA
-			 */
-			*flags &= ~BADCERT_NOT_TRUSTED;
+/*
+ * Return 1 if the chain was verified less than timeout seconds ago
+ */
+static int x509_vcache_get(x509_vcache * cache, const uint8_t digest[32])
+{
+	x509_vcache_entry *e;
+	time_t now = time(NULL);
+	int i, found = 0;
+
+	X509_VCACHE_LOCK(cache);
+
+	e = x509_vcache_set(cache, digest);
+
+	for (i = 0; i < X509_VCACHE_WAYS; i++, e++) {
+		if (e->expires != 0 && e->expires > now &&
+		    memcmp(e->digest, digest, 32) == 0) {
+			found = 1;
 			break;
 		}
-
-		trust_ca = trust_ca->next;
 	}
 
-	if (*flags != 0)
-		return (TROPICSSL_ERR_X509_CERT_VERIFY_FAILED);
+	if (found)
+		cache->hits++;
+	else
+		cache->misses++;
 
-	return (0);
+	X509_VCACHE_UNLOCK(cache);
+
+	return (found);
 }
 
 /*
- * Unallocate all certificate data
+ * Store a verified chain over the entry of its set that expires first
  */
-void x509_free(x509_cert * crt)
+static void x509_vcache_put(x509_vcache * cache, const uint8_t digest[32])
 {
-	x509_cert *cert_cur = crt;
-	x509_cert *cert_prv;
-	x509_name *name_cur;
-	x509_name *name_prv;
+	x509_vcache_entry *e, *victim;
+	int i;
 
-	if (crt == NULL)
-		return;
+	X509_VCACHE_LOCK(cache);
 
-	do {
-		rsa_free(&cert_cur->rsa);
+	e = victim = x509_vcache_set(cache, digest);
 
-		name_cur = cert_cur->issuer.next;
-		while (name_cur != NULL) {
-			name_prv = name_cur;
-			name_cur = name_cur->next;
-			memset(name_prv, 0, sizeof(x509_name));
-			free(name_prv);
+	for (i = 0; i < X509_VCACHE_WAYS; i++, e++) {
+		if (memcmp(e->digest, digest, 32) == 0) {
+			victim = e;
+			break;
 		}
 
-		name_cur = cert_cur->subject.next;
-		while (name_cur != NULL) {
-			name_prv = name_cur;
-			name_cur = name_cur->next;
-			memset(name_prv, 0, sizeof(x509_name));
-			free(name_prv);
-		}
+		if (e->expires < victim->expires)
+			victim = e;
+	}
 
-		if (cert_cur->raw.p != NULL) {
-			memset(cert_cur->raw.p, 0, cert_cur->raw.len);
-			free(cert_cur->raw.p);
-		}
+	memcpy(victim->digest, digest, 32);
+	victim->expires = time(NULL) + cache->timeout;
 
-		cert_cur = cert_cur->next;
-	} while (cert_cur != NULL);
+	X509_VCACHE_UNLOCK(cache);
+}
 
-	cert_cur = crt;
-	do {
-		cert_prv = cert_cur;
-		cert_cur = cert_cur->next;
+#endif
 
-		memset(cert_prv, 0, sizeof(x509_cert));
-		if (cert_prv != crt)
-			free(cert_prv);
-	} while (cert_cur != NULL);
-}
+#if defined(TROPICSSL_X509_CRL)
 
-#if defined(TROPICSSL_SELF_TEST)
+#define PEM_BEGIN_CRL   "-----BEGIN X509 CRL-----"
+#define PEM_END_CRL     "-----END X509 CRL-----"
 
-#include "tropicssl/certs.h"
+#if defined(WIN32)
+#define X509_CRL_LOCK(s)        EnterCriticalSection(&(s)->lock)
+#define X509_CRL_UNLOCK(s)      LeaveCriticalSection(&(s)->lock)
+#else
+#define X509_CRL_LOCK(s)        pthread_mutex_lock(&(s)->lock)
+#define X509_CRL_UNLOCK(s)      pthread_mutex_unlock(&(s)->lock)
+#endif
 
 /*
- * Checkup routine
+ * A revoked serial number, keyed by its issuer and value
  */
-int x509_self_test(int verbose)
+typedef struct {
+	unsigned long hash;
+	const uint8_t *serial;	/* NULL if the slot is empty       */
+	size_t len;
+	const x509_crl *crl;	/* where it is listed              */
+} x509_revoked_slot;
+
+struct _x509_revoked {
+	x509_crl crl;		/* the lists the index points into */
+	x509_revoked_slot *slot;
+	size_t mask;		/* number of slots - 1             */
+	int refs;		/* the store's and verifications'  */
+};
+
+/*
+ * The RSA hash of a CRL signature: same OIDs as for certificates,
+ * plus sha256WithRSAEncryption
+ */
+static int x509_crl_sig_alg(const x509_buf * oid)
 {
-	int ret, flags;
-	size_t i, j;
-	x509_cert cacert;
-	x509_cert clicert;
-	rsa_context rsa;
+	if (oid->len != 9 || memcmp(oid->p, OID_PKCS1, 8) != 0)
+		return (0);
 
-	if (verbose != 0)
-		printf("  X.509 certificate load: ");
+	switch (oid->p[8]) {
+	case 4:
+		return (RSA_MD5);
+	case 5:
+		return (RSA_SHA1);
+#if defined(TROPICSSL_SHA2)
+	case 11:
+		return (RSA_SHA256);
+#endif
+	default:
+		return (0);
+	}
+}
 
-	memset(&clicert, 0, sizeof(x509_cert));
+/*
+ *	SEQUENCE  {
+ *		 userCertificate		CertificateSerialNumber,
+ *		 revocationDate			Time,
+ *		 crlEntryExtensions		Extensions OPTIONAL  }
+ */
+static int x509_crl_get_entry(uint8_t **p, const uint8_t *end,
+			      x509_buf * serial)
+{
+	int ret;
+	size_t len;
+	x509_time date;
 
-	ret = x509parse_crt(&clicert, (uint8_t *)test_cli_crt,
-			    strlen(test_cli_crt));
-	if (ret != 0) {
-		if (verbose != 0)
-			printf("failed\n");
+	if ((ret = asn1_get_tag(p, end, &len,
+				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
+		return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT | ret);
+
+	end = *p + len;
 
+	if ((ret = x509_get_serial(p, end, serial)) != 0 ||
+	    (ret = x509_get_time(p, end, &date)) != 0)
 		return (ret);
-	}
 
-	memset(&cacert, 0, sizeof(x509_cert));
+	/*
+	 * Entry extensions (reason codes and the like) are not parsed
+	 */
+	*p = (uint8_t *)end;
 
-	ret = x509parse_crt(&cacert, (uint8_t *)test_ca_crt,
-			    strlen(test_ca_crt));
-	if (ret != 0) {
-		if (verbose != 0)
-			printf("failed\n");
+	return (0);
+}
 
-		return (ret);
+static int x509_crl_get(x509_crl * crl)
+{
+	int ret, ver;
+	size_t len;
+	uint8_t *p, *end, *end2;
+	x509_buf serial;
+
+	p = crl->raw.p;
+	end = p + crl->raw.len;
+
+	/*
+	 * CertificateList  ::=  SEQUENCE  {
+	 *              tbsCertList              TBSCertList,
+	 *              signatureAlgorithm       AlgorithmIdentifier,
+	 *              signatureValue           BIT STRING      }
+	 */
+	if ((ret = asn1_get_tag(&p, end, &len,
+				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
+		return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT | ret);
+
+	if (len != (size_t)(end - p))
+		return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT |
+			TROPICSSL_ERR_ASN1_LENGTH_MISMATCH);
+
+	/*
+	 * TBSCertList  ::=  SEQUENCE  {
+	 *              version                 Version OPTIONAL,
+	 *              signature               AlgorithmIdentifier,
+	 *              issuer                  Name,
+	 *              thisUpdate              Time,
+	 *              nextUpdate              Time OPTIONAL,
+	 *              revokedCertificates     SEQUENCE OF ... OPTIONAL,
+	 *              crlExtensions      [0]  EXPLICIT Extensions OPTIONAL
+	 */
+	crl->tbs.p = p;
+
+	if ((ret = asn1_get_tag(&p, end, &len,
+				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
+		return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT | ret);
+
+	end = p + len;
+	crl->tbs.len = end - crl->tbs.p;
+
+	crl->version = 1;
+
+	if (p < end && *p == ASN1_INTEGER) {
+		if ((ret = asn1_get_int(&p, end, &ver)) != 0)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_VERSION | ret);
+
+		crl->version = ver + 1;
 	}
 
-	if (verbose != 0)
-		printf("passed\n  X.509 private key load: ");
+	if (crl->version > 2)
+		return (TROPICSSL_ERR_X509_CERT_UNKNOWN_VERSION);
 
-	i = strlen(test_ca_key);
-	j = strlen(test_ca_pwd);
+	if ((ret = x509_get_alg(&p, end, &crl->sig_oid1)) != 0)
+		return (ret);
 
-	if ((ret = x509parse_key(&rsa,
-				 (uint8_t *)test_ca_key, i,
-				 (uint8_t *)test_ca_pwd, j)) != 0) {
-		if (verbose != 0)
-			printf("failed\n");
+	if ((crl->sig_alg = x509_crl_sig_alg(&crl->sig_oid1)) == 0)
+		return (TROPICSSL_ERR_X509_CERT_UNKNOWN_SIG_ALG);
+
+	crl->issuer_raw.p = p;
+
+	if ((ret = asn1_get_tag(&p, end, &len,
+				ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
+		return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT | ret);
 
+	if ((ret = x509_skip_name(&p, p + len)) != 0)
 		return (ret);
-	}
+
+	crl->issuer_raw.len = p - crl->issuer_raw.p;
+
+	if ((ret = x509_get_time(&p, end, &crl->this_update)) != 0)
+		return (ret);
+
+	if (p < end && (*p == ASN1_UTC_TIME || *p == ASN1_GENERALIZED_TIME) &&
+	    (ret = x509_get_time(&p, end, &crl->next_update)) != 0)
+		return (ret);
+
+	/*
+	 * Check every entry now, the index is built from them later
+	 */
+	if (p < end && *p == (ASN1_CONSTRUCTED | ASN1_SEQUENCE)) {
+		if ((ret = asn1_get_tag(&p, end, &len,
+					ASN1_CONSTRUCTED | ASN1_SEQUENCE)) != 0)
+			return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT | ret);
+
+		crl->entries.p = p;
+		crl->entries.len = len;
+		end2 = p + len;
+
+		while (p < end2) {
+			if ((ret = x509_crl_get_entry(&p, end2, &serial)) != 0)
+				return (ret);
+
+			crl->count++;
+		}
+	}
+
+	/*
+	 * CRL extensions (CRL number, authority key id) are not parsed
+	 */
+	if (p < end) {
+		if ((ret = asn1_get_tag(&p, end, &len,
+					ASN1_CONTEXT_SPECIFIC |
+					ASN1_CONSTRUCTED | 0)) != 0)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_EXTENSIONS |
+				ret);
+
+		p += len;
+	}
+
+	if (p != end)
+		return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT |
+			TROPICSSL_ERR_ASN1_LENGTH_MISMATCH);
+
+	end = crl->raw.p + crl->raw.len;
+
+	/*
+	 *      signatureAlgorithm       AlgorithmIdentifier,
+	 *      signatureValue           BIT STRING
+	 */
+	if ((ret = x509_get_alg(&p, end, &crl->sig_oid2)) != 0)
+		return (ret);
+
+	if (crl->sig_oid2.len != crl->sig_oid1.len ||
+	    memcmp(crl->sig_oid1.p, crl->sig_oid2.p, crl->sig_oid1.len) != 0)
+		return (TROPICSSL_ERR_X509_CERT_SIG_MISMATCH);
+
+	if ((ret = x509_get_sig(&p, end, &crl->sig)) != 0)
+		return (ret);
+
+	if (p != end)
+		return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT |
+			TROPICSSL_ERR_ASN1_LENGTH_MISMATCH);
+
+	return (0);
+}
+
+/*
+ * Parse one DER CRL into crl, the empty node at the end of a list;
+ * crl owns p from then on, whether parsing succeeds or not
+ */
+static int x509_parse_crl_der(x509_crl * crl, uint8_t *p, size_t len)
+{
+	int ret;
+
+	crl->raw.p = p;
+	crl->raw.len = len;
+
+	if ((ret = x509_crl_get(crl)) == 0) {
+		crl->next = (x509_crl *) memory_alloc(sizeof(x509_crl));
+
+		if (crl->next == NULL)
+			ret = 1;
+		else
+			memset(crl->next, 0, sizeof(x509_crl));
+	}
+
+	if (ret != 0)
+		x509_crl_free(crl);
+
+	return (ret);
+}
+
+/*
+ * Parse one or more CRLs and add them to the chained list
+ */
+int x509parse_crl(x509_crl * chain, const uint8_t *buf, size_t buflen)
+{
+	int ret;
+	size_t len;
+	const uint8_t *s1, *s2, *end = buf + buflen;
+	uint8_t *p;
+	x509_crl *crl;
+
+	crl = chain;
+
+	while (crl->version != 0)
+		crl = crl->next;
+
+	if (x509_memstr(buf, end, PEM_BEGIN_CRL) == NULL) {
+		if (buflen == 0)
+			return (TROPICSSL_ERR_X509_CRL_INVALID_FORMAT);
+
+		if ((p = (uint8_t *)memory_alloc(buflen)) == NULL)
+			return (1);
+
+		memcpy(p, buf, buflen);
+
+		return (x509_parse_crl_der(crl, p, buflen));
+	}
+
+	while ((s1 = x509_memstr(buf, end, PEM_BEGIN_CRL)) != NULL) {
+		s1 += sizeof(PEM_BEGIN_CRL) - 1;
+		if (s1 < end && *s1 == '\r')
+			s1++;
+		if (s1 == end || *s1++ != '\n')
+			return (TROPICSSL_ERR_X509_CRL_INVALID_PEM);
+
+		if ((s2 = x509_memstr(s1, end, PEM_END_CRL)) == NULL)
+			return (TROPICSSL_ERR_X509_CRL_INVALID_PEM);
+
+		len = 0;
+		ret = base64_decode(NULL, &len, s1, s2 - s1);
+
+		if (ret == TROPICSSL_ERR_BASE64_INVALID_CHARACTER)
+			return (TROPICSSL_ERR_X509_CRL_INVALID_PEM | ret);
+
+		if ((p = (uint8_t *)memory_alloc(len)) == NULL)
+			return (1);
+
+		if ((ret = base64_decode(p, &len, s1, s2 - s1)) != 0) {
+			memory_free(p);
+			return (TROPICSSL_ERR_X509_CRL_INVALID_PEM | ret);
+		}
+
+		if ((ret = x509_parse_crl_der(crl, p, len)) != 0)
+			return (ret);
+
+		crl = crl->next;
+		buf = s2 + sizeof(PEM_END_CRL) - 1;
+	}
+
+	return (0);
+}
+
+#if defined(TROPICSSL_FS_IO)
+/*
+ * Load one or more CRLs and add them to the chained list
+ */
+int x509parse_crlfile(x509_crl * chain, const char *path)
+{
+	int ret;
+#if defined(TROPICSSL_X509_CRTPATH)
+	int fd;
+	void *map;
+	struct stat st;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (1);
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return (1);
+	}
+
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return (1);
+
+	ret = x509parse_crl(chain, (const uint8_t *)map, (size_t) st.st_size);
+
+	munmap(map, (size_t) st.st_size);
+#else
+	FILE *f;
+	size_t n;
+	uint8_t *buf;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		return (1);
+
+	fseek(f, 0, SEEK_END);
+	n = (size_t) ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	if ((buf = (uint8_t *)memory_alloc(n)) == NULL) {
+		fclose(f);
+		return (1);
+	}
+
+	if (fread(buf, 1, n, f) != n) {
+		fclose(f);
+		memory_free(buf);
+		return (1);
+	}
+
+	ret = x509parse_crl(chain, buf, n);
+
+	memory_free(buf);
+	fclose(f);
+#endif
+
+	return (ret);
+}
+#endif
+
+/*
+ * Unallocate all CRL data
+ */
+void x509_crl_free(x509_crl * crl)
+{
+	x509_crl *cur = crl;
+	x509_crl *prv;
+
+	if (crl == NULL)
+		return;
+
+	do {
+		if (cur->raw.p != NULL) {
+			memset(cur->raw.p, 0, cur->raw.len);
+			memory_free(cur->raw.p);
+		}
+
+		cur = cur->next;
+	} while (cur != NULL);
+
+	cur = crl;
+	do {
+		prv = cur;
+		cur = cur->next;
+
+		memset(prv, 0, sizeof(x509_crl));
+		if (prv != crl)
+			memory_free(prv);
+	} while (cur != NULL);
+}
+
+/*
+ * FNV-1a over the issuer name, then on over the serial number
+ */
+static unsigned long x509_serial_hash(const x509_buf * issuer,
+				      const uint8_t *serial, size_t len)
+{
+	unsigned long h = x509_name_hash(issuer);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = ((h ^ serial[i]) * 16777619UL) & 0xFFFFFFFFUL;
+
+	return (h);
+}
+
+/*
+ * Check the CRL signature against the certificates of its issuer
+ */
+static int x509_crl_verify(const x509_crl * crl, x509_cert * ca)
+{
+	int hash_id = crl->sig_alg;
+	unsigned int hashlen = 0;
+	uint8_t hash[19 + 32];
+
+	/*
+	 * rsa_pkcs1_verify() has no DigestInfo for SHA-256: check the
+	 * raw one, as for TLSv1.2 signatures
+	 */
+	if (hash_id == RSA_SHA256) {
+		memcpy(hash, ASN1_HASH_SHA256, 19);
+		x509_hash(crl->tbs.p, crl->tbs.len, hash_id, hash + 19);
+		hash_id = RSA_RAW;
+		hashlen = 19 + 32;
+	} else
+		x509_hash(crl->tbs.p, crl->tbs.len, hash_id, hash);
+
+	for (; ca != NULL && ca->version != 0; ca = ca->next) {
+		if (crl->issuer_raw.len != ca->subject_raw.len ||
+		    memcmp(crl->issuer_raw.p, ca->subject_raw.p,
+			   crl->issuer_raw.len) != 0 ||
+		    crl->sig.len != ca->rsa.len)
+			continue;
+
+		if (rsa_pkcs1_verify(&ca->rsa, RSA_PUBLIC, hash_id,
+				     hashlen, hash, crl->sig.p) == 0)
+			return (0);
+	}
+
+	return (TROPICSSL_ERR_X509_CRL_VERIFY_FAILED);
+}
+
+static void x509_revoked_free(x509_revoked * r)
+{
+	x509_crl_free(&r->crl);
+	free(r->slot);
+	free(r);
+}
+
+int x509_crl_store_init(x509_crl_store * store)
+{
+	memset(store, 0, sizeof(x509_crl_store));
+
+#if defined(WIN32)
+	InitializeCriticalSection(&store->lock);
+#else
+	pthread_mutex_init(&store->lock, NULL);
+#endif
+
+	return (0);
+}
+
+/*
+ * Index the serials of every CRL by issuer and value, then publish
+ * the new lists; the old ones go with their last reader
+ */
+int x509_crl_store_swap(x509_crl_store * store, x509_crl * crl,
+			x509_cert * ca)
+{
+	size_t n, i;
+	unsigned long h;
+	uint8_t *p, *end;
+	x509_buf serial;
+	x509_crl *cur;
+	x509_revoked *r, *old;
+
+	n = 0;
+	for (cur = crl; cur->version != 0; cur = cur->next) {
+		if (x509_crl_verify(cur, ca) != 0)
+			return (TROPICSSL_ERR_X509_CRL_VERIFY_FAILED);
+
+		n += cur->count;
+	}
+
+	r = NULL;
+
+	if (crl->version != 0) {
+		/*
+		 * Shared by every thread, so from the heap
+		 */
+		if ((r = (x509_revoked *) malloc(sizeof(x509_revoked))) == NULL)
+			return (1);
+
+		for (i = 2; i < 2 * n; i <<= 1) ;
+
+		r->slot = (x509_revoked_slot *)
+		    malloc(i * sizeof(x509_revoked_slot));
+
+		if (r->slot == NULL) {
+			free(r);
+			return (1);
+		}
+
+		memset(r->slot, 0, i * sizeof(x509_revoked_slot));
+		r->mask = i - 1;
+		r->refs = 1;
+
+		memcpy(&r->crl, crl, sizeof(x509_crl));
+		memset(crl, 0, sizeof(x509_crl));
+
+		for (cur = &r->crl; cur->version != 0; cur = cur->next) {
+			p = cur->entries.p;
+			end = p + cur->entries.len;
+
+			while (p < end) {
+				x509_crl_get_entry(&p, end, &serial);
+
+				h = x509_serial_hash(&cur->issuer_raw,
+						     serial.p, serial.len);
+
+				for (i = h & r->mask; r->slot[i].serial != NULL;
+				     i = (i + 1) & r->mask) ;
+
+				r->slot[i].hash = h;
+				r->slot[i].serial = serial.p;
+				r->slot[i].len = serial.len;
+				r->slot[i].crl = cur;
+			}
+		}
+	}
+
+	X509_CRL_LOCK(store);
+
+	old = store->cur;
+	store->cur = r;
+
+	if (old != NULL && --old->refs != 0)
+		old = NULL;
+
+	X509_CRL_UNLOCK(store);
+
+	if (old != NULL)
+		x509_revoked_free(old);
+
+	return (0);
+}
+
+void x509_set_crl(x509_cert * trust_ca, x509_crl_store * store)
+{
+	trust_ca->crl = store;
+}
+
+void x509_crl_store_free(x509_crl_store * store)
+{
+	if (store->cur != NULL)
+		x509_revoked_free(store->cur);
+
+#if defined(WIN32)
+	DeleteCriticalSection(&store->lock);
+#else
+	pthread_mutex_destroy(&store->lock);
+#endif
+
+	memset(store, 0, sizeof(x509_crl_store));
+}
+
+/*
+ * Look every certificate of the chain up in the current lists:
+ * BADCERT_REVOKED if one is listed
+ */
+static int x509_crl_check(x509_crl_store * store, const x509_cert * crt)
+{
+	int flags = 0, last;
+	size_t i;
+	unsigned long h, n = 0;
+	x509_revoked *r;
+	const x509_revoked_slot *s;
+
+	X509_CRL_LOCK(store);
+	if ((r = store->cur) != NULL)
+		r->refs++;
+	X509_CRL_UNLOCK(store);
+
+	if (r == NULL)
+		return (0);
+
+	for (; crt != NULL && crt->version != 0 && flags == 0;
+	     crt = crt->next, n++) {
+		h = x509_serial_hash(&crt->issuer_raw,
+				     crt->serial.p, crt->serial.len);
+
+		for (i = h & r->mask; (s = &r->slot[i])->serial != NULL;
+		     i = (i + 1) & r->mask) {
+			if (s->hash == h && s->len == crt->serial.len &&
+			    memcmp(s->serial, crt->serial.p, s->len) == 0 &&
+			    s->crl->issuer_raw.len == crt->issuer_raw.len &&
+			    memcmp(s->crl->issuer_raw.p, crt->issuer_raw.p,
+				   crt->issuer_raw.len) == 0) {
+				flags = BADCERT_REVOKED;
+				break;
+			}
+		}
+	}
+
+	X509_CRL_LOCK(store);
+	store->checks += n;
+	store->revoked += (flags != 0);
+	last = (--r->refs == 0);
+	X509_CRL_UNLOCK(store);
+
+	if (last)
+		x509_revoked_free(r);
+
+	return (flags);
+}
+
+#endif
+
+/*
+ * Check crt against a trusted CA whose subject is its issuer; return 1
+ * once the search is over, either because the CA signed crt or because
+ * the chain is longer than the CA allows
+ */
+static int x509_verify_anchor(const x509_cert * crt, x509_cert * ca,
+			      int pathlen, int *flags)
+{
+	int hash_id;
+	uint8_t hash[20];
+
+	if (ca->max_pathlen > 0 && ca->max_pathlen < pathlen)
+		return (1);
+
+	hash_id = crt->sig_oid1.p[8];
+
+	x509_hash(crt->tbs.p, crt->tbs.len, hash_id, hash);
+
+	if (rsa_pkcs1_verify(&ca->rsa, RSA_PUBLIC, hash_id,
+			     0, hash, crt->sig.p) == 0) {
+		/*
+		 * cert. is signed by a trusted CA
+		 */
+		*flags &= ~BADCERT_NOT_TRUSTED;
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Verify the certificate validity
+ */
+int x509parse_verify(x509_cert * crt,
+		     x509_cert * trust_ca, const char *cn, int *flags)
+{
+	int cn_len;
+	int hash_id;
+	int pathlen;
+	size_t i;
+	unsigned long h;
+	x509_index *idx;
+	x509_cert *cur;
+	x509_name *name;
+	uint8_t hash[20];
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	x509_vcache *vc = trust_ca->vcache;
+	uint8_t digest[32];
+#endif
+
+	*flags = x509parse_expired(crt);
+
+	if (cn != NULL && crt->lazy) {
+		if (x509_raw_has_cn(&crt->subject_raw, cn, strlen(cn)) == 0)
+			*flags |= BADCERT_CN_MISMATCH;
+	} else if (cn != NULL) {
+		name = &crt->subject;
+		cn_len = strlen(cn);
+
+		while (name != NULL) {
+			if (memcmp(name->oid.p, OID_CN, 3) == 0 &&
+			    memcmp(name->val.p, cn, cn_len) == 0 &&
+			    name->val.len == cn_len)
+				break;
+
+			name = name->next;
+		}
+
+		if (name == NULL)
+			*flags |= BADCERT_CN_MISMATCH;
+	}
+
+#if defined(TROPICSSL_X509_CRL)
+	if (trust_ca->crl != NULL)
+		*flags |= x509_crl_check(trust_ca->crl, crt);
+#endif
+
+	*flags |= BADCERT_NOT_TRUSTED;
+
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	if (vc != NULL && vc->table != NULL) {
+		x509_vcache_digest(crt, digest);
+
+		if (x509_vcache_get(vc, digest) != 0) {
+			*flags &= ~BADCERT_NOT_TRUSTED;
+			goto done;
+		}
+	}
+#endif
+
+	/*
+	 * Iterate upwards in the given cert chain,
+	 * ignoring any upper cert with CA != TRUE.
+	 */
+	cur = crt->next;
+
+	pathlen = 1;
+
+	while (cur->version != 0) {
+		if (cur->ca_istrue == 0 ||
+		    crt->issuer_raw.len != cur->subject_raw.len ||
+		    memcmp(crt->issuer_raw.p, cur->subject_raw.p,
+			   crt->issuer_raw.len) != 0) {
+			cur = cur->next;
+			continue;
+		}
+
+		hash_id = crt->sig_oid1.p[8];
+
+		x509_hash(crt->tbs.p, crt->tbs.len, hash_id, hash);
+
+		if (rsa_pkcs1_verify(&cur->rsa, RSA_PUBLIC, hash_id,
+				     0, hash, crt->sig.p) != 0)
+			return (TROPICSSL_ERR_X509_CERT_VERIFY_FAILED);
+
+		pathlen++;
+
+		crt = cur;
+		cur = crt->next;
+	}
+
+	/*
+	 * Atempt to validate topmost cert with our CA chain.
+	 */
+	if ((idx = trust_ca->index) != NULL) {
+		h = x509_name_hash(&crt->issuer_raw);
+
+		for (i = h & idx->mask; (trust_ca = idx->slot[i]) != NULL;
+		     i = (i + 1) & idx->mask) {
+			if (idx->hash[i] != h ||
+			    crt->issuer_raw.len != trust_ca->subject_raw.len ||
+			    memcmp(crt->issuer_raw.p, trust_ca->subject_raw.p,
+				   crt->issuer_raw.len) != 0)
+				continue;
+
+			if (x509_verify_anchor(crt, trust_ca, pathlen,
+					       flags) != 0)
+				break;
+		}
+	} else {
+		while (trust_ca->version != 0) {
+			if (crt->issuer_raw.len != trust_ca->subject_raw.len ||
+			    memcmp(crt->issuer_raw.p, trust_ca->subject_raw.p,
+				   crt->issuer_raw.len) != 0) {
+				trust_ca = trust_ca->next;
+				continue;
+			}
+
+			if (x509_verify_anchor(crt, trust_ca, pathlen,
+					       flags) != 0)
+				break;
+
+			trust_ca = trust_ca->next;
+		}
+	}
+
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	if (vc != NULL && vc->table != NULL &&
+	    (*flags & BADCERT_NOT_TRUSTED) == 0)
+		x509_vcache_put(vc, digest);
+
+done:
+#endif
+	if (*flags != 0)
+		return (TROPICSSL_ERR_X509_CERT_VERIFY_FAILED);
+
+	return (0);
+}
+
+/*
+ * Unallocate all certificate data
+ */
+void x509_free(x509_cert * crt)
+{
+	x509_cert *cert_cur = crt;
+	x509_cert *cert_prv;
+
+	if (crt == NULL)
+		return;
+
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	x509_vcache_flush(crt->vcache);
+#endif
+
+	do {
+		x509_index_free(cert_cur);
+		x509_encoded_free(cert_cur);
+		rsa_free(&cert_cur->rsa);
+
+		x509_name_free(&cert_cur->issuer);
+		x509_name_free(&cert_cur->subject);
+
+		if (cert_cur->raw.p != NULL) {
+			memset(cert_cur->raw.p, 0, cert_cur->raw.len);
+			memory_free(cert_cur->raw.p);
+		}
+
+		cert_cur = cert_cur->next;
+	} while (cert_cur != NULL);
+
+	cert_cur = crt;
+	do {
+		cert_prv = cert_cur;
+		cert_cur = cert_cur->next;
+
+		memset(cert_prv, 0, sizeof(x509_cert));
+		if (cert_prv != crt)
+			memory_free(cert_prv);
+	} while (cert_cur != NULL);
+}
+
+#if defined(TROPICSSL_X509_CRT_CACHE)
+
+struct _x509_shared {
+	x509_cert crt;		/* first: a chain is its entry     */
+	uint8_t digest[32];	/* SHA-256 of the certificate_list */
+	int refs;		/* the cache's and its users'      */
+	unsigned long used;	/* tick of the last lookup         */
+};
+
+#if defined(WIN32)
+#define X509_CRT_CACHE_LOCK(c)          EnterCriticalSection(&(c)->lock)
+#define X509_CRT_CACHE_UNLOCK(c)        LeaveCriticalSection(&(c)->lock)
+#else
+#define X509_CRT_CACHE_LOCK(c)          pthread_mutex_lock(&(c)->lock)
+#define X509_CRT_CACHE_UNLOCK(c)        pthread_mutex_unlock(&(c)->lock)
+#endif
+
+int x509_crt_cache_init(x509_crt_cache * cache, size_t max)
+{
+	size_t n;
+
+	memset(cache, 0, sizeof(x509_crt_cache));
+
+	for (n = 1; n * X509_VCACHE_WAYS < max; n <<= 1) ;
+
+	cache->table = (x509_shared **)
+	    malloc(n * X509_VCACHE_WAYS * sizeof(x509_shared *));
+
+	if (cache->table == NULL)
+		return (1);
+
+	memset(cache->table, 0, n * X509_VCACHE_WAYS * sizeof(x509_shared *));
+	cache->mask = n - 1;
+
+#if defined(WIN32)
+	InitializeCriticalSection(&cache->lock);
+#else
+	pthread_mutex_init(&cache->lock, NULL);
+#endif
+
+	return (0);
+}
+
+static void x509_shared_free(x509_shared * e)
+{
+	x509_free(&e->crt);
+	memset(e, 0, sizeof(x509_shared));
+	free(e);
+}
+
+static x509_shared **x509_crt_cache_set(x509_crt_cache * cache,
+					const uint8_t digest[32])
+{
+	size_t i;
+
+	i = (((size_t) digest[0] << 8) | digest[1]) & cache->mask;
+
+	return (&cache->table[i * X509_VCACHE_WAYS]);
+}
+
+/*
+ * Return the entry of the set holding digest, with one more
+ * reference, or NULL; the cache must be locked
+ */
+static x509_shared *x509_crt_cache_find(x509_crt_cache * cache,
+					x509_shared ** set,
+					const uint8_t digest[32])
+{
+	int i;
+
+	for (i = 0; i < X509_VCACHE_WAYS; i++) {
+		if (set[i] != NULL && memcmp(set[i]->digest, digest, 32) == 0) {
+			set[i]->refs++;
+			set[i]->used = cache->tick;
+			return (set[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Same list format as the TLS Certificate message
+ */
+static int x509_parse_list(x509_cert * chain, const uint8_t *buf,
+			   size_t buflen)
+{
+	int ret;
+	size_t i, n;
+
+	i = 0;
+
+	while (i < buflen) {
+		if (buflen - i < 3 || buf[i] != 0)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_FORMAT);
+
+		n = ((size_t) buf[i + 1] << 8) | buf[i + 2];
+		i += 3;
+
+		if (n > buflen - i)
+			return (TROPICSSL_ERR_X509_CERT_INVALID_FORMAT);
+
+		if ((ret = x509parse_crt_lazy(chain, buf + i, n)) != 0)
+			return (ret);
+
+		i += n;
+	}
+
+	return (chain->version != 0 ? 0 :
+		TROPICSSL_ERR_X509_CERT_INVALID_FORMAT);
+}
+
+int x509parse_crt_shared(x509_crt_cache * cache, x509_cert ** crt,
+			 const uint8_t *buf, size_t buflen)
+{
+	int ret, i, j;
+	uint8_t digest[32];
+	x509_shared **set, *e, *old;
+#if defined(TROPICSSL_MEMORY)
+	void *(*f_alloc) (void *, size_t);
+	void (*f_free) (void *, void *);
+	void *p_alloc;
+#endif
+
+	sha2(buf, buflen, digest, 0);
+
+	X509_CRT_CACHE_LOCK(cache);
+
+	cache->tick++;
+	set = x509_crt_cache_set(cache, digest);
+
+	if ((e = x509_crt_cache_find(cache, set, digest)) != NULL)
+		cache->hits++;
+	else
+		cache->misses++;
+
+	X509_CRT_CACHE_UNLOCK(cache);
+
+	if (e != NULL) {
+		*crt = &e->crt;
+		return (0);
+	}
+
+	/*
+	 * Parse outside the lock. The chain outlives the connection,
+	 * so it comes from the heap rather than the thread's arena.
+	 */
+	if ((e = (x509_shared *) malloc(sizeof(x509_shared))) == NULL)
+		return (1);
+
+	memset(e, 0, sizeof(x509_shared));
+	memcpy(e->digest, digest, 32);
+	e->refs = 2;
+
+#if defined(TROPICSSL_MEMORY)
+	memory_get_alloc(&f_alloc, &f_free, &p_alloc);
+	memory_set_alloc(NULL, NULL, NULL);
+#endif
+
+	if ((ret = x509_parse_list(&e->crt, buf, buflen)) == 0)
+		ret = x509_precompute(&e->crt);
+
+#if defined(TROPICSSL_MEMORY)
+	memory_set_alloc(f_alloc, f_free, p_alloc);
+#endif
+
+	if (ret != 0) {
+		x509_shared_free(e);
+		return (ret);
+	}
+
+	X509_CRT_CACHE_LOCK(cache);
+
+	/*
+	 * Another thread may have parsed the same chain meanwhile
+	 */
+	if ((old = x509_crt_cache_find(cache, set, digest)) != NULL) {
+		X509_CRT_CACHE_UNLOCK(cache);
+		x509_shared_free(e);
+		*crt = &old->crt;
+		return (0);
+	}
+
+	/*
+	 * Take an empty slot, or else the least recently used one
+	 */
+	for (i = 0; i < X509_VCACHE_WAYS && set[i] != NULL; i++) ;
+
+	if (i == X509_VCACHE_WAYS) {
+		for (i = 0, j = 1; j < X509_VCACHE_WAYS; j++)
+			if (set[j]->used < set[i]->used)
+				i = j;
+	}
+
+	old = set[i];
+	e->used = cache->tick;
+	set[i] = e;
+
+	if (old != NULL && --old->refs != 0)
+		old = NULL;
+
+	X509_CRT_CACHE_UNLOCK(cache);
+
+	if (old != NULL)
+		x509_shared_free(old);
+
+	*crt = &e->crt;
+
+	return (0);
+}
+
+void x509_crt_release(x509_crt_cache * cache, x509_cert * crt)
+{
+	x509_shared *e = (x509_shared *) crt;
+	int last;
+
+	X509_CRT_CACHE_LOCK(cache);
+	last = (--e->refs == 0);
+	X509_CRT_CACHE_UNLOCK(cache);
+
+	if (last)
+		x509_shared_free(e);
+}
+
+void x509_crt_cache_free(x509_crt_cache * cache)
+{
+	size_t i;
+	x509_shared *e;
+
+	if (cache->table == NULL)
+		return;
+
+	for (i = 0; i < (cache->mask + 1) * X509_VCACHE_WAYS; i++) {
+		if ((e = cache->table[i]) != NULL && --e->refs == 0)
+			x509_shared_free(e);
+	}
+
+	free(cache->table);
+
+#if defined(WIN32)
+	DeleteCriticalSection(&cache->lock);
+#else
+	pthread_mutex_destroy(&cache->lock);
+#endif
+
+	memset(cache, 0, sizeof(x509_crt_cache));
+}
+
+#endif
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include "tropicssl/certs.h"
+
+/*
+ * Checkup routine
+ */
+int x509_self_test(int verbose)
+{
+	int ret, flags;
+	size_t i, j;
+	x509_cert cacert;
+	x509_cert clicert;
+	rsa_context rsa;
+	int iflags;
+	x509_cert lazycert;
+	char info[1024];
+#if defined(TROPICSSL_X509_CRT_CACHE)
+	uint8_t *list = NULL;
+	x509_cert *shared[2];
+	x509_crt_cache ccache;
+#endif
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	int vflags;
+	x509_vcache vcache;
+#endif
+#if defined(TROPICSSL_X509_CRL)
+	x509_crl crl, dercrl;
+	x509_crl_store crls;
+#endif
+
+	if (verbose != 0)
+		printf("  X.509 certificate load: ");
+
+	memset(&clicert, 0, sizeof(x509_cert));
+
+	ret = x509parse_crt(&clicert, (uint8_t *)test_cli_crt,
+			    strlen(test_cli_crt));
+	if (ret != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (ret);
+	}
+
+	memset(&cacert, 0, sizeof(x509_cert));
+
+	ret = x509parse_crt(&cacert, (uint8_t *)test_ca_crt,
+			    strlen(test_ca_crt));
+	if (ret != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (ret);
+	}
+
+	if (verbose != 0)
+		printf("passed\n  X.509 private key load: ");
+
+	i = strlen(test_ca_key);
+	j = strlen(test_ca_pwd);
+
+	if ((ret = x509parse_key(&rsa,
+				 (uint8_t *)test_ca_key, i,
+				 (uint8_t *)test_ca_pwd, j)) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (ret);
+	}
+
+#if defined(TROPICSSL_X509_VERIFY_CACHE)
+	if (verbose != 0)
+		printf("passed\n  X.509 verify cache: ");
+
+	/*
+	 * A hit must give the flags of a full verification
+	 */
+	ret = x509parse_verify(&clicert, &cacert, "Test Client", &flags);
+
+	if (x509_vcache_init(&vcache, 16, 60) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	x509_set_verify_cache(&cacert, &vcache);
+
+	for (i = 0; i < 2; i++) {
+		if (x509parse_verify(&clicert, &cacert, "Test Client",
+				     &vflags) != ret || vflags != flags)
+			break;
+	}
+
+	x509_set_verify_cache(&cacert, NULL);
+
+	if (i < 2 || vcache.misses != 1 || vcache.hits != 1) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		x509_vcache_free(&vcache);
+		return (1);
+	}
+
+	x509_vcache_free(&vcache);
+#endif
+
+	if (verbose != 0)
+		printf("passed\n  X.509 trust index: ");
+
+	ret = x509parse_verify(&clicert, &cacert, "Test Client", &flags);
+
+	if (x509parse_index(&cacert) != 0 ||
+	    x509parse_verify(&clicert, &cacert, "Test Client",
+			     &iflags) != ret || iflags != flags) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	if (verbose != 0)
+		printf("passed\n  X.509 lazy parse: ");
+
+	memset(&lazycert, 0, sizeof(x509_cert));
+
+	if (x509parse_crt_lazy(&lazycert, (uint8_t *)test_cli_crt,
+			       strlen(test_cli_crt)) != 0 ||
+	    lazycert.subject.next != NULL ||
+	    x509parse_verify(&lazycert, &cacert, "Test Client",
+			     &iflags) != ret || iflags != flags ||
+	    x509parse_verify(&lazycert, &cacert, "Test Clien",
+			     &iflags) == 0 ||
+	    (iflags & BADCERT_CN_MISMATCH) == 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	strcpy(info, x509parse_cert_info("", &clicert));
+
+	if (strcmp(info, x509parse_cert_info("", &lazycert)) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	x509_free(&lazycert);
+
+#if defined(TROPICSSL_X509_CRT_CACHE)
+	if (verbose != 0)
+		printf("passed\n  X.509 shared chain: ");
+
+	if ((list = (uint8_t *)malloc(clicert.raw.len + 3)) == NULL ||
+	    x509_crt_cache_init(&ccache, 4) != 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		free(list);
+		return (1);
+	}
+
+	list[0] = 0;
+	list[1] = (uint8_t)(clicert.raw.len >> 8);
+	list[2] = (uint8_t)(clicert.raw.len);
+	memcpy(list + 3, clicert.raw.p, clicert.raw.len);
+
+	shared[0] = shared[1] = NULL;
+
+	for (i = 0; i < 2; i++) {
+		if (x509parse_crt_shared(&ccache, &shared[i], list,
+					 clicert.raw.len + 3) != 0)
+			break;
+	}
+
+	if (i < 2 || shared[0] != shared[1] ||
+	    ccache.misses != 1 || ccache.hits != 1 ||
+	    x509parse_verify(shared[0], &cacert, "Test Client",
+			     &iflags) != ret || iflags != flags) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+
+	x509_crt_release(&ccache, shared[0]);
+	x509_crt_release(&ccache, shared[1]);
+	x509_crt_cache_free(&ccache);
+	free(list);
+#endif
+
+#if defined(TROPICSSL_X509_CRL)
+	if (verbose != 0)
+		printf("passed\n  X.509 revocation list: ");
+
+	/*
+	 * Serial 01 is listed; a list with a bad signature is refused
+	 * and the store keeps what it had; an empty list clears it
+	 */
+	ret = x509parse_verify(&clicert, &cacert, "Test Client", &flags);
+
+	memset(&crl, 0, sizeof(x509_crl));
+	memset(&dercrl, 0, sizeof(x509_crl));
+	x509_crl_store_init(&crls);
+	x509_set_crl(&cacert, &crls);
+
+	if (x509parse_crl(&crl, (const uint8_t *)test_ca_crl,
+			  strlen(test_ca_crl)) != 0 || crl.count != 3 ||
+	    x509parse_crl(&dercrl, crl.raw.p, crl.raw.len) != 0 ||
+	    x509_crl_store_swap(&crls, &crl, &cacert) != 0 ||
+	    crl.version != 0)
+		i = 0;
+	else {
+		dercrl.sig.p[0] ^= 1;
+
+		i = (x509parse_verify(&clicert, &cacert, "Test Client",
+				      &iflags) != 0 &&
+		     iflags == (flags | BADCERT_REVOKED) &&
+		     x509_crl_store_swap(&crls, &dercrl, &cacert) ==
+		     TROPICSSL_ERR_X509_CRL_VERIFY_FAILED &&
+		     x509parse_verify(&clicert, &cacert, "Test Client",
+				      &iflags) != 0 &&
+		     (iflags & BADCERT_REVOKED) != 0 &&
+		     x509_crl_store_swap(&crls, &crl, &cacert) == 0 &&
+		     x509parse_verify(&clicert, &cacert, "Test Client",
+				      &iflags) == ret && iflags == flags &&
+		     crls.revoked == 2);
+	}
+
+	x509_set_crl(&cacert, NULL);
+	x509_crl_free(&crl);
+	x509_crl_free(&dercrl);
+	x509_crl_store_free(&crls);
+
+	if (i == 0) {
+		if (verbose != 0)
+			printf("failed\n");
+
+		return (1);
+	}
+#endif
 
 	if (verbose != 0)
 		printf("passed\n  X.509 signature verify: ");
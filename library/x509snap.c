@@ -0,0 +1,798 @@
+/*
+ *  Server-side host name (SNI) to certificate map
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *	Snapshot file, all numbers big endian:
+ *
+ *	header   "TROPSNAP", version (4), limb bits (4), entries (4),
+ *	         0 (4), file size (8)
+ *	index    per entry, in name order: name offset (4), name size (4),
+ *	         data offset (4), data size (4), SHA-256 of name and data
+ *	         truncated to 16 bytes
+ *	data     certificates (4), then for each its DER size (4), the
+ *	         DER and a zero byte; key flag (4), then for a key
+ *	         N E D P Q DP DQ QP and the RR RRR RI of P, Q and N, each
+ *	         as its size (4) and unsigned bytes
+ */
+
+#include "tropicssl/config.h"
+
+#if defined(TROPICSSL_X509_SNAP_C)
+
+#include "tropicssl/err.h"
+#include "tropicssl/x509snap.h"
+#include "tropicssl/sha2.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#if defined(TROPICSSL_FS_IO)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define X509_SNAP_DIGEST_LEN           16
+#define X509_SNAP_KEY_MPIS             17
+
+static const uint8_t x509_snap_magic[8] = "TROPSNAP";
+
+#define GET_U32(p)                                              \
+	(((size_t)(p)[0] << 24) | ((size_t)(p)[1] << 16) |      \
+	 ((size_t)(p)[2] <<  8) | ((size_t)(p)[3]      ))
+
+/*
+ * Output cursor that keeps counting once the buffer is full, so that
+ * the same pass gives the size needed
+ */
+typedef struct {
+	uint8_t *buf;
+	size_t len;
+	size_t pos;
+} x509_snap_out;
+
+static void x509_snap_put(x509_snap_out * out, const void *p, size_t n)
+{
+	if (out->buf != NULL && out->pos + n <= out->len && n > 0)
+		memcpy(out->buf + out->pos, p, n);
+
+	out->pos += n;
+}
+
+static void x509_snap_put_u32(x509_snap_out * out, size_t v)
+{
+	uint8_t b[4];
+
+	b[0] = (uint8_t)(v >> 24);
+	b[1] = (uint8_t)(v >> 16);
+	b[2] = (uint8_t)(v >> 8);
+	b[3] = (uint8_t)(v);
+
+	x509_snap_put(out, b, 4);
+}
+
+static void x509_snap_set_u32(uint8_t *p, size_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)(v);
+}
+
+static int x509_snap_put_mpi(x509_snap_out * out, const mpi * X)
+{
+	size_t n = mpi_size(X);
+
+	x509_snap_put_u32(out, n);
+
+	if (out->buf != NULL && out->pos + n <= out->len && n > 0) {
+		if (mpi_write_binary(X, out->buf + out->pos, n) != 0)
+			return (TROPICSSL_ERR_X509_SNAP_INVALID);
+	}
+
+	out->pos += n;
+
+	return (0);
+}
+
+/*
+ * RR, RRR and RI of a modulus, computed here if the key has none
+ */
+static int x509_snap_put_mont(x509_snap_out * out, const mpi_mont * M,
+			      const mpi * N)
+{
+	int ret = 0;
+	mpi_mont T;
+
+	memset(&T, 0, sizeof(mpi_mont));
+
+	if (M->n == 0) {
+		if ((ret = mpi_mont_init(&T, N)) != 0)
+			return (ret);
+
+		M = &T;
+	}
+
+	if ((ret = x509_snap_put_mpi(out, &M->RR)) == 0 &&
+	    (ret = x509_snap_put_mpi(out, &M->RRR)) == 0)
+		ret = x509_snap_put_mpi(out, &M->RI);
+
+	mpi_mont_free(&T);
+
+	return (ret);
+}
+
+static int x509_snap_put_entry(x509_snap_out * out,
+			       const x509_snap_entry * e)
+{
+	int ret;
+	size_t n;
+	const x509_cert *crt;
+	const rsa_context *rsa = e->rsa;
+	const mpi *X[8];
+
+	for (n = 0, crt = e->crt; crt != NULL && crt->version != 0;
+	     crt = crt->next)
+		n++;
+
+	x509_snap_put_u32(out, n);
+
+	for (crt = e->crt; crt != NULL && crt->version != 0; crt = crt->next) {
+		x509_snap_put_u32(out, crt->raw.len);
+		x509_snap_put(out, crt->raw.p, crt->raw.len);
+		x509_snap_put(out, "", 1);
+	}
+
+	x509_snap_put_u32(out, rsa != NULL);
+
+	if (rsa == NULL)
+		return (0);
+
+	X[0] = &rsa->N;
+	X[1] = &rsa->E;
+	X[2] = &rsa->D;
+	X[3] = &rsa->P;
+	X[4] = &rsa->Q;
+	X[5] = &rsa->DP;
+	X[6] = &rsa->DQ;
+	X[7] = &rsa->QP;
+
+	for (n = 0; n < 8; n++)
+		if ((ret = x509_snap_put_mpi(out, X[n])) != 0)
+			return (ret);
+
+	if ((ret = x509_snap_put_mont(out, &rsa->MP, &rsa->P)) != 0 ||
+	    (ret = x509_snap_put_mont(out, &rsa->MQ, &rsa->Q)) != 0 ||
+	    (ret = x509_snap_put_mont(out, &rsa->MN, &rsa->N)) != 0)
+		return (ret);
+
+	return (0);
+}
+
+/*
+ * Byte order of the stored names, shorter first on a common prefix
+ */
+static int x509_snap_cmp(const uint8_t *a, size_t alen,
+			 const uint8_t *b, size_t blen)
+{
+	int c = memcmp(a, b, (alen < blen) ? alen : blen);
+
+	if (c != 0)
+		return (c);
+
+	return ((alen > blen) - (alen < blen));
+}
+
+static int x509_snap_sort_cmp(const void *a, const void *b)
+{
+	const x509_snap_entry *ea = *(const x509_snap_entry * const *)a;
+	const x509_snap_entry *eb = *(const x509_snap_entry * const *)b;
+
+	return (x509_snap_cmp((const uint8_t *)ea->name, strlen(ea->name),
+			      (const uint8_t *)eb->name, strlen(eb->name)));
+}
+
+/*
+ * Serialize certificate chains and keys, sorted by name
+ */
+int x509_snap_build(uint8_t *buf, size_t buflen, size_t *olen,
+		    const x509_snap_entry * entries, size_t count)
+{
+	int ret = 0;
+	size_t i, n, start;
+	uint8_t digest[32];
+	uint8_t *idx;
+	const x509_snap_entry **sorted;
+	x509_snap_out out;
+
+	if (count > 0xFFFFFFF)
+		return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+	sorted = (const x509_snap_entry **)
+	    malloc((count + 1) * sizeof(x509_snap_entry *));
+	if (sorted == NULL)
+		return (1);
+
+	for (i = 0; i < count; i++) {
+		if (entries[i].rsa != NULL &&
+		    (ret = rsa_check_privkey(entries[i].rsa)) != 0)
+			goto cleanup;
+
+		sorted[i] = &entries[i];
+	}
+
+	qsort(sorted, count, sizeof(x509_snap_entry *), x509_snap_sort_cmp);
+
+	for (i = 1; i < count; i++) {
+		if (x509_snap_sort_cmp(&sorted[i - 1], &sorted[i]) == 0) {
+			ret = TROPICSSL_ERR_X509_SNAP_INVALID;
+			goto cleanup;
+		}
+	}
+
+	out.buf = buf;
+	out.len = buflen;
+	out.pos = X509_SNAP_HEADER_LEN + count * X509_SNAP_INDEX_LEN;
+
+	for (i = 0; i < count; i++) {
+		n = strlen(sorted[i]->name);
+		start = out.pos;
+
+		x509_snap_put(&out, sorted[i]->name, n);
+
+		if ((ret = x509_snap_put_entry(&out, sorted[i])) != 0)
+			goto cleanup;
+
+		if (out.pos > 0xFFFFFFFF) {
+			ret = TROPICSSL_ERR_X509_SNAP_INVALID;
+			goto cleanup;
+		}
+
+		if (buf == NULL || out.pos > buflen)
+			continue;
+
+		idx = buf + X509_SNAP_HEADER_LEN + i * X509_SNAP_INDEX_LEN;
+		x509_snap_set_u32(idx, start);
+		x509_snap_set_u32(idx + 4, n);
+		x509_snap_set_u32(idx + 8, start + n);
+		x509_snap_set_u32(idx + 12, out.pos - start - n);
+
+		sha2(buf + start, out.pos - start, digest, 0);
+		memcpy(idx + 16, digest, X509_SNAP_DIGEST_LEN);
+	}
+
+	*olen = out.pos;
+
+	if (buf == NULL || buflen < out.pos) {
+		ret = TROPICSSL_ERR_MPI_BUFFER_TOO_SMALL;
+		goto cleanup;
+	}
+
+	memcpy(buf, x509_snap_magic, 8);
+	x509_snap_set_u32(buf + 8, X509_SNAP_VERSION);
+	x509_snap_set_u32(buf + 12, sizeof(t_uint) * 8);
+	x509_snap_set_u32(buf + 16, count);
+	x509_snap_set_u32(buf + 20, 0);
+	x509_snap_set_u32(buf + 24, (uint64_t)out.pos >> 32);
+	x509_snap_set_u32(buf + 28, out.pos & 0xFFFFFFFF);
+
+cleanup:
+
+	free(sorted);
+
+	return (ret);
+}
+
+/*
+ * Check the header and the index; the entries themselves are only
+ * hashed when loaded
+ */
+int x509_snap_attach(x509_snap * snap, const uint8_t *buf, size_t buflen)
+{
+	size_t i, count, noff, nlen, doff, dlen;
+	size_t pnoff = 0, pnlen = 0;
+	const uint8_t *idx;
+
+	memset(snap, 0, sizeof(x509_snap));
+
+	if (buflen < X509_SNAP_HEADER_LEN ||
+	    memcmp(buf, x509_snap_magic, 8) != 0 ||
+	    GET_U32(buf + 8) != X509_SNAP_VERSION ||
+	    GET_U32(buf + 20) != 0 || GET_U32(buf + 24) != 0 ||
+	    GET_U32(buf + 28) != buflen)
+		return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+	count = GET_U32(buf + 16);
+
+	if (count > (buflen - X509_SNAP_HEADER_LEN) / X509_SNAP_INDEX_LEN)
+		return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+	for (i = 0; i < count; i++) {
+		idx = buf + X509_SNAP_HEADER_LEN + i * X509_SNAP_INDEX_LEN;
+
+		noff = GET_U32(idx);
+		nlen = GET_U32(idx + 4);
+		doff = GET_U32(idx + 8);
+		dlen = GET_U32(idx + 12);
+
+		if (noff > buflen || nlen > buflen - noff ||
+		    doff > buflen || dlen > buflen - doff)
+			return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+		/*
+		 * Strictly ascending names, for the binary search
+		 */
+		if (i > 0 && x509_snap_cmp(buf + pnoff, pnlen,
+					   buf + noff, nlen) >= 0)
+			return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+		pnoff = noff;
+		pnlen = nlen;
+	}
+
+	snap->p = buf;
+	snap->len = buflen;
+	snap->count = count;
+	snap->limb_bits = (int)GET_U32(buf + 12);
+
+	return (0);
+}
+
+#if defined(TROPICSSL_FS_IO)
+/*
+ * Write a snapshot file
+ */
+int x509_snap_write(const char *path,
+		    const x509_snap_entry * entries, size_t count)
+{
+	int ret, fd;
+	size_t len, off;
+	ssize_t n;
+	uint8_t *buf;
+
+	ret = x509_snap_build(NULL, 0, &len, entries, count);
+	if (ret != TROPICSSL_ERR_MPI_BUFFER_TOO_SMALL)
+		return (ret);
+
+	if ((buf = (uint8_t *)malloc(len)) == NULL)
+		return (1);
+
+	if ((ret = x509_snap_build(buf, len, &len, entries, count)) != 0)
+		goto cleanup;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+		ret = TROPICSSL_ERR_FILE_IO_ERROR;
+		goto cleanup;
+	}
+
+	for (off = 0; off < len; off += (size_t)n) {
+		if ((n = write(fd, buf + off, len - off)) <= 0) {
+			ret = TROPICSSL_ERR_FILE_IO_ERROR;
+			break;
+		}
+	}
+
+	if (close(fd) != 0)
+		ret = TROPICSSL_ERR_FILE_IO_ERROR;
+
+cleanup:
+
+	memset(buf, 0, len);
+	free(buf);
+
+	return (ret);
+}
+
+/*
+ * Map a snapshot file
+ */
+int x509_snap_open(x509_snap * snap, const char *path)
+{
+	int ret, fd;
+	void *map;
+	struct stat st;
+
+	memset(snap, 0, sizeof(x509_snap));
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (TROPICSSL_ERR_FILE_IO_ERROR);
+
+	if (fstat(fd, &st) != 0 || st.st_size < X509_SNAP_HEADER_LEN) {
+		close(fd);
+		return (st.st_size < X509_SNAP_HEADER_LEN ?
+			TROPICSSL_ERR_X509_SNAP_INVALID :
+			TROPICSSL_ERR_FILE_IO_ERROR);
+	}
+
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return (TROPICSSL_ERR_FILE_IO_ERROR);
+
+	if ((ret = x509_snap_attach(snap, (const uint8_t *)map,
+				    (size_t) st.st_size)) != 0) {
+		munmap(map, (size_t) st.st_size);
+		return (ret);
+	}
+
+	snap->mapped = 1;
+
+	return (0);
+}
+#endif
+
+/*
+ * Binary search of the index
+ */
+int x509_snap_find(const x509_snap * snap, const char *name)
+{
+	int c;
+	size_t lo = 0, hi = snap->count, mid, len = strlen(name);
+	const uint8_t *idx;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		idx = snap->p + X509_SNAP_HEADER_LEN + mid * X509_SNAP_INDEX_LEN;
+
+		c = x509_snap_cmp((const uint8_t *)name, len,
+				  snap->p + GET_U32(idx), GET_U32(idx + 4));
+
+		if (c == 0)
+			return ((int)mid);
+
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return (TROPICSSL_ERR_X509_SNAP_NOT_FOUND);
+}
+
+const char *x509_snap_name(const x509_snap * snap, int idx, size_t *len)
+{
+	const uint8_t *p;
+
+	if (idx < 0 || (size_t)idx >= snap->count)
+		return (NULL);
+
+	p = snap->p + X509_SNAP_HEADER_LEN + idx * X509_SNAP_INDEX_LEN;
+	*len = GET_U32(p + 4);
+
+	return ((const char *)snap->p + GET_U32(p));
+}
+
+/*
+ * Input cursor over an entry's data
+ */
+static int x509_snap_get(const uint8_t **p, const uint8_t *end,
+			 const uint8_t **q, size_t *n)
+{
+	if (end - *p < 4)
+		return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+	*n = GET_U32(*p);
+	*p += 4;
+
+	if ((size_t)(end - *p) < *n)
+		return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+	*q = *p;
+	*p += *n;
+
+	return (0);
+}
+
+static int x509_snap_get_mpi(const uint8_t **p, const uint8_t *end,
+			     mpi * X)
+{
+	int ret;
+	size_t n;
+	const uint8_t *q;
+
+	if ((ret = x509_snap_get(p, end, &q, &n)) != 0)
+		return (ret);
+
+	return (mpi_read_binary(X, q, n));
+}
+
+static int x509_snap_get_key(const x509_snap * snap, const uint8_t **p,
+			     const uint8_t *end, rsa_context * rsa)
+{
+	int ret, i;
+	mpi *X[8];
+	mpi K[9];
+	mpi_mont *M[3];
+	const mpi *N[3];
+
+	memset(rsa, 0, sizeof(rsa_context));
+	mpi_init(&K[0], &K[1], &K[2], &K[3], &K[4], &K[5], &K[6], &K[7],
+		 &K[8], NULL);
+
+	X[0] = &rsa->N;
+	X[1] = &rsa->E;
+	X[2] = &rsa->D;
+	X[3] = &rsa->P;
+	X[4] = &rsa->Q;
+	X[5] = &rsa->DP;
+	X[6] = &rsa->DQ;
+	X[7] = &rsa->QP;
+
+	M[0] = &rsa->MP;
+	M[1] = &rsa->MQ;
+	M[2] = &rsa->MN;
+	N[0] = &rsa->P;
+	N[1] = &rsa->Q;
+	N[2] = &rsa->N;
+
+	for (i = 0; i < 8; i++)
+		MPI_CHK(x509_snap_get_mpi(p, end, X[i]));
+
+	for (i = 0; i < 9; i++)
+		MPI_CHK(x509_snap_get_mpi(p, end, &K[i]));
+
+	rsa->len = mpi_size(&rsa->N);
+
+	/*
+	 * R is a whole number of limbs: the constants of a writer with
+	 * other limbs are of no use here
+	 */
+	for (i = 0; i < 3; i++) {
+		if (snap->limb_bits == (int)(sizeof(t_uint) * 8)) {
+			MPI_CHK(mpi_mont_import(M[i], N[i], &K[i * 3],
+						&K[i * 3 + 1], &K[i * 3 + 2]));
+		} else {
+			MPI_CHK(mpi_mont_init(M[i], N[i]));
+		}
+	}
+
+cleanup:
+
+	mpi_free(&K[0], &K[1], &K[2], &K[3], &K[4], &K[5], &K[6], &K[7],
+		 &K[8], NULL);
+
+	if (ret != 0) {
+		rsa_free(rsa);
+		return (ret == TROPICSSL_ERR_BAD_ARG ?
+			TROPICSSL_ERR_X509_SNAP_INVALID : ret);
+	}
+
+	return (0);
+}
+
+/*
+ * Load the certificate chain and key of an entry
+ */
+int x509_snap_load(const x509_snap * snap, int idx,
+		   x509_cert * crt, rsa_context * rsa)
+{
+	int ret;
+	size_t i, n, count, nlen, dlen;
+	uint8_t digest[32];
+	const uint8_t *p, *q, *end, *e;
+	sha2_context ctx;
+
+	if (idx < 0 || (size_t)idx >= snap->count)
+		return (TROPICSSL_ERR_X509_SNAP_NOT_FOUND);
+
+	e = snap->p + X509_SNAP_HEADER_LEN + idx * X509_SNAP_INDEX_LEN;
+	nlen = GET_U32(e + 4);
+	dlen = GET_U32(e + 12);
+	p = snap->p + GET_U32(e + 8);
+	end = p + dlen;
+
+	/*
+	 * A flipped bit in a CRT value would give out faulty
+	 * signatures, which reveal the key
+	 */
+	sha2_starts(&ctx, 0);
+	sha2_update(&ctx, snap->p + GET_U32(e), nlen);
+	sha2_update(&ctx, p, dlen);
+	sha2_finish(&ctx, digest);
+	memset(&ctx, 0, sizeof(sha2_context));
+
+	if (memcmp(digest, e + 16, X509_SNAP_DIGEST_LEN) != 0)
+		return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+	if (end - p < 4)
+		return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+	count = GET_U32(p);
+	p += 4;
+
+	for (i = 0; i < count; i++) {
+		if ((ret = x509_snap_get(&p, end, &q, &n)) != 0)
+			return (ret);
+
+		if (p == end || *p != 0)
+			return (TROPICSSL_ERR_X509_SNAP_INVALID);
+
+		p++;
+
+		if ((ret = x509parse_crt_lazy(crt, q, n)) != 0)
+			return (ret);
+	}
+
+	if (rsa == NULL)
+		return (0);
+
+	if (end - p < 4 || GET_U32(p) != 1)
+		return (TROPICSSL_ERR_X509_SNAP_NOT_FOUND);
+
+	p += 4;
+
+	return (x509_snap_get_key(snap, &p, end, rsa));
+}
+
+/*
+ * Unmap or forget a snapshot
+ */
+void x509_snap_close(x509_snap * snap)
+{
+#if defined(TROPICSSL_FS_IO)
+	if (snap->mapped != 0)
+		munmap((void *)snap->p, snap->len);
+#endif
+
+	memset(snap, 0, sizeof(x509_snap));
+}
+
+#if defined(TROPICSSL_SELF_TEST)
+
+#include "tropicssl/certs.h"
+
+/*
+ * Checkup routine
+ */
+int x509_snap_self_test(int verbose)
+{
+	int ret = 1, i;
+	size_t len;
+	uint8_t *buf = NULL;
+	uint8_t in[256], out1[256], out2[256];
+	x509_cert crt[2], lcrt;
+	rsa_context rsa[2], lrsa;
+	x509_snap_entry entries[2];
+	x509_snap snap;
+
+	if (verbose != 0)
+		printf("  X.509 key snapshot: ");
+
+	memset(&snap, 0, sizeof(x509_snap));
+	memset(crt, 0, sizeof(crt));
+	memset(rsa, 0, sizeof(rsa));
+	memset(&lcrt, 0, sizeof(x509_cert));
+	memset(&lrsa, 0, sizeof(rsa_context));
+
+	if (x509parse_crt(&crt[0], (const uint8_t *)test_srv_crt,
+			  strlen(test_srv_crt)) != 0 ||
+	    x509parse_crt(&crt[0], (const uint8_t *)test_ca_crt,
+			  strlen(test_ca_crt)) != 0 ||
+	    x509parse_key(&rsa[0], (const uint8_t *)test_srv_key,
+			  strlen(test_srv_key), NULL, 0) != 0 ||
+	    x509parse_crt(&crt[1], (const uint8_t *)test_cli_crt,
+			  strlen(test_cli_crt)) != 0 ||
+	    x509parse_key(&rsa[1], (const uint8_t *)test_cli_key,
+			  strlen(test_cli_key), NULL, 0) != 0)
+		goto cleanup;
+
+	entries[0].name = "www.example.com";
+	entries[0].crt = &crt[0];
+	entries[0].rsa = &rsa[0];
+	entries[1].name = "mail.example.com";
+	entries[1].crt = &crt[1];
+	entries[1].rsa = &rsa[1];
+
+	if (x509_snap_build(NULL, 0, &len, entries, 2) !=
+	    TROPICSSL_ERR_MPI_BUFFER_TOO_SMALL ||
+	    (buf = (uint8_t *)malloc(len)) == NULL ||
+	    x509_snap_build(buf, len, &len, entries, 2) != 0 ||
+	    x509_snap_attach(&snap, buf, len) != 0)
+		goto cleanup;
+
+	/*
+	 * Sorted by name, so the second entry comes first; a miss
+	 */
+	if (x509_snap_find(&snap, "mail.example.com") != 0 ||
+	    (i = x509_snap_find(&snap, "www.example.com")) != 1 ||
+	    x509_snap_find(&snap, "example.com") !=
+	    TROPICSSL_ERR_X509_SNAP_NOT_FOUND)
+		goto cleanup;
+
+	if (x509_snap_load(&snap, i, &lcrt, &lrsa) != 0 ||
+	    lcrt.next == NULL || lcrt.next->version == 0 ||
+	    lcrt.raw.len != crt[0].raw.len ||
+	    memcmp(lcrt.raw.p, crt[0].raw.p, lcrt.raw.len) != 0 ||
+	    lcrt.next->raw.len != crt[0].next->raw.len ||
+	    mpi_cmp_mpi(&lrsa.QP, &rsa[0].QP) != 0 ||
+	    mpi_cmp_mpi(&lrsa.MP.RR, &rsa[0].MP.RR) != 0 ||
+	    mpi_cmp_mpi(&lrsa.MN.RRR, &rsa[0].MN.RRR) != 0 ||
+	    lrsa.MQ.mm != rsa[0].MQ.mm || lrsa.len != rsa[0].len)
+		goto cleanup;
+
+	/*
+	 * The loaded key signs as the parsed one
+	 */
+	memset(in, 0x2A, sizeof(in));
+	in[0] = 0;
+
+	if (rsa_private(&rsa[0], in, out1) != 0 ||
+	    rsa_private(&lrsa, in, out2) != 0 ||
+	    memcmp(out1, out2, rsa[0].len) != 0)
+		goto cleanup;
+
+	/*
+	 * Any damage to an entry is caught before use
+	 */
+	buf[len - 40] ^= 0x01;
+
+	x509_free(&lcrt);
+	rsa_free(&lrsa);
+	memset(&lcrt, 0, sizeof(x509_cert));
+
+	if (x509_snap_load(&snap, i, &lcrt, &lrsa) !=
+	    TROPICSSL_ERR_X509_SNAP_INVALID)
+		goto cleanup;
+
+	buf[len - 40] ^= 0x01;
+	buf[20] = 1;
+
+	if (x509_snap_attach(&snap, buf, len) !=
+	    TROPICSSL_ERR_X509_SNAP_INVALID)
+		goto cleanup;
+
+	ret = 0;
+
+cleanup:
+
+	x509_snap_close(&snap);
+	free(buf);
+	x509_free(&lcrt);
+	rsa_free(&lrsa);
+
+	for (i = 0; i < 2; i++) {
+		x509_free(&crt[i]);
+		rsa_free(&rsa[i]);
+	}
+
+	if (verbose != 0)
+		printf(ret == 0 ? "passed\n\n" : "failed\n");
+
+	return (ret);
+}
+
+#endif
+
+#endif
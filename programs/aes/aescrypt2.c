@@ -43,6 +43,8 @@
 #else
 #include <sys/types.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
 #endif
 
 #include <string.h>
@@ -52,16 +54,407 @@
 
 #include "tropicssl/aes.h"
 #include "tropicssl/sha2.h"
+#include "tropicssl/gcm.h"
+#include "tropicssl/entropy.h"
 
 #define MODE_ENCRYPT    0
 #define MODE_DECRYPT    1
+#define MODE_CHUNKED    2
+
+#define CHUNK_DFL_KB        1024
+#define CHUNK_MAX_KB        65536
+#define CHUNK_MAX_THREADS   64
 
 #define USAGE   \
-    "\n  aescrypt2 <mode> <input filename> <output filename> <key>\n" \
-    "\n   <mode>: 0 = encrypt, 1 = decrypt\n" \
+    "\n  aescrypt2 <mode> <input filename> <output filename> <key>" \
+    " [param=<>...]\n" \
+    "\n   <mode>: 0 = encrypt, 1 = decrypt, 2 = chunked encrypt\n" \
+    "\n   mode 1 reads both formats; for chunked files:\n" \
+    "    threads=%%d          default: one per online CPU\n" \
+    "    chunk=%%d            segment size in KB, default: 1024\n" \
+    "    offset=%%lld         first plaintext byte to decrypt\n" \
+    "    length=%%lld         bytes to decrypt, default: to the end\n" \
     "\n  example: aescrypt2 0 file file.aes hex:E76B2413958B00E193\n" \
     "\n"
 
+#if defined(TROPICSSL_GCM) && !defined(WIN32)
+/*
+ * Chunked container:
+ *
+ *        00 .. 07              "AESCRYP2"
+ *        08 .. 11              segment size (little endian)
+ *        12 .. 15              reserved, zero
+ *        16 .. 23              plaintext size (little endian)
+ *        24 .. 39              random salt
+ *        40 .. 63              HMAC-SHA-256(header key, bytes 0..39)
+ *        64 ..                 segments, each AES-256-GCM(plaintext)
+ *                              followed by its 16-byte tag
+ *
+ * Segment i uses the nonce 0^4 || BE64(i) and bytes 0..39 of the
+ * header as additional data, so segments cannot be moved, truncated
+ * or spliced between files.  Each one is independently authenticated,
+ * which is what lets workers run in parallel and lets a range be
+ * decrypted without reading the rest of the file.
+ */
+#define CHUNK_MAGIC         "AESCRYP2"
+#define CHUNK_HDR_LEN       64
+#define CHUNK_AAD_LEN       40
+#define CHUNK_TAG_LEN       16
+
+struct chunk_file {
+	int fd_in;
+	int fd_out;
+	int mode;
+	int threads;
+	uint32_t chunk;		/* segment size                 */
+	uint64_t size;		/* plaintext size               */
+	uint64_t first;		/* first segment to process     */
+	uint64_t last;		/* one past the last segment    */
+	uint64_t offset;	/* plaintext range to write out */
+	uint64_t length;
+	uint8_t hdr[CHUNK_HDR_LEN];
+	uint8_t key[32];	/* segment key                  */
+	volatile int failed;
+};
+
+struct chunk_job {
+	struct chunk_file *f;
+	int id;
+	pthread_t tid;
+};
+
+static int pread_full(int fd, uint8_t *buf, size_t len, off_t pos)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, len, pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		buf += n;
+		len -= n;
+		pos += n;
+	}
+
+	return (0);
+}
+
+static int pwrite_full(int fd, const uint8_t *buf, size_t len, off_t pos)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		buf += n;
+		len -= n;
+		pos += n;
+	}
+
+	return (0);
+}
+
+static void put_le(uint8_t *p, uint64_t v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		p[i] = (uint8_t)(v >> (i << 3));
+}
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = n - 1; i >= 0; i--)
+		v = (v << 8) | p[i];
+
+	return (v);
+}
+
+/*
+ * Same iterated hash as the original format, with the salt in place
+ * of the IV; the segment and header keys are then split off it.
+ */
+static void chunk_keys(struct chunk_file *f, uint8_t hkey[32],
+		       const uint8_t *key, int keylen)
+{
+	int i;
+	uint8_t digest[32];
+	sha2_context sha_ctx;
+
+	memset(digest, 0, 32);
+	memcpy(digest, f->hdr + 24, 16);
+
+	for (i = 0; i < 8192; i++) {
+		sha2_starts(&sha_ctx, 0);
+		sha2_update(&sha_ctx, digest, 32);
+		sha2_update(&sha_ctx, key, keylen);
+		sha2_finish(&sha_ctx, digest);
+	}
+
+	sha2_hmac(digest, 32, (const uint8_t *)"segment", 7, f->key, 0);
+	sha2_hmac(digest, 32, (const uint8_t *)"header", 6, hkey, 0);
+
+	memset(digest, 0, sizeof(digest));
+	memset(&sha_ctx, 0, sizeof(sha_ctx));
+}
+
+static void *chunk_worker(void *arg)
+{
+	struct chunk_job *job = (struct chunk_job *)arg;
+	struct chunk_file *f = job->f;
+	uint64_t i, pos, lo, hi;
+	off_t enc;
+	size_t n;
+	uint8_t iv[12], *buf;
+	gcm_context gcm;
+
+	if ((buf = (uint8_t *)malloc(f->chunk + CHUNK_TAG_LEN)) == NULL) {
+		fprintf(stderr, "malloc(%u bytes) failed\n",
+			(unsigned int)(f->chunk + CHUNK_TAG_LEN));
+		f->failed = 1;
+		return (NULL);
+	}
+
+	gcm_init(&gcm, f->key, 256);
+	memset(iv, 0, sizeof(iv));
+
+	for (i = f->first + job->id; i < f->last && !f->failed;
+	     i += f->threads) {
+		pos = i * f->chunk;
+		n = (f->size - pos > f->chunk) ? f->chunk :
+		    (size_t)(f->size - pos);
+		enc = (off_t)(CHUNK_HDR_LEN +
+			      i * (f->chunk + CHUNK_TAG_LEN));
+		for (lo = 0; lo < 8; lo++)
+			iv[4 + lo] = (uint8_t)(i >> ((7 - lo) << 3));
+
+		if (f->mode == MODE_ENCRYPT) {
+			if (pread_full(f->fd_in, buf, n, (off_t)pos) != 0) {
+				perror("pread");
+				f->failed = 1;
+				break;
+			}
+
+			gcm_crypt_and_tag(&gcm, GCM_ENCRYPT, n, iv, 12,
+					  f->hdr, CHUNK_AAD_LEN, buf, buf,
+					  CHUNK_TAG_LEN, buf + n);
+
+			if (pwrite_full(f->fd_out, buf,
+					n + CHUNK_TAG_LEN, enc) != 0) {
+				perror("pwrite");
+				f->failed = 1;
+				break;
+			}
+			continue;
+		}
+
+		if (pread_full(f->fd_in, buf, n + CHUNK_TAG_LEN, enc) != 0) {
+			perror("pread");
+			f->failed = 1;
+			break;
+		}
+
+		if (gcm_auth_decrypt(&gcm, n, iv, 12, f->hdr, CHUNK_AAD_LEN,
+				     buf + n, CHUNK_TAG_LEN, buf, buf) != 0) {
+			fprintf(stderr, "segment %llu: authentication "
+				"failed, file corrupted.\n",
+				(unsigned long long)i);
+			f->failed = 1;
+			break;
+		}
+
+		/*
+		 * Only the part of the segment inside the requested
+		 * range is written, at its position within that range.
+		 */
+		lo = (pos > f->offset) ? pos : f->offset;
+		hi = (pos + n < f->offset + f->length) ? pos + n :
+		    f->offset + f->length;
+
+		if (hi > lo &&
+		    pwrite_full(f->fd_out, buf + (lo - pos), (size_t)(hi - lo),
+				(off_t)(lo - f->offset)) != 0) {
+			perror("pwrite");
+			f->failed = 1;
+			break;
+		}
+	}
+
+	memset(buf, 0, f->chunk + CHUNK_TAG_LEN);
+	free(buf);
+	memset(&gcm, 0, sizeof(gcm));
+
+	return (NULL);
+}
+
+static int chunk_run(struct chunk_file *f)
+{
+	int i, started;
+	struct chunk_job jobs[CHUNK_MAX_THREADS];
+
+	if ((uint64_t)f->threads > f->last - f->first)
+		f->threads = (f->last - f->first > 0) ?
+		    (int)(f->last - f->first) : 1;
+
+	for (started = 0; started < f->threads; started++) {
+		jobs[started].f = f;
+		jobs[started].id = started;
+
+		if (started == f->threads - 1)
+			break;
+
+		if (pthread_create(&jobs[started].tid, NULL,
+				   chunk_worker, &jobs[started]) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			f->failed = 1;
+			break;
+		}
+	}
+
+	/*
+	 * The calling thread takes the last stride itself.
+	 */
+	if (!f->failed)
+		chunk_worker(&jobs[started]);
+
+	for (i = 0; i < started; i++)
+		pthread_join(jobs[i].tid, NULL);
+
+	return (f->failed ? 1 : 0);
+}
+
+static int chunk_encrypt(struct chunk_file *f, const char *name,
+			 const uint8_t *key, int keylen)
+{
+	uint8_t hkey[32], mac[32];
+
+	memcpy(f->hdr, CHUNK_MAGIC, 8);
+	put_le(f->hdr + 8, f->chunk, 4);
+	put_le(f->hdr + 16, f->size, 8);
+
+	/*
+	 * GCM nonces are only unique per key, so the salt must never
+	 * repeat: use the entropy pool where it is built in, otherwise
+	 * the file name, size and current time.
+	 */
+#if defined(TROPICSSL_ENTROPY)
+	{
+		entropy_context entropy;
+
+		if (entropy_init(&entropy) != 0 ||
+		    entropy_func(&entropy, f->hdr + 24, 16) != 0) {
+			fprintf(stderr, "entropy source failed\n");
+			entropy_free(&entropy);
+			return (1);
+		}
+		entropy_free(&entropy);
+	}
+#else
+	{
+		sha2_context sha_ctx;
+		uint8_t stamp[16];
+
+		put_le(stamp, f->size, 8);
+		put_le(stamp + 8, (uint64_t)time(NULL) ^
+		       ((uint64_t)clock() << 32) ^ (uint64_t)getpid(), 8);
+
+		sha2_starts(&sha_ctx, 0);
+		sha2_update(&sha_ctx, stamp, 16);
+		sha2_update(&sha_ctx, (const uint8_t *)name, strlen(name));
+		sha2_finish(&sha_ctx, mac);
+		memcpy(f->hdr + 24, mac, 16);
+	}
+#endif
+	(void)name;
+
+	chunk_keys(f, hkey, key, keylen);
+	sha2_hmac(hkey, 32, f->hdr, CHUNK_AAD_LEN, mac, 0);
+	memcpy(f->hdr + CHUNK_AAD_LEN, mac, CHUNK_HDR_LEN - CHUNK_AAD_LEN);
+	memset(hkey, 0, sizeof(hkey));
+
+	if (pwrite_full(f->fd_out, f->hdr, CHUNK_HDR_LEN, 0) != 0) {
+		perror("pwrite");
+		return (1);
+	}
+
+	f->first = 0;
+	f->last = (f->size + f->chunk - 1) / f->chunk;
+
+	return (chunk_run(f));
+}
+
+static int chunk_decrypt(struct chunk_file *f, off_t filesize,
+			 const uint8_t *key, int keylen,
+			 int64_t offset, int64_t length)
+{
+	int i, diff = 0;
+	uint64_t segs;
+	uint8_t hkey[32], mac[32];
+
+	if (pread_full(f->fd_in, f->hdr, CHUNK_HDR_LEN, 0) != 0) {
+		fprintf(stderr, "File too short to be encrypted.\n");
+		return (1);
+	}
+
+	f->chunk = (uint32_t)get_le(f->hdr + 8, 4);
+	f->size = get_le(f->hdr + 16, 8);
+
+	if (f->chunk == 0 || f->chunk > CHUNK_MAX_KB * 1024) {
+		fprintf(stderr, "Bad segment size in header.\n");
+		return (1);
+	}
+
+	chunk_keys(f, hkey, key, keylen);
+	sha2_hmac(hkey, 32, f->hdr, CHUNK_AAD_LEN, mac, 0);
+	memset(hkey, 0, sizeof(hkey));
+
+	for (i = 0; i < CHUNK_HDR_LEN - CHUNK_AAD_LEN; i++)
+		diff |= mac[i] ^ f->hdr[CHUNK_AAD_LEN + i];
+
+	if (diff != 0) {
+		fprintf(stderr, "HMAC check failed: wrong key, "
+			"or file corrupted.\n");
+		return (1);
+	}
+
+	segs = (f->size + f->chunk - 1) / f->chunk;
+
+	if ((uint64_t)filesize != CHUNK_HDR_LEN + f->size +
+	    segs * CHUNK_TAG_LEN) {
+		fprintf(stderr, "File size does not match the header: "
+			"truncated or corrupted.\n");
+		return (1);
+	}
+
+	if (offset < 0 || (uint64_t)offset > f->size) {
+		fprintf(stderr, "offset beyond the end of the plaintext\n");
+		return (1);
+	}
+
+	if (length < 0 || (uint64_t)length > f->size - offset)
+		length = (int64_t)(f->size - offset);
+
+	f->offset = (uint64_t)offset;
+	f->length = (uint64_t)length;
+
+	if (length == 0)
+		return (0);
+
+	f->first = f->offset / f->chunk;
+	f->last = (f->offset + f->length - 1) / f->chunk + 1;
+
+	return (chunk_run(f));
+}
+#endif /* TROPICSSL_GCM && !WIN32 */
+
 int main(int argc, char *argv[])
 {
 	int ret = 1, i, n;
@@ -77,6 +470,10 @@ int main(int argc, char *argv[])
 	aes_context aes_ctx;
 	sha2_context sha_ctx;
 
+	int threads = 0, chunk_kb = CHUNK_DFL_KB;
+	long long range_off = 0, range_len = -1;
+	char *q;
+
 #if defined(WIN32)
 	LARGE_INTEGER li_size;
 	__int64 filesize, offset;
@@ -87,7 +484,8 @@ int main(int argc, char *argv[])
 	/*
 	 * Parse the command-line arguments.
 	 */
-	if (argc != 5) {
+	if (argc < 5) {
+usage:
 		printf(USAGE);
 
 #if defined(WIN32)
@@ -101,11 +499,46 @@ int main(int argc, char *argv[])
 
 	mode = atoi(argv[1]);
 
-	if (mode != MODE_ENCRYPT && mode != MODE_DECRYPT) {
+	if (mode != MODE_ENCRYPT && mode != MODE_DECRYPT &&
+	    mode != MODE_CHUNKED) {
 		fprintf(stderr, "invalide operation mode\n");
 		goto exit;
 	}
 
+	for (i = 5; i < argc; i++) {
+		p = argv[i];
+
+		if ((q = strchr(p, '=')) == NULL)
+			goto usage;
+
+		*q++ = '\0';
+
+		if (strcmp(p, "threads") == 0) {
+			threads = atoi(q);
+			if (threads < 1 || threads > CHUNK_MAX_THREADS)
+				goto usage;
+		} else if (strcmp(p, "chunk") == 0) {
+			chunk_kb = atoi(q);
+			if (chunk_kb < 1 || chunk_kb > CHUNK_MAX_KB)
+				goto usage;
+		} else if (strcmp(p, "offset") == 0) {
+			range_off = atoll(q);
+			if (range_off < 0)
+				goto usage;
+		} else if (strcmp(p, "length") == 0) {
+			range_len = atoll(q);
+			if (range_len < 0)
+				goto usage;
+		} else
+			goto usage;
+	}
+
+	if (mode != MODE_DECRYPT && (range_off != 0 || range_len >= 0)) {
+		fprintf(stderr, "offset and length only apply to "
+			"decryption\n");
+		goto exit;
+	}
+
 	if (strcmp(argv[2], argv[3]) == 0) {
 		fprintf(stderr, "input and output filenames must differ\n");
 		goto exit;
@@ -176,6 +609,63 @@ int main(int argc, char *argv[])
 		goto exit;
 	}
 
+	/*
+	 * Chunked files are recognised by their magic; anything else
+	 * is taken to be in the original format.
+	 */
+	if (mode == MODE_DECRYPT) {
+		if (filesize >= 8 && fread(buffer, 1, 8, fin) == 8 &&
+		    memcmp(buffer, "AESCRYP2", 8) == 0)
+			mode = MODE_CHUNKED + MODE_DECRYPT;
+		else if (range_off != 0 || range_len >= 0) {
+			fprintf(stderr, "offset and length require the "
+				"chunked format\n");
+			goto exit;
+		}
+
+		if (fseek(fin, 0, SEEK_SET) < 0) {
+			fprintf(stderr, "fseek(0,SEEK_SET) failed\n");
+			goto exit;
+		}
+	}
+
+	if (mode >= MODE_CHUNKED) {
+#if defined(TROPICSSL_GCM) && !defined(WIN32)
+		struct chunk_file f;
+
+		memset(&f, 0, sizeof(f));
+		f.fd_in = fileno(fin);
+		f.fd_out = fileno(fout);
+		f.chunk = (uint32_t)chunk_kb * 1024;
+		f.size = (uint64_t)filesize;
+		f.threads = threads;
+
+		if (f.threads == 0) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+			f.threads = (cpus < 1) ? 1 :
+			    (cpus > CHUNK_MAX_THREADS) ? CHUNK_MAX_THREADS :
+			    (int)cpus;
+		}
+
+		if (mode == MODE_CHUNKED) {
+			f.mode = MODE_ENCRYPT;
+			ret = chunk_encrypt(&f, argv[2], key, keylen);
+		} else {
+			f.mode = MODE_DECRYPT;
+			ret = chunk_decrypt(&f, filesize, key, keylen,
+					    range_off, range_len);
+		}
+
+		memset(key, 0, sizeof(key));
+		memset(&f, 0, sizeof(f));
+#else
+		fprintf(stderr, "chunked format requires TROPICSSL_GCM "
+			"and POSIX I/O\n");
+#endif
+		goto exit;
+	}
+
 	if (mode == MODE_ENCRYPT) {
 		/*
 		 * Generate the initialization vector as:
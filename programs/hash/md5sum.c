@@ -40,11 +40,27 @@
 #include <string.h>
 #include <stdio.h>
 
+#include "tropicssl/config.h"
 #include "tropicssl/md5.h"
+#include "tropicssl/treehash.h"
+
+#if defined(TROPICSSL_TREEHASH)
+/*
+ * --parallel: tree digest of the mapped file on all CPUs
+ */
+static int parallel = 0;
+#endif
 
 static int md5_wrapper(char *filename, uint8_t *sum)
 {
-	int ret = md5_file(filename, sum);
+	int ret;
+
+#if defined(TROPICSSL_TREEHASH)
+	if (parallel != 0)
+		ret = treehash_file(TREEHASH_MD5, filename, 0, sum);
+	else
+#endif
+		ret = md5_file(filename, sum);
 
 	if (ret == 1)
 		fprintf(stderr, "failed to open: %s\n", filename);
@@ -150,6 +166,9 @@ int main(int argc, char *argv[])
 	if (argc == 1) {
 		printf("print mode:  md5sum <file> <file> ...\n");
 		printf("check mode:  md5sum -c <checksum file>\n");
+#if defined(TROPICSSL_TREEHASH)
+		printf("tree digest: md5sum --parallel [-c] ...\n");
+#endif
 
 #ifdef WIN32
 		printf("\n  Press Enter to exit this program.\n");
@@ -160,6 +179,14 @@ int main(int argc, char *argv[])
 		return (1);
 	}
 
+#if defined(TROPICSSL_TREEHASH)
+	if (argc > 1 && strcmp("--parallel", argv[1]) == 0) {
+		parallel = 1;
+		argv++;
+		argc--;
+	}
+#endif
+
 	if (argc == 3 && strcmp("-c", argv[1]) == 0)
 		return (md5_check(argv[2]));
 
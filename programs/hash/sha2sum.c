@@ -38,13 +38,31 @@
 #endif
 
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 
+#include "tropicssl/config.h"
 #include "tropicssl/sha2.h"
+#include "tropicssl/treehash.h"
+#include "tropicssl/hashmb.h"
+
+#if defined(TROPICSSL_TREEHASH)
+/*
+ * --parallel: tree digest of the mapped file on all CPUs
+ */
+static int parallel = 0;
+#endif
 
 static int sha2_wrapper(char *filename, uint8_t *sum)
 {
-	int ret = sha2_file(filename, sum, 0);
+	int ret;
+
+#if defined(TROPICSSL_TREEHASH)
+	if (parallel != 0)
+		ret = treehash_file(TREEHASH_SHA256, filename, 0, sum);
+	else
+#endif
+		ret = sha2_file(filename, sum, 0);
 
 	if (ret == 1)
 		fprintf(stderr, "failed to open: %s\n", filename);
@@ -143,6 +161,85 @@ static int sha2_check(char *filename)
 	return (nb_err1 != 0 || nb_err2 != 0);
 }
 
+#if defined(TROPICSSL_HASHMB)
+/*
+ * Files up to this size are read whole and hashed in batches
+ */
+#define BATCH_MAX_SIZE	(64 * 1024)
+#define BATCH_COUNT	16
+
+/*
+ * Read a small file whole: returns the buffer, or NULL if the file
+ * cannot be read this way (sha2_file() then reports why)
+ */
+static uint8_t *sha2_load(char *filename, size_t * len)
+{
+	FILE *f;
+	long size;
+	uint8_t *p;
+
+	if ((f = fopen(filename, "rb")) == NULL)
+		return (NULL);
+
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+	    size > BATCH_MAX_SIZE || fseek(f, 0, SEEK_SET) != 0 ||
+	    (p = (uint8_t *)malloc((size_t)size + 1)) == NULL) {
+		fclose(f);
+		return (NULL);
+	}
+
+	if (fread(p, 1, (size_t)size, f) != (size_t)size) {
+		free(p);
+		fclose(f);
+		return (NULL);
+	}
+
+	fclose(f);
+	*len = (size_t)size;
+	return (p);
+}
+
+/*
+ * Print mode over up to BATCH_COUNT files: the small ones are hashed
+ * together, the others one by one as before
+ */
+static int sha2_print_batch(char *names[], int n)
+{
+	const uint8_t *input[BATCH_COUNT];
+	uint8_t *data[BATCH_COUNT];
+	size_t ilen[BATCH_COUNT];
+	uint8_t *output[BATCH_COUNT];
+	uint8_t sums[BATCH_COUNT][32];
+	int i, j, k, ret = 0;
+
+	for (i = k = 0; i < n; i++) {
+		data[i] = sha2_load(names[i], &ilen[k]);
+		if (data[i] != NULL) {
+			input[k] = data[i];
+			output[k] = sums[i];
+			k++;
+		}
+	}
+
+	hashmb_sha2(k, input, ilen, output, 0);
+
+	for (i = 0; i < n; i++) {
+		if (data[i] == NULL) {
+			ret |= sha2_print(names[i]);
+			continue;
+		}
+
+		for (j = 0; j < 32; j++)
+			printf("%02x", sums[i][j]);
+
+		printf("  %s\n", names[i]);
+		free(data[i]);
+	}
+
+	return (ret);
+}
+#endif
+
 int main(int argc, char *argv[])
 {
 	int ret, i;
@@ -150,6 +247,9 @@ int main(int argc, char *argv[])
 	if (argc == 1) {
 		printf("print mode:  sha2sum <file> <file> ...\n");
 		printf("check mode:  sha2sum -c <checksum file>\n");
+#if defined(TROPICSSL_TREEHASH)
+		printf("tree digest: sha2sum --parallel [-c] ...\n");
+#endif
 
 #ifdef WIN32
 		printf("\n  Press Enter to exit this program.\n");
@@ -160,11 +260,29 @@ int main(int argc, char *argv[])
 		return (1);
 	}
 
+#if defined(TROPICSSL_TREEHASH)
+	if (argc > 1 && strcmp("--parallel", argv[1]) == 0) {
+		parallel = 1;
+		argv++;
+		argc--;
+	}
+#endif
+
 	if (argc == 3 && strcmp("-c", argv[1]) == 0)
 		return (sha2_check(argv[2]));
 
 	ret = 0;
-	for (i = 1; i < argc; i++)
+	i = 1;
+#if defined(TROPICSSL_HASHMB)
+#if defined(TROPICSSL_TREEHASH)
+	if (parallel == 0)
+#endif
+		for (; i < argc; i += BATCH_COUNT)
+			ret |= sha2_print_batch(argv + i,
+						argc - i < BATCH_COUNT ?
+						argc - i : BATCH_COUNT);
+#endif
+	for (; i < argc; i++)
 		ret |= sha2_print(argv[i]);
 
 	return (ret);
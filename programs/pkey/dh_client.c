@@ -162,6 +162,14 @@ int main(void)
 	printf("\n  . Verifying the server's RSA signature");
 	fflush(stdout);
 
+	if (end - p < 2 || ((p[0] << 8) | p[1]) != end - p - 2) {
+		ret = 1;
+		printf(" failed\n  ! Invalid RSA signature length\n\n");
+		goto exit;
+	}
+
+	p += 2;
+
 	if ((n = (int)(end - p)) != rsa.len) {
 		ret = 1;
 		printf(" failed\n  ! Invalid RSA signature size\n\n");
@@ -183,7 +191,7 @@ int main(void)
 	fflush(stdout);
 
 	n = dhm.len;
-	if ((ret = dhm_make_public(&dhm, 256, buf, n, havege_rand, &hs)) != 0) {
+	if ((ret = dhm_make_public(&dhm, 256, buf, n, havege_random, &hs)) != 0) {
 		printf(" failed\n  ! dhm_make_public returned %d\n\n", ret);
 		goto exit;
 	}
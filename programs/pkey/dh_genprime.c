@@ -48,6 +48,7 @@
  * so it is a generator of order Q (with P = 2*Q+1).
  */
 #define DH_P_SIZE 1024
+#define THREADS   4
 #define GENERATOR "4"
 
 int main(void)
@@ -73,8 +74,9 @@ int main(void)
 	/*
 	 * This can take a long time...
 	 */
-	if ((ret = mpi_gen_prime(&P, DH_P_SIZE, 1, havege_rand, &hs)) != 0) {
-		printf(" failed\n  ! mpi_gen_prime returned %d\n\n", ret);
+	if ((ret = mpi_gen_prime_mt(&P, DH_P_SIZE, 1, THREADS,
+				    havege_random, &hs)) != 0) {
+		printf(" failed\n  ! mpi_gen_prime_mt returned %d\n\n", ret);
 		goto exit;
 	}
 
@@ -91,7 +93,7 @@ int main(void)
 		goto exit;
 	}
 
-	if ((ret = mpi_is_prime(&Q, havege_rand, &hs)) != 0) {
+	if ((ret = mpi_is_prime(&Q, havege_random, &hs)) != 0) {
 		printf(" failed\n  ! mpi_is_prime returned %d\n\n", ret);
 		goto exit;
 	}
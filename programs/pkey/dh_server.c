@@ -154,7 +154,7 @@ int main(void)
 
 	memset(buf, 0, sizeof(buf));
 
-	if ((ret = dhm_make_params(&dhm, 256, buf, &n, havege_rand, &hs)) != 0) {
+	if ((ret = dhm_make_params(&dhm, 256, buf, &n, havege_random, &hs)) != 0) {
 		printf(" failed\n  ! dhm_make_params returned %d\n\n", ret);
 		goto exit;
 	}
@@ -0,0 +1,236 @@
+/*
+ *  Key and certificate snapshot tool
+ *
+ *  Based on XySSL: Copyright (C) 2006-2008  Christophe Devine
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_DEPRECATE 1
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "tropicssl/config.h"
+#include "tropicssl/x509snap.h"
+#include "tropicssl/timing.h"
+
+#if !defined(TROPICSSL_X509_SNAP_C) || !defined(TROPICSSL_FS_IO)
+int main(void)
+{
+	printf("TROPICSSL_X509_SNAP_C and/or TROPICSSL_FS_IO not defined.\n");
+	return (0);
+}
+#else
+
+#define MAX_ENTRIES     256
+
+#define USAGE                                                           \
+    "\n usage: key_snapshot param=<>...\n"                              \
+    "\n write a snapshot:\n"                                            \
+    "    out=<file> then for each host:\n"                             \
+    "    name=<host> crt=<chain file> key=<key file> [pwd=<password>]\n" \
+    "\n check a snapshot:\n"                                            \
+    "    in=<file> [name=<host>]  load every entry, or just that one\n\n"
+
+static x509_cert crts[MAX_ENTRIES];
+static rsa_context keys[MAX_ENTRIES];
+static x509_snap_entry entries[MAX_ENTRIES];
+
+/*
+ * Load and time each entry, as a server would at startup
+ */
+static int check_snapshot(const char *path, const char *name)
+{
+	int ret, i, first, last;
+	size_t len;
+	const char *p;
+	x509_snap snap;
+	x509_cert crt;
+	rsa_context rsa;
+	struct hr_time t;
+	unsigned long ms;
+
+	printf("  . Mapping %s ...", path);
+	fflush(stdout);
+
+	get_timer(&t, 1);
+
+	if ((ret = x509_snap_open(&snap, path)) != 0) {
+		printf(" failed\n  !  x509_snap_open returned -0x%04X\n", -ret);
+		return (ret);
+	}
+
+	printf(" ok (%u entries, %d-bit limbs)\n", (unsigned)snap.count,
+	       snap.limb_bits);
+
+	first = 0;
+	last = (int)snap.count - 1;
+
+	if (name != NULL) {
+		if ((first = x509_snap_find(&snap, name)) < 0) {
+			printf("  !  %s not found\n", name);
+			x509_snap_close(&snap);
+			return (first);
+		}
+
+		last = first;
+	}
+
+	for (i = first; i <= last; i++) {
+		memset(&crt, 0, sizeof(x509_cert));
+
+		if ((ret = x509_snap_load(&snap, i, &crt, &rsa)) != 0) {
+			p = x509_snap_name(&snap, i, &len);
+			printf("  !  %.*s: x509_snap_load returned -0x%04X\n",
+			       (int)len, p, -ret);
+			x509_free(&crt);
+			x509_snap_close(&snap);
+			return (ret);
+		}
+
+		x509_free(&crt);
+		rsa_free(&rsa);
+	}
+
+	ms = get_timer(&t, 0);
+
+	printf("  . Loaded %d entries in %lu ms\n", last - first + 1, ms);
+
+	x509_snap_close(&snap);
+
+	return (0);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 1, i, count = 0;
+	char *p, *q;
+	const char *out = NULL, *in = NULL, *name = NULL, *pwd = NULL;
+	const char *crt = NULL, *key = NULL;
+
+	for (i = 1; i < argc; i++) {
+		p = argv[i];
+
+		if ((q = strchr(p, '=')) == NULL)
+			goto usage;
+
+		*q++ = '\0';
+
+		if (strcmp(p, "out") == 0)
+			out = q;
+		else if (strcmp(p, "in") == 0)
+			in = q;
+		else if (strcmp(p, "name") == 0)
+			name = q;
+		else if (strcmp(p, "crt") == 0)
+			crt = q;
+		else if (strcmp(p, "key") == 0)
+			key = q;
+		else if (strcmp(p, "pwd") == 0)
+			pwd = q;
+		else
+			goto usage;
+
+		if (out == NULL || name == NULL || crt == NULL || key == NULL)
+			continue;
+
+		/*
+		 * One host per name=, crt= and key= (and pwd=) group
+		 */
+		if (count == MAX_ENTRIES) {
+			printf("  !  at most %d hosts\n", MAX_ENTRIES);
+			goto exit;
+		}
+
+		printf("  . Parsing %s ...", name);
+		fflush(stdout);
+
+		memset(&crts[count], 0, sizeof(x509_cert));
+
+		if ((ret = x509parse_crtfile(&crts[count], crt)) != 0) {
+			printf(" failed\n  !  x509parse_crtfile returned"
+			       " -0x%04X\n", -ret);
+			goto exit;
+		}
+
+		if ((ret = x509parse_keyfile(&keys[count], key, pwd)) != 0) {
+			printf(" failed\n  !  x509parse_keyfile returned"
+			       " -0x%04X\n", -ret);
+			goto exit;
+		}
+
+		printf(" ok\n");
+
+		entries[count].name = name;
+		entries[count].crt = &crts[count];
+		entries[count].rsa = &keys[count];
+		count++;
+
+		name = crt = key = pwd = NULL;
+	}
+
+	if (in != NULL && out == NULL) {
+		ret = check_snapshot(in, name);
+		goto exit;
+	}
+
+	if (out == NULL || count == 0 || name != NULL || crt != NULL ||
+	    key != NULL)
+		goto usage;
+
+	printf("  . Writing %s ...", out);
+	fflush(stdout);
+
+	if ((ret = x509_snap_write(out, entries, (size_t)count)) != 0) {
+		printf(" failed\n  !  x509_snap_write returned -0x%04X\n", -ret);
+		goto exit;
+	}
+
+	printf(" ok (%d hosts)\n", count);
+
+exit:
+
+	for (i = 0; i < count; i++) {
+		x509_free(&crts[i]);
+		rsa_free(&keys[i]);
+	}
+
+	return (ret);
+
+usage:
+
+	printf(USAGE);
+	goto exit;
+}
+#endif
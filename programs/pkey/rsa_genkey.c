@@ -46,6 +46,7 @@
 
 #define KEY_SIZE 1024
 #define EXPONENT 65537
+#define THREADS  4
 
 int main(void)
 {
@@ -64,10 +65,10 @@ int main(void)
 	printf(" ok\n  . Generating the RSA key [ %d-bit ]...", KEY_SIZE);
 	fflush(stdout);
 
-	rsa_init(&rsa, RSA_PKCS_V15, 0, havege_rand, &hs);
+	rsa_init(&rsa, RSA_PKCS_V15, 0, havege_random, &hs);
 
-	if ((ret = rsa_gen_key(&rsa, KEY_SIZE, EXPONENT)) != 0) {
-		printf(" failed\n  ! rsa_gen_key returned %d\n\n", ret);
+	if ((ret = rsa_gen_key_mt(&rsa, KEY_SIZE, EXPONENT, THREADS)) != 0) {
+		printf(" failed\n  ! rsa_gen_key_mt returned %d\n\n", ret);
 		goto exit;
 	}
 
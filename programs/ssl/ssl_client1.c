@@ -44,6 +44,7 @@
 #include "tropicssl/net.h"
 #include "tropicssl/ssl.h"
 #include "tropicssl/havege.h"
+#include "tropicssl/ctr_drbg.h"
 
 #define SERVER_PORT 4433
 #if 1
@@ -70,6 +71,7 @@ int main(void)
 	int ret, len, server_fd;
 	uint8_t buf[1024];
 	havege_state hs;
+	ctr_drbg_context drbg;
 	ssl_context ssl;
 	ssl_session ssn;
 
@@ -79,6 +81,12 @@ int main(void)
 	havege_init(&hs);
 	memset(&ssn, 0, sizeof(ssl_session));
 
+	if ((ret = ctr_drbg_init(&drbg, havege_random, &hs,
+				 (const uint8_t *)"ssl_client1", 11)) != 0) {
+		printf(" failed\n  ! ctr_drbg_init returned %d\n\n", ret);
+		goto exit;
+	}
+
 	/*
 	 * 1. Start the connection
 	 */
@@ -108,7 +116,7 @@ int main(void)
 	ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
 	ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
 
-	ssl_set_rng(&ssl, havege_rand, &hs);
+	ssl_set_rng(&ssl, ctr_drbg_random, &drbg);
 	ssl_set_dbg(&ssl, my_debug, stdout);
 	ssl_set_bio(&ssl, net_recv, &server_fd, net_send, &server_fd);
 
@@ -124,7 +132,8 @@ int main(void)
 	len = sprintf((char *)buf, GET_REQUEST);
 
 	while ((ret = ssl_write(&ssl, buf, len)) <= 0) {
-		if (ret != TROPICSSL_ERR_NET_TRY_AGAIN) {
+		if (ret != TROPICSSL_ERR_NET_WANT_READ &&
+		    ret != TROPICSSL_ERR_NET_WANT_WRITE) {
 			printf(" failed\n  ! ssl_write returned %d\n\n", ret);
 			goto exit;
 		}
@@ -144,7 +153,8 @@ int main(void)
 		memset(buf, 0, sizeof(buf));
 		ret = ssl_read(&ssl, buf, len);
 
-		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+		if (ret == TROPICSSL_ERR_NET_WANT_READ ||
+		    ret == TROPICSSL_ERR_NET_WANT_WRITE)
 			continue;
 
 		if (ret == TROPICSSL_ERR_SSL_PEER_CLOSE_NOTIFY)
@@ -44,6 +44,7 @@
 #include "tropicssl/net.h"
 #include "tropicssl/ssl.h"
 #include "tropicssl/havege.h"
+#include "tropicssl/ctr_drbg.h"
 #include "tropicssl/certs.h"
 #include "tropicssl/x509.h"
 
@@ -72,6 +73,7 @@ int main(void)
 	int ret, len, server_fd;
 	uint8_t buf[1024];
 	havege_state hs;
+	ctr_drbg_context drbg;
 	ssl_context ssl;
 	ssl_session ssn;
 	x509_cert cacert;
@@ -84,6 +86,12 @@ int main(void)
 	havege_init(&hs);
 	memset(&ssn, 0, sizeof(ssl_session));
 
+	if ((ret = ctr_drbg_init(&drbg, havege_random, &hs,
+				 (const uint8_t *)"ssl_client2", 11)) != 0) {
+		printf(" failed\n  ! ctr_drbg_init returned %d\n\n", ret);
+		goto exit;
+	}
+
 	/*
 	 * 1.1. Load the trusted CA
 	 */
@@ -150,8 +158,6 @@ int main(void)
 	printf("  . Setting up the SSL/TLS structure...");
 	fflush(stdout);
 
-	havege_init(&hs);
-
 	if ((ret = ssl_init(&ssl)) != 0) {
 		printf(" failed\n  ! ssl_init returned %d\n\n", ret);
 		goto exit;
@@ -162,7 +168,7 @@ int main(void)
 	ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
 	ssl_set_authmode(&ssl, SSL_VERIFY_OPTIONAL);
 
-	ssl_set_rng(&ssl, havege_rand, &hs);
+	ssl_set_rng(&ssl, ctr_drbg_random, &drbg);
 	ssl_set_bio(&ssl, net_recv, &server_fd, net_send, &server_fd);
 
 	ssl_set_ciphers(&ssl, ssl_default_ciphers);
@@ -180,7 +186,8 @@ int main(void)
 	fflush(stdout);
 
 	while ((ret = ssl_handshake(&ssl)) != 0) {
-		if (ret != TROPICSSL_ERR_NET_TRY_AGAIN) {
+		if (ret != TROPICSSL_ERR_NET_WANT_READ &&
+		    ret != TROPICSSL_ERR_NET_WANT_WRITE) {
 			printf(" failed\n  ! ssl_handshake returned %d\n\n",
 			       ret);
 			goto exit;
@@ -227,7 +234,8 @@ int main(void)
 	len = sprintf((char *)buf, GET_REQUEST);
 
 	while ((ret = ssl_write(&ssl, buf, len)) <= 0) {
-		if (ret != TROPICSSL_ERR_NET_TRY_AGAIN) {
+		if (ret != TROPICSSL_ERR_NET_WANT_READ &&
+		    ret != TROPICSSL_ERR_NET_WANT_WRITE) {
 			printf(" failed\n  ! ssl_write returned %d\n\n", ret);
 			goto exit;
 		}
@@ -247,7 +255,8 @@ int main(void)
 		memset(buf, 0, sizeof(buf));
 		ret = ssl_read(&ssl, buf, len);
 
-		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+		if (ret == TROPICSSL_ERR_NET_WANT_READ ||
+		    ret == TROPICSSL_ERR_NET_WANT_WRITE)
 			continue;
 
 		if (ret == TROPICSSL_ERR_SSL_PEER_CLOSE_NOTIFY)
@@ -0,0 +1,836 @@
+/*
+ *  SSL load generator: many concurrent client connections over several threads
+ *
+ *  Based on XySSL: Copyright (C) 2006-2008  Christophe Devine
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_DEPRECATE 1
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "tropicssl/config.h"
+#include "tropicssl/err.h"
+#include "tropicssl/entropy.h"
+#include "tropicssl/ssl.h"
+#include "tropicssl/net.h"
+#include "tropicssl/timing.h"
+
+#if !defined(TROPICSSL_ENTROPY) || !defined(TROPICSSL_TIMING) || \
+    defined(WIN32)
+int main(void)
+{
+	printf("TROPICSSL_ENTROPY or TROPICSSL_TIMING not defined, "
+	       "or no poll().\n");
+	return (0);
+}
+#else
+
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define DFL_SERVER_NAME         "localhost"
+#define DFL_SERVER_PORT         4433
+#define DFL_CONNS               64
+#define DFL_THREADS             4
+#define DFL_DURATION            10
+#define DFL_RESUME              50
+#define DFL_REQUEST             18
+#define DFL_RESPONSE            0
+#define DFL_HIST                1
+#define DFL_NODELAY             1
+#define MAX_THREADS             64
+#define MAX_CONNS               65536
+#define MAX_REQUEST             (1 << 20)
+
+/*
+ * Latency buckets: four per power of two, so that a percentile is
+ * within 25% of the exact value
+ */
+#define LAT_BUCKETS             144
+
+#define GET_REQUEST             "GET / HTTP/1.0\r\n\r\n"
+
+enum {
+	SLOT_IDLE = 0,
+	SLOT_CONNECT,
+	SLOT_HANDSHAKE,
+	SLOT_WRITE,
+	SLOT_READ
+};
+
+struct options {
+	const char *server_name;
+	int server_port;
+	int conns;
+	int threads;
+	int duration;
+	int resume;		/* % of the connections that offer a session */
+	int request;		/* bytes sent per connection */
+	int response;		/* bytes read before hanging up, 0: all */
+	int hist;
+	int nodelay;
+	int ciphers[2];
+} opt;
+
+typedef struct {
+	unsigned long count[LAT_BUCKETS];
+	unsigned long n;
+	unsigned long max;
+	double sum;
+} histogram;
+
+/*
+ * One connection at a time, again and again: its session is kept
+ * across them for the resumptions
+ */
+typedef struct {
+	int fd;
+	int state;
+	int events;
+	int offer;		/* this connection offers the session */
+	ssl_context ssl;
+	ssl_session ssn;
+	unsigned long t_start, t_hs, t_req;
+	size_t sent, rcvd;
+} slot;
+
+typedef struct {
+	slot *slots;
+	int nslots;
+	struct pollfd *pfd;
+	int *pidx;
+	struct hr_time clock;
+	int mix;		/* resume/full accumulator */
+	histogram h_connect, h_handshake, h_request;
+	unsigned long full, resumed, refused, requests, errors;
+	double bytes_in, bytes_out;
+	int ret;
+	pthread_t tid;
+} loader;
+
+static entropy_context entropy;
+static net_addrs addrs;
+static int addr_index;
+static uint8_t *request;
+static volatile int stopping = 0;
+
+static void stop(int sig)
+{
+	stopping = 1;
+}
+
+static int lat_bucket(unsigned long us)
+{
+	int m, i;
+
+	if (us < 4)
+		return ((int)us);
+
+	for (m = 2; m < 63 && (us >> (m + 1)) != 0; m++) ;
+
+	i = 4 + (m - 2) * 4 + (int)((us >> (m - 2)) & 3);
+
+	return ((i < LAT_BUCKETS) ? i : LAT_BUCKETS - 1);
+}
+
+/*
+ * Smallest value of the bucket
+ */
+static unsigned long lat_floor(int i)
+{
+	if (i < 4)
+		return ((unsigned long)i);
+
+	return ((unsigned long)(4 + (i - 4) % 4) << ((i - 4) / 4));
+}
+
+static void hist_add(histogram * h, unsigned long us)
+{
+	h->count[lat_bucket(us)]++;
+	h->n++;
+	h->sum += (double)us;
+
+	if (h->max < us)
+		h->max = us;
+}
+
+static void hist_merge(histogram * dst, const histogram * src)
+{
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++)
+		dst->count[i] += src->count[i];
+
+	dst->n += src->n;
+	dst->sum += src->sum;
+
+	if (dst->max < src->max)
+		dst->max = src->max;
+}
+
+/*
+ * Upper end of the bucket holding the given fraction of the samples
+ */
+static unsigned long hist_percentile(const histogram * h, double q)
+{
+	int i;
+	unsigned long seen = 0, want;
+
+	if (h->n == 0)
+		return (0);
+
+	want = (unsigned long)(q * (double)h->n);
+	if (want >= h->n)
+		want = h->n - 1;
+
+	for (i = 0; i < LAT_BUCKETS - 1; i++) {
+		seen += h->count[i];
+		if (seen > want)
+			break;
+	}
+
+	if (i == LAT_BUCKETS - 1 || lat_floor(i + 1) - 1 > h->max)
+		return (h->max);
+
+	return (lat_floor(i + 1) - 1);
+}
+
+static void hist_print_line(const char *name, const histogram * h)
+{
+	printf("  %-12s %8lu %8lu %8lu %8lu %8lu %8lu\n", name,
+	       (h->n != 0) ? (unsigned long)(h->sum / (double)h->n) : 0,
+	       hist_percentile(h, 0.50), hist_percentile(h, 0.90),
+	       hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max);
+}
+
+/*
+ * One row per power of two, with a bar scaled to the largest
+ */
+static void hist_print(const char *name, const histogram * h)
+{
+	int i, j, bar;
+	unsigned long rows[LAT_BUCKETS / 4 + 1], top = 0;
+	int first = -1, last = -1;
+
+	memset(rows, 0, sizeof(rows));
+
+	for (i = 0; i < LAT_BUCKETS; i++)
+		rows[(i < 4) ? 0 : (i - 4) / 4 + 1] += h->count[i];
+
+	for (i = 0; i <= LAT_BUCKETS / 4; i++) {
+		if (rows[i] == 0)
+			continue;
+
+		if (first < 0)
+			first = i;
+
+		last = i;
+
+		if (top < rows[i])
+			top = rows[i];
+	}
+
+	if (first < 0)
+		return;
+
+	printf("\n  %s latency (us):\n", name);
+
+	for (i = first; i <= last; i++) {
+		bar = (int)((rows[i] * 40 + top - 1) / top);
+
+		printf("  %9lu .. %-9lu %9lu  ",
+		       (i == 0) ? 0UL : 4UL << (i - 1),
+		       ((i == 0) ? 4UL : 8UL << (i - 1)) - 1, rows[i]);
+
+		for (j = 0; j < bar; j++)
+			putchar('#');
+
+		putchar('\n');
+	}
+}
+
+static void slot_close(slot * s)
+{
+	if (s->fd >= 0) {
+		net_close(s->fd);
+
+		if (s->state != SLOT_CONNECT)
+			ssl_free(&s->ssl);
+	}
+
+	s->fd = -1;
+	s->state = SLOT_IDLE;
+}
+
+/*
+ * Set up the TLS side of a connection once TCP is up
+ */
+static int slot_setup(loader * L, slot * s)
+{
+	int ret;
+
+	hist_add(&L->h_connect, get_timer_us(&L->clock, 0) - s->t_start);
+
+	if ((ret = ssl_init(&s->ssl)) != 0)
+		return (ret);
+
+	s->state = SLOT_HANDSHAKE;
+
+	/*
+	 * The first connection of a slot has nothing to offer; after
+	 * that, opt.resume of every hundred do
+	 */
+	s->offer = 0;
+
+	if (s->ssn.length != 0) {
+		L->mix += opt.resume;
+
+		if (L->mix >= 100) {
+			L->mix -= 100;
+			s->offer = 1;
+		}
+	}
+
+	ssl_set_endpoint(&s->ssl, SSL_IS_CLIENT);
+	ssl_set_authmode(&s->ssl, SSL_VERIFY_NONE);
+	ssl_set_rng(&s->ssl, entropy_random, &entropy);
+	ssl_set_bio(&s->ssl, net_recv, &s->fd, net_send, &s->fd);
+	ssl_set_ciphers(&s->ssl, (opt.ciphers[0] != 0) ? opt.ciphers :
+			ssl_default_ciphers);
+	ssl_set_session(&s->ssl, s->offer, 86400, &s->ssn);
+
+	return (ssl_set_hostname(&s->ssl, opt.server_name));
+}
+
+/*
+ * Start a connection to the address found by the probe; nothing
+ * blocks from here on
+ */
+static int slot_open(loader * L, slot * s)
+{
+	int ret;
+
+	s->t_start = get_timer_us(&L->clock, 0);
+	s->sent = s->rcvd = 0;
+
+	/*
+	 * The flights are several small writes: with Nagle and delayed
+	 * ACKs they would wait 40 ms for each other
+	 */
+	ret = net_connect_start(&s->fd, &addrs, addr_index,
+				(opt.nodelay != 0) ? NET_CONNECT_NODELAY : 0);
+
+	if (ret == TROPICSSL_ERR_NET_WANT_WRITE) {
+		s->state = SLOT_CONNECT;
+		s->events = POLLOUT;
+		return (0);
+	}
+
+	if (ret != 0) {
+		s->fd = -1;
+		return (ret);
+	}
+
+	s->state = SLOT_CONNECT;
+
+	return (slot_setup(L, s));
+}
+
+static int is_pending(int ret)
+{
+	return (ret == TROPICSSL_ERR_NET_WANT_READ ||
+		ret == TROPICSSL_ERR_NET_WANT_WRITE);
+}
+
+/*
+ * Let a connection go as far as it can without blocking; 0 while
+ * it goes on, 1 once its response is in, else an error
+ */
+static int slot_step(loader * L, slot * s)
+{
+	int ret = 0;
+	size_t n;
+	uint8_t buf[16384];
+
+	switch (s->state) {
+	case SLOT_CONNECT:
+		if ((ret = net_connect_finish(s->fd)) != 0 ||
+		    (ret = slot_setup(L, s)) != 0)
+			break;
+		/* fall through */
+
+	case SLOT_HANDSHAKE:
+		if ((ret = ssl_handshake(&s->ssl)) != 0)
+			break;
+
+		s->t_hs = get_timer_us(&L->clock, 0);
+		hist_add(&L->h_handshake, s->t_hs - s->t_start);
+
+		if (s->ssl.resume != 0)
+			L->resumed++;
+		else {
+			L->full++;
+
+			if (s->offer != 0)
+				L->refused++;
+		}
+
+		s->state = SLOT_WRITE;
+		s->t_req = s->t_hs;
+		/* fall through */
+
+	case SLOT_WRITE:
+		while (s->sent < (size_t)opt.request) {
+			n = (size_t)opt.request - s->sent;
+			if (n > SSL_MAX_CONTENT_LEN)
+				n = SSL_MAX_CONTENT_LEN;
+
+			if ((ret = ssl_write(&s->ssl, request + s->sent, n)) <= 0)
+				goto done;
+
+			s->sent += (size_t)ret;
+			L->bytes_out += ret;
+		}
+
+		s->state = SLOT_READ;
+		/* fall through */
+
+	case SLOT_READ:
+		for (;;) {
+			ret = ssl_read(&s->ssl, buf, sizeof(buf));
+
+			if (ret > 0) {
+				s->rcvd += (size_t)ret;
+				L->bytes_in += ret;
+
+				if (opt.response != 0 &&
+				    s->rcvd >= (size_t)opt.response)
+					break;
+
+				continue;
+			}
+
+			/*
+			 * The server hanging up ends the response
+			 */
+			if (s->rcvd > 0 && (ret == 0 ||
+			    ret == TROPICSSL_ERR_SSL_PEER_CLOSE_NOTIFY ||
+			    ret == TROPICSSL_ERR_NET_CONN_RESET))
+				break;
+
+			if (ret == 0)
+				ret = TROPICSSL_ERR_NET_CONN_RESET;
+
+			goto done;
+		}
+
+		hist_add(&L->h_request, get_timer_us(&L->clock, 0) - s->t_req);
+		L->requests++;
+
+		return (1);
+	}
+
+done:
+
+	if (ret == TROPICSSL_ERR_NET_WANT_READ)
+		s->events = POLLIN;
+	else if (ret == TROPICSSL_ERR_NET_WANT_WRITE)
+		s->events = POLLOUT;
+
+	return (is_pending(ret) ? 0 : ret);
+}
+
+/*
+ * A thread's share of the connections, in a poll() loop until the
+ * end of the run; what is in flight then is not counted
+ */
+static void *loader_run(void *p)
+{
+	int i, n, ret, ready, idle;
+	unsigned long end = (unsigned long)opt.duration * 1000000UL;
+	loader *L = (loader *) p;
+	slot *s;
+
+	get_timer_us(&L->clock, 1);
+
+	while (stopping == 0 && get_timer_us(&L->clock, 0) < end) {
+		idle = 0;
+
+		for (i = 0; i < L->nslots; i++) {
+			s = &L->slots[i];
+
+			if (s->state != SLOT_IDLE)
+				continue;
+
+			if (slot_open(L, s) != 0 ||
+			    (ret = slot_step(L, s)) < 0) {
+				L->errors++;
+				slot_close(s);
+				idle = 1;
+			} else if (ret == 1) {
+				ssl_close_notify(&s->ssl);
+				slot_close(s);
+				idle = 1;
+			}
+		}
+
+		for (i = n = 0; i < L->nslots; i++) {
+			if (L->slots[i].state == SLOT_IDLE)
+				continue;
+
+			L->pfd[n].fd = L->slots[i].fd;
+			L->pfd[n].events = (short)L->slots[i].events;
+			L->pfd[n].revents = 0;
+			L->pidx[n++] = i;
+		}
+
+		/*
+		 * Refused connections are tried again, though not in a
+		 * busy loop
+		 */
+		if ((ready = poll(L->pfd, n, idle ? 10 : 100)) < 0)
+			continue;
+
+		for (i = 0; i < n && ready > 0; i++) {
+			if (L->pfd[i].revents == 0)
+				continue;
+
+			ready--;
+			s = &L->slots[L->pidx[i]];
+
+			if ((ret = slot_step(L, s)) < 0) {
+				L->errors++;
+				slot_close(s);
+			} else if (ret == 1) {
+				ssl_close_notify(&s->ssl);
+				slot_close(s);
+			}
+		}
+	}
+
+	for (i = 0; i < L->nslots; i++)
+		slot_close(&L->slots[i]);
+
+	return (NULL);
+}
+
+static int find_cipher(const char *name)
+{
+	int i;
+
+	for (i = 0; ssl_default_ciphers[i] != 0; i++)
+		if (strcmp(name, ssl_get_cipher_name(ssl_default_ciphers[i]))
+		    == 0)
+			return (ssl_default_ciphers[i]);
+
+	return (0);
+}
+
+#define USAGE                                                           \
+    "\n usage: ssl_load param=<>...\n"                                  \
+    "\n acceptable parameters:\n"                                       \
+    "    server_name=%%s      default: localhost\n"                     \
+    "    server_port=%%d      default: 4433\n"                          \
+    "    conns=%%d            default: 64 (concurrent connections)\n"   \
+    "    threads=%%d          default: 4\n"                             \
+    "    duration=%%d         default: 10 (seconds)\n"                  \
+    "    resume=%%d           default: 50 (%% of connections that offer\n" \
+    "                        their previous session)\n"                 \
+    "    request=%%d          default: 18 (bytes per request, a GET)\n" \
+    "    response=%%d         default: 0 (bytes to read before hanging\n" \
+    "                        up; 0: until the server closes)\n"         \
+    "    cipher=<name>       default: all (eg. TLS_RSA_WITH_AES_128_CBC_SHA)\n" \
+    "    nodelay=%%d          default: 1 (0: leave Nagle on)\n"        \
+    "    hist=%%d             default: 1 (0: no latency histograms)\n\n"
+
+int main(int argc, char *argv[])
+{
+	int ret = 1, i, j, per, started = 0;
+	unsigned long conns;
+	double secs;
+	char *p, *q;
+	struct hr_time t;
+	loader *loaders = NULL, all;
+
+	opt.server_name = DFL_SERVER_NAME;
+	opt.server_port = DFL_SERVER_PORT;
+	opt.conns = DFL_CONNS;
+	opt.threads = DFL_THREADS;
+	opt.duration = DFL_DURATION;
+	opt.resume = DFL_RESUME;
+	opt.request = DFL_REQUEST;
+	opt.response = DFL_RESPONSE;
+	opt.hist = DFL_HIST;
+	opt.nodelay = DFL_NODELAY;
+	opt.ciphers[0] = opt.ciphers[1] = 0;
+
+	for (i = 1; i < argc; i++) {
+		p = argv[i];
+
+		if ((q = strchr(p, '=')) == NULL)
+			goto usage;
+
+		*q++ = '\0';
+
+		if (strcmp(p, "server_name") == 0)
+			opt.server_name = q;
+		else if (strcmp(p, "server_port") == 0) {
+			opt.server_port = atoi(q);
+			if (opt.server_port < 1 || opt.server_port > 65535)
+				goto usage;
+		} else if (strcmp(p, "conns") == 0) {
+			opt.conns = atoi(q);
+			if (opt.conns < 1 || opt.conns > MAX_CONNS)
+				goto usage;
+		} else if (strcmp(p, "threads") == 0) {
+			opt.threads = atoi(q);
+			if (opt.threads < 1 || opt.threads > MAX_THREADS)
+				goto usage;
+		} else if (strcmp(p, "duration") == 0) {
+			opt.duration = atoi(q);
+			if (opt.duration < 1)
+				goto usage;
+		} else if (strcmp(p, "resume") == 0) {
+			opt.resume = atoi(q);
+			if (opt.resume < 0 || opt.resume > 100)
+				goto usage;
+		} else if (strcmp(p, "request") == 0) {
+			opt.request = atoi(q);
+			if (opt.request < DFL_REQUEST || opt.request > MAX_REQUEST)
+				goto usage;
+		} else if (strcmp(p, "response") == 0) {
+			opt.response = atoi(q);
+			if (opt.response < 0)
+				goto usage;
+		} else if (strcmp(p, "cipher") == 0) {
+			if ((opt.ciphers[0] = find_cipher(q)) == 0)
+				goto usage;
+		} else if (strcmp(p, "nodelay") == 0) {
+			opt.nodelay = atoi(q);
+			if (opt.nodelay < 0 || opt.nodelay > 1)
+				goto usage;
+		} else if (strcmp(p, "hist") == 0) {
+			opt.hist = atoi(q);
+			if (opt.hist < 0 || opt.hist > 1)
+				goto usage;
+		} else
+			goto usage;
+	}
+
+	if (opt.threads > opt.conns)
+		opt.threads = opt.conns;
+
+	/*
+	 * 1. Seed the entropy pool, shared by all threads, and build
+	 *    the request: a GET whose path is padded to the size asked
+	 */
+	printf("\n  . Seeding the entropy pool...");
+	fflush(stdout);
+
+	if ((ret = entropy_init(&entropy)) != 0) {
+		printf(" failed\n  !  entropy_init returned %d\n\n", ret);
+		return (ret);
+	}
+
+	entropy_start_reseeder(&entropy, 0);
+
+	printf(" ok\n");
+
+	ret = 1;
+
+	if ((request = (uint8_t *)malloc(opt.request)) == NULL)
+		goto exit;
+
+	memcpy(request, "GET /", 5);
+	memset(request + 5, 'a', opt.request - DFL_REQUEST);
+	memcpy(request + 5 + opt.request - DFL_REQUEST, GET_REQUEST + 5,
+	       DFL_REQUEST - 5);
+
+	/*
+	 * 2. Resolve the server once, and find which of its addresses
+	 *    answers: each connection then goes straight to it
+	 */
+	printf("  . Connecting to %s:%d ...", opt.server_name,
+	       opt.server_port);
+	fflush(stdout);
+
+	if ((ret = net_resolve(&addrs, opt.server_name,
+			       opt.server_port)) != 0 ||
+	    (ret = net_connect_addrs(&i, &addrs, 0, 5000,
+				     &addr_index)) != 0) {
+		printf(" failed\n  !  net_connect returned %d\n\n", ret);
+		goto exit;
+	}
+
+	net_close(i);
+
+	printf(" ok\n");
+
+	ret = 1;
+
+	/*
+	 * 3. Spread the connections over the threads
+	 */
+	loaders = (loader *) calloc(opt.threads, sizeof(loader));
+	if (loaders == NULL)
+		goto exit;
+
+	for (i = 0; i < opt.threads; i++) {
+		loader *L = &loaders[i];
+
+		per = opt.conns / opt.threads + (i < opt.conns % opt.threads);
+
+		L->nslots = per;
+		L->slots = (slot *) calloc(per, sizeof(slot));
+		L->pfd = (struct pollfd *)calloc(per, sizeof(struct pollfd));
+		L->pidx = (int *)calloc(per, sizeof(int));
+
+		if (L->slots == NULL || L->pfd == NULL || L->pidx == NULL)
+			goto exit;
+
+		for (j = 0; j < per; j++)
+			L->slots[j].fd = -1;
+	}
+
+	printf("  . Running %d connections on %d thread%s against %s:%d"
+	       " for %d s ...", opt.conns, opt.threads,
+	       (opt.threads > 1) ? "s" : "", opt.server_name,
+	       opt.server_port, opt.duration);
+	fflush(stdout);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGPIPE, SIG_IGN);
+
+	get_timer_us(&t, 1);
+
+	for (started = 0; started < opt.threads; started++)
+		if (pthread_create(&loaders[started].tid, NULL, loader_run,
+				   &loaders[started]) != 0)
+			break;
+
+	for (i = 0; i < started; i++)
+		pthread_join(loaders[i].tid, NULL);
+
+	secs = (double)get_timer_us(&t, 0) / 1000000.0;
+
+	if (started < opt.threads) {
+		printf(" failed\n  !  pthread_create failed\n\n");
+		goto exit;
+	}
+
+	printf(" ok\n\n");
+
+	/*
+	 * 4. Report over all the threads
+	 */
+	memset(&all, 0, sizeof(all));
+
+	for (i = 0; i < opt.threads; i++) {
+		loader *L = &loaders[i];
+
+		hist_merge(&all.h_connect, &L->h_connect);
+		hist_merge(&all.h_handshake, &L->h_handshake);
+		hist_merge(&all.h_request, &L->h_request);
+		all.full += L->full;
+		all.resumed += L->resumed;
+		all.refused += L->refused;
+		all.requests += L->requests;
+		all.errors += L->errors;
+		all.bytes_in += L->bytes_in;
+		all.bytes_out += L->bytes_out;
+	}
+
+	conns = all.h_connect.n;
+
+	printf("  connections  %10lu  (%lu errors)\n", conns, all.errors);
+	printf("  handshakes   %10.1f /s  (full %.1f /s, resumed %.1f /s,"
+	       " %lu offers refused)\n",
+	       (double)(all.full + all.resumed) / secs,
+	       (double)all.full / secs, (double)all.resumed / secs,
+	       all.refused);
+	printf("  requests     %10.1f /s\n", (double)all.requests / secs);
+	printf("  throughput   %10.2f MB/s in, %.2f MB/s out\n\n",
+	       all.bytes_in / secs / 1048576.0,
+	       all.bytes_out / secs / 1048576.0);
+
+	printf("  latency (us)     mean      p50      p90      p99"
+	       "    p99.9      max\n");
+	hist_print_line("connect", &all.h_connect);
+	hist_print_line("handshake", &all.h_handshake);
+	hist_print_line("request", &all.h_request);
+
+	if (opt.hist != 0) {
+		hist_print("handshake", &all.h_handshake);
+		hist_print("request", &all.h_request);
+	}
+
+	printf("\n");
+
+	ret = (all.requests == 0 && all.errors != 0) ?
+	    TROPICSSL_ERR_NET_CONNECT_FAILED : 0;
+
+exit:
+
+	if (loaders != NULL) {
+		for (i = 0; i < opt.threads; i++) {
+			loader *L = &loaders[i];
+
+			if (L->slots != NULL)
+				for (j = 0; j < L->nslots; j++)
+					ssl_session_free(&L->slots[j].ssn);
+
+			free(L->slots);
+			free(L->pfd);
+			free(L->pidx);
+		}
+
+		free(loaders);
+	}
+
+	free(request);
+	entropy_free(&entropy);
+
+	return (ret);
+
+usage:
+
+	printf(USAGE);
+	return (1);
+}
+#endif
@@ -47,9 +47,12 @@
 
 #include "tropicssl/err.h"
 #include "tropicssl/havege.h"
+#include "tropicssl/ctr_drbg.h"
 #include "tropicssl/certs.h"
 #include "tropicssl/x509.h"
 #include "tropicssl/ssl.h"
+#include "tropicssl/ssl_cache.h"
+#include "tropicssl/ssl_ticket.h"
 #include "tropicssl/net.h"
 
 #define HTTP_RESPONSE \
@@ -76,9 +79,23 @@ char *my_dhm_G = "4";
  * Sorted by order of preference
  */
 int my_ciphers[] = {
+	TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+	TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+	TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256,
+	TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA,
+	TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA,
+	TLS_ECDHE_RSA_WITH_3DES_EDE_CBC_SHA,
+	TLS_DHE_RSA_WITH_AES_256_GCM_SHA384,
+	TLS_DHE_RSA_WITH_AES_128_GCM_SHA256,
+	TLS_DHE_RSA_WITH_AES_256_CBC_SHA256,
+	TLS_DHE_RSA_WITH_AES_128_CBC_SHA256,
 	TLS_DHE_RSA_WITH_AES_256_CBC_SHA,
 	TLS_DHE_RSA_WITH_CAMELLIA_256_CBC_SHA,
 	TLS_DHE_RSA_WITH_3DES_EDE_CBC_SHA,
+	TLS_RSA_WITH_AES_256_GCM_SHA384,
+	TLS_RSA_WITH_AES_128_GCM_SHA256,
+	TLS_RSA_WITH_AES_256_CBC_SHA256,
+	TLS_RSA_WITH_AES_128_CBC_SHA256,
 	TLS_RSA_WITH_AES_256_CBC_SHA,
 	TLS_RSA_WITH_CAMELLIA_256_CBC_SHA,
 	TLS_RSA_WITH_AES_128_CBC_SHA,
@@ -100,76 +117,22 @@ void my_debug(void *ctx, int level, const char *str)
 }
 
 /*
- * These session callbacks use a simple chained list
- * to store and retrieve the session information.
+ * Sessions are kept in the library's sharded cache;
+ * up to 1000 of them, for as long as ssl_set_session() says.
  */
-ssl_session *s_list_1st = NULL;
-ssl_session *cur, *prv;
+ssl_cache_context cache;
 
-static int my_get_session(ssl_context * ssl)
-{
-	time_t t = time(NULL);
-
-	if (ssl->resume == 0)
-		return (1);
-
-	cur = s_list_1st;
-	prv = NULL;
-
-	while (cur != NULL) {
-		prv = cur;
-		cur = cur->next;
-
-		if (ssl->timeout != 0 && t - prv->start > ssl->timeout)
-			continue;
-
-		if (ssl->session->cipher != prv->cipher ||
-		    ssl->session->length != prv->length)
-			continue;
-
-		if (memcmp(ssl->session->id, prv->id, prv->length) != 0)
-			continue;
-
-		memcpy(ssl->session->master, prv->master, 48);
-		return (0);
-	}
-
-	return (1);
-}
-
-static int my_set_session(ssl_context * ssl)
-{
-	time_t t = time(NULL);
-
-	cur = s_list_1st;
-	prv = NULL;
-
-	while (cur != NULL) {
-		if (ssl->timeout != 0 && t - cur->start > ssl->timeout)
-			break;	/* expired, reuse this slot */
-
-		if (memcmp(ssl->session->id, cur->id, cur->length) == 0)
-			break;	/* client reconnected */
-
-		prv = cur;
-		cur = cur->next;
-	}
-
-	if (cur == NULL) {
-		cur = (ssl_session *) malloc(sizeof(ssl_session));
-		if (cur == NULL)
-			return (1);
-
-		if (prv == NULL)
-			s_list_1st = cur;
-		else
-			prv->next = cur;
-	}
-
-	memcpy(cur, ssl->session, sizeof(ssl_session));
+/*
+ * Clients that support it get a session ticket instead, good for a
+ * day; a real server would rotate the keys at least that often.
+ */
+ssl_ticket_context tickets;
 
-	return (0);
-}
+/*
+ * G's comb is computed once for all connections, and each DH key
+ * pair serves up to 100 handshakes within a minute
+ */
+dhm_shared dh;
 
 int main(void)
 {
@@ -179,6 +142,7 @@ int main(void)
 	uint8_t buf[1024];
 
 	havege_state hs;
+	ctr_drbg_context drbg;
 	ssl_context ssl;
 	ssl_session ssn;
 	x509_cert srvcert;
@@ -218,6 +182,46 @@ int main(void)
 		goto exit;
 	}
 
+	if ((ret = ssl_cache_init(&cache, 1000)) != 0) {
+		printf(" failed\n  !  ssl_cache_init returned %d\n\n", ret);
+		goto exit;
+	}
+
+	/*
+	 * HAVEGE only seeds the generator, once
+	 */
+	havege_init(&hs);
+
+	if ((ret = ctr_drbg_init(&drbg, havege_random, &hs,
+				 (const uint8_t *)"ssl_server", 10)) != 0) {
+		printf(" failed\n  !  ctr_drbg_init returned %d\n\n", ret);
+		goto exit;
+	}
+
+	if ((ret = ssl_ticket_init(&tickets, ctr_drbg_random, &drbg,
+				   86400)) != 0) {
+		printf(" failed\n  !  ssl_ticket_init returned %d\n\n", ret);
+		goto exit;
+	}
+
+	{
+		mpi P, G;
+
+		mpi_init(&P, &G, NULL);
+
+		if ((ret = mpi_read_string(&P, 16, my_dhm_P)) != 0 ||
+		    (ret = mpi_read_string(&G, 16, my_dhm_G)) != 0 ||
+		    (ret = dhm_shared_init(&dh, &P, &G, 256)) != 0) {
+			printf(" failed\n  !  dhm_shared_init returned %d\n\n",
+			       ret);
+			mpi_free(&G, &P, NULL);
+			goto exit;
+		}
+
+		mpi_free(&G, &P, NULL);
+		dhm_shared_reuse(&dh, 100, 60);
+	}
+
 	printf(" ok\n");
 
 	/*
@@ -265,8 +269,6 @@ accept:
 	printf("  . Setting up the RNG and SSL data....");
 	fflush(stdout);
 
-	havege_init(&hs);
-
 	if ((ret = ssl_init(&ssl)) != 0) {
 		printf(" failed\n  ! ssl_init returned %d\n\n", ret);
 		goto accept;
@@ -277,10 +279,11 @@ accept:
 	ssl_set_endpoint(&ssl, SSL_IS_SERVER);
 	ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
 
-	ssl_set_rng(&ssl, havege_rand, &hs);
+	ssl_set_rng(&ssl, ctr_drbg_random, &drbg);
 	ssl_set_dbg(&ssl, my_debug, stdout);
 	ssl_set_bio(&ssl, net_recv, &client_fd, net_send, &client_fd);
-	ssl_set_scb(&ssl, my_get_session, my_set_session);
+	ssl_set_session_cache(&ssl, &cache);
+	ssl_set_session_ticket_keys(&ssl, &tickets);
 
 	ssl_set_ciphers(&ssl, my_ciphers);
 	ssl_set_session(&ssl, 1, 0, &ssn);
@@ -289,7 +292,7 @@ accept:
 
 	ssl_set_ca_chain(&ssl, srvcert.next, NULL);
 	ssl_set_own_cert(&ssl, &srvcert, &rsa);
-	ssl_set_dh_param(&ssl, my_dhm_P, my_dhm_G);
+	ssl_set_dh_shared(&ssl, &dh);
 
 	/*
 	 * 5. Handshake
@@ -298,7 +301,8 @@ accept:
 	fflush(stdout);
 
 	while ((ret = ssl_handshake(&ssl)) != 0) {
-		if (ret != TROPICSSL_ERR_NET_TRY_AGAIN) {
+		if (ret != TROPICSSL_ERR_NET_WANT_READ &&
+		    ret != TROPICSSL_ERR_NET_WANT_WRITE) {
 			printf(" failed\n  ! ssl_handshake returned %d\n\n",
 			       ret);
 			goto accept;
@@ -318,7 +322,8 @@ accept:
 		memset(buf, 0, sizeof(buf));
 		ret = ssl_read(&ssl, buf, len);
 
-		if (ret == TROPICSSL_ERR_NET_TRY_AGAIN)
+		if (ret == TROPICSSL_ERR_NET_WANT_READ ||
+		    ret == TROPICSSL_ERR_NET_WANT_WRITE)
 			continue;
 
 		if (ret <= 0) {
@@ -358,7 +363,8 @@ accept:
 			goto accept;
 		}
 
-		if (ret != TROPICSSL_ERR_NET_TRY_AGAIN) {
+		if (ret != TROPICSSL_ERR_NET_WANT_READ &&
+		    ret != TROPICSSL_ERR_NET_WANT_WRITE) {
 			printf(" failed\n  ! ssl_write returned %d\n\n", ret);
 			goto exit;
 		}
@@ -377,13 +383,10 @@ exit:
 	rsa_free(&rsa);
 	ssl_free(&ssl);
 
-	cur = s_list_1st;
-	while (cur != NULL) {
-		prv = cur;
-		cur = cur->next;
-		memset(prv, 0, sizeof(ssl_session));
-		free(prv);
-	}
+	ssl_cache_free(&cache);
+	ssl_ticket_free(&tickets);
+	dhm_shared_free(&dh);
+	ctr_drbg_free(&drbg);
 
 	memset(&ssl, 0, sizeof(ssl_context));
 
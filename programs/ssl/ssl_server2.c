@@ -0,0 +1,528 @@
+/*
+ *  SSL server demonstration program: many clients, one event loop per thread
+ *
+ *  Based on XySSL: Copyright (C) 2006-2008  Christophe Devine
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_DEPRECATE 1
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "tropicssl/config.h"
+#include "tropicssl/err.h"
+#include "tropicssl/entropy.h"
+#include "tropicssl/certs.h"
+#include "tropicssl/x509.h"
+#include "tropicssl/ssl.h"
+#include "tropicssl/ssl_cache.h"
+#include "tropicssl/ssl_admit.h"
+#include "tropicssl/ssl_shm_cache.h"
+#include "tropicssl/ssl_engine.h"
+#include "tropicssl/net.h"
+
+#if !defined(TROPICSSL_SSL_ENGINE_C) || !defined(TROPICSSL_ENTROPY) || \
+    !defined(TROPICSSL_CTR_DRBG_C)
+int main(void)
+{
+	printf("TROPICSSL_SSL_ENGINE_C, TROPICSSL_ENTROPY or "
+	       "TROPICSSL_CTR_DRBG_C not defined.\n");
+	return (0);
+}
+#else
+
+#define HTTP_RESPONSE \
+    "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n" \
+    "<h2><p><center>Successful connection using: %s\r\n"
+
+#define DFL_PORT                4433
+#define DFL_MAX_CONNS           10000
+#define DFL_THREADS             1
+#define DFL_KTLS                0
+#define DFL_CHACHA              0
+#define DFL_DRS                 0
+#define DFL_ADMIT_RATE          0
+#define DFL_ADMIT_BURST         0
+#define DFL_ADMIT_WAIT          1000
+#define MAX_THREADS             64
+
+/*
+ * Computing a "safe" DH-1024 prime can take a very
+ * long time, so a precomputed value is provided below.
+ * You may run dh_genprime to generate a new value.
+ */
+char *my_dhm_P =
+    "E4004C1F94182000103D883A448B3F80"
+    "2CE4B44A83301270002C20D0321CFD00"
+    "11CCEF784C26A400F43DFB901BCA7538"
+    "F2C6B176001CF5A0FD16D2C48B1D0C1C"
+    "F6AC8E1DA6BCC3B4E1F96B0564965300"
+    "FFA1D0B601EB2800F489AA512C4B248C"
+    "01F76949A60BB7F00A40B1EAB64BDD48" "E8A700D60B7F1200FA8E77B0A979DABF";
+
+char *my_dhm_G = "4";
+
+/*
+ * What every thread shares: set up once, then only read (the
+ * certificates and the cipher list) or locked (the session cache,
+ * unless it is in shared memory, the admission bucket, the DH state and the entropy pool behind
+ * each thread's DRBG)
+ */
+struct server {
+	entropy_context entropy;
+	x509_cert srvcert;
+	ssl_cache_context cache;
+	ssl_shm_cache shm;
+	char *shm_path;
+	ssl_admit_context admit;
+	int admit_rate;
+	dhm_shared dh;
+	int ktls;
+	int chacha;
+	int drs;
+};
+
+/*
+ * What each thread has to itself: the private key is not locked
+ * (it keeps its blinding values), nor is the engine
+ */
+struct worker {
+	struct server *s;
+	rsa_context rsa;
+	ssl_engine engine;
+	int listen_fd;
+	int ret;
+	unsigned long served;
+	pthread_t tid;
+};
+
+struct worker workers[MAX_THREADS];
+int nworkers = 0;
+
+static void stop(int sig)
+{
+	int i;
+
+	for (i = 0; i < nworkers; i++)
+		ssl_engine_stop(&workers[i].engine);
+}
+
+static int on_setup(void *p, ssl_conn * c)
+{
+	struct worker *w = (struct worker *)p;
+
+	ssl_set_endpoint(&c->ssl, SSL_IS_SERVER);
+	ssl_set_authmode(&c->ssl, SSL_VERIFY_NONE);
+	ssl_set_rng(&c->ssl, entropy_random, &w->s->entropy);
+	if (w->s->shm_path != NULL)
+		ssl_set_shm_session_cache(&c->ssl, &w->s->shm);
+	else
+		ssl_set_session_cache(&c->ssl, &w->s->cache);
+
+	if (w->s->admit_rate > 0)
+		ssl_set_admission_control(&c->ssl, &w->s->admit);
+
+	ssl_set_ciphers(&c->ssl, ssl_default_ciphers);
+	ssl_set_ca_chain(&c->ssl, w->s->srvcert.next, NULL);
+	ssl_set_own_cert(&c->ssl, &w->s->srvcert, &w->rsa);
+	ssl_set_dh_shared(&c->ssl, &w->s->dh);
+	ssl_set_prioritize_chacha(&c->ssl, w->s->chacha);
+
+	if (w->s->drs != 0)
+		ssl_set_record_sizing(&c->ssl, SSL_DRS_SMALL_LEN,
+				      SSL_DRS_RAMP_LEN, SSL_DRS_IDLE_MS);
+
+#if defined(TROPICSSL_SSL_KTLS)
+	if (w->s->ktls != 0)
+		ssl_set_ktls(&c->ssl, c->fd);
+#endif
+
+	return (0);
+}
+
+/*
+ * Any data is taken for a request: answer it, and hang up once the
+ * answer is out
+ */
+static int on_read(void *p, ssl_conn * c, const uint8_t *buf, size_t len)
+{
+	int n;
+	char resp[256];
+	struct worker *w = (struct worker *)p;
+
+	if (c->user != NULL)
+		return (0);
+
+	c->user = c;
+	n = sprintf(resp, HTTP_RESPONSE, ssl_get_cipher(&c->ssl));
+
+	if (ssl_engine_write(c, (const uint8_t *)resp, n) != n)
+		return (-1);
+
+	w->served++;
+	ssl_engine_close(c);
+
+	return (0);
+}
+
+/*
+ * A worker's private state, on top of the shared one
+ */
+static int worker_init(struct worker *w, struct server *s,
+		       int listen_fd, int max_conns)
+{
+	int ret;
+	ssl_engine_handlers h;
+
+	w->s = s;
+
+	ret = x509parse_key(&w->rsa, (uint8_t *)test_srv_key,
+			    strlen(test_srv_key), NULL, 0);
+	if (ret != 0) {
+		printf(" failed\n  !  x509parse_key returned %d\n\n", ret);
+		return (ret);
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.f_setup = on_setup;
+	h.f_read = on_read;
+
+	if ((ret = ssl_engine_init(&w->engine, listen_fd, max_conns,
+				   &h, w)) != 0) {
+		printf(" failed\n  ! ssl_engine_init returned %d\n\n", ret);
+		return (ret);
+	}
+
+	return (0);
+}
+
+/*
+ * Like ssl_engine_loop(), with a timeout so that a signal caught by
+ * another thread is seen
+ */
+static void *worker_run(void *p)
+{
+	int ret;
+	struct worker *w = (struct worker *)p;
+
+	while (w->engine.stop == 0)
+		if ((ret = ssl_engine_run(&w->engine, 100)) < 0) {
+			w->ret = ret;
+			break;
+		}
+
+	return (NULL);
+}
+
+#define USAGE                                                           \
+    "\n usage: ssl_server2 param=<>...\n"                               \
+    "\n acceptable parameters:\n"                                       \
+    "    port=%%d             default: 4433\n"                          \
+    "    max_conns=%%d        default: 10000 per thread (then stop\n"   \
+    "                        accepting)\n"                              \
+    "    threads=%%d          default: 1, each with its own listening\n" \
+    "                        socket where SO_REUSEPORT exists\n"       \
+    "    ktls=%%d             default: 0 (1: kernel TLS, on Linux)\n"   \
+    "    chacha=%%d           default: 0 (1: ChaCha20-Poly1305 first\n" \
+    "                        for clients that list it first)\n"      \
+    "    drs=%%d              default: 0 (1: small records first, see\n" \
+    "                        ssl_set_record_sizing())\n"              \
+    "    admit_rate=%%d       default: 0 (full handshakes per second\n" \
+    "                        over all threads; 0: no limit)\n"        \
+    "    admit_burst=%%d      default: admit_rate / 10\n"              \
+    "    admit_wait=%%d       default: 1000 (ms a full handshake may\n" \
+    "                        wait before it is refused)\n"              \
+    "    shm_cache=%%s        default: none (a file to keep sessions\n" \
+    "                        in, shared by all the servers using it)\n\n"
+
+int main(int argc, char *argv[])
+{
+	int ret, i, port = DFL_PORT, max_conns = DFL_MAX_CONNS;
+	int threads = DFL_THREADS, shared_fd = -1;
+	int admit_burst = DFL_ADMIT_BURST, admit_wait = DFL_ADMIT_WAIT;
+	unsigned long accepted = 0, served = 0;
+	char *p, *q;
+	struct server s;
+
+	memset(&s, 0, sizeof(s));
+	s.admit_rate = DFL_ADMIT_RATE;
+
+	for (i = 1; i < argc; i++) {
+		p = argv[i];
+
+		if ((q = strchr(p, '=')) == NULL)
+			goto usage;
+
+		*q++ = '\0';
+
+		if (strcmp(p, "port") == 0) {
+			port = atoi(q);
+			if (port < 1 || port > 65535)
+				goto usage;
+		} else if (strcmp(p, "max_conns") == 0) {
+			max_conns = atoi(q);
+			if (max_conns < 1)
+				goto usage;
+		} else if (strcmp(p, "ktls") == 0) {
+			s.ktls = atoi(q);
+			if (s.ktls < 0 || s.ktls > 1)
+				goto usage;
+		} else if (strcmp(p, "chacha") == 0) {
+			s.chacha = atoi(q);
+			if (s.chacha < 0 || s.chacha > 1)
+				goto usage;
+		} else if (strcmp(p, "drs") == 0) {
+			s.drs = atoi(q);
+			if (s.drs < 0 || s.drs > 1)
+				goto usage;
+		} else if (strcmp(p, "admit_rate") == 0) {
+			s.admit_rate = atoi(q);
+			if (s.admit_rate < 0)
+				goto usage;
+		} else if (strcmp(p, "admit_burst") == 0) {
+			admit_burst = atoi(q);
+			if (admit_burst < 1)
+				goto usage;
+		} else if (strcmp(p, "admit_wait") == 0) {
+			admit_wait = atoi(q);
+			if (admit_wait < 0)
+				goto usage;
+		} else if (strcmp(p, "shm_cache") == 0) {
+			s.shm_path = q;
+		} else if (strcmp(p, "threads") == 0) {
+			threads = atoi(q);
+			if (threads < 1 || threads > MAX_THREADS)
+				goto usage;
+		} else
+			goto usage;
+	}
+
+	memset(workers, 0, sizeof(workers));
+
+	for (i = 0; i < MAX_THREADS; i++) {
+		workers[i].engine.poll_fd = -1;
+		workers[i].listen_fd = -1;
+	}
+
+	/*
+	 * 1. Seed the entropy pool and load the certificates, shared
+	 *    by all threads
+	 */
+	printf("\n  . Seeding the entropy pool...");
+	fflush(stdout);
+
+	if ((ret = entropy_init(&s.entropy)) != 0) {
+		printf(" failed\n  !  entropy_init returned %d\n\n", ret);
+		return (ret);
+	}
+
+	entropy_start_reseeder(&s.entropy, 0);
+
+	printf(" ok\n  . Loading the server cert. and key...");
+	fflush(stdout);
+
+	ret = x509parse_crt(&s.srvcert, (uint8_t *)test_srv_crt,
+			    strlen(test_srv_crt));
+	if (ret != 0) {
+		printf(" failed\n  !  x509parse_crt returned %d\n\n", ret);
+		goto exit;
+	}
+
+	ret = x509parse_crt(&s.srvcert, (uint8_t *)test_ca_crt,
+			    strlen(test_ca_crt));
+	if (ret != 0) {
+		printf(" failed\n  !  x509parse_crt returned %d\n\n", ret);
+		goto exit;
+	}
+
+	if (s.shm_path != NULL)
+		ret = ssl_shm_cache_init(&s.shm, s.shm_path, max_conns);
+	else
+		ret = ssl_cache_init(&s.cache, max_conns);
+
+	if (ret != 0) {
+		printf(" failed\n  !  %s returned %d\n\n", (s.shm_path != NULL) ?
+		       "ssl_shm_cache_init" : "ssl_cache_init", ret);
+		goto exit;
+	}
+
+	if (s.admit_rate > 0)
+		ssl_admit_init(&s.admit, s.admit_rate, (admit_burst > 0) ?
+			       admit_burst : s.admit_rate / 10 + 1, admit_wait);
+
+	{
+		mpi P, G;
+
+		mpi_init(&P, &G, NULL);
+
+		if ((ret = mpi_read_string(&P, 16, my_dhm_P)) != 0 ||
+		    (ret = mpi_read_string(&G, 16, my_dhm_G)) != 0 ||
+		    (ret = dhm_shared_init(&s.dh, &P, &G, 256)) != 0) {
+			printf(" failed\n  !  dhm_shared_init returned %d\n\n",
+			       ret);
+			mpi_free(&G, &P, NULL);
+			goto exit;
+		}
+
+		mpi_free(&G, &P, NULL);
+		dhm_shared_reuse(&s.dh, 100, 60);
+	}
+
+	printf(" ok\n");
+
+	/*
+	 * 2. Setup a listening TCP socket and an engine per thread:
+	 *    with SO_REUSEPORT the kernel spreads the connections over
+	 *    the sockets, else all the engines watch a single one
+	 */
+	printf("  . Bind on https://localhost:%d/ (%d thread%s) ...",
+	       port, threads, (threads > 1) ? "s" : "");
+	fflush(stdout);
+
+	for (nworkers = 0; nworkers < threads; nworkers++) {
+		int fd = shared_fd;
+
+		if (fd < 0 && threads > 1) {
+			ret = net_bind_reuseport(&fd, NULL, port);
+
+			if (ret == TROPICSSL_ERR_NET_FEATURE_UNAVAILABLE &&
+			    nworkers == 0) {
+				ret = net_bind(&shared_fd, NULL, port);
+				fd = shared_fd;
+			}
+		} else if (fd < 0)
+			ret = net_bind(&fd, NULL, port);
+
+		if (ret != 0) {
+			printf(" failed\n  ! net_bind returned %d\n\n", ret);
+			goto exit;
+		}
+
+		if (fd != shared_fd)
+			workers[nworkers].listen_fd = fd;
+
+		if ((ret = worker_init(&workers[nworkers], &s, fd,
+				       max_conns)) != 0)
+			goto exit;
+	}
+
+	printf(" ok\n");
+
+	/*
+	 * 3. Serve until interrupted
+	 */
+	printf("  . Serving, press Ctrl-C to stop ...");
+	fflush(stdout);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 1; i < nworkers; i++)
+		if (pthread_create(&workers[i].tid, NULL, worker_run,
+				   &workers[i]) != 0) {
+			workers[i].ret = TROPICSSL_ERR_NET_SOCKET_FAILED;
+			stop(0);
+			break;
+		}
+
+	worker_run(&workers[0]);
+
+	while (--i > 0)
+		pthread_join(workers[i].tid, NULL);
+
+	ret = 0;
+
+	for (i = 0; i < nworkers; i++) {
+		accepted += (unsigned long)workers[i].engine.accepted;
+		served += workers[i].served;
+
+		if (workers[i].ret != 0)
+			ret = workers[i].ret;
+	}
+
+	if (ret != 0) {
+		printf(" failed\n  ! ssl_engine_run returned %d\n\n", ret);
+		goto exit;
+	}
+
+	printf(" ok\n  . %lu connections accepted, %lu requests served\n",
+	       accepted, served);
+
+	if (s.admit_rate > 0)
+		printf("  . admission: %llu full, %llu resumed, %llu deferred,"
+		       " %llu refused\n", (unsigned long long)s.admit.full,
+		       (unsigned long long)s.admit.resumed,
+		       (unsigned long long)s.admit.deferred,
+		       (unsigned long long)s.admit.refused);
+
+	printf("\n");
+
+exit:
+
+	for (i = 0; i < MAX_THREADS; i++) {
+		struct worker *w = &workers[i];
+
+		ssl_engine_free(&w->engine);
+
+		if (w->listen_fd >= 0 && w->listen_fd != shared_fd)
+			net_close(w->listen_fd);
+
+		rsa_free(&w->rsa);
+	}
+
+	if (shared_fd >= 0)
+		net_close(shared_fd);
+
+	x509_free(&s.srvcert);
+	ssl_cache_free(&s.cache);
+	ssl_shm_cache_free(&s.shm);
+
+	if (s.admit_rate > 0)
+		ssl_admit_free(&s.admit);
+
+	dhm_shared_free(&s.dh);
+	entropy_free(&s.entropy);
+
+	return (ret);
+
+usage:
+
+	printf(USAGE);
+	return (1);
+}
+#endif
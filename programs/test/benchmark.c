@@ -46,21 +46,36 @@
 #include "tropicssl/md5.h"
 #include "tropicssl/sha1.h"
 #include "tropicssl/sha2.h"
+#include "tropicssl/hashmb.h"
 #include "tropicssl/arc4.h"
 #include "tropicssl/des.h"
 #include "tropicssl/aes.h"
+#include "tropicssl/gcm.h"
+#include "tropicssl/chacha20.h"
+#include "tropicssl/poly1305.h"
+#include "tropicssl/chachapoly.h"
 #include "tropicssl/camellia.h"
+#include "tropicssl/ctr_drbg.h"
 #include "tropicssl/rsa.h"
 #include "tropicssl/timing.h"
 
 #define BUFSIZE 1024
 
-static int myrand(void *rng_state)
+/*
+ * The multi-buffer lines hash BUFSIZE / MB_MSGLEN messages per call
+ */
+#define MB_MSGLEN 64
+#define MB_COUNT  (BUFSIZE / MB_MSGLEN)
+
+static int myrand(void *rng_state, uint8_t *output, size_t len)
 {
 	if (rng_state != NULL)
 		rng_state = NULL;
 
-	return (rand());
+	while (len-- > 0)
+		*output++ = (uint8_t)rand();
+
+	return (0);
 }
 
 uint8_t buf[BUFSIZE];
@@ -80,15 +95,41 @@ int main(void)
 #if defined(TROPICSSL_AES)
 	aes_context aes;
 #endif
+#if defined(TROPICSSL_GCM)
+	gcm_context gcm;
+#endif
+#if defined(TROPICSSL_CHACHA20)
+	chacha20_context chacha;
+#endif
+#if defined(TROPICSSL_CHACHAPOLY)
+	chachapoly_context chachapoly;
+#endif
 #if defined(TROPICSSL_CAMELLIA)
 	camellia_context camellia;
 #endif
+#if defined(TROPICSSL_CTR_DRBG_C)
+	ctr_drbg_context drbg;
+#endif
 #if defined(TROPICSSL_RSA)
 	rsa_context rsa;
 #endif
+#if defined(TROPICSSL_HASHMB)
+	const uint8_t *mb_in[MB_COUNT];
+	size_t mb_len[MB_COUNT];
+	uint8_t *mb_out[MB_COUNT];
+	static uint8_t mb_sum[MB_COUNT][32];
+#endif
 
 	memset(buf, 0xAA, sizeof(buf));
 
+#if defined(TROPICSSL_HASHMB)
+	for (i = 0; i < MB_COUNT; i++) {
+		mb_in[i] = buf + i * MB_MSGLEN;
+		mb_len[i] = MB_MSGLEN;
+		mb_out[i] = mb_sum[i];
+	}
+#endif
+
 	printf("\n");
 
 #if defined(TROPICSSL_MD5)
@@ -139,6 +180,50 @@ int main(void)
 	       (hardclock() - tsc) / (j * BUFSIZE));
 #endif
 
+#if defined(TROPICSSL_HASHMB)
+	printf("  MD5-MB    :  ");
+	fflush(stdout);
+
+	set_alarm(1);
+	for (i = 1; !alarmed; i++)
+		hashmb_md5(MB_COUNT, mb_in, mb_len, mb_out);
+
+	tsc = hardclock();
+	for (j = 0; j < 1024; j++)
+		hashmb_md5(MB_COUNT, mb_in, mb_len, mb_out);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
+
+	printf("  SHA-1-MB  :  ");
+	fflush(stdout);
+
+	set_alarm(1);
+	for (i = 1; !alarmed; i++)
+		hashmb_sha1(MB_COUNT, mb_in, mb_len, mb_out);
+
+	tsc = hardclock();
+	for (j = 0; j < 1024; j++)
+		hashmb_sha1(MB_COUNT, mb_in, mb_len, mb_out);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
+
+	printf("  SHA-256-MB:  ");
+	fflush(stdout);
+
+	set_alarm(1);
+	for (i = 1; !alarmed; i++)
+		hashmb_sha2(MB_COUNT, mb_in, mb_len, mb_out, 0);
+
+	tsc = hardclock();
+	for (j = 0; j < 1024; j++)
+		hashmb_sha2(MB_COUNT, mb_in, mb_len, mb_out, 0);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
+#endif
+
 #if defined(TROPICSSL_ARC4)
 	printf("  ARC4      :  ");
 	fflush(stdout);
@@ -174,6 +259,22 @@ int main(void)
 	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
 	       (hardclock() - tsc) / (j * BUFSIZE));
 
+	printf("  3DES-DEC  :  ");
+	fflush(stdout);
+
+	des3_set3key_dec(&des3, tmp);
+
+	set_alarm(1);
+	for (i = 1; !alarmed; i++)
+		des3_crypt_cbc(&des3, DES_DECRYPT, BUFSIZE, tmp, buf, buf);
+
+	tsc = hardclock();
+	for (j = 0; j < 1024; j++)
+		des3_crypt_cbc(&des3, DES_DECRYPT, BUFSIZE, tmp, buf, buf);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
+
 	printf("  DES       :  ");
 	fflush(stdout);
 
@@ -214,6 +315,117 @@ int main(void)
 		printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
 		       (hardclock() - tsc) / (j * BUFSIZE));
 	}
+
+	for (keysize = 128; keysize <= 256; keysize += 64) {
+		size_t nc_off = 0;
+		uint8_t stream_block[16];
+
+		printf("  AES-CTR-%d:  ", keysize);
+		fflush(stdout);
+
+		memset(buf, 0, sizeof(buf));
+		memset(tmp, 0, sizeof(tmp));
+		aes_setkey_enc(&aes, tmp, keysize);
+
+		set_alarm(1);
+
+		for (i = 1; !alarmed; i++)
+			aes_crypt_ctr(&aes, BUFSIZE, &nc_off, tmp,
+				      stream_block, buf, buf);
+
+		tsc = hardclock();
+		for (j = 0; j < 4096; j++)
+			aes_crypt_ctr(&aes, BUFSIZE, &nc_off, tmp,
+				      stream_block, buf, buf);
+
+		printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+		       (hardclock() - tsc) / (j * BUFSIZE));
+	}
+#endif
+
+#if defined(TROPICSSL_GCM)
+	for (keysize = 128; keysize <= 256; keysize += 128) {
+		printf("  AES-GCM-%d:  ", keysize);
+		fflush(stdout);
+
+		memset(buf, 0, sizeof(buf));
+		memset(tmp, 0, sizeof(tmp));
+		gcm_init(&gcm, tmp, keysize);
+
+		set_alarm(1);
+
+		for (i = 1; !alarmed; i++)
+			gcm_crypt_and_tag(&gcm, GCM_ENCRYPT, BUFSIZE, tmp, 12,
+					  NULL, 0, buf, buf, 16, tmp);
+
+		tsc = hardclock();
+		for (j = 0; j < 4096; j++)
+			gcm_crypt_and_tag(&gcm, GCM_ENCRYPT, BUFSIZE, tmp, 12,
+					  NULL, 0, buf, buf, 16, tmp);
+
+		printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+		       (hardclock() - tsc) / (j * BUFSIZE));
+	}
+#endif
+
+#if defined(TROPICSSL_CHACHA20)
+	printf("  CHACHA20  :  ");
+	fflush(stdout);
+
+	memset(tmp, 0, sizeof(tmp));
+	chacha20_setkey(&chacha, tmp);
+	chacha20_starts(&chacha, tmp, 0);
+
+	set_alarm(1);
+
+	for (i = 1; !alarmed; i++)
+		chacha20_update(&chacha, BUFSIZE, buf, buf);
+
+	tsc = hardclock();
+	for (j = 0; j < 4096; j++)
+		chacha20_update(&chacha, BUFSIZE, buf, buf);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
+#endif
+
+#if defined(TROPICSSL_POLY1305)
+	printf("  POLY1305  :  ");
+	fflush(stdout);
+
+	set_alarm(1);
+
+	for (i = 1; !alarmed; i++)
+		poly1305_mac(tmp, buf, BUFSIZE, tmp);
+
+	tsc = hardclock();
+	for (j = 0; j < 4096; j++)
+		poly1305_mac(tmp, buf, BUFSIZE, tmp);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
+#endif
+
+#if defined(TROPICSSL_CHACHAPOLY)
+	printf("  CHACHAPOLY:  ");
+	fflush(stdout);
+
+	memset(tmp, 0, sizeof(tmp));
+	chachapoly_setkey(&chachapoly, tmp);
+
+	set_alarm(1);
+
+	for (i = 1; !alarmed; i++)
+		chachapoly_crypt_and_tag(&chachapoly, CHACHAPOLY_ENCRYPT,
+					 BUFSIZE, tmp, NULL, 0, buf, buf, tmp);
+
+	tsc = hardclock();
+	for (j = 0; j < 4096; j++)
+		chachapoly_crypt_and_tag(&chachapoly, CHACHAPOLY_ENCRYPT,
+					 BUFSIZE, tmp, NULL, 0, buf, buf, tmp);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
 #endif
 
 #if defined(TROPICSSL_CAMELLIA)
@@ -238,9 +450,65 @@ int main(void)
 
 		printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
 		       (hardclock() - tsc) / (j * BUFSIZE));
+
+		printf("  CAMELLIA-%d-D :  ", keysize);
+		fflush(stdout);
+
+		camellia_setkey_dec(&camellia, tmp, keysize);
+
+		set_alarm(1);
+
+		for (i = 1; !alarmed; i++)
+			camellia_crypt_cbc(&camellia, CAMELLIA_DECRYPT, BUFSIZE,
+					   tmp, buf, buf);
+
+		tsc = hardclock();
+		for (j = 0; j < 4096; j++)
+			camellia_crypt_cbc(&camellia, CAMELLIA_DECRYPT, BUFSIZE,
+					   tmp, buf, buf);
+
+		printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+		       (hardclock() - tsc) / (j * BUFSIZE));
 	}
 #endif
 
+#if defined(TROPICSSL_CTR_DRBG_C)
+	printf("  CTR_DRBG     :  ");
+	fflush(stdout);
+
+	ctr_drbg_init(&drbg, myrand, NULL, NULL, 0);
+
+	set_alarm(1);
+	for (i = 1; !alarmed; i++)
+		ctr_drbg_random(&drbg, buf, BUFSIZE);
+
+	tsc = hardclock();
+	for (j = 0; j < 1024; j++)
+		ctr_drbg_random(&drbg, buf, BUFSIZE);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * BUFSIZE / 1024,
+	       (hardclock() - tsc) / (j * BUFSIZE));
+
+	/*
+	 * The size of a hello random or a session id
+	 */
+	printf("  CTR_DRBG (32):  ");
+	fflush(stdout);
+
+	set_alarm(1);
+	for (i = 1; !alarmed; i++)
+		ctr_drbg_random(&drbg, buf, 32);
+
+	tsc = hardclock();
+	for (j = 0; j < 1024; j++)
+		ctr_drbg_random(&drbg, buf, 32);
+
+	printf("%9lu Kb/s,  %9lu cycles/byte\n", i * 32 / 1024,
+	       (hardclock() - tsc) / (j * 32));
+
+	ctr_drbg_free(&drbg);
+#endif
+
 #if defined(TROPICSSL_RSA)
 	rsa_init(&rsa, RSA_PKCS_V15, 0, myrand, NULL);
 	rsa_gen_key(&rsa, 1024, 65537);
@@ -265,7 +533,51 @@ int main(void)
 		rsa_private(&rsa, buf, buf);
 	}
 
-	printf("%9lu private/s\n\n", i / 3);
+	printf("%9lu private/s\n", i / 3);
+
+	{
+		static t_uint wsbuf[4096];
+		mpi_scratch ws;
+
+		mpi_scratch_init(&ws, wsbuf, sizeof(wsbuf) / sizeof(t_uint));
+		mpi_set_scratch(&ws);
+
+		printf("  RSA-1024  :  ");
+		fflush(stdout);
+		set_alarm(3);
+
+		for (i = 1; !alarmed; i++) {
+			buf[0] = 0;
+			rsa_private(&rsa, buf, buf);
+		}
+
+		mpi_set_scratch(NULL);
+
+		printf("%9lu private/s (workspace)\n", i / 3);
+	}
+
+	{
+		const uint8_t *in[MPI_BATCH_LANES];
+		uint8_t *out[MPI_BATCH_LANES];
+
+		for (j = 0; j < MPI_BATCH_LANES; j++) {
+			in[j] = buf + j * 128;
+			out[j] = buf + j * 128;
+		}
+
+		printf("  RSA-1024  :  ");
+		fflush(stdout);
+		set_alarm(3);
+
+		for (i = 1; !alarmed; i++) {
+			for (j = 0; j < MPI_BATCH_LANES; j++)
+				buf[j * 128] = 0;
+			rsa_private_batch(&rsa, MPI_BATCH_LANES, in, out);
+		}
+
+		printf("%9lu private/s (batch)\n\n",
+		       i * MPI_BATCH_LANES / 3);
+	}
 
 	rsa_free(&rsa);
 #endif
@@ -46,14 +46,32 @@
 #include "tropicssl/sha1.h"
 #include "tropicssl/sha2.h"
 #include "tropicssl/sha4.h"
+#include "tropicssl/hashmb.h"
+#include "tropicssl/treehash.h"
 #include "tropicssl/arc4.h"
 #include "tropicssl/des.h"
 #include "tropicssl/aes.h"
+#include "tropicssl/gcm.h"
+#include "tropicssl/chacha20.h"
+#include "tropicssl/poly1305.h"
+#include "tropicssl/chachapoly.h"
+#include "tropicssl/ctr_drbg.h"
+#include "tropicssl/entropy.h"
 #include "tropicssl/base64.h"
 #include "tropicssl/bignum.h"
 #include "tropicssl/rsa.h"
+#include "tropicssl/ecp.h"
 #include "tropicssl/x509.h"
+#include "tropicssl/x509snap.h"
 #include "tropicssl/xtea.h"
+#include "tropicssl/memory.h"
+#include "tropicssl/ssl_cache.h"
+#include "tropicssl/ssl_ticket.h"
+#include "tropicssl/ssl_sni.h"
+#include "tropicssl/ssl_admit.h"
+#include "tropicssl/ssl_shm_cache.h"
+#include "tropicssl/mem_bio.h"
+#include "tropicssl/ssl_engine.h"
 
 int main(int argc, char *argv[])
 {
@@ -86,6 +104,16 @@ int main(int argc, char *argv[])
 		return (ret);
 #endif
 
+#if defined(TROPICSSL_HASHMB)
+	if ((ret = hashmb_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_TREEHASH)
+	if ((ret = treehash_self_test(v)) != 0)
+		return (ret);
+#endif
+
 #if defined(TROPICSSL_ARC4)
 	if ((ret = arc4_self_test(v)) != 0)
 		return (ret);
@@ -101,11 +129,46 @@ int main(int argc, char *argv[])
 		return (ret);
 #endif
 
+#if defined(TROPICSSL_GCM)
+	if ((ret = gcm_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_CHACHA20)
+	if ((ret = chacha20_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_POLY1305)
+	if ((ret = poly1305_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_CHACHAPOLY)
+	if ((ret = chachapoly_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_CTR_DRBG_C)
+	if ((ret = ctr_drbg_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_ENTROPY)
+	if ((ret = entropy_self_test(v)) != 0)
+		return (ret);
+#endif
+
 #if defined(TROPICSSL_BASE64)
 	if ((ret = base64_self_test(v)) != 0)
 		return (ret);
 #endif
 
+#if defined(TROPICSSL_MEMORY)
+	if ((ret = memory_self_test(v)) != 0)
+		return (ret);
+#endif
+
 #if defined(TROPICSSL_BIGNUM)
 	if ((ret = mpi_self_test(v)) != 0)
 		return (ret);
@@ -116,6 +179,61 @@ int main(int argc, char *argv[])
 		return (ret);
 #endif
 
+#if defined(TROPICSSL_ECP)
+	if ((ret = ecp_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_CACHE_C)
+	if ((ret = ssl_cache_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_TICKET_C)
+	if ((ret = ssl_ticket_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_SNI_C)
+	if ((ret = ssl_sni_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_ADMIT_C)
+	if ((ret = ssl_admit_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_SHM_CACHE_C)
+	if ((ret = ssl_shm_cache_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_STATS)
+	if ((ret = ssl_stats_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_TLS_C) && defined(TROPICSSL_CERTS)
+	if ((ret = ssl_gather_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_MEM_BIO_C)
+	if ((ret = mem_bio_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_SSL_ENGINE_C)
+	if ((ret = ssl_engine_self_test(v)) != 0)
+		return (ret);
+#endif
+
+#if defined(TROPICSSL_X509_SNAP_C)
+	if ((ret = x509_snap_self_test(v)) != 0)
+		return (ret);
+#endif
+
 #if defined(TROPICSSL_X509_PARSE)
 	if ((ret = x509_self_test(v)) != 0)
 		return (ret);
@@ -0,0 +1,828 @@
+/*
+ *  SSL/TLS handshake and record benchmark
+ *
+ *  Copyright (C) 2009  Paul Bakker <polarssl_maintainer at polarssl dot org>
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the names of PolarSSL or XySSL nor the names of its contributors
+ *      may be used to endorse or promote products derived from this software
+ *      without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Client and server run in the same process and talk through memory,
+ * so that only the library is measured: full (or resumed) handshakes
+ * per second with their p50/p99 latencies, for each ciphersuite and
+ * over several threads, and the record layer encrypting / decrypting
+ * 64 bytes to 16 KB per record. Results are printed as text, CSV or
+ * JSON, one line / object per measurement.
+ */
+
+#ifndef _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_DEPRECATE 1
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "tropicssl/config.h"
+
+#include "tropicssl/ssl.h"
+#include "tropicssl/ssl_cache.h"
+#include "tropicssl/mem_bio.h"
+#include "tropicssl/havege.h"
+#include "tropicssl/ctr_drbg.h"
+#include "tropicssl/certs.h"
+#include "tropicssl/timing.h"
+
+#define TEST_HANDSHAKE          1
+#define TEST_RECORD             2
+#define TEST_SCALING            4
+#define TEST_ALL                7
+
+#define FORMAT_TEXT             0
+#define FORMAT_CSV              1
+#define FORMAT_JSON             2
+
+#define DFL_TESTS               TEST_ALL
+#define DFL_DURATION            1000
+#define DFL_THREADS             4
+#define DFL_RESUME              0
+#define DFL_FORMAT              FORMAT_TEXT
+#define DFL_STATS               0
+#define DFL_READ_AHEAD          0
+#define DFL_COMPRESS            0
+
+#define MAX_THREADS             64
+
+/*
+ * Each direction of the memory BIO holds a few full records, enough
+ * for any handshake flight and for a batch of application records
+ */
+#define PIPE_SIZE               (4 * SSL_BUFFER_LEN)
+
+char *dhm_G = "4";
+char *dhm_P =
+    "E4004C1F94182000103D883A448B3F802CE4B44A83301270002C20D0321CFD00"
+    "11CCEF784C26A400F43DFB901BCA7538F2C6B176001CF5A0FD16D2C48B1D0C1C"
+    "F6AC8E1DA6BCC3B4E1F96B0564965300FFA1D0B601EB2800F489AA512C4B248C"
+    "01F76949A60BB7F00A40B1EAB64BDD48E8A700D60B7F1200FA8E77B0A979DABF";
+
+static const int record_sizes[] = { 64, 256, 1024, 4096, 16384, 0 };
+
+/*
+ * global options
+ */
+struct options {
+	int tests;		/* which measurements to run            */
+	int cipher;		/* one ciphersuite, or 0 for all        */
+	int duration;		/* milliseconds per measurement         */
+	int threads;		/* max. number of threads for scaling   */
+	int resume;		/* handshakes resume a cached session   */
+	int format;		/* text, csv or json                    */
+	int stats;		/* print the servers' SSL counters      */
+	int read_ahead;		/* receive several records per f_recv   */
+	int compress;		/* DEFLATE level, 0 for none            */
+};
+
+struct options opt;
+
+/*
+ * State shared by all the server contexts
+ */
+ssl_cache_context cache;
+dhm_shared dh;
+#if defined(TROPICSSL_SSL_STATS)
+ssl_stats_sink stats;
+#endif
+
+/*
+ * A client / server pair and everything it needs; one per thread,
+ * as neither the RNG nor the private key may be shared
+ */
+typedef struct {
+	havege_state hs;
+	ctr_drbg_context drbg;
+	x509_cert srvcert;
+	rsa_context rsa;
+	int ciphers[2];
+
+	mem_bio_pair pipe;
+	ssl_context cli;
+	ssl_context srv;
+	ssl_session cli_ssn;
+	ssl_session srv_ssn;
+
+	unsigned long *lat;	/* handshake latencies, in us       */
+	size_t lat_len;
+	size_t lat_max;
+	unsigned long elapsed;	/* run time of the thread, in us    */
+	int ret;
+} bench_peer;
+
+/*
+ * One measurement, as printed
+ */
+typedef struct {
+	const char *test;
+	const char *cipher;
+	int threads;
+	int size;
+	unsigned long ops;
+	double secs;
+	int has_lat;
+	unsigned long p50;
+	unsigned long p99;
+} bench_result;
+
+static int result_count = 0;
+
+static int peer_init(bench_peer * b, int cipher)
+{
+	int ret;
+
+	memset(b, 0, sizeof(bench_peer));
+
+	b->ciphers[0] = cipher;
+	b->ciphers[1] = 0;
+
+	if ((ret = mem_bio_pair_init(&b->pipe, PIPE_SIZE)) != 0)
+		return (ret);
+
+	havege_init(&b->hs);
+
+	if ((ret = ctr_drbg_init(&b->drbg, havege_random, &b->hs,
+				 (const uint8_t *)"ssl_bench", 9)) != 0)
+		return (ret);
+
+	if ((ret = x509parse_crt(&b->srvcert, (uint8_t *)test_srv_crt,
+				 strlen(test_srv_crt))) != 0)
+		return (ret);
+
+	return (x509parse_key(&b->rsa, (uint8_t *)test_srv_key,
+			      strlen(test_srv_key), NULL, 0));
+}
+
+static void peer_free(bench_peer * b)
+{
+	x509_free(&b->srvcert);
+	rsa_free(&b->rsa);
+	mem_bio_pair_free(&b->pipe);
+	free(b->lat);
+	memset(b, 0, sizeof(bench_peer));
+}
+
+/*
+ * Set up a fresh pair of contexts on empty pipes
+ */
+static int pair_open(bench_peer * b)
+{
+	int ret;
+
+	mem_bio_pair_reset(&b->pipe);
+
+	if ((ret = ssl_init(&b->cli)) != 0)
+		return (ret);
+
+	if ((ret = ssl_init(&b->srv)) != 0) {
+		ssl_free(&b->cli);
+		return (ret);
+	}
+
+	ssl_set_endpoint(&b->cli, SSL_IS_CLIENT);
+	ssl_set_authmode(&b->cli, SSL_VERIFY_NONE);
+	ssl_set_rng(&b->cli, ctr_drbg_random, &b->drbg);
+	ssl_set_ciphers(&b->cli, b->ciphers);
+	ssl_set_session(&b->cli, opt.resume, 0, &b->cli_ssn);
+
+	ssl_set_endpoint(&b->srv, SSL_IS_SERVER);
+	ssl_set_authmode(&b->srv, SSL_VERIFY_NONE);
+	ssl_set_rng(&b->srv, ctr_drbg_random, &b->drbg);
+	ssl_set_ciphers(&b->srv, b->ciphers);
+	ssl_set_session(&b->srv, 1, 0, &b->srv_ssn);
+
+	if (opt.resume)
+		ssl_set_session_cache(&b->srv, &cache);
+
+	memset(&b->srv_ssn, 0, sizeof(ssl_session));
+
+	ssl_set_own_cert(&b->srv, &b->srvcert, &b->rsa);
+	ssl_set_dh_shared(&b->srv, &dh);
+#if defined(TROPICSSL_SSL_STATS)
+	if (opt.stats)
+		ssl_set_stats_sink(&b->srv, &stats);
+#endif
+
+	mem_bio_pair_set(&b->pipe, &b->cli, &b->srv);
+
+	if ((opt.read_ahead &&
+	     ((ret = ssl_set_read_ahead(&b->cli, PIPE_SIZE)) != 0 ||
+	      (ret = ssl_set_read_ahead(&b->srv, PIPE_SIZE)) != 0)) ||
+	    (ret = ssl_set_compression(&b->cli, opt.compress)) != 0 ||
+	    (ret = ssl_set_compression(&b->srv, opt.compress)) != 0) {
+		ssl_free(&b->cli);
+		ssl_free(&b->srv);
+		return (ret);
+	}
+
+	return (0);
+}
+
+static void pair_close(bench_peer * b)
+{
+	ssl_free(&b->cli);
+	ssl_free(&b->srv);
+}
+
+static int is_pending(int ret)
+{
+	return (ret == TROPICSSL_ERR_NET_WANT_READ ||
+		ret == TROPICSSL_ERR_NET_WANT_WRITE);
+}
+
+/*
+ * Step both ends in turn until each has finished its handshake
+ */
+static int pair_handshake(bench_peer * b)
+{
+	int rc = 1, rs = 1;
+
+	while (rc != 0 || rs != 0) {
+		if (rc != 0 && !is_pending(rc = ssl_handshake(&b->cli)) &&
+		    rc != 0)
+			return (rc);
+
+		if (rs != 0 && !is_pending(rs = ssl_handshake(&b->srv)) &&
+		    rs != 0)
+			return (rs);
+
+		if (rc != 0 && rs != 0 &&
+		    mem_bio_pending(&b->pipe.c2s) == 0 &&
+		    mem_bio_pending(&b->pipe.s2c) == 0)
+			return (TROPICSSL_ERR_NET_WANT_READ);
+	}
+
+	return (0);
+}
+
+static int add_latency(bench_peer * b, unsigned long us)
+{
+	unsigned long *p;
+
+	if (b->lat_len == b->lat_max) {
+		b->lat_max = (b->lat_max == 0) ? 1024 : b->lat_max * 2;
+
+		p = (unsigned long *)realloc(b->lat,
+					     b->lat_max * sizeof(unsigned long));
+		if (p == NULL)
+			return (1);
+
+		b->lat = p;
+	}
+
+	b->lat[b->lat_len++] = us;
+
+	return (0);
+}
+
+/*
+ * Thread body: handshakes back to back for opt.duration ms
+ */
+static void *run_handshakes(void *arg)
+{
+	int ret;
+	unsigned long us;
+	struct hr_time run, one;
+	bench_peer *b = (bench_peer *) arg;
+
+	/*
+	 * A resumed run needs a session in the cache to begin with
+	 */
+	if (opt.resume) {
+		if ((ret = pair_open(b)) == 0) {
+			ret = pair_handshake(b);
+			pair_close(b);
+		}
+
+		if (ret != 0) {
+			b->ret = ret;
+			return (NULL);
+		}
+	}
+
+	get_timer(&run, 1);
+
+	do {
+		get_timer_us(&one, 1);
+
+		if ((ret = pair_open(b)) != 0) {
+			b->ret = ret;
+			break;
+		}
+
+		ret = pair_handshake(b);
+		us = get_timer_us(&one, 0);
+		pair_close(b);
+
+		if (ret != 0) {
+			b->ret = ret;
+			break;
+		}
+
+		if (add_latency(b, us) != 0) {
+			b->ret = TROPICSSL_ERR_SSL_MALLOC_FAILED;
+			break;
+		}
+	} while (get_timer(&run, 0) < (unsigned long)opt.duration);
+
+	b->elapsed = get_timer_us(&run, 0);
+
+	return (NULL);
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static void print_result(const bench_result * r)
+{
+	double rate = (r->secs > 0) ? r->ops / r->secs : 0;
+	double mbps = rate * r->size / 1000000;
+
+	switch (opt.format) {
+	case FORMAT_CSV:
+		if (result_count == 0)
+			printf("test,cipher,threads,size,ops,seconds,"
+			       "ops_per_sec,mb_per_sec,p50_us,p99_us\n");
+
+		printf("%s,%s,%d,%d,%lu,%.6f,%.1f,%.2f,",
+		       r->test, r->cipher, r->threads, r->size,
+		       r->ops, r->secs, rate, mbps);
+
+		if (r->has_lat)
+			printf("%lu,%lu\n", r->p50, r->p99);
+		else
+			printf(",\n");
+		break;
+
+	case FORMAT_JSON:
+		printf("%s\n  { \"test\": \"%s\", \"cipher\": \"%s\", "
+		       "\"threads\": %d, \"size\": %d, \"ops\": %lu, "
+		       "\"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+		       "\"mb_per_sec\": %.2f",
+		       (result_count == 0) ? "[" : ",",
+		       r->test, r->cipher, r->threads, r->size,
+		       r->ops, r->secs, rate, mbps);
+
+		if (r->has_lat)
+			printf(", \"p50_us\": %lu, \"p99_us\": %lu",
+			       r->p50, r->p99);
+
+		printf(" }");
+		break;
+
+	default:
+		if (r->has_lat)
+			printf("  %-9s %-43s %2d thr: %9.1f /s, "
+			       "p50 %7lu us, p99 %7lu us\n",
+			       r->test, r->cipher, r->threads, rate,
+			       r->p50, r->p99);
+		else
+			printf("  %-9s %-43s %5d B: %9.1f /s, "
+			       "%9.2f MB/s\n",
+			       r->test, r->cipher, r->size, rate, mbps);
+		break;
+	}
+
+	result_count++;
+	fflush(stdout);
+}
+
+/*
+ * Handshakes over 'threads' threads, p50/p99 over all of them
+ */
+static int bench_handshakes(int cipher, int threads)
+{
+	int ret = 0, i;
+	size_t n, k;
+	unsigned long elapsed = 0;
+	unsigned long *all;
+	pthread_t tid[MAX_THREADS];
+	bench_peer *b;
+	bench_result r;
+
+	if ((b = (bench_peer *) malloc(threads * sizeof(bench_peer))) == NULL)
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+	for (i = 0; i < threads; i++) {
+		if ((ret = peer_init(&b[i], cipher)) != 0) {
+			threads = i + 1;
+			goto exit;
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tid[i], NULL, run_handshakes, &b[i]) != 0) {
+			b[i].ret = TROPICSSL_ERR_SSL_MALLOC_FAILED;
+			break;
+		}
+	}
+
+	while (i-- > 0)
+		pthread_join(tid[i], NULL);
+
+	for (i = 0, n = 0; i < threads; i++) {
+		if (b[i].ret != 0)
+			ret = b[i].ret;
+
+		if (b[i].elapsed > elapsed)
+			elapsed = b[i].elapsed;
+
+		n += b[i].lat_len;
+	}
+
+	if (ret != 0 || n == 0)
+		goto exit;
+
+	if ((all = (unsigned long *)malloc(n * sizeof(unsigned long))) == NULL) {
+		ret = TROPICSSL_ERR_SSL_MALLOC_FAILED;
+		goto exit;
+	}
+
+	for (i = 0, k = 0; i < threads; i++) {
+		memcpy(all + k, b[i].lat, b[i].lat_len * sizeof(unsigned long));
+		k += b[i].lat_len;
+	}
+
+	qsort(all, n, sizeof(unsigned long), cmp_ulong);
+
+	memset(&r, 0, sizeof(r));
+	r.test = opt.resume ? "resume" : "handshake";
+	r.cipher = ssl_get_cipher_name(cipher);
+	r.threads = threads;
+	r.ops = n;
+	r.secs = elapsed / 1000000.0;
+	r.has_lat = 1;
+	r.p50 = all[n / 2];
+	r.p99 = all[(n * 99) / 100];
+
+	print_result(&r);
+	free(all);
+
+exit:
+
+	for (i = 0; i < threads; i++)
+		peer_free(&b[i]);
+
+	free(b);
+
+	return (ret);
+}
+
+/*
+ * Client-to-server records of each size, timed in batches that fit
+ * in the pipe: the writes are the encryption, the reads the decryption
+ */
+static int bench_records(int cipher)
+{
+	int ret, i, size, batch, k, got;
+	unsigned long ops, enc_us, dec_us;
+	struct hr_time run, t;
+	bench_peer *b;
+	bench_result r;
+	uint8_t *buf;
+
+	if ((b = (bench_peer *) malloc(sizeof(bench_peer))) == NULL)
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+
+	if ((buf = (uint8_t *)malloc(SSL_MAX_CONTENT_LEN)) == NULL) {
+		free(b);
+		return (TROPICSSL_ERR_SSL_MALLOC_FAILED);
+	}
+
+	memset(buf, 0x2A, SSL_MAX_CONTENT_LEN);
+
+	if ((ret = peer_init(b, cipher)) != 0)
+		goto exit;
+
+	if ((ret = pair_open(b)) != 0)
+		goto exit;
+
+	if ((ret = pair_handshake(b)) != 0)
+		goto close;
+
+	for (i = 0; record_sizes[i] != 0; i++) {
+		size = record_sizes[i];
+		batch = PIPE_SIZE / (size + SSL_BUFFER_OVERHEAD);
+		ops = enc_us = dec_us = 0;
+
+		get_timer(&run, 1);
+
+		do {
+			get_timer_us(&t, 1);
+
+			for (k = 0; k < batch; k++) {
+				if ((ret = ssl_write(&b->cli, buf, size)) < 0)
+					goto close;
+			}
+
+			enc_us += get_timer_us(&t, 1);
+
+			for (k = 0; k < batch; k++) {
+				for (got = 0; got < size; got += ret) {
+					ret = ssl_read(&b->srv, buf + got,
+						       size - got);
+					if (ret <= 0)
+						goto close;
+				}
+			}
+
+			dec_us += get_timer_us(&t, 0);
+			ops += batch;
+		} while (get_timer(&run, 0) < (unsigned long)opt.duration);
+
+		memset(&r, 0, sizeof(r));
+		r.cipher = ssl_get_cipher_name(cipher);
+		r.threads = 1;
+		r.size = size;
+		r.ops = ops;
+
+		r.test = "encrypt";
+		r.secs = enc_us / 1000000.0;
+		print_result(&r);
+
+		r.test = "decrypt";
+		r.secs = dec_us / 1000000.0;
+		print_result(&r);
+	}
+
+	ret = 0;
+
+close:
+
+	pair_close(b);
+
+exit:
+
+	peer_free(b);
+	free(b);
+	free(buf);
+
+	return (ret);
+}
+
+static int find_cipher(const char *name)
+{
+	int i;
+
+	for (i = 0; ssl_default_ciphers[i] != 0; i++)
+		if (strcmp(name, ssl_get_cipher_name(ssl_default_ciphers[i]))
+		    == 0)
+			return (ssl_default_ciphers[i]);
+
+	return (0);
+}
+
+#define USAGE                                                           \
+    "\n usage: ssl_bench param=<>...\n"                                 \
+    "\n acceptable parameters:\n"                                       \
+    "    test=all|handshake|record|scaling  default: all\n"             \
+    "    cipher=<name>       default: all (eg. TLS_RSA_WITH_AES_128_CBC_SHA)\n" \
+    "    duration=%%d         default: 1000 (ms per measurement)\n"     \
+    "    threads=%%d          default: 4 (scaling runs 1, 2, 4.. up to it)\n" \
+    "    resume=on|off       default: off (handshakes resume a session)\n" \
+    "    format=text|csv|json  default: text\n"                      \
+    "    stats=on|off        default: off (print the servers' counters)\n" \
+    "    read_ahead=on|off   default: off (several records per read)\n" \
+    "    compress=%%d         default: 0 (1-9: DEFLATE records, needs\n" \
+    "                        TROPICSSL_ZLIB_SUPPORT)\n\n"
+
+int main(int argc, char *argv[])
+{
+	int ret = 0, i, j, n;
+	int one[2];
+	int *ciphers;
+	char *p, *q;
+
+	opt.tests = DFL_TESTS;
+	opt.cipher = 0;
+	opt.duration = DFL_DURATION;
+	opt.threads = DFL_THREADS;
+	opt.resume = DFL_RESUME;
+	opt.format = DFL_FORMAT;
+	opt.stats = DFL_STATS;
+	opt.read_ahead = DFL_READ_AHEAD;
+	opt.compress = DFL_COMPRESS;
+
+	for (i = 1; i < argc; i++) {
+		p = argv[i];
+
+		if ((q = strchr(p, '=')) == NULL)
+			goto usage;
+
+		*q++ = '\0';
+
+		if (strcmp(p, "test") == 0) {
+			if (strcmp(q, "all") == 0)
+				opt.tests = TEST_ALL;
+			else if (strcmp(q, "handshake") == 0)
+				opt.tests = TEST_HANDSHAKE;
+			else if (strcmp(q, "record") == 0)
+				opt.tests = TEST_RECORD;
+			else if (strcmp(q, "scaling") == 0)
+				opt.tests = TEST_SCALING;
+			else
+				goto usage;
+		} else if (strcmp(p, "cipher") == 0) {
+			if ((opt.cipher = find_cipher(q)) == 0)
+				goto usage;
+		} else if (strcmp(p, "duration") == 0) {
+			opt.duration = atoi(q);
+			if (opt.duration < 1)
+				goto usage;
+		} else if (strcmp(p, "threads") == 0) {
+			opt.threads = atoi(q);
+			if (opt.threads < 1 || opt.threads > MAX_THREADS)
+				goto usage;
+		} else if (strcmp(p, "resume") == 0) {
+			if (strcmp(q, "on") == 0)
+				opt.resume = 1;
+			else if (strcmp(q, "off") == 0)
+				opt.resume = 0;
+			else
+				goto usage;
+		} else if (strcmp(p, "format") == 0) {
+			if (strcmp(q, "text") == 0)
+				opt.format = FORMAT_TEXT;
+			else if (strcmp(q, "csv") == 0)
+				opt.format = FORMAT_CSV;
+			else if (strcmp(q, "json") == 0)
+				opt.format = FORMAT_JSON;
+			else
+				goto usage;
+		} else if (strcmp(p, "read_ahead") == 0) {
+			if (strcmp(q, "on") == 0)
+				opt.read_ahead = 1;
+			else if (strcmp(q, "off") == 0)
+				opt.read_ahead = 0;
+			else
+				goto usage;
+		} else if (strcmp(p, "compress") == 0) {
+			opt.compress = atoi(q);
+			if (opt.compress < 0 || opt.compress > 9)
+				goto usage;
+		} else if (strcmp(p, "stats") == 0) {
+			if (strcmp(q, "on") == 0)
+				opt.stats = 1;
+			else if (strcmp(q, "off") == 0)
+				opt.stats = 0;
+			else
+				goto usage;
+		} else
+			goto usage;
+	}
+
+#if defined(TROPICSSL_SSL_STATS)
+	if (opt.stats && ssl_stats_sink_init(&stats) != 0) {
+		fprintf(stderr, "  ! ssl_stats_sink_init failed\n");
+		return (1);
+	}
+#else
+	if (opt.stats) {
+		fprintf(stderr, "  ! TROPICSSL_SSL_STATS is not defined\n");
+		return (1);
+	}
+#endif
+
+	if ((ret = ssl_cache_init(&cache, 100000)) != 0) {
+		fprintf(stderr, "  ! ssl_cache_init returned %d\n", ret);
+		return (ret);
+	}
+
+	{
+		mpi P, G;
+
+		mpi_init(&P, &G, NULL);
+
+		if ((ret = mpi_read_string(&P, 16, dhm_P)) != 0 ||
+		    (ret = mpi_read_string(&G, 16, dhm_G)) != 0 ||
+		    (ret = dhm_shared_init(&dh, &P, &G, 256)) != 0) {
+			fprintf(stderr, "  ! dhm_shared_init returned %d\n",
+				ret);
+			mpi_free(&G, &P, NULL);
+			ssl_cache_free(&cache);
+			return (ret);
+		}
+
+		mpi_free(&G, &P, NULL);
+	}
+
+	ciphers = ssl_default_ciphers;
+
+	if (opt.cipher != 0) {
+		one[0] = opt.cipher;
+		one[1] = 0;
+		ciphers = one;
+	}
+
+	if (opt.format == FORMAT_TEXT)
+		printf("\n");
+
+	for (i = 0; ciphers[i] != 0; i++) {
+		if ((opt.tests & TEST_HANDSHAKE) &&
+		    (ret = bench_handshakes(ciphers[i], 1)) != 0)
+			goto failed;
+
+		if ((opt.tests & TEST_RECORD) &&
+		    (ret = bench_records(ciphers[i])) != 0)
+			goto failed;
+	}
+
+	/*
+	 * Scaling of the first ciphersuite, 1, 2, 4.. threads
+	 */
+	if (opt.tests & TEST_SCALING) {
+		for (j = 1;; j *= 2) {
+			n = (j < opt.threads) ? j : opt.threads;
+
+			if ((ret = bench_handshakes(ciphers[0], n)) != 0) {
+				i = 0;
+				goto failed;
+			}
+
+			if (n == opt.threads)
+				break;
+		}
+	}
+
+	goto exit;
+
+failed:
+
+	fprintf(stderr, "  ! %s failed: %d\n",
+		ssl_get_cipher_name(ciphers[i]), ret);
+
+exit:
+
+	if (opt.format == FORMAT_JSON)
+		printf("%s\n", (result_count == 0) ? "[]" : "\n]");
+	else if (opt.format == FORMAT_TEXT)
+		printf("\n");
+
+#if defined(TROPICSSL_SSL_STATS)
+	if (opt.stats) {
+		char buf[2048];
+		ssl_stats st;
+
+		/*
+		 * Counters, not results: they go to stderr, out of the way
+		 * of the csv and json output
+		 */
+		fprintf(stderr, "contexts %llu\n", (unsigned long long)
+			ssl_stats_sink_get(&stats, &st));
+
+		if (ssl_stats_write(&st, buf, sizeof(buf)) > 0)
+			fputs(buf, stderr);
+
+		ssl_stats_sink_free(&stats);
+	}
+#endif
+
+	dhm_shared_free(&dh);
+	ssl_cache_free(&cache);
+
+	return (ret);
+
+usage:
+
+	printf(USAGE);
+	return (1);
+}
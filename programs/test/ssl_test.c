@@ -44,6 +44,7 @@
 #include "tropicssl/net.h"
 #include "tropicssl/ssl.h"
 #include "tropicssl/havege.h"
+#include "tropicssl/ctr_drbg.h"
 #include "tropicssl/timing.h"
 #include "tropicssl/certs.h"
 
@@ -156,6 +157,7 @@ static int ssl_test(struct options *opt)
 
 	struct hr_time t;
 	havege_state hs;
+	ctr_drbg_context drbg;
 	ssl_context ssl;
 	ssl_session ssn;
 	x509_cert srvcert;
@@ -166,6 +168,11 @@ static int ssl_test(struct options *opt)
 	havege_init(&hs);
 	get_timer(&t, 1);
 
+	if ((ret = ctr_drbg_init(&drbg, havege_random, &hs, NULL, 0)) != 0) {
+		printf("  ! ctr_drbg_init returned %d\n\n", ret);
+		return (ret);
+	}
+
 	memset(read_state, 0, sizeof(read_state));
 	memset(write_state, 0, sizeof(write_state));
 
@@ -235,7 +242,7 @@ static int ssl_test(struct options *opt)
 
 	ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
 
-	ssl_set_rng(&ssl, havege_rand, &hs);
+	ssl_set_rng(&ssl, ctr_drbg_random, &drbg);
 	ssl_set_dbg(&ssl, my_debug, opt);
 	ssl_set_bio(&ssl, net_recv, &client_fd, net_send, &client_fd);
 
@@ -289,7 +296,8 @@ static int ssl_test(struct options *opt)
 				goto exit;
 			}
 
-			if (ret < 0 && ret != TROPICSSL_ERR_NET_TRY_AGAIN) {
+			if (ret < 0 && ret != TROPICSSL_ERR_NET_WANT_READ &&
+			    ret != TROPICSSL_ERR_NET_WANT_WRITE) {
 				printf("  ! ssl_write returned %d\n\n", ret);
 				break;
 			}
@@ -326,7 +334,8 @@ static int ssl_test(struct options *opt)
 				goto exit;
 			}
 
-			if (ret < 0 && ret != TROPICSSL_ERR_NET_TRY_AGAIN) {
+			if (ret < 0 && ret != TROPICSSL_ERR_NET_WANT_READ &&
+			    ret != TROPICSSL_ERR_NET_WANT_WRITE) {
 				printf("  ! ssl_read returned %d\n\n", ret);
 				break;
 			}